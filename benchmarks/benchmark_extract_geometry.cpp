@@ -0,0 +1,278 @@
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * Microbenchmarks for the geometry code of the extract command: the
+ * contains() checks of bounding box and polygon extracts, building the
+ * bands and grid in the ExtractPolygon constructor, and parsing polygon
+ * files in all supported formats. The polygons are generated with
+ * different numbers of vertices to show how the cost depends on the
+ * polygon complexity and on the number of extracts.
+ */
+
+#include "extract_bbox.hpp"
+#include "extract_polygon.hpp"
+#include "geojson_file_parser.hpp"
+#include "osm_file_parser.hpp"
+#include "poly_file_parser.hpp"
+
+#include <osmium/io/file.hpp>
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm/box.hpp>
+#include <osmium/osm/location.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+
+    // Run each benchmark at least this long.
+    const double min_time = 0.5; // seconds
+
+    const double center_x = 10.0;
+    const double center_y = 50.0;
+
+    // Results are added here so the compiler can't optimize the work away.
+    volatile std::uint64_t sink = 0;
+
+    std::string filter;
+
+    template <typename TFunc>
+    void run_benchmark(const std::string& name, std::size_t items_per_iteration, TFunc&& func) {
+        if (!filter.empty() && name.find(filter) == std::string::npos) {
+            return;
+        }
+
+        using clock = std::chrono::steady_clock;
+
+        func(); // warm up
+
+        std::uint64_t iterations = 1;
+        double elapsed = 0.0;
+        while (true) {
+            const auto start = clock::now();
+            for (std::uint64_t i = 0; i < iterations; ++i) {
+                func();
+            }
+            elapsed = std::chrono::duration<double>(clock::now() - start).count();
+            if (elapsed >= min_time || iterations >= (1ULL << 40U)) {
+                break;
+            }
+            iterations *= elapsed > 0.0 ? std::max<std::uint64_t>(2, static_cast<std::uint64_t>(min_time / elapsed * 1.2)) : 10;
+        }
+
+        const double ns_per_iteration = elapsed * 1e9 / static_cast<double>(iterations);
+        const double items_per_second = static_cast<double>(items_per_iteration * iterations) / elapsed;
+
+        std::cout << std::left << std::setw(40) << name << std::right << std::fixed
+                  << std::setprecision(0) << std::setw(16) << ns_per_iteration << " ns"
+                  << std::setw(12) << iterations
+                  << std::setprecision(0) << std::setw(16) << items_per_second << " items/s\n";
+    }
+
+    // Vertices of a star shaped polygon with the given number of
+    // vertices. The radius varies with the angle, so more vertices mean
+    // a more detailed boundary, as in real-world administrative areas.
+    std::vector<osmium::Location> make_ring(std::size_t num_vertices) {
+        std::vector<osmium::Location> ring;
+        ring.reserve(num_vertices + 1);
+        const double pi = std::acos(-1.0);
+        for (std::size_t i = 0; i < num_vertices; ++i) {
+            const double angle = 2 * pi * static_cast<double>(i) / static_cast<double>(num_vertices);
+            const double radius = num_vertices <= 4 ? 1.0 : 1.0 + 0.2 * std::sin(7 * angle) + ((i % 2) ? 0.02 : 0.0);
+            ring.emplace_back(center_x + radius * std::cos(angle), center_y + radius * std::sin(angle));
+        }
+        ring.push_back(ring.front());
+        return ring;
+    }
+
+    void write_poly_file(const std::string& file_name, const std::vector<osmium::Location>& ring) {
+        std::ofstream out{file_name};
+        out << "benchmark\n1\n" << std::setprecision(9);
+        for (const auto& location : ring) {
+            out << location.lon() << ' ' << location.lat() << '\n';
+        }
+        out << "END\nEND\n";
+    }
+
+    void write_geojson_file(const std::string& file_name, const std::vector<osmium::Location>& ring) {
+        std::ofstream out{file_name};
+        out << "{\"type\": \"Feature\", \"geometry\": {\"type\": \"Polygon\", \"coordinates\": [[" << std::setprecision(9);
+        for (std::size_t i = 0; i < ring.size(); ++i) {
+            out << (i == 0 ? "" : ",") << '[' << ring[i].lon() << ',' << ring[i].lat() << ']';
+        }
+        out << "]]}}\n";
+    }
+
+    void write_osm_file(const std::string& file_name, const std::vector<osmium::Location>& ring) {
+        std::ofstream out{file_name};
+        out << std::setprecision(9);
+        const std::size_t num_nodes = ring.size() - 1;
+        for (std::size_t i = 0; i < num_nodes; ++i) {
+            out << 'n' << (i + 1) << " x" << ring[i].lon() << " y" << ring[i].lat() << '\n';
+        }
+        out << "w1 N";
+        for (std::size_t i = 0; i <= num_nodes; ++i) {
+            out << (i == 0 ? "" : ",") << 'n' << (i % num_nodes + 1);
+        }
+        out << '\n';
+    }
+
+    // Deterministic pseudo-random test locations in the box.
+    std::vector<osmium::Location> make_locations(const osmium::Box& box, std::size_t count) {
+        std::vector<osmium::Location> locations;
+        locations.reserve(count);
+        std::uint32_t state = 12345;
+        const auto next = [&state]() {
+            state = state * 1103515245U + 12345U;
+            return static_cast<double>(state >> 8U) / static_cast<double>(1U << 24U);
+        };
+        const double width = box.top_right().lon() - box.bottom_left().lon();
+        const double height = box.top_right().lat() - box.bottom_left().lat();
+        for (std::size_t i = 0; i < count; ++i) {
+            const double x = box.bottom_left().lon() + width * next();
+            const double y = box.bottom_left().lat() + height * next();
+            locations.emplace_back(x, y);
+        }
+        return locations;
+    }
+
+    template <typename TExtract>
+    std::uint64_t count_contained(const TExtract& extract, const std::vector<osmium::Location>& locations) {
+        std::uint64_t count = 0;
+        for (const auto& location : locations) {
+            if (extract.contains(location)) {
+                ++count;
+            }
+        }
+        return count;
+    }
+
+} // anonymous namespace
+
+int main(int argc, char* argv[]) {
+    std::string directory{"."};
+
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg{argv[i]};
+        if (arg.substr(0, 9) == "--filter=") {
+            filter = arg.substr(9);
+        } else if (arg == "-h" || arg == "--help") {
+            std::cout << "Usage: " << argv[0] << " [--filter=STRING] [DIRECTORY]\n";
+            return 0;
+        } else {
+            directory = arg;
+        }
+    }
+
+    const osmium::io::File output_file{"benchmark.osm"};
+    const std::vector<std::size_t> sizes{4, 100, 10000, 200000};
+    const std::size_t num_locations = 100000;
+
+    try {
+        const osmium::Box envelope{center_x - 1.3, center_y - 1.3, center_x + 1.3, center_y + 1.3};
+        const auto locations = make_locations(envelope, num_locations);
+
+        run_benchmark("bbox_contains", num_locations, [&]() {
+            const ExtractBBox extract{output_file, "", envelope};
+            sink += count_contained(extract, locations);
+        });
+
+        for (const auto size : sizes) {
+            const auto ring = make_ring(size);
+            const std::string suffix = "/" + std::to_string(size);
+
+            const std::string base_name = directory + "/benchmark-polygon-" + std::to_string(size);
+            write_poly_file(base_name + ".poly", ring);
+            write_geojson_file(base_name + ".geojson", ring);
+            write_osm_file(base_name + ".osm.opl", ring);
+
+            run_benchmark("parse_poly" + suffix, size, [&]() {
+                osmium::memory::Buffer buffer{1024, osmium::memory::Buffer::auto_grow::yes};
+                PolyFileParser parser{buffer, base_name + ".poly"};
+                sink += parser();
+            });
+
+            run_benchmark("parse_geojson" + suffix, size, [&]() {
+                osmium::memory::Buffer buffer{1024, osmium::memory::Buffer::auto_grow::yes};
+                GeoJSONFileParser parser{buffer, base_name + ".geojson"};
+                sink += parser();
+            });
+
+            run_benchmark("parse_osm" + suffix, size, [&]() {
+                osmium::memory::Buffer buffer{1024, osmium::memory::Buffer::auto_grow::yes};
+                OSMFileParser parser{buffer, base_name + ".osm.opl"};
+                sink += parser();
+            });
+
+            osmium::memory::Buffer buffer{1024, osmium::memory::Buffer::auto_grow::yes};
+            PolyFileParser parser{buffer, base_name + ".poly"};
+            const auto offset = parser();
+
+            run_benchmark("polygon_construct" + suffix, size, [&]() {
+                const ExtractPolygon extract{output_file, "", buffer, offset};
+                sink += extract.envelope().valid() ? 1 : 0;
+            });
+
+            const ExtractPolygon extract{output_file, "", buffer, offset};
+            run_benchmark("polygon_contains" + suffix, num_locations, [&]() {
+                sink += count_contained(extract, locations);
+            });
+        }
+
+        // Same polygon used for several extracts to compare the cost of
+        // more extracts with the cost of more detailed polygons.
+        const std::size_t detailed_size = 10000;
+        const std::string base_name = directory + "/benchmark-polygon-" + std::to_string(detailed_size);
+        osmium::memory::Buffer buffer{1024, osmium::memory::Buffer::auto_grow::yes};
+        PolyFileParser parser{buffer, base_name + ".poly"};
+        const auto offset = parser();
+        for (const std::size_t num_extracts : {1, 10, 100}) {
+            std::vector<std::unique_ptr<ExtractPolygon>> extracts;
+            for (std::size_t i = 0; i < num_extracts; ++i) {
+                extracts.emplace_back(new ExtractPolygon{output_file, "", buffer, offset});
+            }
+            const std::size_t count = num_locations / num_extracts;
+            const std::vector<osmium::Location> some_locations(locations.begin(), locations.begin() + static_cast<std::ptrdiff_t>(count));
+            run_benchmark("polygon_contains_extracts/" + std::to_string(num_extracts) + "x" + std::to_string(detailed_size), count * num_extracts, [&]() {
+                for (const auto& e : extracts) {
+                    sink += count_contained(*e, some_locations);
+                }
+            });
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,364 @@
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * Generates the synthetic data files used by the benchmarks and a
+ * datasets.json file with the number of objects in each of them. The
+ * data only depends on the scale factor, so results from different runs
+ * can be compared.
+ */
+
+#include <osmium/builder/osm_object_builder.hpp>
+#include <osmium/io/any_output.hpp>
+#include <osmium/io/file.hpp>
+#include <osmium/io/header.hpp>
+#include <osmium/io/writer.hpp>
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm/box.hpp>
+#include <osmium/osm/item_type.hpp>
+#include <osmium/osm/location.hpp>
+#include <osmium/osm/timestamp.hpp>
+#include <osmium/osm/types.hpp>
+
+#include <rapidjson/prettywriter.h>
+#include <rapidjson/stringbuffer.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+    // All objects are written with this timestamp (plus one day for each
+    // version in the history file).
+    const std::time_t base_time = 1514764800; // 2018-01-01T00:00:00Z
+
+    const std::size_t buffer_size = 1024UL * 1024UL;
+
+    using tags_type = std::vector<std::pair<const char*, const char*>>;
+
+    // Distance between neighbouring nodes on the grid in degrees.
+    const double grid_step = 0.0001;
+
+    class DataWriter {
+
+        osmium::io::Writer m_writer;
+        osmium::memory::Buffer m_buffer{buffer_size, osmium::memory::Buffer::auto_grow::yes};
+        std::uint64_t m_count = 0;
+
+        static osmium::io::Header make_header(const osmium::Box& box, bool history) {
+            osmium::io::Header header;
+            header.set("generator", "osmium benchmark data generator");
+            header.set_has_multiple_object_versions(history);
+            header.add_box(box);
+            return header;
+        }
+
+        template <typename TBuilder>
+        void set_attributes(TBuilder& builder, osmium::object_id_type id, osmium::object_version_type version) {
+            builder.set_id(id);
+            builder.set_version(version);
+            builder.set_changeset(static_cast<osmium::changeset_id_type>(id / 100 + version));
+            builder.set_timestamp(osmium::Timestamp{base_time + static_cast<std::time_t>(version - 1) * 24 * 60 * 60});
+            builder.set_uid(static_cast<osmium::user_id_type>(id % 1000 + 1));
+            builder.set_user("bench");
+        }
+
+        void commit() {
+            m_buffer.commit();
+            ++m_count;
+            if (m_buffer.committed() > buffer_size - 64UL * 1024UL) {
+                m_writer(std::move(m_buffer));
+                m_buffer = osmium::memory::Buffer{buffer_size, osmium::memory::Buffer::auto_grow::yes};
+            }
+        }
+
+    public:
+
+        DataWriter(const std::string& filename, const osmium::Box& box, bool history = false) :
+            m_writer(osmium::io::File{filename}, make_header(box, history), osmium::io::overwrite::allow) {
+        }
+
+        void node(osmium::object_id_type id, const osmium::Location& location, const tags_type& tags, osmium::object_version_type version = 1) {
+            {
+                osmium::builder::NodeBuilder builder{m_buffer};
+                set_attributes(builder, id, version);
+                builder.set_location(location);
+                if (!tags.empty()) {
+                    osmium::builder::TagListBuilder tl_builder{builder};
+                    for (const auto& tag : tags) {
+                        tl_builder.add_tag(tag.first, tag.second);
+                    }
+                }
+            }
+            commit();
+        }
+
+        void way(osmium::object_id_type id, const std::vector<osmium::object_id_type>& nodes, const tags_type& tags, osmium::object_version_type version = 1) {
+            {
+                osmium::builder::WayBuilder builder{m_buffer};
+                set_attributes(builder, id, version);
+                {
+                    osmium::builder::WayNodeListBuilder wnl_builder{builder};
+                    for (const auto ref : nodes) {
+                        wnl_builder.add_node_ref(ref);
+                    }
+                }
+                osmium::builder::TagListBuilder tl_builder{builder};
+                for (const auto& tag : tags) {
+                    tl_builder.add_tag(tag.first, tag.second);
+                }
+            }
+            commit();
+        }
+
+        void relation(osmium::object_id_type id, const std::vector<std::pair<osmium::item_type, osmium::object_id_type>>& members, const tags_type& tags) {
+            {
+                osmium::builder::RelationBuilder builder{m_buffer};
+                set_attributes(builder, id, 1);
+                {
+                    osmium::builder::RelationMemberListBuilder rml_builder{builder};
+                    for (const auto& member : members) {
+                        rml_builder.add_member(member.first, member.second, member.first == osmium::item_type::way ? "outer" : "");
+                    }
+                }
+                osmium::builder::TagListBuilder tl_builder{builder};
+                for (const auto& tag : tags) {
+                    tl_builder.add_tag(tag.first, tag.second);
+                }
+            }
+            commit();
+        }
+
+        std::uint64_t close() {
+            if (m_buffer.committed() > 0) {
+                m_writer(std::move(m_buffer));
+            }
+            m_writer.close();
+            return m_count;
+        }
+
+    }; // class DataWriter
+
+    osmium::Location grid_location(std::size_t x, std::size_t y) {
+        return osmium::Location{static_cast<double>(x) * grid_step, static_cast<double>(y) * grid_step};
+    }
+
+    osmium::Box grid_box(std::size_t side) {
+        return osmium::Box{0.0, 0.0, static_cast<double>(side) * grid_step, static_cast<double>(side) * grid_step};
+    }
+
+    // A dense grid of nodes. Every row is a way, every tenth cell has a
+    // closed way (a building) and every hundredth building is also a
+    // multipolygon relation.
+    std::uint64_t generate_grid(const std::string& filename, std::size_t scale) {
+        const std::size_t side = 500 * scale;
+        DataWriter writer{filename, grid_box(side)};
+
+        const auto node_id = [side](std::size_t x, std::size_t y) {
+            return static_cast<osmium::object_id_type>(y * side + x + 1);
+        };
+
+        for (std::size_t y = 0; y < side; ++y) {
+            for (std::size_t x = 0; x < side; ++x) {
+                if (x % 50 == 0 && y % 50 == 0) {
+                    writer.node(node_id(x, y), grid_location(x, y), {{"amenity", "bench"}});
+                } else {
+                    writer.node(node_id(x, y), grid_location(x, y), {});
+                }
+            }
+        }
+
+        osmium::object_id_type way_id = 1;
+        for (std::size_t y = 0; y < side; ++y) {
+            std::vector<osmium::object_id_type> nodes;
+            for (std::size_t x = 0; x < side; ++x) {
+                nodes.push_back(node_id(x, y));
+            }
+            writer.way(way_id++, nodes, {{"highway", "residential"}, {"name", "Grid Street"}});
+        }
+
+        std::vector<osmium::object_id_type> buildings;
+        for (std::size_t y = 0; y + 1 < side; y += 10) {
+            for (std::size_t x = 0; x + 1 < side; x += 10) {
+                const std::vector<osmium::object_id_type> nodes{node_id(x, y), node_id(x + 1, y), node_id(x + 1, y + 1), node_id(x, y + 1), node_id(x, y)};
+                buildings.push_back(way_id);
+                if (buildings.size() % 100 == 0) {
+                    writer.way(way_id++, nodes, {});
+                } else {
+                    writer.way(way_id++, nodes, {{"building", "yes"}});
+                }
+            }
+        }
+
+        osmium::object_id_type relation_id = 1;
+        for (std::size_t i = 99; i < buildings.size(); i += 100) {
+            writer.relation(relation_id++, {{osmium::item_type::way, buildings[i]}}, {{"type", "multipolygon"}, {"landuse", "grass"}});
+        }
+
+        return writer.close();
+    }
+
+    // A few very long ways.
+    std::uint64_t generate_long_ways(const std::string& filename, std::size_t scale) {
+        const std::size_t num_ways = 100 * scale;
+        const std::size_t way_length = 10000;
+        DataWriter writer{filename, grid_box(way_length)};
+
+        for (std::size_t w = 0; w < num_ways; ++w) {
+            for (std::size_t n = 0; n < way_length; ++n) {
+                writer.node(static_cast<osmium::object_id_type>(w * way_length + n + 1), grid_location(n, w), {});
+            }
+        }
+
+        for (std::size_t w = 0; w < num_ways; ++w) {
+            std::vector<osmium::object_id_type> nodes;
+            nodes.reserve(way_length);
+            for (std::size_t n = 0; n < way_length; ++n) {
+                nodes.push_back(static_cast<osmium::object_id_type>(w * way_length + n + 1));
+            }
+            writer.way(static_cast<osmium::object_id_type>(w + 1), nodes, {{"natural", "coastline"}});
+        }
+
+        return writer.close();
+    }
+
+    // Chains of relations each containing the one before it, up to a
+    // depth of 100, plus some node members.
+    std::uint64_t generate_relations(const std::string& filename, std::size_t scale) {
+        const std::size_t num_nodes = 10000;
+        const std::size_t num_relations = 20000 * scale;
+        const std::size_t depth = 100;
+        DataWriter writer{filename, grid_box(100)};
+
+        for (std::size_t n = 0; n < num_nodes; ++n) {
+            writer.node(static_cast<osmium::object_id_type>(n + 1), grid_location(n % 100, n / 100), {});
+        }
+
+        for (std::size_t r = 0; r < num_relations; ++r) {
+            std::vector<std::pair<osmium::item_type, osmium::object_id_type>> members;
+            members.emplace_back(osmium::item_type::node, static_cast<osmium::object_id_type>(r % num_nodes + 1));
+            members.emplace_back(osmium::item_type::node, static_cast<osmium::object_id_type>((r * 7) % num_nodes + 1));
+            if (r % depth != 0) {
+                members.emplace_back(osmium::item_type::relation, static_cast<osmium::object_id_type>(r));
+            }
+            writer.relation(static_cast<osmium::object_id_type>(r + 1), members, {{"type", "collection"}});
+        }
+
+        return writer.close();
+    }
+
+    // Objects with many versions each.
+    std::uint64_t generate_history(const std::string& filename, std::size_t scale) {
+        const std::size_t side = 200 * scale;
+        const osmium::object_version_type versions = 10;
+        DataWriter writer{filename, grid_box(side), true};
+
+        const tags_type no_tags;
+        const tags_type changed_tags{{"note", "changed"}};
+
+        for (std::size_t y = 0; y < side; ++y) {
+            for (std::size_t x = 0; x < side; ++x) {
+                const auto id = static_cast<osmium::object_id_type>(y * side + x + 1);
+                for (osmium::object_version_type v = 1; v <= versions; ++v) {
+                    writer.node(id, grid_location(x, y), v % 2 ? no_tags : changed_tags, v);
+                }
+            }
+        }
+
+        for (std::size_t y = 0; y < side; ++y) {
+            std::vector<osmium::object_id_type> nodes;
+            for (std::size_t x = 0; x < side; ++x) {
+                nodes.push_back(static_cast<osmium::object_id_type>(y * side + x + 1));
+            }
+            for (osmium::object_version_type v = 1; v <= versions / 2; ++v) {
+                writer.way(static_cast<osmium::object_id_type>(y + 1), nodes, {{"highway", "track"}}, v);
+            }
+        }
+
+        return writer.close();
+    }
+
+} // anonymous namespace
+
+int main(int argc, char* argv[]) {
+    std::size_t scale = 1;
+    std::string directory;
+
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg{argv[i]};
+        if (arg.substr(0, 8) == "--scale=") {
+            scale = std::strtoul(arg.substr(8).c_str(), nullptr, 10);
+        } else {
+            directory = arg;
+        }
+    }
+
+    if (directory.empty() || scale == 0) {
+        std::cerr << "Usage: " << argv[0] << " [--scale=N] DIRECTORY\n";
+        return 2;
+    }
+
+    using generator_type = std::uint64_t (*)(const std::string&, std::size_t);
+    const std::vector<std::pair<const char*, generator_type>> datasets{
+        {"grid", generate_grid},
+        {"long-ways", generate_long_ways},
+        {"relations", generate_relations},
+        {"history", generate_history}
+    };
+
+    rapidjson::StringBuffer stream;
+    rapidjson::PrettyWriter<rapidjson::StringBuffer> json{stream};
+    json.StartObject();
+
+    try {
+        for (const auto& dataset : datasets) {
+            const std::string file_name = std::string{dataset.first} + (std::string{dataset.first} == "history" ? ".osh.pbf" : ".osm.pbf");
+            std::cerr << "Generating " << file_name << "...\n";
+            const auto count = dataset.second(directory + "/" + file_name, scale);
+
+            json.String(dataset.first);
+            json.StartObject();
+            json.String("file");
+            json.String(file_name.c_str());
+            json.String("objects");
+            json.Uint64(count);
+            json.EndObject();
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << '\n';
+        return 1;
+    }
+
+    json.EndObject();
+
+    std::ofstream out{directory + "/datasets.json"};
+    out << stream.GetString() << '\n';
+
+    return 0;
+}
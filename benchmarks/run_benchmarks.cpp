@@ -0,0 +1,339 @@
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * Runs the osmium commands on the data created by generate_data and
+ * reports their throughput. Each benchmark is run several times and the
+ * fastest run is used. The wall time is taken from the file written by
+ * the --metrics option, so process startup is not included.
+ *
+ * The results can be saved as baselines and compared with baselines
+ * saved earlier. A benchmark which is slower than its baseline by more
+ * than the tolerance makes the program exit with an error.
+ */
+
+#include <osmium/util/file.hpp>
+
+#include <rapidjson/document.h>
+#include <rapidjson/istreamwrapper.h>
+#include <rapidjson/prettywriter.h>
+#include <rapidjson/stringbuffer.h>
+
+#include <boost/program_options.hpp>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace po = boost::program_options;
+
+namespace {
+
+    struct benchmark {
+        const char* name;
+        const char* dataset;
+        const char* command;
+        const char* arguments; // {in} and {out} are replaced
+    };
+
+    const std::vector<benchmark> benchmarks{
+        {"cat-pbf",               "grid",      "cat",                   "-O -o {out}.osm.pbf {in}"},
+        {"cat-opl",               "grid",      "cat",                   "-O -o {out}.opl {in}"},
+        {"cat-history",           "history",   "cat",                   "-O -o {out}.osh.pbf {in}"},
+        {"fileinfo",              "grid",      "fileinfo",              "-e {in} >{out}.txt"},
+        {"check-refs",            "grid",      "check-refs",            "-r {in}"},
+        {"sort-simple",           "grid",      "sort",                  "-O -o {out}.osm.pbf {in}"},
+        {"sort-multipass",        "history",   "sort",                  "-s multipass -O -o {out}.osh.pbf {in}"},
+        {"add-locations-to-ways", "long-ways", "add-locations-to-ways", "-O -o {out}.osm.pbf {in}"},
+        {"extract-simple",        "grid",      "extract",               "-s simple -b 0,0,0.025,0.025 -O -o {out}.osm.pbf {in}"},
+        {"extract-complete-ways", "grid",      "extract",               "-s complete_ways -b 0,0,0.025,0.025 -O -o {out}.osm.pbf {in}"},
+        {"extract-smart",         "grid",      "extract",               "-s smart -b 0,0,0.025,0.025 -O -o {out}.osm.pbf {in}"},
+        {"extract-relations",     "relations", "extract",               "-s smart -b 0,0,0.005,0.005 -O -o {out}.osm.pbf {in}"},
+        {"export",                "grid",      "export",                "-O -f geojsonseq -o {out}.geojsonseq {in}"},
+        {"tags-filter",           "grid",      "tags-filter",           "-O -o {out}.osm.pbf {in} w/highway"},
+        {"getid-relations",       "relations", "getid",                 "-r -O -o {out}.osm.pbf {in} r1000"},
+        {"renumber",              "grid",      "renumber",              "-O -o {out}.osm.pbf {in}"},
+        {"time-filter",           "history",   "time-filter",           "-O -o {out}.osm.pbf {in} 2018-01-05T00:00:00Z"}
+    };
+
+    struct result {
+        double wall_time = 0.0;
+        double objects_per_second = 0.0;
+        double mbytes_per_second = 0.0;
+        int peak_memory = 0;
+    };
+
+    void replace_all(std::string& str, const std::string& from, const std::string& to) {
+        for (auto pos = str.find(from); pos != std::string::npos; pos = str.find(from, pos + to.size())) {
+            str.replace(pos, from.size(), to);
+        }
+    }
+
+    rapidjson::Document read_json(const std::string& filename) {
+        std::ifstream file{filename};
+        if (!file.is_open()) {
+            throw std::runtime_error{"Could not open file '" + filename + "'"};
+        }
+        rapidjson::IStreamWrapper stream_wrapper{file};
+
+        rapidjson::Document doc;
+        if (doc.ParseStream(stream_wrapper).HasParseError() || !doc.IsObject()) {
+            throw std::runtime_error{"Could not parse JSON file '" + filename + "'"};
+        }
+        return doc;
+    }
+
+    double get_number(const rapidjson::Value& object, const char* key) {
+        const auto it = object.FindMember(key);
+        if (it == object.MemberEnd() || !it->value.IsNumber()) {
+            return 0.0;
+        }
+        return it->value.GetDouble();
+    }
+
+    // Run the benchmark once and return the wall time and peak memory
+    // from the metrics file.
+    bool run_once(const std::string& command_line, const std::string& metrics_file, result& res) {
+        std::remove(metrics_file.c_str());
+        if (std::system(command_line.c_str()) != 0) {
+            return false;
+        }
+        const auto metrics = read_json(metrics_file);
+        res.wall_time = get_number(metrics, "wall_time");
+        res.peak_memory = static_cast<int>(get_number(metrics, "peak_memory_mb"));
+        return true;
+    }
+
+    void save_baselines(const std::string& filename, const std::vector<std::pair<std::string, result>>& results) {
+        rapidjson::StringBuffer stream;
+        rapidjson::PrettyWriter<rapidjson::StringBuffer> writer{stream};
+
+        writer.StartObject();
+        for (const auto& r : results) {
+            writer.String(r.first.c_str());
+            writer.StartObject();
+            writer.String("wall_time");
+            writer.Double(r.second.wall_time);
+            writer.String("objects_per_second");
+            writer.Double(r.second.objects_per_second);
+            writer.String("mbytes_per_second");
+            writer.Double(r.second.mbytes_per_second);
+            writer.EndObject();
+        }
+        writer.EndObject();
+
+        std::ofstream out{filename};
+        if (!out.is_open()) {
+            throw std::runtime_error{"Could not open file '" + filename + "'"};
+        }
+        out << stream.GetString() << '\n';
+    }
+
+} // anonymous namespace
+
+int main(int argc, char* argv[]) {
+    std::string osmium;
+    std::string data_dir;
+    std::string baselines_file;
+    std::string save_file;
+    std::string filter;
+    int repeat = 3;
+    double tolerance = 10.0;
+
+    po::options_description opts_cmdline{"OPTIONS"};
+    opts_cmdline.add_options()
+    ("help,h", "Show usage help")
+    ("baselines,b", po::value<std::string>(), "Compare with baselines in this file")
+    ("save,s", po::value<std::string>(), "Save results as baselines to this file")
+    ("filter,f", po::value<std::string>(), "Only run benchmarks with names containing this string")
+    ("repeat,r", po::value<int>(), "Run each benchmark this many times (default: 3)")
+    ("tolerance,t", po::value<double>(), "Allowed slowdown against baseline in percent (default: 10)")
+    ;
+
+    po::options_description opts_hidden;
+    opts_hidden.add_options()
+    ("osmium", po::value<std::string>(), "Osmium binary")
+    ("data-dir", po::value<std::string>(), "Directory with benchmark data")
+    ;
+
+    po::options_description desc;
+    desc.add(opts_cmdline).add(opts_hidden);
+
+    po::positional_options_description positional;
+    positional.add("osmium", 1);
+    positional.add("data-dir", 1);
+
+    try {
+        po::variables_map vm;
+        po::store(po::command_line_parser(argc, argv).options(desc).positional(positional).run(), vm);
+        po::notify(vm);
+
+        if (vm.count("help") || !vm.count("osmium") || !vm.count("data-dir")) {
+            std::cout << "Usage: " << argv[0] << " [OPTIONS] OSMIUM DATA-DIR\n\n" << opts_cmdline;
+            return vm.count("help") ? 0 : 2;
+        }
+
+        osmium = vm["osmium"].as<std::string>();
+        data_dir = vm["data-dir"].as<std::string>();
+        if (vm.count("baselines")) {
+            baselines_file = vm["baselines"].as<std::string>();
+        }
+        if (vm.count("save")) {
+            save_file = vm["save"].as<std::string>();
+        }
+        if (vm.count("filter")) {
+            filter = vm["filter"].as<std::string>();
+        }
+        if (vm.count("repeat")) {
+            repeat = vm["repeat"].as<int>();
+            if (repeat < 1) {
+                throw std::runtime_error{"The --repeat option needs a positive number."};
+            }
+        }
+        if (vm.count("tolerance")) {
+            tolerance = vm["tolerance"].as<double>();
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error parsing command line: " << e.what() << '\n';
+        return 2;
+    }
+
+    try {
+        const auto datasets = read_json(data_dir + "/datasets.json");
+
+        rapidjson::Document baselines;
+        bool have_baselines = false;
+        if (!baselines_file.empty()) {
+            std::ifstream file{baselines_file};
+            if (file.is_open()) {
+                baselines = read_json(baselines_file);
+                have_baselines = true;
+            } else {
+                std::cerr << "No baselines in '" << baselines_file << "' (save them with --save).\n";
+            }
+        }
+
+        std::vector<std::pair<std::string, result>> results;
+        int failed = 0;
+        int regressions = 0;
+
+        std::cout << std::left << std::setw(24) << "BENCHMARK" << std::right
+                  << std::setw(10) << "TIME (s)"
+                  << std::setw(14) << "OBJECTS/s"
+                  << std::setw(10) << "MB/s"
+                  << std::setw(10) << "PEAK MB"
+                  << std::setw(12) << "BASELINE" << '\n';
+
+        for (const auto& b : benchmarks) {
+            if (!filter.empty() && std::string{b.name}.find(filter) == std::string::npos) {
+                continue;
+            }
+
+            const auto ds = datasets.FindMember(b.dataset);
+            if (ds == datasets.MemberEnd() || !ds->value.IsObject()) {
+                throw std::runtime_error{std::string{"Unknown dataset '"} + b.dataset + "' in datasets.json"};
+            }
+            const std::string input = data_dir + "/" + ds->value["file"].GetString();
+            const auto objects = get_number(ds->value, "objects");
+            const auto mbytes = static_cast<double>(osmium::file_size(input)) / (1000 * 1000);
+
+            const std::string metrics_file = data_dir + "/" + b.name + ".metrics.json";
+            std::string arguments{b.arguments};
+            replace_all(arguments, "{in}", "\"" + input + "\"");
+            replace_all(arguments, "{out}", "\"" + data_dir + "/out-" + b.name + "\"");
+            const std::string command_line = "\"" + osmium + "\" " + b.command + " --metrics=\"" + metrics_file + "\" " + arguments;
+
+            result best;
+            bool ok = true;
+            for (int i = 0; i < repeat; ++i) {
+                result res;
+                if (!run_once(command_line, metrics_file, res)) {
+                    ok = false;
+                    break;
+                }
+                if (i == 0 || res.wall_time < best.wall_time) {
+                    best = res;
+                }
+            }
+
+            std::cout << std::left << std::setw(24) << b.name << std::right;
+            if (!ok) {
+                std::cout << "  FAILED: " << command_line << '\n';
+                ++failed;
+                continue;
+            }
+
+            if (best.wall_time > 0.0) {
+                best.objects_per_second = objects / best.wall_time;
+                best.mbytes_per_second = mbytes / best.wall_time;
+            }
+
+            std::cout << std::fixed << std::setprecision(3) << std::setw(10) << best.wall_time
+                      << std::setprecision(0) << std::setw(14) << best.objects_per_second
+                      << std::setprecision(1) << std::setw(10) << best.mbytes_per_second
+                      << std::setw(10) << best.peak_memory;
+
+            if (have_baselines) {
+                const auto base = baselines.FindMember(b.name);
+                if (base != baselines.MemberEnd() && base->value.IsObject()) {
+                    const auto base_ops = get_number(base->value, "objects_per_second");
+                    if (base_ops > 0.0) {
+                        const auto change = 100.0 * (best.objects_per_second - base_ops) / base_ops;
+                        std::cout << std::setw(11) << std::showpos << change << std::noshowpos << '%';
+                        if (change < -tolerance) {
+                            std::cout << "  REGRESSION";
+                            ++regressions;
+                        }
+                    }
+                } else {
+                    std::cout << std::setw(12) << "-";
+                }
+            }
+            std::cout << '\n';
+
+            results.emplace_back(b.name, best);
+        }
+
+        if (!save_file.empty()) {
+            save_baselines(save_file, results);
+            std::cout << "Saved baselines to '" << save_file << "'.\n";
+        }
+
+        if (failed > 0 || regressions > 0) {
+            std::cout << failed << " benchmarks failed, " << regressions << " slower than baseline by more than " << tolerance << "%.\n";
+            return 1;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,192 @@
+#ifndef ADAPTIVE_ID_SET_HPP
+#define ADAPTIVE_ID_SET_HPP
+
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <osmium/index/id_set.hpp>
+#include <osmium/osm/types.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+/**
+ * Set of IDs which keeps a small number of IDs in a sorted vector and
+ * switches to an IdSetDense once it gets larger. Looking up an ID in
+ * the vector is a binary search on a few cache lines instead of going
+ * through the chunk table of the dense set, and the set doesn't need
+ * a whole chunk of memory for a few IDs. Used for the IDs requested on
+ * the command line or in ID files, which are often only a handful.
+ *
+ * Has the same interface as the IdSetDense as far as it is used in
+ * osmium. Iteration is in order of IDs in both cases.
+ */
+class AdaptiveIdSet {
+
+    using dense_set_type = osmium::index::IdSetDense<osmium::unsigned_object_id_type>;
+    using dense_iterator = decltype(std::declval<const dense_set_type&>().begin());
+    using small_iterator = std::vector<osmium::unsigned_object_id_type>::const_iterator;
+
+    // Inserting into the middle of the vector moves all IDs after it,
+    // so it must not get too large.
+    static constexpr const std::size_t max_small_size = 4096;
+
+    std::vector<osmium::unsigned_object_id_type> m_small;
+    dense_set_type m_dense;
+    bool m_is_dense = false;
+
+    void convert_to_dense() {
+        for (const auto id : m_small) {
+            m_dense.set(id);
+        }
+        std::vector<osmium::unsigned_object_id_type>{}.swap(m_small);
+        m_is_dense = true;
+    }
+
+public:
+
+    class const_iterator {
+
+        small_iterator m_small_it;
+        dense_iterator m_dense_it;
+        bool m_is_dense;
+
+    public:
+
+        using iterator_category = std::forward_iterator_tag;
+        using value_type        = osmium::unsigned_object_id_type;
+        using difference_type   = std::ptrdiff_t;
+        using pointer           = const value_type*;
+        using reference         = value_type;
+
+        const_iterator(small_iterator small_it, dense_iterator dense_it, bool is_dense) :
+            m_small_it(small_it),
+            m_dense_it(dense_it),
+            m_is_dense(is_dense) {
+        }
+
+        value_type operator*() const {
+            return m_is_dense ? *m_dense_it : *m_small_it;
+        }
+
+        const_iterator& operator++() {
+            if (m_is_dense) {
+                ++m_dense_it;
+            } else {
+                ++m_small_it;
+            }
+            return *this;
+        }
+
+        const_iterator operator++(int) {
+            const_iterator tmp{*this};
+            operator++();
+            return tmp;
+        }
+
+        bool operator==(const const_iterator& rhs) const {
+            return m_is_dense ? m_dense_it == rhs.m_dense_it : m_small_it == rhs.m_small_it;
+        }
+
+        bool operator!=(const const_iterator& rhs) const {
+            return !(*this == rhs);
+        }
+
+    }; // class const_iterator
+
+    bool is_dense() const noexcept {
+        return m_is_dense;
+    }
+
+    bool get(osmium::unsigned_object_id_type id) const noexcept {
+        if (m_is_dense) {
+            return m_dense.get(id);
+        }
+        return std::binary_search(m_small.cbegin(), m_small.cend(), id);
+    }
+
+    /// Set the ID and return true if it was not set before.
+    bool check_and_set(osmium::unsigned_object_id_type id) {
+        if (m_is_dense) {
+            return m_dense.check_and_set(id);
+        }
+
+        // IDs are often added in order
+        if (m_small.empty() || m_small.back() < id) {
+            m_small.push_back(id);
+        } else {
+            const auto it = std::lower_bound(m_small.begin(), m_small.end(), id);
+            if (*it == id) {
+                return false;
+            }
+            m_small.insert(it, id);
+        }
+
+        if (m_small.size() > max_small_size) {
+            convert_to_dense();
+        }
+        return true;
+    }
+
+    void set(osmium::unsigned_object_id_type id) {
+        check_and_set(id);
+    }
+
+    void unset(osmium::unsigned_object_id_type id) {
+        if (m_is_dense) {
+            m_dense.unset(id);
+            return;
+        }
+        const auto it = std::lower_bound(m_small.begin(), m_small.end(), id);
+        if (it != m_small.end() && *it == id) {
+            m_small.erase(it);
+        }
+    }
+
+    bool empty() const noexcept {
+        return m_is_dense ? m_dense.empty() : m_small.empty();
+    }
+
+    std::size_t size() const noexcept {
+        return m_is_dense ? m_dense.size() : m_small.size();
+    }
+
+    void clear() {
+        m_small.clear();
+        m_dense.clear();
+        m_is_dense = false;
+    }
+
+    const_iterator begin() const {
+        return {m_small.cbegin(), m_is_dense ? m_dense.begin() : m_dense.end(), m_is_dense};
+    }
+
+    const_iterator end() const {
+        return {m_small.cend(), m_dense.end(), m_is_dense};
+    }
+
+}; // class AdaptiveIdSet
+
+#endif // ADAPTIVE_ID_SET_HPP
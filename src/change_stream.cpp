@@ -0,0 +1,85 @@
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "change_stream.hpp"
+
+#include <osmium/osm/entity_bits.hpp>
+#include <osmium/osm/object_comparisons.hpp>
+
+#include <stdexcept>
+#include <utility>
+
+bool ChangeStream::queue_element::operator<(const queue_element& other) const noexcept {
+    if (osmium::object_order_type_id_version{}(*other.object, *object)) {
+        return true;
+    }
+    if (osmium::object_order_type_id_version{}(*object, *other.object)) {
+        return false;
+    }
+    return source > other.source;
+}
+
+ChangeStream::ChangeStream(const std::vector<osmium::io::File>& files) {
+    m_sources.reserve(files.size());
+    for (const auto& file : files) {
+        std::unique_ptr<osmium::io::Reader> reader{new osmium::io::Reader{file, osmium::osm_entity_bits::object}};
+        it_type iterator{*reader};
+        m_sources.push_back(source{file.filename(), std::move(reader), iterator});
+    }
+    for (std::size_t i = 0; i < m_sources.size(); ++i) {
+        if (m_sources[i].iterator != it_type{}) {
+            m_queue.push(queue_element{&*m_sources[i].iterator, i});
+        }
+    }
+}
+
+void ChangeStream::next() {
+    const auto element = m_queue.top();
+    m_queue.pop();
+
+    auto& it = m_sources[element.source].iterator;
+    const osmium::OSMObject& last = *it;
+    const auto type = last.type();
+    const auto id = last.id();
+    const auto version = last.version();
+    ++it;
+    if (it != it_type{}) {
+        if (it->type() < type || (it->type() == type && (osmium::id_order{}(it->id(), id) || (it->id() == id && it->version() < version)))) {
+            throw std::runtime_error{"Change file '" + m_sources[element.source].filename + "' is not sorted."};
+        }
+        m_queue.push(queue_element{&*it, element.source});
+    }
+}
+
+std::size_t ChangeStream::offset() const noexcept {
+    std::size_t sum = 0;
+    for (const auto& source : m_sources) {
+        sum += source.reader->offset();
+    }
+    return sum;
+}
+
+void ChangeStream::close() {
+    for (auto& source : m_sources) {
+        source.reader->close();
+    }
+}
@@ -0,0 +1,89 @@
+#ifndef CHANGE_STREAM_HPP
+#define CHANGE_STREAM_HPP
+
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <osmium/io/file.hpp>
+#include <osmium/io/input_iterator.hpp>
+#include <osmium/io/reader.hpp>
+#include <osmium/osm/object.hpp>
+
+#include <cstddef>
+#include <memory>
+#include <queue>
+#include <string>
+#include <vector>
+
+/**
+ * Reads several sorted change files at the same time and returns
+ * their objects in order. Objects that compare equal are returned
+ * in the order of the change files. Only the current buffer of each
+ * file is kept in memory.
+ */
+class ChangeStream {
+
+    using it_type = osmium::io::InputIterator<osmium::io::Reader, osmium::OSMObject>;
+
+    struct source {
+        std::string filename;
+        std::unique_ptr<osmium::io::Reader> reader;
+        it_type iterator;
+    };
+
+    std::vector<source> m_sources;
+
+    struct queue_element {
+        const osmium::OSMObject* object;
+        std::size_t source;
+
+        // priority_queue has the largest element on top
+        bool operator<(const queue_element& other) const noexcept;
+    };
+
+    std::priority_queue<queue_element> m_queue;
+
+public:
+
+    explicit ChangeStream(const std::vector<osmium::io::File>& files);
+
+    bool empty() const noexcept {
+        return m_queue.empty();
+    }
+
+    const osmium::OSMObject& top() const noexcept {
+        return *m_queue.top().object;
+    }
+
+    // Advance to the next object. The current object isn't valid any
+    // more after this. Throws std::runtime_error if a change file is
+    // not sorted.
+    void next();
+
+    // Sum of the offsets of all change files.
+    std::size_t offset() const noexcept;
+
+    void close();
+
+}; // class ChangeStream
+
+#endif // CHANGE_STREAM_HPP
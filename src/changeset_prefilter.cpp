@@ -0,0 +1,260 @@
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "changeset_prefilter.hpp"
+
+#include <osmium/osm/location.hpp>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+    bool has_prefix(const char* data, const char* end, const char* prefix) noexcept {
+        const auto len = std::strlen(prefix);
+        return static_cast<std::size_t>(end - data) >= len && std::strncmp(data, prefix, len) == 0;
+    }
+
+    bool is_space(char c) noexcept {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+    }
+
+    // Does an element with the given name start at data (just after
+    // the '<')?
+    bool is_element(const char* data, const char* end, const char* name) noexcept {
+        const auto len = std::strlen(name);
+        if (static_cast<std::size_t>(end - data) <= len || std::strncmp(data, name, len) != 0) {
+            return false;
+        }
+        const char c = data[len];
+        return is_space(c) || c == '>' || c == '/';
+    }
+
+    // Parse an unsigned number which must make up the whole string.
+    bool parse_number(const std::string& str, unsigned long long& value) noexcept {
+        if (str.empty() || str[0] == '-') {
+            return false;
+        }
+        char* end = nullptr;
+        errno = 0;
+        value = std::strtoull(str.c_str(), &end, 10);
+        return errno == 0 && *end == '\0';
+    }
+
+    // Find the '>' ending the start tag beginning at pos. Attribute values
+    // can contain '>', so quotes have to be tracked.
+    std::size_t find_tag_end(const std::string& data, std::size_t pos) noexcept {
+        char quote = '\0';
+        for (; pos < data.size(); ++pos) {
+            const char c = data[pos];
+            if (quote) {
+                if (c == quote) {
+                    quote = '\0';
+                }
+            } else if (c == '"' || c == '\'') {
+                quote = c;
+            } else if (c == '>') {
+                return pos;
+            }
+        }
+        return std::string::npos;
+    }
+
+} // anonymous namespace
+
+bool parse_changeset_attributes(const char* begin, const char* end, changeset_summary& summary) {
+    std::string min_lon;
+    std::string min_lat;
+    std::string max_lon;
+    std::string max_lat;
+
+    const char* p = begin;
+    while (true) {
+        while (p != end && is_space(*p)) {
+            ++p;
+        }
+        if (p == end) {
+            break;
+        }
+
+        const char* name_begin = p;
+        while (p != end && *p != '=' && !is_space(*p)) {
+            ++p;
+        }
+        const std::string name(name_begin, p);
+
+        while (p != end && is_space(*p)) {
+            ++p;
+        }
+        if (p == end || *p != '=') {
+            return false;
+        }
+        ++p;
+        while (p != end && is_space(*p)) {
+            ++p;
+        }
+        if (p == end || (*p != '"' && *p != '\'')) {
+            return false;
+        }
+        const char quote = *p++;
+        const char* value_begin = p;
+        while (p != end && *p != quote) {
+            ++p;
+        }
+        if (p == end) {
+            return false;
+        }
+        const std::string value(value_begin, p);
+        ++p;
+
+        unsigned long long number = 0;
+        try {
+            if (name == "user") {
+                if (value.find('&') != std::string::npos) {
+                    return false;
+                }
+                summary.m_user = value;
+            } else if (name == "uid") {
+                if (!parse_number(value, number)) {
+                    return false;
+                }
+                summary.m_uid = static_cast<osmium::user_id_type>(number);
+            } else if (name == "created_at") {
+                summary.m_created_at = osmium::Timestamp{value.c_str()};
+            } else if (name == "closed_at") {
+                summary.m_closed_at = osmium::Timestamp{value.c_str()};
+            } else if (name == "num_changes") {
+                if (!parse_number(value, number)) {
+                    return false;
+                }
+                summary.m_num_changes = static_cast<osmium::num_changes_type>(number);
+            } else if (name == "comments_count") {
+                if (!parse_number(value, number)) {
+                    return false;
+                }
+                summary.m_num_comments = static_cast<osmium::num_comments_type>(number);
+            } else if (name == "min_lon") {
+                min_lon = value;
+            } else if (name == "min_lat") {
+                min_lat = value;
+            } else if (name == "max_lon") {
+                max_lon = value;
+            } else if (name == "max_lat") {
+                max_lat = value;
+            }
+        } catch (const std::invalid_argument&) {
+            return false;
+        }
+    }
+
+    const int num_coordinates = !min_lon.empty() + !min_lat.empty() + !max_lon.empty() + !max_lat.empty();
+    if (num_coordinates == 0) {
+        return true;
+    }
+    if (num_coordinates != 4) {
+        return false;
+    }
+
+    try {
+        osmium::Location min;
+        min.set_lon(min_lon.c_str());
+        min.set_lat(min_lat.c_str());
+        osmium::Location max;
+        max.set_lon(max_lon.c_str());
+        max.set_lat(max_lat.c_str());
+        summary.m_bounds.extend(min);
+        summary.m_bounds.extend(max);
+    } catch (const osmium::invalid_location&) {
+        return false;
+    }
+
+    return true;
+}
+
+std::size_t prefilter_xml_changesets(std::string& data, const std::function<bool(const changeset_summary&)>& predicate) {
+    static const std::size_t start_len = std::strlen("<changeset");
+    static const std::size_t end_tag_len = std::strlen("</changeset>");
+
+    std::string output;
+    std::size_t removed = 0;
+
+    // Everything before this position is either in the output or has
+    // been removed.
+    std::size_t copied = 0;
+
+    std::size_t pos = 0;
+    while ((pos = data.find('<', pos)) != std::string::npos) {
+        const char* p = data.data() + pos + 1;
+        const char* end = data.data() + data.size();
+
+        if (has_prefix(p, end, "!--")) {
+            pos = data.find("-->", pos);
+            if (pos == std::string::npos) {
+                break;
+            }
+            continue;
+        }
+
+        if (!is_element(p, end, "changeset")) {
+            ++pos;
+            continue;
+        }
+
+        const auto tag_end = find_tag_end(data, pos + start_len);
+        if (tag_end == std::string::npos) {
+            break;
+        }
+
+        const bool empty_element = data[tag_end - 1] == '/';
+        std::size_t element_end = tag_end + 1;
+        if (!empty_element) {
+            const auto end_tag = data.find("</changeset>", tag_end);
+            if (end_tag == std::string::npos) {
+                break;
+            }
+            element_end = end_tag + end_tag_len;
+        }
+
+        changeset_summary summary;
+        const char* attributes_end = data.data() + tag_end - (empty_element ? 1 : 0);
+        if (parse_changeset_attributes(data.data() + pos + start_len, attributes_end, summary) && !predicate(summary)) {
+            if (removed == 0) {
+                output.reserve(data.size());
+            }
+            output.append(data, copied, pos - copied);
+            copied = element_end;
+            ++removed;
+        }
+
+        pos = element_end;
+    }
+
+    if (removed > 0) {
+        output.append(data, copied, std::string::npos);
+        data.swap(output);
+    }
+
+    return removed;
+}
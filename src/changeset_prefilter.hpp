@@ -0,0 +1,109 @@
+#ifndef CHANGESET_PREFILTER_HPP
+#define CHANGESET_PREFILTER_HPP
+
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <osmium/osm/box.hpp>
+#include <osmium/osm/timestamp.hpp>
+#include <osmium/osm/types.hpp>
+
+#include <cstddef>
+#include <functional>
+#include <string>
+
+/**
+ * The attributes of a changeset as found in the start tag of a
+ * changeset element in an XML file. The accessors have the same names as
+ * those of osmium::Changeset, so the same filter code can be used for
+ * both. The discussion and the tags are not available.
+ */
+class changeset_summary {
+
+    std::string m_user;
+    osmium::Box m_bounds;
+    osmium::Timestamp m_created_at;
+    osmium::Timestamp m_closed_at;
+    osmium::user_id_type m_uid = 0;
+    osmium::num_changes_type m_num_changes = 0;
+    osmium::num_comments_type m_num_comments = 0;
+
+    friend bool parse_changeset_attributes(const char* begin, const char* end, changeset_summary& summary);
+
+public:
+
+    const char* user() const noexcept {
+        return m_user.c_str();
+    }
+
+    const osmium::Box& bounds() const noexcept {
+        return m_bounds;
+    }
+
+    osmium::Timestamp created_at() const noexcept {
+        return m_created_at;
+    }
+
+    osmium::Timestamp closed_at() const noexcept {
+        return m_closed_at;
+    }
+
+    bool open() const noexcept {
+        return m_closed_at == osmium::Timestamp{};
+    }
+
+    bool closed() const noexcept {
+        return !open();
+    }
+
+    osmium::user_id_type uid() const noexcept {
+        return m_uid;
+    }
+
+    osmium::num_changes_type num_changes() const noexcept {
+        return m_num_changes;
+    }
+
+    osmium::num_comments_type num_comments() const noexcept {
+        return m_num_comments;
+    }
+
+}; // class changeset_summary
+
+/**
+ * Parse the attributes of the start tag of a changeset element. The range
+ * contains everything between "<changeset" and the closing ">". Returns
+ * false if any of the attributes can not be interpreted the same way the
+ * XML parser would, for instance because they contain entity references.
+ */
+bool parse_changeset_attributes(const char* begin, const char* end, changeset_summary& summary);
+
+/**
+ * Remove all changeset elements from the XML data for which the predicate
+ * returns false. Only the attributes in the start tags are looked at,
+ * the discussions and tags of the changesets are skipped without being
+ * parsed. Changesets whose attributes can't be interpreted are always
+ * kept. Returns the number of changesets removed.
+ */
+std::size_t prefilter_xml_changesets(std::string& data, const std::function<bool(const changeset_summary&)>& predicate);
+
+#endif // CHANGESET_PREFILTER_HPP
@@ -0,0 +1,373 @@
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "chunked_reader.hpp"
+
+#include <osmium/io/any_compression.hpp> // IWYU pragma: keep
+#include <osmium/io/detail/opl_parser_functions.hpp>
+#include <osmium/io/detail/read_write.hpp>
+#include <osmium/io/error.hpp>
+#include <osmium/io/reader.hpp>
+#include <osmium/io/xml_input.hpp> // IWYU pragma: keep
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+
+    bool has_prefix(const char* data, const char* end, const char* prefix) noexcept {
+        const auto len = std::strlen(prefix);
+        return static_cast<std::size_t>(end - data) >= len && std::strncmp(data, prefix, len) == 0;
+    }
+
+    // Does an element with the given name start at data (just after
+    // the '<')?
+    bool is_element(const char* data, const char* end, const char* name) noexcept {
+        const auto len = std::strlen(name);
+        if (static_cast<std::size_t>(end - data) <= len || std::strncmp(data, name, len) != 0) {
+            return false;
+        }
+        const char c = data[len];
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '>' || c == '/';
+    }
+
+    // Buffers are handed out once this much of them is used.
+    constexpr const std::size_t buffer_size = 1024UL * 1024UL;
+    constexpr const std::size_t buffer_flush_size = 800UL * 1024UL;
+
+    // Parse OPL data with the line parser directly instead of going
+    // through an osmium::io::Reader, which would start threads of its own
+    // for every chunk and copy the data around some more. The line ends
+    // are found with memchr(), which the C library implements with SIMD
+    // instructions, and overwritten with 0 bytes as expected by the line
+    // parser. Line numbers in error messages are relative to the chunk.
+    std::vector<osmium::memory::Buffer> parse_opl_chunk(std::string& data, osmium::osm_entity_bits::type entities) {
+        std::vector<osmium::memory::Buffer> buffers;
+
+        if (!data.empty() && data.back() != '\n') {
+            data += '\n';
+        }
+
+        osmium::memory::Buffer buffer{buffer_size, osmium::memory::Buffer::auto_grow::yes};
+        char* line = &data[0];
+        char* const end = line + data.size();
+        uint64_t line_count = 0;
+        while (line != end) {
+            char* const eol = static_cast<char*>(std::memchr(line, '\n', static_cast<std::size_t>(end - line)));
+            *eol = '\0';
+            if (eol != line && eol[-1] == '\r') {
+                eol[-1] = '\0';
+            }
+
+            osmium::io::detail::opl_parse_line(++line_count, line, buffer, entities);
+            if (buffer.committed() > buffer_flush_size) {
+                buffers.push_back(std::move(buffer));
+                buffer = osmium::memory::Buffer{buffer_size, osmium::memory::Buffer::auto_grow::yes};
+            }
+
+            line = eol + 1;
+        }
+
+        if (buffer.committed() > 0) {
+            buffers.push_back(std::move(buffer));
+        }
+
+        return buffers;
+    }
+
+    std::vector<osmium::memory::Buffer> parse_xml_chunk(const std::string& data, osmium::osm_entity_bits::type entities) {
+        std::vector<osmium::memory::Buffer> buffers;
+
+        const osmium::io::File file{data.data(), data.size(), "osm"};
+        osmium::io::Reader reader{file, entities};
+        while (osmium::memory::Buffer buffer = reader.read()) {
+            buffers.push_back(std::move(buffer));
+        }
+        reader.close();
+
+        return buffers;
+    }
+
+    const osmium::io::File& check_supported(const osmium::io::File& file) {
+        if (!ChunkedReader::supports(file)) {
+            throw std::invalid_argument{"ChunkedReader can only read XML and OPL files"};
+        }
+        return file;
+    }
+
+} // anonymous namespace
+
+ChunkedReader::ChunkedReader(const osmium::io::File& file, osmium::osm_entity_bits::type entities, osmium::thread::Pool& pool) :
+    m_file(check_supported(file)),
+    m_entities(entities),
+    m_pool(pool),
+    m_max_pending(static_cast<std::size_t>(pool.num_threads()) * 2),
+    m_fd(osmium::io::detail::open_for_reading(file.filename())),
+    m_decompressor(osmium::io::CompressionFactory::instance().create_decompressor(file.compression(), m_fd)),
+    m_xml(file.format() == osmium::io::file_format::xml) {
+}
+
+ChunkedReader::~ChunkedReader() noexcept {
+    try {
+        close();
+    } catch (...) {
+        // Ignore any exceptions because destructor must not throw.
+    }
+}
+
+bool ChunkedReader::supports(const osmium::io::File& file) noexcept {
+    return file.format() == osmium::io::file_format::xml ||
+           file.format() == osmium::io::file_format::opl;
+}
+
+bool ChunkedReader::read_more() {
+    if (m_input_done) {
+        return false;
+    }
+
+    const std::string data = m_decompressor->read();
+    if (data.empty()) {
+        m_input_done = true;
+        return false;
+    }
+
+    m_data += data;
+    return true;
+}
+
+// Find the start of the first object at or after min_size in the data.
+// This doesn't parse the XML, it only looks at what follows each '<'.
+// Because '<' must be escaped in attribute values and text, this is
+// enough to find the objects, skipping only comments, CDATA sections,
+// and processing instructions. The section of change files and the name
+// of the root element are tracked on the way. Returns the size of the
+// data if there are no more objects.
+std::size_t ChunkedReader::find_xml_boundary(std::size_t min_size) {
+    // Longest sequence after '<' we have to look at to decide what it is.
+    constexpr const std::size_t lookahead = 16;
+
+    while (true) {
+        const auto pos = m_data.find('<', m_scan_pos);
+        if (pos == std::string::npos) {
+            m_scan_pos = m_data.size();
+            if (!read_more()) {
+                return m_data.size();
+            }
+            continue;
+        }
+
+        m_scan_pos = pos;
+        if (m_data.size() - pos < lookahead && read_more()) {
+            continue;
+        }
+
+        const char* data = m_data.data() + pos + 1;
+        const char* end = m_data.data() + m_data.size();
+
+        const char* skip_to = nullptr;
+        if (has_prefix(data, end, "!--")) {
+            skip_to = "-->";
+        } else if (has_prefix(data, end, "![CDATA[")) {
+            skip_to = "]]>";
+        } else if (has_prefix(data, end, "?")) {
+            skip_to = "?>";
+        } else if (has_prefix(data, end, "!")) {
+            skip_to = ">";
+        }
+
+        if (skip_to) {
+            const auto skip_end = m_data.find(skip_to, pos + 1);
+            if (skip_end == std::string::npos) {
+                if (read_more()) {
+                    continue;
+                }
+                throw osmium::io_error{"Unterminated comment or CDATA section in XML file '" + m_file.filename() + "'"};
+            }
+            m_scan_pos = skip_end + std::strlen(skip_to);
+            continue;
+        }
+
+        if (is_element(data, end, "node") ||
+            is_element(data, end, "way") ||
+            is_element(data, end, "relation") ||
+            is_element(data, end, "changeset")) {
+            if (pos >= min_size) {
+                return pos;
+            }
+        } else if (is_element(data, end, "osm")) {
+            m_root = "osm";
+        } else if (is_element(data, end, "osmChange")) {
+            m_root = "osmChange";
+        } else if (is_element(data, end, "/osm") || is_element(data, end, "/osmChange")) {
+            m_end_found = true;
+            return pos;
+        } else if (is_element(data, end, "create") ||
+                   is_element(data, end, "modify") ||
+                   is_element(data, end, "delete")) {
+            const auto tag_end = m_data.find('>', pos);
+            if (tag_end == std::string::npos) {
+                if (read_more()) {
+                    continue;
+                }
+                throw osmium::io_error{"Unterminated element in XML file '" + m_file.filename() + "'"};
+            }
+            if (m_data[tag_end - 1] != '/') {
+                m_section = *data == 'c' ? section::create :
+                            *data == 'm' ? section::modify :
+                                           section::del;
+            }
+        } else if (is_element(data, end, "/create") ||
+                   is_element(data, end, "/modify") ||
+                   is_element(data, end, "/delete")) {
+            m_section = section::none;
+        }
+
+        ++m_scan_pos;
+    }
+}
+
+// Find the end of the first line ending at or after min_size. Returns the
+// size of the data at the end of the file.
+std::size_t ChunkedReader::find_opl_boundary(std::size_t min_size) {
+    while (true) {
+        if (m_data.size() > min_size) {
+            const auto pos = m_data.find('\n', std::max(min_size, m_scan_pos));
+            if (pos != std::string::npos) {
+                return pos + 1;
+            }
+            m_scan_pos = m_data.size();
+        }
+        if (!read_more()) {
+            return m_data.size();
+        }
+    }
+}
+
+bool ChunkedReader::next_chunk(std::string& chunk) {
+    if (m_done) {
+        return false;
+    }
+
+    const auto consume = [this](std::size_t size) {
+        m_data.erase(0, size);
+        m_scan_pos = m_scan_pos > size ? m_scan_pos - size : 0;
+    };
+
+    if (m_xml && !m_prolog_done) {
+        // Everything before the first object (XML declaration, start of
+        // root element, bounds, ...) is not needed. The header has to be
+        // read separately anyway.
+        consume(find_xml_boundary(0));
+        m_prolog_done = true;
+        m_chunk_section = m_section;
+    }
+
+    const std::size_t boundary = m_xml ? find_xml_boundary(chunk_size) : find_opl_boundary(chunk_size);
+    if (boundary == 0) {
+        m_done = true;
+        return false;
+    }
+
+    if (m_xml) {
+        // Each chunk is wrapped in the root element and the section of
+        // the change file it starts and ends in, so that it can be parsed
+        // on its own.
+        static const char* const section_names[] = {"", "create", "modify", "delete"};
+        const char* start_section = section_names[static_cast<int>(m_chunk_section)];
+        const char* end_section = section_names[static_cast<int>(m_section)];
+
+        chunk = "<" + m_root + " version=\"0.6\">";
+        if (*start_section) {
+            chunk += std::string{"<"} + start_section + ">";
+        }
+        chunk.append(m_data, 0, boundary);
+        if (*end_section) {
+            chunk += std::string{"</"} + end_section + ">";
+        }
+        chunk += "</" + m_root + ">";
+    } else {
+        chunk.assign(m_data, 0, boundary);
+    }
+
+    consume(boundary);
+    m_chunk_section = m_section;
+
+    if (m_end_found || (m_input_done && m_data.empty())) {
+        m_done = true;
+    }
+
+    return true;
+}
+
+void ChunkedReader::fill() {
+    const bool xml = m_xml;
+    const auto entities = m_entities;
+    const auto chunk_filter = m_chunk_filter;
+
+    std::string chunk;
+    while (m_pending.size() < m_max_pending && next_chunk(chunk)) {
+        auto chunk_ptr = std::make_shared<std::string>(std::move(chunk));
+        m_pending.push_back(m_pool.submit([chunk_ptr, xml, entities, chunk_filter]() {
+            if (chunk_filter) {
+                chunk_filter(*chunk_ptr);
+            }
+            return xml ? parse_xml_chunk(*chunk_ptr, entities)
+                       : parse_opl_chunk(*chunk_ptr, entities);
+        }));
+        chunk.clear();
+    }
+}
+
+osmium::memory::Buffer ChunkedReader::read() {
+    while (m_buffers.empty()) {
+        fill();
+        if (m_pending.empty()) {
+            return osmium::memory::Buffer{};
+        }
+        for (auto& buffer : m_pending.front().get()) {
+            m_buffers.push_back(std::move(buffer));
+        }
+        m_pending.pop_front();
+    }
+
+    osmium::memory::Buffer buffer{std::move(m_buffers.front())};
+    m_buffers.pop_front();
+    return buffer;
+}
+
+std::size_t ChunkedReader::offset() const noexcept {
+    if (!m_decompressor) {
+        return 0;
+    }
+    const auto offset = ::lseek(m_fd, 0, SEEK_CUR);
+    return offset < 0 ? 0 : static_cast<std::size_t>(offset);
+}
+
+void ChunkedReader::close() {
+    if (m_decompressor) {
+        m_decompressor->close();
+        m_decompressor.reset();
+    }
+}
@@ -0,0 +1,139 @@
+#ifndef CHUNKED_READER_HPP
+#define CHUNKED_READER_HPP
+
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <osmium/io/compression.hpp>
+#include <osmium/io/file.hpp>
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm/entity_bits.hpp>
+#include <osmium/thread/pool.hpp>
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * Reads an XML or OPL file by splitting the uncompressed data into chunks
+ * at the boundaries of top-level objects (changesets, nodes, ways, and
+ * relations) and parsing the chunks on a thread pool. The buffers are
+ * returned in the order of the input. OPL chunks are handed to the line
+ * parser directly. Can be used instead of an osmium::io::Reader, but the
+ * header has to be read separately.
+ */
+class ChunkedReader {
+
+    // Minimum size of each chunk of uncompressed data.
+    static constexpr const std::size_t chunk_size = 8UL * 1024UL * 1024UL;
+
+    // The section of an XML change file we are in.
+    enum class section {
+        none   = 0,
+        create = 1,
+        modify = 2,
+        del    = 3
+    };
+
+    osmium::io::File m_file;
+    osmium::osm_entity_bits::type m_entities;
+    osmium::thread::Pool& m_pool;
+    std::size_t m_max_pending;
+    int m_fd;
+    std::unique_ptr<osmium::io::Decompressor> m_decompressor;
+
+    // Uncompressed data not yet handed out as a chunk and the position
+    // up to which it has been scanned.
+    std::string m_data;
+    std::size_t m_scan_pos = 0;
+
+    // Name of the XML root element ("osm" or "osmChange").
+    std::string m_root{"osm"};
+
+    // Section at the beginning of the current chunk and at the scan
+    // position.
+    section m_chunk_section = section::none;
+    section m_section = section::none;
+
+    bool m_xml;
+    bool m_input_done = false;
+    bool m_end_found = false;
+    bool m_prolog_done = false;
+    bool m_done = false;
+
+    std::function<void(std::string&)> m_chunk_filter;
+
+    std::deque<std::future<std::vector<osmium::memory::Buffer>>> m_pending;
+    std::deque<osmium::memory::Buffer> m_buffers;
+
+    bool read_more();
+
+    std::size_t find_xml_boundary(std::size_t min_size);
+
+    std::size_t find_opl_boundary(std::size_t min_size);
+
+    bool next_chunk(std::string& chunk);
+
+    void fill();
+
+public:
+
+    // The pool must not be used for anything that waits for the
+    // results of this reader.
+    ChunkedReader(const osmium::io::File& file, osmium::osm_entity_bits::type entities, osmium::thread::Pool& pool);
+
+    ChunkedReader(const ChunkedReader&) = delete;
+    ChunkedReader& operator=(const ChunkedReader&) = delete;
+
+    ChunkedReader(ChunkedReader&&) = delete;
+    ChunkedReader& operator=(ChunkedReader&&) = delete;
+
+    ~ChunkedReader() noexcept;
+
+    // Set a function which is called with the data of each chunk on the
+    // thread pool before the chunk is parsed. It can remove objects which
+    // are not needed to save the time parsing them. Must be set before
+    // the first call to read().
+    void set_chunk_filter(std::function<void(std::string&)> filter) {
+        m_chunk_filter = std::move(filter);
+    }
+
+    // Can files of this format be read with this class?
+    static bool supports(const osmium::io::File& file) noexcept;
+
+    // Returns an invalid buffer at the end of the file.
+    osmium::memory::Buffer read();
+
+    // Offset in the (compressed) input file. Only available for real
+    // files, always 0 when reading from a pipe.
+    std::size_t offset() const noexcept;
+
+    void close();
+
+}; // class ChunkedReader
+
+#endif // CHUNKED_READER_HPP
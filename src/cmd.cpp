@@ -22,13 +22,21 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "cmd.hpp"
 #include "exception.hpp"
+#include "memory_policy.hpp"
+#include "trace.hpp"
+#include "util.hpp"
 
 #include <osmium/osm/entity_bits.hpp>
 #include <osmium/util/memory.hpp>
+#include <osmium/util/string.hpp>
 #include <osmium/util/verbose_output.hpp>
 
+#include <cstddef>
+#include <cstdint>
 #include <cstdlib>
 #include <iostream>
+#include <string>
+#include <system_error>
 
 po::options_description Command::add_common_options(const bool with_progress) {
     po::options_description options{"COMMON OPTIONS"};
@@ -36,6 +44,11 @@ po::options_description Command::add_common_options(const bool with_progress) {
     auto opts = options.add_options()
     ("help,h", "Show usage help")
     ("verbose,v", "Set verbose mode")
+    ("threads", po::value<int>(), "Number of threads for parallel work (default: 1)")
+    ("metrics", po::value<std::string>(), "Write metrics about this run to file (JSON format)")
+    ("trace", po::value<std::string>(), "Write trace of this run to file (Chrome trace format)")
+    ("memory-budget", po::value<std::size_t>(), "Use algorithms which need at most about this many MBytes of memory")
+    ("memory-policy", po::value<std::string>(), "Memory policy for large indexes (huge-pages, interleave)")
     ;
 
     if (with_progress) {
@@ -58,6 +71,56 @@ void Command::setup_common(const boost::program_options::variables_map& vm, cons
     if (vm.count("verbose")) {
         m_vout.verbose(true);
     }
+
+    if (vm.count("threads")) {
+        m_threads = vm["threads"].as<int>();
+        if (m_threads < 1) {
+            throw argument_error{"The --threads option needs a positive number."};
+        }
+    }
+
+    if (vm.count("metrics")) {
+        m_metrics_filename = vm["metrics"].as<std::string>();
+        if (m_metrics_filename.empty()) {
+            throw argument_error{"The --metrics option needs a file name."};
+        }
+        m_metrics.enable();
+    }
+
+    if (vm.count("memory-budget")) {
+        m_memory_budget = vm["memory-budget"].as<std::size_t>();
+        if (m_memory_budget == 0) {
+            throw argument_error{"The --memory-budget option needs a positive number."};
+        }
+    }
+
+    if (vm.count("memory-policy")) {
+        bool interleave = false;
+        for (const auto& policy : osmium::split_string(vm["memory-policy"].as<std::string>(), ',', true)) {
+            if (policy == "huge-pages") {
+                if (!supports_huge_pages()) {
+                    throw argument_error{std::string{"The 'huge-pages' memory policy is not supported by the '"} + name() + "' command."};
+                }
+                m_huge_pages = true;
+            } else if (policy == "interleave") {
+                interleave = true;
+            } else if (policy != "default") {
+                throw argument_error{"Unknown memory policy '" + policy + "' (allowed are 'default', 'huge-pages', and 'interleave')."};
+            }
+        }
+        // Must be set before any large allocations are done.
+        if (interleave && !set_numa_interleave()) {
+            warning("Can not interleave memory over NUMA nodes on this system.\n");
+        }
+    }
+
+    if (vm.count("trace")) {
+        const auto& filename = vm["trace"].as<std::string>();
+        if (filename.empty()) {
+            throw argument_error{"The --trace option needs a file name."};
+        }
+        Tracer::instance().enable(filename);
+    }
 }
 
 void Command::setup_progress(const boost::program_options::variables_map& vm) {
@@ -143,10 +206,76 @@ void Command::print_arguments(const std::string& command) {
     }
 }
 
+osmium::thread::Pool& Command::thread_pool() {
+    if (!m_thread_pool) {
+        m_thread_pool.reset(new osmium::thread::Pool{m_threads});
+    }
+    return *m_thread_pool;
+}
+
+namespace {
+
+    std::uint64_t size_of_file(const std::string& filename) {
+        if (filename.empty() || filename == "-") {
+            return 0;
+        }
+        try {
+            return osmium::file_size(filename);
+        } catch (const std::system_error&) {
+            return 0;
+        }
+    }
+
+} // anonymous namespace
+
+void Command::write_metrics(const std::string& command, const bool success) {
+    if (m_metrics_filename.empty()) {
+        return;
+    }
+
+    std::uint64_t input_bytes = 0;
+    if (const auto* input = dynamic_cast<const with_single_osm_input*>(this)) {
+        input_bytes += size_of_file(input->input_file().filename());
+    }
+    if (const auto* inputs = dynamic_cast<const with_multiple_osm_inputs*>(this)) {
+        for (const auto& file : inputs->input_files()) {
+            input_bytes += size_of_file(file.filename());
+        }
+    }
+    if (input_bytes > 0) {
+        m_metrics.set_max("input_file_bytes", input_bytes);
+    }
+
+    if (const auto* output = dynamic_cast<const with_osm_output*>(this)) {
+        const auto output_bytes = size_of_file(output->output_file().filename());
+        if (output_bytes > 0) {
+            m_metrics.set_max("output_file_bytes", output_bytes);
+        }
+    }
+
+    m_metrics.write(m_metrics_filename, command, success);
+}
+
+void Command::use_huge_pages() {
+    // Only areas large enough to be worth it.
+    constexpr const std::size_t min_size = 64UL * 1024UL * 1024UL;
+
+    if (!m_huge_pages || m_huge_pages_advised) {
+        return;
+    }
+    m_huge_pages_advised = true;
+
+    const auto size = advise_huge_pages(min_size);
+    m_vout << "Advised " << (size / (1024UL * 1024UL)) << " MBytes of memory to use huge pages.\n";
+}
+
 void Command::show_memory_used() {
     osmium::MemoryUsage mem;
     if (mem.current() > 0) {
         m_vout << "Peak memory used: " << mem.peak() << " MBytes\n";
+        if (m_memory_budget > 0 && static_cast<std::size_t>(mem.peak()) > m_memory_budget) {
+            m_vout << "Memory budget of " << m_memory_budget << " MBytes was exceeded.\n";
+        }
     }
 }
 
@@ -23,15 +23,20 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 */
 
+#include "metrics.hpp"
+
 #include <osmium/io/file.hpp>
 #include <osmium/io/header.hpp>
 #include <osmium/io/writer_options.hpp>
 #include <osmium/osm/entity_bits.hpp>
+#include <osmium/thread/pool.hpp>
 #include <osmium/util/file.hpp>
 #include <osmium/util/verbose_output.hpp>
 
 #include <boost/program_options.hpp>
 
+#include <cstddef>
+#include <cstdint>
 #include <functional>
 #include <map>
 #include <memory>
@@ -60,11 +65,32 @@ class Command {
         always = 2
     } m_display_progress = display_progress_type::on_tty;
 
+    std::unique_ptr<osmium::thread::Pool> m_thread_pool;
+
+    std::string m_metrics_filename;
+
 protected:
 
     const CommandFactory& m_command_factory;
     osmium::VerboseOutput m_vout{false};
 
+    // Number of threads set with the --threads option.
+    int m_threads = 1;
+
+    // Metrics collected for the --metrics option. Recording is a no-op
+    // if the option was not used.
+    Metrics m_metrics;
+
+    // Memory budget in MBytes set with the --memory-budget option. 0 if
+    // there is no budget.
+    std::size_t m_memory_budget = 0;
+
+    // Use huge pages for large indexes (set with --memory-policy).
+    bool m_huge_pages = false;
+
+    // Has use_huge_pages() already advised the kernel?
+    bool m_huge_pages_advised = false;
+
 public:
 
     explicit Command(const CommandFactory& command_factory) :
@@ -104,6 +130,12 @@ public:
     // The command line usage synopsis of the command.
     virtual const char* synopsis() const noexcept = 0;
 
+    // Does the command put its large indexes on huge pages? The
+    // huge-pages memory policy is rejected by all other commands.
+    virtual bool supports_huge_pages() const noexcept {
+        return false;
+    }
+
     po::options_description add_common_options(bool with_progress = true);
     void setup_common(const boost::program_options::variables_map& vm, const po::options_description& desc);
     void setup_progress(const boost::program_options::variables_map& vm);
@@ -113,6 +145,37 @@ public:
     void print_arguments(const std::string& command);
     void show_memory_used();
 
+    // If huge pages were requested with --memory-policy, ask the kernel
+    // to use them for the large memory areas allocated so far. Called by
+    // commands after they have built their large indexes. Only the first
+    // call does anything.
+    void use_huge_pages();
+
+    // The thread pool with m_threads threads used for all parallel work
+    // of the command. It is created when it is first used.
+    osmium::thread::Pool& thread_pool();
+
+    // Write the metrics to the file set with the --metrics option (if
+    // any). Called after the command has run.
+    void write_metrics(const std::string& command, bool success);
+
+    // Verbose output of the command, also used for messages about the
+    // command from outside (such as from the result cache).
+    osmium::VerboseOutput& vout() noexcept {
+        return m_vout;
+    }
+
+    // Memory budget in bytes, 0 if there is no budget.
+    uint64_t memory_budget() const noexcept {
+        return static_cast<uint64_t>(m_memory_budget) * 1024UL * 1024UL;
+    }
+
+    // Does something estimated to need this many bytes fit into the
+    // memory budget? Always true if there is no budget.
+    bool fits_memory_budget(uint64_t bytes) const noexcept {
+        return m_memory_budget == 0 || bytes <= memory_budget();
+    }
+
     osmium::osm_entity_bits::type osm_entity_bits() const {
         return m_osm_entity_bits;
     }
@@ -186,6 +249,11 @@ protected:
     osmium::io::File m_output_file;
     osmium::io::overwrite m_output_overwrite = osmium::io::overwrite::no;
     osmium::io::fsync m_fsync = osmium::io::fsync::no;
+    int m_output_threads = 0;
+    std::string m_output_compression;
+    int m_output_compression_level = -1;
+    bool m_block_stats = false;
+    std::string m_cache_directory;
 
 public:
 
@@ -208,10 +276,23 @@ public:
 
     void setup_header(osmium::io::Header& header) const;
 
+    // Called after the command has run and the output file is closed.
+    void finish_output() const;
+
     osmium::io::overwrite output_overwrite() const {
         return m_output_overwrite;
     }
 
+    const std::string& output_filename() const noexcept {
+        return m_output_filename;
+    }
+
+    // Directory set with --cache-dir, empty if the result cache is not
+    // used.
+    const std::string& cache_directory() const noexcept {
+        return m_cache_directory;
+    }
+
 }; // class with_osm_output
 
 
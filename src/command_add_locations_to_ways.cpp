@@ -22,26 +22,38 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "command_add_locations_to_ways.hpp"
 #include "exception.hpp"
+#include "location_index.hpp"
+#include "read_ahead.hpp"
+#include "trace.hpp"
 #include "util.hpp"
 
+#include <osmium/index/index.hpp>
 #include <osmium/index/map.hpp>
 #include <osmium/io/file.hpp>
 #include <osmium/io/header.hpp>
 #include <osmium/io/reader.hpp>
 #include <osmium/io/writer.hpp>
 #include <osmium/memory/buffer.hpp>
+#include <osmium/osm/entity_bits.hpp>
 #include <osmium/osm/item_type.hpp>
 #include <osmium/osm/location.hpp>
 #include <osmium/osm/node.hpp>
+#include <osmium/osm/node_ref.hpp>
 #include <osmium/osm/types.hpp>
+#include <osmium/osm/way.hpp>
+#include <osmium/thread/pool.hpp>
 #include <osmium/util/progress_bar.hpp>
 #include <osmium/util/verbose_output.hpp>
-#include <osmium/visitor.hpp>
 
 #include <boost/program_options.hpp>
 
+#include <algorithm>
+#include <cstddef>
+#include <fstream>
+#include <future>
 #include <iostream>
 #include <iterator>
+#include <memory>
 #include <string>
 #include <utility>
 #include <vector>
@@ -54,8 +66,10 @@ bool CommandAddLocationsToWays::setup(const std::vector<std::string>& arguments)
     opts_cmd.add_options()
     ("index-type,i", po::value<std::string>()->default_value(default_index_type), "Index type to use")
     ("show-index-types,I", "Show available index types")
+    ("index-file", po::value<std::string>(), "Keep node location index in this file for later use")
     ("keep-untagged-nodes,n", "Keep untagged nodes")
     ("ignore-missing-nodes", "Ignore missing nodes")
+    ("index-nodes-first", "Index nodes from all input files concurrently before copying")
     ;
 
     po::options_description opts_common{add_common_options()};
@@ -84,12 +98,13 @@ bool CommandAddLocationsToWays::setup(const std::vector<std::string>& arguments)
         for (const auto& map_type : map_factory.map_types()) {
             std::cout << map_type << '\n';
         }
+        std::cout << "auto\n";
         return false;
     }
 
     if (vm.count("index-type")) {
         m_index_type_name = vm["index-type"].as<std::string>();
-        if (!map_factory.has_map_type(m_index_type_name)) {
+        if (m_index_type_name != "auto" && !map_factory.has_map_type(m_index_type_name)) {
             throw argument_error{std::string{"Unknown index type '"} + m_index_type_name + "'. Use --show-index-types or -I to get a list."};
         }
     }
@@ -99,6 +114,33 @@ bool CommandAddLocationsToWays::setup(const std::vector<std::string>& arguments)
     setup_input_files(vm);
     setup_output_file(vm);
 
+    if (m_index_type_name == "auto") {
+        const auto choice = choose_location_index(m_input_files);
+        m_index_type_name = choice.type;
+        m_index_type_reason = choice.reason;
+    }
+
+    if (vm.count("index-file")) {
+        m_index_file_name = vm["index-file"].as<std::string>();
+        if (m_index_type_name.find(',') != std::string::npos) {
+            throw argument_error{"Can not use --index-file together with an index type that has a file name."};
+        }
+        // The file based index types keep the data in an mmap'ed file
+        // which is left on disk and can be used again with the same
+        // index type and file name.
+        const std::string base_type{m_index_type_name.find("sparse") == std::string::npos ? "dense_file_array" : "sparse_file_array"};
+        if (!map_factory.has_map_type(base_type)) {
+            throw argument_error{std::string{"Index type '"} + base_type + "' needed for --index-file is not available on this system."};
+        }
+        if (std::ifstream{m_index_file_name}.is_open() && m_output_overwrite != osmium::io::overwrite::allow) {
+            throw argument_error{"Index file '" + m_index_file_name + "' exists. Use --overwrite/-O to replace it."};
+        }
+        // The index is built under a temporary name and only replaces an
+        // existing index file when it is complete.
+        m_index_file_identity = index_file_identity(base_type, m_input_files);
+        m_index_type_name = base_type + "," + partial_index_filename(m_index_file_name);
+    }
+
     if (vm.count("keep-untagged-nodes")) {
         m_keep_untagged_nodes = true;
     }
@@ -107,6 +149,15 @@ bool CommandAddLocationsToWays::setup(const std::vector<std::string>& arguments)
         m_ignore_missing_nodes = true;
     }
 
+    if (vm.count("index-nodes-first")) {
+        m_index_nodes_first = true;
+        for (const auto& input_file : m_input_files) {
+            if (is_stdin_or_pipe(input_file.filename())) {
+                throw argument_error{"Can not use --index-nodes-first when reading from STDIN."};
+            }
+        }
+    }
+
     return true;
 }
 
@@ -116,47 +167,199 @@ void CommandAddLocationsToWays::show_arguments() {
 
     m_vout << "  other options:\n";
     m_vout << "    index type: " << m_index_type_name << '\n';
+    if (!m_index_type_reason.empty()) {
+        m_vout << "      (chosen automatically: " << m_index_type_reason << ")\n";
+    }
+    if (!m_index_file_name.empty()) {
+        m_vout << "    index file: " << m_index_file_name << '\n';
+    }
     m_vout << "    keep untagged nodes: " << yes_no(m_keep_untagged_nodes);
+    m_vout << "    index nodes first: " << yes_no(m_index_nodes_first);
+    m_vout << "    threads: " << m_threads << '\n';
     m_vout << '\n';
 }
 
-void CommandAddLocationsToWays::copy_data(osmium::ProgressBar& progress_bar, osmium::io::Reader& reader, osmium::io::Writer& writer, location_handler_type& location_handler) {
-    while (osmium::memory::Buffer buffer = reader.read()) {
+namespace {
+
+    // Look up this many locations together. The lookups are sorted by
+    // node ID, so that the index is accessed in order.
+    constexpr const std::size_t lookup_batch_size = 4UL * 1024UL * 1024UL;
+
+    // Number of input files read ahead while indexing the nodes with
+    // --index-nodes-first.
+    constexpr const std::size_t index_read_ahead = 1;
+
+    template <typename TIterator>
+    void lookup_range(const index_type& index, TIterator begin, TIterator end) {
+        for (auto it = begin; it != end; ++it) {
+            it->second->set_location(index.get_noexcept(it->first));
+        }
+    }
+
+} // anonymous namespace
+
+void CommandAddLocationsToWays::lookup_locations(index_type& index) {
+    const TraceSpan span{"index lookups"};
+
+    if (m_index_needs_sort) {
+        index.sort();
+        m_index_needs_sort = false;
+        use_huge_pages();
+    }
+
+    std::sort(m_lookups.begin(), m_lookups.end(), [](const std::pair<osmium::unsigned_object_id_type, osmium::NodeRef*>& lhs,
+                                                     const std::pair<osmium::unsigned_object_id_type, osmium::NodeRef*>& rhs) {
+        return lhs.first < rhs.first;
+    });
+
+    const auto num_threads = static_cast<std::size_t>(m_threads);
+    if (num_threads <= 1 || m_lookups.size() < num_threads * 1000) {
+        lookup_range(index, m_lookups.begin(), m_lookups.end());
+    } else {
+        auto& pool = thread_pool();
+        std::vector<std::future<void>> futures;
+        const auto size = m_lookups.size();
+        for (std::size_t n = 0; n < num_threads; ++n) {
+            const auto begin = m_lookups.begin() + static_cast<std::ptrdiff_t>(size * n / num_threads);
+            const auto end = m_lookups.begin() + static_cast<std::ptrdiff_t>(size * (n + 1) / num_threads);
+            const index_type& const_index = index;
+            futures.push_back(pool.submit([&const_index, begin, end]() {
+                const TraceSpan span{"index lookups (thread)"};
+                lookup_range(const_index, begin, end);
+            }));
+        }
+        for (auto& future : futures) {
+            future.get();
+        }
+    }
+
+    if (!m_ignore_missing_nodes) {
+        for (const auto& lookup : m_lookups) {
+            if (!lookup.second->location().valid()) {
+                throw osmium::not_found{lookup.second->ref()};
+            }
+        }
+    }
+
+    m_lookups.clear();
+}
+
+void CommandAddLocationsToWays::write_buffer(osmium::io::Writer& writer, osmium::memory::Buffer&& buffer) {
+    const TraceSpan span{"write"};
+    if (m_keep_untagged_nodes) {
+        writer(std::move(buffer));
+    } else {
+        for (const auto& object : buffer) {
+            if (object.type() != osmium::item_type::node || !static_cast<const osmium::Node&>(object).tags().empty()) {
+                writer(object);
+            }
+        }
+    }
+}
+
+void CommandAddLocationsToWays::flush(osmium::io::Writer& writer, index_type& index) {
+    lookup_locations(index);
+    for (auto& buffer : m_pending_buffers) {
+        write_buffer(writer, std::move(buffer));
+    }
+    m_pending_buffers.clear();
+}
+
+void CommandAddLocationsToWays::copy_data(osmium::ProgressBar& progress_bar, osmium::io::Reader& reader, osmium::io::Writer& writer, index_type& index) {
+    while (osmium::memory::Buffer buffer = traced_read(reader)) {
         progress_bar.update(reader.offset());
-        osmium::apply(buffer, location_handler);
-
-        if (m_keep_untagged_nodes) {
-            writer(std::move(buffer));
-        } else {
-            for (const auto& object : buffer) {
-                if (object.type() != osmium::item_type::node || !static_cast<const osmium::Node&>(object).tags().empty()) {
-                    writer(object);
+
+        // With --index-nodes-first all nodes are already in the index
+        if (!m_index_nodes_first) {
+            bool has_nodes = false;
+            for (const auto& node : buffer.select<osmium::Node>()) {
+                if (!has_nodes && !m_pending_buffers.empty()) {
+                    // Ways already collected must not see nodes added later
+                    flush(writer, index);
+                }
+                has_nodes = true;
+                if (node.id() >= 0) {
+                    index.set(node.positive_id(), node.location());
+                    m_index_needs_sort = true;
+                }
+            }
+        }
+
+        for (auto& way : buffer.select<osmium::Way>()) {
+            for (auto& node_ref : way.nodes()) {
+                if (node_ref.ref() >= 0) {
+                    m_lookups.emplace_back(node_ref.positive_ref(), &node_ref);
+                } else {
+                    // Negative IDs are never in the index
+                    node_ref.set_location(osmium::Location{});
+                    if (!m_ignore_missing_nodes) {
+                        throw osmium::not_found{node_ref.ref()};
+                    }
+                }
+            }
+        }
+
+        if (m_lookups.empty() && m_pending_buffers.empty()) {
+            write_buffer(writer, std::move(buffer));
+            continue;
+        }
+
+        m_pending_buffers.push_back(std::move(buffer));
+        if (m_lookups.size() >= lookup_batch_size) {
+            flush(writer, index);
+        }
+    }
+
+    flush(writer, index);
+}
+
+void CommandAddLocationsToWays::index_nodes(index_type& index) {
+    const TraceSpan span{"index nodes"};
+    m_vout << "Indexing nodes from " << m_input_files.size() << " input file(s)...\n";
+
+    // The files are indexed in the order they were given, so if a node
+    // is in several files, the location from the last file is used. The
+    // next file is already read and decoded while the current one is
+    // added to the index.
+    ReadAhead inputs{m_input_files, osmium::osm_entity_bits::node, index_read_ahead, osmium::io::read_meta::no};
+    while (std::unique_ptr<osmium::io::Reader> reader = inputs.next()) {
+        while (osmium::memory::Buffer buffer = reader->read()) {
+            for (const auto& node : buffer.select<osmium::Node>()) {
+                if (node.id() >= 0) {
+                    index.set(node.positive_id(), node.location());
                 }
             }
         }
+        reader->close();
     }
+
+    m_index_needs_sort = true;
 }
 
 bool CommandAddLocationsToWays::run() {
+    if (!m_index_file_name.empty()) {
+        clear_index_file(m_index_file_name);
+    }
+
     const auto& map_factory = osmium::index::MapFactory<osmium::unsigned_object_id_type, osmium::Location>::instance();
     auto location_index = map_factory.create_map(m_index_type_name);
-    location_handler_type location_handler{*location_index};
-
-    if (m_ignore_missing_nodes) {
-        location_handler.ignore_errors();
-    }
 
     m_output_file.set("locations_on_ways");
+    const auto read_metadata = has_metadata_output(m_output_file) ? osmium::io::read_meta::yes : osmium::io::read_meta::no;
+
+    if (m_index_nodes_first) {
+        index_nodes(*location_index);
+    }
 
     if (m_input_files.size() == 1) { // single input file
         m_vout << "Copying input file '" << m_input_files[0].filename() << "'\n";
-        osmium::io::Reader reader{m_input_files[0]};
+        osmium::io::Reader reader{m_input_files[0], read_metadata};
         osmium::io::Header header{reader.header()};
         setup_header(header);
         osmium::io::Writer writer(m_output_file, header, m_output_overwrite, m_fsync);
 
         osmium::ProgressBar progress_bar{reader.file_size(), display_progress()};
-        copy_data(progress_bar, reader, writer, location_handler);
+        copy_data(progress_bar, reader, writer, *location_index);
         progress_bar.done();
 
         writer.close();
@@ -170,9 +373,9 @@ bool CommandAddLocationsToWays::run() {
         for (const auto& input_file : m_input_files) {
             progress_bar.remove();
             m_vout << "Copying input file '" << input_file.filename() << "'\n";
-            osmium::io::Reader reader(input_file);
+            osmium::io::Reader reader(input_file, read_metadata);
 
-            copy_data(progress_bar, reader, writer, location_handler);
+            copy_data(progress_bar, reader, writer, *location_index);
 
             progress_bar.file_done(reader.file_size());
             reader.close();
@@ -181,6 +384,15 @@ bool CommandAddLocationsToWays::run() {
         writer.close();
     }
 
+    if (!m_index_file_name.empty()) {
+        // Sparse indexes must be sorted before they can be used again.
+        location_index->sort();
+        complete_index_file(m_index_file_name, m_index_file_identity);
+        m_vout << "Node location index kept in file '" << m_index_file_name << "'. Use it again with '-i "
+               << m_index_type_name.substr(0, m_index_type_name.find(',') + 1) << m_index_file_name << "'.\n";
+    }
+
+    m_metrics.set_max("index_memory_bytes", location_index->used_memory());
     m_vout << "About " << (location_index->used_memory() / (1024 * 1024)) << " MBytes used for node location index (in main memory or on disk).\n";
     show_memory_used();
     m_vout << "Done.\n";
@@ -25,25 +25,43 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "cmd.hpp" // IWYU pragma: export
 
-#include <osmium/handler/node_locations_for_ways.hpp>
 #include <osmium/index/map/all.hpp>
 #include <osmium/io/reader.hpp>
 #include <osmium/io/writer.hpp>
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm/node_ref.hpp>
+#include <osmium/osm/types.hpp>
 #include <osmium/util/progress_bar.hpp>
 
 #include <string>
+#include <utility>
 #include <vector>
 
 using index_type = osmium::index::map::Map<osmium::unsigned_object_id_type, osmium::Location>;
-using location_handler_type = osmium::handler::NodeLocationsForWays<index_type>;
 
 class CommandAddLocationsToWays : public Command, public with_multiple_osm_inputs, public with_osm_output {
 
     std::string m_index_type_name;
+    std::string m_index_type_reason;
+    std::string m_index_file_name;
+    std::string m_index_file_identity;
     bool m_keep_untagged_nodes = false;
     bool m_ignore_missing_nodes = false;
+    bool m_index_nodes_first = false;
 
-    void copy_data(osmium::ProgressBar& progress_bar, osmium::io::Reader& reader, osmium::io::Writer& writer, location_handler_type& location_handler);
+    // Buffers whose way node locations haven't been looked up yet and
+    // the node refs in them which need a location.
+    std::vector<osmium::memory::Buffer> m_pending_buffers;
+    std::vector<std::pair<osmium::unsigned_object_id_type, osmium::NodeRef*>> m_lookups;
+    bool m_index_needs_sort = false;
+
+    void lookup_locations(index_type& index);
+    void flush(osmium::io::Writer& writer, index_type& index);
+    void write_buffer(osmium::io::Writer& writer, osmium::memory::Buffer&& buffer);
+
+    void index_nodes(index_type& index);
+
+    void copy_data(osmium::ProgressBar& progress_bar, osmium::io::Reader& reader, osmium::io::Writer& writer, index_type& index);
 
 public:
 
@@ -65,6 +83,10 @@ public:
         return "osmium add-locations-to-ways [OPTIONS] OSM-FILE...";
     }
 
+    bool supports_huge_pages() const noexcept override final {
+        return true;
+    }
+
 }; // class CommandAddLocationsToWays
 
 
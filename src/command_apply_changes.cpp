@@ -20,13 +20,22 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 */
 
+#include "change_stream.hpp"
+#include "chunked_reader.hpp"
 #include "command_apply_changes.hpp"
 #include "exception.hpp"
+#include "object_sort.hpp"
+#include "object_store.hpp"
+#include "pbf_blocks.hpp"
+#include "prefetch.hpp"
+#include "temp_files.hpp"
 #include "util.hpp"
 
 #include <osmium/index/id_set.hpp>
-#include <osmium/index/map/sparse_mem_array.hpp>
+#include <osmium/io/error.hpp>
 #include <osmium/io/file.hpp>
+#include <osmium/io/file_compression.hpp>
+#include <osmium/io/file_format.hpp>
 #include <osmium/io/header.hpp>
 #include <osmium/io/input_iterator.hpp>
 #include <osmium/io/output_iterator.hpp>
@@ -36,9 +45,14 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <osmium/memory/buffer.hpp>
 #include <osmium/object_pointer_collection.hpp>
 #include <osmium/osm/entity_bits.hpp>
+#include <osmium/osm/location.hpp>
 #include <osmium/osm/object.hpp>
 #include <osmium/osm/object_comparisons.hpp>
 #include <osmium/osm/types.hpp>
+#include <osmium/osm/way.hpp>
+#include <osmium/thread/pool.hpp>
+#include <osmium/util/file.hpp>
+#include <osmium/util/progress_bar.hpp>
 #include <osmium/util/verbose_output.hpp>
 #include <osmium/visitor.hpp>
 
@@ -46,12 +60,126 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <boost/program_options.hpp>
 
 #include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <sstream>
 #include <stdexcept>
 #include <string>
 #include <utility>
 #include <vector>
 
-using location_index_type = osmium::index::map::SparseMemArray<osmium::unsigned_object_id_type, osmium::Location>;
+namespace {
+
+    /**
+     * Location index for the nodes needed to update the ways. This is a
+     * hash table with open addressing and linear probing. Its size is
+     * fixed when it is created from the size of the change set, so
+     * locations can be added and looked up in any order without sorting
+     * or rehashing.
+     *
+     * The index has a bitmap with one bit for each node ID (modulo the
+     * size of the bitmap). Almost all ways in the input file don't
+     * reference any node in the index, the bitmap allows skipping them
+     * without looking up each of their nodes in the table.
+     */
+    class FilteredLocationIndex {
+
+        static constexpr const std::size_t filter_bits = 1UL << 24U;
+
+        // ID 0 is used to mark empty slots, so all IDs are stored plus one.
+        struct slot {
+            osmium::unsigned_object_id_type id = 0;
+            osmium::Location location{};
+        };
+
+        std::vector<slot> m_table;
+        std::vector<bool> m_filter;
+        std::size_t m_mask;
+        std::size_t m_size = 0;
+
+        static std::size_t table_size(std::size_t max_entries) noexcept {
+            std::size_t size = 16;
+            while (size < max_entries * 2) {
+                size <<= 1U;
+            }
+            return size;
+        }
+
+        std::size_t hash(osmium::unsigned_object_id_type id) const noexcept {
+            return static_cast<std::size_t>((id * 0x9e3779b97f4a7c15ULL) >> 32U) & m_mask;
+        }
+
+    public:
+
+        explicit FilteredLocationIndex(std::size_t max_entries) :
+            m_table(table_size(max_entries)),
+            m_filter(filter_bits),
+            m_mask(m_table.size() - 1) {
+        }
+
+        // Add location, the location of an ID already in the index is
+        // not changed. The table is never more than half full, so there
+        // is always an empty slot.
+        void set(osmium::unsigned_object_id_type id, const osmium::Location& location) {
+            const auto key = id + 1;
+            auto pos = hash(key);
+            while (m_table[pos].id != 0) {
+                if (m_table[pos].id == key) {
+                    return;
+                }
+                pos = (pos + 1) & m_mask;
+            }
+            if (m_size * 2 >= m_table.size()) {
+                throw std::runtime_error{"Location index is full."};
+            }
+            m_table[pos].id = key;
+            m_table[pos].location = location;
+            m_filter[id & (filter_bits - 1)] = true;
+            ++m_size;
+        }
+
+        // Set the locations of all nodes in the list found in the index.
+        // The table slots for a batch of nodes are prefetched before they
+        // are looked up, so the cache misses of the batch overlap.
+        void update_locations(osmium::WayNodeList& nodes) const noexcept {
+            std::array<std::pair<osmium::NodeRef*, std::size_t>, prefetch_batch_size> batch;
+            auto it = nodes.begin();
+            while (it != nodes.end()) {
+                std::size_t count = 0;
+                for (; it != nodes.end() && count < batch.size(); ++it) {
+                    const auto id = it->positive_ref();
+                    if (m_filter[id & (filter_bits - 1)]) {
+                        const auto pos = hash(id + 1);
+                        prefetch(&m_table[pos]);
+                        batch[count++] = std::make_pair(&*it, pos);
+                    }
+                }
+                for (std::size_t n = 0; n < count; ++n) {
+                    const auto key = batch[n].first->positive_ref() + 1;
+                    for (auto pos = batch[n].second; m_table[pos].id != 0; pos = (pos + 1) & m_mask) {
+                        if (m_table[pos].id == key) {
+                            if (m_table[pos].location) {
+                                batch[n].first->set_location(m_table[pos].location);
+                            }
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+
+        std::size_t size() const noexcept {
+            return m_size;
+        }
+
+    }; // class FilteredLocationIndex
+
+} // anonymous namespace
 
 bool CommandApplyChanges::setup(const std::vector<std::string>& arguments) {
     po::options_description opts_cmd{"COMMAND OPTIONS"};
@@ -62,6 +190,13 @@ bool CommandApplyChanges::setup(const std::vector<std::string>& arguments) {
     ("remove-deleted,r",  "Remove deleted objects from output (deprecated)")
     ("with-history,H",    "Apply changes to history file")
     ("locations-on-ways", "Expect and update locations on ways")
+    ("sorted-changes",    "Change files are sorted, read them while merging")
+    ("copy-blocks",       "Copy PBF blocks not affected by the changes without decoding them")
+    ("block-index", po::value<std::string>(), "Use this index of PBF blocks for --copy-blocks")
+    ("parse-threads", po::value<int>(), "Number of threads for parsing XML and OPL change files (default: 1)")
+    ("store", po::value<std::string>(), "Apply changes to the object store in this directory")
+    ("create-store", "Create object store from the OSM file first")
+    ("batch", po::value<std::string>(), "Apply changes to all pairs of input and output files listed in this file")
     ;
 
     po::options_description opts_common{add_common_options()};
@@ -90,15 +225,42 @@ bool CommandApplyChanges::setup(const std::vector<std::string>& arguments) {
 
     setup_common(vm, desc);
     setup_progress(vm);
-    setup_input_file(vm);
-    setup_output_file(vm);
 
-    if (vm.count("change-filenames")) {
-        m_change_filenames = vm["change-filenames"].as<std::vector<std::string>>();
+    if (vm.count("batch")) {
+        if (vm.count("store") || vm.count("create-store")) {
+            throw argument_error{"Can not use --batch together with --store or --create-store."};
+        }
+        if (vm.count("output")) {
+            throw argument_error{"Can not use --batch together with --output/-o. The output files are set in the batch file."};
+        }
+        setup_batch(vm);
+    } else if (vm.count("store")) {
+        m_store_directory = vm["store"].as<std::string>();
+        m_create_store = vm.count("create-store") != 0;
+        setup_store(vm);
     } else {
+        if (vm.count("create-store")) {
+            throw argument_error{"The --create-store option only works together with --store."};
+        }
+        setup_input_file(vm);
+        setup_output_file(vm);
+    }
+
+    if (vm.count("change-filenames")) {
+        const auto& filenames = vm["change-filenames"].as<std::vector<std::string>>();
+        m_change_filenames.insert(m_change_filenames.end(), filenames.begin(), filenames.end());
+    } else if (m_store_directory.empty() && m_batch.empty()) {
         throw argument_error{"Need data file and at least one change file on the command line."};
     }
 
+    if (!m_batch.empty() && m_change_filenames.empty()) {
+        throw argument_error{"Need at least one change file on the command line."};
+    }
+
+    if (!m_create_store && !m_store_directory.empty() && m_change_filenames.empty()) {
+        throw argument_error{"Need at least one change file on the command line."};
+    }
+
     if (vm.count("change-file-format")) {
         m_change_file_format = vm["change-file-format"].as<std::string>();
     }
@@ -113,7 +275,15 @@ bool CommandApplyChanges::setup(const std::vector<std::string>& arguments) {
         }
         m_with_history = true;
         m_output_file.set_has_multiple_object_versions(true);
-    } else {
+    } else if (!m_batch.empty()) {
+        for (const auto& entry : m_batch) {
+            const osmium::io::File input_file{entry.first, m_input_format};
+            const osmium::io::File output_file{entry.second, m_output_format};
+            if (input_file.has_multiple_object_versions() || output_file.has_multiple_object_versions()) {
+                throw argument_error{"Use --with-history/-H to apply changes to history files with --batch."};
+            }
+        }
+    } else if (m_store_directory.empty()) {
         if (m_input_file.has_multiple_object_versions() && m_output_file.has_multiple_object_versions()) {
             if (m_locations_on_ways) {
                 throw argument_error{"Can not use --locations-on-ways on history files."};
@@ -133,6 +303,20 @@ bool CommandApplyChanges::setup(const std::vector<std::string>& arguments) {
         m_output_file.set_has_multiple_object_versions(true);
     }
 
+    if (vm.count("sorted-changes")) {
+        if (m_locations_on_ways) {
+            throw argument_error{"Can not use --sorted-changes and --locations-on-ways together."};
+        }
+        m_sorted_changes = true;
+    }
+
+    if (vm.count("parse-threads")) {
+        m_parse_threads = vm["parse-threads"].as<int>();
+        if (m_parse_threads < 1) {
+            throw argument_error{"The --parse-threads option needs a positive number."};
+        }
+    }
+
     if (vm.count("simplify")) {
         warning("-s, --simplify option is deprecated. Please see manual page.\n");
         m_with_history = false;
@@ -143,11 +327,158 @@ bool CommandApplyChanges::setup(const std::vector<std::string>& arguments) {
         m_with_history = false;
     }
 
+    if (vm.count("block-index")) {
+        m_block_index_filename = vm["block-index"].as<std::string>();
+        m_copy_blocks = true;
+    }
+
+    if (vm.count("copy-blocks")) {
+        m_copy_blocks = true;
+    }
+
+    if (!m_batch.empty()) {
+        if (m_locations_on_ways) {
+            throw argument_error{"Can not use --batch together with --locations-on-ways."};
+        }
+        if (m_sorted_changes) {
+            throw argument_error{"Can not use --batch together with --sorted-changes."};
+        }
+        if (m_copy_blocks) {
+            throw argument_error{"Can not use --batch together with --copy-blocks or --block-index."};
+        }
+    }
+
+    if (!m_store_directory.empty()) {
+        if (m_locations_on_ways) {
+            throw argument_error{"Can not use --store together with --locations-on-ways."};
+        }
+        if (m_sorted_changes) {
+            throw argument_error{"Can not use --store together with --sorted-changes."};
+        }
+        if (m_copy_blocks) {
+            throw argument_error{"Can not use --store together with --copy-blocks or --block-index."};
+        }
+    }
+
+    if (m_copy_blocks) {
+        if (m_locations_on_ways) {
+            throw argument_error{"Can not use --copy-blocks or --block-index together with --locations-on-ways."};
+        }
+        if (m_sorted_changes) {
+            throw argument_error{"Can not use --copy-blocks or --block-index together with --sorted-changes."};
+        }
+        if (m_input_file.format() != osmium::io::file_format::pbf || m_output_file.format() != osmium::io::file_format::pbf) {
+            throw argument_error{"The --copy-blocks and --block-index options only work with PBF input and output files."};
+        }
+        if (m_input_filename.empty() || m_input_filename == "-" || m_output_filename.empty() || m_output_filename == "-") {
+            throw argument_error{"Can not use --copy-blocks or --block-index when reading from STDIN or writing to STDOUT."};
+        }
+    }
+
+    // All changes are read into memory unless they are sorted. Osmium
+    // can't know whether they are, so it can only warn.
+    if (!m_sorted_changes && m_memory_budget > 0) {
+        std::vector<osmium::io::File> change_files;
+        for (const auto& filename : m_change_filenames) {
+            change_files.emplace_back(filename, m_change_file_format);
+        }
+        if (!fits_memory_budget(estimate_buffer_memory(change_files))) {
+            warning("The changes probably don't fit into the memory budget. Use --sorted-changes if the change files are sorted.\n");
+        }
+    }
+
     return true;
 }
 
+// In store mode there is no input file unless the store is created
+// from one, so the first positional argument is a change file. The
+// output file is optional, it gets a snapshot of the store.
+void CommandApplyChanges::setup_store(const boost::program_options::variables_map& vm) {
+    if (m_create_store) {
+        setup_input_file(vm);
+        if (m_input_file.format() != osmium::io::file_format::pbf || is_stdin_or_pipe(m_input_filename)) {
+            throw argument_error{"The object store can only be created from a PBF file."};
+        }
+    } else if (vm.count("input-filename")) {
+        m_change_filenames.push_back(vm["input-filename"].as<std::string>());
+    }
+
+    if (vm.count("output")) {
+        m_write_snapshot = true;
+        setup_output_file(vm);
+    }
+}
+
+// In batch mode the input and output files are read from the batch
+// file, all positional arguments are change files. Each line of the
+// batch file has the name of an input file and the name of an output
+// file separated by whitespace.
+void CommandApplyChanges::setup_batch(const boost::program_options::variables_map& vm) {
+    const auto& file_name = vm["batch"].as<std::string>();
+    std::ifstream file{file_name};
+    if (!file.is_open()) {
+        throw argument_error{"Could not open batch file '" + file_name + "'"};
+    }
+
+    std::size_t line_number = 0;
+    for (std::string line; std::getline(file, line);) {
+        ++line_number;
+        const auto pos = line.find_first_of('#');
+        if (pos != std::string::npos) {
+            line.erase(pos);
+        }
+        std::istringstream fields{line};
+        std::string input_name;
+        std::string output_name;
+        std::string rest;
+        if (!(fields >> input_name)) {
+            continue;
+        }
+        if (!(fields >> output_name) || (fields >> rest)) {
+            throw argument_error{"Line " + std::to_string(line_number) + " of batch file '" + file_name + "' must contain an input and an output file name."};
+        }
+        if (input_name == "-" || output_name == "-") {
+            throw argument_error{"Can not read from STDIN or write to STDOUT with --batch."};
+        }
+        m_batch.emplace_back(input_name, output_name);
+    }
+
+    if (m_batch.empty()) {
+        throw argument_error{"Batch file '" + file_name + "' doesn't contain any input and output files."};
+    }
+
+    if (vm.count("input-filename")) {
+        m_change_filenames.push_back(vm["input-filename"].as<std::string>());
+    }
+
+    if (vm.count("input-format")) {
+        m_input_format = vm["input-format"].as<std::string>();
+    }
+
+    init_output_file(vm);
+    if (m_block_stats) {
+        throw argument_error{"Can not use --block-stats together with --batch."};
+    }
+    for (const auto& entry : m_batch) {
+        osmium::io::File output_file{entry.second, m_output_format};
+        output_file.check();
+    }
+}
+
 void CommandApplyChanges::show_arguments() {
-    m_vout << "  input data file name: " << m_input_filename << "\n";
+    if (!m_store_directory.empty()) {
+        m_vout << "  object store: " << m_store_directory << "\n";
+        m_vout << "  create object store: " << yes_no(m_create_store);
+        m_vout << "  write snapshot: " << yes_no(m_write_snapshot);
+    }
+    if (m_batch.empty()) {
+        m_vout << "  input data file name: " << m_input_filename << "\n";
+    } else {
+        m_vout << "  input and output data file names: \n";
+        for (const auto& entry : m_batch) {
+            m_vout << "    " << entry.first << " -> " << entry.second << "\n";
+        }
+    }
     m_vout << "  input change file names: \n";
     for (const auto& fn : m_change_filenames) {
         m_vout << "    " << fn << "\n";
@@ -157,6 +488,13 @@ void CommandApplyChanges::show_arguments() {
     show_output_arguments(m_vout);
     m_vout << "  reading and writing history file: " << yes_no(m_with_history);
     m_vout << "  locations on ways: " << yes_no(m_locations_on_ways);
+    m_vout << "  sorted change files: " << yes_no(m_sorted_changes);
+    m_vout << "  copy PBF blocks: " << yes_no(m_copy_blocks);
+    if (!m_block_index_filename.empty()) {
+        m_vout << "  block index: " << m_block_index_filename << "\n";
+    }
+    m_vout << "  threads: " << m_threads << '\n';
+    m_vout << "  parse threads: " << m_parse_threads << '\n';
 }
 
 namespace {
@@ -190,33 +528,542 @@ namespace {
 
     }; // class copy_first_with_id
 
+    pbf_object_key get_object_key(const osmium::OSMObject& object) noexcept {
+        pbf_object_key key;
+        key.type = object.type();
+        key.positive = object.id() > 0;
+        key.id = object.positive_id();
+        return key;
+    }
+
+    bool same_key(const pbf_object_key& lhs, const pbf_object_key& rhs) noexcept {
+        return !(lhs < rhs) && !(rhs < lhs);
+    }
+
+    /**
+     * Consecutive blocks of the input file. Usually this is a single
+     * block, but in history files the versions of an object can be
+     * spread over several blocks. Those have to be merged with the
+     * changes together.
+     */
+    struct block_group {
+        std::vector<std::size_t> offsets;
+        pbf_object_key max;
+        bool last = false;
+    };
+
 } // anonymous namespace
 
-static void update_nodes_if_way(osmium::OSMObject& object, const location_index_type& location_index) {
+static void update_nodes_if_way(osmium::OSMObject& object, const FilteredLocationIndex& location_index) {
     if (object.type() != osmium::item_type::way) {
         return;
     }
 
-    for (auto& node_ref : static_cast<osmium::Way&>(object).nodes()) {
-        auto location = location_index.get_noexcept(node_ref.positive_ref());
-        if (location) {
-            node_ref.set_location(location);
+    location_index.update_locations(static_cast<osmium::Way&>(object).nodes());
+}
+
+// Merge the sorted change files with the input without reading the
+// change files into memory first. This does the same as the code in
+// run() below for the cases without --locations-on-ways.
+void CommandApplyChanges::apply_sorted_changes(osmium::io::Reader& reader, osmium::io::Writer& writer) {
+    std::vector<osmium::io::File> change_files;
+    for (const auto& filename : m_change_filenames) {
+        change_files.emplace_back(filename, m_change_file_format);
+    }
+    ChangeStream changes{change_files};
+
+    const auto input = osmium::io::make_input_iterator_range<osmium::OSMObject>(reader);
+    auto in_it = input.begin();
+    const auto in_end = input.end();
+
+    if (m_with_history) {
+        const auto less = [this](const osmium::OSMObject& lhs, const osmium::OSMObject& rhs) {
+            if (m_redact) {
+                return osmium::object_order_type_id_version_without_timestamp{}(lhs, rhs);
+            }
+            return osmium::object_order_type_id_version{}(lhs, rhs);
+        };
+
+        while (!changes.empty() || in_it != in_end) {
+            if (in_it == in_end || (!changes.empty() && !less(*in_it, changes.top()))) {
+                if (in_it != in_end && !less(changes.top(), *in_it)) {
+                    ++in_it;
+                }
+                writer(changes.top());
+                changes.next();
+            } else {
+                writer(*in_it);
+                ++in_it;
+            }
+        }
+    } else {
+        // Of all versions of an object in the change files only the last
+        // one is used, it replaces the object from the input.
+        osmium::memory::Buffer last_change{1024 * 1024, osmium::memory::Buffer::auto_grow::yes};
+        const osmium::object_order_type_id_reverse_version order{};
+        const osmium::object_equal_type_id equal{};
+
+        while (!changes.empty()) {
+            last_change.clear();
+            last_change.add_item(changes.top());
+            last_change.commit();
+            changes.next();
+            while (!changes.empty() && equal(changes.top(), *last_change.begin<osmium::OSMObject>())) {
+                last_change.clear();
+                last_change.add_item(changes.top());
+                last_change.commit();
+                changes.next();
+            }
+            const auto& object = *last_change.begin<osmium::OSMObject>();
+
+            while (in_it != in_end && order(*in_it, object) && !equal(*in_it, object)) {
+                writer(*in_it);
+                ++in_it;
+            }
+            while (in_it != in_end && equal(*in_it, object)) {
+                ++in_it;
+            }
+            if (object.visible()) {
+                writer(object);
+            }
+        }
+
+        while (in_it != in_end) {
+            writer(*in_it);
+            ++in_it;
         }
     }
+
+    changes.close();
 }
 
-bool CommandApplyChanges::run() {
-    std::vector<osmium::memory::Buffer> changes;
-    osmium::ObjectPointerCollection objects;
+// Sort the changes. For history files they are sorted by type, ID, and
+// version, for normal data files with the largest version of each object
+// first, so that only this last version is copied to the output.
+void CommandApplyChanges::sort_changes(osmium::ObjectPointerCollection& objects) {
+    m_vout << "Sorting change data...\n";
+    if (m_with_history) {
+        if (!radix_sort_objects(objects.ptr_begin(), objects.ptr_end(), m_parse_threads)) {
+            objects.sort(osmium::object_order_type_id_version());
+        }
+    } else {
+        if (!radix_sort_objects(objects.ptr_begin(), objects.ptr_end(), m_parse_threads, version_order::descending)) {
+            objects.sort(osmium::object_order_type_id_reverse_version{});
+        }
+    }
+}
 
-    m_vout << "Reading change file contents...\n";
+// Merge the sorted changes with the whole input file and write the
+// result. The changes are only read, so this can run for several input
+// files at the same time.
+void CommandApplyChanges::merge_input(osmium::ObjectPointerCollection& objects, osmium::io::Reader& reader, osmium::io::Writer& writer) const {
+    const auto input = osmium::io::make_input_iterator_range<osmium::OSMObject>(reader);
+
+    if (!m_with_history) {
+        std::set_union(objects.begin(),
+                       objects.end(),
+                       input.begin(),
+                       input.end(),
+                       boost::make_function_output_iterator(copy_first_with_id(writer)),
+                       osmium::object_order_type_id_reverse_version());
+        return;
+    }
+
+    auto out = osmium::io::make_output_iterator(writer);
+    if (m_redact) {
+        std::set_union(objects.begin(),
+                       objects.end(),
+                       input.begin(),
+                       input.end(),
+                       out,
+                       osmium::object_order_type_id_version_without_timestamp());
+    } else {
+        std::set_union(objects.begin(),
+                       objects.end(),
+                       input.begin(),
+                       input.end(),
+                       out);
+    }
+}
+
+// Apply the changes to all input files in the batch file. With several
+// threads that many input files are merged with the changes at the same
+// time, they all share the sorted changes.
+void CommandApplyChanges::apply_changes_batch(osmium::ObjectPointerCollection& objects) {
+    osmium::io::Header header;
+    setup_header(header);
+    if (m_with_history) {
+        header.set_has_multiple_object_versions(true);
+    }
 
+    const auto apply = [this, &objects, &header](const std::pair<std::string, std::string>& entry) {
+        const osmium::io::File input_file{entry.first, m_input_format};
+        osmium::io::File output_file{entry.second, m_output_format};
+        set_pbf_compression(output_file, m_output_compression, m_output_compression_level);
+        if (m_with_history) {
+            output_file.set_has_multiple_object_versions(true);
+        }
+
+        osmium::io::Reader reader{input_file, osmium::osm_entity_bits::object};
+        osmium::io::Writer writer{output_file, header, m_output_overwrite, m_fsync};
+        merge_input(objects, reader, writer);
+        writer.close();
+        reader.close();
+    };
+
+    m_vout << "Applying changes to " << m_batch.size() << " input files...\n";
+    osmium::ProgressBar progress_bar{m_batch.size(), display_progress()};
+
+    if (m_threads <= 1) {
+        std::size_t done = 0;
+        for (const auto& entry : m_batch) {
+            apply(entry);
+            progress_bar.update(++done);
+        }
+        progress_bar.done();
+        return;
+    }
+
+    auto& pool = thread_pool();
+    std::vector<std::future<void>> futures;
+    futures.reserve(m_batch.size());
+    for (const auto& entry : m_batch) {
+        futures.push_back(pool.submit([&apply, &entry]() {
+            apply(entry);
+        }));
+    }
+
+    // Wait for all files before get() can throw, they are still using
+    // the changes.
+    std::size_t done = 0;
+    for (auto& future : futures) {
+        future.wait();
+        progress_bar.update(++done);
+    }
+    progress_bar.done();
+    for (auto& future : futures) {
+        future.get();
+    }
+}
+
+// Merge the changes (sorted as for --copy-blocks) with the objects from
+// part of the input and write the result.
+void CommandApplyChanges::merge_changes(osmium::ObjectPointerCollection::iterator first,
+                                        osmium::ObjectPointerCollection::iterator last,
+                                        osmium::ObjectPointerCollection& input,
+                                        osmium::io::Writer& writer) const {
+    if (m_with_history) {
+        const auto less = [this](const osmium::OSMObject& lhs, const osmium::OSMObject& rhs) {
+            if (m_redact) {
+                return osmium::object_order_type_id_version_without_timestamp{}(lhs, rhs);
+            }
+            return osmium::object_order_type_id_version{}(lhs, rhs);
+        };
+        std::set_union(first, last, input.begin(), input.end(), osmium::io::make_output_iterator(writer), less);
+    } else {
+        // Only the last version of each object is used, deleted
+        // objects are removed.
+        std::set_union(first, last,
+                       input.begin(), input.end(),
+                       boost::make_function_output_iterator(copy_first_with_id(writer)),
+                       osmium::object_order_type_id_reverse_version());
+    }
+}
+
+// Merge the changes with a PBF file block by block. The key ranges of
+// the blocks come from the block index or, if there is none, from
+// reading the IDs in all blocks (which only needs decompressing them).
+// Each change object belongs to the first group of blocks whose largest
+// key is not smaller than the key of the object. Groups without any
+// changes are copied to the output as they are without decoding them.
+// The others are decoded, merged with their changes and encoded again
+// through a temporary file, like it is done by merge with --copy-blocks.
+void CommandApplyChanges::apply_changes_copy_blocks(osmium::ObjectPointerCollection& objects, const osmium::io::Header& header) {
+    pbf_block_index index;
+    if (m_block_index_filename.empty()) {
+        m_vout << "Reading ID ranges of all blocks in input file...\n";
+        index = build_pbf_block_index(m_input_filename);
+    } else {
+        m_vout << "Reading block index...\n";
+        index = read_pbf_block_index(m_block_index_filename);
+        if (index.file_size != osmium::file_size(m_input_filename)) {
+            throw std::runtime_error{"Block index '" + m_block_index_filename + "' does not match input file '" + m_input_filename + "'."};
+        }
+    }
+
+    std::vector<block_group> groups;
+    for (const auto& range : index.blocks) {
+        if (!groups.empty() && range.min < groups.back().max) {
+            throw std::runtime_error{"Blocks in input file '" + m_input_filename + "' are not sorted or overlap. Can not use --copy-blocks."};
+        }
+        if (groups.empty() || !same_key(groups.back().max, range.min)) {
+            groups.emplace_back();
+        }
+        groups.back().offsets.push_back(range.offset);
+        groups.back().max = range.max;
+    }
+    if (groups.empty()) {
+        groups.emplace_back();
+    }
+    groups.back().last = true;
+
+    PBFBlockReader reader{m_input_filename};
+    pbf_block block;
+
+    // Changed blocks are encoded again without the PBF features of the
+    // input file (like node locations on ways), so they can't be mixed
+    // with copied blocks using those features.
+    if (!reader.read(block) || block.type != "OSMHeader") {
+        throw osmium::io_error{"Missing header block in PBF file '" + m_input_filename + "'"};
+    }
+    const auto features = get_pbf_features(decode_pbf_header(block));
+    if (!features.empty()) {
+        throw std::runtime_error{"Input file '" + m_input_filename + "' uses PBF feature '" + features.front() + "'. Can not use --copy-blocks."};
+    }
+
+    m_vout << "Opening output file...\n";
+    PBFBlockWriter writer{m_output_filename, header, m_output_overwrite, m_fsync};
+
+    TempFiles temp_files{default_temp_directory(), "osmium-apply-changes", ".osm.pbf"};
+    // Temporary files are written with the same options as the output.
+    const auto make_temp_file = [&](const std::string& filename) {
+        osmium::io::File file{filename, "pbf"};
+        for (const auto& option : m_output_file) {
+            file.set(option.first, option.second);
+        }
+        file.set_has_multiple_object_versions(m_with_history);
+        return file;
+    };
+
+    const auto read_block = [&](std::size_t offset) {
+        reader.seek(offset);
+        if (!reader.read(block) || block.type != "OSMData") {
+            throw std::runtime_error{"Input file '" + m_input_filename + "' does not match the block index."};
+        }
+    };
+
+    m_vout << "Applying changes and writing them to output...\n";
+    osmium::ProgressBar progress_bar{index.file_size, display_progress()};
+    std::size_t blocks_copied = 0;
+    std::size_t blocks_merged = 0;
+    auto change_it = objects.begin();
+    for (auto it = groups.begin(); it != groups.end();) {
+        auto change_end = change_it;
+        while (change_end != objects.end() && (it->last || !(it->max < get_object_key(*change_end)))) {
+            ++change_end;
+        }
+
+        if (change_end == change_it) {
+            for (const auto offset : it->offsets) {
+                read_block(offset);
+                writer.write(block);
+                ++blocks_copied;
+            }
+            progress_bar.update(reader.offset());
+            ++it;
+            continue;
+        }
+
+        // Merge all consecutive groups with changes into one temporary
+        // file and copy its blocks to the output.
+        const std::string temp_filename{temp_files.create()};
+        {
+            osmium::io::Writer temp_writer{make_temp_file(temp_filename), header, osmium::io::overwrite::allow};
+
+            while (it != groups.end() && change_end != change_it) {
+                std::vector<osmium::memory::Buffer> buffers;
+                osmium::ObjectPointerCollection input;
+                for (const auto offset : it->offsets) {
+                    read_block(offset);
+                    buffers.push_back(decode_pbf_block(block, osmium::osm_entity_bits::object));
+                    osmium::apply(buffers.back(), input);
+                    ++blocks_merged;
+                }
+                progress_bar.update(reader.offset());
+
+                merge_changes(change_it, change_end, input, temp_writer);
+
+                change_it = change_end;
+                ++it;
+                if (it != groups.end()) {
+                    while (change_end != objects.end() && (it->last || !(it->max < get_object_key(*change_end)))) {
+                        ++change_end;
+                    }
+                }
+            }
+
+            temp_writer.close();
+        }
+
+        PBFBlockReader temp_reader{temp_filename};
+        while (temp_reader.read(block)) {
+            if (block.type == "OSMData") {
+                writer.write(block);
+            }
+        }
+        std::remove(temp_filename.c_str());
+    }
+    progress_bar.done();
+
+    m_vout << "Copied " << blocks_copied << " blocks, decoded and merged " << blocks_merged << " blocks.\n";
+
+    m_vout << "Closing output file...\n";
+    writer.close();
+}
+
+// Merge the changes with the pages of the object store. Only pages with
+// changes are read, they are merged with their changes like the blocks
+// with --copy-blocks and replace the old pages. The new index is only
+// written when all pages are done, so the store always has either all
+// or none of the changes.
+void CommandApplyChanges::apply_changes_to_store(ObjectStore& store, osmium::ObjectPointerCollection& objects) {
+    m_vout << "Applying changes to object store...\n";
+    osmium::ProgressBar progress_bar{store.size(), display_progress()};
+    std::size_t pages_merged = 0;
+    std::size_t n = 0;
+    auto change_it = objects.begin();
+    while (change_it != objects.end()) {
+        auto change_end = change_it;
+        while (change_end != objects.end() && !store.after_page(n, get_object_key(*change_end))) {
+            ++change_end;
+        }
+
+        if (change_end == change_it) {
+            ++n;
+            continue;
+        }
+
+        {
+            std::vector<osmium::memory::Buffer> buffers;
+            osmium::ObjectPointerCollection input;
+            osmium::io::Reader reader{store.page_filename(n), osmium::osm_entity_bits::object};
+            while (osmium::memory::Buffer buffer = reader.read()) {
+                osmium::apply(buffer, input);
+                buffers.push_back(std::move(buffer));
+            }
+            reader.close();
+
+            osmium::io::File file{store.temp_filename(), "pbf"};
+            file.set_has_multiple_object_versions(m_with_history);
+            osmium::io::Writer writer{file, store.header(), osmium::io::overwrite::allow};
+            merge_changes(change_it, change_end, input, writer);
+            writer.close();
+        }
+
+        n += store.replace_page(n);
+        ++pages_merged;
+        change_it = change_end;
+        progress_bar.update(n);
+    }
+    progress_bar.done();
+
+    m_vout << "Writing object store index...\n";
+    store.commit();
+
+    m_vout << "Rewrote " << pages_merged << " of " << store.size() << " pages.\n";
+}
+
+// PBF blocks are copied from the pages as they are. Other formats need
+// all objects to be decoded and encoded again.
+void CommandApplyChanges::write_store_snapshot(const ObjectStore& store) {
+    osmium::io::Header header;
+    setup_header(header);
+
+    // The store keeps the bounding boxes of the original file and its
+    // objects are always sorted.
+    for (const auto& box : store.header().boxes()) {
+        header.add_box(box);
+    }
+    header.set("sorting", "Type_then_ID");
+    if (m_with_history) {
+        header.set_has_multiple_object_versions(true);
+        m_output_file.set_has_multiple_object_versions(true);
+    }
+
+    m_vout << "Writing snapshot of object store to output...\n";
+    if (m_output_file.format() == osmium::io::file_format::pbf && m_output_file.compression() == osmium::io::file_compression::none) {
+        store.write_snapshot(m_output_filename, header, m_output_overwrite, m_fsync);
+        return;
+    }
+
+    osmium::io::Writer writer{m_output_file, header, m_output_overwrite, m_fsync};
+    for (std::size_t n = 0; n < store.size(); ++n) {
+        osmium::io::Reader reader{store.page_filename(n), osmium::osm_entity_bits::object};
+        while (osmium::memory::Buffer buffer = reader.read()) {
+            writer(std::move(buffer));
+        }
+        reader.close();
+    }
+    writer.close();
+}
+
+bool CommandApplyChanges::run() {
     for (const std::string& change_file_name : m_change_filenames) {
         if (change_file_name == "-" && m_change_file_format.empty()) {
             throw argument_error{"When reading the change file from STDIN you have to use\n"
                                  "the --change-file-format option to specify the file format."};
         }
+    }
+
+    std::unique_ptr<ObjectStore> store;
+    if (!m_store_directory.empty()) {
+        if (m_create_store) {
+            m_vout << "Creating object store from input file...\n";
+            ObjectStore::create(m_store_directory, m_input_filename, m_fsync);
+        }
+        m_vout << "Opening object store...\n";
+        store.reset(new ObjectStore{m_store_directory, m_fsync});
+        if (store->header().has_multiple_object_versions()) {
+            m_with_history = true;
+        }
+    }
+
+    if (m_sorted_changes) {
+        m_vout << "Opening input file...\n";
+        osmium::io::ReaderWithProgressBar reader{display_progress(), m_input_file, osmium::osm_entity_bits::object};
+
+        osmium::io::Header header;
+        setup_header(header);
+        if (m_with_history) {
+            header.set_has_multiple_object_versions(true);
+        }
+
+        m_vout << "Opening output file...\n";
+        osmium::io::Writer writer{m_output_file, header, m_output_overwrite, m_fsync};
+
+        m_vout << "Merging sorted change files with input and writing them to output...\n";
+        apply_sorted_changes(reader, writer);
+
+        writer.close();
+        reader.close();
+
+        show_memory_used();
+        m_vout << "Done.\n";
+
+        return true;
+    }
+
+    std::vector<osmium::memory::Buffer> changes;
+    osmium::ObjectPointerCollection objects;
+
+    m_vout << "Reading change file contents...\n";
+
+    std::unique_ptr<osmium::thread::Pool> parse_pool;
+    if (m_parse_threads > 1) {
+        parse_pool.reset(new osmium::thread::Pool{m_parse_threads});
+    }
+
+    for (const std::string& change_file_name : m_change_filenames) {
         osmium::io::File file{change_file_name, m_change_file_format};
+        if (parse_pool && ChunkedReader::supports(file)) {
+            ChunkedReader reader{file, osmium::osm_entity_bits::object, *parse_pool};
+            while (osmium::memory::Buffer buffer = reader.read()) {
+                osmium::apply(buffer, objects);
+                changes.push_back(std::move(buffer));
+            }
+            reader.close();
+            continue;
+        }
         osmium::io::Reader reader{file, osmium::osm_entity_bits::object};
         while (osmium::memory::Buffer buffer = reader.read()) {
             osmium::apply(buffer, objects);
@@ -224,6 +1071,42 @@ bool CommandApplyChanges::run() {
         }
         reader.close();
     }
+    parse_pool.reset();
+
+    if (!m_batch.empty()) {
+        sort_changes(objects);
+        apply_changes_batch(objects);
+
+        show_memory_used();
+        m_vout << "Done.\n";
+
+        return true;
+    }
+
+    if (m_copy_blocks || store) {
+        sort_changes(objects);
+
+        if (store) {
+            apply_changes_to_store(*store, objects);
+
+            if (m_write_snapshot) {
+                write_store_snapshot(*store);
+            }
+        } else {
+            osmium::io::Header header;
+            setup_header(header);
+            if (m_with_history) {
+                header.set_has_multiple_object_versions(true);
+            }
+
+            apply_changes_copy_blocks(objects, header);
+        }
+
+        show_memory_used();
+        m_vout << "Done.\n";
+
+        return true;
+    }
 
     m_vout << "Opening input file...\n";
     osmium::io::ReaderWithProgressBar reader{display_progress(), m_input_file, osmium::osm_entity_bits::object};
@@ -241,55 +1124,39 @@ bool CommandApplyChanges::run() {
     m_vout << "Opening output file...\n";
     osmium::io::Writer writer{m_output_file, header, m_output_overwrite, m_fsync};
 
-    if (m_with_history) {
-        // For history files this is a straightforward sort of the change
-        // files followed by a merge with the input file.
-        m_vout << "Sorting change data...\n";
-        objects.sort(osmium::object_order_type_id_version());
+    sort_changes(objects);
 
+    if (m_with_history) {
+        // For history files this is a straightforward merge of the
+        // sorted changes with the input file.
         m_vout << "Applying changes and writing them to output...\n";
-        const auto input = osmium::io::make_input_iterator_range<osmium::OSMObject>(reader);
-        auto out = osmium::io::make_output_iterator(writer);
-
-        if (m_redact) {
-            std::set_union(objects.begin(),
-                           objects.end(),
-                           input.begin(),
-                           input.end(),
-                           out,
-                           osmium::object_order_type_id_version_without_timestamp());
-        } else {
-            std::set_union(objects.begin(),
-                           objects.end(),
-                           input.begin(),
-                           input.end(),
-                           out);
-        }
+        merge_input(objects, reader, writer);
     } else {
-        // For normal data files we sort with the largest version of each
-        // object first and then only copy this last version of any object
-        // to the output.
-        m_vout << "Sorting change data...\n";
-        objects.sort(osmium::object_order_type_id_reverse_version{});
-
         if (m_locations_on_ways) {
             objects.unique(osmium::object_equal_type_id{});
             m_vout << "There are " << objects.size() << " unique objects in the change files\n";
 
             osmium::index::IdSetSmall<osmium::unsigned_object_id_type> node_ids;
+            std::size_t num_change_nodes = 0;
             m_vout << "Creating node index...\n";
             for (const auto& buffer : changes) {
-                for (const auto& way : buffer.select<osmium::Way>()) {
-                    for (const auto& nr : way.nodes()) {
-                        node_ids.set(nr.positive_ref());
+                for (const auto& object : buffer.select<osmium::OSMObject>()) {
+                    if (object.type() == osmium::item_type::node) {
+                        ++num_change_nodes;
+                    } else if (object.type() == osmium::item_type::way) {
+                        for (const auto& nr : static_cast<const osmium::Way&>(object).nodes()) {
+                            node_ids.set(nr.positive_ref());
+                        }
                     }
                 }
             }
             node_ids.sort_unique();
             m_vout << "Node index has " << node_ids.size() << " entries\n";
 
+            // The index gets the locations of all nodes in the change files
+            // and of the nodes in the input referenced from changed ways.
             m_vout << "Creating location index...\n";
-            location_index_type location_index;
+            FilteredLocationIndex location_index{num_change_nodes + node_ids.size()};
             for (const auto& buffer : changes) {
                 for (const auto& node : buffer.select<osmium::Node>()) {
                     location_index.set(node.positive_id(), node.location());
@@ -298,9 +1165,46 @@ bool CommandApplyChanges::run() {
             m_vout << "Location index has " << location_index.size() << " entries\n";
 
             m_vout << "Applying changes and writing them to output...\n";
+
+            // The merged objects are collected in one output buffer for
+            // each input buffer. Updating the locations of the ways in those
+            // buffers is done in the thread pool, the buffers are handed to
+            // the writer in order. Once the first way is seen the location
+            // index doesn't change any more, so the way buffers can be
+            // worked on in parallel.
+            osmium::thread::Pool* pool = m_threads > 1 ? &thread_pool() : nullptr;
+            std::deque<std::future<osmium::memory::Buffer>> pending;
+            const std::size_t max_pending = static_cast<std::size_t>(m_threads) * 4;
+
+            const auto submit = [&](osmium::memory::Buffer&& out_buffer) {
+                if (!pool) {
+                    for (auto& object : out_buffer.select<osmium::OSMObject>()) {
+                        update_nodes_if_way(object, location_index);
+                    }
+                    writer(std::move(out_buffer));
+                    return;
+                }
+                std::shared_ptr<osmium::memory::Buffer> buffer_ptr{new osmium::memory::Buffer{std::move(out_buffer)}};
+                pending.push_back(pool->submit([buffer_ptr, &location_index]() {
+                    for (auto& object : buffer_ptr->select<osmium::OSMObject>()) {
+                        update_nodes_if_way(object, location_index);
+                    }
+                    return std::move(*buffer_ptr);
+                }));
+                while (pending.size() > max_pending) {
+                    writer(pending.front().get());
+                    pending.pop_front();
+                }
+            };
+
+            const auto new_buffer = []() {
+                return osmium::memory::Buffer{1024 * 1024, osmium::memory::Buffer::auto_grow::yes};
+            };
+
             auto it = objects.begin();
             auto last_type = osmium::item_type::undefined;
             while (osmium::memory::Buffer buffer = reader.read()) {
+                auto out_buffer = new_buffer();
                 for (auto& object : buffer.select<osmium::OSMObject>()) {
                     if (object.type() < last_type) {
                         throw std::runtime_error{"Input data out of order. Need nodes, ways, relations in ID order."};
@@ -308,14 +1212,10 @@ bool CommandApplyChanges::run() {
                     if (object.type() == osmium::item_type::node) {
                         const auto& node = static_cast<osmium::Node&>(object);
                         if (node_ids.get_binary_search(node.positive_id())) {
-                            const auto location = location_index.get_noexcept(node.positive_id());
-                            if (!location) {
-                                location_index.set(node.positive_id(), node.location());
-                            }
+                            location_index.set(node.positive_id(), node.location());
                         }
                     } else if (object.type() == osmium::item_type::way) {
                         if (last_type == osmium::item_type::node) {
-                            location_index.sort();
                             node_ids.clear();
                         }
                     }
@@ -325,39 +1225,39 @@ bool CommandApplyChanges::run() {
                     auto last_it = it;
                     while (it != objects.end() && osmium::object_order_type_id_reverse_version{}(*it, object)) {
                         if (it->visible()) {
-                            update_nodes_if_way(*it, location_index);
-                            writer(*it);
+                            out_buffer.add_item(*it);
+                            out_buffer.commit();
                         }
                         last_it = it;
                         ++it;
                     }
 
                     if (last_it == objects.end() || last_it->type() != object.type() || last_it->id() != object.id()) {
-                        update_nodes_if_way(object, location_index);
-                        writer(object);
+                        out_buffer.add_item(object);
+                        out_buffer.commit();
                     }
                 }
+                submit(std::move(out_buffer));
             }
+
+            auto out_buffer = new_buffer();
             while (it != objects.end()) {
                 if (it->visible()) {
-                    update_nodes_if_way(*it, location_index);
-                    writer(*it);
+                    out_buffer.add_item(*it);
+                    out_buffer.commit();
                 }
                 ++it;
             }
+            submit(std::move(out_buffer));
+
+            for (auto& future : pending) {
+                writer(future.get());
+            }
         } else {
+            // Only the last version of any object is copied to the
+            // output.
             m_vout << "Applying changes and writing them to output...\n";
-            const auto input = osmium::io::make_input_iterator_range<osmium::OSMObject>(reader);
-            auto output_it = boost::make_function_output_iterator(
-                                copy_first_with_id(writer)
-            );
-
-            std::set_union(objects.begin(),
-                           objects.end(),
-                           input.begin(),
-                           input.end(),
-                           output_it,
-                           osmium::object_order_type_id_reverse_version());
+            merge_input(objects, reader, writer);
         }
     }
 
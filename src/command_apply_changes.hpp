@@ -24,19 +24,57 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
 #include "cmd.hpp" // IWYU pragma: export
+#include "object_store.hpp"
+
+#include <osmium/io/header.hpp>
+#include <osmium/io/reader.hpp>
+#include <osmium/io/writer.hpp>
+#include <osmium/object_pointer_collection.hpp>
 
 #include <string>
+#include <utility>
 #include <vector>
 
 class CommandApplyChanges : public Command, public with_single_osm_input, public with_osm_output {
 
     std::vector<std::string> m_change_filenames;
+    std::vector<std::pair<std::string, std::string>> m_batch;
 
     std::string m_change_file_format;
+    std::string m_block_index_filename;
+    std::string m_store_directory;
 
     bool m_with_history = false;
     bool m_locations_on_ways = false;
     bool m_redact = false;
+    bool m_sorted_changes = false;
+    bool m_copy_blocks = false;
+    bool m_create_store = false;
+    bool m_write_snapshot = false;
+    int m_parse_threads = 1;
+
+    void setup_store(const boost::program_options::variables_map& vm);
+
+    void setup_batch(const boost::program_options::variables_map& vm);
+
+    void sort_changes(osmium::ObjectPointerCollection& objects);
+
+    void merge_input(osmium::ObjectPointerCollection& objects, osmium::io::Reader& reader, osmium::io::Writer& writer) const;
+
+    void apply_changes_batch(osmium::ObjectPointerCollection& objects);
+
+    void merge_changes(osmium::ObjectPointerCollection::iterator first,
+                       osmium::ObjectPointerCollection::iterator last,
+                       osmium::ObjectPointerCollection& input,
+                       osmium::io::Writer& writer) const;
+
+    void apply_sorted_changes(osmium::io::Reader& reader, osmium::io::Writer& writer);
+
+    void apply_changes_copy_blocks(osmium::ObjectPointerCollection& objects, const osmium::io::Header& header);
+
+    void apply_changes_to_store(ObjectStore& store, osmium::ObjectPointerCollection& objects);
+
+    void write_store_snapshot(const ObjectStore& store);
 
 public:
 
@@ -55,7 +93,9 @@ public:
     }
 
     const char* synopsis() const noexcept override final {
-        return "osmium apply-changes [OPTIONS] OSM-FILE OSM-CHANGE-FILE...";
+        return "osmium apply-changes [OPTIONS] OSM-FILE OSM-CHANGE-FILE...\n"
+               "       osmium apply-changes [OPTIONS] --store=DIR [--create-store OSM-FILE] OSM-CHANGE-FILE...\n"
+               "       osmium apply-changes [OPTIONS] --batch=FILE OSM-CHANGE-FILE...";
     }
 
 }; // class CommandApplyChanges
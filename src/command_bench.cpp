@@ -0,0 +1,559 @@
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "command_bench.hpp"
+#include "exception.hpp"
+#include "pbf_blocks.hpp"
+#include "pooled_writer.hpp"
+#include "temp_files.hpp"
+#include "util.hpp"
+
+#include "extract/extract_polygon.hpp"
+
+#include <osmium/builder/attr.hpp>
+#include <osmium/builder/osm_object_builder.hpp>
+#include <osmium/index/map.hpp>
+#include <osmium/io/file.hpp>
+#include <osmium/io/file_format.hpp>
+#include <osmium/io/header.hpp>
+#include <osmium/io/pbf_output.hpp>
+#include <osmium/io/writer.hpp>
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm/box.hpp>
+#include <osmium/osm/entity_bits.hpp>
+#include <osmium/osm/item_type.hpp>
+#include <osmium/osm/location.hpp>
+#include <osmium/osm/node.hpp>
+#include <osmium/osm/types.hpp>
+#include <osmium/osm/way.hpp>
+#include <osmium/thread/pool.hpp>
+#include <osmium/util/string.hpp>
+#include <osmium/util/verbose_output.hpp>
+
+#include <boost/program_options.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+
+    using clock_type = std::chrono::steady_clock;
+
+    const char* const all_workloads[] = {"decode", "encode", "index", "lookup", "pip"};
+
+    double seconds_since(const clock_type::time_point& start) {
+        return std::chrono::duration<double>(clock_type::now() - start).count();
+    }
+
+    std::size_t parse_count(const std::string& str, const char* option) {
+        if (str.empty() || str.find_first_not_of("0123456789") != std::string::npos || str.size() > 9) {
+            throw argument_error{std::string{"Invalid value '"} + str + "' for --" + option + " option."};
+        }
+        const auto count = static_cast<std::size_t>(std::stoul(str));
+        if (count == 0) {
+            throw argument_error{std::string{"The --"} + option + " option must be larger than 0."};
+        }
+        return count;
+    }
+
+    // Powers of two up to the number of hardware threads and that number
+    // itself.
+    std::vector<int> default_thread_counts() {
+        const int max_threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+        std::vector<int> counts;
+        for (int n = 1; n < max_threads; n *= 2) {
+            counts.push_back(n);
+        }
+        counts.push_back(max_threads);
+        return counts;
+    }
+
+    // A byte copy of the buffer the encode workload can consume.
+    osmium::memory::Buffer copy_buffer(const osmium::memory::Buffer& buffer) {
+        osmium::memory::Buffer copy{buffer.committed(), osmium::memory::Buffer::auto_grow::no};
+        copy.add_buffer(buffer);
+        copy.commit();
+        return copy;
+    }
+
+    // Split [0, size) into num_ranges parts and call func(begin, end) for
+    // each of them on the pool. Returns the sum of the results.
+    template <typename TFunc>
+    std::size_t sum_over_ranges(osmium::thread::Pool& pool, std::size_t size, int num_ranges, TFunc&& func) {
+        const auto n_ranges = static_cast<std::size_t>(num_ranges);
+        std::vector<std::future<std::size_t>> futures;
+        for (std::size_t n = 0; n < n_ranges; ++n) {
+            const std::size_t begin = size * n / n_ranges;
+            const std::size_t end = size * (n + 1) / n_ranges;
+            futures.push_back(pool.submit([&func, begin, end]() {
+                return func(begin, end);
+            }));
+        }
+
+        std::size_t sum = 0;
+        for (auto& future : futures) {
+            sum += future.get();
+        }
+        return sum;
+    }
+
+    void print_result(const char* workload, int threads, double seconds, std::size_t items, std::size_t bytes) {
+        const double s = std::max(seconds, 1e-9);
+        std::cout << workload << '\t'
+                  << threads << '\t'
+                  << std::fixed << std::setprecision(3) << seconds << '\t'
+                  << items << '\t'
+                  << std::setprecision(0) << (static_cast<double>(items) / s) << '\t';
+        if (bytes > 0) {
+            std::cout << std::setprecision(1) << (static_cast<double>(bytes) / (1024 * 1024) / s);
+        } else {
+            std::cout << '-';
+        }
+        std::cout << '\n';
+    }
+
+} // anonymous namespace
+
+bool CommandBench::setup(const std::vector<std::string>& arguments) {
+    const auto& map_factory = osmium::index::MapFactory<osmium::unsigned_object_id_type, osmium::Location>::instance();
+
+    po::options_description opts_cmd{"COMMAND OPTIONS"};
+    opts_cmd.add_options()
+    ("workloads,w", po::value<std::string>(), "Comma-separated list of workloads (default: all)")
+    ("thread-counts,T", po::value<std::string>(), "Comma-separated list of thread counts")
+    ("max-blocks", po::value<std::size_t>(), "Use at most this many blocks from the input file (default: 500)")
+    ("generate-nodes", po::value<std::size_t>(), "Number of nodes in generated data (default: 1000000)")
+    ("index-type,i", po::value<std::string>()->default_value(m_index_type_name), "Index type for index and lookup workloads")
+    ("show-index-types,I", "Show available index types")
+    ("temp-dir", po::value<std::string>(), "Directory for the generated data file")
+    ;
+
+    po::options_description opts_common{add_common_options(false)};
+
+    po::options_description hidden;
+    hidden.add_options()
+    ("input-filename", po::value<std::string>(), "OSM input file")
+    ;
+
+    po::options_description desc;
+    desc.add(opts_cmd).add(opts_common);
+
+    po::options_description parsed_options;
+    parsed_options.add(desc).add(hidden);
+
+    po::positional_options_description positional;
+    positional.add("input-filename", 1);
+
+    po::variables_map vm;
+    po::store(po::command_line_parser(arguments).options(parsed_options).positional(positional).run(), vm);
+    po::notify(vm);
+
+    if (vm.count("show-index-types")) {
+        for (const auto& map_type : map_factory.map_types()) {
+            std::cout << map_type << '\n';
+        }
+        return false;
+    }
+
+    setup_common(vm, desc);
+
+    if (vm.count("input-filename")) {
+        m_input_filename = vm["input-filename"].as<std::string>();
+        if (m_input_filename == "-") {
+            throw argument_error{"The bench command can not read from STDIN."};
+        }
+        if (osmium::io::File{m_input_filename}.format() != osmium::io::file_format::pbf) {
+            throw argument_error{"The bench command only works with PBF input files."};
+        }
+    }
+
+    if (vm.count("workloads")) {
+        for (const auto& workload : osmium::split_string(vm["workloads"].as<std::string>(), ',', true)) {
+            if (std::find(std::begin(all_workloads), std::end(all_workloads), workload) == std::end(all_workloads)) {
+                throw argument_error{"Unknown workload '" + workload + "'. Use one of 'decode', 'encode', 'index', 'lookup', 'pip'."};
+            }
+            m_workloads.push_back(workload);
+        }
+    } else {
+        m_workloads.assign(std::begin(all_workloads), std::end(all_workloads));
+    }
+
+    if (vm.count("thread-counts")) {
+        for (const auto& count : osmium::split_string(vm["thread-counts"].as<std::string>(), ',', true)) {
+            m_thread_counts.push_back(static_cast<int>(parse_count(count, "thread-counts")));
+        }
+    }
+    if (m_thread_counts.empty()) {
+        m_thread_counts = default_thread_counts();
+    }
+
+    if (vm.count("max-blocks")) {
+        m_max_blocks = vm["max-blocks"].as<std::size_t>();
+        if (m_max_blocks == 0) {
+            throw argument_error{"The --max-blocks option must be larger than 0."};
+        }
+    }
+
+    if (vm.count("generate-nodes")) {
+        if (!m_input_filename.empty()) {
+            warning("Ignoring --generate-nodes option, because an input file was given.\n");
+        }
+        m_generate_nodes = vm["generate-nodes"].as<std::size_t>();
+        if (m_generate_nodes < 10) {
+            throw argument_error{"The --generate-nodes option must be at least 10."};
+        }
+    }
+
+    m_index_type_name = vm["index-type"].as<std::string>();
+    if (!map_factory.has_map_type(m_index_type_name)) {
+        throw argument_error{std::string{"Unknown index type '"} + m_index_type_name + "'. Use --show-index-types or -I to get a list."};
+    }
+
+    if (vm.count("temp-dir")) {
+        m_temp_directory = vm["temp-dir"].as<std::string>();
+    } else {
+        m_temp_directory = default_temp_directory();
+    }
+
+    return true;
+}
+
+void CommandBench::show_arguments() {
+    m_vout << "  input file: " << (m_input_filename.empty() ? "(generated)" : m_input_filename) << "\n";
+    m_vout << "  other options:\n";
+    m_vout << "    workloads:";
+    for (const auto& workload : m_workloads) {
+        m_vout << ' ' << workload;
+    }
+    m_vout << "\n    thread counts:";
+    for (const auto count : m_thread_counts) {
+        m_vout << ' ' << count;
+    }
+    m_vout << "\n    max blocks: " << m_max_blocks << "\n";
+    if (m_input_filename.empty()) {
+        m_vout << "    generated nodes: " << m_generate_nodes << "\n";
+        m_vout << "    temp directory: " << m_temp_directory << "\n";
+    }
+    m_vout << "    index type: " << m_index_type_name << "\n";
+}
+
+bool CommandBench::has_workload(const char* name) const {
+    return std::find(m_workloads.begin(), m_workloads.end(), name) != m_workloads.end();
+}
+
+void CommandBench::generate_input(const std::string& filename) const {
+    using namespace osmium::builder::attr; // NOLINT(google-build-using-namespace)
+
+    static const std::size_t flush_size = 10UL * 1024UL * 1024UL;
+    static const std::size_t nodes_per_way = 10;
+
+    osmium::io::Header header;
+    header.set("generator", "osmium/bench");
+    osmium::io::Writer writer{osmium::io::File{filename, "pbf"}, header, osmium::io::overwrite::allow};
+
+    osmium::memory::Buffer buffer{flush_size, osmium::memory::Buffer::auto_grow::yes};
+    const auto flush = [&writer, &buffer](bool force) {
+        if (force || buffer.committed() > flush_size) {
+            writer(std::move(buffer));
+            buffer = osmium::memory::Buffer{flush_size, osmium::memory::Buffer::auto_grow::yes};
+        }
+    };
+
+    // The nodes are on a regular grid with about 10 degrees on each side,
+    // every tenth node is tagged.
+    const auto columns = static_cast<std::size_t>(std::ceil(std::sqrt(static_cast<double>(m_generate_nodes))));
+    const double step = 10.0 / static_cast<double>(columns);
+    for (std::size_t n = 0; n < m_generate_nodes; ++n) {
+        const osmium::Location location{static_cast<double>(n % columns) * step,
+                                        45.0 + static_cast<double>(n / columns) * step};
+        const auto id = static_cast<osmium::object_id_type>(n + 1);
+        if (n % 10 == 0) {
+            osmium::builder::add_node(buffer, _id(id), _version(1), _location(location), _tag("amenity", "bench"));
+        } else {
+            osmium::builder::add_node(buffer, _id(id), _version(1), _location(location));
+        }
+        flush(false);
+    }
+
+    // The ways follow the rows of the grid, each way shares its first
+    // node with the last node of the way before.
+    osmium::object_id_type way_id = 1;
+    std::vector<osmium::object_id_type> node_ids;
+    for (std::size_t row_begin = 0; row_begin < m_generate_nodes; row_begin += columns) {
+        const auto row_end = std::min(row_begin + columns, m_generate_nodes);
+        for (std::size_t begin = row_begin; begin + 1 < row_end; begin += nodes_per_way - 1) {
+            node_ids.clear();
+            for (std::size_t n = begin; n < std::min(begin + nodes_per_way, row_end); ++n) {
+                node_ids.push_back(static_cast<osmium::object_id_type>(n + 1));
+            }
+            osmium::builder::add_way(buffer, _id(way_id++), _version(1), _nodes(node_ids), _tag("highway", "residential"));
+            flush(false);
+        }
+    }
+
+    flush(true);
+    writer.close();
+}
+
+CommandBench::result CommandBench::bench_decode(const std::vector<pbf_block>& blocks, std::size_t bytes, int threads) const {
+    osmium::thread::Pool pool{threads};
+    const std::size_t max_pending = static_cast<std::size_t>(threads) * 4;
+
+    const auto start = clock_type::now();
+
+    std::deque<std::future<std::size_t>> pending;
+    std::size_t items = 0;
+    for (const auto& block : blocks) {
+        const pbf_block* block_ptr = &block;
+        pending.push_back(pool.submit([block_ptr]() {
+            const auto buffer = decode_pbf_block(*block_ptr, osmium::osm_entity_bits::nwr);
+            return static_cast<std::size_t>(std::distance(buffer.begin(), buffer.end()));
+        }));
+        while (pending.size() > max_pending) {
+            items += pending.front().get();
+            pending.pop_front();
+        }
+    }
+    for (auto& future : pending) {
+        items += future.get();
+    }
+
+    return {seconds_since(start), items, bytes};
+}
+
+CommandBench::result CommandBench::bench_encode(const std::vector<osmium::memory::Buffer>& buffers, std::size_t bytes, int threads) const {
+    std::vector<osmium::memory::Buffer> copies;
+    copies.reserve(buffers.size());
+    std::size_t items = 0;
+    for (const auto& buffer : buffers) {
+        copies.push_back(copy_buffer(buffer));
+        items += static_cast<std::size_t>(std::distance(buffer.begin(), buffer.end()));
+    }
+
+    osmium::thread::Pool pool{threads};
+
+    const auto start = clock_type::now();
+
+    PooledWriter writer{osmium::io::File{"/dev/null", "pbf"}, osmium::io::Header{}, osmium::io::overwrite::allow, osmium::io::fsync::no, pool};
+    for (auto& copy : copies) {
+        writer(std::move(copy));
+    }
+    writer.close();
+
+    return {seconds_since(start), items, bytes};
+}
+
+CommandBench::result CommandBench::bench_index(const std::vector<osmium::memory::Buffer>& buffers) const {
+    const auto& map_factory = osmium::index::MapFactory<osmium::unsigned_object_id_type, osmium::Location>::instance();
+
+    const auto start = clock_type::now();
+
+    auto index = map_factory.create_map(m_index_type_name);
+    std::size_t items = 0;
+    for (const auto& buffer : buffers) {
+        for (const auto& node : buffer.select<osmium::Node>()) {
+            index->set(node.positive_id(), node.location());
+            ++items;
+        }
+    }
+    index->sort();
+
+    return {seconds_since(start), items, 0};
+}
+
+CommandBench::result CommandBench::bench_lookup(const std::vector<osmium::memory::Buffer>& buffers, int threads) const {
+    const auto& map_factory = osmium::index::MapFactory<osmium::unsigned_object_id_type, osmium::Location>::instance();
+
+    auto index = map_factory.create_map(m_index_type_name);
+    std::vector<osmium::unsigned_object_id_type> refs;
+    for (const auto& buffer : buffers) {
+        for (const auto& object : buffer) {
+            if (object.type() == osmium::item_type::node) {
+                const auto& node = static_cast<const osmium::Node&>(object);
+                index->set(node.positive_id(), node.location());
+            } else if (object.type() == osmium::item_type::way) {
+                for (const auto& node_ref : static_cast<const osmium::Way&>(object).nodes()) {
+                    refs.push_back(node_ref.positive_ref());
+                }
+            }
+        }
+    }
+    index->sort();
+
+    osmium::thread::Pool pool{threads};
+    const auto& const_index = *index;
+
+    const auto start = clock_type::now();
+
+    const auto found = sum_over_ranges(pool, refs.size(), threads, [&const_index, &refs](std::size_t begin, std::size_t end) {
+        std::size_t count = 0;
+        for (std::size_t n = begin; n < end; ++n) {
+            if (const_index.get_noexcept(refs[n]).valid()) {
+                ++count;
+            }
+        }
+        return count;
+    });
+
+    const auto seconds = seconds_since(start);
+    m_vout << "Found locations for " << found << " of " << refs.size() << " node references.\n";
+
+    return {seconds, refs.size(), 0};
+}
+
+CommandBench::result CommandBench::bench_pip(const std::vector<osmium::memory::Buffer>& buffers, int threads) const {
+    static const std::size_t num_vertices = 1000;
+
+    std::vector<osmium::Location> locations;
+    osmium::Box box;
+    for (const auto& buffer : buffers) {
+        for (const auto& node : buffer.select<osmium::Node>()) {
+            if (node.location().valid()) {
+                locations.push_back(node.location());
+                box.extend(node.location());
+            }
+        }
+    }
+
+    if (locations.empty()) {
+        return {0.0, 0, 0};
+    }
+
+    // A star-shaped polygon with many vertices covering a large part of
+    // the data, so that it has many segments and many locations end up
+    // in boundary cells like with real-world boundaries.
+    osmium::memory::Buffer polygon_buffer{1024, osmium::memory::Buffer::auto_grow::yes};
+    {
+        const double cx = (box.bottom_left().lon() + box.top_right().lon()) / 2;
+        const double cy = (box.bottom_left().lat() + box.top_right().lat()) / 2;
+        const double rx = (box.top_right().lon() - box.bottom_left().lon()) / 2;
+        const double ry = (box.top_right().lat() - box.bottom_left().lat()) / 2;
+
+        osmium::builder::AreaBuilder builder{polygon_buffer};
+        osmium::builder::OuterRingBuilder ring_builder{builder};
+        for (std::size_t n = 0; n <= num_vertices; ++n) {
+            const double angle = 2 * 3.14159265358979323846 * static_cast<double>(n % num_vertices) / num_vertices;
+            const double factor = (n % 2 == 0) ? 0.9 : 0.7;
+            ring_builder.add_node_ref(0, osmium::Location{cx + rx * factor * std::cos(angle),
+                                                          cy + ry * factor * std::sin(angle)});
+        }
+    }
+    polygon_buffer.commit();
+
+    const ExtractPolygon polygon{osmium::io::File{"/dev/null", "pbf"}, "bench", polygon_buffer, 0};
+
+    osmium::thread::Pool pool{threads};
+
+    const auto start = clock_type::now();
+
+    const auto inside = sum_over_ranges(pool, locations.size(), threads, [&polygon, &locations](std::size_t begin, std::size_t end) {
+        std::size_t count = 0;
+        for (std::size_t n = begin; n < end; ++n) {
+            if (polygon.contains(locations[n])) {
+                ++count;
+            }
+        }
+        return count;
+    });
+
+    const auto seconds = seconds_since(start);
+    m_vout << "Found " << inside << " of " << locations.size() << " locations inside the polygon.\n";
+
+    return {seconds, locations.size(), 0};
+}
+
+bool CommandBench::run() {
+    TempFiles temp_files{m_temp_directory, "osmium-bench", ".osm.pbf"};
+
+    std::string filename{m_input_filename};
+    if (filename.empty()) {
+        filename = temp_files.create();
+        m_vout << "Generating data with " << m_generate_nodes << " nodes into '" << filename << "'...\n";
+        generate_input(filename);
+    }
+
+    m_vout << "Reading up to " << m_max_blocks << " data blocks into memory...\n";
+    std::vector<pbf_block> blocks;
+    std::size_t bytes = 0;
+    {
+        PBFBlockReader reader{filename};
+        pbf_block block;
+        while (blocks.size() < m_max_blocks && reader.read(block)) {
+            if (block.type == "OSMData") {
+                bytes += block.data.size();
+                blocks.push_back(std::move(block));
+            }
+        }
+    }
+    m_vout << "Read " << blocks.size() << " blocks with " << bytes << " bytes.\n";
+
+    std::vector<osmium::memory::Buffer> buffers;
+    if (has_workload("encode") || has_workload("index") || has_workload("lookup") || has_workload("pip")) {
+        m_vout << "Decoding blocks...\n";
+        buffers.reserve(blocks.size());
+        for (const auto& block : blocks) {
+            buffers.push_back(decode_pbf_block(block, osmium::osm_entity_bits::nwr));
+        }
+    }
+
+    std::cout << "workload\tthreads\tseconds\titems\titems_per_second\tmbytes_per_second\n";
+
+    for (const auto& workload : m_workloads) {
+        m_vout << "Running workload '" << workload << "'...\n";
+        if (workload == "index") {
+            // Filling and sorting the index is done by one thread only.
+            const auto r = bench_index(buffers);
+            print_result("index", 1, r.seconds, r.items, r.bytes);
+            continue;
+        }
+        for (const auto threads : m_thread_counts) {
+            result r{0.0, 0, 0};
+            if (workload == "decode") {
+                r = bench_decode(blocks, bytes, threads);
+            } else if (workload == "encode") {
+                r = bench_encode(buffers, bytes, threads);
+            } else if (workload == "lookup") {
+                r = bench_lookup(buffers, threads);
+            } else {
+                r = bench_pip(buffers, threads);
+            }
+            print_result(workload.c_str(), threads, r.seconds, r.items, r.bytes);
+        }
+    }
+
+    show_memory_used();
+    m_vout << "Done.\n";
+
+    return true;
+}
@@ -0,0 +1,87 @@
+#ifndef COMMAND_BENCH_HPP
+#define COMMAND_BENCH_HPP
+
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "cmd.hpp" // IWYU pragma: export
+
+#include <osmium/memory/buffer.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct pbf_block;
+
+class CommandBench : public Command {
+
+    // Results of one run of a workload.
+    struct result {
+        double seconds;
+        std::size_t items;
+        std::size_t bytes; // 0 if not applicable
+    };
+
+    std::string m_input_filename;
+    std::string m_index_type_name{"flex_mem"};
+    std::string m_temp_directory;
+    std::vector<std::string> m_workloads;
+    std::vector<int> m_thread_counts;
+    std::size_t m_max_blocks = 500;
+    std::size_t m_generate_nodes = 1000000;
+
+    bool has_workload(const char* name) const;
+
+    void generate_input(const std::string& filename) const;
+
+    result bench_decode(const std::vector<pbf_block>& blocks, std::size_t bytes, int threads) const;
+    result bench_encode(const std::vector<osmium::memory::Buffer>& buffers, std::size_t bytes, int threads) const;
+    result bench_index(const std::vector<osmium::memory::Buffer>& buffers) const;
+    result bench_lookup(const std::vector<osmium::memory::Buffer>& buffers, int threads) const;
+    result bench_pip(const std::vector<osmium::memory::Buffer>& buffers, int threads) const;
+
+public:
+
+    explicit CommandBench(const CommandFactory& command_factory) :
+        Command(command_factory) {
+    }
+
+    bool setup(const std::vector<std::string>& arguments) override final;
+
+    void show_arguments() override final;
+
+    bool run() override final;
+
+    const char* name() const noexcept override final {
+        return "bench";
+    }
+
+    const char* synopsis() const noexcept override final {
+        return "osmium bench [OPTIONS] [OSM-FILE]";
+    }
+
+}; // class CommandBench
+
+
+#endif // COMMAND_BENCH_HPP
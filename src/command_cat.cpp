@@ -21,26 +21,168 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
 #include "command_cat.hpp"
+#include "exception.hpp"
+#include "opl_writer.hpp"
+#include "pbf_blocks.hpp"
+#include "remote_file.hpp"
+#include "read_ahead.hpp"
+#include "trace.hpp"
 #include "util.hpp"
 
+#include <osmium/io/error.hpp>
 #include <osmium/io/file.hpp>
+#include <osmium/io/file_format.hpp>
 #include <osmium/io/header.hpp>
 #include <osmium/io/reader.hpp>
 #include <osmium/io/writer.hpp>
 #include <osmium/memory/buffer.hpp>
+#include <osmium/osm/changeset.hpp>
+#include <osmium/osm/entity.hpp>
+#include <osmium/osm/entity_bits.hpp>
+#include <osmium/osm/item_type.hpp>
+#include <osmium/osm/object.hpp>
+#include <osmium/osm/types.hpp>
+#include <osmium/thread/pool.hpp>
 #include <osmium/util/progress_bar.hpp>
 #include <osmium/util/verbose_output.hpp>
 
 #include <boost/program_options.hpp>
 
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <memory>
 #include <string>
 #include <utility>
 #include <vector>
 
+namespace {
+
+    osmium::object_id_type parse_id(const std::string& str, const std::string& range) {
+        if (str.empty() || str.find_first_not_of("0123456789") != std::string::npos || str.size() > 18) {
+            throw argument_error{"Invalid ID range '" + range + "'. Use FROM-TO or FROM- with positive IDs."};
+        }
+        const auto id = static_cast<osmium::object_id_type>(std::stoll(str));
+        if (id == 0) {
+            throw argument_error{"Invalid ID range '" + range + "'. Use FROM-TO or FROM- with positive IDs."};
+        }
+        return id;
+    }
+
+    // Parse an ID range "FROM-TO" or "FROM-" (for all IDs from FROM).
+    std::pair<osmium::object_id_type, osmium::object_id_type> parse_id_range(const std::string& str) {
+        const auto pos = str.find('-');
+        if (pos == std::string::npos) {
+            throw argument_error{"Invalid ID range '" + str + "'. Use FROM-TO or FROM- with positive IDs."};
+        }
+
+        std::pair<osmium::object_id_type, osmium::object_id_type> range{parse_id(str.substr(0, pos), str),
+                                                                        std::numeric_limits<osmium::object_id_type>::max()};
+        if (pos + 1 < str.size()) {
+            range.second = parse_id(str.substr(pos + 1), str);
+        }
+        if (range.first > range.second) {
+            throw argument_error{"Invalid ID range '" + str + "'. FROM must not be larger than TO."};
+        }
+
+        return range;
+    }
+
+    // Find the blocks of a PBF file which can contain objects of the
+    // given types (with IDs in the range if min_id is not 0).
+    std::vector<std::size_t> find_selected_blocks(const std::string& filename,
+                                                  osmium::osm_entity_bits::type entities,
+                                                  osmium::object_id_type min_id,
+                                                  osmium::object_id_type max_id) {
+        std::vector<std::size_t> offsets;
+        const auto add = [&offsets](const std::vector<std::size_t>& type_offsets) {
+            offsets.insert(offsets.end(), type_offsets.begin(), type_offsets.end());
+        };
+
+        if (min_id == 0) {
+            const auto blocks = get_pbf_type_blocks(filename);
+            if (entities & osmium::osm_entity_bits::node) {
+                add(blocks.nodes);
+            }
+            if (entities & osmium::osm_entity_bits::way) {
+                add(blocks.ways);
+            }
+            if (entities & osmium::osm_entity_bits::relation) {
+                add(blocks.relations);
+            }
+        } else {
+            for (const auto type : {osmium::item_type::node, osmium::item_type::way, osmium::item_type::relation}) {
+                if (entities & osmium::osm_entity_bits::from_item_type(type)) {
+                    add(find_pbf_blocks_with_ids(filename, type, min_id, max_id));
+                }
+            }
+        }
+
+        std::sort(offsets.begin(), offsets.end());
+        offsets.erase(std::unique(offsets.begin(), offsets.end()), offsets.end());
+        return offsets;
+    }
+
+    // Remove all objects with IDs outside the range from the buffer.
+    void select_id_range(osmium::memory::Buffer& buffer, osmium::object_id_type min_id, osmium::object_id_type max_id) {
+        osmium::memory::Buffer selected{buffer.committed(), osmium::memory::Buffer::auto_grow::yes};
+        for (const auto& entity : buffer.select<osmium::OSMEntity>()) {
+            const osmium::object_id_type id = entity.type() == osmium::item_type::changeset
+                ? static_cast<osmium::object_id_type>(static_cast<const osmium::Changeset&>(entity).id())
+                : static_cast<const osmium::OSMObject&>(entity).id();
+            if (id >= min_id && id <= max_id) {
+                selected.add_item(entity);
+                selected.commit();
+            }
+        }
+        buffer = std::move(selected);
+    }
+
+    // Copy the buffers from the reader to the writer, but not more than
+    // objects_left objects, which is decremented by the number of objects
+    // copied. If min_id is not 0, only objects with IDs from min_id to
+    // max_id are copied. Returns false when no more objects should be
+    // copied, the reader can then be closed without reading the rest of
+    // the input.
+    template <typename TReader, typename TWriter>
+    bool copy_objects(TReader& reader, TWriter& writer, osmium::ProgressBar& progress_bar, std::size_t& objects_left,
+                      osmium::object_id_type min_id, osmium::object_id_type max_id) {
+        if (objects_left == std::numeric_limits<std::size_t>::max() && min_id == 0) {
+            while (osmium::memory::Buffer buffer = traced_read(reader)) {
+                progress_bar.update(reader.offset());
+                traced_write(writer, std::move(buffer));
+            }
+            return true;
+        }
+
+        while (objects_left > 0) {
+            osmium::memory::Buffer buffer = traced_read(reader);
+            if (!buffer) {
+                return true;
+            }
+            progress_bar.update(reader.offset());
+            if (min_id != 0) {
+                select_id_range(buffer, min_id, max_id);
+            }
+            if (objects_left != std::numeric_limits<std::size_t>::max()) {
+                objects_left -= truncate_buffer(buffer, objects_left);
+            }
+            traced_write(writer, std::move(buffer));
+        }
+
+        return false;
+    }
+
+} // anonymous namespace
+
 bool CommandCat::setup(const std::vector<std::string>& arguments) {
     po::options_description opts_cmd{"COMMAND OPTIONS"};
     opts_cmd.add_options()
+    ("copy-blocks", "Copy PBF blocks without decoding them (PBF input and output only)")
+    ("id-range", po::value<std::string>(), "Only copy objects with IDs in this range (FROM-TO or FROM-)")
+    ("max-objects", po::value<std::size_t>(), "Stop after copying this many objects")
     ("object-type,t", po::value<std::vector<std::string>>(), "Read only objects of given type (node, way, relation, changeset)")
+    ("read-ahead", po::value<int>(), "Number of input files opened ahead of time (default: 1)")
     ;
 
     po::options_description opts_common{add_common_options()};
@@ -71,6 +213,45 @@ bool CommandCat::setup(const std::vector<std::string>& arguments) {
     setup_input_files(vm);
     setup_output_file(vm);
 
+    if (vm.count("copy-blocks")) {
+        if (vm.count("object-type")) {
+            throw argument_error{"Can not use --copy-blocks together with --object-type/-t."};
+        }
+        for (const auto& file : m_input_files) {
+            if (file.format() != osmium::io::file_format::pbf) {
+                throw argument_error{"The --copy-blocks option only works with PBF input files."};
+            }
+        }
+        if (m_output_file.format() != osmium::io::file_format::pbf) {
+            throw argument_error{"The --copy-blocks option only works with PBF output files."};
+        }
+        m_copy_blocks = true;
+    }
+
+    if (vm.count("id-range")) {
+        if (m_copy_blocks) {
+            throw argument_error{"Can not use --copy-blocks together with --id-range."};
+        }
+        const auto range = parse_id_range(vm["id-range"].as<std::string>());
+        m_min_id = range.first;
+        m_max_id = range.second;
+    }
+
+    if (vm.count("max-objects")) {
+        if (m_copy_blocks) {
+            throw argument_error{"Can not use --copy-blocks together with --max-objects."};
+        }
+        m_max_objects = vm["max-objects"].as<std::size_t>();
+    }
+
+    if (vm.count("read-ahead")) {
+        const auto read_ahead = vm["read-ahead"].as<int>();
+        if (read_ahead < 0) {
+            throw argument_error{"The --read-ahead option needs a number of zero or more."};
+        }
+        m_read_ahead = static_cast<std::size_t>(read_ahead);
+    }
+
     return true;
 }
 
@@ -79,10 +260,183 @@ void CommandCat::show_arguments() {
     show_output_arguments(m_vout);
 
     m_vout << "  other options:\n";
+    m_vout << "    copy PBF blocks: " << yes_no(m_copy_blocks);
+    m_vout << "    read ahead: " << m_read_ahead << " files\n";
+    if (m_min_id != 0) {
+        m_vout << "    ID range: " << m_min_id << '-';
+        if (m_max_id != std::numeric_limits<osmium::object_id_type>::max()) {
+            m_vout << m_max_id;
+        }
+        m_vout << '\n';
+    }
+    if (m_max_objects != std::numeric_limits<std::size_t>::max()) {
+        m_vout << "    max objects: " << m_max_objects << '\n';
+    }
     show_object_types(m_vout);
 }
 
+// Can the blocks of the input files be selected by the types and IDs of
+// the objects in them? This needs PBF input files (not STDIN) and is only
+// worth it if an ID range is set or not all object types are read.
+bool CommandCat::select_blocks() const {
+    if ((osm_entity_bits() & osmium::osm_entity_bits::nwr) == osmium::osm_entity_bits::nwr && m_min_id == 0) {
+        return false;
+    }
+
+    for (const auto& file : m_input_files) {
+        if (file.format() != osmium::io::file_format::pbf || is_stdin_or_pipe(file.filename())) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool CommandCat::run_copy_blocks() {
+    std::vector<std::unique_ptr<PBFBlockReader>> readers;
+    pbf_block block;
+
+    // Read the header blocks of all input files. If there is only one
+    // input file, its header is copied, like in the normal case.
+    osmium::io::Header header;
+    bool has_multiple_object_versions = false;
+    for (const auto& input_file : m_input_files) {
+        readers.emplace_back(new PBFBlockReader{input_file.filename()});
+        if (!readers.back()->read(block) || block.type != "OSMHeader") {
+            throw osmium::io_error{"Missing header block in PBF file '" + input_file.filename() + "'"};
+        }
+        const auto input_header = decode_pbf_header(block);
+        if (m_input_files.size() == 1) {
+            header = input_header;
+        } else if (readers.size() == 1) {
+            copy_pbf_features(input_header, header);
+        } else if (get_pbf_features(input_header) != get_pbf_features(header)) {
+            // The blocks are copied as they are, so the output header
+            // must declare the same features as all input headers.
+            throw argument_error{"Can not use --copy-blocks with input files which use different PBF features."};
+        }
+        has_multiple_object_versions = has_multiple_object_versions || input_header.has_multiple_object_versions();
+    }
+    header.set_has_multiple_object_versions(has_multiple_object_versions);
+    setup_header(header);
+
+    PBFBlockWriter writer{m_output_file.filename(), header, m_output_overwrite, m_fsync};
+
+    osmium::ProgressBar progress_bar{file_size_sum(m_input_files), display_progress()};
+    for (std::size_t i = 0; i < m_input_files.size(); ++i) {
+        progress_bar.remove();
+        m_vout << "Copying blocks from input file '" << m_input_files[i].filename() << "'\n";
+        auto& reader = *readers[i];
+        while (reader.read(block)) {
+            if (block.type == "OSMData") {
+                writer.write(block);
+            }
+            progress_bar.update(reader.offset());
+        }
+        progress_bar.file_done(reader.offset());
+    }
+    progress_bar.done();
+
+    writer.close();
+
+    show_memory_used();
+    m_vout << "Done.\n";
+
+    return true;
+}
+
+// Uncompressed OPL output doesn't need the header, so all input files
+// are handled the same way.
+bool CommandCat::run_opl() {
+    OPLWriter writer{m_output_file, m_output_overwrite, m_fsync, m_threads > 1 ? thread_pool() : osmium::thread::Pool::default_instance()};
+
+    std::size_t objects_left = m_max_objects;
+    ReadAhead inputs{m_input_files, osm_entity_bits(), m_read_ahead};
+    osmium::ProgressBar progress_bar{file_size_sum(m_input_files), display_progress()};
+    for (const auto& input_file : m_input_files) {
+        progress_bar.remove();
+        m_vout << "Copying input file '" << input_file.filename() << "'\n";
+        const auto reader = inputs.next();
+        const bool more = copy_objects(*reader, writer, progress_bar, objects_left, m_min_id, m_max_id);
+        progress_bar.file_done(reader->file_size());
+        reader->close();
+        if (!more) {
+            m_vout << "Copied " << m_max_objects << " objects, stopping.\n";
+            break;
+        }
+    }
+    progress_bar.done();
+
+    writer.close();
+
+    show_memory_used();
+    m_vout << "Done.\n";
+
+    return true;
+}
+
+// Only read and decode the blocks of the input files which can contain
+// objects of the types wanted and in the ID range. The other blocks are
+// skipped without decompressing them if they have block statistics.
+template <typename TWriter>
+void CommandCat::copy_selected_blocks(TWriter& writer) {
+    std::size_t objects_left = m_max_objects;
+    osmium::ProgressBar progress_bar{file_size_sum(m_input_files), display_progress()};
+    for (const auto& input_file : m_input_files) {
+        progress_bar.remove();
+        const auto offsets = find_selected_blocks(input_file.filename(), osm_entity_bits(), m_min_id, m_max_id);
+        m_vout << "Copying " << offsets.size() << " selected blocks from input file '" << input_file.filename() << "'\n";
+        PBFDataReader reader{input_file.filename(), offsets, PBFDataReader::offsets_mode::read, osm_entity_bits()};
+        const bool more = copy_objects(reader, writer, progress_bar, objects_left, m_min_id, m_max_id);
+        progress_bar.file_done(input_file_size(input_file.filename()));
+        if (!more) {
+            m_vout << "Copied " << m_max_objects << " objects, stopping.\n";
+            break;
+        }
+    }
+    progress_bar.done();
+}
+
+bool CommandCat::run_select_blocks() {
+    if (OPLWriter::can_write(m_output_file)) {
+        OPLWriter writer{m_output_file, m_output_overwrite, m_fsync, m_threads > 1 ? thread_pool() : osmium::thread::Pool::default_instance()};
+        copy_selected_blocks(writer);
+        writer.close();
+    } else {
+        osmium::io::Header header;
+        if (m_input_files.size() == 1) {
+            PBFBlockReader reader{m_input_files[0].filename()};
+            pbf_block block;
+            if (!reader.read(block) || block.type != "OSMHeader") {
+                throw osmium::io_error{"Missing header block in PBF file '" + m_input_files[0].filename() + "'"};
+            }
+            header = decode_pbf_header(block);
+        }
+        setup_header(header);
+        osmium::io::Writer writer{m_output_file, header, m_output_overwrite, m_fsync};
+        copy_selected_blocks(writer);
+        writer.close();
+    }
+
+    show_memory_used();
+    m_vout << "Done.\n";
+
+    return true;
+}
+
 bool CommandCat::run() {
+    if (m_copy_blocks) {
+        return run_copy_blocks();
+    }
+
+    if (select_blocks()) {
+        return run_select_blocks();
+    }
+
+    if (OPLWriter::can_write(m_output_file)) {
+        return run_opl();
+    }
+
     if (m_input_files.size() == 1) { // single input file
         m_vout << "Copying input file '" << m_input_files[0].filename() << "'\n";
         osmium::io::Reader reader{m_input_files[0], osm_entity_bits()};
@@ -90,31 +444,34 @@ bool CommandCat::run() {
         setup_header(header);
         osmium::io::Writer writer(m_output_file, header, m_output_overwrite, m_fsync);
 
+        std::size_t objects_left = m_max_objects;
         osmium::ProgressBar progress_bar{reader.file_size(), display_progress()};
-        while (osmium::memory::Buffer buffer = reader.read()) {
-            progress_bar.update(reader.offset());
-            writer(std::move(buffer));
+        if (!copy_objects(reader, writer, progress_bar, objects_left, m_min_id, m_max_id)) {
+            m_vout << "Copied " << m_max_objects << " objects, stopping.\n";
         }
         progress_bar.done();
 
-        writer.close();
         reader.close();
+        writer.close();
     } else { // multiple input files
         osmium::io::Header header;
         setup_header(header);
         osmium::io::Writer writer{m_output_file, header, m_output_overwrite, m_fsync};
 
+        std::size_t objects_left = m_max_objects;
+        ReadAhead inputs{m_input_files, osm_entity_bits(), m_read_ahead};
         osmium::ProgressBar progress_bar{file_size_sum(m_input_files), display_progress()};
         for (const auto& input_file : m_input_files) {
             progress_bar.remove();
             m_vout << "Copying input file '" << input_file.filename() << "'\n";
-            osmium::io::Reader reader{input_file, osm_entity_bits()};
-            while (osmium::memory::Buffer buffer = reader.read()) {
-                progress_bar.update(reader.offset());
-                writer(std::move(buffer));
+            const auto reader = inputs.next();
+            const bool more = copy_objects(*reader, writer, progress_bar, objects_left, m_min_id, m_max_id);
+            progress_bar.file_done(reader->file_size());
+            reader->close();
+            if (!more) {
+                m_vout << "Copied " << m_max_objects << " objects, stopping.\n";
+                break;
             }
-            progress_bar.file_done(reader.file_size());
-            reader.close();
         }
         writer.close();
         progress_bar.done();
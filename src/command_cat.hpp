@@ -25,11 +25,36 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "cmd.hpp" // IWYU pragma: export
 
+#include <osmium/osm/types.hpp>
+
+#include <cstddef>
+#include <limits>
 #include <string>
 #include <vector>
 
 class CommandCat : public Command, public with_multiple_osm_inputs, public with_osm_output {
 
+    bool m_copy_blocks = false;
+
+    // Number of input files opened before they are needed.
+    std::size_t m_read_ahead = 1;
+
+    // Stop after this many objects have been copied.
+    std::size_t m_max_objects = std::numeric_limits<std::size_t>::max();
+
+    // Only copy objects with IDs in this range (if m_min_id is not 0).
+    osmium::object_id_type m_min_id = 0;
+    osmium::object_id_type m_max_id = std::numeric_limits<osmium::object_id_type>::max();
+
+    bool select_blocks() const;
+
+    template <typename TWriter>
+    void copy_selected_blocks(TWriter& writer);
+
+    bool run_copy_blocks();
+    bool run_opl();
+    bool run_select_blocks();
+
 public:
 
     explicit CommandCat(const CommandFactory& command_factory) :
@@ -20,28 +20,34 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 */
 
+#include "changeset_prefilter.hpp"
+#include "chunked_reader.hpp"
 #include "command_changeset_filter.hpp"
 #include "exception.hpp"
 #include "util.hpp"
 
 #include <osmium/geom/relations.hpp>
+#include <osmium/io/file_format.hpp>
 #include <osmium/io/header.hpp>
-#include <osmium/io/input_iterator.hpp>
-#include <osmium/io/output_iterator.hpp>
 #include <osmium/io/reader.hpp>
 #include <osmium/io/writer.hpp>
 #include <osmium/osm/changeset.hpp>
 #include <osmium/osm/entity_bits.hpp>
 #include <osmium/osm/timestamp.hpp>
 #include <osmium/osm/types.hpp>
+#include <osmium/thread/pool.hpp>
 #include <osmium/util/progress_bar.hpp>
 #include <osmium/util/verbose_output.hpp>
 
 #include <boost/program_options.hpp>
 
-#include <algorithm>
+#include <cstddef>
+#include <deque>
+#include <future>
+#include <memory>
 #include <stdexcept>
 #include <string>
+#include <utility>
 #include <vector>
 
 bool CommandChangesetFilter::setup(const std::vector<std::string>& arguments) {
@@ -58,6 +64,7 @@ bool CommandChangesetFilter::setup(const std::vector<std::string>& arguments) {
     ("after,a", po::value<std::string>(), "Changesets opened after this time")
     ("before,b", po::value<std::string>(), "Changesets closed before this time")
     ("bbox,B", po::value<std::string>(), "Changesets overlapping this bounding box")
+    ("parse-threads", po::value<int>(), "Number of threads for parsing XML and OPL input (default: 1)")
     ;
 
     po::options_description opts_common{add_common_options()};
@@ -141,6 +148,16 @@ bool CommandChangesetFilter::setup(const std::vector<std::string>& arguments) {
         m_box = parse_bbox(vm["bbox"].as<std::string>(), "--bbox/-B");
     }
 
+    if (vm.count("parse-threads")) {
+        m_parse_threads = vm["parse-threads"].as<int>();
+        if (m_parse_threads < 1) {
+            throw argument_error{"The --parse-threads option needs a positive number."};
+        }
+        if (m_parse_threads > 1 && is_stdin_or_pipe(m_input_file.filename())) {
+            throw argument_error{"The --parse-threads option can not be used when reading from STDIN."};
+        }
+    }
+
     if (m_with_discussion && m_without_discussion) {
         throw argument_error{"You can not use --with-discussion/-d and --without-discussion/-D together."};
     }
@@ -195,62 +212,138 @@ void CommandChangesetFilter::show_arguments() {
     if (m_before < osmium::end_of_time()) {
         m_vout << "      - be created before " << m_before.to_iso() << "\n";
     }
+    m_vout << "    threads: " << m_threads << '\n';
+    m_vout << "    parse threads: " << m_parse_threads << '\n';
 }
 
-bool changeset_after(const osmium::Changeset& changeset, osmium::Timestamp time) {
+template <typename TChangeset>
+bool changeset_after(const TChangeset& changeset, osmium::Timestamp time) {
     return changeset.open() || changeset.closed_at() >= time;
 }
 
-bool changeset_before(const osmium::Changeset& changeset, osmium::Timestamp time) {
+template <typename TChangeset>
+bool changeset_before(const TChangeset& changeset, osmium::Timestamp time) {
     return changeset.created_at() <= time;
 }
 
+bool CommandChangesetFilter::has_predicates() const noexcept {
+    return m_with_discussion || m_without_discussion ||
+           m_with_changes || m_without_changes ||
+           m_open || m_closed ||
+           m_uid != 0 || !m_user.empty() ||
+           m_after > osmium::start_of_time() ||
+           m_before < osmium::end_of_time() ||
+           m_box.valid();
+}
+
+template <typename TChangeset>
+bool CommandChangesetFilter::matches(const TChangeset& changeset) const {
+    return (!m_with_discussion    || changeset.num_comments() > 0) &&
+           (!m_without_discussion || changeset.num_comments() == 0) &&
+           (!m_with_changes       || changeset.num_changes() > 0) &&
+           (!m_without_changes    || changeset.num_changes() == 0) &&
+           (!m_open               || changeset.open()) &&
+           (!m_closed             || changeset.closed()) &&
+           (m_uid == 0            || changeset.uid() == m_uid) &&
+           (m_user.empty()        || m_user == changeset.user()) &&
+           changeset_after(changeset, m_after) &&
+           changeset_before(changeset, m_before) &&
+           (!m_box.valid()        || (changeset.bounds().valid() && osmium::geom::overlaps(changeset.bounds(), m_box)));
+}
+
+// Copy all matching changesets from the buffer into a new buffer. This
+// only reads the buffer, so it can be run on any thread.
+osmium::memory::Buffer CommandChangesetFilter::filter_buffer(const osmium::memory::Buffer& buffer) const {
+    osmium::memory::Buffer output{buffer.committed() + 1024, osmium::memory::Buffer::auto_grow::yes};
+
+    for (const auto& changeset : buffer.select<osmium::Changeset>()) {
+        if (matches(changeset)) {
+            output.add_item(changeset);
+            output.commit();
+        }
+    }
+
+    return output;
+}
+
 bool CommandChangesetFilter::run() {
-    m_vout << "Opening input file...\n";
-    osmium::io::Reader reader{m_input_file, osmium::osm_entity_bits::changeset};
+    // XML and OPL input can be split into chunks which are parsed on a
+    // thread pool. The header is read with a normal reader in that case.
+    // For XML files the changesets in each chunk are first checked using
+    // only the attributes of their start tags, so the discussions and
+    // tags of changesets which don't match are never parsed.
+    const bool is_stdin = is_stdin_or_pipe(m_input_file.filename());
+    const bool prefilter = m_input_file.format() == osmium::io::file_format::xml && !is_stdin && has_predicates();
+    const bool parse_chunked = prefilter || (m_parse_threads > 1 && ChunkedReader::supports(m_input_file));
 
-    auto input = osmium::io::make_input_iterator_range<osmium::Changeset>(reader);
+    m_vout << "Opening input file...\n";
+    osmium::io::Reader reader{m_input_file, parse_chunked ? osmium::osm_entity_bits::nothing : osmium::osm_entity_bits::changeset};
 
     osmium::io::Header header{reader.header()};
     setup_header(header);
 
+    std::unique_ptr<osmium::thread::Pool> parse_pool;
+    std::unique_ptr<ChunkedReader> chunked_reader;
+    if (parse_chunked) {
+        reader.close();
+        parse_pool.reset(new osmium::thread::Pool{m_parse_threads});
+        chunked_reader.reset(new ChunkedReader{m_input_file, osmium::osm_entity_bits::changeset, *parse_pool});
+        if (prefilter) {
+            chunked_reader->set_chunk_filter([this](std::string& data) {
+                prefilter_xml_changesets(data, [this](const changeset_summary& summary) {
+                    return matches(summary);
+                });
+            });
+        }
+    }
+
     m_vout << "Opening output file...\n";
     osmium::io::Writer writer{m_output_file, header, m_output_overwrite, m_fsync};
-    auto out = osmium::io::make_output_iterator(writer);
 
     m_vout << "Filtering data...\n";
 
     osmium::ProgressBar progress_bar{reader.file_size(), display_progress()};
 
-    int count = 0;
-    std::copy_if(input.begin(), input.end(), out,
-        [this, &count, &progress_bar, &reader](const osmium::Changeset& changeset) {
-            if (++count > 10000) {
-                progress_bar.update(reader.offset());
-                count = 0;
-            }
-            return (!m_with_discussion    || changeset.num_comments() > 0) &&
-                   (!m_without_discussion || changeset.num_comments() == 0) &&
-                   (!m_with_changes       || changeset.num_changes() > 0) &&
-                   (!m_without_changes    || changeset.num_changes() == 0) &&
-                   (!m_open               || changeset.open()) &&
-                   (!m_closed             || changeset.closed()) &&
-                   (m_uid == 0            || changeset.uid() == m_uid) &&
-                   (m_user.empty()        || m_user == changeset.user()) &&
-                   changeset_after(changeset, m_after) &&
-                   changeset_before(changeset, m_before) &&
-                   (!m_box.valid()        || (changeset.bounds().valid() && osmium::geom::overlaps(changeset.bounds(), m_box)));
-
-    });
+    // With several threads the buffers are filtered on a thread pool of
+    // their own while the main thread keeps reading. The results are
+    // written in the order of the input.
+    osmium::thread::Pool* pool = m_threads > 1 ? &thread_pool() : nullptr;
+    const std::size_t max_pending = static_cast<std::size_t>(m_threads) * 4;
+    std::deque<std::future<osmium::memory::Buffer>> pending;
+
+    while (osmium::memory::Buffer buffer = chunked_reader ? chunked_reader->read() : reader.read()) {
+        progress_bar.update(chunked_reader ? chunked_reader->offset() : reader.offset());
+        if (!pool) {
+            writer(filter_buffer(buffer));
+            continue;
+        }
+
+        auto buffer_ptr = std::make_shared<osmium::memory::Buffer>(std::move(buffer));
+        pending.push_back(pool->submit([this, buffer_ptr]() {
+            return filter_buffer(*buffer_ptr);
+        }));
+        while (pending.size() >= max_pending) {
+            writer(pending.front().get());
+            pending.pop_front();
+        }
+    }
+
+    while (!pending.empty()) {
+        writer(pending.front().get());
+        pending.pop_front();
+    }
 
     progress_bar.done();
 
     writer.close();
-    reader.close();
+    if (chunked_reader) {
+        chunked_reader->close();
+    } else {
+        reader.close();
+    }
 
     show_memory_used();
     m_vout << "Done.\n";
 
     return true;
 }
-
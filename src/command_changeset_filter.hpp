@@ -25,7 +25,9 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "cmd.hpp" // IWYU pragma: export
 
+#include <osmium/memory/buffer.hpp>
 #include <osmium/osm/box.hpp>
+#include <osmium/osm/changeset.hpp>
 #include <osmium/osm/timestamp.hpp>
 #include <osmium/osm/types.hpp>
 
@@ -39,6 +41,7 @@ class CommandChangesetFilter : public Command, public with_single_osm_input, pub
     osmium::Timestamp m_after = osmium::start_of_time();
     osmium::Timestamp m_before = osmium::end_of_time();
     osmium::user_id_type m_uid = 0;
+    int m_parse_threads = 1;
 
     bool m_with_discussion = false;
     bool m_without_discussion = false;
@@ -47,6 +50,14 @@ class CommandChangesetFilter : public Command, public with_single_osm_input, pub
     bool m_open = false;
     bool m_closed = false;
 
+    // Works with osmium::Changeset and changeset_summary.
+    template <typename TChangeset>
+    bool matches(const TChangeset& changeset) const;
+
+    bool has_predicates() const noexcept;
+
+    osmium::memory::Buffer filter_buffer(const osmium::memory::Buffer& buffer) const;
+
 public:
 
     explicit CommandChangesetFilter(const CommandFactory& command_factory) :
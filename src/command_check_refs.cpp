@@ -21,14 +21,24 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
 #include "command_check_refs.hpp"
+#include "exception.hpp"
+#include "id_file.hpp"
+#include "pbf_blocks.hpp"
+#include "query_index.hpp"
+#include "temp_files.hpp"
 #include "util.hpp"
 
 #include <osmium/handler.hpp>
 #include <osmium/handler/check_order.hpp>
 #include <osmium/index/id_set.hpp>
 #include <osmium/index/nwr_array.hpp>
+#include <osmium/io/error.hpp>
 #include <osmium/io/reader.hpp>
+#include <osmium/object_pointer_collection.hpp>
 #include <osmium/osm.hpp>
+#include <osmium/osm/object_comparisons.hpp>
+#include <osmium/thread/pool.hpp>
+#include <osmium/util/file.hpp>
 #include <osmium/util/progress_bar.hpp>
 #include <osmium/util/verbose_output.hpp>
 #include <osmium/visitor.hpp>
@@ -37,7 +47,14 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include <algorithm>
 #include <cstdint>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <future>
 #include <iostream>
+#include <memory>
+#include <queue>
+#include <stdexcept>
 #include <string>
 #include <utility>
 #include <vector>
@@ -47,6 +64,11 @@ bool CommandCheckRefs::setup(const std::vector<std::string>& arguments) {
     opts_cmd.add_options()
     ("show-ids,i", "Show IDs of missing objects")
     ("check-relations,r", "Also check relations")
+    ("change-file,c", po::value<std::vector<std::string>>(), "Only check references of objects in this change file")
+    ("block-index", po::value<std::string>(), "Look up objects for --change-file using this index of PBF blocks")
+    ("object-index", po::value<std::string>(), "Look up objects for --change-file using this index of PBF objects")
+    ("max-relation-refs", po::value<std::size_t>(), "Maximum number of relation references kept in memory (default: 67108864)")
+    ("temp-dir", po::value<std::string>(), "Directory for temporary files")
     ;
 
     po::options_description opts_common{add_common_options()};
@@ -82,22 +104,220 @@ bool CommandCheckRefs::setup(const std::vector<std::string>& arguments) {
         m_check_relations = true;
     }
 
+    if (vm.count("change-file")) {
+        m_change_filenames = vm["change-file"].as<std::vector<std::string>>();
+    }
+
+    for (const char* option : {"block-index", "object-index"}) {
+        if (!vm.count(option)) {
+            continue;
+        }
+        if (m_change_filenames.empty()) {
+            throw argument_error{std::string{"The --"} + option + " option only works together with --change-file/-c."};
+        }
+        if (m_input_file.format() != osmium::io::file_format::pbf) {
+            throw argument_error{std::string{"The --"} + option + " option only works with PBF input files."};
+        }
+        if (is_stdin_or_pipe(m_input_filename)) {
+            throw argument_error{std::string{"Can not use --"} + option + " when reading from STDIN."};
+        }
+    }
+
+    if (vm.count("block-index") && vm.count("object-index")) {
+        throw argument_error{"Can not use --block-index together with --object-index."};
+    }
+
+    if (vm.count("block-index")) {
+        m_block_index_filename = vm["block-index"].as<std::string>();
+    }
+
+    if (vm.count("object-index")) {
+        m_object_index_filename = vm["object-index"].as<std::string>();
+    }
+
+    if (vm.count("max-relation-refs")) {
+        m_max_relation_refs = vm["max-relation-refs"].as<std::size_t>();
+        if (m_max_relation_refs == 0) {
+            throw argument_error{"The --max-relation-refs option needs a positive number."};
+        }
+    }
+
+    // The relation references are the only part whose memory use can be
+    // limited, they get a quarter of the memory budget.
+    if (!vm.count("max-relation-refs") && m_memory_budget > 0) {
+        m_max_relation_refs = std::max<std::size_t>(memory_budget() / 4 / sizeof(std::pair<osmium::object_id_type, osmium::object_id_type>), 1);
+    }
+
+    if (vm.count("temp-dir")) {
+        m_temp_directory = vm["temp-dir"].as<std::string>();
+    } else {
+        m_temp_directory = default_temp_directory();
+    }
+
     return true;
 }
 
 void CommandCheckRefs::show_arguments() {
     show_single_input_arguments(m_vout);
+    if (!m_change_filenames.empty()) {
+        m_vout << "  change files:\n";
+        for (const auto& filename : m_change_filenames) {
+            m_vout << "    " << filename << '\n';
+        }
+        if (!m_block_index_filename.empty()) {
+            m_vout << "  block index: " << m_block_index_filename << '\n';
+        }
+        if (!m_object_index_filename.empty()) {
+            m_vout << "  object index: " << m_object_index_filename << '\n';
+        }
+    }
     m_vout << "  other options:\n";
     m_vout << "    show ids: " << yes_no(m_show_ids);
     m_vout << "    check relations: " << yes_no(m_check_relations);
+    if (m_check_relations && m_change_filenames.empty()) {
+        m_vout << "    max relation refs in memory: " << m_max_relation_refs << '\n';
+        if (m_memory_budget > 0) {
+            m_vout << "    memory budget: " << m_memory_budget << " MBytes\n";
+        }
+        m_vout << "    directory for temporary files: " << m_temp_directory << '\n';
+    }
+    m_vout << "    threads: " << m_threads << '\n';
 }
 
+namespace {
+
+    using relation_ref = std::pair<osmium::object_id_type, osmium::object_id_type>;
+
+    constexpr const std::size_t relation_refs_chunk_size = 64UL * 1024UL;
+
+    void write_relation_refs_file(const std::string& filename, const std::vector<relation_ref>& refs) {
+        std::ofstream out{filename, std::ios::binary | std::ios::trunc};
+        if (!out) {
+            throw osmium::io_error{"Could not open temporary file '" + filename + "'"};
+        }
+        out.write(reinterpret_cast<const char*>(refs.data()), static_cast<std::streamsize>(refs.size() * sizeof(relation_ref)));
+        out.close();
+        if (!out) {
+            throw osmium::io_error{"Error writing temporary file '" + filename + "'"};
+        }
+    }
+
+    /**
+     * Reads back a sorted run of relation references written by
+     * write_relation_refs_file() one chunk at a time.
+     */
+    class RelationRefsReader {
+
+        std::string m_filename;
+        std::ifstream m_in;
+        std::vector<relation_ref> m_chunk;
+        std::size_t m_pos = 0;
+
+        bool read_chunk() {
+            m_chunk.resize(relation_refs_chunk_size);
+            m_in.read(reinterpret_cast<char*>(m_chunk.data()), static_cast<std::streamsize>(m_chunk.size() * sizeof(relation_ref)));
+            if (m_in.bad() || m_in.gcount() % sizeof(relation_ref) != 0) {
+                throw osmium::io_error{"Error reading temporary file '" + m_filename + "'"};
+            }
+            m_chunk.resize(static_cast<std::size_t>(m_in.gcount()) / sizeof(relation_ref));
+            m_pos = 0;
+            return !m_chunk.empty();
+        }
+
+    public:
+
+        explicit RelationRefsReader(const std::string& filename) :
+            m_filename(filename),
+            m_in(filename, std::ios::binary) {
+            if (!m_in) {
+                throw osmium::io_error{"Could not open temporary file '" + m_filename + "'"};
+            }
+            read_chunk();
+        }
+
+        bool empty() const noexcept {
+            return m_pos == m_chunk.size();
+        }
+
+        const relation_ref& get() const noexcept {
+            return m_chunk[m_pos];
+        }
+
+        bool next() {
+            ++m_pos;
+            return m_pos < m_chunk.size() || read_chunk();
+        }
+
+    }; // class RelationRefsReader
+
+    /**
+     * Sets of the positive and negative IDs of nodes, ways, and relations.
+     */
+    class ObjectIdSets {
+
+        osmium::nwr_array<osmium::index::IdSetDense<osmium::unsigned_object_id_type>> m_idset_pos;
+        osmium::nwr_array<osmium::index::IdSetDense<osmium::unsigned_object_id_type>> m_idset_neg;
+
+    public:
+
+        void set(osmium::item_type type, osmium::object_id_type id) {
+            (id > 0 ? m_idset_pos(type) : m_idset_neg(type)).set(std::abs(id));
+        }
+
+        bool get(osmium::item_type type, osmium::object_id_type id) const noexcept {
+            return (id > 0 ? m_idset_pos(type) : m_idset_neg(type)).get(std::abs(id));
+        }
+
+        std::size_t used_memory() const noexcept {
+            return m_idset_pos(osmium::item_type::node).used_memory() +
+                   m_idset_pos(osmium::item_type::way).used_memory() +
+                   m_idset_pos(osmium::item_type::relation).used_memory() +
+                   m_idset_neg(osmium::item_type::node).used_memory() +
+                   m_idset_neg(osmium::item_type::way).used_memory() +
+                   m_idset_neg(osmium::item_type::relation).used_memory();
+        }
+
+    }; // class ObjectIdSets
+
+    // Call func(type, id) for all references of the object which are
+    // checked: the nodes of a way and, if check_relations is set, the
+    // members of a relation.
+    template <typename TFunc>
+    void for_each_ref(const osmium::OSMObject& object, bool check_relations, TFunc&& func) {
+        if (object.type() == osmium::item_type::way) {
+            for (const auto& node_ref : static_cast<const osmium::Way&>(object).nodes()) {
+                func(osmium::item_type::node, node_ref.ref());
+            }
+        } else if (check_relations && object.type() == osmium::item_type::relation) {
+            for (const auto& member : static_cast<const osmium::Relation&>(object).members()) {
+                if (member.type() == osmium::item_type::node ||
+                    member.type() == osmium::item_type::way ||
+                    member.type() == osmium::item_type::relation) {
+                    func(member.type(), member.ref());
+                }
+            }
+        }
+    }
+
+    void add_object_ids(ObjectIdSets& ids, const osmium::memory::Buffer& buffer) {
+        for (const auto& object : buffer.select<osmium::OSMObject>()) {
+            ids.set(object.type(), object.id());
+        }
+    }
+
+} // anonymous namespace
+
 class RefCheckHandler : public osmium::handler::Handler {
 
-    osmium::nwr_array<osmium::index::IdSetDense<osmium::unsigned_object_id_type>> m_idset_pos;
-    osmium::nwr_array<osmium::index::IdSetDense<osmium::unsigned_object_id_type>> m_idset_neg;
+    ObjectIdSets m_ids;
 
-    std::vector<std::pair<osmium::object_id_type, osmium::object_id_type>> m_relation_refs;
+    // References to relations which could not be checked immediately.
+    // If there are more than m_max_relation_refs of them, they are
+    // written out in sorted runs to temporary files.
+    std::vector<relation_ref> m_relation_refs;
+    std::vector<std::string> m_relation_refs_runs;
+    TempFiles& m_temp_files;
+    std::size_t m_max_relation_refs;
 
     osmium::handler::CheckOrder m_check_order;
 
@@ -108,6 +328,7 @@ class RefCheckHandler : public osmium::handler::Handler {
     uint64_t m_missing_nodes_in_ways = 0;
     uint64_t m_missing_nodes_in_relations = 0;
     uint64_t m_missing_ways_in_relations = 0;
+    uint64_t m_missing_relations_in_relations = 0;
 
     osmium::VerboseOutput& m_vout;
     osmium::ProgressBar& m_progress_bar;
@@ -115,16 +336,34 @@ class RefCheckHandler : public osmium::handler::Handler {
     bool m_check_relations;
 
     void set(osmium::item_type type, osmium::object_id_type id) {
-        (id > 0 ? m_idset_pos(type) : m_idset_neg(type)).set(std::abs(id));
+        m_ids.set(type, id);
     }
 
     bool get(osmium::item_type type, osmium::object_id_type id) const noexcept {
-        return (id > 0 ? m_idset_pos(type) : m_idset_neg(type)).get(std::abs(id));
+        return m_ids.get(type, id);
+    }
+
+    void write_relation_refs_run() {
+        std::sort(m_relation_refs.begin(), m_relation_refs.end());
+        m_relation_refs_runs.push_back(m_temp_files.create());
+        write_relation_refs_file(m_relation_refs_runs.back(), m_relation_refs);
+        m_relation_refs.clear();
+    }
+
+    void check_relation_ref(const relation_ref& refs) {
+        if (!get(osmium::item_type::relation, refs.first)) {
+            ++m_missing_relations_in_relations;
+            if (m_show_ids) {
+                std::cout << "r" << refs.first << " in r" << refs.second << "\n";
+            }
+        }
     }
 
 public:
 
-    RefCheckHandler(osmium::VerboseOutput& vout, osmium::ProgressBar& progress_bar, bool show_ids, bool check_relations) :
+    RefCheckHandler(osmium::VerboseOutput& vout, osmium::ProgressBar& progress_bar, TempFiles& temp_files, std::size_t max_relation_refs, bool show_ids, bool check_relations) :
+        m_temp_files(temp_files),
+        m_max_relation_refs(max_relation_refs),
         m_vout(vout),
         m_progress_bar(progress_bar),
         m_show_ids(show_ids),
@@ -156,18 +395,53 @@ public:
     }
 
     uint64_t missing_relations_in_relations() const {
-        return m_relation_refs.size();
+        return m_missing_relations_in_relations;
     }
 
+    // Check the references to relations which could not be checked
+    // when the relation was read. If sorted runs were written to disk,
+    // they are merged, so the results come out in the same order as
+    // when everything is kept in memory.
     void find_missing_relations() {
-        std::sort(m_relation_refs.begin(), m_relation_refs.end());
+        if (m_relation_refs_runs.empty()) {
+            std::sort(m_relation_refs.begin(), m_relation_refs.end());
+            for (const auto& refs : m_relation_refs) {
+                check_relation_ref(refs);
+            }
+            m_relation_refs.clear();
+            return;
+        }
+
+        if (!m_relation_refs.empty()) {
+            write_relation_refs_run();
+        }
+        m_relation_refs.shrink_to_fit();
+
+        m_vout << "Merging " << m_relation_refs_runs.size() << " runs of relation references...\n";
+
+        std::vector<std::unique_ptr<RelationRefsReader>> readers;
+        readers.reserve(m_relation_refs_runs.size());
+
+        using element_type = std::pair<relation_ref, std::size_t>;
+        std::priority_queue<element_type, std::vector<element_type>, std::greater<element_type>> queue;
+
+        for (const auto& filename : m_relation_refs_runs) {
+            readers.emplace_back(new RelationRefsReader{filename});
+            if (!readers.back()->empty()) {
+                queue.emplace(readers.back()->get(), readers.size() - 1);
+            }
+        }
+
+        while (!queue.empty()) {
+            const auto element = queue.top();
+            queue.pop();
+            check_relation_ref(element.first);
 
-        m_relation_refs.erase(
-            std::remove_if(m_relation_refs.begin(), m_relation_refs.end(), [this](std::pair<osmium::object_id_type, osmium::object_id_type> refs){
-                return get(osmium::item_type::relation, refs.first);
-            }),
-            m_relation_refs.end()
-        );
+            const auto index = element.second;
+            if (readers[index]->next()) {
+                queue.emplace(readers[index]->get(), index);
+            }
+        }
     }
 
     bool no_errors() {
@@ -189,7 +463,8 @@ public:
         set(osmium::item_type::node, node.id());
     }
 
-    void way(const osmium::Way& way) {
+    // Handles everything for a way except checking its nodes.
+    void way_without_nodes(const osmium::Way& way) {
         m_check_order.way(way);
 
         if (m_way_count == 0) {
@@ -201,6 +476,34 @@ public:
         if (m_check_relations) {
             set(osmium::item_type::way, way.id());
         }
+    }
+
+    // Check the nodes of all ways in the buffer. Returns the number of
+    // missing nodes and the text to be written if --show-ids is set.
+    // This only reads the node ID sets, so it can run on several threads
+    // as long as no nodes or relations are handled at the same time.
+    std::pair<uint64_t, std::string> check_way_nodes(const osmium::memory::Buffer& buffer) const {
+        std::pair<uint64_t, std::string> result{0, ""};
+        for (const auto& way : buffer.select<osmium::Way>()) {
+            for (const auto& node_ref : way.nodes()) {
+                if (!get(osmium::item_type::node, node_ref.ref())) {
+                    ++result.first;
+                    if (m_show_ids) {
+                        result.second += "n" + std::to_string(node_ref.ref()) + " in w" + std::to_string(way.id()) + "\n";
+                    }
+                }
+            }
+        }
+        return result;
+    }
+
+    void add_missing_nodes_in_ways(const std::pair<uint64_t, std::string>& result) {
+        m_missing_nodes_in_ways += result.first;
+        std::cout << result.second;
+    }
+
+    void way(const osmium::Way& way) {
+        way_without_nodes(way);
 
         for (const auto& node_ref : way.nodes()) {
             if (!get(osmium::item_type::node, node_ref.ref())) {
@@ -246,6 +549,9 @@ public:
                     case osmium::item_type::relation:
                         if (member.ref() > relation.id() || !get(osmium::item_type::relation, member.ref())) {
                             m_relation_refs.emplace_back(member.ref(), relation.id());
+                            if (m_relation_refs.size() >= m_max_relation_refs) {
+                                write_relation_refs_run();
+                            }
                         }
                         break;
                     default:
@@ -255,32 +561,208 @@ public:
         }
     }
 
-    void show_missing_relation_ids() {
-        for (const auto& refs : m_relation_refs) {
-            std::cout << "r" << refs.first << " in r" << refs.second << "\n";
-        }
-    }
-
     std::size_t used_memory() const noexcept {
-        return m_idset_pos(osmium::item_type::node).used_memory() +
-               m_idset_pos(osmium::item_type::way).used_memory() +
-               m_idset_pos(osmium::item_type::relation).used_memory() +
-               m_idset_neg(osmium::item_type::node).used_memory() +
-               m_idset_neg(osmium::item_type::way).used_memory() +
-               m_idset_neg(osmium::item_type::relation).used_memory() +
+        return m_ids.used_memory() +
                m_relation_refs.capacity() * sizeof(decltype(m_relation_refs)::value_type);
     }
 
 }; // class RefCheckHandler
 
+// Check only the references of the objects created or modified by the
+// change files. A reference is good if the object it references is
+// created or modified by the changes, or if it is not deleted by them
+// and can be found in the input file. Only the objects not in the
+// changes are looked up in the input file, using the block or object
+// index if there is one, so only the blocks which can contain them are
+// read.
+bool CommandCheckRefs::check_change_files() {
+    m_vout << "Reading change files...\n";
+    osmium::memory::Buffer changes{1024 * 1024, osmium::memory::Buffer::auto_grow::yes};
+    for (const auto& filename : m_change_filenames) {
+        osmium::io::Reader reader{filename, osmium::osm_entity_bits::nwr};
+        while (osmium::memory::Buffer buffer = reader.read()) {
+            changes.add_buffer(buffer);
+            changes.commit();
+        }
+        reader.close();
+    }
+
+    // Only the last version of each object in the changes counts.
+    osmium::ObjectPointerCollection objects;
+    osmium::apply(changes, objects);
+    objects.sort(osmium::object_order_type_id_reverse_version{});
+
+    std::vector<const osmium::OSMObject*> last_versions;
+    const osmium::object_equal_type_id equal{};
+    for (auto it = objects.ptr_begin(); it != objects.ptr_end(); ++it) {
+        if (last_versions.empty() || !equal(*last_versions.back(), **it)) {
+            last_versions.push_back(*it);
+        }
+    }
+
+    ObjectIdSets in_changes;
+    ObjectIdSets deleted;
+    osmium::nwr_array<uint64_t> counts;
+    uint64_t deleted_count = 0;
+    for (const auto* object : last_versions) {
+        ++counts(object->type());
+        if (object->visible()) {
+            in_changes.set(object->type(), object->id());
+        } else {
+            deleted.set(object->type(), object->id());
+            ++deleted_count;
+        }
+    }
+
+    ids_type lookup_ids;
+    for (const auto* object : last_versions) {
+        if (object->visible()) {
+            for_each_ref(*object, m_check_relations, [&](osmium::item_type type, osmium::object_id_type id) {
+                if (!in_changes.get(type, id) && !deleted.get(type, id)) {
+                    lookup_ids(type).set(static_cast<osmium::unsigned_object_id_type>(std::abs(id)));
+                }
+            });
+        }
+    }
+
+    ObjectIdSets in_input;
+    if (!no_ids(lookup_ids)) {
+        if (!m_object_index_filename.empty()) {
+            m_vout << "Looking up referenced objects using the object index...\n";
+            PBFObjectIndex index{m_object_index_filename};
+            if (index.file_size() != osmium::file_size(m_input_filename)) {
+                throw std::runtime_error{"Object index '" + m_object_index_filename + "' does not match input file '" + m_input_filename + "'."};
+            }
+            PBFBlockReader reader{m_input_filename};
+            add_object_ids(in_input, read_pbf_objects(reader, index.find(get_pbf_object_keys(lookup_ids))));
+        } else if (!m_block_index_filename.empty()) {
+            m_vout << "Looking up referenced objects using the block index...\n";
+            QueryIndex index{m_input_filename, read_pbf_block_index(m_block_index_filename)};
+            add_object_ids(in_input, index.get_objects(lookup_ids));
+        } else {
+            m_vout << "Looking up referenced objects in the input file...\n";
+            osmium::io::Reader reader{m_input_file, osmium::io::read_meta::no};
+            osmium::ProgressBar progress_bar{reader.file_size(), display_progress()};
+            while (osmium::memory::Buffer buffer = reader.read()) {
+                progress_bar.update(reader.offset());
+                for (const auto& object : buffer.select<osmium::OSMObject>()) {
+                    if (lookup_ids(object.type()).get(object.positive_id())) {
+                        in_input.set(object.type(), object.id());
+                    }
+                }
+            }
+            progress_bar.done();
+            reader.close();
+        }
+    }
+
+    osmium::nwr_array<uint64_t> missing_in_ways;
+    osmium::nwr_array<uint64_t> missing_in_relations;
+    for (const auto* object : last_versions) {
+        if (!object->visible()) {
+            continue;
+        }
+        const bool is_way = object->type() == osmium::item_type::way;
+        for_each_ref(*object, m_check_relations, [&](osmium::item_type type, osmium::object_id_type id) {
+            if (in_changes.get(type, id) || (!deleted.get(type, id) && in_input.get(type, id))) {
+                return;
+            }
+            auto& missing = is_way ? missing_in_ways : missing_in_relations;
+            ++missing(type);
+            if (m_show_ids) {
+                std::cout << osmium::item_type_to_char(type) << id << " in "
+                          << osmium::item_type_to_char(object->type()) << object->id() << "\n";
+            }
+        });
+    }
+
+    std::cerr << "There are " << counts(osmium::item_type::node) << " nodes, "
+                              << counts(osmium::item_type::way) << " ways, and "
+                              << counts(osmium::item_type::relation) << " relations ("
+                              << deleted_count << " deleted) in the change files.\n";
+
+    const uint64_t missing_nodes_in_ways = missing_in_ways(osmium::item_type::node);
+    if (m_check_relations) {
+        std::cerr << "Nodes     in ways      missing: " << missing_nodes_in_ways                             << "\n";
+        std::cerr << "Nodes     in relations missing: " << missing_in_relations(osmium::item_type::node)     << "\n";
+        std::cerr << "Ways      in relations missing: " << missing_in_relations(osmium::item_type::way)      << "\n";
+        std::cerr << "Relations in relations missing: " << missing_in_relations(osmium::item_type::relation) << "\n";
+    } else {
+        std::cerr << "Nodes in ways missing: " << missing_nodes_in_ways << "\n";
+    }
+
+    show_memory_used();
+    m_vout << "Done.\n";
+
+    return missing_nodes_in_ways == 0 &&
+           missing_in_relations(osmium::item_type::node) == 0 &&
+           missing_in_relations(osmium::item_type::way) == 0 &&
+           missing_in_relations(osmium::item_type::relation) == 0;
+}
+
 bool CommandCheckRefs::run() {
-    osmium::io::Reader reader{m_input_file};
-    osmium::ProgressBar progress_bar{reader.file_size(), display_progress()};
-    RefCheckHandler handler{m_vout, progress_bar, m_show_ids, m_check_relations};
+    if (!m_change_filenames.empty()) {
+        return check_change_files();
+    }
 
-    while (osmium::memory::Buffer buffer = reader.read()) {
-        progress_bar.update(reader.offset());
-        osmium::apply(buffer, handler);
+    osmium::io::Reader reader{m_input_file, osmium::io::read_meta::no};
+    osmium::ProgressBar progress_bar{reader.file_size(), display_progress()};
+    TempFiles temp_files{m_temp_directory, "osmium-check-refs", ".run"};
+    RefCheckHandler handler{m_vout, progress_bar, temp_files, m_max_relation_refs, m_show_ids, m_check_relations};
+
+    if (m_threads > 1) {
+        // The nodes of the ways are checked in the thread pool, one task
+        // for each buffer. Everything else is done here in order. All
+        // pending checks are finished before the first relation is
+        // handled, because relations can change the node ID sets.
+        auto& pool = thread_pool();
+        std::deque<std::future<std::pair<uint64_t, std::string>>> pending;
+        const std::size_t max_pending = static_cast<std::size_t>(m_threads) * 4;
+
+        const auto finish_pending = [&]() {
+            for (auto& future : pending) {
+                handler.add_missing_nodes_in_ways(future.get());
+            }
+            pending.clear();
+        };
+
+        while (osmium::memory::Buffer buffer = reader.read()) {
+            progress_bar.update(reader.offset());
+            std::shared_ptr<osmium::memory::Buffer> buffer_ptr{new osmium::memory::Buffer{std::move(buffer)}};
+            bool has_ways = false;
+            for (const auto& object : buffer_ptr->select<osmium::OSMObject>()) {
+                if (object.type() == osmium::item_type::way) {
+                    handler.way_without_nodes(static_cast<const osmium::Way&>(object));
+                    has_ways = true;
+                    continue;
+                }
+                if (object.type() == osmium::item_type::relation) {
+                    if (has_ways) {
+                        pending.push_back(pool.submit([&handler, buffer_ptr]() {
+                            return handler.check_way_nodes(*buffer_ptr);
+                        }));
+                        has_ways = false;
+                    }
+                    finish_pending();
+                }
+                osmium::apply_item(object, handler);
+            }
+            if (has_ways) {
+                pending.push_back(pool.submit([&handler, buffer_ptr]() {
+                    return handler.check_way_nodes(*buffer_ptr);
+                }));
+                while (pending.size() > max_pending) {
+                    handler.add_missing_nodes_in_ways(pending.front().get());
+                    pending.pop_front();
+                }
+            }
+        }
+        finish_pending();
+    } else {
+        while (osmium::memory::Buffer buffer = reader.read()) {
+            progress_bar.update(reader.offset());
+            osmium::apply(buffer, handler);
+        }
     }
     progress_bar.done();
 
@@ -288,10 +770,6 @@ bool CommandCheckRefs::run() {
 
     if (m_check_relations) {
         handler.find_missing_relations();
-
-        if (m_show_ids) {
-            handler.show_missing_relation_ids();
-        }
     }
 
     std::cerr << "There are " << handler.node_count() << " nodes, "
@@ -314,4 +792,3 @@ bool CommandCheckRefs::run() {
 
     return handler.no_errors();
 }
-
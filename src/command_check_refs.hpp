@@ -25,14 +25,22 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "cmd.hpp" // IWYU pragma: export
 
+#include <cstddef>
 #include <string>
 #include <vector>
 
 class CommandCheckRefs : public Command, public with_single_osm_input {
 
+    std::vector<std::string> m_change_filenames;
+    std::string m_block_index_filename;
+    std::string m_object_index_filename;
+    std::string m_temp_directory;
+    std::size_t m_max_relation_refs = 64UL * 1024UL * 1024UL;
     bool m_show_ids = false;
     bool m_check_relations = false;
 
+    bool check_change_files();
+
 public:
 
     explicit CommandCheckRefs(const CommandFactory& command_factory) :
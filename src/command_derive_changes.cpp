@@ -22,6 +22,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "command_derive_changes.hpp"
 #include "exception.hpp"
+#include "pbf_blocks.hpp"
 #include "util.hpp"
 
 #include <osmium/builder/attr.hpp>
@@ -34,12 +35,19 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <osmium/io/writer.hpp>
 #include <osmium/osm/entity_bits.hpp>
 #include <osmium/osm/object.hpp>
+#include <osmium/thread/pool.hpp>
 #include <osmium/util/verbose_output.hpp>
 
 #include <boost/program_options.hpp>
 
+#include <algorithm>
+#include <cstddef>
 #include <ctime>
+#include <future>
+#include <iterator>
+#include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 bool CommandDeriveChanges::setup(const std::vector<std::string>& arguments) {
@@ -48,6 +56,8 @@ bool CommandDeriveChanges::setup(const std::vector<std::string>& arguments) {
     ("increment-version", "Increment version of deleted objects")
     ("keep-details",      "Keep tags (and nodes of ways, members of relations) of deleted objects")
     ("update-timestamp",  "Set timestamp of deleted objects to current time")
+    ("compare-blocks",    "Skip blocks which are the same in both PBF files")
+    ("by-type",           "Derive changes for nodes, ways, and relations in parallel")
     ;
 
     po::options_description opts_common{add_common_options()};
@@ -93,6 +103,28 @@ bool CommandDeriveChanges::setup(const std::vector<std::string>& arguments) {
         m_update_timestamp = true;
     }
 
+    for (const char* option : {"compare-blocks", "by-type"}) {
+        if (!vm.count(option)) {
+            continue;
+        }
+        for (const auto& file : m_input_files) {
+            if (file.format() != osmium::io::file_format::pbf) {
+                throw argument_error{std::string{"The --"} + option + " option only works with PBF input files."};
+            }
+            if (is_stdin_or_pipe(file.filename())) {
+                throw argument_error{std::string{"Can not use --"} + option + " when reading from STDIN."};
+            }
+        }
+    }
+
+    if (vm.count("compare-blocks")) {
+        m_compare_blocks = true;
+    }
+
+    if (vm.count("by-type")) {
+        m_by_type = true;
+    }
+
     return true;
 }
 
@@ -104,9 +136,14 @@ void CommandDeriveChanges::show_arguments() {
     m_vout << "      increment version: " << yes_no(m_increment_version);
     m_vout << "      keep details: "      << yes_no(m_keep_details);
     m_vout << "      update timestamp: "  << yes_no(m_update_timestamp);
+    m_vout << "    compare blocks: " << yes_no(m_compare_blocks);
+    m_vout << "    by type: " << yes_no(m_by_type);
 }
 
-void CommandDeriveChanges::write_deleted(osmium::io::Writer& writer, osmium::OSMObject& object) {
+// Write a deleted object to the output. The buffer is used for building
+// the deleted object if the details are not kept.
+template <typename TOutput>
+void CommandDeriveChanges::write_deleted(TOutput&& output, osmium::memory::Buffer& buffer, osmium::OSMObject& object) const {
     if (m_increment_version) {
         object.set_version(object.version() + 1);
     }
@@ -117,70 +154,55 @@ void CommandDeriveChanges::write_deleted(osmium::io::Writer& writer, osmium::OSM
 
     if (m_keep_details) {
         object.set_visible(false);
-        writer(object);
+        output(object);
     } else {
         using namespace osmium::builder::attr; // NOLINT(google-build-using-namespace)
         if (object.type() == osmium::item_type::node) {
-            osmium::builder::add_node(m_buffer,
+            osmium::builder::add_node(buffer,
                 _deleted(),
                 _id(object.id()),
                 _version(object.version()),
                 _timestamp(object.timestamp())
             );
         } else if (object.type() == osmium::item_type::way) {
-            osmium::builder::add_way(m_buffer,
+            osmium::builder::add_way(buffer,
                  _deleted(),
                  _id(object.id()),
                  _version(object.version()),
                  _timestamp(object.timestamp())
              );
         } else if (object.type() == osmium::item_type::relation) {
-            osmium::builder::add_relation(m_buffer,
+            osmium::builder::add_relation(buffer,
                  _deleted(),
                  _id(object.id()),
                  _version(object.version()),
                  _timestamp(object.timestamp())
              );
         }
-        writer(m_buffer.get<osmium::OSMObject>(0));
-        m_buffer.clear();
+        output(buffer.get<osmium::OSMObject>(0));
+        buffer.clear();
     }
 }
 
-bool CommandDeriveChanges::run() {
-    m_vout << "Opening input files...\n";
-    osmium::io::Reader reader1{m_input_files[0], osmium::osm_entity_bits::object};
-    osmium::io::ReaderWithProgressBar reader2{display_progress(), m_input_files[1], osmium::osm_entity_bits::object};
-    auto in1 = osmium::io::make_input_iterator_range<osmium::OSMObject>(reader1);
-    auto in2 = osmium::io::make_input_iterator_range<osmium::OSMObject>(reader2);
+template <typename TSource1, typename TSource2, typename TOutput>
+void CommandDeriveChanges::derive_changes(TSource1& source1, TSource2& source2, TOutput&& output, osmium::memory::Buffer& buffer) const {
+    auto in1 = osmium::io::make_input_iterator_range<osmium::OSMObject>(source1);
+    auto in2 = osmium::io::make_input_iterator_range<osmium::OSMObject>(source2);
     auto it1 = in1.begin();
     auto it2 = in2.begin();
     auto end1 = in1.end();
     auto end2 = in2.end();
 
-    reader2.progress_bar().remove();
-    m_vout << "Opening output file...\n";
-    if (m_output_file.format() != osmium::io::file_format::xml || !m_output_file.is_true("xml_change_format")) {
-        warning("Output format chosen is not the XML change format. Use .osc(.gz|bz2) as suffix or -f option.\n");
-    }
-
-    osmium::io::Header header;
-    setup_header(header);
-
-    osmium::io::Writer writer{m_output_file, header, m_output_overwrite, m_fsync};
-
-    reader2.progress_bar().remove();
-    m_vout << "Deriving changes...\n";
     while (it1 != end1 || it2 != end2) {
         if (it2 == end2) {
-            write_deleted(writer, *it1);
+            write_deleted(output, buffer, *it1);
             ++it1;
         } else if (it1 == end1 || *it2 < *it1) {
-            writer(*it2);
+            output(*it2);
             ++it2;
         } else if (*it1 < *it2) {
             if (it2->id() != it1->id()) {
-                write_deleted(writer, *it1);
+                write_deleted(output, buffer, *it1);
             }
             ++it1;
         } else { /* *it1 == *it2 */
@@ -188,14 +210,119 @@ bool CommandDeriveChanges::run() {
             ++it2;
         }
     }
+}
+
+// Remove the offsets in remove from offsets. Both must be sorted.
+static void remove_offsets(std::vector<std::size_t>& offsets, const std::vector<std::size_t>& remove) {
+    std::vector<std::size_t> result;
+    std::set_difference(offsets.cbegin(), offsets.cend(), remove.cbegin(), remove.cend(), std::back_inserter(result));
+    offsets.swap(result);
+}
+
+// Nodes, ways, and relations are derived independently on their own
+// threads reading only the blocks containing objects of that type. The
+// changes are collected in memory and written out in order.
+void CommandDeriveChanges::derive_changes_by_type(osmium::io::Writer& writer) const {
+    const std::string filename1{m_input_files[0].filename()};
+    const std::string filename2{m_input_files[1].filename()};
+
+    m_vout << "Finding blocks for each object type...\n";
+    pbf_type_blocks blocks1 = get_pbf_type_blocks(filename1);
+    pbf_type_blocks blocks2 = get_pbf_type_blocks(filename2);
+
+    if (m_compare_blocks) {
+        m_vout << "Comparing blocks...\n";
+        const auto identical = find_identical_pbf_blocks(filename1, filename2);
+        m_vout << "Found " << identical.offsets1.size() << " identical blocks.\n";
+        for (auto* offsets : {&blocks1.nodes, &blocks1.ways, &blocks1.relations}) {
+            remove_offsets(*offsets, identical.offsets1);
+        }
+        for (auto* offsets : {&blocks2.nodes, &blocks2.ways, &blocks2.relations}) {
+            remove_offsets(*offsets, identical.offsets2);
+        }
+    }
+
+    osmium::thread::Pool pool{3};
+
+    const auto submit = [&](const std::vector<std::size_t>& offsets1, const std::vector<std::size_t>& offsets2, osmium::osm_entity_bits::type entities) {
+        return pool.submit([this, filename1, filename2, offsets1, offsets2, entities]() {
+            PBFDataReader reader1{filename1, offsets1, PBFDataReader::offsets_mode::read, entities};
+            PBFDataReader reader2{filename2, offsets2, PBFDataReader::offsets_mode::read, entities};
+
+            osmium::memory::Buffer changes{1024UL * 1024UL, osmium::memory::Buffer::auto_grow::yes};
+            osmium::memory::Buffer buffer{128};
+            derive_changes(reader1, reader2, [&changes](const osmium::OSMObject& object) {
+                changes.add_item(object);
+                changes.commit();
+            }, buffer);
+
+            return changes;
+        });
+    };
+
+    std::vector<std::future<osmium::memory::Buffer>> results;
+    results.push_back(submit(blocks1.nodes, blocks2.nodes, osmium::osm_entity_bits::node));
+    results.push_back(submit(blocks1.ways, blocks2.ways, osmium::osm_entity_bits::way));
+    results.push_back(submit(blocks1.relations, blocks2.relations, osmium::osm_entity_bits::relation));
+
+    for (auto& result : results) {
+        writer(result.get());
+    }
+}
+
+bool CommandDeriveChanges::run() {
+    std::unique_ptr<osmium::io::Reader> reader1;
+    std::unique_ptr<osmium::io::ReaderWithProgressBar> reader2;
+    std::unique_ptr<PBFDataReader> data_reader1;
+    std::unique_ptr<PBFDataReader> data_reader2;
+
+    if (m_by_type) {
+        // The input files are opened in derive_changes_by_type().
+    } else if (m_compare_blocks) {
+        // Objects in blocks which are the same in both files can not be
+        // part of the changes, so those blocks are not even decoded.
+        m_vout << "Comparing blocks...\n";
+        auto blocks = find_identical_pbf_blocks(m_input_files[0].filename(), m_input_files[1].filename());
+        m_vout << "Found " << blocks.offsets1.size() << " identical blocks.\n";
+        data_reader1.reset(new PBFDataReader{m_input_files[0].filename(), std::move(blocks.offsets1), PBFDataReader::offsets_mode::skip, osmium::osm_entity_bits::object});
+        data_reader2.reset(new PBFDataReader{m_input_files[1].filename(), std::move(blocks.offsets2), PBFDataReader::offsets_mode::skip, osmium::osm_entity_bits::object});
+    } else {
+        m_vout << "Opening input files...\n";
+        reader1.reset(new osmium::io::Reader{m_input_files[0], osmium::osm_entity_bits::object});
+        reader2.reset(new osmium::io::ReaderWithProgressBar{display_progress(), m_input_files[1], osmium::osm_entity_bits::object});
+        reader2->progress_bar().remove();
+    }
+
+    m_vout << "Opening output file...\n";
+    if (m_output_file.format() != osmium::io::file_format::xml || !m_output_file.is_true("xml_change_format")) {
+        warning("Output format chosen is not the XML change format. Use .osc(.gz|bz2) as suffix or -f option.\n");
+    }
+
+    osmium::io::Header header;
+    setup_header(header);
+
+    osmium::io::Writer writer{m_output_file, header, m_output_overwrite, m_fsync};
+
+    const auto output = [&writer](const osmium::OSMObject& object) {
+        writer(object);
+    };
+
+    m_vout << "Deriving changes...\n";
+    if (m_by_type) {
+        derive_changes_by_type(writer);
+    } else if (m_compare_blocks) {
+        derive_changes(*data_reader1, *data_reader2, output, m_buffer);
+    } else {
+        reader2->progress_bar().remove();
+        derive_changes(*reader1, *reader2, output, m_buffer);
+        reader2->close();
+        reader1->close();
+    }
 
     writer.close();
-    reader2.close();
-    reader1.close();
 
     show_memory_used();
     m_vout << "Done.\n";
 
     return true;
 }
-
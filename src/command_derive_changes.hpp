@@ -39,6 +39,16 @@ class CommandDeriveChanges : public Command, public with_multiple_osm_inputs, pu
     bool m_keep_details = false;
     bool m_update_timestamp = false;
     bool m_increment_version = false;
+    bool m_compare_blocks = false;
+    bool m_by_type = false;
+
+    template <typename TOutput>
+    void write_deleted(TOutput&& output, osmium::memory::Buffer& buffer, osmium::OSMObject& object) const;
+
+    template <typename TSource1, typename TSource2, typename TOutput>
+    void derive_changes(TSource1& source1, TSource2& source2, TOutput&& output, osmium::memory::Buffer& buffer) const;
+
+    void derive_changes_by_type(osmium::io::Writer& writer) const;
 
 public:
 
@@ -50,8 +60,6 @@ public:
 
     void show_arguments() override final;
 
-    void write_deleted(osmium::io::Writer& writer, osmium::OSMObject& object);
-
     bool run() override final;
 
     const char* name() const noexcept override final {
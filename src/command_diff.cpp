@@ -22,30 +22,36 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "command_diff.hpp"
 #include "exception.hpp"
+#include "pbf_blocks.hpp"
 #include "util.hpp"
 
 #include <osmium/io/detail/read_write.hpp>
 #include <osmium/io/file.hpp>
 #include <osmium/io/file_format.hpp>
-#include <osmium/io/input_iterator.hpp>
 #include <osmium/io/reader.hpp>
 #include <osmium/io/reader_with_progress_bar.hpp>
 #include <osmium/io/writer.hpp>
 #include <osmium/io/writer_options.hpp>
+#include <osmium/memory/buffer.hpp>
 #include <osmium/memory/item.hpp>
 #include <osmium/osm.hpp>
 #include <osmium/osm/crc.hpp>
 #include <osmium/osm/crc_zlib.hpp>
 #include <osmium/osm/item_type.hpp>
+#include <osmium/thread/pool.hpp>
 #include <osmium/util/verbose_output.hpp>
 
 #include <boost/program_options.hpp>
 
+#include <cstddef>
 #include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
 #include <iostream>
 #include <memory>
-#include <sstream>
 #include <string>
+#include <utility>
 #include <vector>
 
 bool CommandDiff::setup(const std::vector<std::string>& arguments) {
@@ -58,6 +64,7 @@ bool CommandDiff::setup(const std::vector<std::string>& arguments) {
     ("quiet,q", "Report only when files differ")
     ("summary,s", "Show summary on STDERR")
     ("suppress-common,c", "Suppress common objects")
+    ("compare-blocks", "Skip blocks which are the same in both PBF files")
     ;
 
     po::options_description opts_common{add_common_options()};
@@ -138,6 +145,21 @@ bool CommandDiff::setup(const std::vector<std::string>& arguments) {
         m_suppress_common = true;
     }
 
+    if (vm.count("compare-blocks")) {
+        if (!m_suppress_common && m_output_action != "none") {
+            throw argument_error{"The --compare-blocks option needs --suppress-common/-c or --quiet/-q."};
+        }
+        for (const auto& file : m_input_files) {
+            if (file.format() != osmium::io::file_format::pbf) {
+                throw argument_error{"The --compare-blocks option only works with PBF input files."};
+            }
+            if (is_stdin_or_pipe(file.filename())) {
+                throw argument_error{"Can not use --compare-blocks when reading from STDIN."};
+            }
+        }
+        m_compare_blocks = true;
+    }
+
     return true;
 }
 
@@ -148,6 +170,8 @@ void CommandDiff::show_arguments() {
     m_vout << "  other options:\n";
     m_vout << "    show summary: " << yes_no(m_show_summary);
     m_vout << "    suppress common objects: " << yes_no(m_suppress_common);
+    m_vout << "    threads: " << m_threads << '\n';
+    m_vout << "    compare blocks: " << yes_no(m_compare_blocks);
     show_object_types(m_vout);
 }
 
@@ -178,24 +202,62 @@ public:
     virtual void different(osmium::OSMObject& /* left */, osmium::OSMObject& /* right */) {
     }
 
+    virtual void close() {
+    }
+
 }; // class OutputAction
 
 class OutputActionCompact : public OutputAction {
 
+    // Lines are formatted into this buffer which is written out when it
+    // is full instead of formatting and writing each line on its own.
+    static constexpr const std::size_t buffer_size = 1024UL * 1024UL;
+
+    std::string m_buffer;
     int m_fd;
 
-    void print(const char diff, const osmium::OSMObject& object) const {
-        std::stringstream ss;
-        ss << diff
-           << osmium::item_type_to_char(object.type()) << object.id()
-           << " v" << object.version() << '\n';
-        osmium::io::detail::reliable_write(m_fd, ss.str().c_str(), ss.str().size());
+    void append_number(uint64_t value) {
+        char digits[20];
+        char* const end = digits + sizeof(digits);
+        char* p = end;
+        do {
+            *--p = static_cast<char>('0' + value % 10);
+            value /= 10;
+        } while (value != 0);
+        m_buffer.append(p, end);
+    }
+
+    void append_id(osmium::object_id_type id) {
+        if (id < 0) {
+            m_buffer += '-';
+            append_number(0 - static_cast<uint64_t>(id));
+        } else {
+            append_number(static_cast<uint64_t>(id));
+        }
+    }
+
+    void write_buffer() {
+        osmium::io::detail::reliable_write(m_fd, m_buffer.data(), m_buffer.size());
+        m_buffer.clear();
+    }
+
+    void print(const char diff, const osmium::OSMObject& object) {
+        m_buffer += diff;
+        m_buffer += osmium::item_type_to_char(object.type());
+        append_id(object.id());
+        m_buffer += " v";
+        append_number(object.version());
+        m_buffer += '\n';
+        if (m_buffer.size() >= buffer_size) {
+            write_buffer();
+        }
     }
 
 public:
 
-    explicit OutputActionCompact(int fd) noexcept :
+    explicit OutputActionCompact(int fd) :
         m_fd(fd) {
+        m_buffer.reserve(buffer_size + 64);
     }
 
     void left(osmium::OSMObject& object) override {
@@ -214,6 +276,10 @@ public:
         print('*', left);
     }
 
+    void close() override {
+        write_buffer();
+    }
+
 }; // class OutputActionCompact
 
 class OutputActionOSM : public OutputAction {
@@ -243,17 +309,176 @@ public:
         m_writer(right);
     }
 
+    void close() override {
+        m_writer.close();
+    }
+
 }; // class OutputActionOSM
 
+namespace {
+
+    // Digest of all attributes, tags, members, and locations of an
+    // object. Objects with the same type, ID, version, and timestamp are
+    // the same if they have the same digest.
+    uint32_t object_digest(const osmium::OSMObject& object) {
+        osmium::CRC<osmium::CRC_zlib> crc;
+        switch (object.type()) {
+            case osmium::item_type::node:
+                crc.update(static_cast<const osmium::Node&>(object));
+                break;
+            case osmium::item_type::way:
+                crc.update(static_cast<const osmium::Way&>(object));
+                break;
+            case osmium::item_type::relation:
+                crc.update(static_cast<const osmium::Relation&>(object));
+                break;
+            default:
+                break;
+        }
+        return crc().checksum();
+    }
+
+    struct digested_buffer {
+        std::shared_ptr<osmium::memory::Buffer> buffer;
+        std::vector<uint32_t> digests;
+    };
+
+    digested_buffer digest_buffer(const std::shared_ptr<osmium::memory::Buffer>& buffer) {
+        digested_buffer result;
+        result.buffer = buffer;
+        for (const auto& object : buffer->select<osmium::OSMObject>()) {
+            result.digests.push_back(object_digest(object));
+        }
+        return result;
+    }
+
+    /**
+     * One of the inputs of the diff. The buffers are read ahead and the
+     * digests of all objects are calculated on the thread pool (if there
+     * is one) while the objects from earlier buffers are compared. Without
+     * a thread pool the digest is only calculated for objects which are
+     * in both inputs.
+     */
+    class DiffInput {
+
+        using iterator = osmium::memory::Buffer::t_iterator<osmium::OSMObject>;
+
+        std::function<osmium::memory::Buffer()> m_read;
+        osmium::thread::Pool* m_pool;
+        std::size_t m_max_pending;
+        std::deque<std::future<digested_buffer>> m_pending;
+        digested_buffer m_current;
+        iterator m_it;
+        iterator m_end;
+        std::size_t m_index = 0;
+        bool m_eof = false;
+
+        void fill() {
+            while (!m_eof && m_pending.size() < m_max_pending) {
+                osmium::memory::Buffer buffer = m_read();
+                if (!buffer) {
+                    m_eof = true;
+                    return;
+                }
+                std::shared_ptr<osmium::memory::Buffer> buffer_ptr{new osmium::memory::Buffer{std::move(buffer)}};
+                if (m_pool) {
+                    m_pending.push_back(m_pool->submit([buffer_ptr]() {
+                        return digest_buffer(buffer_ptr);
+                    }));
+                } else {
+                    m_pending.push_back(std::async(std::launch::deferred, [buffer_ptr]() {
+                        return digested_buffer{buffer_ptr, {}};
+                    }));
+                }
+            }
+        }
+
+        void next_buffer() {
+            for (;;) {
+                fill();
+                if (m_pending.empty()) {
+                    m_current = digested_buffer{};
+                    m_it = iterator{};
+                    m_end = iterator{};
+                    return;
+                }
+                m_current = m_pending.front().get();
+                m_pending.pop_front();
+                m_it = m_current.buffer->begin<osmium::OSMObject>();
+                m_end = m_current.buffer->end<osmium::OSMObject>();
+                m_index = 0;
+                if (m_it != m_end) {
+                    return;
+                }
+            }
+        }
+
+    public:
+
+        DiffInput(std::function<osmium::memory::Buffer()>&& read, osmium::thread::Pool* pool, std::size_t max_pending) :
+            m_read(std::move(read)),
+            m_pool(pool),
+            m_max_pending(max_pending) {
+            next_buffer();
+        }
+
+        bool valid() const noexcept {
+            return m_it != m_end;
+        }
+
+        osmium::OSMObject& object() {
+            return *m_it;
+        }
+
+        uint32_t digest() const {
+            if (m_current.digests.empty()) {
+                return object_digest(*m_it);
+            }
+            return m_current.digests[m_index];
+        }
+
+        void next() {
+            ++m_it;
+            ++m_index;
+            if (m_it == m_end) {
+                next_buffer();
+            }
+        }
+
+    }; // class DiffInput
+
+} // anonymous namespace
+
 bool CommandDiff::run() {
-    osmium::io::Reader reader1{m_input_files[0], osm_entity_bits()};
-    osmium::io::ReaderWithProgressBar reader2{display_progress(), m_input_files[1], osm_entity_bits()};
-    auto in1 = osmium::io::make_input_iterator_range<osmium::OSMObject>(reader1);
-    auto in2 = osmium::io::make_input_iterator_range<osmium::OSMObject>(reader2);
-    auto it1 = in1.begin();
-    auto it2 = in2.begin();
-    auto end1 = in1.end();
-    auto end2 = in2.end();
+    osmium::thread::Pool* pool = m_threads > 1 ? &thread_pool() : nullptr;
+    const std::size_t max_pending = m_threads > 1 ? static_cast<std::size_t>(m_threads) * 4 : 1;
+
+    // Either read both files completely or only those blocks which are
+    // not the same in both files.
+    std::unique_ptr<osmium::io::Reader> reader1;
+    std::unique_ptr<osmium::io::ReaderWithProgressBar> reader2;
+    std::unique_ptr<PBFDataReader> data_reader1;
+    std::unique_ptr<PBFDataReader> data_reader2;
+    std::function<osmium::memory::Buffer()> read1;
+    std::function<osmium::memory::Buffer()> read2;
+
+    if (m_compare_blocks) {
+        m_vout << "Comparing blocks...\n";
+        auto blocks = find_identical_pbf_blocks(m_input_files[0].filename(), m_input_files[1].filename());
+        m_vout << "Found " << blocks.offsets1.size() << " identical blocks.\n";
+        data_reader1.reset(new PBFDataReader{m_input_files[0].filename(), std::move(blocks.offsets1), PBFDataReader::offsets_mode::skip, osm_entity_bits(), m_show_summary});
+        data_reader2.reset(new PBFDataReader{m_input_files[1].filename(), std::move(blocks.offsets2), PBFDataReader::offsets_mode::skip, osm_entity_bits()});
+        read1 = [&data_reader1]() { return data_reader1->read(); };
+        read2 = [&data_reader2]() { return data_reader2->read(); };
+    } else {
+        reader1.reset(new osmium::io::Reader{m_input_files[0], osm_entity_bits()});
+        reader2.reset(new osmium::io::ReaderWithProgressBar{display_progress(), m_input_files[1], osm_entity_bits()});
+        read1 = [&reader1]() { return reader1->read(); };
+        read2 = [&reader2]() { return reader2->read(); };
+    }
+
+    DiffInput input1{std::move(read1), pool, max_pending};
+    DiffInput input2{std::move(read2), pool, max_pending};
 
     std::unique_ptr<OutputAction> action;
 
@@ -270,69 +495,68 @@ bool CommandDiff::run() {
     uint64_t count_same = 0;
     uint64_t count_different = 0;
 
-    while (it1 != end1 || it2 != end2) {
-        if (it2 == end2) {
-            it1->set_diff(osmium::diff_indicator_type::left);
+    // Without output and summary only the return code is needed, so we
+    // can stop at the first difference.
+    const bool stop_at_difference = m_output_action == "none" && !m_show_summary;
+
+    while (input1.valid() || input2.valid()) {
+        if (stop_at_difference && (count_left > 0 || count_right > 0 || count_different > 0)) {
+            m_vout << "Files differ, stopping at first difference.\n";
+            break;
+        }
+        if (!input2.valid()) {
+            input1.object().set_diff(osmium::diff_indicator_type::left);
             ++count_left;
             if (action) {
-                action->left(*it1);
+                action->left(input1.object());
             }
-            ++it1;
-        } else if (it1 == end1 || *it2 < *it1) {
-            it2->set_diff(osmium::diff_indicator_type::right);
+            input1.next();
+        } else if (!input1.valid() || input2.object() < input1.object()) {
+            input2.object().set_diff(osmium::diff_indicator_type::right);
             ++count_right;
             if (action) {
-                action->right(*it2);
+                action->right(input2.object());
             }
-            ++it2;
-        } else if (*it1 < *it2) {
-            it1->set_diff(osmium::diff_indicator_type::left);
+            input2.next();
+        } else if (input1.object() < input2.object()) {
+            input1.object().set_diff(osmium::diff_indicator_type::left);
             ++count_left;
             if (action) {
-                action->left(*it1);
+                action->left(input1.object());
             }
-            ++it1;
-        } else { /* *it1 == *it2 */
-            osmium::CRC<osmium::CRC_zlib> crc1;
-            osmium::CRC<osmium::CRC_zlib> crc2;
-            switch (it1->type()) {
-                case osmium::item_type::node:
-                    crc1.update(static_cast<const osmium::Node&>(*it1));
-                    crc2.update(static_cast<const osmium::Node&>(*it2));
-                    break;
-                case osmium::item_type::way:
-                    crc1.update(static_cast<const osmium::Way&>(*it1));
-                    crc2.update(static_cast<const osmium::Way&>(*it2));
-                    break;
-                case osmium::item_type::relation:
-                    crc1.update(static_cast<const osmium::Relation&>(*it1));
-                    crc2.update(static_cast<const osmium::Relation&>(*it2));
-                    break;
-                default:
-                    break;
-            }
-            if (crc1().checksum() == crc2().checksum()) {
+            input1.next();
+        } else { /* input1.object() == input2.object() */
+            if (input1.digest() == input2.digest()) {
                 ++count_same;
                 if (!m_suppress_common) {
-                    it1->set_diff(osmium::diff_indicator_type::both);
-                    it2->set_diff(osmium::diff_indicator_type::both);
+                    input1.object().set_diff(osmium::diff_indicator_type::both);
+                    input2.object().set_diff(osmium::diff_indicator_type::both);
                     if (action) {
-                        action->same(*it1);
+                        action->same(input1.object());
                     }
                 }
             } else {
                 ++count_different;
-                it1->set_diff(osmium::diff_indicator_type::left);
-                it2->set_diff(osmium::diff_indicator_type::right);
+                input1.object().set_diff(osmium::diff_indicator_type::left);
+                input2.object().set_diff(osmium::diff_indicator_type::right);
                 if (action) {
-                    action->different(*it1, *it2);
+                    action->different(input1.object(), input2.object());
                 }
             }
-            ++it1;
-            ++it2;
+            input1.next();
+            input2.next();
         }
     }
 
+    if (action) {
+        action->close();
+    }
+
+    if (data_reader1) {
+        // Objects in identical blocks are the same in both files.
+        count_same += data_reader1->skipped_objects();
+    }
+
     if (m_show_summary) {
         std::cerr << "Summary: left=" << count_left <<
                             " right=" << count_right <<
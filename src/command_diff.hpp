@@ -33,6 +33,7 @@ class CommandDiff : public Command, public with_multiple_osm_inputs, public with
     std::string m_output_action;
     bool m_show_summary = false;
     bool m_suppress_common = false;
+    bool m_compare_blocks = false;
 
 public:
 
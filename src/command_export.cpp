@@ -22,21 +22,37 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "command_export.hpp"
 #include "exception.hpp"
+#include "location_index.hpp"
+#include "pbf_blocks.hpp"
+#include "temp_files.hpp"
+#include "trace.hpp"
 #include "util.hpp"
 
+#include "export/export_format_flatgeobuf.hpp"
 #include "export/export_format_json.hpp"
 #include "export/export_format_pg.hpp"
+#include "export/export_format_pg_binary.hpp"
+#include "export/export_format_split.hpp"
 #include "export/export_format_text.hpp"
 #include "export/export_handler.hpp"
+#include "export/parallel_multipolygon_manager.hpp"
 
 #include <osmium/area/assembler.hpp>
 #include <osmium/area/multipolygon_manager.hpp>
+#include <osmium/handler.hpp>
 #include <osmium/handler/check_order.hpp>
+#include <osmium/index/id_set.hpp>
 #include <osmium/io/any_input.hpp>
+#include <osmium/io/any_output.hpp>
+#include <osmium/io/file_compression.hpp>
+#include <osmium/io/file_format.hpp>
 #include <osmium/io/reader_with_progress_bar.hpp>
+#include <osmium/io/writer.hpp>
 #include <osmium/memory/buffer.hpp>
 #include <osmium/osm.hpp>
 #include <osmium/relations/manager_util.hpp>
+#include <osmium/util/file.hpp>
+#include <osmium/util/progress_bar.hpp>
 #include <osmium/util/string.hpp>
 #include <osmium/util/verbose_output.hpp>
 #include <osmium/visitor.hpp>
@@ -47,7 +63,11 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include <boost/program_options.hpp>
 
+#include <algorithm>
 #include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <memory>
@@ -55,6 +75,14 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <utility>
 #include <vector>
 
+// Highest zoom level allowed for --split-zoom. With more tiles there could
+// be too many files open at the same time.
+static constexpr const int max_split_zoom = 12;
+
+// Upper limit for the number of output files with --split-zoom. Each open
+// file has an output buffer of about 1 MByte.
+static constexpr const std::size_t max_split_files = 4096;
+
 static std::string get_attr_string(const rapidjson::Value& object, const char* key) {
     const auto it = object.FindMember(key);
     if (it == object.MemberEnd()) {
@@ -74,19 +102,19 @@ static std::string get_attr_string(const rapidjson::Value& object, const char* k
     return "";
 }
 
-void CommandExport::parse_options(const rapidjson::Value& attributes) {
+void CommandExport::parse_options(const rapidjson::Value& attributes, options_type& options) {
     if (!attributes.IsObject()) {
         throw config_error{"'attributes' member must be an object."};
     }
 
-    m_options.type      = get_attr_string(attributes, "type");
-    m_options.id        = get_attr_string(attributes, "id");
-    m_options.version   = get_attr_string(attributes, "version");
-    m_options.changeset = get_attr_string(attributes, "changeset");
-    m_options.timestamp = get_attr_string(attributes, "timestamp");
-    m_options.uid       = get_attr_string(attributes, "uid");
-    m_options.user      = get_attr_string(attributes, "user");
-    m_options.way_nodes = get_attr_string(attributes, "way_nodes");
+    options.type      = get_attr_string(attributes, "type");
+    options.id        = get_attr_string(attributes, "id");
+    options.version   = get_attr_string(attributes, "version");
+    options.changeset = get_attr_string(attributes, "changeset");
+    options.timestamp = get_attr_string(attributes, "timestamp");
+    options.uid       = get_attr_string(attributes, "uid");
+    options.user      = get_attr_string(attributes, "user");
+    options.way_nodes = get_attr_string(attributes, "way_nodes");
 }
 
 static Ruleset parse_tags_ruleset(const rapidjson::Value& object, const char* key) {
@@ -159,8 +187,8 @@ static bool parse_string_array(const rapidjson::Value& object, const char* key,
     return true;
 }
 
-void CommandExport::parse_config_file() {
-    std::ifstream config_file{m_config_file_name};
+void CommandExport::parse_config_file(export_config& config) {
+    std::ifstream config_file{config.config_file_name};
     rapidjson::IStreamWrapper stream_wrapper{config_file};
 
     rapidjson::Document doc;
@@ -178,41 +206,56 @@ void CommandExport::parse_config_file() {
 
     const auto json_attr = doc.FindMember("attributes");
     if (json_attr != doc.MemberEnd()) {
-        parse_options(json_attr->value);
+        parse_options(json_attr->value, config.options);
     }
 
-    m_linear_ruleset = parse_tags_ruleset(doc, "linear_tags");
-    m_area_ruleset   = parse_tags_ruleset(doc, "area_tags");
+    config.linear_ruleset = parse_tags_ruleset(doc, "linear_tags");
+    config.area_ruleset   = parse_tags_ruleset(doc, "area_tags");
 
-    if (m_linear_ruleset.rule_type() == tags_filter_rule_type::other &&
-        m_area_ruleset.rule_type() == tags_filter_rule_type::other) {
-        m_linear_ruleset.set_rule_type(tags_filter_rule_type::any);
-        m_area_ruleset.set_rule_type(tags_filter_rule_type::any);
+    if (config.linear_ruleset.rule_type() == tags_filter_rule_type::other &&
+        config.area_ruleset.rule_type() == tags_filter_rule_type::other) {
+        config.linear_ruleset.set_rule_type(tags_filter_rule_type::any);
+        config.area_ruleset.set_rule_type(tags_filter_rule_type::any);
     }
 
-    parse_string_array(doc, "include_tags", m_include_tags);
-    parse_string_array(doc, "exclude_tags", m_exclude_tags);
+    parse_string_array(doc, "include_tags", config.include_tags);
+    parse_string_array(doc, "exclude_tags", config.exclude_tags);
 }
 
-void CommandExport::canonicalize_output_format() {
-    for (auto& c : m_output_format) {
+static void canonicalize_output_format(std::string& output_format) {
+    for (auto& c : output_format) {
         c = static_cast<char>(std::tolower(c));
     }
 
-    if (m_output_format == "json") {
-        m_output_format = "geojson";
+    if (output_format == "json") {
+        output_format = "geojson";
         return;
     }
 
-    if (m_output_format == "jsonseq") {
-        m_output_format = "geojsonseq";
+    if (output_format == "jsonseq") {
+        output_format = "geojsonseq";
         return;
     }
 
-    if (m_output_format == "txt") {
-        m_output_format = "text";
+    if (output_format == "fgb") {
+        output_format = "flatgeobuf";
         return;
     }
+
+    if (output_format == "txt") {
+        output_format = "text";
+        return;
+    }
+}
+
+// Remove a ".gz" suffix from the file name or format. Returns true if
+// there was one.
+static bool strip_gzip_suffix(std::string& str) {
+    if (str.size() > 3 && str.compare(str.size() - 3, 3, ".gz") == 0) {
+        str.resize(str.size() - 3);
+        return true;
+    }
+    return false;
 }
 
 bool CommandExport::setup(const std::vector<std::string>& arguments) {
@@ -222,17 +265,22 @@ bool CommandExport::setup(const std::vector<std::string>& arguments) {
     po::options_description opts_cmd{"COMMAND OPTIONS"};
     opts_cmd.add_options()
     ("add-unique-id,u", po::value<std::string>(), "Add unique id to each feature ('counter' or 'type_id')")
-    ("config,c", po::value<std::string>(), "Config file")
+    ("area-pass", "Assemble areas in a separate pass to use less memory")
+    ("config,c", po::value<std::vector<std::string>>(), "Config file (can be given multiple times, one for each output file)")
+    ("directory,d", po::value<std::string>(), "Output directory for --split-zoom (default: current directory)")
     ("fsync", "Call fsync after writing file")
     ("geometry-types", po::value<std::string>(), "Geometry types that should be written (default: 'point,linestring,polygon')")
     ("index-type,i", po::value<std::string>()->default_value(default_index_type), "Index type to use")
+    ("index-file", po::value<std::string>(), "Use node location index in this file, build it there if it doesn't exist")
     ("keep-untagged,n", "Keep features that don't have any tags")
-    ("output,o", po::value<std::string>(), "Output file (default: STDOUT)")
+    ("output,o", po::value<std::vector<std::string>>(), "Output file (default: STDOUT), one for each config file")
     ("output-format,f", po::value<std::string>(), "Output format (default depends on output file suffix)")
     ("overwrite,O", "Allow existing output file to be overwritten")
     ("print-default-config,C", "Print default config on STDOUT")
     ("show-errors,e", "Output any geometry errors on STDOUT")
+    ("split-zoom", po::value<int>(), "Write one output file per tile on this zoom level")
     ("stop-on-error,E", "Stop on the first error encountered")
+    ("temp-dir", po::value<std::string>(), "Directory for temporary file used by --area-pass")
     ("show-index-types,I", "Show available index types")
     ("omit-rs,r", "Do not print RS (record separator) character when using JSON Text Sequences")
     ;
@@ -284,6 +332,7 @@ bool CommandExport::setup(const std::vector<std::string>& arguments) {
             std::cout << map_type << '\n';
         }
         std::cout << "none\n";
+        std::cout << "auto\n";
         return false;
     }
 
@@ -291,26 +340,90 @@ bool CommandExport::setup(const std::vector<std::string>& arguments) {
     setup_progress(vm);
     setup_input_file(vm);
 
+    std::vector<std::string> config_file_names;
     if (vm.count("config")) {
-        m_config_file_name = vm["config"].as<std::string>();
+        config_file_names = vm["config"].as<std::vector<std::string>>();
+    }
+
+    std::vector<std::string> output_filenames;
+    if (vm.count("output")) {
+        output_filenames = vm["output"].as<std::vector<std::string>>();
+    }
+
+    if (config_file_names.size() > 1 && output_filenames.size() != config_file_names.size()) {
+        throw argument_error{"When using several --config/-c options, there must be one --output/-o option for each of them."};
+    }
+
+    // With one config file (or without any) there can be several output
+    // files which all get the same features.
+    m_exports.resize(std::max(std::max(config_file_names.size(), output_filenames.size()), static_cast<std::size_t>(1)));
+
+    for (std::size_t i = 0; i < config_file_names.size(); ++i) {
+        auto& config = m_exports[i];
+        config.config_file_name = config_file_names[i];
 
         try {
-            parse_config_file();
+            parse_config_file(config);
         } catch (const config_error&) {
-            std::cerr << "Error while reading config file '" << m_config_file_name << "':\n";
+            std::cerr << "Error while reading config file '" << config.config_file_name << "':\n";
             throw;
         }
     }
 
+    if (config_file_names.size() <= 1) {
+        for (std::size_t i = 1; i < m_exports.size(); ++i) {
+            m_exports[i] = m_exports[0];
+            m_exports[i].same_as_previous = true;
+        }
+    }
+
+    for (std::size_t i = 0; i < m_exports.size(); ++i) {
+        auto& config = m_exports[i];
+
+        if (i < output_filenames.size()) {
+            config.output_filename = output_filenames[i];
+
+            std::string name{config.output_filename};
+            config.options.gzip = strip_gzip_suffix(name);
+            const auto pos = name.rfind('.');
+            if (pos != std::string::npos) {
+                config.output_format = name.substr(pos + 1);
+            }
+        } else {
+            config.output_filename = "-";
+        }
+
+        if (vm.count("output-format")) {
+            config.output_format = vm["output-format"].as<std::string>();
+            if (strip_gzip_suffix(config.output_format)) {
+                config.options.gzip = true;
+            }
+        }
+
+        canonicalize_output_format(config.output_format);
+
+        if (config.output_format != "geojson" && config.output_format != "geojsonseq" && config.output_format != "flatgeobuf" && config.output_format != "pg" && config.output_format != "pg-binary" && config.output_format != "text") {
+            throw argument_error{"Set output format with --output-format or -f to 'geojson', 'geojsonseq', 'flatgeobuf', 'pg', 'pg-binary', or 'text'."};
+        }
+
+        if (config.options.gzip && config.output_format != "geojson" && config.output_format != "geojsonseq" && config.output_format != "text") {
+            throw argument_error{"Only the 'geojson', 'geojsonseq', and 'text' formats can be written gzip compressed."};
+        }
+    }
+
     if (vm.count("add-unique-id")) {
         const std::string value = vm["add-unique-id"].as<std::string>();
+        unique_id_type unique_id = unique_id_type::none;
         if (value == "counter") {
-            m_options.unique_id = unique_id_type::counter;
+            unique_id = unique_id_type::counter;
         } else if (value == "type_id") {
-            m_options.unique_id = unique_id_type::type_id;
+            unique_id = unique_id_type::type_id;
         } else {
             throw argument_error{"Unknown --add-unique-id, -u setting. Use 'counter' or 'type_id'."};
         }
+        for (auto& config : m_exports) {
+            config.options.unique_id = unique_id;
+        }
     }
 
     if (vm.count("fsync")) {
@@ -338,36 +451,79 @@ bool CommandExport::setup(const std::vector<std::string>& arguments) {
         }
     }
 
+    // Polygons need the relations first, so the input is read twice.
+    if (m_geometry_types.polygon && is_stdin_or_pipe(m_input_filename)) {
+        throw argument_error{"Can not read from STDIN when exporting polygons. Use --geometry-types without 'polygon'."};
+    }
+
     if (vm.count("index-type")) {
+        m_index_type_set = !vm["index-type"].defaulted();
         m_index_type_name = vm["index-type"].as<std::string>();
-        if (m_index_type_name != "none" && !map_factory.has_map_type(m_index_type_name)) {
+        if (m_index_type_name == "auto") {
+            if (!vm.count("index-file") && has_locations_on_ways(m_input_file)) {
+                m_index_type_name = "none";
+                m_index_type_reason = "input file has node locations on ways";
+            } else {
+                const auto choice = choose_location_index({m_input_file});
+                m_index_type_name = choice.type;
+                m_index_type_reason = choice.reason;
+            }
+        }
+        // File based index types can have the file name after a comma.
+        if (m_index_type_name != "none" && !map_factory.has_map_type(m_index_type_name.substr(0, m_index_type_name.find(',')))) {
             throw argument_error{std::string{"Unknown index type '"} + m_index_type_name + "'. Use --show-index-types or -I to get a list."};
         }
     }
 
-    if (vm.count("keep-untagged")) {
-        m_options.keep_untagged = true;
+    if (vm.count("index-file")) {
+        m_index_file_name = vm["index-file"].as<std::string>();
+        if (m_index_type_name == "none") {
+            throw argument_error{"Can not use --index-file together with index type 'none'."};
+        }
+        if (m_index_type_name.find(',') != std::string::npos) {
+            throw argument_error{"Can not use --index-file together with an index type that has a file name."};
+        }
+        // Same index types as used by the --index-file option of the
+        // add-locations-to-ways command.
+        const std::string base_type{m_index_type_name.find("sparse") == std::string::npos ? "dense_file_array" : "sparse_file_array"};
+        if (!map_factory.has_map_type(base_type)) {
+            throw argument_error{std::string{"Index type '"} + base_type + "' needed for --index-file is not available on this system."};
+        }
+        // An existing index is only used if it was completed and built
+        // from the same input file. Otherwise it is built again under a
+        // temporary name and replaces the old one when it is done.
+        m_index_file_identity = index_file_identity(base_type, {m_input_file});
+        m_index_file_exists = is_complete_index_file(m_index_file_name, m_index_file_identity);
+        if (m_index_file_exists) {
+            m_index_type_name = base_type + "," + m_index_file_name;
+        } else {
+            if (std::ifstream{m_index_file_name}.is_open()) {
+                warning(std::string{"Node location index in file '"} + m_index_file_name + "' is incomplete or not built from this input file. Building it again.\n");
+            }
+            m_index_type_name = base_type + "," + partial_index_filename(m_index_file_name);
+        }
     }
 
-    if (vm.count("output")) {
-        m_output_filename = vm["output"].as<std::string>();
-
-        const auto pos = m_output_filename.rfind('.');
-        if (pos != std::string::npos) {
-            m_output_format = m_output_filename.substr(pos + 1);
+    if (vm.count("area-pass")) {
+        if (m_index_type_name == "none") {
+            warning("The --area-pass option doesn't do anything with index type 'none'. Ignored.\n");
+        } else if (!m_geometry_types.polygon) {
+            warning("The --area-pass option doesn't do anything without polygons. Ignored.\n");
+        } else {
+            m_area_pass = true;
         }
-    } else {
-        m_output_filename = "-";
     }
 
-    if (vm.count("output-format")) {
-        m_output_format = vm["output-format"].as<std::string>();
+    if (vm.count("temp-dir")) {
+        m_temp_directory = vm["temp-dir"].as<std::string>();
+    } else {
+        m_temp_directory = default_temp_directory();
     }
 
-    canonicalize_output_format();
-
-    if (m_output_format != "geojson" && m_output_format != "geojsonseq" && m_output_format != "pg" && m_output_format != "text") {
-        throw argument_error{"Set output format with --output-format or -f to 'geojson', 'geojsonseq', 'pg', or 'text'."};
+    if (vm.count("keep-untagged")) {
+        for (auto& config : m_exports) {
+            config.options.keep_untagged = true;
+        }
     }
 
     if (vm.count("overwrite")) {
@@ -375,8 +531,14 @@ bool CommandExport::setup(const std::vector<std::string>& arguments) {
     }
 
     if (vm.count("omit-rs")) {
-        m_options.print_record_separator = false;
-        if (m_output_format != "geojsonseq") {
+        bool has_geojsonseq = false;
+        for (auto& config : m_exports) {
+            config.options.print_record_separator = false;
+            if (config.output_format == "geojsonseq") {
+                has_geojsonseq = true;
+            }
+        }
+        if (!has_geojsonseq) {
             warning("The --omit-rs/-r option only works for GeoJSON Text Sequence (geojsonseq) format. Ignored.\n");
         }
     }
@@ -390,19 +552,61 @@ bool CommandExport::setup(const std::vector<std::string>& arguments) {
         m_stop_on_error = true;
     }
 
-    if (!m_include_tags.empty() && !m_exclude_tags.empty()) {
-        throw config_error{"Setting both 'include_tags' and 'exclude_tags' is not allowed."};
+    if (vm.count("split-zoom")) {
+        m_split_zoom = vm["split-zoom"].as<int>();
+        if (m_split_zoom < 0 || m_split_zoom > max_split_zoom) {
+            throw argument_error{"The --split-zoom option needs a zoom level between 0 and " + std::to_string(max_split_zoom) + "."};
+        }
+        if (vm.count("output")) {
+            throw argument_error{"Can not use --output/-o together with --split-zoom. Set the output directory with --directory/-d instead."};
+        }
+        if (vm.count("directory")) {
+            m_output_directory = vm["directory"].as<std::string>();
+        }
+    } else if (vm.count("directory")) {
+        throw argument_error{"The --directory/-d option can only be used with --split-zoom."};
     }
 
-    if (!m_include_tags.empty()) {
-        initialize_tags_filter(m_options.tags_filter, false, m_include_tags);
-    } else if (!m_exclude_tags.empty()) {
-        initialize_tags_filter(m_options.tags_filter, true, m_exclude_tags);
+    for (auto& config : m_exports) {
+        if (!config.include_tags.empty() && !config.exclude_tags.empty()) {
+            throw config_error{"Setting both 'include_tags' and 'exclude_tags' is not allowed."};
+        }
+
+        if (!config.include_tags.empty()) {
+            initialize_tags_filter(config.options.tags_filter, false, config.include_tags);
+        } else if (!config.exclude_tags.empty()) {
+            initialize_tags_filter(config.options.tags_filter, true, config.exclude_tags);
+        }
     }
 
     return true;
 }
 
+// Metadata is only decoded from the input if one of the exports has
+// an attribute for it configured.
+// Untagged nodes are only needed for their locations if they are not
+// exported. If no metadata is needed either, they are read from PBF
+// files without decoding them into objects.
+bool CommandExport::skip_untagged_nodes() const {
+    return !m_exports.front().options.keep_untagged &&
+           needed_metadata() == osmium::io::read_meta::no &&
+           m_input_file.format() == osmium::io::file_format::pbf &&
+           m_input_file.compression() == osmium::io::file_compression::none &&
+           !m_input_file.filename().empty() &&
+           m_input_file.filename() != "-";
+}
+
+osmium::io::read_meta CommandExport::needed_metadata() const {
+    const bool needed = std::any_of(m_exports.cbegin(), m_exports.cend(), [](const export_config& config) {
+        return !config.options.version.empty() ||
+               !config.options.changeset.empty() ||
+               !config.options.timestamp.empty() ||
+               !config.options.uid.empty() ||
+               !config.options.user.empty();
+    });
+    return needed ? osmium::io::read_meta::yes : osmium::io::read_meta::no;
+}
+
 static void print_taglist(osmium::VerboseOutput& vout, const std::vector<std::string>& strings) {
     for (const auto& str : strings) {
         vout << "    " << str << '\n';
@@ -443,43 +647,67 @@ static const char* print_unique_id_type(unique_id_type unique_id) {
 void CommandExport::show_arguments() {
     show_single_input_arguments(m_vout);
 
-    m_vout << "  output options:\n";
-    m_vout << "    file name: " << m_output_filename << '\n';
+    for (const auto& config : m_exports) {
+        if (m_exports.size() > 1) {
+            m_vout << "  config file: " << config.config_file_name << '\n';
+        }
 
-    if (m_output_format == "geojsonseq") {
-        m_vout << "    file format: geojsonseq (with" << (m_options.print_record_separator ? " RS)\n" : "out RS)\n");
-    } else {
-        m_vout << "    file format: " << m_output_format << '\n';
-    }
-    m_vout << "    overwrite: " << yes_no(m_output_overwrite == osmium::io::overwrite::allow);
-    m_vout << "    fsync: " << yes_no(m_fsync == osmium::io::fsync::yes);
-    m_vout << "  attributes:\n";
-    m_vout << "    type:      " << (m_options.type.empty()      ? "(omitted)" : m_options.type)      << '\n';
-    m_vout << "    id:        " << (m_options.id.empty()        ? "(omitted)" : m_options.id)        << '\n';
-    m_vout << "    version:   " << (m_options.version.empty()   ? "(omitted)" : m_options.version)   << '\n';
-    m_vout << "    changeset: " << (m_options.changeset.empty() ? "(omitted)" : m_options.changeset) << '\n';
-    m_vout << "    timestamp: " << (m_options.timestamp.empty() ? "(omitted)" : m_options.timestamp) << '\n';
-    m_vout << "    uid:       " << (m_options.uid.empty()       ? "(omitted)" : m_options.uid)       << '\n';
-    m_vout << "    user:      " << (m_options.user.empty()      ? "(omitted)" : m_options.user)      << '\n';
-    m_vout << "    way_nodes: " << (m_options.way_nodes.empty() ? "(omitted)" : m_options.way_nodes) << '\n';
-
-    m_vout << "  linear tags: ";
-    print_ruleset(m_vout, m_linear_ruleset);
-    m_vout << "  area tags:   ";
-    print_ruleset(m_vout, m_area_ruleset);
-
-    if (!m_include_tags.empty()) {
-        m_vout << "  include only these tags:\n";
-        print_taglist(m_vout, m_include_tags);
-    } else if (!m_exclude_tags.empty()) {
-        m_vout << "  exclude these tags:\n";
-        print_taglist(m_vout, m_exclude_tags);
+        m_vout << "  output options:\n";
+        if (m_split_zoom >= 0) {
+            m_vout << "    split on zoom level: " << m_split_zoom << '\n';
+            m_vout << "    directory: " << m_output_directory << '\n';
+        } else {
+            m_vout << "    file name: " << config.output_filename << '\n';
+        }
+
+        if (config.output_format == "geojsonseq") {
+            m_vout << "    file format: geojsonseq (with" << (config.options.print_record_separator ? " RS)\n" : "out RS)\n");
+        } else {
+            m_vout << "    file format: " << config.output_format << '\n';
+        }
+        m_vout << "    gzip compressed: " << yes_no(config.options.gzip);
+        m_vout << "    overwrite: " << yes_no(m_output_overwrite == osmium::io::overwrite::allow);
+        m_vout << "    fsync: " << yes_no(m_fsync == osmium::io::fsync::yes);
+        m_vout << "  attributes:\n";
+        m_vout << "    type:      " << (config.options.type.empty()      ? "(omitted)" : config.options.type)      << '\n';
+        m_vout << "    id:        " << (config.options.id.empty()        ? "(omitted)" : config.options.id)        << '\n';
+        m_vout << "    version:   " << (config.options.version.empty()   ? "(omitted)" : config.options.version)   << '\n';
+        m_vout << "    changeset: " << (config.options.changeset.empty() ? "(omitted)" : config.options.changeset) << '\n';
+        m_vout << "    timestamp: " << (config.options.timestamp.empty() ? "(omitted)" : config.options.timestamp) << '\n';
+        m_vout << "    uid:       " << (config.options.uid.empty()       ? "(omitted)" : config.options.uid)       << '\n';
+        m_vout << "    user:      " << (config.options.user.empty()      ? "(omitted)" : config.options.user)      << '\n';
+        m_vout << "    way_nodes: " << (config.options.way_nodes.empty() ? "(omitted)" : config.options.way_nodes) << '\n';
+
+        m_vout << "  linear tags: ";
+        print_ruleset(m_vout, config.linear_ruleset);
+        m_vout << "  area tags:   ";
+        print_ruleset(m_vout, config.area_ruleset);
+
+        if (!config.include_tags.empty()) {
+            m_vout << "  include only these tags:\n";
+            print_taglist(m_vout, config.include_tags);
+        } else if (!config.exclude_tags.empty()) {
+            m_vout << "  exclude these tags:\n";
+            print_taglist(m_vout, config.exclude_tags);
+        }
     }
 
     m_vout << "  other options:\n";
     m_vout << "    index type: " << m_index_type_name << '\n';
-    m_vout << "    add unique IDs: " << print_unique_id_type(m_options.unique_id) << '\n';
-    m_vout << "    keep untagged features: " << yes_no(m_options.keep_untagged);
+    if (!m_index_type_reason.empty()) {
+        m_vout << "      (chosen automatically: " << m_index_type_reason << ")\n";
+    }
+    if (!m_index_file_name.empty()) {
+        m_vout << "    index file: " << m_index_file_name << (m_index_file_exists ? " (existing)\n" : " (new)\n");
+    }
+    m_vout << "    add unique IDs: " << print_unique_id_type(m_exports.front().options.unique_id) << '\n';
+    m_vout << "    keep untagged features: " << yes_no(m_exports.front().options.keep_untagged);
+    m_vout << "    threads: " << m_threads << '\n';
+    m_vout << "    read metadata: " << yes_no(needed_metadata() == osmium::io::read_meta::yes);
+    m_vout << "    separate pass for areas: " << yes_no(m_area_pass);
+    if (m_area_pass) {
+        m_vout << "    directory for temporary files: " << m_temp_directory << '\n';
+    }
 }
 
 static std::unique_ptr<ExportFormat> create_handler(const std::string& output_format,
@@ -491,10 +719,18 @@ static std::unique_ptr<ExportFormat> create_handler(const std::string& output_fo
         return std::unique_ptr<ExportFormat>{new ExportFormatJSON{output_format, output_filename, overwrite, fsync, options}};
     }
 
+    if (output_format == "flatgeobuf") {
+        return std::unique_ptr<ExportFormat>{new ExportFormatFlatGeobuf{output_format, output_filename, overwrite, fsync, options}};
+    }
+
     if (output_format == "pg") {
         return std::unique_ptr<ExportFormat>{new ExportFormatPg{output_format, output_filename, overwrite, fsync, options}};
     }
 
+    if (output_format == "pg-binary") {
+        return std::unique_ptr<ExportFormat>{new ExportFormatPgBinary{output_format, output_filename, overwrite, fsync, options}};
+    }
+
     if (output_format == "text") {
         return std::unique_ptr<ExportFormat>{new ExportFormatText{output_format, output_filename, overwrite, fsync, options}};
     }
@@ -502,54 +738,505 @@ static std::unique_ptr<ExportFormat> create_handler(const std::string& output_fo
     throw argument_error{"Unknown output format"};
 }
 
-bool CommandExport::run() {
-    osmium::area::Assembler::config_type assembler_config;
-    osmium::area::MultipolygonManager<osmium::area::Assembler> mp_manager{assembler_config};
+// File name suffix for the output files with --split-zoom.
+static const char* file_suffix(const std::string& output_format) {
+    if (output_format == "flatgeobuf") {
+        return "fgb";
+    }
+    if (output_format == "pg-binary") {
+        return "pgcopy";
+    }
+    if (output_format == "text") {
+        return "txt";
+    }
+    return output_format.c_str();
+}
+
+namespace {
 
-    m_vout << "First pass (of two) through input file (reading relations)...\n";
-    osmium::relations::read_relations(m_input_file, mp_manager);
-    m_vout << "First pass done.\n";
+    /**
+     * Used instead of the location handler when the node locations are
+     * already in an index built by an earlier run. Only the locations of
+     * the way nodes are looked up, nodes with negative IDs (which are
+     * not in the file based index) are still stored.
+     */
+    template <typename TLocationHandler>
+    class LocationLookupHandler : public osmium::handler::Handler {
 
-    m_vout << "Second pass (of two) through input file...\n";
+        TLocationHandler& m_location_handler;
 
-    m_linear_ruleset.init_filter();
-    m_area_ruleset.init_filter();
+    public:
+
+        explicit LocationLookupHandler(TLocationHandler& location_handler) :
+            m_location_handler(location_handler) {
+        }
+
+        void node(const osmium::Node& node) {
+            if (node.id() < 0) {
+                m_location_handler.node(node);
+            }
+        }
+
+        void way(osmium::Way& way) {
+            m_location_handler.way(way);
+        }
+
+    }; // class LocationLookupHandler
+
+    /**
+     * Used instead of the location handler when the node locations are
+     * read separately from the objects (see PBFTaggedReader). They are
+     * stored in the indexes with add(), the nodes themselves are
+     * ignored. Like the location handler, this sorts the indexes before
+     * the first way if the IDs were not in order (for negative IDs).
+     */
+    template <typename TLocationHandler>
+    class NodeLocationsStore : public osmium::handler::Handler {
+
+        using index_type = osmium::index::map::Map<osmium::unsigned_object_id_type, osmium::Location>;
+
+        TLocationHandler& m_location_handler;
+        index_type& m_index_pos;
+        index_type& m_index_neg;
+        osmium::unsigned_object_id_type m_last_id = 0;
+
+        // False if the positive IDs are already in an existing index.
+        bool m_store_positive;
+
+        bool m_must_sort = false;
+
+    public:
+
+        NodeLocationsStore(TLocationHandler& location_handler, index_type& index_pos, index_type& index_neg, bool store_positive) :
+            m_location_handler(location_handler),
+            m_index_pos(index_pos),
+            m_index_neg(index_neg),
+            m_store_positive(store_positive) {
+        }
+
+        void add(const pbf_node_location& node) {
+            const auto positive_id = static_cast<osmium::unsigned_object_id_type>(node.id < 0 ? -node.id : node.id);
+            if (positive_id < m_last_id) {
+                m_must_sort = true;
+            }
+            m_last_id = positive_id;
+            if (node.id < 0) {
+                m_index_neg.set(positive_id, node.location);
+            } else if (m_store_positive) {
+                m_index_pos.set(positive_id, node.location);
+            }
+        }
 
-    auto handler = create_handler(m_output_format, m_output_filename, m_output_overwrite, m_fsync, m_options);
-    if (m_vout.verbose()) {
-        handler->debug_output(m_vout, m_output_filename);
+        void way(osmium::Way& way) {
+            if (m_must_sort) {
+                m_index_pos.sort();
+                m_index_neg.sort();
+                m_must_sort = false;
+            }
+            m_location_handler.way(way);
+        }
+
+    }; // class NodeLocationsStore
+
+    /**
+     * Used with PBFTaggedReader instead of NodeLocationsStore if the node
+     * locations are not needed.
+     */
+    class IgnoreNodeLocations : public osmium::handler::Handler {
+
+    public:
+
+        void add(const pbf_node_location& /*node*/) const noexcept {
+        }
+
+    }; // class IgnoreNodeLocations
+
+    /**
+     * Hands all objects to the export handlers for each of the output
+     * files, so they can all be written in the same pass.
+     */
+    class MultiExportHandler : public osmium::handler::Handler {
+
+        std::vector<std::unique_ptr<ExportHandler>>& m_handlers;
+
+    public:
+
+        explicit MultiExportHandler(std::vector<std::unique_ptr<ExportHandler>>& handlers) :
+            m_handlers(handlers) {
+        }
+
+        void node(const osmium::Node& node) {
+            for (auto& handler : m_handlers) {
+                handler->node(node);
+            }
+        }
+
+        void way(const osmium::Way& way) {
+            for (auto& handler : m_handlers) {
+                handler->way(way);
+            }
+        }
+
+        void area(const osmium::Area& area) {
+            for (auto& handler : m_handlers) {
+                handler->area(area);
+            }
+        }
+
+    }; // class MultiExportHandler
+
+    /**
+     * Used with --area-pass. Looks like a relations manager in the first
+     * pass to remember the IDs of all member ways of multipolygon and
+     * boundary relations. In the second pass it writes those ways and all
+     * closed ways (which might become areas on their own) with their node
+     * locations to a temporary file, from which the areas are assembled
+     * in the third pass.
+     */
+    class AreaWaysWriter : public osmium::handler::Handler {
+
+        osmium::index::IdSetDense<osmium::unsigned_object_id_type> m_member_ids;
+        std::unique_ptr<osmium::io::Writer> m_writer;
+        std::uint64_t m_count = 0;
+
+    public:
+
+        void relation(const osmium::Relation& relation) {
+            const char* type = relation.tags().get_value_by_key("type");
+            if (!type || (std::strcmp(type, "multipolygon") && std::strcmp(type, "boundary"))) {
+                return;
+            }
+            for (const auto& member : relation.members()) {
+                if (member.type() == osmium::item_type::way) {
+                    m_member_ids.set(member.positive_ref());
+                }
+            }
+        }
+
+        void prepare_for_lookup() const noexcept {
+        }
+
+        void open(const osmium::io::File& file) {
+            m_writer.reset(new osmium::io::Writer{file, osmium::io::overwrite::allow});
+        }
+
+        void way(const osmium::Way& way) {
+            if (way.is_closed() || m_member_ids.get(way.positive_id())) {
+                (*m_writer)(way);
+                ++m_count;
+            }
+        }
+
+        void close() {
+            m_writer->close();
+        }
+
+        std::uint64_t count() const noexcept {
+            return m_count;
+        }
+
+    }; // class AreaWaysWriter
+
+    /**
+     * Used instead of a multipolygon manager if no polygons are exported.
+     * No relations have to be read for it and its handler doesn't do
+     * anything, so no areas are assembled.
+     */
+    class NoAreasManager {
+
+    public:
+
+        template <typename TCallback>
+        osmium::handler::Handler handler(TCallback&& /*callback*/) const noexcept {
+            return osmium::handler::Handler{};
+        }
+
+    }; // class NoAreasManager
+
+} // anonymous namespace
+
+template <typename TManager>
+static void read_area_relations(const osmium::io::File& input_file, TManager& mp_manager, AreaWaysWriter& area_ways_writer, bool area_pass) {
+    if (area_pass) {
+        osmium::relations::read_relations(input_file, mp_manager, area_ways_writer);
+    } else {
+        osmium::relations::read_relations(input_file, mp_manager);
     }
+}
+
+static void read_area_relations(const osmium::io::File& /*input_file*/, NoAreasManager& /*mp_manager*/, AreaWaysWriter& /*area_ways_writer*/, bool /*area_pass*/) {
+}
+
+static void finish_areas(NoAreasManager& /*mp_manager*/) {
+}
 
-    ExportHandler export_handler{std::move(handler), m_linear_ruleset, m_area_ruleset, m_geometry_types, m_show_errors, m_stop_on_error};
+// Read a PBF file without decoding most untagged nodes into objects (see
+// PBFTaggedReader). The locations of all nodes are added to the store,
+// which is also the first handler, so it can look up the locations of
+// the way nodes before the other handlers see the ways. The order of the
+// nodes is checked here, because CheckOrder only sees the tagged nodes.
+template <typename TStore, typename... THandlers>
+static void read_tagged_input(const std::string& filename, bool display_progress, TStore& store, THandlers&&... handlers) {
+    PBFTaggedReader reader{filename, osmium::osm_entity_bits::nwr};
+    osmium::ProgressBar progress_bar{osmium::file_size(filename), display_progress};
+
+    osmium::memory::Buffer buffer;
+    std::vector<pbf_node_location> node_locations;
+    pbf_object_key last_key;
+    bool has_nodes = false;
+    bool has_other = false;
+    while (reader.read(buffer, node_locations)) {
+        progress_bar.update(reader.offset());
+        for (const auto& node : node_locations) {
+            if (has_other) {
+                throw osmium::out_of_order_error{"Found a node after a way or relation.", node.id};
+            }
+            pbf_object_key key;
+            key.type = osmium::item_type::node;
+            key.positive = node.id > 0;
+            key.id = static_cast<osmium::unsigned_object_id_type>(node.id < 0 ? -node.id : node.id);
+            if (has_nodes && !(last_key < key)) {
+                throw osmium::out_of_order_error{"Node IDs out of order or twice: " + std::to_string(node.id), node.id};
+            }
+            last_key = key;
+            has_nodes = true;
+            store.add(node);
+        }
+
+        const TraceSpan span{"export handlers"};
+        osmium::apply(buffer, store, handlers...);
+        has_other = has_other || std::any_of(buffer.cbegin<osmium::OSMObject>(), buffer.cend<osmium::OSMObject>(), [](const osmium::OSMObject& object) {
+            return object.type() != osmium::item_type::node;
+        });
+    }
+    progress_bar.done();
+}
+
+// The ParallelMultipolygonManager keeps areas back until all of them
+// are assembled, they have to be handed to the callback at the end.
+static void finish_areas(osmium::area::MultipolygonManager<osmium::area::Assembler>& /*mp_manager*/) {
+}
+
+static void finish_areas(ParallelMultipolygonManager& mp_manager) {
+    mp_manager.finish();
+}
+
+template <typename TManager>
+void CommandExport::export_data(TManager& mp_manager) {
+    // Without polygons the relations are not needed, so there is only
+    // one pass.
+    const bool areas = m_geometry_types.polygon;
+    const char* passes = m_area_pass ? "three" : "two";
+    AreaWaysWriter area_ways_writer;
+
+    std::unique_ptr<TraceSpan> pass_span;
+    if (areas) {
+        m_vout << "First pass (of " << passes << ") through input file (reading relations)...\n";
+        m_metrics.start_phase("pass 1 (relations)");
+        {
+            const TraceSpan span{"export pass 1 (relations)"};
+            read_area_relations(m_input_file, mp_manager, area_ways_writer, m_area_pass);
+        }
+        m_vout << "First pass done.\n";
+
+        m_vout << "Second pass (of " << passes << ") through input file...\n";
+        m_metrics.start_phase("pass 2");
+        pass_span.reset(new TraceSpan{"export pass 2"});
+    } else {
+        m_vout << "Only pass through input file (no polygons exported)...\n";
+        m_metrics.start_phase("pass 1");
+        pass_span.reset(new TraceSpan{"export pass 1"});
+    }
+
+    std::vector<std::unique_ptr<ExportHandler>> export_handlers;
+    std::vector<std::unique_ptr<ExportFormat>> formats;
+
+    // The outputs of all exports share the available file descriptors.
+    // Some are kept back for the input file, indexes, etc.
+    const std::size_t max_files = std::max(std::size_t{1}, std::min(max_split_files, max_open_files(32) / m_exports.size()));
+    for (std::size_t i = 0; i < m_exports.size(); ++i) {
+        auto& config = m_exports[i];
+        config.linear_ruleset.init_filter();
+        config.area_ruleset.init_filter();
+
+        std::unique_ptr<ExportFormat> handler;
+        if (m_split_zoom >= 0) {
+            const auto& output_format = config.output_format;
+            const auto& options = config.options;
+            handler.reset(new ExportFormatSplit{options, static_cast<uint32_t>(m_split_zoom), max_files, m_output_directory, std::string{file_suffix(output_format)} + (options.gzip ? ".gz" : ""),
+                                                [this, &output_format, &options](const std::string& filename) {
+                return create_handler(output_format, filename, m_output_overwrite, m_fsync, options);
+            }});
+        } else {
+            handler = create_handler(config.output_format, config.output_filename, m_output_overwrite, m_fsync, config.options);
+        }
+        if (m_vout.verbose()) {
+            handler->debug_output(m_vout, config.output_filename);
+        }
+
+        formats.push_back(std::move(handler));
+
+        // All outputs with the same config share one ExportHandler.
+        if (i + 1 == m_exports.size() || !m_exports[i + 1].same_as_previous) {
+            export_handlers.emplace_back(new ExportHandler{std::move(formats), config.linear_ruleset, config.area_ruleset, m_geometry_types, m_show_errors, m_stop_on_error, m_threads > 1 ? &thread_pool() : nullptr});
+            formats.clear();
+        }
+    }
+
+    MultiExportHandler export_handler{export_handlers};
     osmium::handler::CheckOrder check_order_handler;
 
+    auto areas_handler = mp_manager.handler([&export_handler](osmium::memory::Buffer&& buffer) {
+        const TraceSpan span{"export areas"};
+        osmium::apply(buffer, export_handler);
+    });
+
     if (m_index_type_name == "none") {
-        osmium::io::ReaderWithProgressBar reader{display_progress(), m_input_file};
-        osmium::apply(reader, check_order_handler, export_handler, mp_manager.handler([&export_handler](osmium::memory::Buffer&& buffer) {
-            osmium::apply(buffer, export_handler);
-        }));
+        if (skip_untagged_nodes()) {
+            IgnoreNodeLocations store;
+            read_tagged_input(m_input_file.filename(), display_progress(), store, check_order_handler, export_handler, areas_handler);
+        } else {
+            osmium::io::ReaderWithProgressBar reader{display_progress(), m_input_file, needed_metadata()};
+            osmium::apply(reader, check_order_handler, export_handler, areas_handler);
+            reader.close();
+        }
+        finish_areas(mp_manager);
+    } else if (m_area_pass) {
+        TempFiles temp_files{m_temp_directory, "osmium-export", ".osm.pbf"};
+        const osmium::io::File area_ways_file{temp_files.create(), "pbf,locations_on_ways=true"};
+        area_ways_writer.open(area_ways_file);
+
+        // The location index only lives until the end of the second pass,
+        // so it isn't in memory together with the ways for the areas.
+        {
+            const auto& map_factory = osmium::index::MapFactory<osmium::unsigned_object_id_type, osmium::Location>::instance();
+            if (!m_index_file_name.empty() && !m_index_file_exists) {
+                clear_index_file(m_index_file_name);
+            }
+            auto location_index_pos = map_factory.create_map(m_index_type_name);
+            auto location_index_neg = map_factory.create_map(m_index_type_name.find(',') == std::string::npos ? m_index_type_name : "flex_mem");
+            location_handler_type location_handler{*location_index_pos, *location_index_neg};
+            location_handler.ignore_errors();
+
+            if (m_index_file_exists) {
+                m_vout << "Using existing node location index in file '" << m_index_file_name << "'.\n";
+            }
+            if (skip_untagged_nodes()) {
+                NodeLocationsStore<location_handler_type> store{location_handler, *location_index_pos, *location_index_neg, !m_index_file_exists};
+                read_tagged_input(m_input_file.filename(), display_progress(), store, check_order_handler, export_handler, area_ways_writer);
+            } else {
+                osmium::io::ReaderWithProgressBar reader{display_progress(), m_input_filename, needed_metadata()};
+                if (m_index_file_exists) {
+                    LocationLookupHandler<location_handler_type> lookup_handler{location_handler};
+                    osmium::apply(reader, check_order_handler, lookup_handler, export_handler, area_ways_writer);
+                } else {
+                    osmium::apply(reader, check_order_handler, location_handler, export_handler, area_ways_writer);
+                }
+                reader.close();
+            }
+            area_ways_writer.close();
+            if (!m_index_file_name.empty() && !m_index_file_exists) {
+                location_index_pos->sort();
+                complete_index_file(m_index_file_name, m_index_file_identity);
+                m_vout << "Node location index kept in file '" << m_index_file_name << "'. Use it again with '--index-file " << m_index_file_name << "'.\n";
+            }
+            m_metrics.set_max("index_memory_bytes", location_index_pos->used_memory() + location_index_neg->used_memory());
+            m_vout << "About "
+                   << ((location_index_pos->used_memory() + location_index_neg->used_memory()) / (1024 * 1024))
+                   << " MBytes used for node location index (in main memory or on disk).\n";
+        }
+        m_vout << "Second pass done.\n";
+        pass_span.reset(new TraceSpan{"export pass 3 (areas)"});
+
+        m_vout << "Third pass (of three) through " << area_ways_writer.count() << " ways in temporary file (assembling areas)...\n";
+        m_metrics.start_phase("pass 3 (areas)");
+        osmium::io::Reader reader{area_ways_file};
+        osmium::apply(reader, areas_handler);
+        finish_areas(mp_manager);
         reader.close();
     } else {
         const auto& map_factory = osmium::index::MapFactory<osmium::unsigned_object_id_type, osmium::Location>::instance();
+        if (!m_index_file_name.empty() && !m_index_file_exists) {
+            clear_index_file(m_index_file_name);
+        }
         auto location_index_pos = map_factory.create_map(m_index_type_name);
-        auto location_index_neg = map_factory.create_map(m_index_type_name);
+        // A file based index can't be shared between positive and
+        // negative IDs. There are not many negative IDs anyway.
+        auto location_index_neg = map_factory.create_map(m_index_type_name.find(',') == std::string::npos ? m_index_type_name : "flex_mem");
         location_handler_type location_handler{*location_index_pos, *location_index_neg};
         location_handler.ignore_errors();
 
-        osmium::io::ReaderWithProgressBar reader{display_progress(), m_input_filename};
-        osmium::apply(reader, check_order_handler, location_handler, export_handler, mp_manager.handler([&export_handler](osmium::memory::Buffer&& buffer) {
-            osmium::apply(buffer, export_handler);
-        }));
-        reader.close();
+        if (m_index_file_exists) {
+            m_vout << "Using existing node location index in file '" << m_index_file_name << "'.\n";
+        }
+        if (skip_untagged_nodes()) {
+            NodeLocationsStore<location_handler_type> store{location_handler, *location_index_pos, *location_index_neg, !m_index_file_exists};
+            read_tagged_input(m_input_file.filename(), display_progress(), store, check_order_handler, export_handler, areas_handler);
+        } else {
+            osmium::io::ReaderWithProgressBar reader{display_progress(), m_input_filename, needed_metadata()};
+            if (m_index_file_exists) {
+                LocationLookupHandler<location_handler_type> lookup_handler{location_handler};
+                osmium::apply(reader, check_order_handler, lookup_handler, export_handler, areas_handler);
+            } else {
+                osmium::apply(reader, check_order_handler, location_handler, export_handler, areas_handler);
+            }
+            reader.close();
+        }
+        finish_areas(mp_manager);
+        if (!m_index_file_name.empty() && !m_index_file_exists) {
+            // Sparse indexes must be sorted before they can be used again.
+            location_index_pos->sort();
+            complete_index_file(m_index_file_name, m_index_file_identity);
+            m_vout << "Node location index kept in file '" << m_index_file_name << "'. Use it again with '--index-file " << m_index_file_name << "'.\n";
+        }
+        m_metrics.set_max("index_memory_bytes", location_index_pos->used_memory() + location_index_neg->used_memory());
         m_vout << "About "
                << ((location_index_pos->used_memory() + location_index_neg->used_memory()) / (1024 * 1024))
                << " MBytes used for node location index (in main memory or on disk).\n";
     }
-    m_vout << "Second pass done.\n";
-    export_handler.close();
+    pass_span.reset();
+    m_vout << (!areas ? "Pass done.\n" : m_area_pass ? "Third pass done.\n" : "Second pass done.\n");
+
+    m_metrics.start_phase("close");
+    std::size_t export_num = 0;
+    for (auto& handler : export_handlers) {
+        handler->close();
+        m_metrics.add("errors", handler->error_count());
+
+        for (std::size_t n = 0; n < handler->num_formats(); ++n) {
+            m_metrics.add("features", handler->count(n));
+            if (m_exports.size() > 1) {
+                m_vout << "Output file '" << m_exports[export_num].output_filename << "':\n";
+            }
+            ++export_num;
+            m_vout << "Wrote " << handler->count(n) << " features.\n";
+        }
+        m_vout << "Encountered " << handler->error_count() << " errors.\n";
+    }
+    m_metrics.end_phase();
+}
 
-    m_vout << "Wrote " << export_handler.count() << " features.\n";
-    m_vout << "Encountered " << export_handler.error_count() << " errors.\n";
+bool CommandExport::run() {
+    // If the input already has the node locations on the ways, no index
+    // is needed unless one was asked for.
+    if (!m_index_type_set && m_index_file_name.empty() && has_locations_on_ways(m_input_file)) {
+        m_vout << "Input file has node locations on ways. Not using a node location index.\n";
+        m_index_type_name = "none";
+        m_area_pass = false;
+    }
+
+    osmium::area::Assembler::config_type assembler_config;
+
+    if (!m_geometry_types.polygon) {
+        NoAreasManager mp_manager;
+        export_data(mp_manager);
+    } else if (m_threads > 1) {
+        ParallelMultipolygonManager mp_manager{assembler_config, thread_pool()};
+        export_data(mp_manager);
+    } else {
+        osmium::area::MultipolygonManager<osmium::area::Assembler> mp_manager{assembler_config};
+        export_data(mp_manager);
+    }
 
     show_memory_used();
 
@@ -557,4 +1244,3 @@ bool CommandExport::run() {
 
     return true;
 }
-
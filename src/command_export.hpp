@@ -29,6 +29,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include <osmium/handler/node_locations_for_ways.hpp>
 #include <osmium/index/map/all.hpp>
+#include <osmium/io/reader.hpp>
 #include <osmium/io/writer_options.hpp>
 
 #include <rapidjson/document.h>
@@ -41,30 +42,62 @@ class CommandExport : public Command, public with_single_osm_input {
     using index_type = osmium::index::map::Map<osmium::unsigned_object_id_type, osmium::Location>;
     using location_handler_type = osmium::handler::NodeLocationsForWays<index_type, index_type>;
 
-    options_type m_options{};
+    // Settings for one output file. There is one of these for each
+    // config file given on the command line (or one with the defaults
+    // if there is no config file). If there are several output files
+    // for one config file, there is a copy of the config for each of
+    // them. All of them are written in the same pass through the input
+    // file.
+    struct export_config {
+        options_type options{};
 
-    Ruleset m_linear_ruleset;
-    Ruleset m_area_ruleset;
+        Ruleset linear_ruleset;
+        Ruleset area_ruleset;
 
-    std::vector<std::string> m_include_tags;
-    std::vector<std::string> m_exclude_tags;
+        std::vector<std::string> include_tags;
+        std::vector<std::string> exclude_tags;
+
+        std::string config_file_name;
+        std::string output_filename;
+        std::string output_format;
+
+        // Same config as the previous one, the features are selected
+        // once for both.
+        bool same_as_previous = false;
+    };
+
+    std::vector<export_config> m_exports;
 
-    std::string m_config_file_name;
     std::string m_index_type_name;
-    std::string m_output_filename;
-    std::string m_output_format;
+    std::string m_index_type_reason;
+    std::string m_index_file_name;
+    std::string m_index_file_identity;
+    std::string m_output_directory{"."};
+    std::string m_temp_directory;
 
     geometry_types m_geometry_types;
 
     osmium::io::overwrite m_output_overwrite = osmium::io::overwrite::no;
     osmium::io::fsync m_fsync = osmium::io::fsync::no;
 
+    // Zoom level for splitting the output into tiles (-1 = no splitting).
+    int m_split_zoom = -1;
+
+    bool m_index_file_exists = false;
+    bool m_index_type_set = false;
+    bool m_area_pass = false;
     bool m_show_errors = false;
     bool m_stop_on_error = false;
 
-    void canonicalize_output_format();
-    void parse_options(const rapidjson::Value& attributes);
-    void parse_config_file();
+    static void parse_options(const rapidjson::Value& attributes, options_type& options);
+    static void parse_config_file(export_config& config);
+
+    osmium::io::read_meta needed_metadata() const;
+
+    bool skip_untagged_nodes() const;
+
+    template <typename TManager>
+    void export_data(TManager& mp_manager);
 
 public:
 
@@ -25,12 +25,14 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "extract/extract_bbox.hpp"
 #include "extract/extract_polygon.hpp"
+#include "extract/extract_tile.hpp"
 #include "extract/geojson_file_parser.hpp"
 #include "extract/osm_file_parser.hpp"
 #include "extract/poly_file_parser.hpp"
 #include "extract/strategy_complete_ways.hpp"
 #include "extract/strategy_complete_ways_with_history.hpp"
 #include "extract/strategy_simple.hpp"
+#include "extract/strategy_simple_with_history.hpp"
 #include "extract/strategy_smart.hpp"
 #include "util.hpp"
 
@@ -41,7 +43,9 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <osmium/io/writer_options.hpp>
 #include <osmium/osm.hpp>
 #include <osmium/osm/box.hpp>
+#include <osmium/thread/pool.hpp>
 #include <osmium/util/progress_bar.hpp>
+#include <osmium/util/file.hpp>
 #include <osmium/util/string.hpp>
 #include <osmium/util/verbose_output.hpp>
 
@@ -51,11 +55,19 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include <boost/program_options.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
 #include <cstdlib>
 #include <fstream>
+#include <future>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <map>
 #include <memory>
 #include <string>
+#include <utility>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <vector>
@@ -73,6 +85,37 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 namespace {
 
+    bool same_ring(const osmium::NodeRefList& a, const osmium::NodeRefList& b) noexcept {
+        return a.size() == b.size() &&
+               std::equal(a.cbegin(), a.cend(), b.cbegin(), [](const osmium::NodeRef& lhs, const osmium::NodeRef& rhs) {
+                   return lhs.location() == rhs.location();
+               });
+    }
+
+    /// Do the areas have the same rings in the same order?
+    bool same_geometry(const osmium::Area& a, const osmium::Area& b) {
+        const auto outer_rings_b = b.outer_rings();
+        auto outer_b = outer_rings_b.cbegin();
+        for (const auto& outer_a : a.outer_rings()) {
+            if (outer_b == outer_rings_b.cend() || !same_ring(outer_a, *outer_b)) {
+                return false;
+            }
+            const auto inner_rings_b = b.inner_rings(*outer_b);
+            auto inner_b = inner_rings_b.cbegin();
+            for (const auto& inner_a : a.inner_rings(outer_a)) {
+                if (inner_b == inner_rings_b.cend() || !same_ring(inner_a, *inner_b)) {
+                    return false;
+                }
+                ++inner_b;
+            }
+            if (inner_b != inner_rings_b.cend()) {
+                return false;
+            }
+            ++outer_b;
+        }
+        return outer_b == outer_rings_b.cend();
+    }
+
     osmium::Box parse_bbox(const rapidjson::Value& value) {
         if (value.IsArray()) {
             if (value.Size() != 4) {
@@ -250,6 +293,46 @@ namespace {
         throw config_error{"Multipolygon must be an object or array."};
     }
 
+    /**
+     * Close the output files of all extracts. Closing a file writes the
+     * rest of the data and, with --fsync, waits for the disk. With many
+     * extracts this is done by several threads, so the flushes overlap
+     * instead of running one after the other. The default thread pool
+     * can't be used here, because closing a Writer waits for jobs on
+     * that pool.
+     */
+    void close_extract_files(const std::vector<std::unique_ptr<Extract>>& extracts) {
+        constexpr const std::size_t max_threads = 16;
+        const auto num_threads = std::min(extracts.size(), max_threads);
+
+        if (num_threads <= 1) {
+            for (const auto& extract : extracts) {
+                extract->close_file();
+            }
+            return;
+        }
+
+        std::atomic<std::size_t> next{0};
+        std::vector<std::future<void>> futures;
+        futures.reserve(num_threads);
+        for (std::size_t n = 0; n < num_threads; ++n) {
+            futures.push_back(std::async(std::launch::async, [&extracts, &next]() {
+                for (std::size_t i = next++; i < extracts.size(); i = next++) {
+                    extracts[i]->close_file();
+                }
+            }));
+        }
+
+        // Wait for all threads before get() can throw, they are still
+        // using the extracts.
+        for (auto& future : futures) {
+            future.wait();
+        }
+        for (auto& future : futures) {
+            future.get();
+        }
+    }
+
 } // anonymous namespace
 
 static bool is_existing_directory(const char* name) {
@@ -314,7 +397,49 @@ void CommandExtract::parse_config_file() {
     }
 
     m_vout << "  Reading extracts from config file...\n";
+    std::map<std::string, std::size_t> extract_by_output;
     int extract_num = 1;
+
+    // Preparing a polygon extract (building its bands and grid) can take
+    // a while for detailed polygons. So polygon extracts are created on
+    // the thread pool after all polygons have been read into m_buffer.
+    // Until then their slot in m_extracts is empty.
+    struct polygon_extract {
+        std::size_t index;
+        osmium::io::File output_file;
+        std::string description;
+        std::size_t offset;
+        int extract_num;
+        std::string output;
+
+        // Errors are reported with the same context as those found while
+        // reading the config file, even though they only show up later.
+        std::unique_ptr<Extract> create(const osmium::memory::Buffer& buffer) const {
+            try {
+                return std::unique_ptr<Extract>{new ExtractPolygon{output_file, description, buffer, offset}};
+            } catch (const config_error& e) {
+                throw config_error{"In extract " + std::to_string(extract_num) + " (" + output + "): " + e.what()};
+            }
+        }
+    };
+    std::vector<polygon_extract> polygon_extracts;
+
+    // Outputs of extracts with the same geometry as an earlier extract.
+    struct extra_output {
+        std::size_t index;
+        osmium::io::File output_file;
+        std::vector<std::pair<std::string, std::string>> header_options;
+    };
+    std::vector<extra_output> extra_outputs;
+
+    // For each extract in m_extracts.
+    constexpr const std::size_t no_polygon = std::numeric_limits<std::size_t>::max();
+    std::vector<osmium::Box> envelopes;
+    std::vector<std::size_t> polygon_offsets;
+    std::vector<std::size_t> parents;
+    std::vector<std::string> outputs;
+    std::vector<std::vector<std::pair<std::string, std::string>>> header_options;
+
     for (const auto& e : json_extracts->value.GetArray()) {
         std::string output;
         try {
@@ -343,17 +468,60 @@ void CommandExtract::parse_config_file() {
                 throw config_error{"Looks like you are trying to write a history file, but option --with-history is not set."};
             }
 
+            std::string compression{get_value_as_string(e, "output_compression")};
+            int compression_level = -1;
+            const auto json_compression_level = e.FindMember("output_compression_level");
+            if (json_compression_level != e.MemberEnd()) {
+                if (!json_compression_level->value.IsInt() || json_compression_level->value.GetInt() < 0) {
+                    throw config_error{"Value of 'output_compression_level' field must be a number of at least 0."};
+                }
+                compression_level = json_compression_level->value.GetInt();
+            }
+            // The command line options are only used for PBF outputs,
+            // settings in the config file for all.
+            if (output_file.format() == osmium::io::file_format::pbf) {
+                if (compression.empty()) {
+                    compression = m_output_compression;
+                }
+                if (compression_level < 0) {
+                    compression_level = m_output_compression_level;
+                }
+            }
+            try {
+                set_pbf_compression(output_file, compression, compression_level);
+            } catch (const argument_error& error) {
+                throw config_error{error.what()};
+            }
+
+            osmium::Box envelope;
+            std::size_t offset = no_polygon;
             if (json_bbox != e.MemberEnd()) {
-                m_extracts.emplace_back(new ExtractBBox{output_file, description, parse_bbox(json_bbox->value)});
-            } else if (json_polygon != e.MemberEnd()) {
-                m_extracts.emplace_back(new ExtractPolygon{output_file, description, m_buffer, parse_polygon(m_config_directory, json_polygon->value, m_buffer)});
-            } else if (json_multipolygon != e.MemberEnd()) {
-                m_extracts.emplace_back(new ExtractPolygon{output_file, description, m_buffer, parse_multipolygon(m_config_directory, json_multipolygon->value, m_buffer)});
+                envelope = parse_bbox(json_bbox->value);
+            } else if (json_polygon != e.MemberEnd() || json_multipolygon != e.MemberEnd()) {
+                offset = json_polygon != e.MemberEnd()
+                       ? parse_polygon(m_config_directory, json_polygon->value, m_buffer)
+                       : parse_multipolygon(m_config_directory, json_multipolygon->value, m_buffer);
+                envelope = m_buffer.get<osmium::Area>(offset).envelope();
             } else {
                 throw config_error{"Missing geometry for extract. Need 'bbox', 'polygon', or 'multipolygon'."};
             }
 
-            Extract& extract = *m_extracts.back();
+            std::size_t parent_index = Extract::no_parent;
+            const std::string parent{get_value_as_string(e, "parent")};
+            if (!parent.empty()) {
+                const auto it = extract_by_output.find(parent);
+                if (it == extract_by_output.end()) {
+                    throw config_error{"Parent extract '" + parent + "' not found. It must be defined before its children."};
+                }
+                const auto& parent_envelope = envelopes[it->second];
+                if (!parent_envelope.contains(envelope.bottom_left()) ||
+                    !parent_envelope.contains(envelope.top_right())) {
+                    throw config_error{"Extract '" + output + "' is not completely inside its parent extract '" + parent + "'."};
+                }
+                parent_index = it->second;
+            }
+
+            std::vector<std::pair<std::string, std::string>> options;
             const auto json_output_header = e.FindMember("output_header");
             if (json_output_header != e.MemberEnd()) {
                 const auto& value = json_output_header->value;
@@ -365,12 +533,53 @@ void CommandExtract::parse_config_file() {
                     if (!member_value.IsString()) {
                         throw config_error{"Values in 'output_header' object must be strings."};
                     }
-                    extract.add_header_option(it->name.GetString(), member_value.GetString());
+                    options.emplace_back(it->name.GetString(), member_value.GetString());
+                }
+            }
+
+            // An extract with the same geometry (and parent) as an
+            // earlier one only becomes another output of that extract,
+            // so the strategy handles the geometry only once.
+            std::size_t same = 0;
+            for (; same < envelopes.size(); ++same) {
+                if (parents[same] == parent_index &&
+                    polygon_offsets[same] == no_polygon && offset == no_polygon &&
+                    envelopes[same] == envelope) {
+                    break;
+                }
+                if (parents[same] == parent_index &&
+                    polygon_offsets[same] != no_polygon && offset != no_polygon &&
+                    envelopes[same] == envelope &&
+                    same_geometry(m_buffer.get<osmium::Area>(polygon_offsets[same]), m_buffer.get<osmium::Area>(offset))) {
+                    break;
+                }
+            }
+            if (same < envelopes.size()) {
+                m_vout << "      Same geometry as an earlier extract, writing it together with '" << outputs[same] << "'.\n";
+                extra_outputs.push_back(extra_output{same, output_file, std::move(options)});
+                extract_by_output[output] = same;
+            } else {
+                if (offset == no_polygon) {
+                    m_extracts.emplace_back(new ExtractBBox{output_file, description, envelope});
+                } else {
+                    polygon_extracts.push_back(polygon_extract{m_extracts.size(), output_file, description, offset, extract_num, output});
+                    m_extracts.emplace_back();
                 }
+                envelopes.push_back(envelope);
+                polygon_offsets.push_back(offset);
+                parents.push_back(parent_index);
+                outputs.push_back(output);
+                header_options.push_back(std::move(options));
+                extract_by_output[output] = m_extracts.size() - 1;
             }
         } catch (const config_error& e) {
             std::string message{"In extract "};
             message += std::to_string(extract_num);
+            if (!output.empty()) {
+                message += " (";
+                message += output;
+                message += ')';
+            }
             message += ": ";
             message += e.what();
             throw config_error{message};
@@ -393,13 +602,51 @@ void CommandExtract::parse_config_file() {
 
         ++extract_num;
     }
+
+    if (m_threads > 1 && polygon_extracts.size() > 1) {
+        m_vout << "  Preparing " << polygon_extracts.size() << " polygons using " << m_threads << " threads...\n";
+        auto& pool = thread_pool();
+        const osmium::memory::Buffer* buffer = &m_buffer;
+        std::vector<std::future<std::unique_ptr<Extract>>> futures;
+        futures.reserve(polygon_extracts.size());
+        for (const auto& pe : polygon_extracts) {
+            futures.push_back(pool.submit([pe, buffer]() {
+                return pe.create(*buffer);
+            }));
+        }
+        // Wait for all tasks before get() can throw, they are still
+        // using the buffer.
+        for (auto& future : futures) {
+            future.wait();
+        }
+        for (std::size_t i = 0; i < futures.size(); ++i) {
+            m_extracts[polygon_extracts[i].index] = futures[i].get();
+        }
+    } else {
+        for (const auto& pe : polygon_extracts) {
+            m_extracts[pe.index] = pe.create(m_buffer);
+        }
+    }
+
+    for (std::size_t i = 0; i < m_extracts.size(); ++i) {
+        if (parents[i] != Extract::no_parent) {
+            m_extracts[i]->set_parent(parents[i]);
+        }
+        for (const auto& option : header_options[i]) {
+            m_extracts[i]->add_header_option(option.first, option.second);
+        }
+    }
+    for (const auto& eo : extra_outputs) {
+        m_extracts[eo.index]->add_output(eo.output_file, eo.header_options);
+    }
+
     m_vout << '\n';
 }
 
 std::unique_ptr<ExtractStrategy> CommandExtract::make_strategy(const std::string& name) {
     if (name == "simple") {
         if (m_with_history) {
-            throw argument_error{"The 'simple' strategy is not supported for history files."};
+            return std::unique_ptr<ExtractStrategy>(new strategy_simple_with_history::Strategy{m_extracts, m_options});
         }
         return std::unique_ptr<ExtractStrategy>(new strategy_simple::Strategy{m_extracts, m_options});
     }
@@ -421,6 +668,36 @@ std::unique_ptr<ExtractStrategy> CommandExtract::make_strategy(const std::string
     throw argument_error{std::string{"Unknown extract strategy: '"} + name + "'."};
 }
 
+std::size_t CommandExtract::tiles_per_pass() const {
+    // Keep some file descriptors for the input file, indexes, etc.
+    const std::size_t limit = max_tiles_per_pass;
+    return std::min(limit, max_open_files(32));
+}
+
+void CommandExtract::setup_tiles(unsigned int zoom, const osmium::Box& box) {
+    if (zoom > tile_id::max_zoom) {
+        throw argument_error{"Zoom level for --tiles must be between 0 and " + std::to_string(tile_id::max_zoom) + "."};
+    }
+
+    const auto num_tiles = num_tiles_in_box(zoom, box);
+    if (num_tiles > max_tiles) {
+        throw argument_error{"Too many tiles (" + std::to_string(num_tiles) + ", maximum is " + std::to_string(max_tiles) +
+                             "). Use --bbox/-b to restrict the area or a lower zoom level."};
+    }
+
+    if (num_tiles > tiles_per_pass() && is_stdin_or_pipe(m_input_filename)) {
+        throw argument_error{"Too many tiles (" + std::to_string(num_tiles) + ") to write in one pass, which is needed when reading from STDIN."};
+    }
+
+    m_tile_zoom = static_cast<int>(zoom);
+    const std::string suffix{m_output_format.empty() ? "osm.pbf" : m_output_format};
+    for (const auto& tile : tiles_in_box(zoom, box)) {
+        const std::string name{std::to_string(tile.zoom) + '-' + std::to_string(tile.x) + '-' + std::to_string(tile.y)};
+        const osmium::io::File output_file{m_output_directory + name + '.' + suffix, m_output_format};
+        m_extracts.emplace_back(new ExtractTile{output_file, name, tile});
+    }
+}
+
 bool CommandExtract::setup(const std::vector<std::string>& arguments) {
     po::options_description opts_cmd{"COMMAND OPTIONS"};
     opts_cmd.add_options()
@@ -430,6 +707,7 @@ bool CommandExtract::setup(const std::vector<std::string>& arguments) {
     ("option,S", po::value<std::vector<std::string>>(), "Set strategy option")
     ("polygon,p", po::value<std::string>(), "Polygon file")
     ("strategy,s", po::value<std::string>()->default_value("complete_ways"), "Use named extract strategy")
+    ("tiles", po::value<unsigned int>(), "Write one extract for each tile at this zoom level")
     ("with-history,H", "Input file and output files are history files")
     ("set-bounds", "Sets bounds (bounding box) in header")
     ;
@@ -461,7 +739,31 @@ bool CommandExtract::setup(const std::vector<std::string>& arguments) {
     setup_input_file(vm);
     init_output_file(vm);
 
-    if (vm.count("config") + vm.count("bbox") + vm.count("polygon") > 1) {
+    if ((vm.count("tiles") || vm.count("config")) && m_block_stats) {
+        throw argument_error{"Can not use --block-stats together with --tiles or --config/-c."};
+    }
+
+    // The result cache only keeps the file set with --output/-o.
+    if ((vm.count("tiles") || vm.count("config")) && !cache_directory().empty()) {
+        throw argument_error{"Can not use --cache-dir together with --tiles or --config/-c."};
+    }
+
+    if (vm.count("tiles")) {
+        if (vm.count("config") || vm.count("polygon")) {
+            throw argument_error{"Can not use --tiles together with --config/-c or --polygon/-p."};
+        }
+        if (vm.count("output")) {
+            warning("Ignoring --output/-o option.\n");
+        }
+        if (vm.count("directory")) {
+            set_directory(vm["directory"].as<std::string>());
+        }
+        osmium::Box box{-180.0, -90.0, 180.0, 90.0};
+        if (vm.count("bbox")) {
+            box = parse_bbox(vm["bbox"].as<std::string>(), "--bbox/-b");
+        }
+        setup_tiles(vm["tiles"].as<unsigned int>(), box);
+    } else if (vm.count("config") + vm.count("bbox") + vm.count("polygon") > 1) {
         throw argument_error{"Can only use one of --config/-c, --bbox/-b, or --polygon/-p."};
     }
 
@@ -487,7 +789,7 @@ bool CommandExtract::setup(const std::vector<std::string>& arguments) {
         }
     }
 
-    if (vm.count("bbox")) {
+    if (vm.count("bbox") && !vm.count("tiles")) {
         if (vm.count("directory")) {
             warning("Ignoring --directory/-d option.\n");
         }
@@ -531,6 +833,10 @@ void CommandExtract::show_arguments() {
     m_vout << "  other options:\n";
     m_vout << "    config file: " << m_config_file_name << '\n';
     m_vout << "    output directory: " << m_output_directory << '\n';
+    if (m_tile_zoom >= 0) {
+        m_vout << "    tiles: zoom level " << m_tile_zoom << '\n';
+    }
+    m_vout << "    threads: " << m_threads << '\n';
 
     m_vout << '\n';
 }
@@ -558,6 +864,12 @@ void CommandExtract::show_extracts() {
                 m_vout << opt.first << ": " << opt.second << '\n';
             }
         }
+        for (std::size_t i = 1; i < e->num_outputs(); ++i) {
+            m_vout << "     Also output: " << e->output(i) << " (" << e->output_format(i) << ")\n";
+        }
+        if (e->parent() != Extract::no_parent) {
+            m_vout << "     Parent:      " << m_extracts[e->parent()]->output() << '\n';
+        }
         m_vout << "     Envelope:    " << e->envelope_as_text() << '\n';
         m_vout << "     Type:        " << e->geometry_type()    << '\n';
         m_vout << "     Geometry:    " << e->geometry_as_text() << '\n';
@@ -567,6 +879,32 @@ void CommandExtract::show_extracts() {
     m_vout << '\n';
 }
 
+void CommandExtract::run_extracts(const osmium::io::Header& header) {
+    m_strategy = make_strategy(m_strategy_name);
+    m_strategy->set_num_threads(m_threads);
+    m_strategy->set_locations_on_ways(has_locations_on_ways(m_input_file));
+    if (m_metrics.enabled()) {
+        m_strategy->set_metrics(&m_metrics);
+    }
+    m_strategy->show_arguments(m_vout);
+
+    for (const auto& extract : m_extracts) {
+        osmium::io::Header file_header{header};
+        if (m_with_history) {
+            file_header.set_has_multiple_object_versions(true);
+        }
+        if (m_set_bounds) {
+            file_header.add_box(extract->envelope());
+        }
+        extract->open_file(file_header, m_output_overwrite, m_fsync);
+    }
+
+    m_strategy->run(m_vout, display_progress(), m_input_file);
+
+    m_vout << "Closing output files...\n";
+    close_extract_files(m_extracts);
+}
+
 bool CommandExtract::run() {
     if (!m_config_file_name.empty()) {
         m_vout << "Reading config file...\n";
@@ -584,30 +922,34 @@ bool CommandExtract::run() {
 
     show_extracts();
 
-    m_strategy = make_strategy(m_strategy_name);
-    m_strategy->show_arguments(m_vout);
-
     osmium::io::Header header;
     setup_header(header);
 
-    for (const auto& extract : m_extracts) {
-        osmium::io::Header file_header{header};
-        if (m_with_history) {
-            file_header.set_has_multiple_object_versions(true);
+    const auto batch_size = tiles_per_pass();
+    if (m_tile_zoom >= 0 && m_extracts.size() > batch_size) {
+        // Tiles are independent of each other, so they can be written
+        // in batches, each needing a pass over the input file.
+        std::vector<std::unique_ptr<Extract>> tiles;
+        tiles.swap(m_extracts);
+        for (std::size_t begin = 0; begin < tiles.size(); begin += batch_size) {
+            const auto end = std::min(tiles.size(), begin + batch_size);
+            m_vout << "Writing tiles " << (begin + 1) << " to " << end << " of " << tiles.size() << "...\n";
+            m_extracts.assign(std::make_move_iterator(tiles.begin() + begin),
+                              std::make_move_iterator(tiles.begin() + end));
+            run_extracts(header);
+            std::move(m_extracts.begin(), m_extracts.end(), tiles.begin() + begin);
         }
-        if (m_set_bounds) {
-            file_header.add_box(extract->envelope());
-        }
-        for (const auto& p : extract->header_options()) {
-            file_header.set(p.first, p.second);
-        }
-        extract->open_file(file_header, m_output_overwrite, m_fsync);
+        m_extracts.swap(tiles);
+    } else {
+        run_extracts(header);
     }
 
-    m_strategy->run(m_vout, display_progress(), m_input_file);
-
     for (const auto& extract : m_extracts) {
-        extract->close_file();
+        for (std::size_t n = 0; n < extract->num_outputs(); ++n) {
+            if (m_metrics.enabled() && extract->output(n) != "-") {
+                m_metrics.add("bytes_written", osmium::file_size(extract->output(n)));
+            }
+        }
     }
 
     show_memory_used();
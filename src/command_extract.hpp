@@ -28,6 +28,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include "extract/strategy.hpp"
 
 #include <osmium/memory/buffer.hpp>
+#include <osmium/osm/box.hpp>
 #include <osmium/util/options.hpp>
 
 #include <cstddef>
@@ -39,6 +40,13 @@ class CommandExtract : public Command, public with_single_osm_input, public with
 
     static const std::size_t initial_buffer_size = 10 * 1024;
 
+    // Maximum number of tiles written with the --tiles option.
+    static const std::size_t max_tiles = 100000;
+
+    // Maximum number of tiles written in one pass over the input file.
+    // Each needs a file descriptor and an output buffer.
+    static const std::size_t max_tiles_per_pass = 1000;
+
     std::vector<std::unique_ptr<Extract>> m_extracts;
     osmium::Options m_options;
     std::string m_config_file_name;
@@ -49,8 +57,12 @@ class CommandExtract : public Command, public with_single_osm_input, public with
     std::unique_ptr<ExtractStrategy> m_strategy;
     bool m_with_history = false;
     bool m_set_bounds = false;
+    int m_tile_zoom = -1;
 
     void parse_config_file();
+    void setup_tiles(unsigned int zoom, const osmium::Box& box);
+    std::size_t tiles_per_pass() const;
+    void run_extracts(const osmium::io::Header& header);
     void show_extracts();
 
     void set_directory(const std::string& directory);
@@ -76,7 +88,8 @@ public:
     const char* synopsis() const noexcept override final {
         return "osmium extract --config CONFIG-FILE [OPTIONS] OSM-FILE\n"
                "       osmium extract --bbox LEFT,BOTTOM,RIGHT,TOP [OPTIONS] OSM-FILE\n"
-               "       osmium extract --polygon POLYGON-FILE [OPTIONS] OSM-FILE";
+               "       osmium extract --polygon POLYGON-FILE [OPTIONS] OSM-FILE\n"
+               "       osmium extract --tiles ZOOM [--bbox LEFT,BOTTOM,RIGHT,TOP] [OPTIONS] OSM-FILE";
     }
 
 }; // class CommandExtract
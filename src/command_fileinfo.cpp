@@ -22,18 +22,21 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "command_fileinfo.hpp"
 #include "exception.hpp"
+#include "pbf_blocks.hpp"
 #include "util.hpp"
 
 #include <osmium/handler.hpp>
 #include <osmium/io/file.hpp>
+#include <osmium/io/file_format.hpp>
 #include <osmium/io/header.hpp>
 #include <osmium/io/reader.hpp>
 #include <osmium/osm.hpp>
 #include <osmium/osm/box.hpp>
 #include <osmium/osm/crc.hpp>
-#include <osmium/osm/crc_zlib.hpp>
+#include <osmium/osm/entity_bits.hpp>
 #include <osmium/osm/metadata_options.hpp>
 #include <osmium/osm/object_comparisons.hpp>
+#include <osmium/thread/pool.hpp>
 #include <osmium/util/file.hpp>
 #include <osmium/util/minmax.hpp>
 #include <osmium/util/progress_bar.hpp>
@@ -45,13 +48,19 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include <boost/program_options.hpp>
 
+#include <zlib.h>
+
 #include <algorithm>
 #include <cmath>
+#include <cstddef>
 #include <cstdint>
+#include <deque>
+#include <future>
 #include <iostream>
 #include <iterator>
 #include <memory>
 #include <sstream>
+#include <stdexcept>
 #include <string>
 #include <utility>
 #include <vector>
@@ -62,6 +71,51 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 /*************************************************************************/
 
+/**
+ * Works like osmium::CRC_zlib, but also keeps track of the number of bytes
+ * processed, so that the CRCs of consecutive parts of the data can be
+ * combined into the CRC of the whole data.
+ */
+class CRC_zlib_combinable {
+
+    unsigned long m_crc32 = ::crc32(0, nullptr, 0);
+    uint64_t m_length = 0;
+
+public:
+
+    void process_byte(const unsigned char byte) noexcept {
+        m_crc32 = ::crc32(m_crc32, &byte, 1);
+        ++m_length;
+    }
+
+    void process_bytes(const void* buffer, std::size_t byte_count) noexcept {
+        m_crc32 = ::crc32(m_crc32, reinterpret_cast<const unsigned char*>(buffer), static_cast<unsigned int>(byte_count)); // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
+        m_length += byte_count;
+    }
+
+    unsigned long checksum() const noexcept {
+        return m_crc32;
+    }
+
+    // Append the CRC of the data following the data of this CRC.
+    void combine(const CRC_zlib_combinable& other) noexcept {
+        m_crc32 = ::crc32_combine(m_crc32, other.m_crc32, static_cast<z_off_t>(other.m_length));
+        m_length += other.m_length;
+    }
+
+}; // class CRC_zlib_combinable
+
+// The parts of the statistics calculated by the InfoHandler. If only one
+// variable is requested with --get, everything else is skipped.
+enum info_fields : unsigned int {
+    field_bounds     = 0x01,
+    field_counts     = 0x02, // object counts and smallest/largest IDs
+    field_timestamps = 0x04,
+    field_metadata   = 0x08,
+    field_order      = 0x10, // objects_ordered and multiple_versions
+    field_all        = 0xff
+};
+
 struct InfoHandler : public osmium::handler::Handler {
 
     osmium::Box bounds;
@@ -91,93 +145,268 @@ struct InfoHandler : public osmium::handler::Handler {
     osmium::min_op<osmium::Timestamp> first_timestamp;
     osmium::max_op<osmium::Timestamp> last_timestamp;
 
-    osmium::CRC<osmium::CRC_zlib> crc32;
+    osmium::CRC<CRC_zlib_combinable> crc32;
 
     bool ordered = true;
     bool multiple_versions = false;
     bool calculate_crc = false;
 
+    unsigned int fields = field_all;
+
+    osmium::item_type first_type = osmium::item_type::undefined;
+    osmium::object_id_type first_id = 0;
+
     osmium::item_type last_type = osmium::item_type::undefined;
     osmium::object_id_type last_id = 0;
 
-    explicit InfoHandler(bool with_crc) :
-        calculate_crc(with_crc) {
+    explicit InfoHandler(bool with_crc, unsigned int info_fields = field_all) :
+        calculate_crc(with_crc),
+        fields(info_fields) {
     }
 
-    void changeset(const osmium::Changeset& changeset) {
-        if (last_type == osmium::item_type::changeset) {
-            if (last_id > changeset.id()) {
+    void check_order(osmium::item_type type, osmium::object_id_type id) noexcept {
+        if (last_type == osmium::item_type::undefined) {
+            first_type = type;
+            first_id = id;
+        }
+
+        if (type == osmium::item_type::changeset) {
+            if (last_type == osmium::item_type::changeset && last_id > id) {
                 ordered = false;
             }
-        } else {
-            last_type = osmium::item_type::changeset;
+        } else if (last_type == type) {
+            if (last_id == id) {
+                multiple_versions = true;
+            }
+            if (osmium::id_order{}(id, last_id)) {
+                ordered = false;
+            }
+        } else if (last_type != osmium::item_type::changeset && last_type > type) {
+            ordered = false;
         }
 
-        last_id = changeset.id();
+        last_type = type;
+        last_id = id;
+    }
+
+    // Add the results from a handler which has seen the data following the
+    // data seen by this handler.
+    void merge(const InfoHandler& other) {
+        bounds.extend(other.bounds);
+
+        changesets += other.changesets;
+        nodes      += other.nodes;
+        ways       += other.ways;
+        relations  += other.relations;
+
+        buffers_count    += other.buffers_count;
+        buffers_size     += other.buffers_size;
+        buffers_capacity += other.buffers_capacity;
+
+        smallest_changeset_id.update(other.smallest_changeset_id());
+        smallest_node_id.update(other.smallest_node_id());
+        smallest_way_id.update(other.smallest_way_id());
+        smallest_relation_id.update(other.smallest_relation_id());
+
+        largest_changeset_id.update(other.largest_changeset_id());
+        largest_node_id.update(other.largest_node_id());
+        largest_way_id.update(other.largest_way_id());
+        largest_relation_id.update(other.largest_relation_id());
+
+        metadata_all_objects &= other.metadata_all_objects;
+        metadata_some_objects |= other.metadata_some_objects;
+
+        first_timestamp.update(other.first_timestamp());
+        last_timestamp.update(other.last_timestamp());
+
         if (calculate_crc) {
-            crc32.update(changeset);
+            crc32().combine(other.crc32());
         }
-        ++changesets;
 
-        smallest_changeset_id.update(changeset.id());
-        largest_changeset_id.update(changeset.id());
+        ordered = ordered && other.ordered;
+        multiple_versions = multiple_versions || other.multiple_versions;
+        if ((fields & field_order) && other.last_type != osmium::item_type::undefined) {
+            check_order(other.first_type, other.first_id);
+            last_type = other.last_type;
+            last_id = other.last_id;
+        }
     }
 
-    void osm_object(const osmium::OSMObject& object) {
-        first_timestamp.update(object.timestamp());
-        last_timestamp.update(object.timestamp());
+    void changeset(const osmium::Changeset& changeset) {
+        if (fields & field_order) {
+            check_order(osmium::item_type::changeset, changeset.id());
+        }
+        if (calculate_crc) {
+            crc32.update(changeset);
+        }
+        if (fields & field_counts) {
+            ++changesets;
+            smallest_changeset_id.update(changeset.id());
+            largest_changeset_id.update(changeset.id());
+        }
+    }
 
-        metadata_all_objects &= osmium::detect_available_metadata(object);
-        metadata_some_objects |= osmium::detect_available_metadata(object);
+    void osm_object(const osmium::OSMObject& object) {
+        if (fields & field_timestamps) {
+            first_timestamp.update(object.timestamp());
+            last_timestamp.update(object.timestamp());
+        }
 
-        if (last_type == object.type()) {
-            if (last_id == object.id()) {
-                multiple_versions = true;
-            }
-            if (osmium::id_order{}(object.id(), last_id)) {
-                ordered = false;
-            }
-        } else if (last_type != osmium::item_type::changeset && last_type > object.type()) {
-            ordered = false;
+        if (fields & field_metadata) {
+            const auto metadata = osmium::detect_available_metadata(object);
+            metadata_all_objects &= metadata;
+            metadata_some_objects |= metadata;
         }
 
-        last_type = object.type();
-        last_id = object.id();
+        if (fields & field_order) {
+            check_order(object.type(), object.id());
+        }
     }
 
     void node(const osmium::Node& node) {
         if (calculate_crc) {
             crc32.update(node);
         }
-        bounds.extend(node.location());
-        ++nodes;
-
-        smallest_node_id.update(node.id());
-        largest_node_id.update(node.id());
+        if (fields & field_bounds) {
+            bounds.extend(node.location());
+        }
+        if (fields & field_counts) {
+            ++nodes;
+            smallest_node_id.update(node.id());
+            largest_node_id.update(node.id());
+        }
     }
 
     void way(const osmium::Way& way) {
         if (calculate_crc) {
             crc32.update(way);
         }
-        ++ways;
-
-        smallest_way_id.update(way.id());
-        largest_way_id.update(way.id());
+        if (fields & field_counts) {
+            ++ways;
+            smallest_way_id.update(way.id());
+            largest_way_id.update(way.id());
+        }
     }
 
     void relation(const osmium::Relation& relation) {
         if (calculate_crc) {
             crc32.update(relation);
         }
-        ++relations;
-
-        smallest_relation_id.update(relation.id());
-        largest_relation_id.update(relation.id());
+        if (fields & field_counts) {
+            ++relations;
+            smallest_relation_id.update(relation.id());
+            largest_relation_id.update(relation.id());
+        }
     }
 
 }; // struct InfoHandler
 
+// Create the statistics for one block from the statistics stored in
+// its BlobHeader.
+static InfoHandler from_block_stats(const pbf_block_stats& stats) {
+    InfoHandler handler{false};
+
+    handler.bounds = stats.bounds;
+
+    handler.nodes     = stats.nodes;
+    handler.ways      = stats.ways;
+    handler.relations = stats.relations;
+
+    ++handler.buffers_count;
+
+    if (stats.nodes > 0) {
+        handler.smallest_node_id.update(stats.min_node_id);
+        handler.largest_node_id.update(stats.max_node_id);
+    }
+    if (stats.ways > 0) {
+        handler.smallest_way_id.update(stats.min_way_id);
+        handler.largest_way_id.update(stats.max_way_id);
+    }
+    if (stats.relations > 0) {
+        handler.smallest_relation_id.update(stats.min_relation_id);
+        handler.largest_relation_id.update(stats.max_relation_id);
+    }
+
+    if (stats.first_type != osmium::item_type::undefined) {
+        handler.first_timestamp.update(stats.first_timestamp);
+        handler.last_timestamp.update(stats.last_timestamp);
+
+        handler.metadata_all_objects = stats.metadata_all_objects;
+        handler.metadata_some_objects = stats.metadata_some_objects;
+
+        handler.ordered = stats.ordered;
+        handler.multiple_versions = stats.multiple_versions;
+
+        handler.first_type = stats.first_type;
+        handler.first_id = stats.first_id;
+        handler.last_type = stats.last_type;
+        handler.last_id = stats.last_id;
+    }
+
+    return handler;
+}
+
+// The statistics and reader settings needed for a --get variable. For
+// anything not listed here (and for the full output) everything is
+// needed.
+struct info_needs {
+    unsigned int fields = field_all;
+    osmium::osm_entity_bits::type entities = osmium::osm_entity_bits::all;
+    osmium::io::read_meta read_meta = osmium::io::read_meta::yes;
+};
+
+static osmium::osm_entity_bits::type entities_from_plural(const std::string& name) noexcept {
+    if (name == "nodes") {
+        return osmium::osm_entity_bits::node;
+    }
+    if (name == "ways") {
+        return osmium::osm_entity_bits::way;
+    }
+    if (name == "relations") {
+        return osmium::osm_entity_bits::relation;
+    }
+    return osmium::osm_entity_bits::changeset;
+}
+
+static info_needs get_info_needs(const std::string& get_value) {
+    info_needs needs;
+
+    if (get_value.substr(0, 5) == "file." || get_value.substr(0, 7) == "header.") {
+        needs.fields = 0;
+        needs.entities = osmium::osm_entity_bits::nothing;
+        needs.read_meta = osmium::io::read_meta::no;
+    } else if (get_value == "data.bbox") {
+        needs.fields = field_bounds;
+        needs.entities = osmium::osm_entity_bits::node;
+        needs.read_meta = osmium::io::read_meta::no;
+    } else if (get_value.substr(0, 15) == "data.timestamp.") {
+        needs.fields = field_timestamps;
+    } else if (get_value == "data.objects_ordered" || get_value == "data.multiple_versions") {
+        needs.fields = field_order;
+        needs.read_meta = osmium::io::read_meta::no;
+    } else if (get_value.substr(0, 11) == "data.count." ||
+               get_value.substr(0, 11) == "data.minid." ||
+               get_value.substr(0, 11) == "data.maxid.") {
+        needs.fields = field_counts;
+        needs.entities = entities_from_plural(get_value.substr(11));
+        needs.read_meta = osmium::io::read_meta::no;
+    } else if (get_value.substr(0, 9) == "metadata.") {
+        needs.fields = field_metadata;
+    }
+
+    return needs;
+}
+
+// Information about the blocks in a PBF file as found in the BlobHeaders.
+struct BlocksInfo {
+
+    uint64_t count      = 0;
+    uint64_t with_stats = 0;
+    uint64_t size       = 0;
+    uint64_t max_size   = 0;
+
+}; // struct BlocksInfo
+
 class Output {
 
 protected:
@@ -203,6 +432,7 @@ public:
     virtual void file(const std::string& filename, const osmium::io::File& input_file) = 0;
     virtual void header(const osmium::io::Header& header) = 0;
     virtual void data(const osmium::io::Header& header, const InfoHandler& info_handler) = 0;
+    virtual void blocks(const BlocksInfo& blocks_info) = 0;
 
     virtual void output() {
     }
@@ -314,6 +544,14 @@ public:
         }
     }
 
+    void blocks(const BlocksInfo& blocks_info) final {
+        std::cout << "Blocks:\n";
+        std::cout << "  Number of data blocks: " << blocks_info.count << "\n";
+        std::cout << "  Data blocks with statistics: " << blocks_info.with_stats << "\n";
+        std::cout << "  Sum of block sizes: " << blocks_info.size << "\n";
+        std::cout << "  Largest block: " << blocks_info.max_size << "\n";
+    }
+
 }; // class HumanReadableOutput
 
 class JSONOutput : public Output {
@@ -500,9 +738,30 @@ public:
         m_writer.EndObject();
     }
 
-    void output() final {
+    void blocks(const BlocksInfo& blocks_info) final {
+        m_writer.String("blocks");
+        m_writer.StartObject();
+        m_writer.String("count");
+        m_writer.Int64(blocks_info.count);
+        m_writer.String("with_stats");
+        m_writer.Int64(blocks_info.with_stats);
+        m_writer.String("size");
+        m_writer.Int64(blocks_info.size);
+        m_writer.String("max_size");
+        m_writer.Int64(blocks_info.max_size);
         m_writer.EndObject();
-        std::cout << m_stream.GetString() << "\n";
+    }
+
+    // Finish the JSON document and return it.
+    std::string str() {
+        m_writer.EndObject();
+        std::string result{m_stream.GetString()};
+        result += '\n';
+        return result;
+    }
+
+    void output() final {
+        std::cout << str();
     }
 
 }; // class JSONOutput
@@ -704,6 +963,25 @@ public:
         }
     }
 
+    void blocks(const BlocksInfo& blocks_info) final {
+        if (m_get_value == "blocks.count") {
+            std::cout << blocks_info.count << "\n";
+            return;
+        }
+        if (m_get_value == "blocks.with_stats") {
+            std::cout << blocks_info.with_stats << "\n";
+            return;
+        }
+        if (m_get_value == "blocks.size") {
+            std::cout << blocks_info.size << "\n";
+            return;
+        }
+        if (m_get_value == "blocks.max_size") {
+            std::cout << blocks_info.max_size << "\n";
+            return;
+        }
+    }
+
 }; // class SimpleOutput
 
 
@@ -713,12 +991,15 @@ bool CommandFileinfo::setup(const std::vector<std::string>& arguments) {
     po::options_description opts_cmd{"COMMAND OPTIONS"};
     opts_cmd.add_options()
     ("extended,e", "Extended output")
+    ("block-headers", "Only read PBF block headers")
     ("get,g", po::value<std::string>(), "Get value")
     ("show-variables,G", "Show variables for --get option")
     ("json,j", "JSON output")
     ("crc,c", "Calculate CRC")
     ("no-crc", "Do not calculate CRC")
     ("object-type,t", po::value<std::vector<std::string>>(), "Read only objects of given type (node, way, relation, changeset)")
+    ("write-block-index", po::value<std::string>(), "Write index of PBF blocks to file")
+    ("write-object-index", po::value<std::string>(), "Write index of all objects in sorted PBF file to file")
     ;
 
     po::options_description opts_common{add_common_options()};
@@ -727,6 +1008,7 @@ bool CommandFileinfo::setup(const std::vector<std::string>& arguments) {
     po::options_description hidden;
     hidden.add_options()
     ("input-filename", po::value<std::string>(), "Input file")
+    ("more-input-filenames", po::value<std::vector<std::string>>(), "More input files")
     ;
 
     po::options_description desc;
@@ -737,6 +1019,7 @@ bool CommandFileinfo::setup(const std::vector<std::string>& arguments) {
 
     po::positional_options_description positional;
     positional.add("input-filename", 1);
+    positional.add("more-input-filenames", -1);
 
     po::variables_map vm;
     po::store(po::command_line_parser(arguments).options(parsed_options).positional(positional).run(), vm);
@@ -750,6 +1033,14 @@ bool CommandFileinfo::setup(const std::vector<std::string>& arguments) {
         m_extended = true;
     }
 
+    if (vm.count("block-headers")) {
+        m_block_headers = true;
+    }
+
+    if (m_extended && m_block_headers) {
+        throw argument_error{"Can not use --extended/-e and --block-headers together."};
+    }
+
     if (vm.count("json")) {
         m_json_output = true;
     }
@@ -805,7 +1096,11 @@ bool CommandFileinfo::setup(const std::vector<std::string>& arguments) {
         "metadata.some_objects.timestamp",
         "metadata.some_objects.changeset",
         "metadata.some_objects.uid",
-        "metadata.some_objects.user"
+        "metadata.some_objects.user",
+        "blocks.count",
+        "blocks.with_stats",
+        "blocks.size",
+        "blocks.max_size"
     };
 
     if (vm.count("show-variables")) {
@@ -823,9 +1118,15 @@ bool CommandFileinfo::setup(const std::vector<std::string>& arguments) {
                 throw argument_error{std::string{"Unknown value for --get/-g option '"} + m_get_value + "'. Use --show-variables/-G to see list of known values."};
             }
         }
-        if (m_get_value.substr(0, 5) == "data." && !m_extended) {
+        if (m_get_value.substr(0, 5) == "data." && !m_extended && !m_block_headers) {
             throw argument_error{"You need to set --extended/-e for any 'data.*' variables to be available."};
         }
+        if (m_get_value.substr(0, 7) == "blocks." && !m_block_headers) {
+            throw argument_error{"You need to set --block-headers for any 'blocks.*' variables to be available."};
+        }
+        if (m_get_value == "data.crc32" && m_block_headers) {
+            throw argument_error{"The CRC32 is not available with --block-headers."};
+        }
         if (m_get_value == "data.crc32") {
             m_calculate_crc = true;
         } else {
@@ -837,19 +1138,241 @@ bool CommandFileinfo::setup(const std::vector<std::string>& arguments) {
         throw argument_error{"You can not use --get/-g and --json/-j together."};
     }
 
+    if (vm.count("more-input-filenames")) {
+        m_more_input_filenames = vm["more-input-filenames"].as<std::vector<std::string>>();
+        if (!m_json_output) {
+            throw argument_error{"Several input files can only be used together with --json/-j."};
+        }
+        if (vm.count("write-block-index")) {
+            throw argument_error{"Can not use --write-block-index with several input files."};
+        }
+        if (vm.count("write-object-index")) {
+            throw argument_error{"Can not use --write-object-index with several input files."};
+        }
+        if (m_input_filename.empty() || m_input_filename == "-" ||
+            std::find(m_more_input_filenames.cbegin(), m_more_input_filenames.cend(), "-") != m_more_input_filenames.cend()) {
+            throw argument_error{"Can not read from STDIN when using several input files."};
+        }
+    }
+
+    if (m_block_headers) {
+        if (m_input_file.format() != osmium::io::file_format::pbf) {
+            throw argument_error{"The --block-headers option only works with PBF input files."};
+        }
+        if (is_stdin_or_pipe(m_input_filename)) {
+            throw argument_error{"Can not use --block-headers when reading from STDIN."};
+        }
+        for (const auto& filename : m_more_input_filenames) {
+            if (osmium::io::File{filename, m_input_format}.format() != osmium::io::file_format::pbf) {
+                throw argument_error{"The --block-headers option only works with PBF input files."};
+            }
+        }
+    }
+
+    if (vm.count("write-block-index")) {
+        if (m_input_file.format() != osmium::io::file_format::pbf) {
+            throw argument_error{"The --write-block-index option only works with PBF input files."};
+        }
+        if (is_stdin_or_pipe(m_input_filename)) {
+            throw argument_error{"Can not use --write-block-index when reading from STDIN."};
+        }
+        m_block_index_filename = vm["write-block-index"].as<std::string>();
+    }
+
+    if (vm.count("write-object-index")) {
+        if (m_input_file.format() != osmium::io::file_format::pbf) {
+            throw argument_error{"The --write-object-index option only works with PBF input files."};
+        }
+        if (is_stdin_or_pipe(m_input_filename)) {
+            throw argument_error{"Can not use --write-object-index when reading from STDIN."};
+        }
+        m_object_index_filename = vm["write-object-index"].as<std::string>();
+    }
+
     return true;
 }
 
 void CommandFileinfo::show_arguments() {
     show_single_input_arguments(m_vout);
+    if (!m_more_input_filenames.empty()) {
+        m_vout << "  more input files:\n";
+        for (const auto& filename : m_more_input_filenames) {
+            m_vout << "    " << filename << '\n';
+        }
+    }
 
     m_vout << "  other options:\n";
     show_object_types(m_vout);
     m_vout << "    extended output: " << (m_extended ? "yes\n" : "no\n");
+    m_vout << "    only read block headers: " << (m_block_headers ? "yes\n" : "no\n");
     m_vout << "    calculate CRC: " << (m_calculate_crc ? "yes\n" : "no\n");
+    m_vout << "    threads: " << m_threads << '\n';
+    if (!m_block_index_filename.empty()) {
+        m_vout << "    write block index to: " << m_block_index_filename << '\n';
+    }
+    if (!m_object_index_filename.empty()) {
+        m_vout << "    write object index to: " << m_object_index_filename << '\n';
+    }
+}
+
+// Walk through the BlobHeaders of a PBF file without reading the blobs.
+// If the writer of the file stored statistics for all blocks, the data
+// section is created from them.
+static void show_block_headers(const std::string& filename, const std::string& get_value, bool with_progress, const osmium::io::Header& header, Output& output) {
+    PBFBlockReader block_reader{filename};
+    osmium::ProgressBar progress_bar{osmium::file_size(filename), with_progress};
+
+    BlocksInfo blocks_info;
+    InfoHandler info_handler{false};
+
+    pbf_blob_header blob_header;
+    pbf_block_stats stats;
+    while (block_reader.read_header(blob_header)) {
+        progress_bar.update(block_reader.offset());
+        if (blob_header.type != "OSMData") {
+            continue;
+        }
+        ++blocks_info.count;
+        blocks_info.size += blob_header.size;
+        blocks_info.max_size = std::max<uint64_t>(blocks_info.max_size, blob_header.size);
+        if (decode_pbf_block_stats(blob_header.index_data, stats)) {
+            ++blocks_info.with_stats;
+            info_handler.merge(from_block_stats(stats));
+        }
+    }
+    progress_bar.done();
+
+    output.blocks(blocks_info);
+
+    // The data section can only be shown if all blocks have statistics.
+    if (blocks_info.with_stats == blocks_info.count) {
+        output.data(header, info_handler);
+    } else if (get_value.substr(0, 5) == "data." || get_value.substr(0, 9) == "metadata.") {
+        throw std::runtime_error{"Not all blocks in the input file have statistics. Use --extended/-e instead of --block-headers."};
+    }
 }
 
 bool CommandFileinfo::run() {
+    if (!m_block_index_filename.empty()) {
+        m_vout << "Writing block index...\n";
+        const auto index = build_pbf_block_index(m_input_filename);
+        write_pbf_block_index(m_block_index_filename, index);
+        m_vout << "Block index has " << index.blocks.size() << " entries.\n";
+    }
+
+    if (!m_object_index_filename.empty()) {
+        m_vout << "Writing object index...\n";
+        write_pbf_object_index(m_input_filename, m_object_index_filename);
+    }
+
+    // Collect the info for one input file. If a pool is given, the
+    // statistics for the buffers of the file are calculated on it.
+    const auto process_file = [this](const std::string& filename, const osmium::io::File& input_file, Output& output, bool with_progress, osmium::thread::Pool* pool) {
+        output.set_crc(m_calculate_crc);
+        output.file(filename, input_file);
+
+        const auto needs = get_info_needs(m_get_value);
+        osmium::io::Reader reader{input_file,
+                                  m_extended ? (osm_entity_bits() & needs.entities) : osmium::osm_entity_bits::nothing,
+                                  needs.read_meta};
+        osmium::io::Header header{reader.header()};
+        output.header(header);
+
+        if (m_extended) {
+            InfoHandler info_handler{m_calculate_crc, needs.fields};
+            osmium::ProgressBar progress_bar{reader.file_size(), with_progress};
+            if (pool) {
+                // The statistics for each buffer are calculated in the thread
+                // pool and merged in input order.
+                std::deque<std::future<InfoHandler>> pending;
+                const std::size_t max_pending = static_cast<std::size_t>(m_threads) * 4;
+                const bool calculate_crc = m_calculate_crc;
+                const unsigned int fields = needs.fields;
+
+                while (osmium::memory::Buffer buffer = reader.read()) {
+                    progress_bar.update(reader.offset());
+                    std::shared_ptr<osmium::memory::Buffer> buffer_ptr{new osmium::memory::Buffer{std::move(buffer)}};
+                    pending.push_back(pool->submit([buffer_ptr, calculate_crc, fields]() {
+                        InfoHandler partial{calculate_crc, fields};
+                        ++partial.buffers_count;
+                        partial.buffers_size += buffer_ptr->committed();
+                        partial.buffers_capacity += buffer_ptr->capacity();
+                        osmium::apply(*buffer_ptr, partial);
+                        return partial;
+                    }));
+                    while (pending.size() > max_pending) {
+                        info_handler.merge(pending.front().get());
+                        pending.pop_front();
+                    }
+                }
+                for (auto& future : pending) {
+                    info_handler.merge(future.get());
+                }
+            } else {
+                while (osmium::memory::Buffer buffer = reader.read()) {
+                    progress_bar.update(reader.offset());
+                    ++info_handler.buffers_count;
+                    info_handler.buffers_size += buffer.committed();
+                    info_handler.buffers_capacity += buffer.capacity();
+                    osmium::apply(buffer, info_handler);
+                }
+            }
+            progress_bar.done();
+            output.data(header, info_handler);
+        }
+
+        reader.close();
+
+        if (m_block_headers) {
+            show_block_headers(filename, m_get_value, with_progress, header, output);
+        }
+    };
+
+    if (!m_more_input_filenames.empty()) {
+        // Several input files are read in parallel, one file on each
+        // thread, and their JSON documents are written in input order.
+        std::vector<std::string> filenames{m_input_filename};
+        filenames.insert(filenames.end(), m_more_input_filenames.cbegin(), m_more_input_filenames.cend());
+
+        m_vout << "Reading " << filenames.size() << " input files...\n";
+        auto& pool = thread_pool();
+        std::deque<std::pair<std::size_t, std::future<std::string>>> pending;
+        const std::size_t max_pending = static_cast<std::size_t>(m_threads) * 4;
+
+        std::vector<osmium::io::File> input_files;
+        for (const auto& filename : filenames) {
+            input_files.emplace_back(filename, m_input_format);
+        }
+        osmium::ProgressBar progress_bar{file_size_sum(input_files), display_progress()};
+        std::size_t done_size = 0;
+
+        const auto write_front = [&]() {
+            std::cout << pending.front().second.get();
+            done_size += pending.front().first;
+            progress_bar.update(done_size);
+            pending.pop_front();
+        };
+
+        for (const auto& input_file : input_files) {
+            pending.emplace_back(osmium::file_size(input_file.filename()), pool.submit([&process_file, input_file]() -> std::string {
+                JSONOutput output;
+                process_file(input_file.filename(), input_file, output, false, nullptr);
+                return output.str();
+            }));
+            while (pending.size() > max_pending) {
+                write_front();
+            }
+        }
+        while (!pending.empty()) {
+            write_front();
+        }
+        progress_bar.done();
+
+        m_vout << "Done.\n";
+
+        return true;
+    }
+
     std::unique_ptr<Output> output;
     if (m_json_output) {
         output.reset(new JSONOutput{});
@@ -859,32 +1382,14 @@ bool CommandFileinfo::run() {
         output.reset(new SimpleOutput{m_get_value});
     }
 
-    output->set_crc(m_calculate_crc);
-    output->file(m_input_filename, m_input_file);
-
-    osmium::io::Reader reader{m_input_file, m_extended ? osm_entity_bits() : osmium::osm_entity_bits::nothing};
-    osmium::io::Header header{reader.header()};
-    output->header(header);
-
-    if (m_extended) {
-        InfoHandler info_handler{m_calculate_crc};
-        osmium::ProgressBar progress_bar{reader.file_size(), display_progress()};
-        while (osmium::memory::Buffer buffer = reader.read()) {
-            progress_bar.update(reader.offset());
-            ++info_handler.buffers_count;
-            info_handler.buffers_size += buffer.committed();
-            info_handler.buffers_capacity += buffer.capacity();
-            osmium::apply(buffer, info_handler);
-        }
-        progress_bar.done();
-        output->data(header, info_handler);
+    if (m_block_headers) {
+        m_vout << "Reading block headers...\n";
     }
+    process_file(m_input_filename, m_input_file, *output, display_progress(), m_threads > 1 ? &thread_pool() : nullptr);
 
-    reader.close();
     output->output();
 
     m_vout << "Done.\n";
 
     return true;
 }
-
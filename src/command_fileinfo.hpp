@@ -30,8 +30,14 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 class CommandFileinfo : public Command, public with_single_osm_input {
 
+    // Input files after the first one. They are all read in parallel.
+    std::vector<std::string> m_more_input_filenames;
+
     std::string m_get_value;
+    std::string m_block_index_filename;
+    std::string m_object_index_filename;
     bool m_extended = false;
+    bool m_block_headers = false;
     bool m_json_output = false;
     bool m_calculate_crc = false;
 
@@ -52,7 +58,7 @@ public:
     }
 
     const char* synopsis() const noexcept override final {
-        return "osmium fileinfo [OPTIONS] OSM-FILE";
+        return "osmium fileinfo [OPTIONS] OSM-FILE...";
     }
 
 }; // class CommandFileinfo
@@ -23,9 +23,15 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include "command_getid.hpp"
 #include "exception.hpp"
 #include "id_file.hpp"
+#include "pbf_blocks.hpp"
+#include "remote_file.hpp"
+#include "relations_map.hpp"
+#include "temp_files.hpp"
 #include "util.hpp"
 
-#include <osmium/index/relations_map.hpp>
+#include <osmium/io/error.hpp>
+#include <osmium/io/file.hpp>
+#include <osmium/io/file_format.hpp>
 #include <osmium/io/header.hpp>
 #include <osmium/io/reader.hpp>
 #include <osmium/io/writer.hpp>
@@ -38,7 +44,9 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include <boost/program_options.hpp>
 
+#include <algorithm>
 #include <cstddef>
+#include <cstdio>
 #include <fstream>
 #include <iostream>
 #include <stdexcept>
@@ -61,7 +69,10 @@ bool CommandGetId::setup(const std::vector<std::string>& arguments) {
     ("history", "Deprecated, use --with-history instead")
     ("with-history,H", "Make it work with history files")
     ("add-referenced,r", "Recursively add referenced objects")
+    ("add-parents,p", "Add ways and relations directly referencing the objects")
     ("verbose-ids", "Print all requested and missing IDs")
+    ("block-index", po::value<std::string>(), "Read only PBF blocks which can contain the IDs according to this index")
+    ("object-index", po::value<std::string>(), "Read only the objects with the IDs according to this index")
     ;
 
     po::options_description opts_common{add_common_options()};
@@ -94,16 +105,49 @@ bool CommandGetId::setup(const std::vector<std::string>& arguments) {
     setup_output_file(vm);
 
     if (vm.count("add-referenced")) {
-        if (m_input_filename.empty() || m_input_filename == "-") {
+        if (is_stdin_or_pipe(m_input_filename)) {
             throw argument_error{"Can not read OSM input from STDIN when --add-referenced/-r option is used."};
         }
         m_add_referenced_objects = true;
     }
 
+    if (vm.count("add-parents")) {
+        m_add_parents = true;
+    }
+
     if (vm.count("with-history")) {
         m_work_with_history = true;
     }
 
+    if (vm.count("block-index")) {
+        if (m_input_file.format() != osmium::io::file_format::pbf) {
+            throw argument_error{"The --block-index option only works with PBF input files."};
+        }
+        if (is_stdin_or_pipe(m_input_filename)) {
+            throw argument_error{"Can not use --block-index when reading from STDIN."};
+        }
+        if (m_add_parents) {
+            throw argument_error{"Can not use --block-index together with --add-parents/-p."};
+        }
+        m_block_index_filename = vm["block-index"].as<std::string>();
+    }
+
+    if (vm.count("object-index")) {
+        if (m_input_file.format() != osmium::io::file_format::pbf) {
+            throw argument_error{"The --object-index option only works with PBF input files."};
+        }
+        if (is_stdin_or_pipe(m_input_filename)) {
+            throw argument_error{"Can not use --object-index when reading from STDIN."};
+        }
+        if (m_add_parents) {
+            throw argument_error{"Can not use --object-index together with --add-parents/-p."};
+        }
+        if (!m_block_index_filename.empty()) {
+            throw argument_error{"Can not use --object-index together with --block-index."};
+        }
+        m_object_index_filename = vm["object-index"].as<std::string>();
+    }
+
     if (vm.count("history")) {
         warning("The --history option is deprecated. Use --with-history instead.\n");
         m_work_with_history = true;
@@ -167,8 +211,15 @@ void CommandGetId::show_arguments() {
 
     m_vout << "  other options:\n";
     m_vout << "    add referenced objects: " << yes_no(m_add_referenced_objects);
+    m_vout << "    add parent objects: " << yes_no(m_add_parents);
     m_vout << "    work with history files: " << yes_no(m_work_with_history);
     m_vout << "    default object type: " << osmium::item_type_to_name(m_default_item_type) << "\n";
+    if (!m_block_index_filename.empty()) {
+        m_vout << "    block index: " << m_block_index_filename << "\n";
+    }
+    if (!m_object_index_filename.empty()) {
+        m_vout << "    object index: " << m_object_index_filename << "\n";
+    }
     if (m_verbose_ids) {
         m_vout << "    looking for these ids:\n";
         m_vout << "      nodes:";
@@ -206,10 +257,36 @@ osmium::osm_entity_bits::type CommandGetId::get_needed_types() const {
         types |= osmium::osm_entity_bits::relation;
     }
 
+    if (m_add_parents) {
+        if (!m_requested_ids(osmium::item_type::node).empty()) {
+            types |= osmium::osm_entity_bits::way;
+        }
+        types |= osmium::osm_entity_bits::relation;
+    }
+
     return types;
 }
 
-static void print_missing_ids(const char* type, const osmium::index::IdSetDense<osmium::unsigned_object_id_type>& set) {
+bool CommandGetId::is_parent(const osmium::OSMObject& object) const noexcept {
+    if (object.type() == osmium::item_type::way) {
+        const auto& way = static_cast<const osmium::Way&>(object);
+        for (const auto& nr : way.nodes()) {
+            if (m_requested_ids(osmium::item_type::node).get(nr.positive_ref())) {
+                return true;
+            }
+        }
+    } else if (object.type() == osmium::item_type::relation) {
+        const auto& relation = static_cast<const osmium::Relation&>(object);
+        for (const auto& member : relation.members()) {
+            if (m_requested_ids(member.type()).get(member.positive_ref())) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static void print_missing_ids(const char* type, const AdaptiveIdSet& set) {
     if (set.empty()) {
         return;
     }
@@ -220,19 +297,11 @@ static void print_missing_ids(const char* type, const osmium::index::IdSetDense<
     std::cerr << '\n';
 }
 
-void CommandGetId::mark_rel_ids(const osmium::index::RelationsMapIndex& rel_in_rel, osmium::object_id_type parent_id) {
-    rel_in_rel.for_each(parent_id, [&](osmium::unsigned_object_id_type member_id) {
-        if (m_ids(osmium::item_type::relation).check_and_set(member_id)) {
-            mark_rel_ids(rel_in_rel, member_id);
-        }
-    });
-}
-
 bool CommandGetId::find_relations_in_relations() {
     m_vout << "  Reading input file to find relations in relations...\n";
-    osmium::index::RelationsMapStash stash;
+    CompactRelationsMapStash stash;
 
-    osmium::io::Reader reader{m_input_file, osmium::osm_entity_bits::relation};
+    osmium::io::Reader reader{m_input_file, osmium::osm_entity_bits::relation, osmium::io::read_meta::no};
     while (osmium::memory::Buffer buffer = reader.read()) {
         for (const auto& relation : buffer.select<osmium::Relation>()) {
             for (const auto& member : relation.members()) {
@@ -255,9 +324,7 @@ bool CommandGetId::find_relations_in_relations() {
     }
 
     const auto rel_in_rel = stash.build_parent_to_member_index();
-    for (const osmium::unsigned_object_id_type id : m_ids(osmium::item_type::relation)) {
-        mark_rel_ids(rel_in_rel, id);
-    }
+    add_member_relations(rel_in_rel, m_ids(osmium::item_type::relation));
 
     return true;
 }
@@ -265,7 +332,7 @@ bool CommandGetId::find_relations_in_relations() {
 void CommandGetId::find_nodes_and_ways_in_relations() {
     m_vout << "  Reading input file to find nodes/ways in relations...\n";
 
-    osmium::io::Reader reader{m_input_file, osmium::osm_entity_bits::relation};
+    osmium::io::Reader reader{m_input_file, osmium::osm_entity_bits::relation, osmium::io::read_meta::no};
     while (osmium::memory::Buffer buffer = reader.read()) {
         for (const auto& relation : buffer.select<osmium::Relation>()) {
             if (m_ids(osmium::item_type::relation).get(relation.positive_id())) {
@@ -285,7 +352,7 @@ void CommandGetId::find_nodes_and_ways_in_relations() {
 void CommandGetId::find_nodes_in_ways() {
     m_vout << "  Reading input file to find nodes in ways...\n";
 
-    osmium::io::Reader reader{m_input_file, osmium::osm_entity_bits::way};
+    osmium::io::Reader reader{m_input_file, osmium::osm_entity_bits::way, osmium::io::read_meta::no};
     while (osmium::memory::Buffer buffer = reader.read()) {
         for (const auto& way : buffer.select<osmium::Way>()) {
             if (m_ids(osmium::item_type::way).get(way.positive_id())) {
@@ -320,13 +387,102 @@ void CommandGetId::find_referenced_objects() {
     m_vout << "Done following references.\n";
 }
 
+// Copy all blocks from the input file which, according to the block
+// index, can contain any of the objects we are looking for into a new
+// PBF file.
+void CommandGetId::copy_candidate_blocks(const std::string& filename) {
+    m_vout << "Reading block index...\n";
+    const auto index = read_pbf_block_index(m_block_index_filename);
+    if (index.file_size != input_file_size(m_input_filename)) {
+        throw std::runtime_error{"Block index '" + m_block_index_filename + "' does not match input file '" + m_input_filename + "'."};
+    }
+
+    const auto offsets = find_pbf_blocks(index, get_pbf_object_keys(m_ids));
+
+    PBFBlockReader reader{m_input_filename};
+    pbf_block block;
+    if (!reader.read(block) || block.type != "OSMHeader") {
+        throw osmium::io_error{"Missing header block in PBF file '" + m_input_filename + "'"};
+    }
+
+    PBFBlockWriter writer{filename, decode_pbf_header(block), osmium::io::overwrite::allow, osmium::io::fsync::no};
+    for (const auto offset : offsets) {
+        reader.seek(offset);
+        if (!reader.read(block) || block.type != "OSMData") {
+            throw std::runtime_error{"Block index '" + m_block_index_filename + "' does not match input file '" + m_input_filename + "'."};
+        }
+        writer.write(block);
+    }
+    writer.close();
+
+    m_vout << "Found " << offsets.size() << " of " << index.blocks.size() << " blocks which can contain the objects.\n";
+}
+
+// Copy the objects we are looking for into a new PBF file. The object
+// index has the exact position of each object, so only the blocks which
+// contain any of the objects are decoded.
+void CommandGetId::copy_indexed_objects(const std::string& filename) {
+    m_vout << "Opening object index...\n";
+    PBFObjectIndex index{m_object_index_filename};
+    if (index.file_size() != input_file_size(m_input_filename)) {
+        throw std::runtime_error{"Object index '" + m_object_index_filename + "' does not match input file '" + m_input_filename + "'."};
+    }
+
+    const auto positions = index.find(get_pbf_object_keys(m_ids));
+
+    PBFBlockReader reader{m_input_filename};
+    pbf_block block;
+    if (!reader.read(block) || block.type != "OSMHeader") {
+        throw osmium::io_error{"Missing header block in PBF file '" + m_input_filename + "'"};
+    }
+    const auto header = decode_pbf_header(block);
+
+    osmium::io::Writer writer{osmium::io::File{filename, "pbf"}, header, osmium::io::overwrite::allow};
+    writer(read_pbf_objects(reader, positions));
+    writer.close();
+
+    m_vout << "Found " << positions.size() << " objects in the object index.\n";
+}
+
+// Objects with negative IDs come before those with positive IDs in sorted
+// files, so this is only called for positive IDs.
+bool CommandGetId::all_ids_passed(const osmium::OSMObject& object, const osmium::nwr_array<osmium::unsigned_object_id_type>& max_ids) const {
+    for (const auto type : {osmium::item_type::way, osmium::item_type::relation}) {
+        if (type > object.type() && !m_ids(type).empty()) {
+            return false;
+        }
+    }
+    return m_ids(object.type()).empty() || object.positive_id() > max_ids(object.type());
+}
+
 bool CommandGetId::run() {
+    if (m_add_parents) {
+        // Parents are found in the same pass that copies the objects,
+        // so they are looked up in a copy of the requested IDs which is
+        // neither extended by -r nor cleared while copying.
+        for (const auto type : {osmium::item_type::node, osmium::item_type::way, osmium::item_type::relation}) {
+            for (const osmium::unsigned_object_id_type id : m_ids(type)) {
+                m_requested_ids(type).set(id);
+            }
+        }
+    }
+
     if (m_add_referenced_objects) {
         find_referenced_objects();
     }
 
+    TempFiles temp_files{default_temp_directory(), "osmium-getid", ".osm.pbf"};
+    osmium::io::File input_file{m_input_file};
+    if (!m_block_index_filename.empty()) {
+        input_file = osmium::io::File{temp_files.create(), "pbf"};
+        copy_candidate_blocks(input_file.filename());
+    } else if (!m_object_index_filename.empty()) {
+        input_file = osmium::io::File{temp_files.create(), "pbf"};
+        copy_indexed_objects(input_file.filename());
+    }
+
     m_vout << "Opening input file...\n";
-    osmium::io::Reader reader{m_input_file, get_needed_types()};
+    osmium::io::Reader reader{input_file, get_needed_types()};
 
     m_vout << "Opening output file...\n";
     osmium::io::Header header = reader.header();
@@ -334,16 +490,39 @@ bool CommandGetId::run() {
 
     osmium::io::Writer writer{m_output_file, header, m_output_overwrite, m_fsync};
 
+    // In a file sorted by type and ID reading can stop once all requested
+    // objects have been passed. Parents can be anywhere in the file.
+    const bool stop_early = !m_add_parents && reader.header().get("sorting") == "Type_then_ID";
+    osmium::nwr_array<osmium::unsigned_object_id_type> max_ids;
+    for (const auto type : {osmium::item_type::node, osmium::item_type::way, osmium::item_type::relation}) {
+        max_ids(type) = 0;
+        for (const osmium::unsigned_object_id_type id : m_ids(type)) {
+            max_ids(type) = id;
+        }
+    }
+
     m_vout << "Copying matching objects to output file...\n";
     osmium::ProgressBar progress_bar{reader.file_size(), display_progress()};
-    while (osmium::memory::Buffer buffer = reader.read()) {
+    bool done = false;
+    while (!done) {
+        osmium::memory::Buffer buffer = reader.read();
+        if (!buffer) {
+            break;
+        }
         progress_bar.update(reader.offset());
         for (const auto& object : buffer.select<osmium::OSMObject>()) {
+            if (stop_early && object.id() > 0 && all_ids_passed(object, max_ids)) {
+                m_vout << "Passed all requested objects, stopping early.\n";
+                done = true;
+                break;
+            }
             if (m_ids(object.type()).get(object.positive_id())) {
                 if (!m_work_with_history) {
                     m_ids(object.type()).unset(object.positive_id());
                 }
                 writer(object);
+            } else if (m_add_parents && is_parent(object)) {
+                writer(object);
             }
         }
     }
@@ -24,13 +24,14 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
 #include "cmd.hpp" // IWYU pragma: export
+#include "id_file.hpp"
 
 #include <osmium/fwd.hpp>
 #include <osmium/index/id_set.hpp>
 #include <osmium/index/nwr_array.hpp>
-#include <osmium/index/relations_map.hpp>
 #include <osmium/osm/entity_bits.hpp>
 #include <osmium/osm/item_type.hpp>
+#include <osmium/osm/object.hpp>
 #include <osmium/osm/types.hpp>
 
 #include <cstddef>
@@ -40,11 +41,19 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 class CommandGetId : public Command, public with_single_osm_input, public with_osm_output {
 
-    osmium::nwr_array<osmium::index::IdSetDense<osmium::unsigned_object_id_type>> m_ids;
+    ids_type m_ids;
+
+    // The IDs as requested (before adding referenced objects), only
+    // filled when looking for parents.
+    ids_type m_requested_ids;
 
     osmium::item_type m_default_item_type = osmium::item_type::node;
 
+    std::string m_block_index_filename;
+    std::string m_object_index_filename;
+
     bool m_add_referenced_objects = false;
+    bool m_add_parents = false;
     bool m_work_with_history = false;
     bool m_verbose_ids = false;
 
@@ -52,12 +61,18 @@ class CommandGetId : public Command, public with_single_osm_input, public with_o
     std::size_t count_ids() const noexcept;
 
     void find_referenced_objects();
+    bool is_parent(const osmium::OSMObject& object) const noexcept;
+
+    bool all_ids_passed(const osmium::OSMObject& object, const osmium::nwr_array<osmium::unsigned_object_id_type>& max_ids) const;
 
-    void mark_rel_ids(const osmium::index::RelationsMapIndex& rel_in_rel, osmium::object_id_type parent_id);
     bool find_relations_in_relations();
     void find_nodes_and_ways_in_relations();
     void find_nodes_in_ways();
 
+    void copy_candidate_blocks(const std::string& filename);
+
+    void copy_indexed_objects(const std::string& filename);
+
 public:
 
     explicit CommandGetId(const CommandFactory& command_factory) :
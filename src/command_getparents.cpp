@@ -23,6 +23,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include "command_getparents.hpp"
 #include "exception.hpp"
 #include "id_file.hpp"
+#include "relations_map.hpp"
 #include "util.hpp"
 
 #include <osmium/io/header.hpp>
@@ -31,6 +32,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <osmium/memory/buffer.hpp>
 #include <osmium/osm.hpp>
 #include <osmium/osm/types_from_string.hpp>
+#include <osmium/thread/pool.hpp>
 #include <osmium/util/progress_bar.hpp>
 #include <osmium/util/string.hpp>
 #include <osmium/util/verbose_output.hpp>
@@ -38,8 +40,11 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <boost/program_options.hpp>
 
 #include <cstddef>
+#include <deque>
 #include <fstream>
+#include <future>
 #include <iostream>
+#include <memory>
 #include <stdexcept>
 #include <string>
 #include <utility>
@@ -52,6 +57,7 @@ bool CommandGetParents::setup(const std::vector<std::string>& arguments) {
     ("id-file,i", po::value<std::vector<std::string>>(), "Read OSM IDs from text file")
     ("id-osm-file,I", po::value<std::vector<std::string>>(), "Read OSM IDs from OSM file")
     ("add-self,s", "Add objects with specified IDs themselves")
+    ("recursive", "Also add parents of parents")
     ("verbose-ids", "Print all requested IDs")
     ;
 
@@ -88,6 +94,10 @@ bool CommandGetParents::setup(const std::vector<std::string>& arguments) {
         m_add_self = true;
     }
 
+    if (vm.count("recursive")) {
+        m_recursive = true;
+    }
+
     if (vm.count("default-type")) {
         m_default_item_type = parse_item_type(vm["default-type"].as<std::string>());
     }
@@ -146,6 +156,7 @@ void CommandGetParents::show_arguments() {
 
     m_vout << "  other options:\n";
     m_vout << "    add self: " << yes_no(m_add_self);
+    m_vout << "    recursive: " << yes_no(m_recursive);
     m_vout << "    default object type: " << osmium::item_type_to_name(m_default_item_type) << "\n";
     if (m_verbose_ids) {
         m_vout << "    looking for these ids:\n";
@@ -189,22 +200,122 @@ osmium::osm_entity_bits::type CommandGetParents::get_needed_types() const {
     return types;
 }
 
-bool CommandGetParents::run() {
-    m_vout << "Opening input file...\n";
-    osmium::io::Reader reader{m_input_file, get_needed_types()};
+bool CommandGetParents::is_parent_or_self(const osmium::OSMObject& object) const noexcept {
+    if (m_add_self && m_ids(object.type()).get(object.positive_id())) {
+        return true;
+    }
+    if (object.type() == osmium::item_type::way) {
+        const auto& way = static_cast<const osmium::Way&>(object);
+        for (const auto& nr : way.nodes()) {
+            if (m_ids(osmium::item_type::node).get(nr.positive_ref())) {
+                return true;
+            }
+        }
+    } else if (object.type() == osmium::item_type::relation) {
+        const auto& relation = static_cast<const osmium::Relation&>(object);
+        for (const auto& member : relation.members()) {
+            if (m_ids(member.type()).get(member.positive_ref())) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
 
-    m_vout << "Opening output file...\n";
-    osmium::io::Header header = reader.header();
-    setup_header(header);
+osmium::memory::Buffer CommandGetParents::filter_buffer(const osmium::memory::Buffer& buffer) const {
+    osmium::memory::Buffer out_buffer{64UL * 1024UL, osmium::memory::Buffer::auto_grow::yes};
 
-    osmium::io::Writer writer{m_output_file, header, m_output_overwrite, m_fsync};
+    for (const auto& object : buffer.select<osmium::OSMObject>()) {
+        if (is_parent_or_self(object)) {
+            out_buffer.add_item(object);
+            out_buffer.commit();
+        }
+    }
+
+    return out_buffer;
+}
+
+void CommandGetParents::copy_parents(osmium::io::Reader& reader, osmium::io::Writer& writer, osmium::ProgressBar& progress_bar) {
+    const auto write = [&](osmium::memory::Buffer&& out_buffer) {
+        if (out_buffer.committed() > 0) {
+            writer(std::move(out_buffer));
+        }
+    };
+
+    // With several threads the input buffers are filtered in the thread
+    // pool, the output buffers are handed to the writer in input order.
+    osmium::thread::Pool* pool = m_threads > 1 ? &thread_pool() : nullptr;
+    std::deque<std::future<osmium::memory::Buffer>> pending;
+    const std::size_t max_pending = static_cast<std::size_t>(m_threads) * 4;
+
+    while (osmium::memory::Buffer buffer = reader.read()) {
+        progress_bar.update(reader.offset());
+        if (!pool) {
+            write(filter_buffer(buffer));
+            continue;
+        }
+        std::shared_ptr<osmium::memory::Buffer> buffer_ptr{new osmium::memory::Buffer{std::move(buffer)}};
+        pending.push_back(pool->submit([this, buffer_ptr]() {
+            return filter_buffer(*buffer_ptr);
+        }));
+        while (pending.size() > max_pending) {
+            write(pending.front().get());
+            pending.pop_front();
+        }
+    }
+
+    for (auto& future : pending) {
+        write(future.get());
+    }
+}
+
+/**
+ * Find all parents, grandparents etc. in one pass over the input file.
+ *
+ * Nodes and ways come before relations in the input, so the ways
+ * containing any of the nodes are known when the relations are read.
+ * Relations directly containing any of the objects or those ways are
+ * marked when they are read. All relations having relation members are
+ * kept in a buffer and a member to parent index is built for them.
+ * After all relations are read, the index is used to find all relations
+ * containing marked relations and all marked relations are copied from
+ * the buffer to the output.
+ */
+void CommandGetParents::copy_parents_recursive(osmium::io::Reader& reader, osmium::io::Writer& writer, osmium::ProgressBar& progress_bar) {
+    osmium::index::IdSetDense<osmium::unsigned_object_id_type> parent_ways;
+    osmium::index::IdSetDense<osmium::unsigned_object_id_type> parent_relations;
+
+    osmium::memory::Buffer relations{1024 * 1024, osmium::memory::Buffer::auto_grow::yes};
+    CompactRelationsMapStash stash;
+
+    const auto contains = [&](const osmium::RelationMember& member) {
+        return m_ids(member.type()).get(member.positive_ref()) ||
+               (member.type() == osmium::item_type::way && parent_ways.get(member.positive_ref()));
+    };
 
-    m_vout << "Copying matching objects to output file...\n";
-    osmium::ProgressBar progress_bar{reader.file_size(), display_progress()};
     while (osmium::memory::Buffer buffer = reader.read()) {
         progress_bar.update(reader.offset());
         for (const auto& object : buffer.select<osmium::OSMObject>()) {
-            if (m_add_self && m_ids(object.type()).get(object.positive_id())) {
+            const bool self = m_ids(object.type()).get(object.positive_id());
+            if (object.type() == osmium::item_type::relation) {
+                const auto& relation = static_cast<const osmium::Relation&>(object);
+                bool has_relation_members = false;
+                for (const auto& member : relation.members()) {
+                    if (contains(member)) {
+                        parent_relations.set(relation.positive_id());
+                    }
+                    if (member.type() == osmium::item_type::relation) {
+                        stash.add(member.ref(), relation.id());
+                        has_relation_members = true;
+                    }
+                }
+                if (has_relation_members || parent_relations.get(relation.positive_id()) || (m_add_self && self)) {
+                    relations.add_item(relation);
+                    relations.commit();
+                }
+                continue;
+            }
+            if (m_add_self && self) {
                 writer(object);
                 continue;
             }
@@ -212,21 +323,61 @@ bool CommandGetParents::run() {
                 const auto& way = static_cast<const osmium::Way&>(object);
                 for (const auto& nr : way.nodes()) {
                     if (m_ids(osmium::item_type::node).get(nr.positive_ref())) {
+                        parent_ways.set(way.positive_id());
                         writer(object);
                         break;
                     }
                 }
-            } else if (object.type() == osmium::item_type::relation) {
-                const auto& relation = static_cast<const osmium::Relation&>(object);
-                for (const auto& member : relation.members()) {
-                    if (m_ids(member.type()).get(member.positive_ref())) {
-                        writer(object);
-                        break;
-                    }
-                }
             }
         }
     }
+
+    // Relations containing the relations we are looking for are parents.
+    std::vector<osmium::unsigned_object_id_type> todo;
+    for (const osmium::unsigned_object_id_type id : m_ids(osmium::item_type::relation)) {
+        todo.push_back(id);
+    }
+    for (const osmium::unsigned_object_id_type id : parent_relations) {
+        todo.push_back(id);
+    }
+
+    const auto member_to_parent = stash.build_member_to_parent_index();
+    while (!todo.empty()) {
+        const auto id = todo.back();
+        todo.pop_back();
+        member_to_parent.for_each(id, [&](osmium::unsigned_object_id_type parent_id) {
+            if (parent_relations.check_and_set(parent_id)) {
+                todo.push_back(parent_id);
+            }
+        });
+    }
+
+    for (const auto& relation : relations.select<osmium::Relation>()) {
+        if (parent_relations.get(relation.positive_id()) ||
+            (m_add_self && m_ids(osmium::item_type::relation).get(relation.positive_id()))) {
+            writer(relation);
+        }
+    }
+}
+
+bool CommandGetParents::run() {
+    m_vout << "Opening input file...\n";
+    const auto read_metadata = has_metadata_output(m_output_file) ? osmium::io::read_meta::yes : osmium::io::read_meta::no;
+    osmium::io::Reader reader{m_input_file, get_needed_types(), read_metadata};
+
+    m_vout << "Opening output file...\n";
+    osmium::io::Header header = reader.header();
+    setup_header(header);
+
+    osmium::io::Writer writer{m_output_file, header, m_output_overwrite, m_fsync};
+
+    m_vout << "Copying matching objects to output file...\n";
+    osmium::ProgressBar progress_bar{reader.file_size(), display_progress()};
+    if (m_recursive) {
+        copy_parents_recursive(reader, writer, progress_bar);
+    } else {
+        copy_parents(reader, writer, progress_bar);
+    }
     progress_bar.done();
 
     m_vout << "Closing output file...\n";
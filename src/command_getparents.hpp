@@ -24,14 +24,18 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
 #include "cmd.hpp" // IWYU pragma: export
+#include "id_file.hpp"
 
 #include <osmium/fwd.hpp>
 #include <osmium/index/id_set.hpp>
 #include <osmium/index/nwr_array.hpp>
-#include <osmium/index/relations_map.hpp>
+#include <osmium/io/reader.hpp>
+#include <osmium/io/writer.hpp>
+#include <osmium/memory/buffer.hpp>
 #include <osmium/osm/entity_bits.hpp>
 #include <osmium/osm/item_type.hpp>
 #include <osmium/osm/types.hpp>
+#include <osmium/util/progress_bar.hpp>
 
 #include <cstddef>
 #include <iosfwd>
@@ -40,15 +44,22 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 class CommandGetParents : public Command, public with_single_osm_input, public with_osm_output {
 
-    osmium::nwr_array<osmium::index::IdSetDense<osmium::unsigned_object_id_type>> m_ids;
+    ids_type m_ids;
 
     osmium::item_type m_default_item_type = osmium::item_type::node;
 
     bool m_add_self = false;
+    bool m_recursive = false;
     bool m_verbose_ids = false;
 
     osmium::osm_entity_bits::type get_needed_types() const;
 
+    bool is_parent_or_self(const osmium::OSMObject& object) const noexcept;
+    osmium::memory::Buffer filter_buffer(const osmium::memory::Buffer& buffer) const;
+
+    void copy_parents(osmium::io::Reader& reader, osmium::io::Writer& writer, osmium::ProgressBar& progress_bar);
+    void copy_parents_recursive(osmium::io::Reader& reader, osmium::io::Writer& writer, osmium::ProgressBar& progress_bar);
+
     void add_nodes(const osmium::Way& way);
     void add_members(const osmium::Relation& relation);
 
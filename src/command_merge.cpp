@@ -21,9 +21,14 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
 #include "command_merge.hpp"
+#include "exception.hpp"
+#include "pbf_blocks.hpp"
+#include "temp_files.hpp"
 #include "util.hpp"
 
+#include <osmium/io/error.hpp>
 #include <osmium/io/file.hpp>
+#include <osmium/io/file_format.hpp>
 #include <osmium/io/header.hpp>
 #include <osmium/io/input_iterator.hpp>
 #include <osmium/io/output_iterator.hpp>
@@ -32,21 +37,31 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <osmium/io/writer.hpp>
 #include <osmium/memory/buffer.hpp>
 #include <osmium/osm/entity_bits.hpp>
+#include <osmium/osm/item_type.hpp>
 #include <osmium/osm/object.hpp>
+#include <osmium/osm/types.hpp>
+#include <osmium/util/progress_bar.hpp>
 #include <osmium/util/verbose_output.hpp>
 
 #include <boost/program_options.hpp>
 
 #include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <iterator>
 #include <memory>
 #include <numeric>
-#include <queue>
 #include <string>
+#include <tuple>
 #include <utility>
 #include <vector>
 
 bool CommandMerge::setup(const std::vector<std::string>& arguments) {
     po::options_description opts_cmd{"COMMAND OPTIONS"};
+    opts_cmd.add_options()
+    ("copy-blocks", "Copy PBF blocks not overlapping with other inputs without decoding them")
+    ;
 
     po::options_description opts_common{add_common_options()};
     po::options_description opts_input{add_multiple_inputs_options()};
@@ -75,86 +90,478 @@ bool CommandMerge::setup(const std::vector<std::string>& arguments) {
     setup_input_files(vm);
     setup_output_file(vm);
 
+    if (vm.count("copy-blocks")) {
+        for (const auto& file : m_input_files) {
+            if (file.format() != osmium::io::file_format::pbf) {
+                throw argument_error{"The --copy-blocks option only works with PBF input files."};
+            }
+            if (is_stdin_or_pipe(file.filename())) {
+                throw argument_error{"Can not use --copy-blocks when reading from STDIN."};
+            }
+        }
+        if (m_output_file.format() != osmium::io::file_format::pbf) {
+            throw argument_error{"The --copy-blocks option only works with PBF output files."};
+        }
+        m_copy_blocks = true;
+    }
+
     return true;
 }
 
 void CommandMerge::show_arguments() {
     show_multiple_inputs_arguments(m_vout);
     show_output_arguments(m_vout);
+
+    m_vout << "  other options:\n";
+    m_vout << "    copy PBF blocks: " << yes_no(m_copy_blocks);
 }
 
 namespace {
 
+    /**
+     * The part of an object needed for sorting. Cached in the data source
+     * so comparisons don't have to go to the object itself.
+     */
+    struct object_key {
+
+        osmium::item_type type = osmium::item_type::undefined;
+        bool positive = false;
+        osmium::unsigned_object_id_type id = 0;
+        osmium::object_version_type version = 0;
+        std::uint32_t timestamp = 0;
+
+        object_key() noexcept = default;
+
+        explicit object_key(const osmium::OSMObject& object) noexcept :
+            type(object.type()),
+            positive(object.id() > 0),
+            id(object.positive_id()),
+            version(object.version()),
+            timestamp(object.timestamp().seconds_since_epoch()) {
+        }
+
+    }; // struct object_key
+
+    bool operator<(const object_key& lhs, const object_key& rhs) noexcept {
+        return std::tie(lhs.type, lhs.positive, lhs.id, lhs.version, lhs.timestamp) <
+               std::tie(rhs.type, rhs.positive, rhs.id, rhs.version, rhs.timestamp);
+    }
+
+    bool operator==(const object_key& lhs, const object_key& rhs) noexcept {
+        return std::tie(lhs.type, lhs.positive, lhs.id, lhs.version, lhs.timestamp) ==
+               std::tie(rhs.type, rhs.positive, rhs.id, rhs.version, rhs.timestamp);
+    }
+
     class DataSource {
 
         using it_type = osmium::io::InputIterator<osmium::io::Reader, osmium::OSMObject>;
 
         std::unique_ptr<osmium::io::Reader> reader;
         it_type iterator;
+        object_key key;
 
     public:
 
         explicit DataSource(const osmium::io::File& file) :
             reader(new osmium::io::Reader{file}),
             iterator(*reader) {
+            if (!empty()) {
+                key = object_key{*iterator};
+            }
         }
 
         bool empty() const noexcept {
             return iterator == it_type{};
         }
 
-        bool next() noexcept {
+        bool next() {
             ++iterator;
-            return iterator != it_type{};
+            if (iterator == it_type{}) {
+                return false;
+            }
+            key = object_key{*iterator};
+            return true;
         }
 
         const osmium::OSMObject* get() noexcept {
             return &*iterator;
         }
 
+        const object_key& get_key() const noexcept {
+            return key;
+        }
+
         std::size_t offset() const noexcept {
             return reader->offset();
         }
 
     }; // DataSource
 
-    class QueueElement {
+    /**
+     * Tournament tree of losers over the data sources. The root always
+     * has the data source with the smallest current object, after it was
+     * advanced only the matches on the path from its leaf to the root
+     * have to be replayed, that's log2(N) comparisons of cached keys.
+     */
+    class LoserTree {
+
+        std::vector<DataSource>& m_data_sources;
+
+        // Internal nodes 1 .. N-1 contain the index of the data source
+        // that lost the match in this node, the leaves are implicit.
+        std::vector<std::size_t> m_tree;
+        std::size_t m_winner = 0;
+
+        // Does data source a win against b? Empty data sources always
+        // lose, ties are won by the data source with the larger index.
+        // Of several equal objects only the first one is written, so this
+        // keeps the object from the last input file as merge always did.
+        bool wins(std::size_t a, std::size_t b) const noexcept {
+            if (m_data_sources[a].empty()) {
+                return false;
+            }
+            if (m_data_sources[b].empty()) {
+                return true;
+            }
+            const auto& key_a = m_data_sources[a].get_key();
+            const auto& key_b = m_data_sources[b].get_key();
+            if (key_a < key_b) {
+                return true;
+            }
+            if (key_b < key_a) {
+                return false;
+            }
+            return a > b;
+        }
 
-        const osmium::OSMObject* m_object;
-        int m_data_source_index;
+        std::size_t init(std::size_t node) {
+            if (node >= m_data_sources.size()) {
+                return node - m_data_sources.size();
+            }
+            const auto left = init(node * 2);
+            const auto right = init(node * 2 + 1);
+            if (wins(left, right)) {
+                m_tree[node] = right;
+                return left;
+            }
+            m_tree[node] = left;
+            return right;
+        }
 
     public:
 
-        QueueElement(const osmium::OSMObject* object, int data_source_index) noexcept :
-            m_object(object),
-            m_data_source_index(data_source_index) {
+        explicit LoserTree(std::vector<DataSource>& data_sources) :
+            m_data_sources(data_sources),
+            m_tree(data_sources.size()) {
+            m_winner = init(1);
         }
 
-        const osmium::OSMObject& object() const noexcept {
-            return *m_object;
+        bool empty() const noexcept {
+            return m_data_sources[m_winner].empty();
         }
 
-        int data_source_index() const noexcept {
-            return m_data_source_index;
+        DataSource& top() noexcept {
+            return m_data_sources[m_winner];
+        }
+
+        // Advance the winning data source and replay its matches.
+        void next() {
+            m_data_sources[m_winner].next();
+            auto winner = m_winner;
+            for (auto node = (winner + m_data_sources.size()) / 2; node > 0; node /= 2) {
+                if (wins(m_tree[node], winner)) {
+                    using std::swap;
+                    swap(m_tree[node], winner);
+                }
+            }
+            m_winner = winner;
         }
 
-    }; // QueueElement
+    }; // class LoserTree
 
-    bool operator<(const QueueElement& lhs, const QueueElement& rhs) noexcept {
-        return lhs.object() > rhs.object();
+    void merge_data_sources(std::vector<DataSource>& data_sources, osmium::io::Writer& writer, osmium::ProgressBar& progress_bar) {
+        LoserTree tree{data_sources};
+
+        bool have_last_key = false;
+        object_key last_key;
+        int n = 0;
+        while (!tree.empty()) {
+            auto& source = tree.top();
+            if (!have_last_key || !(source.get_key() == last_key)) {
+                writer(*source.get());
+                last_key = source.get_key();
+                have_last_key = true;
+            }
+
+            tree.next();
+
+            if (n++ > 10000) {
+                n = 0;
+                progress_bar.update(std::accumulate(data_sources.cbegin(), data_sources.cend(), static_cast<std::size_t>(0), [](std::size_t sum, const DataSource& source){
+                    return sum + source.offset();
+                }));
+            }
+        }
+    }
+
+    struct pbf_block_info {
+        std::size_t file;
+        std::size_t offset;
+        pbf_object_key min;
+        pbf_object_key max;
+        bool duplicate;
+    };
+
+    bool same_key(const pbf_object_key& lhs, const pbf_object_key& rhs) noexcept {
+        return !(lhs < rhs) && !(rhs < lhs);
     }
 
-    bool operator==(const QueueElement& lhs, const QueueElement& rhs) noexcept {
-        return lhs.object() == rhs.object();
+    void read_block(PBFBlockReader& reader, std::size_t offset, pbf_block& block) {
+        reader.seek(offset);
+        if (!reader.read(block)) {
+            throw osmium::io_error{"Unexpected end of PBF file"};
+        }
+    }
+
+    void copy_block(PBFBlockReader& reader, std::size_t offset, PBFBlockWriter& writer) {
+        pbf_block block;
+        read_block(reader, offset, block);
+        writer.write(block);
     }
 
-    bool operator!=(const QueueElement& lhs, const QueueElement& rhs) noexcept {
-        return !(lhs == rhs);
+    /**
+     * Do the blocks contain exactly the same objects? Blocks can be
+     * encoded differently (compression, order of the string table, dense
+     * or normal nodes) and still contain the same objects, those are
+     * compared after decoding them.
+     */
+    bool same_objects(const pbf_block& block1, const pbf_block& block2) {
+        if (block1.data == block2.data) {
+            return true;
+        }
+
+        const auto buffer1 = decode_pbf_block(block1, osmium::osm_entity_bits::nwr);
+        const auto buffer2 = decode_pbf_block(block2, osmium::osm_entity_bits::nwr);
+
+        // Objects with the same contents have the same representation
+        // in the buffer.
+        auto it1 = buffer1.cbegin<osmium::OSMObject>();
+        auto it2 = buffer2.cbegin<osmium::OSMObject>();
+        for (; it1 != buffer1.cend<osmium::OSMObject>() && it2 != buffer2.cend<osmium::OSMObject>(); ++it1, ++it2) {
+            if (it1->byte_size() != it2->byte_size() ||
+                !std::equal(it1->data(), it1->data() + it1->byte_size(), it2->data())) {
+                return false;
+            }
+        }
+
+        return it1 == buffer1.cend<osmium::OSMObject>() && it2 == buffer2.cend<osmium::OSMObject>();
+    }
+
+    /**
+     * Mark blocks which contain exactly the same objects as a block from
+     * another input file as duplicates. They don't have to be decoded and
+     * merged. The blocks must be sorted by their min key. Candidates are
+     * blocks with the same ID range, their contents are then compared.
+     * Returns the number of duplicates found.
+     */
+    std::size_t mark_duplicate_blocks(std::vector<pbf_block_info>& blocks, std::vector<std::unique_ptr<PBFBlockReader>>& readers) {
+        std::size_t count = 0;
+        pbf_block block1;
+        pbf_block block2;
+        for (auto it = blocks.begin(); it != blocks.end(); ++it) {
+            // Only blocks with the same min key can be the same, they
+            // are next to each other after sorting.
+            for (auto prev = it; prev != blocks.begin() && same_key(std::prev(prev)->min, it->min);) {
+                --prev;
+                if (prev->duplicate || prev->file == it->file || !same_key(prev->max, it->max)) {
+                    continue;
+                }
+                read_block(*readers[prev->file], prev->offset, block1);
+                read_block(*readers[it->file], it->offset, block2);
+                if (same_objects(block1, block2)) {
+                    it->duplicate = true;
+                    ++count;
+                    break;
+                }
+            }
+        }
+        return count;
     }
 
 } // anonymous namespace
 
+bool CommandMerge::run_copy_blocks() {
+    std::vector<std::unique_ptr<PBFBlockReader>> readers;
+    std::vector<pbf_block_info> blocks;
+    bool has_multiple_object_versions = false;
+    osmium::io::Header features_header;
+
+    m_vout << "Reading ID ranges of all blocks in input files...\n";
+    osmium::ProgressBar progress_bar{file_size_sum(m_input_files), display_progress()};
+    pbf_block block;
+    for (std::size_t i = 0; i < m_input_files.size(); ++i) {
+        readers.emplace_back(new PBFBlockReader{m_input_files[i].filename()});
+        auto& reader = *readers.back();
+        if (!reader.read(block) || block.type != "OSMHeader") {
+            throw osmium::io_error{"Missing header block in PBF file '" + m_input_files[i].filename() + "'"};
+        }
+        const auto input_header = decode_pbf_header(block);
+        has_multiple_object_versions = has_multiple_object_versions || input_header.has_multiple_object_versions();
+        if (i == 0) {
+            copy_pbf_features(input_header, features_header);
+        } else if (get_pbf_features(input_header) != get_pbf_features(features_header)) {
+            // The blocks are copied as they are, so the output header
+            // must declare the same features as all input headers.
+            throw argument_error{"Can not use --copy-blocks with input files which use different PBF features."};
+        }
+
+        for (;;) {
+            pbf_block_info info;
+            info.file = i;
+            info.offset = reader.offset();
+            if (!reader.read(block)) {
+                break;
+            }
+            if (block.type == "OSMData" && get_pbf_block_range(block, info.min, info.max)) {
+                info.duplicate = false;
+                blocks.push_back(info);
+            }
+            progress_bar.update(reader.offset());
+        }
+        progress_bar.file_done(reader.offset());
+    }
+    progress_bar.done();
+
+    std::stable_sort(blocks.begin(), blocks.end(), [](const pbf_block_info& lhs, const pbf_block_info& rhs) {
+        return lhs.min < rhs.min;
+    });
+
+    m_vout << "Looking for identical blocks in different input files...\n";
+    const auto blocks_duplicate = mark_duplicate_blocks(blocks, readers);
+    blocks.erase(std::remove_if(blocks.begin(), blocks.end(), [](const pbf_block_info& info) {
+        return info.duplicate;
+    }), blocks.end());
+
+    // Overlapping blocks are decoded and encoded again, which only keeps
+    // the node locations on ways of all the features.
+    bool locations_on_ways = false;
+    for (const auto& feature : get_pbf_features(features_header)) {
+        if (feature != "optional LocationsOnWays") {
+            throw argument_error{"Can not use --copy-blocks with input files which use PBF feature '" + feature + "'."};
+        }
+        locations_on_ways = true;
+    }
+
+    m_vout << "Opening output file...\n";
+    osmium::io::Header header;
+    header.set_has_multiple_object_versions(has_multiple_object_versions);
+    copy_pbf_features(features_header, header);
+    setup_header(header);
+
+    PBFBlockWriter writer{m_output_file.filename(), header, m_output_overwrite, m_fsync};
+
+    osmium::io::Header temp_header;
+    temp_header.set_has_multiple_object_versions(has_multiple_object_versions);
+    copy_pbf_features(features_header, temp_header);
+    TempFiles temp_files{default_temp_directory(), "osmium-merge", ".osm.pbf"};
+    osmium::ProgressBar no_progress_bar{0, false};
+
+    m_vout << "Copying and merging " << blocks.size() << " blocks...\n";
+    std::size_t blocks_copied = 0;
+    std::size_t blocks_merged = 0;
+    for (auto it = blocks.begin(); it != blocks.end();) {
+        // Find all blocks overlapping with this one directly or through
+        // other blocks.
+        auto end = std::next(it);
+        auto cluster_max = it->max;
+        bool single_file = true;
+        while (end != blocks.end() && !(cluster_max < end->min)) {
+            if (end->file != it->file) {
+                single_file = false;
+            }
+            if (cluster_max < end->max) {
+                cluster_max = end->max;
+            }
+            ++end;
+        }
+
+        if (single_file) {
+            for (; it != end; ++it) {
+                copy_block(*readers[it->file], it->offset, writer);
+                ++blocks_copied;
+            }
+            continue;
+        }
+
+        // Overlapping blocks from several input files: Write the blocks
+        // from each file into a temporary file, merge those normally
+        // and copy the resulting blocks to the output.
+        std::vector<pbf_block_info> cluster(it, end);
+        std::sort(cluster.begin(), cluster.end(), [](const pbf_block_info& lhs, const pbf_block_info& rhs) {
+            return std::tie(lhs.file, lhs.offset) < std::tie(rhs.file, rhs.offset);
+        });
+        blocks_merged += cluster.size();
+
+        std::vector<std::string> temp_inputs;
+        for (auto cit = cluster.begin(); cit != cluster.end();) {
+            temp_inputs.push_back(temp_files.create());
+            PBFBlockWriter temp_writer{temp_inputs.back(), temp_header, osmium::io::overwrite::allow, osmium::io::fsync::no};
+            const auto file = cit->file;
+            for (; cit != cluster.end() && cit->file == file; ++cit) {
+                copy_block(*readers[file], cit->offset, temp_writer);
+            }
+            temp_writer.close();
+        }
+
+        const std::string temp_output{temp_files.create()};
+        {
+            std::vector<DataSource> data_sources;
+            data_sources.reserve(temp_inputs.size());
+            for (const auto& filename : temp_inputs) {
+                data_sources.emplace_back(osmium::io::File{filename, "pbf"});
+            }
+
+            osmium::io::File temp_output_file{temp_output, "pbf"};
+            if (locations_on_ways) {
+                temp_output_file.set("locations_on_ways");
+            }
+            osmium::io::Writer temp_writer{temp_output_file, temp_header, osmium::io::overwrite::allow};
+            merge_data_sources(data_sources, temp_writer, no_progress_bar);
+            temp_writer.close();
+        }
+
+        PBFBlockReader temp_reader{temp_output};
+        while (temp_reader.read(block)) {
+            if (block.type == "OSMData") {
+                writer.write(block);
+            }
+        }
+
+        for (const auto& filename : temp_inputs) {
+            std::remove(filename.c_str());
+        }
+        std::remove(temp_output.c_str());
+
+        it = end;
+    }
+
+    m_vout << "Copied " << blocks_copied << " blocks, decoded and merged " << blocks_merged
+           << " blocks, skipped " << blocks_duplicate << " identical blocks.\n";
+
+    m_vout << "Closing output file...\n";
+    writer.close();
+
+    show_memory_used();
+    m_vout << "Done.\n";
+
+    return true;
+}
+
 bool CommandMerge::run() {
+    if (m_copy_blocks) {
+        return run_copy_blocks();
+    }
+
     m_vout << "Opening output file...\n";
     osmium::io::Header header;
     setup_header(header);
@@ -194,39 +601,11 @@ bool CommandMerge::run() {
         std::vector<DataSource> data_sources;
         data_sources.reserve(m_input_files.size());
 
-        std::priority_queue<QueueElement> queue;
-
-        int index = 0;
         for (const osmium::io::File& file : m_input_files) {
             data_sources.emplace_back(file);
-
-            if (!data_sources.back().empty()) {
-                queue.emplace(data_sources.back().get(), index);
-            }
-
-            ++index;
         }
 
-        int n = 0;
-        while (!queue.empty()) {
-            const auto element = queue.top();
-            queue.pop();
-            if (queue.empty() || element != queue.top()) {
-                writer(element.object());
-            }
-
-            const int index = element.data_source_index();
-            if (data_sources[index].next()) {
-                queue.emplace(data_sources[index].get(), index);
-            }
-
-            if (n++ > 10000) {
-                n = 0;
-                progress_bar.update(std::accumulate(data_sources.cbegin(), data_sources.cend(), static_cast<std::size_t>(0), [](std::size_t sum, const DataSource& source){
-                    return sum + source.offset();
-                }));
-            }
-        }
+        merge_data_sources(data_sources, writer, progress_bar);
     }
 
     m_vout << "Closing output file...\n";
@@ -20,7 +20,11 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 */
 
+#include "change_stream.hpp"
+#include "chunked_reader.hpp"
 #include "command_merge_changes.hpp"
+#include "exception.hpp"
+#include "object_sort.hpp"
 #include "util.hpp"
 
 #include <osmium/io/file.hpp>
@@ -31,7 +35,10 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <osmium/memory/buffer.hpp>
 #include <osmium/object_pointer_collection.hpp>
 #include <osmium/osm/entity_bits.hpp>
+#include <osmium/osm/object.hpp>
 #include <osmium/osm/object_comparisons.hpp>
+#include <osmium/thread/pool.hpp>
+#include <osmium/util/file.hpp>
 #include <osmium/util/progress_bar.hpp>
 #include <osmium/util/verbose_output.hpp>
 #include <osmium/visitor.hpp>
@@ -39,6 +46,11 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <boost/program_options.hpp>
 
 #include <algorithm>
+#include <cstddef>
+#include <future>
+#include <iterator>
+#include <memory>
+#include <queue>
 #include <string>
 #include <utility>
 #include <vector>
@@ -47,6 +59,8 @@ bool CommandMergeChanges::setup(const std::vector<std::string>& arguments) {
     po::options_description opts_cmd{"COMMAND OPTIONS"};
     opts_cmd.add_options()
     ("simplify,s", "Simplify change")
+    ("sorted-changes", "Change files are sorted, merge them without reading them into memory")
+    ("parse-threads", po::value<int>(), "Number of threads for parsing XML and OPL change files (default: 1)")
     ;
 
     po::options_description opts_common{add_common_options()};
@@ -80,12 +94,159 @@ bool CommandMergeChanges::setup(const std::vector<std::string>& arguments) {
         m_simplify_change = true;
     }
 
+    if (vm.count("sorted-changes")) {
+        m_sorted_changes = true;
+    }
+
+    // All changes are read into memory unless they are sorted. Osmium
+    // can't know whether they are, so it can only warn.
+    if (!m_sorted_changes && m_memory_budget > 0 && !fits_memory_budget(estimate_buffer_memory(m_input_files))) {
+        warning("The change files probably don't fit into the memory budget. Use --sorted-changes if they are sorted.\n");
+    }
+
+    if (vm.count("parse-threads")) {
+        m_parse_threads = vm["parse-threads"].as<int>();
+        if (m_parse_threads < 1) {
+            throw argument_error{"The --parse-threads option needs a positive number."};
+        }
+    }
+
     return true;
 }
 
 void CommandMergeChanges::show_arguments() {
     show_multiple_inputs_arguments(m_vout);
     show_output_arguments(m_vout);
+
+    m_vout << "  other options:\n";
+    m_vout << "    simplify: " << yes_no(m_simplify_change);
+    m_vout << "    sorted change files: " << yes_no(m_sorted_changes);
+    m_vout << "    parse threads: " << m_parse_threads << '\n';
+}
+
+// Merge the sorted change files reading them all at the same time. Only
+// the current buffer of each file is kept in memory.
+void CommandMergeChanges::merge_sorted_changes(osmium::io::Writer& writer) {
+    ChangeStream changes{m_input_files};
+    osmium::ProgressBar progress_bar{file_size_sum(m_input_files), display_progress()};
+
+    int n = 0;
+    const auto update_progress = [&]() {
+        if (n++ > 10000) {
+            n = 0;
+            progress_bar.update(changes.offset());
+        }
+    };
+
+    if (m_simplify_change) {
+        // Of all versions of an object only the last one is written.
+        osmium::memory::Buffer last_change{1024 * 1024, osmium::memory::Buffer::auto_grow::yes};
+        const osmium::object_equal_type_id equal{};
+
+        while (!changes.empty()) {
+            last_change.clear();
+            last_change.add_item(changes.top());
+            last_change.commit();
+            changes.next();
+            update_progress();
+            while (!changes.empty() && equal(changes.top(), *last_change.begin<osmium::OSMObject>())) {
+                last_change.clear();
+                last_change.add_item(changes.top());
+                last_change.commit();
+                changes.next();
+                update_progress();
+            }
+            writer(*last_change.begin<osmium::OSMObject>());
+        }
+    } else {
+        while (!changes.empty()) {
+            writer(changes.top());
+            changes.next();
+            update_progress();
+        }
+    }
+
+    progress_bar.done();
+    changes.close();
+}
+
+// Sort the objects of each input file (given by the bounds into
+// objects) in the thread pool and merge them while writing. Change files
+// are usually sorted already, then there is nothing to sort.
+void CommandMergeChanges::sort_and_merge_files(osmium::ObjectPointerCollection& objects, const std::vector<std::size_t>& bounds, osmium::io::Writer& writer) {
+    using iterator = decltype(objects.ptr_begin());
+    const osmium::object_order_type_id_version order{};
+
+    m_vout << "Sorting change data of each file...\n";
+    {
+        auto& pool = thread_pool();
+        std::vector<std::future<void>> futures;
+        futures.reserve(bounds.size() - 1);
+        for (std::size_t i = 0; i + 1 < bounds.size(); ++i) {
+            const iterator begin = objects.ptr_begin() + static_cast<std::ptrdiff_t>(bounds[i]);
+            const iterator end = objects.ptr_begin() + static_cast<std::ptrdiff_t>(bounds[i + 1]);
+            futures.push_back(pool.submit([begin, end, order]() {
+                if (!std::is_sorted(begin, end, order) && !radix_sort_objects(begin, end, 1)) {
+                    std::sort(begin, end, order);
+                }
+            }));
+        }
+        for (auto& future : futures) {
+            future.get();
+        }
+    }
+
+    m_vout << (m_simplify_change ? "Merging files writing last version of each object to output...\n"
+                                 : "Merging files writing all objects to output...\n");
+
+    // The same object version from several files is taken from the
+    // files in the order they were given.
+    struct cursor {
+        iterator it;
+        iterator end;
+        std::size_t file;
+    };
+    const auto later = [&order](const cursor& lhs, const cursor& rhs) {
+        if (order(*rhs.it, *lhs.it)) {
+            return true;
+        }
+        if (order(*lhs.it, *rhs.it)) {
+            return false;
+        }
+        return lhs.file > rhs.file;
+    };
+    std::priority_queue<cursor, std::vector<cursor>, decltype(later)> queue{later};
+    for (std::size_t i = 0; i + 1 < bounds.size(); ++i) {
+        if (bounds[i] != bounds[i + 1]) {
+            queue.push(cursor{objects.ptr_begin() + static_cast<std::ptrdiff_t>(bounds[i]),
+                              objects.ptr_begin() + static_cast<std::ptrdiff_t>(bounds[i + 1]),
+                              i});
+        }
+    }
+
+    // With --simplify an object is only written when the next object is
+    // a different one, so only its last version is written.
+    const osmium::object_equal_type_id equal{};
+    const osmium::OSMObject* last = nullptr;
+    while (!queue.empty()) {
+        auto top = queue.top();
+        queue.pop();
+        const osmium::OSMObject* object = *top.it;
+        if (!m_simplify_change) {
+            writer(*object);
+        } else {
+            if (last && !equal(*last, *object)) {
+                writer(*last);
+            }
+            last = object;
+        }
+        if (++top.it != top.end) {
+            queue.push(top);
+        }
+    }
+    if (last) {
+        writer(*last);
+    }
 }
 
 bool CommandMergeChanges::run() {
@@ -94,6 +255,20 @@ bool CommandMergeChanges::run() {
     setup_header(header);
 
     osmium::io::Writer writer{m_output_file, header, m_output_overwrite, m_fsync};
+
+    if (m_sorted_changes) {
+        m_vout << "Merging sorted change files...\n";
+        merge_sorted_changes(writer);
+
+        m_vout << "Closing output file...\n";
+        writer.close();
+
+        show_memory_used();
+        m_vout << "Done.\n";
+
+        return true;
+    }
+
     auto out = osmium::io::make_output_iterator(writer);
 
     // this will contain all the buffers with the input data
@@ -105,7 +280,29 @@ bool CommandMergeChanges::run() {
     // to each object to objects collection.
     m_vout << "Reading change file contents...\n";
     osmium::ProgressBar progress_bar{file_size_sum(m_input_files), display_progress()};
+
+    std::unique_ptr<osmium::thread::Pool> parse_pool;
+    if (m_parse_threads > 1) {
+        parse_pool.reset(new osmium::thread::Pool{m_parse_threads});
+    }
+
+    // Start of the objects from each file in objects (and the end).
+    std::vector<std::size_t> bounds{0};
     for (osmium::io::File& change_file : m_input_files) {
+        if (bounds.back() != objects.size()) {
+            bounds.push_back(objects.size());
+        }
+        if (parse_pool && ChunkedReader::supports(change_file)) {
+            ChunkedReader reader{change_file, osmium::osm_entity_bits::object, *parse_pool};
+            while (osmium::memory::Buffer buffer = reader.read()) {
+                progress_bar.update(reader.offset());
+                osmium::apply(buffer, objects);
+                changes.push_back(std::move(buffer));
+            }
+            progress_bar.file_done(osmium::file_size(change_file.filename()));
+            reader.close();
+            continue;
+        }
         osmium::io::Reader reader{change_file, osmium::osm_entity_bits::object};
         while (osmium::memory::Buffer buffer = reader.read()) {
             progress_bar.update(reader.offset());
@@ -115,23 +312,49 @@ bool CommandMergeChanges::run() {
         progress_bar.file_done(reader.file_size());
         reader.close();
     }
+    if (bounds.back() != objects.size()) {
+        bounds.push_back(objects.size());
+    }
     progress_bar.done();
+    parse_pool.reset();
+
+    if (m_threads > 1 && bounds.size() > 2) {
+        sort_and_merge_files(objects, bounds, writer);
+
+        m_vout << "Closing output file...\n";
+        writer.close();
+
+        show_memory_used();
+        m_vout << "Done.\n";
+
+        return true;
+    }
 
     // Now we sort all objects and write them in order into the
     // output_buffer, flushing the output_buffer whenever it is full.
+    // The sort is stable, so the same object version from several files
+    // stays in the order of the files.
+    m_vout << "Sorting change data...\n";
+    if (!radix_sort_objects(objects.ptr_begin(), objects.ptr_end(), m_parse_threads)) {
+        std::stable_sort(objects.ptr_begin(), objects.ptr_end(), osmium::object_order_type_id_version());
+    }
+
     if (m_simplify_change) {
-        // If the --simplify option was given we sort with the
-        // largest version of each object first and then only
-        // copy this last version of any object to the output_buffer.
-        m_vout << "Sorting change data...\n";
-        objects.sort(osmium::object_order_type_id_reverse_version());
+        // If the --simplify option was given we only copy the last
+        // version of any object to the output_buffer. Like in the
+        // merges above this is the one from the last file if several
+        // files have the same version.
         m_vout << "Writing last version of each object to output...\n";
-        std::unique_copy(objects.cbegin(), objects.cend(), out, osmium::object_equal_type_id());
+        const osmium::object_equal_type_id equal{};
+        for (auto it = objects.cbegin(); it != objects.cend(); ++it) {
+            const auto next = std::next(it);
+            if (next == objects.cend() || !equal(*it, *next)) {
+                writer(*it);
+            }
+        }
     } else {
         // If the --simplify option was not given, this
-        // is a straightforward sort and copy.
-        m_vout << "Sorting change data...\n";
-        objects.sort(osmium::object_order_type_id_version());
+        // is a straightforward copy.
         m_vout << "Writing all objects to output...\n";
         std::copy(objects.cbegin(), objects.cend(), out);
     }
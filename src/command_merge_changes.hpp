@@ -25,12 +25,21 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "cmd.hpp" // IWYU pragma: export
 
+#include <osmium/io/writer.hpp>
+#include <osmium/object_pointer_collection.hpp>
+
+#include <cstddef>
 #include <string>
 #include <vector>
 
 class CommandMergeChanges : public Command, public with_multiple_osm_inputs, public with_osm_output {
 
     bool m_simplify_change = false;
+    bool m_sorted_changes = false;
+    int m_parse_threads = 1;
+
+    void merge_sorted_changes(osmium::io::Writer& writer);
+    void sort_and_merge_files(osmium::ObjectPointerCollection& objects, const std::vector<std::size_t>& bounds, osmium::io::Writer& writer);
 
 public:
 
@@ -0,0 +1,281 @@
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "command_pipeline.hpp"
+#include "exception.hpp"
+
+#include <boost/program_options.hpp>
+
+#include <cerrno>
+#include <csignal>
+#include <cstddef>
+#include <exception>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifndef _WIN32
+# include <fcntl.h>
+# include <unistd.h>
+#endif
+
+// Separates the commands on the command line.
+static const char* const stage_separator = "+";
+
+// Format of the data passed between the stages. Compressing it would
+// only cost time.
+static const char* const pipe_format = "pbf,pbf_compression=none";
+
+static std::string fd_filename(int fd) {
+    return "/dev/fd/" + std::to_string(fd);
+}
+
+#ifndef _WIN32
+// The pipes between the stages have the close-on-exec flag set, so that
+// child processes started by any stage (like curl for remote files) don't
+// keep them open and the next stage sees the end of the data. A stage
+// opens its end through /dev/fd which gives it a new descriptor, so the
+// flag doesn't have to be cleared for that.
+static int make_pipe(int fds[2]) {
+#ifdef __linux__
+    return ::pipe2(fds, O_CLOEXEC);
+#else
+    if (::pipe(fds) != 0) {
+        return -1;
+    }
+    ::fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    ::fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    return 0;
+#endif
+}
+#endif
+
+CommandPipeline::~CommandPipeline() noexcept {
+    close_pipes();
+}
+
+void CommandPipeline::close_pipes() noexcept {
+#ifndef _WIN32
+    for (auto& st : m_stages) {
+        if (st.read_fd >= 0) {
+            ::close(st.read_fd);
+            st.read_fd = -1;
+        }
+        if (st.write_fd >= 0) {
+            ::close(st.write_fd);
+            st.write_fd = -1;
+        }
+    }
+#endif
+}
+
+void CommandPipeline::setup_stage(stage& st, bool first, bool last) {
+    const std::string& command_name = st.arguments.front();
+
+    if (command_name == name() || command_name == "help") {
+        throw argument_error{"Command '" + command_name + "' can not be used in a pipeline."};
+    }
+
+    st.command = m_command_factory.create_command(command_name);
+    if (!st.command) {
+        throw argument_error{"Unknown command '" + command_name + "' in pipeline."};
+    }
+
+    std::vector<std::string> arguments{st.arguments.begin() + 1, st.arguments.end()};
+
+    if (!first) {
+        if (!dynamic_cast<with_single_osm_input*>(st.command.get()) &&
+            !dynamic_cast<with_multiple_osm_inputs*>(st.command.get())) {
+            throw argument_error{"Command '" + command_name + "' can not read OSM data from the previous command in the pipeline."};
+        }
+
+        // The placeholder '-' (STDIN) for the input file is replaced by
+        // the pipe from the previous stage.
+        bool found = false;
+        for (std::size_t i = 0; i < arguments.size(); ++i) {
+            if (arguments[i] == "-" && (i == 0 || (arguments[i - 1] != "-o" && arguments[i - 1] != "--output"))) {
+                arguments[i] = fd_filename(st.read_fd);
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            throw argument_error{"Command '" + command_name + "' in pipeline must have '-' as input file name."};
+        }
+        arguments.emplace_back("--input-format");
+        arguments.emplace_back(pipe_format);
+    }
+
+    if (!last) {
+        if (!dynamic_cast<with_osm_output*>(st.command.get())) {
+            throw argument_error{"Command '" + command_name + "' can not write OSM data to the next command in the pipeline."};
+        }
+        arguments.emplace_back("--output");
+        arguments.emplace_back(fd_filename(st.write_fd));
+        arguments.emplace_back("--output-format");
+        arguments.emplace_back(pipe_format);
+        arguments.emplace_back("--overwrite");
+    }
+
+    if (!st.command->setup(arguments)) {
+        throw argument_error{"Command '" + command_name + "' in pipeline has nothing to do."};
+    }
+}
+
+bool CommandPipeline::setup(const std::vector<std::string>& arguments) {
+    po::options_description opts_common{add_common_options(false)};
+
+    po::options_description desc;
+    desc.add(opts_common);
+
+    // Options for the pipeline command itself come before the first
+    // command name.
+    auto it = arguments.begin();
+    while (it != arguments.end() && !it->empty() && (*it)[0] == '-') {
+        ++it;
+    }
+    const std::vector<std::string> pipeline_arguments{arguments.begin(), it};
+
+    po::variables_map vm;
+    po::store(po::command_line_parser(pipeline_arguments).options(desc).run(), vm);
+    po::notify(vm);
+
+    setup_common(vm, desc);
+
+#ifdef _WIN32
+    throw argument_error{"The pipeline command is not available on Windows."};
+#else
+    m_stages.emplace_back();
+    for (; it != arguments.end(); ++it) {
+        if (*it == stage_separator) {
+            if (m_stages.back().arguments.empty()) {
+                throw argument_error{"Missing command in pipeline."};
+            }
+            m_stages.emplace_back();
+        } else {
+            m_stages.back().arguments.push_back(*it);
+        }
+    }
+
+    if (m_stages.back().arguments.empty()) {
+        throw argument_error{"Missing command in pipeline."};
+    }
+
+    if (m_stages.size() < 2) {
+        throw argument_error{std::string{"Need at least two commands separated by '"} + stage_separator + "'."};
+    }
+
+    for (std::size_t i = 1; i < m_stages.size(); ++i) {
+        int fds[2];
+        if (make_pipe(fds) != 0) {
+            throw std::system_error{errno, std::system_category(), "Creating pipe failed"};
+        }
+        m_stages[i].read_fd = fds[0];
+        m_stages[i - 1].write_fd = fds[1];
+    }
+
+    for (std::size_t i = 0; i < m_stages.size(); ++i) {
+        setup_stage(m_stages[i], i == 0, i == m_stages.size() - 1);
+    }
+
+    return true;
+#endif
+}
+
+void CommandPipeline::show_arguments() {
+    for (std::size_t i = 0; i < m_stages.size(); ++i) {
+        m_vout << "  command " << (i + 1) << ":";
+        for (const auto& argument : m_stages[i].arguments) {
+            m_vout << ' ' << argument;
+        }
+        m_vout << '\n';
+    }
+}
+
+bool CommandPipeline::run() {
+#ifndef _WIN32
+    // If a command stops reading early, the command writing into the pipe
+    // should get an error instead of being killed.
+    std::signal(SIGPIPE, SIG_IGN);
+
+    std::vector<char> results(m_stages.size(), 0);
+    std::vector<std::exception_ptr> errors(m_stages.size());
+    std::vector<std::thread> threads;
+
+    m_vout << "Starting " << m_stages.size() << " commands...\n";
+
+    for (std::size_t i = 0; i < m_stages.size(); ++i) {
+        m_stages[i].command->print_arguments(m_stages[i].arguments.front());
+        threads.emplace_back([this, i, &results, &errors]() {
+            auto& st = m_stages[i];
+            try {
+                results[i] = st.command->run();
+                if (const auto* output = dynamic_cast<const with_osm_output*>(st.command.get())) {
+                    output->finish_output();
+                }
+            } catch (...) {
+                errors[i] = std::current_exception();
+            }
+
+            // Closing our ends of the pipes lets the neighbouring stages
+            // see the end of the data or an error.
+            if (st.write_fd >= 0) {
+                ::close(st.write_fd);
+                st.write_fd = -1;
+            }
+            if (st.read_fd >= 0) {
+                ::close(st.read_fd);
+                st.read_fd = -1;
+            }
+        });
+    }
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    // Errors in later commands are often caused by errors earlier in
+    // the pipeline, so the first one is reported.
+    for (std::size_t i = 0; i < m_stages.size(); ++i) {
+        if (errors[i]) {
+            m_vout << "Command " << (i + 1) << " (" << m_stages[i].arguments.front() << ") failed.\n";
+            std::rethrow_exception(errors[i]);
+        }
+    }
+
+    bool okay = true;
+    for (std::size_t i = 0; i < m_stages.size(); ++i) {
+        if (!results[i]) {
+            m_vout << "Command " << (i + 1) << " (" << m_stages[i].arguments.front() << ") reported an error.\n";
+            okay = false;
+        }
+    }
+
+    m_vout << "Done.\n";
+
+    return okay;
+#else
+    return false;
+#endif
+}
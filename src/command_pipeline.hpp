@@ -0,0 +1,72 @@
+#ifndef COMMAND_PIPELINE_HPP
+#define COMMAND_PIPELINE_HPP
+
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "cmd.hpp" // IWYU pragma: export
+
+#include <memory>
+#include <string>
+#include <vector>
+
+class CommandPipeline : public Command {
+
+    struct stage {
+        std::vector<std::string> arguments;
+        std::unique_ptr<Command> command;
+        int read_fd = -1;  // Pipe from previous stage (-1 for first stage)
+        int write_fd = -1; // Pipe to next stage (-1 for last stage)
+    };
+
+    std::vector<stage> m_stages;
+
+    void setup_stage(stage& st, bool first, bool last);
+
+    void close_pipes() noexcept;
+
+public:
+
+    explicit CommandPipeline(const CommandFactory& command_factory) :
+        Command(command_factory) {
+    }
+
+    ~CommandPipeline() noexcept override;
+
+    bool setup(const std::vector<std::string>& arguments) override final;
+
+    void show_arguments() override final;
+
+    bool run() override final;
+
+    const char* name() const noexcept override final {
+        return "pipeline";
+    }
+
+    const char* synopsis() const noexcept override final {
+        return "osmium pipeline [OPTIONS] COMMAND [ARGS...] + COMMAND [ARGS...]...";
+    }
+
+}; // class CommandPipeline
+
+
+#endif // COMMAND_PIPELINE_HPP
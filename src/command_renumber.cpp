@@ -21,6 +21,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "command_renumber.hpp"
 #include "exception.hpp"
+#include "util.hpp"
 
 #include <osmium/io/detail/read_write.hpp>
 #include <osmium/io/file.hpp>
@@ -30,6 +31,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <osmium/io/writer.hpp>
 #include <osmium/osm.hpp>
 #include <osmium/osm/types_from_string.hpp>
+#include <osmium/thread/pool.hpp>
 #include <osmium/util/file.hpp>
 #include <osmium/util/memory_mapping.hpp>
 #include <osmium/util/progress_bar.hpp>
@@ -39,12 +41,19 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <boost/program_options.hpp>
 
 #include <algorithm>
+#include <cassert>
 #include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
 #include <cstring>
+#include <deque>
 #include <fcntl.h>
 #include <fstream>
+#include <future>
 #include <iostream>
 #include <iterator>
+#include <memory>
 #include <stdexcept>
 #include <string>
 #include <sys/stat.h>
@@ -56,6 +65,142 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 # include <io.h>
 #endif
 
+std::size_t extra_id_table::hash(osmium::object_id_type id) noexcept {
+    auto h = static_cast<uint64_t>(id) * 0x9e3779b97f4a7c15ULL;
+    h ^= h >> 32U;
+    return static_cast<std::size_t>(h);
+}
+
+std::unique_ptr<osmium::TypedMemoryMapping<extra_id_table::slot>> extra_id_table::create_slots(std::size_t capacity, std::string& filename) {
+    if (!m_temp_files) {
+        return std::unique_ptr<osmium::TypedMemoryMapping<slot>>{new osmium::TypedMemoryMapping<slot>{capacity}};
+    }
+
+    filename = m_temp_files->create();
+    const int fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600); // NOLINT(hicpp-signed-bitwise)
+    if (fd < 0) {
+        throw std::runtime_error{std::string{"Could not open temporary file '"} + filename + "': " + std::strerror(errno)};
+    }
+#ifdef _WIN32
+    _setmode(fd, _O_BINARY);
+#endif
+
+    std::unique_ptr<osmium::TypedMemoryMapping<slot>> slots{new osmium::TypedMemoryMapping<slot>{capacity, osmium::MemoryMapping::mapping_mode::write_shared, fd}};
+    close(fd);
+
+    return slots;
+}
+
+void extra_id_table::grow() {
+    const std::size_t new_capacity = capacity() == 0 ? 1024 : capacity() * 2;
+
+    std::string new_filename;
+    auto new_slots = create_slots(new_capacity, new_filename);
+
+    const std::size_t mask = new_capacity - 1;
+    for_each([&](osmium::object_id_type id, osmium::object_id_type value) {
+        std::size_t pos = hash(id) & mask;
+        while (new_slots->begin()[pos].value != 0) {
+            pos = (pos + 1) & mask;
+        }
+        new_slots->begin()[pos] = slot{id, value};
+    });
+
+    m_slots = std::move(new_slots);
+    if (!m_filename.empty()) {
+        std::remove(m_filename.c_str());
+    }
+    m_filename = std::move(new_filename);
+}
+
+extra_id_table::~extra_id_table() noexcept {
+    m_slots.reset();
+    if (!m_filename.empty()) {
+        std::remove(m_filename.c_str());
+    }
+}
+
+osmium::object_id_type extra_id_table::get(osmium::object_id_type id) const noexcept {
+    if (m_size == 0) {
+        return 0;
+    }
+
+    const std::size_t mask = capacity() - 1;
+    for (std::size_t pos = hash(id) & mask;; pos = (pos + 1) & mask) {
+        const slot& s = m_slots->begin()[pos];
+        if (s.value == 0) {
+            return 0;
+        }
+        if (s.id == id) {
+            return s.value;
+        }
+    }
+}
+
+void extra_id_table::set(osmium::object_id_type id, osmium::object_id_type value) {
+    // Keep the load factor below 3/4.
+    if ((m_size + 1) * 4 > capacity() * 3) {
+        grow();
+    }
+
+    const std::size_t mask = capacity() - 1;
+    std::size_t pos = hash(id) & mask;
+    while (m_slots->begin()[pos].value != 0) {
+        pos = (pos + 1) & mask;
+    }
+    m_slots->begin()[pos] = slot{id, value};
+    ++m_size;
+}
+
+id_vector::~id_vector() noexcept {
+    m_data.reset();
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+    if (!m_filename.empty()) {
+        std::remove(m_filename.c_str());
+    }
+}
+
+void id_vector::reserve(std::size_t new_capacity) {
+    if (new_capacity <= capacity()) {
+        return;
+    }
+
+    if (m_data) {
+        m_data->resize(new_capacity);
+        return;
+    }
+
+    if (!m_temp_files) {
+        m_data.reset(new osmium::TypedMemoryMapping<osmium::object_id_type>{new_capacity});
+        return;
+    }
+
+    // The file stays open, the mapping needs it to grow the file.
+    m_filename = m_temp_files->create();
+    m_fd = ::open(m_filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600); // NOLINT(hicpp-signed-bitwise)
+    if (m_fd < 0) {
+        throw std::runtime_error{std::string{"Could not open temporary file '"} + m_filename + "': " + std::strerror(errno)};
+    }
+#ifdef _WIN32
+    _setmode(m_fd, _O_BINARY);
+#endif
+
+    m_data.reset(new osmium::TypedMemoryMapping<osmium::object_id_type>{new_capacity, osmium::MemoryMapping::mapping_mode::write_shared, m_fd});
+}
+
+void id_vector::resize(std::size_t new_size, osmium::object_id_type value) {
+    if (new_size <= m_size) {
+        return;
+    }
+    if (new_size > capacity()) {
+        reserve(std::max(new_size, capacity() * 2));
+    }
+    std::fill(m_data->begin() + m_size, m_data->begin() + new_size, value);
+    m_size = new_size;
+}
+
 osmium::object_id_type id_map::add_offset_to_id(osmium::object_id_type id) const noexcept {
     if (m_start_id < 0) {
         return -id + m_start_id + 1;
@@ -63,49 +208,176 @@ osmium::object_id_type id_map::add_offset_to_id(osmium::object_id_type id) const
     return id + m_start_id - 1;
 }
 
+osmium::object_id_type id_map::base_position(osmium::object_id_type id) const noexcept {
+    if (m_base_size == 0) {
+        return 0;
+    }
+
+    const auto* begin = m_base->begin();
+    const auto* end = begin + m_base_size;
+    const auto* element = std::lower_bound(begin, end, id, [](const id_map_entry& entry, osmium::object_id_type value) {
+        return osmium::id_order{}(entry.id, value);
+    });
+
+    if (element == end || element->id != id) {
+        return 0;
+    }
+    return element->position;
+}
+
 osmium::object_id_type id_map::operator()(osmium::object_id_type id) {
+    // Search for id in the base mappings and return if found.
+    const auto base_pos = base_position(id);
+    if (base_pos != 0) {
+        return add_offset_to_id(base_pos);
+    }
+
     // Search for id in m_extra_ids and return if found.
-    const auto it = m_extra_ids.find(id);
-    if (it != m_extra_ids.end()) {
-        return add_offset_to_id(it->second);
+    const auto extra_id = m_extra_ids.get(id);
+    if (extra_id != 0) {
+        return add_offset_to_id(extra_id);
     }
 
     // New ID is larger than all existing IDs. Add it to end and return.
-    if (m_ids.empty() || osmium::id_order{}(m_ids.back(), id)) {
+    if (!m_frozen && (m_ids.empty() || osmium::id_order{}(m_ids.back(), id))) {
         m_ids.push_back(id);
-        return add_offset_to_id(m_ids.size());
+        return add_offset_to_id(osmium::object_id_type(size()));
     }
 
     const auto element = std::lower_bound(m_ids.cbegin(), m_ids.cend(), id, osmium::id_order{});
     // Old ID not found in m_ids, add to m_extra_ids.
     if (element == m_ids.cend() || *element != id) {
-        m_ids.push_back(m_ids.back());
-        m_extra_ids[id] = m_ids.size();
-        return add_offset_to_id(m_ids.size());
+        if (m_frozen) {
+            ++m_frozen_extra;
+        } else {
+            m_ids.push_back(m_ids.back());
+        }
+        m_extra_ids.set(id, osmium::object_id_type(size()));
+        return add_offset_to_id(osmium::object_id_type(size()));
     }
 
     // Old ID found in m_ids, return.
-    return add_offset_to_id(osmium::object_id_type(std::distance(m_ids.cbegin(), element) + 1));
+    return add_offset_to_id(osmium::object_id_type(m_base_size + std::distance(m_ids.cbegin(), element) + 1));
 }
 
-void id_map::write(int fd) {
-    for (const auto& m : m_extra_ids) {
-        m_ids[m.second - 1] = m.first;
+osmium::object_id_type id_map::lookup(osmium::object_id_type id) const noexcept {
+    const auto base_pos = base_position(id);
+    if (base_pos != 0) {
+        return add_offset_to_id(base_pos);
+    }
+
+    const auto element = std::lower_bound(m_ids.cbegin(), m_ids.cend(), id, osmium::id_order{});
+    if (element == m_ids.cend() || *element != id) {
+        return 0;
     }
+    return add_offset_to_id(osmium::object_id_type(m_base_size + std::distance(m_ids.cbegin(), element) + 1));
+}
 
-    osmium::io::detail::reliable_write(
-        fd,
-        reinterpret_cast<const char*>(m_ids.data()), // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
-        sizeof(osmium::object_id_type) * m_ids.size()
-    );
+void id_map::unfreeze() {
+    if (m_frozen_extra > 0) {
+        const osmium::object_id_type last_id = m_ids.empty() ? 0 : m_ids.back();
+        m_ids.resize(m_ids.size() + m_frozen_extra, last_id);
+        m_frozen_extra = 0;
+    }
+    m_frozen = false;
 }
 
-void id_map::print(osmium::object_id_type new_id) {
-    for (const auto& m : m_extra_ids) {
-        m_ids[m.second - 1] = m.first;
+std::vector<osmium::object_id_type> id_map::ids_by_position() const {
+    std::vector<osmium::object_id_type> ids(size());
+
+    if (m_base_size > 0) {
+        for (const auto* it = m_base->begin(); it != m_base->begin() + m_base_size; ++it) {
+            ids[static_cast<std::size_t>(it->position) - 1] = it->id;
+        }
     }
 
-    for (const auto& id : m_ids) {
+    std::copy(m_ids.cbegin(), m_ids.cend(), ids.begin() + static_cast<std::ptrdiff_t>(m_base_size));
+
+    m_extra_ids.for_each([&](osmium::object_id_type old_id, osmium::object_id_type pos) {
+        ids[static_cast<std::size_t>(pos) - 1] = old_id;
+    });
+
+    return ids;
+}
+
+void id_map::write(int fd) const {
+    assert(!m_frozen);
+
+    // The mappings added in this run for IDs seen out of order, sorted by
+    // old ID, and their positions in ascending order. All other mappings
+    // are in m_ids which is sorted already, the positions of the dummy IDs
+    // in there are skipped. This way only the out of order mappings have
+    // to be held in memory, not all of them.
+    std::vector<id_map_entry> extra_entries;
+    std::vector<osmium::object_id_type> dummy_positions;
+    extra_entries.reserve(m_extra_ids.size());
+    dummy_positions.reserve(m_extra_ids.size());
+    m_extra_ids.for_each([&](osmium::object_id_type old_id, osmium::object_id_type pos) {
+        extra_entries.push_back(id_map_entry{old_id, pos});
+        dummy_positions.push_back(pos);
+    });
+    std::sort(extra_entries.begin(), extra_entries.end(), [](const id_map_entry& a, const id_map_entry& b) {
+        return osmium::id_order{}(a.id, b.id);
+    });
+    std::sort(dummy_positions.begin(), dummy_positions.end());
+
+    // Merge them with the base mappings and write out in chunks.
+    constexpr const std::size_t chunk_size = 64UL * 1024UL;
+    std::vector<id_map_entry> chunk;
+    chunk.reserve(chunk_size);
+
+    const auto flush = [&]() {
+        osmium::io::detail::reliable_write(
+            fd,
+            reinterpret_cast<const char*>(chunk.data()), // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
+            sizeof(id_map_entry) * chunk.size()
+        );
+        chunk.clear();
+    };
+
+    const id_map_entry* base_it = m_base_size > 0 ? m_base->begin() : nullptr;
+    const id_map_entry* base_end = base_it + m_base_size;
+    auto extra_it = extra_entries.cbegin();
+    auto dummy_it = dummy_positions.cbegin();
+    std::size_t i = 0;
+
+    const auto position = [&](std::size_t n) {
+        return osmium::object_id_type(m_base_size + n + 1);
+    };
+
+    for (;;) {
+        while (i < m_ids.size() && dummy_it != dummy_positions.cend() && *dummy_it == position(i)) {
+            ++i;
+            ++dummy_it;
+        }
+
+        const bool has_id = i < m_ids.size();
+        const bool has_extra = extra_it != extra_entries.cend();
+        const bool has_base = base_it != base_end;
+        if (!has_id && !has_extra && !has_base) {
+            break;
+        }
+
+        if (has_id &&
+            (!has_extra || osmium::id_order{}(m_ids[i], extra_it->id)) &&
+            (!has_base || !osmium::id_order{}(base_it->id, m_ids[i]))) {
+            chunk.push_back(id_map_entry{m_ids[i], position(i)});
+            ++i;
+        } else if (has_extra && (!has_base || !osmium::id_order{}(base_it->id, extra_it->id))) {
+            chunk.push_back(*extra_it++);
+        } else {
+            chunk.push_back(*base_it++);
+        }
+
+        if (chunk.size() == chunk_size) {
+            flush();
+        }
+    }
+    flush();
+}
+
+void id_map::print(osmium::object_id_type new_id) const {
+    for (const auto& id : ids_by_position()) {
         std::cout << id << ' ' << new_id << '\n';
         if (new_id > 0) {
             ++new_id;
@@ -127,11 +399,18 @@ void id_map::read(int fd, std::size_t file_size) {
             last_id = id;
         } else {
             m_ids.push_back(last_id);
-            m_extra_ids[id] = m_ids.size();
+            m_extra_ids.set(id, osmium::object_id_type(m_ids.size()));
         }
     }
 }
 
+void id_map::map_sorted(int fd, std::size_t file_size) {
+    m_base_size = file_size / sizeof(id_map_entry);
+    if (m_base_size > 0) {
+        m_base.reset(new osmium::TypedMemoryMapping<id_map_entry>{m_base_size, osmium::MemoryMapping::mapping_mode::readonly, fd});
+    }
+}
+
 static osmium::object_id_type get_start_id(const std::string& s) noexcept {
     const auto id = osmium::string_to_object_id(s.c_str());
     if (id == 0) {
@@ -181,6 +460,7 @@ bool CommandRenumber::setup(const std::vector<std::string>& arguments) {
     ("object-type,t", po::value<std::vector<std::string>>(), "Renumber only objects of given type (node, way, relation)")
     ("show-index", po::value<std::string>(), "Show contents of index file")
     ("start-id,s", po::value<std::string>(), "Comma separated list of first node, way, and relation id to use (default: 1,1,1)")
+    ("temp-dir", po::value<std::string>(), "Keep the ID tables in memory-mapped files in this directory")
     ;
 
     po::options_description opts_common{add_common_options()};
@@ -224,6 +504,27 @@ bool CommandRenumber::setup(const std::vector<std::string>& arguments) {
         set_start_ids(vm["start-id"].as<std::string>());
     }
 
+    // With a memory budget the tables are kept in temporary files if
+    // they probably don't fit. An object needs on average about 64
+    // bytes in a buffer but only 8 bytes in the tables.
+    if (!vm.count("temp-dir") && m_memory_budget > 0) {
+        const auto estimate = estimate_buffer_memory({m_input_file}) / 8;
+        if (estimate == 0 || !fits_memory_budget(estimate)) {
+            m_temp_directory = default_temp_directory();
+        }
+    }
+
+    if (vm.count("temp-dir")) {
+        m_temp_directory = vm["temp-dir"].as<std::string>();
+    }
+
+    if (!m_temp_directory.empty()) {
+        m_temp_files.reset(new TempFiles{m_temp_directory, "osmium-renumber", ".ids"});
+        m_id_map(osmium::item_type::node).set_temp_files(m_temp_files.get());
+        m_id_map(osmium::item_type::way).set_temp_files(m_temp_files.get());
+        m_id_map(osmium::item_type::relation).set_temp_files(m_temp_files.get());
+    }
+
     return true;
 }
 
@@ -233,6 +534,13 @@ void CommandRenumber::show_arguments() {
 
     m_vout << "  other options:\n";
     m_vout << "    index directory: " << m_index_directory << "\n";
+    if (!m_temp_directory.empty()) {
+        m_vout << "    directory for temporary files: " << m_temp_directory << "\n";
+    }
+    if (m_memory_budget > 0) {
+        m_vout << "    memory budget: " << m_memory_budget << " MBytes\n";
+    }
+    m_vout << "    threads: " << m_threads << "\n";
     m_vout << "    object types that will be renumbered and their start IDs:";
     if (osm_entity_bits() & osmium::osm_entity_bits::node) {
         m_vout << " node (" << m_id_map(osmium::item_type::node).start_id() << ')';
@@ -283,13 +591,144 @@ void CommandRenumber::renumber(osmium::memory::Buffer& buffer) {
     }
 }
 
-std::string CommandRenumber::filename(const char* name) const {
-    return m_index_directory + "/" + name + ".idx";
+void CommandRenumber::renumber_lookup(osmium::memory::Buffer& buffer, lookup_misses& misses) const {
+    for (auto& object : buffer.select<osmium::OSMObject>()) {
+        switch (object.type()) {
+            case osmium::item_type::node:
+            case osmium::item_type::way:
+            case osmium::item_type::relation:
+                if (osm_entity_bits() & osmium::osm_entity_bits::from_item_type(object.type())) {
+                    const auto id = m_id_map(object.type()).lookup(object.id());
+                    if (id == 0) {
+                        misses.objects.push_back(&object);
+                    } else {
+                        object.set_id(id);
+                    }
+                }
+                break;
+            default:
+                break;
+        }
+        if (object.type() == osmium::item_type::way && (osm_entity_bits() & osmium::osm_entity_bits::node)) {
+            for (auto& ref : static_cast<osmium::Way&>(object).nodes()) {
+                const auto id = m_id_map(osmium::item_type::node).lookup(ref.ref());
+                if (id == 0) {
+                    misses.node_refs.push_back(&ref);
+                } else {
+                    ref.set_ref(id);
+                }
+            }
+        } else if (object.type() == osmium::item_type::relation) {
+            for (auto& member : static_cast<osmium::Relation&>(object).members()) {
+                if (osm_entity_bits() & osmium::osm_entity_bits::from_item_type(member.type())) {
+                    const auto id = m_id_map(member.type()).lookup(member.ref());
+                    if (id == 0) {
+                        misses.members.push_back(&member);
+                    } else {
+                        member.set_ref(id);
+                    }
+                }
+            }
+        }
+    }
+}
+
+void CommandRenumber::renumber_misses(lookup_misses& misses) {
+    for (auto* object : misses.objects) {
+        object->set_id(m_id_map(object->type())(object->id()));
+    }
+    for (auto* ref : misses.node_refs) {
+        ref->set_ref(m_id_map(osmium::item_type::node)(ref->ref()));
+    }
+    for (auto* member : misses.members) {
+        member->set_ref(m_id_map(member->type())(member->ref()));
+    }
+}
+
+// Read the IDs of all objects (in the order they would be mapped by the
+// second pass) and check the order of the input file. After this the ID
+// maps contain all objects in the file and only references to objects
+// missing from the file have to be added.
+void CommandRenumber::read_ids() {
+    osmium::io::Reader reader{m_input_file, osm_entity_bits() & osmium::osm_entity_bits::nwr};
+    while (osmium::memory::Buffer buffer = reader.read()) {
+        for (const auto& object : buffer.select<osmium::OSMObject>()) {
+            switch (object.type()) {
+                case osmium::item_type::node:
+                    m_check_order.node(static_cast<const osmium::Node&>(object));
+                    break;
+                case osmium::item_type::way:
+                    m_check_order.way(static_cast<const osmium::Way&>(object));
+                    break;
+                case osmium::item_type::relation:
+                    m_check_order.relation(static_cast<const osmium::Relation&>(object));
+                    break;
+                default:
+                    continue;
+            }
+            m_id_map(object.type())(object.id());
+        }
+    }
+    reader.close();
+}
+
+// The ID maps are frozen and each buffer is renumbered in the thread pool
+// using only lookups. The few references not found are mapped here in
+// input order, so the result is the same as when renumbering on a single
+// thread.
+void CommandRenumber::renumber_in_threads(osmium::io::Reader& reader, osmium::io::Writer& writer, osmium::ProgressBar& progress_bar) {
+    using result_type = std::pair<std::shared_ptr<osmium::memory::Buffer>, lookup_misses>;
+
+    m_id_map(osmium::item_type::node).freeze();
+    m_id_map(osmium::item_type::way).freeze();
+    m_id_map(osmium::item_type::relation).freeze();
+
+    auto& pool = thread_pool();
+    std::deque<std::future<result_type>> pending;
+    const std::size_t max_pending = static_cast<std::size_t>(m_threads) * 4;
+
+    const auto write = [&](result_type&& result) {
+        renumber_misses(result.second);
+        writer(std::move(*result.first));
+    };
+
+    while (osmium::memory::Buffer buffer = reader.read()) {
+        progress_bar.update(reader.offset());
+        std::shared_ptr<osmium::memory::Buffer> buffer_ptr{new osmium::memory::Buffer{std::move(buffer)}};
+        pending.push_back(pool.submit([this, buffer_ptr]() {
+            result_type result{buffer_ptr, lookup_misses{}};
+            renumber_lookup(*buffer_ptr, result.second);
+            return result;
+        }));
+        while (pending.size() > max_pending) {
+            write(pending.front().get());
+            pending.pop_front();
+        }
+    }
+    for (auto& future : pending) {
+        write(future.get());
+    }
+
+    m_id_map(osmium::item_type::node).unfreeze();
+    m_id_map(osmium::item_type::way).unfreeze();
+    m_id_map(osmium::item_type::relation).unfreeze();
+}
+
+std::string CommandRenumber::filename(const char* name, const char* suffix) const {
+    return m_index_directory + "/" + name + suffix;
 }
 
 void CommandRenumber::read_index(osmium::item_type type) {
-    const std::string f{filename(osmium::item_type_to_name(type))};
-    const int fd = ::open(f.c_str(), O_RDWR);
+    // Use the sorted index file if there is one. It is memory mapped and
+    // queried directly. Otherwise fall back to reading the old format.
+    bool sorted = true;
+    std::string f{filename(osmium::item_type_to_name(type), ".sidx")};
+    int fd = ::open(f.c_str(), O_RDONLY);
+    if (fd < 0 && errno == ENOENT) {
+        sorted = false;
+        f = filename(osmium::item_type_to_name(type), ".idx");
+        fd = ::open(f.c_str(), O_RDONLY);
+    }
     if (fd < 0) {
         // if the file is not there we don't have to read anything and can return
         if (errno == ENOENT) {
@@ -303,11 +742,15 @@ void CommandRenumber::read_index(osmium::item_type type) {
 
     const std::size_t file_size = osmium::file_size(fd);
 
-    if (file_size % sizeof(osmium::object_id_type) != 0) {
+    if (file_size % (sorted ? sizeof(id_map_entry) : sizeof(osmium::object_id_type)) != 0) {
         throw std::runtime_error{std::string{"Index file '"} + f + "' has wrong file size"};
     }
 
-    m_id_map(type).read(fd, file_size);
+    if (sorted) {
+        m_id_map(type).map_sorted(fd, file_size);
+    } else {
+        m_id_map(type).read(fd, file_size);
+    }
 
     close(fd);
 }
@@ -317,10 +760,14 @@ void CommandRenumber::write_index(osmium::item_type type) {
         return;
     }
 
-    const std::string f{filename(osmium::item_type_to_name(type))};
-    const int fd = ::open(f.c_str(), O_WRONLY | O_CREAT, 0666); // NOLINT(hicpp-signed-bitwise)
+    // The index is written to a new file which then replaces the old one.
+    // This way the memory mapping of the old index stays valid while the
+    // new one is written.
+    const std::string f{filename(osmium::item_type_to_name(type), ".sidx")};
+    const std::string tmp{f + ".new"};
+    const int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666); // NOLINT(hicpp-signed-bitwise)
     if (fd < 0) {
-        throw std::runtime_error{std::string{"Could not open file '"} + f + "': " + std::strerror(errno)};
+        throw std::runtime_error{std::string{"Could not open file '"} + tmp + "': " + std::strerror(errno)};
     }
 #ifdef _WIN32
     _setmode(fd, _O_BINARY);
@@ -329,6 +776,13 @@ void CommandRenumber::write_index(osmium::item_type type) {
     m_id_map(type).write(fd);
 
     close(fd);
+
+    if (std::rename(tmp.c_str(), f.c_str()) != 0) {
+        throw std::runtime_error{std::string{"Could not rename file '"} + tmp + "' to '" + f + "': " + std::strerror(errno)};
+    }
+
+    // Remove index in old format, it has been replaced by the sorted index.
+    std::remove(filename(osmium::item_type_to_name(type), ".idx").c_str());
 }
 
 void read_relations(const osmium::io::File& input_file, id_map& map) {
@@ -365,7 +819,12 @@ bool CommandRenumber::run() {
         m_vout << "  Relations index contains " << m_id_map(osmium::item_type::relation).size() << " items\n";
     }
 
-    if (osm_entity_bits() & osmium::osm_entity_bits::relation) {
+    if (m_threads > 1) {
+        m_vout << "First pass (of two) through input file (reading object IDs)...\n";
+        read_ids();
+        m_vout << "First pass done.\n";
+        m_vout << "Second pass (of two) through input file...\n";
+    } else if (osm_entity_bits() & osmium::osm_entity_bits::relation) {
         m_vout << "First pass (of two) through input file (reading relations)...\n";
         read_relations(m_input_file, m_id_map(osmium::item_type::relation));
         m_vout << "First pass done.\n";
@@ -373,6 +832,7 @@ bool CommandRenumber::run() {
     } else {
         m_vout << "Single pass through input file (because relation IDs are not mapped)...\n";
     }
+    use_huge_pages();
 
     osmium::io::Reader reader{m_input_file};
 
@@ -383,10 +843,14 @@ bool CommandRenumber::run() {
     osmium::io::Writer writer{m_output_file, header, m_output_overwrite, m_fsync};
 
     osmium::ProgressBar progress_bar{reader.file_size(), display_progress()};
-    while (osmium::memory::Buffer buffer = reader.read()) {
-        progress_bar.update(reader.offset());
-        renumber(buffer);
-        writer(std::move(buffer));
+    if (m_threads > 1) {
+        renumber_in_threads(reader, writer, progress_bar);
+    } else {
+        while (osmium::memory::Buffer buffer = reader.read()) {
+            progress_bar.update(reader.offset());
+            renumber(buffer);
+            writer(std::move(buffer));
+        }
     }
     progress_bar.done();
     reader.close();
@@ -24,35 +24,207 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
 #include "cmd.hpp" // IWYU pragma: export
+#include "temp_files.hpp"
 
 #include <osmium/handler/check_order.hpp>
 #include <osmium/index/nwr_array.hpp>
+#include <osmium/io/reader.hpp>
+#include <osmium/io/writer.hpp>
 #include <osmium/memory/buffer.hpp>
 #include <osmium/osm/item_type.hpp>
+#include <osmium/osm/node_ref.hpp>
+#include <osmium/osm/object.hpp>
+#include <osmium/osm/relation.hpp>
 #include <osmium/osm/types.hpp>
+#include <osmium/util/memory_mapping.hpp>
+#include <osmium/util/progress_bar.hpp>
 
 #include <cstddef>
+#include <memory>
 #include <string>
-#include <unordered_map>
 #include <vector>
 
+/**
+ * Hash table (with open addressing) from old IDs to positions in the
+ * id_map. The slots are kept in a memory mapping which is either
+ * anonymous or, if temporary files are set, backed by a file.
+ */
+class extra_id_table {
+
+    struct slot {
+        osmium::object_id_type id;
+        osmium::object_id_type value; // 0 means the slot is empty
+    };
+
+    std::unique_ptr<osmium::TypedMemoryMapping<slot>> m_slots;
+    std::string m_filename;
+    TempFiles* m_temp_files = nullptr;
+    std::size_t m_size = 0;
+
+    static std::size_t hash(osmium::object_id_type id) noexcept;
+
+    std::size_t capacity() const noexcept {
+        return m_slots ? m_slots->size() : 0;
+    }
+
+    std::unique_ptr<osmium::TypedMemoryMapping<slot>> create_slots(std::size_t capacity, std::string& filename);
+
+    void grow();
+
+public:
+
+    extra_id_table() = default;
+
+    extra_id_table(const extra_id_table&) = delete;
+    extra_id_table& operator=(const extra_id_table&) = delete;
+
+    extra_id_table(extra_id_table&&) = delete;
+    extra_id_table& operator=(extra_id_table&&) = delete;
+
+    ~extra_id_table() noexcept;
+
+    // Use memory-mapped temporary files instead of anonymous memory.
+    void set_temp_files(TempFiles* temp_files) noexcept {
+        m_temp_files = temp_files;
+    }
+
+    // Return the value for the ID or 0 if it is not in the table.
+    osmium::object_id_type get(osmium::object_id_type id) const noexcept;
+
+    // Add the ID with the value (which must not be 0). The ID must not
+    // be in the table already.
+    void set(osmium::object_id_type id, osmium::object_id_type value);
+
+    std::size_t size() const noexcept {
+        return m_size;
+    }
+
+    std::size_t used_memory() const noexcept {
+        return capacity() * sizeof(slot);
+    }
+
+    template <typename TFunc>
+    void for_each(TFunc&& func) const {
+        if (!m_slots) {
+            return;
+        }
+        for (const auto& s : *m_slots) {
+            if (s.value != 0) {
+                func(s.id, s.value);
+            }
+        }
+    }
+
+}; // class extra_id_table
+
+/**
+ * A growable array of IDs. It lives in anonymous memory or, if temporary
+ * files are set, in a memory-mapped temporary file. The kernel can then
+ * write its pages out to disk instead of the command running out of
+ * main memory.
+ */
+class id_vector {
+
+    std::unique_ptr<osmium::TypedMemoryMapping<osmium::object_id_type>> m_data;
+    std::string m_filename;
+    TempFiles* m_temp_files = nullptr;
+    std::size_t m_size = 0;
+    int m_fd = -1;
+
+    std::size_t capacity() const noexcept {
+        return m_data ? m_data->size() : 0;
+    }
+
+public:
+
+    using const_iterator = const osmium::object_id_type*;
+
+    id_vector() = default;
+
+    id_vector(const id_vector&) = delete;
+    id_vector& operator=(const id_vector&) = delete;
+
+    id_vector(id_vector&&) = delete;
+    id_vector& operator=(id_vector&&) = delete;
+
+    ~id_vector() noexcept;
+
+    // Use a memory-mapped temporary file instead of anonymous memory.
+    // Must be called before anything is added.
+    void set_temp_files(TempFiles* temp_files) noexcept {
+        m_temp_files = temp_files;
+    }
+
+    void reserve(std::size_t new_capacity);
+
+    void push_back(osmium::object_id_type id) {
+        if (m_size == capacity()) {
+            reserve(capacity() == 0 ? 1024 : capacity() * 2);
+        }
+        m_data->begin()[m_size++] = id;
+    }
+
+    // Add IDs with the value to the end until the array has the new size.
+    void resize(std::size_t new_size, osmium::object_id_type value);
+
+    bool empty() const noexcept {
+        return m_size == 0;
+    }
+
+    std::size_t size() const noexcept {
+        return m_size;
+    }
+
+    osmium::object_id_type operator[](std::size_t n) const noexcept {
+        return m_data->begin()[n];
+    }
+
+    osmium::object_id_type back() const noexcept {
+        return m_data->begin()[m_size - 1];
+    }
+
+    const_iterator cbegin() const noexcept {
+        return m_data ? m_data->begin() : nullptr;
+    }
+
+    const_iterator cend() const noexcept {
+        return cbegin() + m_size;
+    }
+
+}; // class id_vector
+
+/**
+ * One entry in a sorted index file: The old ID and its position in the
+ * id_map (the new ID without the offset). The entries are sorted by old ID.
+ */
+struct id_map_entry {
+    osmium::object_id_type id;
+    osmium::object_id_type position;
+};
+
 /**
  * Holds the mapping from old IDs to new IDs of one object type.
  */
 class id_map {
 
+    // Mappings from an earlier run read from a sorted index file. They are
+    // used directly from the memory mapped file and have the positions
+    // 1 to m_base_size. All mappings added in this run come after those.
+    std::unique_ptr<osmium::TypedMemoryMapping<id_map_entry>> m_base;
+    std::size_t m_base_size = 0;
+
     // Internally this uses two different means of storing the mapping:
     //
     // Most of the old IDs are stored in a sorted vector. The index into the
     // vector is the new ID. All IDs from the nodes, ways, and relations
     // themselves will end up here.
-    std::vector<osmium::object_id_type> m_ids;
+    id_vector m_ids;
 
     // For IDs that can't be written into the sorted vector because this would
     // destroy the sorting, a hash map is used. These are the IDs not read
     // in order, ie the node IDs referenced from the ways and the member IDs
     // referenced from the relations.
-    std::unordered_map<osmium::object_id_type, osmium::object_id_type> m_extra_ids;
+    extra_id_table m_extra_ids;
 
     // Because we still have to allocate unique new IDs for the mappings
     // ending up in m_extra_ids, we add dummy IDs of the same value as the
@@ -63,6 +235,18 @@ class id_map {
 
     osmium::object_id_type m_start_id = 1;
 
+    // Find the position of an ID in the base mappings, 0 if not found.
+    osmium::object_id_type base_position(osmium::object_id_type id) const noexcept;
+
+    // Return the old IDs of all mappings in order of their positions.
+    std::vector<osmium::object_id_type> ids_by_position() const;
+
+    // While the map is frozen, m_ids is not changed. New IDs are only
+    // added to m_extra_ids, the dummy IDs for them are counted here and
+    // added to m_ids when the map is unfrozen.
+    std::size_t m_frozen_extra = 0;
+    bool m_frozen = false;
+
 public:
 
     id_map() = default;
@@ -75,26 +259,46 @@ public:
         m_start_id = start_id;
     }
 
+    void set_temp_files(TempFiles* temp_files) noexcept {
+        m_ids.set_temp_files(temp_files);
+        m_extra_ids.set_temp_files(temp_files);
+    }
+
     osmium::object_id_type add_offset_to_id(osmium::object_id_type id) const noexcept;
 
     // Map from old ID to new ID. If the old ID has been seen before, it will
     // be returned, otherwise a new ID will be allocated and stored.
     osmium::object_id_type operator()(osmium::object_id_type id);
 
-    // Write the mappings into a file in binary form. This will first copy
-    // the mappings from m_extra_ids into the m_ids vector. After this
-    // operation this object becomes unusable!
-    void write(int fd);
+    // Map from old ID to new ID using only the base mappings and the sorted
+    // vector. Returns 0 if the ID is not found there. This doesn't change anything, so it can be
+    // called from several threads while the map is frozen.
+    osmium::object_id_type lookup(osmium::object_id_type id) const noexcept;
+
+    void freeze() noexcept {
+        m_frozen = true;
+    }
+
+    void unfreeze();
 
-    void print(osmium::object_id_type new_id);
+    // Write all mappings into a sorted index file. These are the entries
+    // from the base mappings and the ones added in this run.
+    void write(int fd) const;
 
-    // Read the mappings from a binary file into m_ids and m_extra_ids.
+    void print(osmium::object_id_type new_id) const;
+
+    // Read the mappings from a binary file in the old format (one old ID
+    // for each new ID) into m_ids and m_extra_ids.
     void read(int fd, std::size_t file_size);
 
+    // Use the mappings from a sorted index file as base mappings. The file
+    // is memory mapped, nothing is read into memory.
+    void map_sorted(int fd, std::size_t file_size);
+
     // The number of mappings currently existing. Also the last allocated
     // new ID.
     std::size_t size() const noexcept {
-        return m_ids.size();
+        return m_base_size + m_ids.size() + m_frozen_extra;
     }
 
 }; // class id_map
@@ -102,6 +306,9 @@ public:
 class CommandRenumber : public Command, public with_single_osm_input, public with_osm_output {
 
     std::string m_index_directory;
+    std::string m_temp_directory;
+
+    std::unique_ptr<TempFiles> m_temp_files;
 
     osmium::handler::CheckOrder m_check_order;
 
@@ -110,7 +317,23 @@ class CommandRenumber : public Command, public with_single_osm_input, public wit
 
     void renumber(osmium::memory::Buffer& buffer);
 
-    std::string filename(const char* name) const;
+    // Objects, way node references, and relation members in a buffer
+    // not found by renumber_lookup().
+    struct lookup_misses {
+        std::vector<osmium::OSMObject*> objects;
+        std::vector<osmium::NodeRef*> node_refs;
+        std::vector<osmium::RelationMember*> members;
+    };
+
+    void renumber_lookup(osmium::memory::Buffer& buffer, lookup_misses& misses) const;
+
+    void renumber_misses(lookup_misses& misses);
+
+    void read_ids();
+
+    void renumber_in_threads(osmium::io::Reader& reader, osmium::io::Writer& writer, osmium::ProgressBar& progress_bar);
+
+    std::string filename(const char* name, const char* suffix) const;
 
     void set_start_ids(const std::string& str);
 
@@ -142,6 +365,10 @@ public:
         return "osmium renumber [OPTIONS] OSM-FILE";
     }
 
+    bool supports_huge_pages() const noexcept override final {
+        return true;
+    }
+
 }; // class CommandRenumber
 
 
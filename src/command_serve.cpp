@@ -0,0 +1,338 @@
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "command_serve.hpp"
+#include "exception.hpp"
+#include "pbf_blocks.hpp"
+#include "query_index.hpp"
+#include "util.hpp"
+
+#include <osmium/io/file_format.hpp>
+#include <osmium/osm/types_from_string.hpp>
+#include <osmium/util/verbose_output.hpp>
+
+#include <boost/program_options.hpp>
+
+#include <cerrno>
+#include <csignal>
+#include <cstddef>
+#include <cstring>
+#include <exception>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#ifndef _WIN32
+# include <sys/socket.h>
+# include <sys/stat.h>
+# include <sys/time.h>
+# include <sys/un.h>
+# include <unistd.h>
+#endif
+
+#ifndef _WIN32
+namespace {
+
+    volatile std::sig_atomic_t stop_requested = 0;
+
+    void handle_stop_signal(int /*signal*/) {
+        stop_requested = 1;
+    }
+
+    // Write all data, returns false if the client went away.
+    bool write_all(int fd, const std::string& data) {
+        const char* ptr = data.data();
+        std::size_t size = data.size();
+        while (size > 0) {
+            const auto written = ::write(fd, ptr, size);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            ptr += written;
+            size -= static_cast<std::size_t>(written);
+        }
+        return true;
+    }
+
+} // anonymous namespace
+#endif
+
+bool CommandServe::setup(const std::vector<std::string>& arguments) {
+    po::options_description opts_cmd{"COMMAND OPTIONS"};
+    opts_cmd.add_options()
+    ("socket,S", po::value<std::string>(), "Path of the Unix domain socket to listen on (required)")
+    ("block-index", po::value<std::string>(), "Read block index from this file instead of building it")
+    ("object-index", po::value<std::string>(), "Use object index from this file for getid requests")
+    ("parents", "Build index of parent ways and relations for getparents requests")
+    ("default-type", po::value<std::string>()->default_value("node"), "Default item type")
+    ("timeout", po::value<unsigned int>(), "Close idle connections after this many seconds (default: 60, 0: never)")
+    ;
+
+    po::options_description opts_common{add_common_options()};
+    po::options_description opts_input{add_single_input_options()};
+
+    po::options_description hidden;
+    hidden.add_options()
+    ("input-filename", po::value<std::string>(), "OSM input file")
+    ;
+
+    po::options_description desc;
+    desc.add(opts_cmd).add(opts_common).add(opts_input);
+
+    po::options_description parsed_options;
+    parsed_options.add(desc).add(hidden);
+
+    po::positional_options_description positional;
+    positional.add("input-filename", 1);
+
+    po::variables_map vm;
+    po::store(po::command_line_parser(arguments).options(parsed_options).positional(positional).run(), vm);
+    po::notify(vm);
+
+    setup_common(vm, desc);
+    setup_input_file(vm);
+
+#ifdef _WIN32
+    throw argument_error{"The serve command is not available on Windows."};
+#else
+    if (m_input_filename.empty() || m_input_filename == "-") {
+        throw argument_error{"Can not serve a file from STDIN."};
+    }
+
+    if (m_input_file.format() != osmium::io::file_format::pbf) {
+        throw argument_error{"The serve command only works with PBF input files."};
+    }
+
+    if (!vm.count("socket")) {
+        throw argument_error{"Missing --socket/-S option."};
+    }
+    m_socket_path = vm["socket"].as<std::string>();
+    if (m_socket_path.size() >= sizeof(sockaddr_un::sun_path)) {
+        throw argument_error{"Socket path is too long."};
+    }
+
+    if (vm.count("block-index")) {
+        m_block_index_filename = vm["block-index"].as<std::string>();
+    }
+
+    if (vm.count("object-index")) {
+        m_object_index_filename = vm["object-index"].as<std::string>();
+    }
+
+    if (vm.count("parents")) {
+        m_parents = true;
+    }
+
+    if (vm.count("default-type")) {
+        m_default_item_type = parse_item_type(vm["default-type"].as<std::string>());
+    }
+
+    if (vm.count("timeout")) {
+        m_timeout = vm["timeout"].as<unsigned int>();
+    }
+
+    return true;
+#endif
+}
+
+void CommandServe::show_arguments() {
+    show_single_input_arguments(m_vout);
+
+    m_vout << "  other options:\n";
+    m_vout << "    socket: " << m_socket_path << "\n";
+    m_vout << "    block index: " << (m_block_index_filename.empty() ? "(build at startup)" : m_block_index_filename) << "\n";
+    m_vout << "    object index: " << (m_object_index_filename.empty() ? "(none)" : m_object_index_filename) << "\n";
+    m_vout << "    build parent index: " << yes_no(m_parents);
+    m_vout << "    default object type: " << osmium::item_type_to_name(m_default_item_type) << "\n";
+    m_vout << "    connection timeout: " << m_timeout << " seconds\n";
+}
+
+#ifdef _WIN32
+bool CommandServe::handle_connection(int /*fd*/, QueryIndex& /*index*/) {
+    return false;
+}
+
+bool CommandServe::run() {
+    return false;
+}
+#else
+bool CommandServe::handle_connection(int fd, QueryIndex& index) {
+    // Connections are handled one after the other, so a client which
+    // doesn't send or read anything must not block all others. Reads and
+    // writes fail with EAGAIN after the timeout.
+    if (m_timeout > 0) {
+        timeval tv{};
+        tv.tv_sec = static_cast<decltype(tv.tv_sec)>(m_timeout);
+        ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    }
+
+    std::string input;
+    char data[4096];
+
+    while (!stop_requested) {
+        const auto length = ::read(fd, data, sizeof(data));
+        if (length < 0 && errno == EINTR) {
+            continue;
+        }
+        if (length <= 0) {
+            return true;
+        }
+        input.append(data, static_cast<std::size_t>(length));
+
+        if (input.size() > max_request_length && input.find('\n') == std::string::npos) {
+            write_all(fd, "error: request too long\n\n");
+            return true;
+        }
+
+        std::string::size_type pos;
+        while ((pos = input.find('\n')) != std::string::npos) {
+            std::string request{input, 0, pos};
+            input.erase(0, pos + 1);
+            if (!request.empty() && request.back() == '\r') {
+                request.pop_back();
+            }
+
+            if (request == "quit") {
+                return true;
+            }
+            if (request == "shutdown") {
+                return false;
+            }
+
+            // Every response ends with an empty line. OPL lines are never
+            // empty, so clients can always find the end.
+            std::string response;
+            try {
+                response = index.query(request, m_default_item_type);
+            } catch (const std::exception& e) {
+                response = "error: ";
+                response += e.what();
+                response += '\n';
+            }
+            response += '\n';
+
+            if (!write_all(fd, response)) {
+                return true;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool CommandServe::run() {
+    pbf_block_index block_index;
+    if (m_block_index_filename.empty()) {
+        m_vout << "Building block index...\n";
+        block_index = build_pbf_block_index(m_input_filename);
+    } else {
+        m_vout << "Reading block index...\n";
+        block_index = read_pbf_block_index(m_block_index_filename);
+    }
+
+    QueryIndex index{m_input_filename, std::move(block_index)};
+
+    if (!m_object_index_filename.empty()) {
+        m_vout << "Opening object index...\n";
+        index.open_object_index(m_object_index_filename);
+    }
+
+    if (m_parents) {
+        m_vout << "Building parent index...\n";
+        index.build_parent_index();
+        m_vout << "Parent index has " << index.parent_index_size() << " entries.\n";
+    }
+
+    // Remove stale socket from an earlier run, but nothing else.
+    struct stat st;
+    if (::lstat(m_socket_path.c_str(), &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            throw argument_error{"File '" + m_socket_path + "' exists and is not a socket."};
+        }
+        ::unlink(m_socket_path.c_str());
+    }
+
+    const int server_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server_fd < 0) {
+        throw std::system_error{errno, std::system_category(), "Could not create socket"};
+    }
+
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, m_socket_path.c_str(), sizeof(address.sun_path) - 1);
+
+    if (::bind(server_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+        ::listen(server_fd, 16) != 0) {
+        const int error = errno;
+        ::close(server_fd);
+        throw std::system_error{error, std::system_category(), "Could not listen on socket '" + m_socket_path + "'"};
+    }
+
+    // Clients going away while we write should not kill the server. Stop
+    // signals interrupt accept() so that the socket is cleaned up.
+    std::signal(SIGPIPE, SIG_IGN);
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_handler = handle_stop_signal;
+    sigemptyset(&action.sa_mask);
+    ::sigaction(SIGINT, &action, nullptr);
+    ::sigaction(SIGTERM, &action, nullptr);
+
+    m_vout << "Listening on '" << m_socket_path << "'...\n";
+
+    bool keep_running = true;
+    while (keep_running && !stop_requested) {
+        const int fd = ::accept(server_fd, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            const int error = errno;
+            ::close(server_fd);
+            ::unlink(m_socket_path.c_str());
+            throw std::system_error{error, std::system_category(), "Error accepting connection"};
+        }
+        try {
+            keep_running = handle_connection(fd, index);
+        } catch (...) {
+            ::close(fd);
+            ::close(server_fd);
+            ::unlink(m_socket_path.c_str());
+            throw;
+        }
+        ::close(fd);
+    }
+
+    ::close(server_fd);
+    ::unlink(m_socket_path.c_str());
+
+    m_vout << "Done.\n";
+
+    return true;
+}
+#endif
@@ -0,0 +1,79 @@
+#ifndef COMMAND_SERVE_HPP
+#define COMMAND_SERVE_HPP
+
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "cmd.hpp" // IWYU pragma: export
+
+#include <osmium/osm/item_type.hpp>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+class QueryIndex;
+
+class CommandServe : public Command, public with_single_osm_input {
+
+    std::string m_socket_path;
+    std::string m_block_index_filename;
+    std::string m_object_index_filename;
+
+    // Requests longer than this close the connection.
+    static const std::size_t max_request_length = 64 * 1024;
+
+    osmium::item_type m_default_item_type = osmium::item_type::node;
+
+    // Connections idle for longer than this (in seconds) are closed.
+    unsigned int m_timeout = 60;
+
+    bool m_parents = false;
+
+    // Handle all requests on one connection. Returns false if the server
+    // should shut down.
+    bool handle_connection(int fd, QueryIndex& index);
+
+public:
+
+    explicit CommandServe(const CommandFactory& command_factory) :
+        Command(command_factory) {
+    }
+
+    bool setup(const std::vector<std::string>& arguments) override final;
+
+    void show_arguments() override final;
+
+    bool run() override final;
+
+    const char* name() const noexcept override final {
+        return "serve";
+    }
+
+    const char* synopsis() const noexcept override final {
+        return "osmium serve [OPTIONS] --socket=PATH OSM-FILE";
+    }
+
+}; // class CommandServe
+
+
+#endif // COMMAND_SERVE_HPP
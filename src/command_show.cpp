@@ -22,6 +22,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "command_show.hpp"
 #include "exception.hpp"
+#include "opl_writer.hpp"
 #include "util.hpp"
 
 #include <osmium/io/file.hpp>
@@ -29,13 +30,16 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <osmium/io/reader.hpp>
 #include <osmium/io/writer.hpp>
 #include <osmium/memory/buffer.hpp>
+#include <osmium/thread/pool.hpp>
 #include <osmium/util/verbose_output.hpp>
 
 #include <boost/program_options.hpp>
 
 #include <cerrno>
 #include <csignal>
+#include <cstddef>
 #include <cstdlib>
+#include <limits>
 #include <string>
 #include <system_error>
 #include <utility>
@@ -45,6 +49,46 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 # include <unistd.h>
 #endif
 
+namespace {
+
+    template <typename TWriter>
+    void copy_buffers(osmium::io::Reader& reader, TWriter& writer, std::size_t max_objects) {
+        if (max_objects == std::numeric_limits<std::size_t>::max()) {
+            while (osmium::memory::Buffer buffer = reader.read()) {
+                writer(std::move(buffer));
+            }
+            return;
+        }
+
+        while (max_objects > 0) {
+            osmium::memory::Buffer buffer = reader.read();
+            if (!buffer) {
+                return;
+            }
+            max_objects -= truncate_buffer(buffer, max_objects);
+            writer(std::move(buffer));
+        }
+    }
+
+    // Copy the buffers from the reader to STDOUT in the given format, but
+    // not more than max_objects objects.
+    void copy_to_stdout(osmium::io::Reader& reader, const osmium::io::Header& header, const std::string& format, std::size_t max_objects) {
+        const osmium::io::File file{"-", format};
+
+        if (OPLWriter::can_write(file)) {
+            OPLWriter writer{file, osmium::io::overwrite::allow, osmium::io::fsync::no, osmium::thread::Pool::default_instance()};
+            copy_buffers(reader, writer, max_objects);
+            writer.close();
+            return;
+        }
+
+        osmium::io::Writer writer{file, header};
+        copy_buffers(reader, writer, max_objects);
+        writer.close();
+    }
+
+} // anonymous namespace
+
 #ifndef _MSC_VER
 void CommandShow::setup_pager_from_env() noexcept {
     m_pager = "less";
@@ -75,6 +119,7 @@ bool CommandShow::setup(const std::vector<std::string>& arguments) {
 #endif
     ("object-type,t", po::value<std::vector<std::string>>(), "Read only objects of given type (node, way, relation, changeset)")
     ("output-format,f", po::value<std::string>(), "Format of output file")
+    ("max-objects,n", po::value<std::size_t>(), "Show only this many objects")
     ;
 
     po::options_description opts_common{add_common_options(false)};
@@ -132,6 +177,10 @@ bool CommandShow::setup(const std::vector<std::string>& arguments) {
         }
     }
 
+    if (vm.count("max-objects")) {
+        m_max_objects = vm["max-objects"].as<std::size_t>();
+    }
+
     m_color_output = m_output_format.find("color=true") != std::string::npos;
 
     return true;
@@ -143,6 +192,9 @@ void CommandShow::show_arguments() {
     m_vout << "    file format: " << m_output_format << "\n";
     m_vout << "    use color: " << yes_no(m_color_output);
     m_vout << "    use pager: " << (m_pager.empty() ? "(no pager)" : m_pager) << "\n";
+    if (m_max_objects != std::numeric_limits<std::size_t>::max()) {
+        m_vout << "    max objects: " << m_max_objects << "\n";
+    }
     show_object_types(m_vout);
 }
 
@@ -194,12 +246,8 @@ bool CommandShow::run() {
     osmium::io::Header header{reader.header()};
 
     if (m_pager.empty()) {
-        osmium::io::File file{"-", m_output_format};
-        osmium::io::Writer writer{file, header};
-        while (osmium::memory::Buffer buffer = reader.read()) {
-            writer(std::move(buffer));
-        }
-        writer.close();
+        copy_to_stdout(reader, header, m_output_format, m_max_objects);
+        reader.close();
     } else {
 #ifndef _MSC_VER
         const int fd = execute_pager(m_pager, m_color_output);
@@ -209,20 +257,23 @@ bool CommandShow::run() {
             throw std::system_error{errno, std::system_category(), "Could not run pager: dup2() call failed"};
         }
 
-        osmium::io::File file{"-", m_output_format};
-        osmium::io::Writer writer{file, header};
+        // If the pager quits before all data is written, writing fails
+        // with EPIPE. We stop then without reading the rest of the input.
         try {
-            while (osmium::memory::Buffer buffer = reader.read()) {
-                writer(std::move(buffer));
-            }
+            copy_to_stdout(reader, header, m_output_format, m_max_objects);
         } catch (const std::system_error& e) {
             if (e.code().value() != EPIPE) {
                 throw;
             }
         }
 
+        // Shut down the reader threads before waiting for the pager,
+        // they would otherwise keep decoding while the user looks at the
+        // output.
+        reader.close();
+
+        ::close(1);
         close(fd);
-        writer.close();
 
         int status = 0;
         const int pid = ::wait(&status);
@@ -235,8 +286,5 @@ bool CommandShow::run() {
 #endif
     }
 
-    reader.close();
-
     return true;
 }
-
@@ -25,6 +25,8 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "cmd.hpp" // IWYU pragma: export
 
+#include <cstddef>
+#include <limits>
 #include <string>
 #include <vector>
 
@@ -32,6 +34,7 @@ class CommandShow : public Command, public with_single_osm_input {
 
     std::string m_output_format{"debug,color=true"};
     std::string m_pager;
+    std::size_t m_max_objects = std::numeric_limits<std::size_t>::max();
     bool m_color_output = false;
 
     void setup_pager_from_env() noexcept;
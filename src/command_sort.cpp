@@ -22,28 +22,49 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "command_sort.hpp"
 #include "exception.hpp"
+#include "object_sort.hpp"
+#include "parallel_sort.hpp"
+#include "pbf_blocks.hpp"
+#include "temp_files.hpp"
+#include "trace.hpp"
 #include "util.hpp"
 
+#include <osmium/io/error.hpp>
+#include <osmium/io/file.hpp>
 #include <osmium/io/header.hpp>
-#include <osmium/io/output_iterator.hpp>
 #include <osmium/io/reader.hpp>
 #include <osmium/io/writer.hpp>
 #include <osmium/memory/buffer.hpp>
-#include <osmium/object_pointer_collection.hpp>
+#include <osmium/memory/item_iterator.hpp>
 #include <osmium/osm/box.hpp>
 #include <osmium/osm/entity_bits.hpp>
+#include <osmium/osm/item_type.hpp>
+#include <osmium/osm/object.hpp>
 #include <osmium/osm/object_comparisons.hpp>
+#include <osmium/osm/types.hpp>
+#include <osmium/thread/pool.hpp>
+#include <osmium/util/file.hpp>
 #include <osmium/util/progress_bar.hpp>
 #include <osmium/util/verbose_output.hpp>
-#include <osmium/visitor.hpp>
 
 #include <boost/program_options.hpp>
 
 #include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <future>
+#include <iterator>
+#include <memory>
+#include <queue>
 #include <string>
+#include <tuple>
 #include <utility>
 #include <vector>
 
+
 bool CommandSort::setup(const std::vector<std::string>& arguments) {
     po::options_description opts_common{add_common_options()};
     po::options_description opts_input{add_multiple_inputs_options()};
@@ -53,6 +74,11 @@ bool CommandSort::setup(const std::vector<std::string>& arguments) {
     hidden.add_options()
     ("input-filenames", po::value<std::vector<std::string>>(), "OSM input files")
     ("strategy,s", po::value<std::string>(), "Strategy (default: simple)")
+    ("run-size", po::value<std::size_t>(), "Maximum size of in-memory runs in MBytes for external strategy (default: 1024)")
+    ("temp-dir", po::value<std::string>(), "Directory for temporary files of external strategy")
+    ("check-sorted", "Check whether input is already sorted and copy it if it is")
+    ("compact", "Compact input buffers and sort on packed keys")
+    ("dedupe", "Remove objects with the same type, id, and version")
     ;
 
     po::options_description desc;
@@ -79,11 +105,52 @@ bool CommandSort::setup(const std::vector<std::string>& arguments) {
 
     if (vm.count("strategy")) {
         m_strategy = vm["strategy"].as<std::string>();
-        if (m_strategy != "simple" && m_strategy != "multipass") {
+        if (m_strategy != "simple" && m_strategy != "multipass" && m_strategy != "external") {
             throw argument_error{"Unknown strategy: " + m_strategy};
         }
     }
 
+    if (vm.count("run-size")) {
+        m_run_size = vm["run-size"].as<std::size_t>();
+    }
+
+    if (vm.count("check-sorted")) {
+        m_check_sorted = true;
+        for (const auto& file : m_input_files) {
+            if (is_stdin_or_pipe(file.filename())) {
+                throw argument_error{"Can not use --check-sorted when reading from STDIN."};
+            }
+        }
+    }
+
+    if (vm.count("compact")) {
+        m_compact = true;
+    }
+
+    if (vm.count("dedupe")) {
+        m_dedupe = true;
+    }
+
+    if (vm.count("temp-dir")) {
+        m_temp_directory = vm["temp-dir"].as<std::string>();
+    } else {
+        m_temp_directory = default_temp_directory();
+    }
+
+    // Without a strategy set on the command line switch to the external
+    // strategy if the data probably doesn't fit into the memory budget.
+    // Half of the budget is used for the runs, the rest is needed while
+    // sorting and merging them.
+    if (!vm.count("strategy") && m_memory_budget > 0) {
+        const auto estimate = estimate_buffer_memory(m_input_files);
+        if (estimate == 0 || !fits_memory_budget(estimate)) {
+            m_strategy = "external";
+            if (!vm.count("run-size")) {
+                m_run_size = std::max<std::size_t>(m_memory_budget / 2, 1);
+            }
+        }
+    }
+
     return true;
 }
 
@@ -93,11 +160,485 @@ void CommandSort::show_arguments() {
 
     m_vout << "  other options:\n";
     m_vout << "    strategy: " << m_strategy << "\n";
+    if (m_memory_budget > 0) {
+        m_vout << "    memory budget: " << m_memory_budget << " MBytes\n";
+    }
+    m_vout << "    threads: " << m_threads << "\n";
+    m_vout << "    compact buffers and sort keys: " << yes_no(m_compact);
+    m_vout << "    check whether input is sorted: " << yes_no(m_check_sorted);
+    m_vout << "    remove duplicates: " << yes_no(m_dedupe);
+    if (m_strategy == "external") {
+        m_vout << "    run size: " << m_run_size << " MBytes\n";
+        m_vout << "    directory for temporary files: " << m_temp_directory << "\n";
+    }
+}
+
+namespace {
+
+    using object_pointers = std::vector<const osmium::OSMObject*>;
+
+    // Size of the buffers partially filled input buffers are compacted into.
+    constexpr const std::size_t compact_buffer_size = 16UL * 1024UL * 1024UL;
+
+    void add_objects(osmium::memory::ItemIteratorRange<osmium::OSMObject> range, object_pointers& objects) {
+        for (const auto& object : range) {
+            objects.push_back(&object);
+        }
+    }
+
+    /**
+     * Add the contents of the buffer to data and pointers to all objects
+     * in it to objects. If compact is set, the contents of the buffer are
+     * copied to the end of the last buffer in data if there is enough
+     * space or to a new large buffer, so that the unused capacity of
+     * the input buffers doesn't waste memory.
+     */
+    void add_buffer(std::vector<osmium::memory::Buffer>& data, object_pointers& objects, osmium::memory::Buffer&& buffer, bool compact) {
+        const auto size = buffer.committed();
+        if (!compact || size >= compact_buffer_size) {
+            add_objects(buffer.select<osmium::OSMObject>(), objects);
+            data.push_back(std::move(buffer));
+            return;
+        }
+
+        if (data.empty() || data.back().capacity() - data.back().committed() < size) {
+            data.emplace_back(compact_buffer_size, osmium::memory::Buffer::auto_grow::no);
+        }
+
+        auto& target = data.back();
+        unsigned char* start = target.reserve_space(size);
+        std::copy_n(buffer.data(), size, start);
+        target.commit();
+        add_objects(osmium::memory::ItemIteratorRange<osmium::OSMObject>{start, start + size}, objects);
+    }
+
+    // Contents of one input file read and decoded on its own thread.
+    struct input_data {
+        std::vector<osmium::memory::Buffer> buffers;
+        osmium::Box bounding_box;
+        std::size_t file_size = 0;
+    };
+
+    input_data read_input(const std::string& file_name) {
+        input_data input;
+        osmium::io::Reader reader{file_name, osmium::osm_entity_bits::object};
+        input.bounding_box = reader.header().joined_boxes();
+        while (osmium::memory::Buffer buffer = traced_read(reader)) {
+            input.buffers.push_back(std::move(buffer));
+        }
+        input.file_size = reader.file_size();
+        reader.close();
+        return input;
+    }
+
+    // If the objects are made up of at most this many already sorted
+    // runs, the runs are merged instead of sorting everything.
+    constexpr const std::size_t max_presorted_runs = 256;
+
+    /**
+     * Find the starts of the sorted runs in objects. Returns false if
+     * there are more than max_presorted_runs runs.
+     */
+    bool find_sorted_runs(object_pointers& objects, std::vector<object_pointers::iterator>& bounds) {
+        const osmium::object_order_type_id_version order;
+
+        bounds.push_back(objects.begin());
+        for (auto it = objects.begin() + 1; it < objects.end(); ++it) {
+            if (order(*it, *(it - 1))) {
+                if (bounds.size() == max_presorted_runs) {
+                    return false;
+                }
+                bounds.push_back(it);
+            }
+        }
+        bounds.push_back(objects.end());
+
+        return true;
+    }
+
+    void sort_objects(object_pointers& objects, int threads, bool compact) {
+        if (objects.empty()) {
+            return;
+        }
+
+        const TraceSpan span{"sort"};
+
+        std::vector<object_pointers::iterator> bounds;
+        if (find_sorted_runs(objects, bounds)) {
+            parallel_merge(std::move(bounds), osmium::object_order_type_id_version{}, threads);
+            return;
+        }
+
+        if (compact && radix_sort_objects(objects.begin(), objects.end(), threads)) {
+            return;
+        }
+        parallel_sort(objects.begin(), objects.end(), osmium::object_order_type_id_version{}, threads);
+    }
+
+    /**
+     * Remove objects with the same type, id, and version as the object
+     * before them from the sorted objects. Returns the number of objects
+     * removed.
+     */
+    std::size_t remove_duplicates(object_pointers& objects) {
+        const TraceSpan span{"dedupe"};
+
+        const osmium::object_equal_type_id_version equal;
+        const auto end = std::unique(objects.begin(), objects.end(), [&equal](const osmium::OSMObject* lhs, const osmium::OSMObject* rhs) {
+            return equal(*lhs, *rhs);
+        });
+        const auto removed = static_cast<std::size_t>(std::distance(end, objects.end()));
+        objects.erase(end, objects.end());
+
+        return removed;
+    }
+
+    // Number of objects copied into each output buffer when the output
+    // buffers are built on the thread pool.
+    constexpr const std::size_t write_chunk_size = 64UL * 1024UL;
+
+    /**
+     * Write the sorted objects to the writer. If a pool is given, the
+     * objects are copied into output buffers in chunks on the pool and
+     * the buffers are handed to the writer in order.
+     */
+    void write_objects(osmium::io::Writer& writer, const object_pointers& objects, osmium::thread::Pool* pool) {
+        const TraceSpan span{"write"};
+
+        if (!pool) {
+            for (const auto* object : objects) {
+                writer(*object);
+            }
+            return;
+        }
+
+        std::deque<std::future<osmium::memory::Buffer>> pending;
+        const std::size_t max_pending = static_cast<std::size_t>(pool->num_threads()) * 4;
+
+        for (std::size_t start = 0; start < objects.size(); start += write_chunk_size) {
+            const auto begin = objects.cbegin() + static_cast<std::ptrdiff_t>(start);
+            const auto end = objects.cbegin() + static_cast<std::ptrdiff_t>(std::min(start + write_chunk_size, objects.size()));
+            pending.push_back(pool->submit([begin, end]() {
+                osmium::memory::Buffer buffer{4UL * 1024UL * 1024UL, osmium::memory::Buffer::auto_grow::yes};
+                for (auto it = begin; it != end; ++it) {
+                    buffer.add_item(**it);
+                    buffer.commit();
+                }
+                return buffer;
+            }));
+            while (pending.size() > max_pending) {
+                writer(pending.front().get());
+                pending.pop_front();
+            }
+        }
+
+        for (auto& future : pending) {
+            writer(future.get());
+        }
+    }
+
+    // Size of the chunks in the temporary run files.
+    constexpr const std::size_t run_chunk_size = 1024UL * 1024UL;
+
+    // Maximum number of runs that are merged at the same time. If there
+    // are more runs, they are merged into larger runs first.
+    constexpr const std::size_t max_merge_width = 64;
+
+    /**
+     * Writes a sorted run of OSM objects to a temporary file. The file
+     * contains a sequence of chunks, each consisting of its size as a
+     * 64bit integer followed by the committed contents of a buffer.
+     */
+    class RunWriter {
+
+        std::string m_filename;
+        std::ofstream m_out;
+        osmium::memory::Buffer m_buffer{run_chunk_size, osmium::memory::Buffer::auto_grow::yes};
+
+        void flush() {
+            const std::uint64_t size = m_buffer.committed();
+            if (size == 0) {
+                return;
+            }
+            m_out.write(reinterpret_cast<const char*>(&size), sizeof(size));
+            m_out.write(reinterpret_cast<const char*>(m_buffer.data()), static_cast<std::streamsize>(size));
+            if (!m_out) {
+                throw osmium::io_error{"Error writing temporary file '" + m_filename + "'"};
+            }
+            m_buffer.clear();
+        }
+
+    public:
+
+        explicit RunWriter(const std::string& filename) :
+            m_filename(filename),
+            m_out(filename, std::ios::binary | std::ios::trunc) {
+            if (!m_out) {
+                throw osmium::io_error{"Could not open temporary file '" + m_filename + "'"};
+            }
+        }
+
+        void operator()(const osmium::OSMObject& object) {
+            m_buffer.add_item(object);
+            m_buffer.commit();
+            if (m_buffer.committed() >= run_chunk_size) {
+                flush();
+            }
+        }
+
+        void close() {
+            flush();
+            m_out.close();
+            if (!m_out) {
+                throw osmium::io_error{"Error closing temporary file '" + m_filename + "'"};
+            }
+        }
+
+    }; // class RunWriter
+
+    /**
+     * Reads back a run written by the RunWriter one chunk at a time.
+     */
+    class RunReader {
+
+        using iterator = osmium::memory::Buffer::t_iterator<osmium::OSMObject>;
+
+        std::string m_filename;
+        std::ifstream m_in;
+        osmium::memory::Buffer m_buffer;
+        iterator m_it;
+        iterator m_end;
+
+        bool read_chunk() {
+            std::uint64_t size = 0;
+            if (!m_in.read(reinterpret_cast<char*>(&size), sizeof(size))) {
+                return false;
+            }
+
+            m_buffer = osmium::memory::Buffer{static_cast<std::size_t>(size), osmium::memory::Buffer::auto_grow::no};
+            unsigned char* data = m_buffer.reserve_space(static_cast<std::size_t>(size));
+            if (!m_in.read(reinterpret_cast<char*>(data), static_cast<std::streamsize>(size))) {
+                throw osmium::io_error{"Error reading temporary file '" + m_filename + "'"};
+            }
+            m_buffer.commit();
+
+            m_it = m_buffer.begin<osmium::OSMObject>();
+            m_end = m_buffer.end<osmium::OSMObject>();
+            return m_it != m_end;
+        }
+
+    public:
+
+        explicit RunReader(const std::string& filename) :
+            m_filename(filename),
+            m_in(filename, std::ios::binary) {
+            if (!m_in) {
+                throw osmium::io_error{"Could not open temporary file '" + m_filename + "'"};
+            }
+            read_chunk();
+        }
+
+        bool empty() const noexcept {
+            return m_it == m_end;
+        }
+
+        bool next() {
+            ++m_it;
+            return m_it != m_end || read_chunk();
+        }
+
+        const osmium::OSMObject* get() noexcept {
+            return &*m_it;
+        }
+
+    }; // class RunReader
+
+    class RunQueueElement {
+
+        const osmium::OSMObject* m_object;
+        std::size_t m_run_index;
+
+    public:
+
+        RunQueueElement(const osmium::OSMObject* object, std::size_t run_index) noexcept :
+            m_object(object),
+            m_run_index(run_index) {
+        }
+
+        const osmium::OSMObject& object() const noexcept {
+            return *m_object;
+        }
+
+        std::size_t run_index() const noexcept {
+            return m_run_index;
+        }
+
+    }; // RunQueueElement
+
+    // Reversed order for the priority queue, objects comparing equal
+    // are taken from the earlier run first so the result is stable.
+    bool operator<(const RunQueueElement& lhs, const RunQueueElement& rhs) noexcept {
+        const osmium::object_order_type_id_version order;
+        if (order(rhs.object(), lhs.object())) {
+            return true;
+        }
+        if (order(lhs.object(), rhs.object())) {
+            return false;
+        }
+        return lhs.run_index() > rhs.run_index();
+    }
+
+    /**
+     * Output wrapper for merge_runs() which drops objects with the same
+     * type, id, and version as the object before them. Only the key of
+     * the last object is kept, the object itself may be gone when the
+     * run reader has read its next chunk.
+     */
+    template <typename TOutput>
+    class DuplicateFilter {
+
+        using key_type = std::tuple<osmium::item_type, osmium::object_id_type, osmium::object_version_type>;
+
+        TOutput& m_output;
+        key_type m_last_key;
+        bool m_first = true;
+        std::size_t m_removed = 0;
+
+    public:
+
+        explicit DuplicateFilter(TOutput& output) :
+            m_output(output) {
+        }
+
+        void operator()(const osmium::OSMObject& object) {
+            const key_type key{object.type(), object.id(), object.version()};
+            if (!m_first && key == m_last_key) {
+                ++m_removed;
+                return;
+            }
+            m_first = false;
+            m_last_key = key;
+            m_output(object);
+        }
+
+        std::size_t removed() const noexcept {
+            return m_removed;
+        }
+
+    }; // class DuplicateFilter
+
+    template <typename TOutput>
+    void merge_runs(const std::vector<std::string>& filenames, TOutput&& output) {
+        const TraceSpan span{"merge runs"};
+
+        std::vector<std::unique_ptr<RunReader>> readers;
+        readers.reserve(filenames.size());
+
+        std::priority_queue<RunQueueElement> queue;
+
+        for (const auto& filename : filenames) {
+            readers.emplace_back(new RunReader{filename});
+            if (!readers.back()->empty()) {
+                queue.emplace(readers.back()->get(), readers.size() - 1);
+            }
+        }
+
+        while (!queue.empty()) {
+            const auto element = queue.top();
+            queue.pop();
+            output(element.object());
+
+            const auto index = element.run_index();
+            if (readers[index]->next()) {
+                queue.emplace(readers[index]->get(), index);
+            }
+        }
+    }
+
+} // anonymous namespace
+
+void CommandSort::dedupe(object_pointers& objects) {
+    if (!m_dedupe) {
+        return;
+    }
+    const auto removed = remove_duplicates(objects);
+    m_vout << "Removed " << removed << " duplicate objects.\n";
+    m_metrics.add("duplicates", removed);
+}
+
+bool CommandSort::input_is_sorted() {
+    using key_type = std::tuple<osmium::item_type, bool, osmium::unsigned_object_id_type>;
+
+    m_vout << "Checking whether input is already sorted...\n";
+
+    bool first = true;
+    key_type last_key;
+    for (const auto& file : m_input_files) {
+        osmium::io::Reader reader{file, osmium::osm_entity_bits::object, osmium::io::read_meta::no};
+        while (osmium::memory::Buffer buffer = traced_read(reader)) {
+            for (const auto& object : buffer.select<osmium::OSMObject>()) {
+                const key_type key{object.type(), object.id() > 0, object.positive_id()};
+                // Objects with the same type and id (as in history
+                // files) can't be checked without metadata.
+                if (!first && !(last_key < key)) {
+                    m_vout << "Input is not sorted.\n";
+                    return false;
+                }
+                first = false;
+                last_key = key;
+            }
+        }
+        reader.close();
+    }
+
+    m_vout << "Input is already sorted.\n";
+    return true;
+}
+
+bool CommandSort::run_copy() {
+    osmium::Box bounding_box;
+
+    m_vout << "Reading input file headers...\n";
+    for (const auto& file : m_input_files) {
+        osmium::io::Reader reader{file, osmium::osm_entity_bits::nothing};
+        bounding_box.extend(reader.header().joined_boxes());
+        reader.close();
+    }
+
+    m_vout << "Opening output file...\n";
+    osmium::io::Header header;
+    setup_header(header);
+    if (bounding_box) {
+        header.add_box(bounding_box);
+    }
+
+    osmium::io::Writer writer{m_output_file, header, m_output_overwrite, m_fsync};
+
+    m_vout << "Copying input files to output file...\n";
+    osmium::ProgressBar progress_bar{file_size_sum(m_input_files), display_progress()};
+    for (const auto& file : m_input_files) {
+        osmium::io::Reader reader{file, osmium::osm_entity_bits::object};
+        while (osmium::memory::Buffer buffer = traced_read(reader)) {
+            progress_bar.update(reader.offset());
+            traced_write(writer, std::move(buffer));
+        }
+        progress_bar.file_done(reader.file_size());
+        reader.close();
+    }
+    progress_bar.done();
+
+    m_vout << "Closing output file...\n";
+    writer.close();
+
+    show_memory_used();
+    m_vout << "Done.\n";
+
+    return true;
 }
 
 bool CommandSort::run_single_pass() {
     std::vector<osmium::memory::Buffer> data;
-    osmium::ObjectPointerCollection objects;
+    object_pointers objects;
 
     osmium::Box bounding_box;
 
@@ -106,21 +647,47 @@ bool CommandSort::run_single_pass() {
     uint64_t buffers_capacity = 0;
 
     m_vout << "Reading contents of input files...\n";
+    m_metrics.start_phase("read");
     osmium::ProgressBar progress_bar{file_size_sum(m_input_files), display_progress()};
-    for (const std::string& file_name : m_filenames) {
-        osmium::io::Reader reader{file_name, osmium::osm_entity_bits::object};
-        osmium::io::Header header{reader.header()};
-        bounding_box.extend(header.joined_boxes());
-        while (osmium::memory::Buffer buffer = reader.read()) {
-            ++buffers_count;
-            buffers_size += buffer.committed();
-            buffers_capacity += buffer.capacity();
-            progress_bar.update(reader.offset());
-            osmium::apply(buffer, objects);
-            data.push_back(std::move(buffer));
+    const auto add = [&](osmium::memory::Buffer&& buffer) {
+        ++buffers_count;
+        buffers_size += buffer.committed();
+        buffers_capacity += buffer.capacity();
+        m_metrics.add_buffer(buffer);
+        add_buffer(data, objects, std::move(buffer), m_compact);
+    };
+    if (m_threads > 1 && m_filenames.size() > 1) {
+        // Several input files are read and decoded at the same time,
+        // each into its own buffers. They are added in the order of the
+        // input files, so the result is the same as with one thread.
+        auto& pool = thread_pool();
+        std::vector<std::future<input_data>> futures;
+        futures.reserve(m_filenames.size());
+        for (const std::string& file_name : m_filenames) {
+            futures.push_back(pool.submit([file_name]() {
+                return read_input(file_name);
+            }));
+        }
+        for (auto& future : futures) {
+            input_data input{future.get()};
+            bounding_box.extend(input.bounding_box);
+            for (auto& buffer : input.buffers) {
+                add(std::move(buffer));
+            }
+            progress_bar.file_done(input.file_size);
+        }
+    } else {
+        for (const std::string& file_name : m_filenames) {
+            osmium::io::Reader reader{file_name, osmium::osm_entity_bits::object};
+            osmium::io::Header header{reader.header()};
+            bounding_box.extend(header.joined_boxes());
+            while (osmium::memory::Buffer buffer = traced_read(reader)) {
+                progress_bar.update(reader.offset());
+                add(std::move(buffer));
+            }
+            progress_bar.file_done(reader.file_size());
+            reader.close();
         }
-        progress_bar.file_done(reader.file_size());
-        reader.close();
     }
     progress_bar.done();
 
@@ -148,14 +715,17 @@ bool CommandSort::run_single_pass() {
     osmium::io::Writer writer{m_output_file, header, m_output_overwrite, m_fsync};
 
     m_vout << "Sorting data...\n";
-    objects.sort(osmium::object_order_type_id_version());
+    m_metrics.start_phase("sort");
+    sort_objects(objects, m_threads, m_compact);
+    dedupe(objects);
 
     m_vout << "Writing out sorted data...\n";
-    auto out = osmium::io::make_output_iterator(writer);
-    std::copy(objects.begin(), objects.end(), out);
+    m_metrics.start_phase("write");
+    write_objects(writer, objects, m_threads > 1 ? &thread_pool() : nullptr);
 
     m_vout << "Closing output file...\n";
     writer.close();
+    m_metrics.end_phase();
 
     show_memory_used();
     m_vout << "Done.\n";
@@ -183,30 +753,62 @@ bool CommandSort::run_multi_pass() {
 
     osmium::io::Writer writer{m_output_file, header, m_output_overwrite, m_fsync};
 
+    // For PBF files find out which blocks contain which types first, so
+    // that each pass only has to decode the blocks with its type.
+    std::vector<std::unique_ptr<pbf_type_blocks>> type_blocks;
+    for (std::size_t i = 0; i < m_filenames.size(); ++i) {
+        const auto& file = m_input_files[i];
+        if (file.format() == osmium::io::file_format::pbf && !file.filename().empty() && file.filename() != "-") {
+            m_vout << "Finding blocks for each object type in '" << file.filename() << "'...\n";
+            type_blocks.emplace_back(new pbf_type_blocks{get_pbf_type_blocks(file.filename())});
+        } else {
+            type_blocks.emplace_back(nullptr);
+        }
+    }
+
     osmium::ProgressBar progress_bar{file_size_sum(m_input_files) * 3, display_progress()};
 
     int pass = 1;
     for (const auto entity : {osmium::osm_entity_bits::node, osmium::osm_entity_bits::way, osmium::osm_entity_bits::relation}) {
         std::vector<osmium::memory::Buffer> data;
-        osmium::ObjectPointerCollection objects;
+        object_pointers objects;
 
         uint64_t buffers_count = 0;
         uint64_t buffers_size = 0;
         uint64_t buffers_capacity = 0;
 
+        const std::string pass_name{"pass " + std::to_string(pass)};
         m_vout << "Pass " << pass++ << "...\n";
         m_vout << "Reading contents of input files...\n";
-        for (const std::string& file_name : m_filenames) {
+        m_metrics.start_phase(pass_name + " read");
+        const auto add = [&](osmium::memory::Buffer&& buffer) {
+            ++buffers_count;
+            buffers_size += buffer.committed();
+            buffers_capacity += buffer.capacity();
+            m_metrics.add_buffer(buffer);
+            add_buffer(data, objects, std::move(buffer), m_compact);
+        };
+
+        for (std::size_t i = 0; i < m_filenames.size(); ++i) {
+            const std::string& file_name = m_filenames[i];
+            if (type_blocks[i]) {
+                const auto& blocks = *type_blocks[i];
+                std::vector<std::size_t> offsets{entity == osmium::osm_entity_bits::node ? blocks.nodes :
+                                                 entity == osmium::osm_entity_bits::way  ? blocks.ways :
+                                                                                           blocks.relations};
+                PBFDataReader reader{file_name, std::move(offsets), PBFDataReader::offsets_mode::read, entity};
+                while (osmium::memory::Buffer buffer = traced_read(reader)) {
+                    progress_bar.update(reader.offset());
+                    add(std::move(buffer));
+                }
+                progress_bar.file_done(osmium::file_size(file_name));
+                continue;
+            }
+
             osmium::io::Reader reader{file_name, entity};
-            osmium::io::Header header{reader.header()};
-            bounding_box.extend(header.joined_boxes());
-            while (osmium::memory::Buffer buffer = reader.read()) {
-                ++buffers_count;
-                buffers_size += buffer.committed();
-                buffers_capacity += buffer.capacity();
+            while (osmium::memory::Buffer buffer = traced_read(reader)) {
                 progress_bar.update(reader.offset());
-                osmium::apply(buffer, objects);
-                data.push_back(std::move(buffer));
+                add(std::move(buffer));
             }
             progress_bar.file_done(reader.file_size());
             reader.close();
@@ -231,17 +833,138 @@ bool CommandSort::run_multi_pass() {
         }
 
         m_vout << "Sorting data...\n";
-        objects.sort(osmium::object_order_type_id_version());
+        m_metrics.start_phase(pass_name + " sort");
+        sort_objects(objects, m_threads, m_compact);
+        dedupe(objects);
 
         m_vout << "Writing out sorted data...\n";
-        auto out = osmium::io::make_output_iterator(writer);
-        std::copy(objects.begin(), objects.end(), out);
+        m_metrics.start_phase(pass_name + " write");
+        write_objects(writer, objects, m_threads > 1 ? &thread_pool() : nullptr);
     }
 
     progress_bar.done();
 
     m_vout << "Closing output file...\n";
     writer.close();
+    m_metrics.end_phase();
+
+    show_memory_used();
+    m_vout << "Done.\n";
+
+    return true;
+}
+
+
+bool CommandSort::run_external() {
+    osmium::Box bounding_box;
+
+    TempFiles temp_files{m_temp_directory, "osmium-sort", ".run"};
+    std::vector<std::string> runs;
+
+    std::vector<osmium::memory::Buffer> data;
+    object_pointers objects;
+    std::size_t run_memory = 0;
+    const std::size_t max_run_memory = m_run_size * 1024UL * 1024UL;
+
+    const auto write_run = [&]() {
+        sort_objects(objects, m_threads, m_compact);
+
+        const TraceSpan span{"write run"};
+        runs.push_back(temp_files.create());
+        RunWriter run_writer{runs.back()};
+        for (const auto* object : objects) {
+            run_writer(*object);
+        }
+        run_writer.close();
+        m_metrics.add("runs", 1);
+
+        objects.clear();
+        data.clear();
+        run_memory = 0;
+    };
+
+    m_vout << "Reading contents of input files and writing sorted runs...\n";
+    m_metrics.start_phase("read and write runs");
+    osmium::ProgressBar progress_bar{file_size_sum(m_input_files), display_progress()};
+    for (const std::string& file_name : m_filenames) {
+        osmium::io::Reader reader{file_name, osmium::osm_entity_bits::object};
+        osmium::io::Header header{reader.header()};
+        bounding_box.extend(header.joined_boxes());
+        while (osmium::memory::Buffer buffer = traced_read(reader)) {
+            progress_bar.update(reader.offset());
+            m_metrics.add_buffer(buffer);
+            const auto old_size = objects.size();
+            run_memory += m_compact ? buffer.committed() : buffer.capacity();
+            add_buffer(data, objects, std::move(buffer), m_compact);
+            run_memory += (objects.size() - old_size) * sizeof(osmium::OSMObject*);
+            if (run_memory >= max_run_memory) {
+                write_run();
+            }
+        }
+        progress_bar.file_done(reader.file_size());
+        reader.close();
+    }
+    progress_bar.done();
+
+    m_vout << "Opening output file...\n";
+    osmium::io::Header header;
+    setup_header(header);
+    if (bounding_box) {
+        header.add_box(bounding_box);
+    }
+
+    osmium::io::Writer writer{m_output_file, header, m_output_overwrite, m_fsync};
+
+    if (runs.empty()) {
+        m_vout << "All data fits into one run. Sorting data...\n";
+        m_metrics.start_phase("sort");
+        sort_objects(objects, m_threads, m_compact);
+        dedupe(objects);
+
+        m_vout << "Writing out sorted data...\n";
+        m_metrics.start_phase("write");
+        const TraceSpan span{"write"};
+        for (const auto* object : objects) {
+            writer(*object);
+        }
+    } else {
+        if (!objects.empty()) {
+            write_run();
+        }
+        m_vout << "Wrote " << runs.size() << " sorted runs to temporary files.\n";
+        m_metrics.start_phase("merge");
+
+        while (runs.size() > max_merge_width) {
+            m_vout << "Merging " << max_merge_width << " runs into one...\n";
+            const std::vector<std::string> merge_from(runs.begin(), runs.begin() + max_merge_width);
+            runs.erase(runs.begin(), runs.begin() + max_merge_width);
+
+            // The merged run holds the oldest objects, so it goes in front
+            // of the remaining runs to keep the result stable.
+            runs.insert(runs.begin(), temp_files.create());
+            RunWriter run_writer{runs.front()};
+            merge_runs(merge_from, run_writer);
+            run_writer.close();
+
+            for (const auto& filename : merge_from) {
+                std::remove(filename.c_str());
+            }
+        }
+
+        m_vout << "Merging " << runs.size() << " runs and writing out sorted data...\n";
+        if (m_dedupe) {
+            DuplicateFilter<osmium::io::Writer> filter{writer};
+            merge_runs(runs, filter);
+            m_vout << "Removed " << filter.removed() << " duplicate objects.\n";
+            m_metrics.add("duplicates", filter.removed());
+        } else {
+            merge_runs(runs, writer);
+        }
+    }
+
+    m_vout << "Closing output file...\n";
+    writer.close();
+    m_metrics.end_phase();
 
     show_memory_used();
     m_vout << "Done.\n";
@@ -250,9 +973,15 @@ bool CommandSort::run_multi_pass() {
 }
 
 bool CommandSort::run() {
+    if (m_check_sorted && input_is_sorted()) {
+        return run_copy();
+    }
     if (m_strategy == "simple") {
         return run_single_pass();
     }
+    if (m_strategy == "external") {
+        return run_external();
+    }
     return run_multi_pass();
 }
 
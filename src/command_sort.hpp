@@ -25,6 +25,9 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "cmd.hpp" // IWYU pragma: export
 
+#include <osmium/osm/object.hpp>
+
+#include <cstddef>
 #include <string>
 #include <vector>
 
@@ -32,6 +35,15 @@ class CommandSort : public Command, public with_multiple_osm_inputs, public with
 
     std::vector<std::string> m_filenames;
     std::string m_strategy{"simple"};
+    std::string m_temp_directory;
+    std::size_t m_run_size = 1024;
+    bool m_compact = false;
+    bool m_check_sorted = false;
+    bool m_dedupe = false;
+
+    void dedupe(std::vector<const osmium::OSMObject*>& objects);
+
+    bool input_is_sorted();
 
 public:
 
@@ -43,10 +55,14 @@ public:
 
     void show_arguments() override final;
 
+    bool run_copy();
+
     bool run_single_pass();
 
     bool run_multi_pass();
 
+    bool run_external();
+
     bool run() override final;
 
     const char* name() const noexcept override final {
@@ -0,0 +1,389 @@
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "command_tags_count.hpp"
+#include "exception.hpp"
+#include "util.hpp"
+
+#include <osmium/io/detail/read_write.hpp>
+#include <osmium/io/reader.hpp>
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm/entity_bits.hpp>
+#include <osmium/osm/item_type.hpp>
+#include <osmium/osm/object.hpp>
+#include <osmium/osm/tag.hpp>
+#include <osmium/thread/pool.hpp>
+#include <osmium/util/progress_bar.hpp>
+#include <osmium/util/verbose_output.hpp>
+
+#include <boost/program_options.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <deque>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+void CommandTagsCount::add_expression(const std::string& str) {
+    const auto expr = get_filter_expression(str);
+    if (expr.second.empty()) {
+        throw argument_error{"Empty tag expression '" + str + "'."};
+    }
+    m_expressions.push_back(expression{expr.first,
+                                       get_tag_matcher(expr.second),
+                                       expr.second.find('=') != std::string::npos});
+}
+
+void CommandTagsCount::read_expressions_file(const std::string& file_name) {
+    m_vout << "Reading expressions file...\n";
+
+    std::ifstream file{file_name};
+    if (!file.is_open()) {
+        throw argument_error{"Could not open file '" + file_name + "'"};
+    }
+
+    for (std::string line; std::getline(file, line);) {
+        const auto pos = line.find_first_of('#');
+        if (pos != std::string::npos) {
+            line.erase(pos);
+        }
+        if (!line.empty() && line.back() == '\r') {
+            line.resize(line.size() - 1);
+        }
+        strip_whitespace(line);
+        if (!line.empty()) {
+            add_expression(line);
+        }
+    }
+}
+
+bool CommandTagsCount::setup(const std::vector<std::string>& arguments) {
+    po::options_description opts_cmd{"COMMAND OPTIONS"};
+    opts_cmd.add_options()
+    ("expressions,e", po::value<std::string>(), "Read tag expressions from file")
+    ("min-count,m", po::value<uint64_t>(), "Only show keys/tags found at least this many times")
+    ("max-count,M", po::value<uint64_t>(), "Only show keys/tags found at most this many times")
+    ("top", po::value<std::size_t>(), "Only show this many keys/tags (after sorting)")
+    ("sort,s", po::value<std::string>(), "Sort order: count-desc (default), count-asc, name-asc, name-desc")
+    ("per-type", "Also show counts for nodes, ways, and relations")
+    ("output,o", po::value<std::string>(), "Output file (default: STDOUT)")
+    ("overwrite,O", "Allow existing output file to be overwritten")
+    ;
+
+    po::options_description opts_common{add_common_options()};
+    po::options_description opts_input{add_single_input_options()};
+
+    po::options_description hidden;
+    hidden.add_options()
+    ("input-filename", po::value<std::string>(), "OSM input file")
+    ("expression-list", po::value<std::vector<std::string>>(), "Tag expressions")
+    ;
+
+    po::options_description desc;
+    desc.add(opts_cmd).add(opts_common).add(opts_input);
+
+    po::options_description parsed_options;
+    parsed_options.add(desc).add(hidden);
+
+    po::positional_options_description positional;
+    positional.add("input-filename", 1);
+    positional.add("expression-list", -1);
+
+    po::variables_map vm;
+    po::store(po::command_line_parser(arguments).options(parsed_options).positional(positional).run(), vm);
+    po::notify(vm);
+
+    setup_common(vm, desc);
+    setup_progress(vm);
+    setup_input_file(vm);
+
+    if (vm.count("expression-list")) {
+        for (const auto& str : vm["expression-list"].as<std::vector<std::string>>()) {
+            add_expression(str);
+        }
+    }
+
+    if (vm.count("expressions")) {
+        read_expressions_file(vm["expressions"].as<std::string>());
+    }
+
+    // Without expressions all keys are counted.
+    if (m_expressions.empty()) {
+        add_expression("*");
+    }
+
+    if (vm.count("min-count")) {
+        m_min_count = vm["min-count"].as<uint64_t>();
+    }
+
+    if (vm.count("max-count")) {
+        m_max_count = vm["max-count"].as<uint64_t>();
+        if (m_max_count < m_min_count) {
+            throw argument_error{"The --max-count must not be smaller than --min-count."};
+        }
+    }
+
+    if (vm.count("top")) {
+        m_top = vm["top"].as<std::size_t>();
+        if (m_top == 0) {
+            throw argument_error{"The --top option needs a positive number."};
+        }
+    }
+
+    if (vm.count("sort")) {
+        m_sort_order = vm["sort"].as<std::string>();
+        if (m_sort_order != "count-desc" && m_sort_order != "count-asc" &&
+            m_sort_order != "name-asc" && m_sort_order != "name-desc") {
+            throw argument_error{"Unknown sort order '" + m_sort_order + "'. Use 'count-desc', 'count-asc', 'name-asc', or 'name-desc'."};
+        }
+    }
+
+    if (vm.count("per-type")) {
+        m_per_type = true;
+    }
+
+    if (vm.count("output")) {
+        m_output_filename = vm["output"].as<std::string>();
+        if (m_output_filename == "-") {
+            m_output_filename.clear();
+        }
+    }
+
+    if (vm.count("overwrite")) {
+        m_output_overwrite = osmium::io::overwrite::allow;
+    }
+
+    return true;
+}
+
+void CommandTagsCount::show_arguments() {
+    show_single_input_arguments(m_vout);
+
+    m_vout << "  output options:\n";
+    m_vout << "    file name: " << (m_output_filename.empty() ? "(STDOUT)" : m_output_filename) << '\n';
+    m_vout << "    overwrite: " << yes_no(m_output_overwrite == osmium::io::overwrite::allow);
+
+    m_vout << "  other options:\n";
+    m_vout << "    number of tag expressions: " << m_expressions.size() << '\n';
+    m_vout << "    min count: " << m_min_count << '\n';
+    if (m_max_count > 0) {
+        m_vout << "    max count: " << m_max_count << '\n';
+    }
+    if (m_top > 0) {
+        m_vout << "    top: " << m_top << '\n';
+    }
+    m_vout << "    sort order: " << m_sort_order << '\n';
+    m_vout << "    counts per object type: " << yes_no(m_per_type);
+    m_vout << "    threads: " << m_threads << '\n';
+}
+
+void CommandTagsCount::count_tags(const osmium::memory::Buffer& buffer, counts_map& counts) const {
+    std::string name;
+    for (const auto& object : buffer.select<osmium::OSMObject>()) {
+        const auto entities = osmium::osm_entity_bits::from_item_type(object.type());
+        for (const auto& tag : object.tags()) {
+            // Each tag is counted at most once as key and once as tag
+            // even if several expressions match.
+            bool key_counted = false;
+            bool tag_counted = false;
+            for (const auto& expr : m_expressions) {
+                if (!(expr.entities & entities) ||
+                    (expr.with_values ? tag_counted : key_counted) ||
+                    !expr.matcher(tag)) {
+                    continue;
+                }
+                name = tag.key();
+                if (expr.with_values) {
+                    name += '\0';
+                    name += tag.value();
+                    tag_counted = true;
+                } else {
+                    key_counted = true;
+                }
+                ++counts[name](object.type());
+            }
+        }
+    }
+}
+
+namespace {
+
+    uint64_t total(const osmium::nwr_array<uint64_t>& counts) noexcept {
+        return counts(osmium::item_type::node) +
+               counts(osmium::item_type::way) +
+               counts(osmium::item_type::relation);
+    }
+
+    void append_quoted(std::string& out, const char* begin, const char* end) {
+        out += '"';
+        for (; begin != end; ++begin) {
+            if (*begin == '"') {
+                out += '"';
+            }
+            out += *begin;
+        }
+        out += '"';
+    }
+
+} // anonymous namespace
+
+void CommandTagsCount::write_counts(const counts_map& counts) {
+    using entry = counts_map::value_type;
+
+    std::vector<const entry*> entries;
+    for (const auto& e : counts) {
+        const auto count = total(e.second);
+        if (count >= m_min_count && (m_max_count == 0 || count <= m_max_count)) {
+            entries.push_back(&e);
+        }
+    }
+
+    const auto name_less = [](const entry* a, const entry* b) {
+        return a->first < b->first;
+    };
+
+    if (m_sort_order == "count-desc") {
+        std::sort(entries.begin(), entries.end(), [&](const entry* a, const entry* b) {
+            const auto ca = total(a->second);
+            const auto cb = total(b->second);
+            return ca == cb ? name_less(a, b) : ca > cb;
+        });
+    } else if (m_sort_order == "count-asc") {
+        std::sort(entries.begin(), entries.end(), [&](const entry* a, const entry* b) {
+            const auto ca = total(a->second);
+            const auto cb = total(b->second);
+            return ca == cb ? name_less(a, b) : ca < cb;
+        });
+    } else if (m_sort_order == "name-asc") {
+        std::sort(entries.begin(), entries.end(), name_less);
+    } else {
+        std::sort(entries.begin(), entries.end(), [&](const entry* a, const entry* b) {
+            return name_less(b, a);
+        });
+    }
+
+    if (m_top > 0 && entries.size() > m_top) {
+        entries.resize(m_top);
+    }
+
+    const int fd = osmium::io::detail::open_for_writing(m_output_filename, m_output_overwrite);
+
+    std::string out;
+    for (const auto* e : entries) {
+        out += std::to_string(total(e->second));
+        if (m_per_type) {
+            out += '\t';
+            out += std::to_string(e->second(osmium::item_type::node));
+            out += '\t';
+            out += std::to_string(e->second(osmium::item_type::way));
+            out += '\t';
+            out += std::to_string(e->second(osmium::item_type::relation));
+        }
+        out += '\t';
+        const char* begin = e->first.data();
+        const char* end = begin + e->first.size();
+        const char* sep = std::find(begin, end, '\0');
+        append_quoted(out, begin, sep);
+        if (sep != end) {
+            out += '\t';
+            append_quoted(out, sep + 1, end);
+        }
+        out += '\n';
+        if (out.size() > 1024UL * 1024UL) {
+            osmium::io::detail::reliable_write(fd, out.data(), out.size());
+            out.clear();
+        }
+    }
+    osmium::io::detail::reliable_write(fd, out.data(), out.size());
+
+    if (fd != 1) {
+        osmium::io::detail::reliable_close(fd);
+    }
+}
+
+bool CommandTagsCount::run() {
+    osmium::osm_entity_bits::type entities = osmium::osm_entity_bits::nothing;
+    for (const auto& expr : m_expressions) {
+        entities |= expr.entities;
+    }
+
+    osmium::io::Reader reader{m_input_file, entities & osmium::osm_entity_bits::nwr};
+    osmium::ProgressBar progress_bar{reader.file_size(), display_progress()};
+
+    counts_map counts;
+
+    m_vout << "Counting tags...\n";
+    if (m_threads > 1) {
+        // Each buffer is counted into its own table in the thread pool,
+        // the tables are merged here in the order of the buffers.
+        auto& pool = thread_pool();
+        std::deque<std::future<counts_map>> pending;
+        const std::size_t max_pending = static_cast<std::size_t>(m_threads) * 4;
+
+        const auto merge = [&](counts_map&& buffer_counts) {
+            for (const auto& e : buffer_counts) {
+                auto& c = counts[e.first];
+                c(osmium::item_type::node) += e.second(osmium::item_type::node);
+                c(osmium::item_type::way) += e.second(osmium::item_type::way);
+                c(osmium::item_type::relation) += e.second(osmium::item_type::relation);
+            }
+        };
+
+        while (osmium::memory::Buffer buffer = reader.read()) {
+            progress_bar.update(reader.offset());
+            std::shared_ptr<osmium::memory::Buffer> buffer_ptr{new osmium::memory::Buffer{std::move(buffer)}};
+            pending.push_back(pool.submit([this, buffer_ptr]() {
+                counts_map buffer_counts;
+                count_tags(*buffer_ptr, buffer_counts);
+                return buffer_counts;
+            }));
+            while (pending.size() > max_pending) {
+                merge(pending.front().get());
+                pending.pop_front();
+            }
+        }
+        for (auto& future : pending) {
+            merge(future.get());
+        }
+    } else {
+        while (osmium::memory::Buffer buffer = reader.read()) {
+            progress_bar.update(reader.offset());
+            count_tags(buffer, counts);
+        }
+    }
+    progress_bar.done();
+    reader.close();
+
+    m_vout << "Found " << counts.size() << " different keys/tags.\n";
+
+    m_vout << "Writing output...\n";
+    write_counts(counts);
+
+    show_memory_used();
+    m_vout << "Done.\n";
+
+    return true;
+}
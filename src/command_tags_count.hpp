@@ -0,0 +1,98 @@
+#ifndef COMMAND_TAGS_COUNT_HPP
+#define COMMAND_TAGS_COUNT_HPP
+
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "cmd.hpp" // IWYU pragma: export
+
+#include <osmium/index/nwr_array.hpp>
+#include <osmium/io/writer_options.hpp>
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm/entity_bits.hpp>
+#include <osmium/tags/matcher.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class CommandTagsCount : public Command, public with_single_osm_input {
+
+public:
+
+    // The counts for one key or tag. For tags the name is the key and the
+    // value separated by a 0 byte.
+    using counts_map = std::unordered_map<std::string, osmium::nwr_array<uint64_t>>;
+
+private:
+
+    struct expression {
+        osmium::osm_entity_bits::type entities;
+        osmium::TagMatcher matcher;
+        bool with_values;
+    };
+
+    std::vector<expression> m_expressions;
+
+    std::string m_output_filename;
+    osmium::io::overwrite m_output_overwrite = osmium::io::overwrite::no;
+
+    std::string m_sort_order{"count-desc"};
+    uint64_t m_min_count = 0;
+    uint64_t m_max_count = 0;
+    std::size_t m_top = 0;
+    bool m_per_type = false;
+
+    void add_expression(const std::string& str);
+    void read_expressions_file(const std::string& file_name);
+
+    void write_counts(const counts_map& counts);
+
+public:
+
+    explicit CommandTagsCount(const CommandFactory& command_factory) :
+        Command(command_factory) {
+    }
+
+    bool setup(const std::vector<std::string>& arguments) override final;
+
+    void show_arguments() override final;
+
+    // Count the keys and tags in the buffer and add them to counts.
+    void count_tags(const osmium::memory::Buffer& buffer, counts_map& counts) const;
+
+    bool run() override final;
+
+    const char* name() const noexcept override final {
+        return "tags-count";
+    }
+
+    const char* synopsis() const noexcept override final {
+        return "osmium tags-count [OPTIONS] OSM-FILE [TAG-EXPRESSION...]";
+    }
+
+}; // class CommandTagsCount
+
+
+#endif // COMMAND_TAGS_COUNT_HPP
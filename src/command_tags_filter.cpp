@@ -22,46 +22,124 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "command_tags_filter.hpp"
 #include "exception.hpp"
+#include "id_file.hpp"
+#include "relations_map.hpp"
 #include "util.hpp"
 
-#include <osmium/index/relations_map.hpp>
+#include "extract/geojson_file_parser.hpp"
+
+#include <osmium/io/error.hpp>
+#include <osmium/io/file_format.hpp>
 #include <osmium/io/header.hpp>
 #include <osmium/io/reader.hpp>
 #include <osmium/io/writer.hpp>
 #include <osmium/memory/buffer.hpp>
 #include <osmium/osm.hpp>
-#include <osmium/tags/taglist.hpp>
+#include <osmium/thread/pool.hpp>
+#include <osmium/util/file.hpp>
 #include <osmium/util/progress_bar.hpp>
 #include <osmium/util/verbose_output.hpp>
 
 #include <boost/program_options.hpp>
 
+#include <rapidjson/document.h>
+#include <rapidjson/error/en.h>
+#include <rapidjson/istreamwrapper.h>
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
 #include <fstream>
+#include <future>
+#include <memory>
 #include <string>
 #include <utility>
 #include <vector>
 
-void CommandTagsFilter::add_filter(osmium::osm_entity_bits::type entities, const osmium::TagMatcher& matcher) {
+// Marks way IDs in the cached relation members.
+static constexpr const osmium::unsigned_object_id_type way_flag = 1ULL << 63U;
+
+void TagsFilterSet::add_filter(osmium::osm_entity_bits::type entities, const std::string& expression) {
     if (entities & osmium::osm_entity_bits::node) {
-        m_filters(osmium::item_type::node).add_rule(true, matcher);
+        filters(osmium::item_type::node).add_expression(expression);
     }
     if (entities & osmium::osm_entity_bits::way) {
-        m_filters(osmium::item_type::way).add_rule(true, matcher);
+        filters(osmium::item_type::way).add_expression(expression);
     }
     if (entities & osmium::osm_entity_bits::relation) {
-        m_filters(osmium::item_type::relation).add_rule(true, matcher);
+        filters(osmium::item_type::relation).add_expression(expression);
     }
     if (entities & osmium::osm_entity_bits::area) {
-        m_area_filters.add_rule(true, matcher);
+        area_filters.add_expression(expression);
     }
 }
 
-void CommandTagsFilter::parse_and_add_expression(const std::string& expression) {
+void TagsFilterSet::parse_and_add_expression(const std::string& expression) {
     const auto p = get_filter_expression(expression);
-    add_filter(p.first, get_tag_matcher(p.second));
+    add_filter(p.first, p.second);
+}
+
+void TagsFilterSet::add_nodes(const osmium::Way& way) {
+    for (const auto& nr : way.nodes()) {
+        referenced_ids(osmium::item_type::node).set(nr.positive_ref());
+    }
+}
+
+bool TagsFilterSet::matches_node(const osmium::Node& node) const noexcept {
+    return filters(osmium::item_type::node).match_any_of(node.tags());
+}
+
+bool TagsFilterSet::matches_way(const osmium::Way& way) const noexcept {
+    return filters(osmium::item_type::way).match_any_of(way.tags()) ||
+           (way.is_closed() &&
+            way.nodes().size() >= 4 &&
+               area_filters.match_any_of(way.tags()));
+}
+
+static bool is_multipolygon(const osmium::Relation& relation) noexcept {
+    const char* type = relation.tags().get_value_by_key("type");
+    if (type == nullptr) {
+        return false;
+    }
+
+    return !std::strcmp(type, "multipolygon") || !std::strcmp(type, "boundary");
+}
+
+bool TagsFilterSet::matches_relation(const osmium::Relation& relation) const noexcept {
+    return filters(osmium::item_type::relation).match_any_of(relation.tags()) ||
+           (is_multipolygon(relation) &&
+               area_filters.match_any_of(relation.tags()));
+}
+
+bool TagsFilterSet::matches_object(const osmium::OSMObject& object) const noexcept {
+    switch (object.type()) {
+        case osmium::item_type::node:
+            return matches_node(static_cast<const osmium::Node&>(object));
+        case osmium::item_type::way:
+            return matches_way(static_cast<const osmium::Way&>(object));
+        case osmium::item_type::relation:
+            return matches_relation(static_cast<const osmium::Relation&>(object));
+        default:
+            break;
+    }
+    return false;
+}
+
+bool TagsFilterSet::has_only_plain_keys() const noexcept {
+    return filters(osmium::item_type::node).has_only_plain_keys() &&
+           filters(osmium::item_type::way).has_only_plain_keys() &&
+           filters(osmium::item_type::relation).has_only_plain_keys() &&
+           area_filters.has_only_plain_keys();
+}
+
+bool TagsFilterSet::may_match_key(const char* key) const noexcept {
+    return filters(osmium::item_type::node).may_match_key(key) ||
+           filters(osmium::item_type::way).may_match_key(key) ||
+           filters(osmium::item_type::relation).may_match_key(key) ||
+           area_filters.may_match_key(key);
 }
 
-void CommandTagsFilter::read_expressions_file(const std::string& file_name) {
+void CommandTagsFilter::read_expressions_file(const std::string& file_name, TagsFilterSet& set) {
     m_vout << "Reading expressions file...\n";
 
     std::ifstream file{file_name};
@@ -78,18 +156,107 @@ void CommandTagsFilter::read_expressions_file(const std::string& file_name) {
             if (line.back() == '\r') {
                 line.resize(line.size() - 1);
             }
-            parse_and_add_expression(line);
+            set.parse_and_add_expression(line);
         }
     }
 }
 
+void CommandTagsFilter::parse_config_file() {
+    std::ifstream config_file{m_config_file_name};
+    if (!config_file.is_open()) {
+        throw config_error{"Could not open config file '" + m_config_file_name + "'."};
+    }
+    rapidjson::IStreamWrapper stream_wrapper{config_file};
+
+    rapidjson::Document doc;
+    if (doc.ParseStream<(rapidjson::kParseCommentsFlag | rapidjson::kParseTrailingCommasFlag)>(stream_wrapper).HasParseError()) {
+        throw config_error{std::string{"JSON error at offset "} +
+                           std::to_string(doc.GetErrorOffset()) +
+                           ": " +
+                           rapidjson::GetParseError_En(doc.GetParseError())
+                          };
+    }
+
+    if (!doc.IsObject()) {
+        throw config_error{"Top-level value must be an object."};
+    }
+
+    if (m_output_directory.empty()) {
+        m_output_directory = get_value_as_string(doc, "directory");
+        if (!m_output_directory.empty() && m_output_directory.back() != '/') {
+            m_output_directory += '/';
+        }
+    }
+
+    const auto json_filters = doc.FindMember("filters");
+    if (json_filters == doc.MemberEnd()) {
+        throw config_error{"Missing 'filters' member in top-level object."};
+    }
+
+    if (!json_filters->value.IsArray()) {
+        throw config_error{"'filters' member in top-level object must be array."};
+    }
+
+    m_vout << "  Reading filters from config file...\n";
+    for (const auto& f : json_filters->value.GetArray()) {
+        if (!f.IsObject()) {
+            throw config_error{"Members in 'filters' array must be objects."};
+        }
+
+        const std::string output{get_value_as_string(f, "output")};
+        if (output.empty()) {
+            throw config_error{"Missing 'output' field for filter."};
+        }
+
+        const std::string output_format{get_value_as_string(f, "output_format")};
+        osmium::io::File output_file{m_output_directory + output, output_format};
+        output_file.check();
+
+        std::unique_ptr<TagsFilterSet> set{new TagsFilterSet{output_file}};
+
+        const auto json_expressions = f.FindMember("expressions");
+        if (json_expressions != f.MemberEnd()) {
+            if (!json_expressions->value.IsArray()) {
+                throw config_error{"'expressions' member of filter '" + output + "' must be array."};
+            }
+            for (const auto& e : json_expressions->value.GetArray()) {
+                if (!e.IsString()) {
+                    throw config_error{"Members of 'expressions' array of filter '" + output + "' must be strings."};
+                }
+                set->parse_and_add_expression(e.GetString());
+            }
+        }
+
+        std::string expressions_file{get_value_as_string(f, "expressions_file")};
+        if (!expressions_file.empty()) {
+            if (expressions_file.front() != '/') {
+                expressions_file = m_config_directory + expressions_file;
+            }
+            read_expressions_file(expressions_file, *set);
+        }
+
+        if (json_expressions == f.MemberEnd() && expressions_file.empty()) {
+            throw config_error{"Missing 'expressions' or 'expressions_file' field for filter '" + output + "'."};
+        }
+
+        m_sets.push_back(std::move(set));
+    }
+
+    if (m_sets.empty()) {
+        throw config_error{"No filters defined in config file."};
+    }
+}
+
 bool CommandTagsFilter::setup(const std::vector<std::string>& arguments) {
     po::options_description opts_cmd{"COMMAND OPTIONS"};
     opts_cmd.add_options()
     ("expressions,e", po::value<std::string>(), "Read filter expressions from file")
+    ("config,c", po::value<std::string>(), "Config file with several filters")
+    ("directory,d", po::value<std::string>(), "Output directory (default: from config)")
     ("invert-match,i", "Invert the sense of matching, exclude objects with matching tags")
     ("omit-referenced,R", "Omit referenced objects")
     ("remove-tags,t", "Remove tags from non-matching objects")
+    ("cache-members", "Keep relation members in memory to save a pass through the input")
     ;
 
     po::options_description opts_common{add_common_options()};
@@ -119,11 +286,10 @@ bool CommandTagsFilter::setup(const std::vector<std::string>& arguments) {
     setup_common(vm, desc);
     setup_progress(vm);
     setup_input_file(vm);
-    setup_output_file(vm);
 
     if (vm.count("omit-referenced")) {
         m_add_referenced_objects = false;
-    } else if (m_input_filename == "-") {
+    } else if (is_stdin_or_pipe(m_input_filename)) {
         throw argument_error{"Can not read OSM input from STDIN (unless --omit-referenced/-R option is used)."};
     }
 
@@ -135,14 +301,62 @@ bool CommandTagsFilter::setup(const std::vector<std::string>& arguments) {
         m_remove_tags = true;
     }
 
+    if (vm.count("cache-members")) {
+        if (!m_add_referenced_objects) {
+            throw argument_error{"Can not use --cache-members together with --omit-referenced/-R."};
+        }
+        m_cache_members = true;
+    }
+
+    if (vm.count("config")) {
+        if (vm.count("expression-list") || vm.count("expressions")) {
+            throw argument_error{"Can not use filter expressions or --expressions/-e together with --config/-c."};
+        }
+        init_output_file(vm);
+        if (m_block_stats) {
+            throw argument_error{"Can not use --block-stats together with --config/-c."};
+        }
+        // The result cache only keeps the file set with --output/-o.
+        if (!cache_directory().empty()) {
+            throw argument_error{"Can not use --cache-dir together with --config/-c."};
+        }
+        if (vm.count("output")) {
+            warning("Ignoring --output/-o option.\n");
+        }
+        if (vm.count("output-format")) {
+            warning("Ignoring --output-format/-f option.\n");
+        }
+        if (vm.count("directory")) {
+            m_output_directory = vm["directory"].as<std::string>();
+            if (m_output_directory.back() != '/') {
+                m_output_directory += '/';
+            }
+        }
+        m_config_file_name = vm["config"].as<std::string>();
+        const auto slash = m_config_file_name.find_last_of('/');
+        if (slash != std::string::npos) {
+            m_config_directory = m_config_file_name;
+            m_config_directory.resize(slash + 1);
+        }
+        parse_config_file();
+        return true;
+    }
+
+    if (vm.count("directory")) {
+        warning("Ignoring --directory/-d option.\n");
+    }
+
+    setup_output_file(vm);
+    m_sets.emplace_back(new TagsFilterSet{m_output_file});
+
     if (vm.count("expression-list")) {
         for (const auto& e : vm["expression-list"].as<std::vector<std::string>>()) {
-            parse_and_add_expression(e);
+            m_sets.front()->parse_and_add_expression(e);
         }
     }
 
     if (vm.count("expressions")) {
-        read_expressions_file(vm["expressions"].as<std::string>());
+        read_expressions_file(vm["expressions"].as<std::string>(), *m_sets.front());
     }
 
     return true;
@@ -154,10 +368,21 @@ void CommandTagsFilter::show_arguments() {
 
     m_vout << "  other options:\n";
     m_vout << "    add referenced objects: " << yes_no(m_add_referenced_objects);
-    m_vout << "  looking for tags...\n";
-    m_vout << "    on nodes: "     << yes_no(!m_filters(osmium::item_type::node).empty());
-    m_vout << "    on ways: "      << yes_no(!m_filters(osmium::item_type::way).empty() || !m_area_filters.empty());
-    m_vout << "    on relations: " << yes_no(!m_filters(osmium::item_type::relation).empty() || !m_area_filters.empty());
+    m_vout << "    cache relation members: " << yes_no(m_cache_members);
+    m_vout << "    threads: " << m_threads << '\n';
+    if (!m_config_file_name.empty()) {
+        m_vout << "    config file: " << m_config_file_name << '\n';
+        m_vout << "    output directory: " << m_output_directory << '\n';
+    }
+    for (const auto& set : m_sets) {
+        if (m_sets.size() > 1) {
+            m_vout << "  filter for '" << set->output_file.filename() << "'\n";
+        }
+        m_vout << "  looking for tags...\n";
+        m_vout << "    on nodes: "     << yes_no(!set->filters(osmium::item_type::node).empty());
+        m_vout << "    on ways: "      << yes_no(set->has_way_filters());
+        m_vout << "    on relations: " << yes_no(set->has_relation_filters());
+    }
 }
 
 osmium::osm_entity_bits::type CommandTagsFilter::get_needed_types() const {
@@ -167,95 +392,55 @@ osmium::osm_entity_bits::type CommandTagsFilter::get_needed_types() const {
 
     osmium::osm_entity_bits::type types = osmium::osm_entity_bits::nothing;
 
-    if (!m_referenced_ids(osmium::item_type::node).empty() || !m_filters(osmium::item_type::node).empty()) {
-        types |= osmium::osm_entity_bits::node;
-    }
-    if (!m_referenced_ids(osmium::item_type::way).empty() || !m_filters(osmium::item_type::way).empty() || !m_area_filters.empty()) {
-        types |= osmium::osm_entity_bits::way;
-    }
-    if (!m_referenced_ids(osmium::item_type::relation).empty() || !m_filters(osmium::item_type::relation).empty() || !m_area_filters.empty()) {
-        types |= osmium::osm_entity_bits::relation;
+    for (const auto& set : m_sets) {
+        if (!set->referenced_ids(osmium::item_type::node).empty() || !set->filters(osmium::item_type::node).empty()) {
+            types |= osmium::osm_entity_bits::node;
+        }
+        if (!set->referenced_ids(osmium::item_type::way).empty() || set->has_way_filters()) {
+            types |= osmium::osm_entity_bits::way;
+        }
+        if (!set->referenced_ids(osmium::item_type::relation).empty() || set->has_relation_filters()) {
+            types |= osmium::osm_entity_bits::relation;
+        }
     }
 
     return types;
 }
 
-void CommandTagsFilter::add_nodes(const osmium::Way& way) {
-    for (const auto& nr : way.nodes()) {
-        m_referenced_ids(osmium::item_type::node).set(nr.positive_ref());
-    }
-}
-
-void CommandTagsFilter::add_members(const osmium::Relation& relation) {
-    for (const auto& member : relation.members()) {
-        m_referenced_ids(member.type()).set(member.positive_ref());
-    }
-}
-
-bool CommandTagsFilter::matches_node(const osmium::Node& node) const noexcept {
-    return osmium::tags::match_any_of(node.tags(), m_filters(osmium::item_type::node));
-}
-
-bool CommandTagsFilter::matches_way(const osmium::Way& way) const noexcept {
-    return osmium::tags::match_any_of(way.tags(), m_filters(osmium::item_type::way)) ||
-           (way.is_closed() &&
-            way.nodes().size() >= 4 &&
-               osmium::tags::match_any_of(way.tags(), m_area_filters));
-}
-
-static bool is_multipolygon(const osmium::Relation& relation) noexcept {
-    const char* type = relation.tags().get_value_by_key("type");
-    if (type == nullptr) {
-        return false;
-    }
-
-    return !std::strcmp(type, "multipolygon") || !std::strcmp(type, "boundary");
-}
-
-bool CommandTagsFilter::matches_relation(const osmium::Relation& relation) const noexcept {
-    return osmium::tags::match_any_of(relation.tags(), m_filters(osmium::item_type::relation)) ||
-           (is_multipolygon(relation) &&
-               osmium::tags::match_any_of(relation.tags(), m_area_filters));
-}
-
-bool CommandTagsFilter::matches_object(const osmium::OSMObject& object) const noexcept {
-    switch (object.type()) {
-        case osmium::item_type::node:
-            return matches_node(static_cast<const osmium::Node&>(object));
-        case osmium::item_type::way:
-            return matches_way(static_cast<const osmium::Way&>(object));
-        case osmium::item_type::relation:
-            return matches_relation(static_cast<const osmium::Relation&>(object));
-        default:
-            break;
-    }
-    return false;
-}
-
-void CommandTagsFilter::mark_rel_ids(const osmium::index::RelationsMapIndex& rel_in_rel, osmium::object_id_type parent_id) {
-    rel_in_rel.for_each(parent_id, [&](osmium::unsigned_object_id_type member_id) {
-        if (m_referenced_ids(osmium::item_type::relation).check_and_set(member_id)) {
-            mark_rel_ids(rel_in_rel, member_id);
-        }
-    });
-}
-
 bool CommandTagsFilter::find_relations_in_relations() {
     m_vout << "  Reading input file to find relations in relations...\n";
-    osmium::index::RelationsMapStash stash;
+    CompactRelationsMapStash stash;
 
     ++m_count_passes;
-    osmium::io::Reader reader{m_input_file, osmium::osm_entity_bits::relation};
+    osmium::io::Reader reader{m_input_file, osmium::osm_entity_bits::relation, osmium::io::read_meta::no};
     while (osmium::memory::Buffer buffer = reader.read()) {
         for (const auto& relation : buffer.select<osmium::Relation>()) {
             stash.add_members(relation);
-            if (matches_relation(relation) != m_invert_match) {
-                m_matching_ids(osmium::item_type::relation).set(relation.positive_id());
-                for (const auto& member : relation.members()) {
-                    if (member.type() == osmium::item_type::node) {
-                        m_referenced_ids(osmium::item_type::node).set(member.positive_ref());
-                    } else if (member.type() == osmium::item_type::way) {
-                        m_referenced_ids(osmium::item_type::way).set(member.positive_ref());
+            for (auto& set : m_sets) {
+                if (!set->follow_relations) {
+                    continue;
+                }
+                if (set->matches_relation(relation) != m_invert_match) {
+                    set->matching_ids(osmium::item_type::relation).set(relation.positive_id());
+                    for (const auto& member : relation.members()) {
+                        if (member.type() == osmium::item_type::node) {
+                            set->referenced_ids(osmium::item_type::node).set(member.positive_ref());
+                        } else if (member.type() == osmium::item_type::way) {
+                            set->referenced_ids(osmium::item_type::way).set(member.positive_ref());
+                        }
+                    }
+                } else if (m_cache_members) {
+                    const auto offset = set->cached_members.size();
+                    for (const auto& member : relation.members()) {
+                        if (member.type() == osmium::item_type::node) {
+                            set->cached_members.push_back(member.positive_ref());
+                        } else if (member.type() == osmium::item_type::way) {
+                            set->cached_members.push_back(member.positive_ref() | way_flag);
+                        }
+                    }
+                    if (set->cached_members.size() > offset) {
+                        set->cached_relation_ids.push_back(relation.positive_id());
+                        set->cached_member_offsets.push_back(offset);
                     }
                 }
             }
@@ -268,8 +453,10 @@ bool CommandTagsFilter::find_relations_in_relations() {
     }
 
     const auto rel_in_rel = stash.build_parent_to_member_index();
-    for (const osmium::unsigned_object_id_type id : m_referenced_ids(osmium::item_type::relation)) {
-        mark_rel_ids(rel_in_rel, id);
+    for (auto& set : m_sets) {
+        if (set->follow_relations) {
+            add_member_relations(rel_in_rel, set->referenced_ids(osmium::item_type::relation));
+        }
     }
 
     return true;
@@ -279,15 +466,17 @@ void CommandTagsFilter::find_nodes_and_ways_in_relations() {
     m_vout << "  Reading input file to find nodes/ways in relations...\n";
 
     ++m_count_passes;
-    osmium::io::Reader reader{m_input_file, osmium::osm_entity_bits::relation};
+    osmium::io::Reader reader{m_input_file, osmium::osm_entity_bits::relation, osmium::io::read_meta::no};
     while (osmium::memory::Buffer buffer = reader.read()) {
         for (const auto& relation : buffer.select<osmium::Relation>()) {
-            if (m_referenced_ids(osmium::item_type::relation).get(relation.positive_id())) {
-                for (const auto& member : relation.members()) {
-                    if (member.type() == osmium::item_type::node) {
-                        m_referenced_ids(osmium::item_type::node).set(member.positive_ref());
-                    } else if (member.type() == osmium::item_type::way) {
-                        m_referenced_ids(osmium::item_type::way).set(member.positive_ref());
+            for (auto& set : m_sets) {
+                if (set->follow_relations && set->referenced_ids(osmium::item_type::relation).get(relation.positive_id())) {
+                    for (const auto& member : relation.members()) {
+                        if (member.type() == osmium::item_type::node) {
+                            set->referenced_ids(osmium::item_type::node).set(member.positive_ref());
+                        } else if (member.type() == osmium::item_type::way) {
+                            set->referenced_ids(osmium::item_type::way).set(member.positive_ref());
+                        }
                     }
                 }
             }
@@ -296,18 +485,53 @@ void CommandTagsFilter::find_nodes_and_ways_in_relations() {
     reader.close();
 }
 
+// Does the same as find_nodes_and_ways_in_relations() but uses the
+// members stored in memory by find_relations_in_relations().
+void CommandTagsFilter::add_cached_members() {
+    m_vout << "  Adding cached nodes/ways in relations...\n";
+
+    for (auto& set : m_sets) {
+        set->cached_member_offsets.push_back(set->cached_members.size());
+        for (std::size_t n = 0; n < set->cached_relation_ids.size(); ++n) {
+            if (!set->referenced_ids(osmium::item_type::relation).get(set->cached_relation_ids[n])) {
+                continue;
+            }
+            for (std::size_t i = set->cached_member_offsets[n]; i < set->cached_member_offsets[n + 1]; ++i) {
+                const auto ref = set->cached_members[i];
+                if (ref & way_flag) {
+                    set->referenced_ids(osmium::item_type::way).set(ref & ~way_flag);
+                } else {
+                    set->referenced_ids(osmium::item_type::node).set(ref);
+                }
+            }
+        }
+
+        set->cached_relation_ids.clear();
+        set->cached_relation_ids.shrink_to_fit();
+        set->cached_member_offsets.clear();
+        set->cached_member_offsets.shrink_to_fit();
+        set->cached_members.clear();
+        set->cached_members.shrink_to_fit();
+    }
+}
+
 void CommandTagsFilter::find_nodes_in_ways() {
     m_vout << "  Reading input file to find nodes in ways...\n";
 
     ++m_count_passes;
-    osmium::io::Reader reader{m_input_file, osmium::osm_entity_bits::way};
+    osmium::io::Reader reader{m_input_file, osmium::osm_entity_bits::way, osmium::io::read_meta::no};
     while (osmium::memory::Buffer buffer = reader.read()) {
         for (const auto& way : buffer.select<osmium::Way>()) {
-            if (m_referenced_ids(osmium::item_type::way).get(way.positive_id())) {
-                add_nodes(way);
-            } else if (matches_way(way) != m_invert_match) {
-                m_matching_ids(osmium::item_type::way).set(way.positive_id());
-                add_nodes(way);
+            for (auto& set : m_sets) {
+                if (!set->follow_ways) {
+                    continue;
+                }
+                if (set->referenced_ids(osmium::item_type::way).get(way.positive_id())) {
+                    set->add_nodes(way);
+                } else if (set->matches_way(way) != m_invert_match) {
+                    set->matching_ids(osmium::item_type::way).set(way.positive_id());
+                    set->add_nodes(way);
+                }
             }
         }
     }
@@ -316,60 +540,204 @@ void CommandTagsFilter::find_nodes_in_ways() {
 
 void CommandTagsFilter::find_referenced_objects() {
     m_vout << "Following references...\n";
-    bool todo = !m_filters(osmium::item_type::relation).empty() || !m_area_filters.empty() || m_invert_match;
+    bool todo = false;
+    for (auto& set : m_sets) {
+        set->follow_relations = set->has_relation_filters() || m_invert_match;
+        todo = todo || set->follow_relations;
+    }
+
     if (todo) {
         todo = find_relations_in_relations();
     }
 
     if (todo) {
-        find_nodes_and_ways_in_relations();
+        if (m_cache_members) {
+            add_cached_members();
+        } else {
+            find_nodes_and_ways_in_relations();
+        }
     }
 
-    if (!m_referenced_ids(osmium::item_type::way).empty() || !m_filters(osmium::item_type::way).empty() || !m_area_filters.empty()) {
+    todo = false;
+    for (auto& set : m_sets) {
+        set->follow_ways = !set->referenced_ids(osmium::item_type::way).empty() || set->has_way_filters();
+        todo = todo || set->follow_ways;
+    }
+    if (todo) {
         find_nodes_in_ways();
     }
     m_vout << "Done following references.\n";
 }
 
+std::vector<osmium::memory::Buffer> CommandTagsFilter::filter_buffer(const osmium::memory::Buffer& buffer) const {
+    std::vector<osmium::memory::Buffer> out_buffers;
+    out_buffers.reserve(m_sets.size());
+    for (std::size_t i = 0; i < m_sets.size(); ++i) {
+        out_buffers.emplace_back(64UL * 1024UL, osmium::memory::Buffer::auto_grow::yes);
+    }
+
+    for (const auto& object : buffer.select<osmium::OSMObject>()) {
+        for (std::size_t i = 0; i < m_sets.size(); ++i) {
+            const auto& set = *m_sets[i];
+            auto& out_buffer = out_buffers[i];
+            if (set.matching_ids(object.type()).get(object.positive_id()) ||
+                ((!m_add_referenced_objects || object.type() == osmium::item_type::node) && set.matches_object(object) != m_invert_match)) {
+                out_buffer.add_item(object);
+                out_buffer.commit();
+            } else if (set.referenced_ids(object.type()).get(object.positive_id())) {
+                const auto offset = out_buffer.committed();
+                out_buffer.add_item(object);
+                out_buffer.commit();
+                if (m_remove_tags) {
+                    out_buffer.get<osmium::OSMObject>(offset).remove_tags();
+                }
+            }
+        }
+    }
+
+    return out_buffers;
+}
+
+// Without referenced objects and inverted matching, only objects with
+// a matching tag are written. If all expressions have plain keys, PBF
+// blocks whose string table doesn't contain any of those keys can be
+// skipped without decoding them.
+bool CommandTagsFilter::can_skip_blocks() const {
+    if (m_add_referenced_objects || m_invert_match) {
+        return false;
+    }
+    if (m_input_file.format() != osmium::io::file_format::pbf || is_stdin_or_pipe(m_input_filename)) {
+        return false;
+    }
+    return std::all_of(m_sets.cbegin(), m_sets.cend(), [](const std::unique_ptr<TagsFilterSet>& set) {
+        return set->has_only_plain_keys();
+    });
+}
+
+std::vector<osmium::memory::Buffer> CommandTagsFilter::filter_block(const pbf_block& block) const {
+    const bool may_match = pbf_block_has_string(block, [this](const std::string& str) {
+        return std::any_of(m_sets.cbegin(), m_sets.cend(), [&str](const std::unique_ptr<TagsFilterSet>& set) {
+            return set->may_match_key(str.c_str());
+        });
+    });
+
+    if (!may_match) {
+        ++m_skipped_blocks;
+        return std::vector<osmium::memory::Buffer>(m_sets.size());
+    }
+
+    return filter_buffer(decode_pbf_block(block, get_needed_types()));
+}
+
 bool CommandTagsFilter::run() {
     if (m_add_referenced_objects) {
         find_referenced_objects();
     }
 
+    // Either the input is read through a normal reader or the PBF blocks
+    // are read and filtered by their string tables first.
+    std::unique_ptr<osmium::io::Reader> reader;
+    std::unique_ptr<PBFBlockReader> block_reader;
+    osmium::io::Header header;
+
     m_vout << "Opening input file...\n";
     ++m_count_passes;
-    osmium::io::Reader reader{m_input_file, get_needed_types()};
+    if (can_skip_blocks()) {
+        block_reader.reset(new PBFBlockReader{m_input_filename});
+        pbf_block block;
+        if (!block_reader->read(block) || block.type != "OSMHeader") {
+            throw osmium::io_error{"Missing header block in PBF file '" + m_input_filename + "'"};
+        }
+        header = decode_pbf_header(block);
+    } else {
+        const bool need_metadata = std::any_of(m_sets.cbegin(), m_sets.cend(), [](const std::unique_ptr<TagsFilterSet>& set) {
+            return has_metadata_output(set->output_file);
+        });
+        reader.reset(new osmium::io::Reader{m_input_file, get_needed_types(), need_metadata ? osmium::io::read_meta::yes : osmium::io::read_meta::no});
+        header = reader->header();
+    }
 
-    m_vout << "Opening output file...\n";
-    osmium::io::Header header = reader.header();
+    m_vout << "Opening output file" << (m_sets.size() > 1 ? "s" : "") << "...\n";
     setup_header(header);
 
-    osmium::io::Writer writer{m_output_file, header, m_output_overwrite, m_fsync};
+    for (auto& set : m_sets) {
+        set->writer.reset(new osmium::io::Writer{set->output_file, header, m_output_overwrite, m_fsync});
+    }
 
-    m_vout << "Copying matching objects to output file...\n";
-    osmium::ProgressBar progress_bar{reader.file_size(), display_progress()};
-    while (osmium::memory::Buffer buffer = reader.read()) {
-        progress_bar.update(reader.offset());
-        for (auto& object : buffer.select<osmium::OSMObject>()) {
-            if (m_matching_ids(object.type()).get(object.positive_id())) {
-                writer(object);
-            } else if ((!m_add_referenced_objects || object.type() == osmium::item_type::node) && matches_object(object) != m_invert_match) {
-                writer(object);
-            } else if (m_referenced_ids(object.type()).get(object.positive_id())) {
-                if (m_remove_tags) {
-                    object.remove_tags();
-                }
-                writer(object);
+    const auto write = [&](std::vector<osmium::memory::Buffer>&& out_buffers) {
+        for (std::size_t i = 0; i < m_sets.size(); ++i) {
+            if (out_buffers[i].committed() > 0) {
+                (*m_sets[i]->writer)(std::move(out_buffers[i]));
             }
         }
+    };
+
+    // Each input buffer is filtered into one output buffer for each
+    // filter set. With several threads this is done in the thread pool,
+    // the output buffers are handed to the writers in input order.
+    osmium::thread::Pool* pool = m_threads > 1 ? &thread_pool() : nullptr;
+    std::deque<std::future<std::vector<osmium::memory::Buffer>>> pending;
+    const std::size_t max_pending = static_cast<std::size_t>(m_threads) * 4;
+
+    const auto push = [&](std::future<std::vector<osmium::memory::Buffer>>&& future) {
+        pending.push_back(std::move(future));
+        while (pending.size() > max_pending) {
+            write(pending.front().get());
+            pending.pop_front();
+        }
+    };
+
+    m_vout << "Copying matching objects to output file" << (m_sets.size() > 1 ? "s" : "") << "...\n";
+    if (block_reader) {
+        osmium::ProgressBar progress_bar{osmium::file_size(m_input_filename), display_progress()};
+        pbf_block block;
+        while (block_reader->read(block)) {
+            progress_bar.update(block_reader->offset());
+            if (block.type != "OSMData") {
+                continue;
+            }
+            if (!pool) {
+                write(filter_block(block));
+                continue;
+            }
+            std::shared_ptr<pbf_block> block_ptr{new pbf_block{std::move(block)}};
+            push(pool->submit([this, block_ptr]() {
+                return filter_block(*block_ptr);
+            }));
+        }
+        for (auto& future : pending) {
+            write(future.get());
+        }
+        progress_bar.done();
+        m_vout << "Skipped " << m_skipped_blocks.load() << " PBF blocks without any of the keys looked for.\n";
+    } else {
+        osmium::ProgressBar progress_bar{reader->file_size(), display_progress()};
+        while (osmium::memory::Buffer buffer = reader->read()) {
+            progress_bar.update(reader->offset());
+            if (!pool) {
+                write(filter_buffer(buffer));
+                continue;
+            }
+            std::shared_ptr<osmium::memory::Buffer> buffer_ptr{new osmium::memory::Buffer{std::move(buffer)}};
+            push(pool->submit([this, buffer_ptr]() {
+                return filter_buffer(*buffer_ptr);
+            }));
+        }
+        for (auto& future : pending) {
+            write(future.get());
+        }
+        progress_bar.done();
     }
-    progress_bar.done();
 
-    m_vout << "Closing output file...\n";
-    writer.close();
+    m_vout << "Closing output file" << (m_sets.size() > 1 ? "s" : "") << "...\n";
+    for (auto& set : m_sets) {
+        set->writer->close();
+    }
 
     m_vout << "Closing input file...\n";
-    reader.close();
+    if (reader) {
+        reader->close();
+    }
 
     show_memory_used();
 
@@ -378,4 +746,3 @@ bool CommandTagsFilter::run() {
 
     return true;
 }
-
@@ -24,52 +24,123 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
 #include "cmd.hpp" // IWYU pragma: export
+#include "compiled_tags_filter.hpp"
+#include "pbf_blocks.hpp"
 
 #include <osmium/fwd.hpp>
 #include <osmium/index/id_set.hpp>
 #include <osmium/index/nwr_array.hpp>
-#include <osmium/index/relations_map.hpp>
+#include <osmium/io/file.hpp>
+#include <osmium/io/writer.hpp>
+#include <osmium/memory/buffer.hpp>
 #include <osmium/osm/entity_bits.hpp>
 #include <osmium/osm/item_type.hpp>
 #include <osmium/osm/types.hpp>
-#include <osmium/tags/tags_filter.hpp>
 
+#include <atomic>
+#include <cstddef>
+#include <memory>
 #include <string>
 #include <vector>
 
-class CommandTagsFilter : public Command, public with_single_osm_input, public with_osm_output {
+/**
+ * A set of filter expressions together with the output file for the
+ * objects matching them and the IDs of the objects found so far.
+ */
+struct TagsFilterSet {
 
-    osmium::nwr_array<osmium::TagsFilter> m_filters;
-    osmium::TagsFilter m_area_filters;
+    osmium::io::File output_file;
+    std::unique_ptr<osmium::io::Writer> writer;
 
-    osmium::nwr_array<osmium::index::IdSetDense<osmium::unsigned_object_id_type>> m_matching_ids;
-    osmium::nwr_array<osmium::index::IdSetDense<osmium::unsigned_object_id_type>> m_referenced_ids;
+    osmium::nwr_array<CompiledTagsFilter> filters;
+    CompiledTagsFilter area_filters;
 
-    int m_count_passes = 0;
-    bool m_add_referenced_objects = true;
-    bool m_invert_match = false;
-    bool m_remove_tags = false;
+    osmium::nwr_array<osmium::index::IdSetDense<osmium::unsigned_object_id_type>> matching_ids;
+    osmium::nwr_array<osmium::index::IdSetDense<osmium::unsigned_object_id_type>> referenced_ids;
 
-    osmium::osm_entity_bits::type get_needed_types() const;
+    // Node and way members of relations kept in memory when the
+    // --cache-members option is used. Members of the relation
+    // cached_relation_ids[n] are in cached_members starting at
+    // cached_member_offsets[n], way IDs are marked with a flag.
+    std::vector<osmium::unsigned_object_id_type> cached_relation_ids;
+    std::vector<std::size_t> cached_member_offsets;
+    std::vector<osmium::unsigned_object_id_type> cached_members;
 
-    void find_referenced_objects();
+    // Set if relations in relations have to be followed for this set.
+    bool follow_relations = false;
+
+    // Set if the ways have to be checked for this set.
+    bool follow_ways = false;
+
+    explicit TagsFilterSet(const osmium::io::File& file) :
+        output_file(file) {
+    }
+
+    void add_filter(osmium::osm_entity_bits::type entities, const std::string& expression);
+    void parse_and_add_expression(const std::string& expression);
+
+    bool has_relation_filters() const noexcept {
+        return !filters(osmium::item_type::relation).empty() || !area_filters.empty();
+    }
+
+    bool has_way_filters() const noexcept {
+        return !filters(osmium::item_type::way).empty() || !area_filters.empty();
+    }
 
     void add_nodes(const osmium::Way& way);
-    void add_members(const osmium::Relation& relation);
 
     bool matches_node(const osmium::Node& node) const noexcept;
     bool matches_way(const osmium::Way& way) const noexcept;
     bool matches_relation(const osmium::Relation& relation) const noexcept;
     bool matches_object(const osmium::OSMObject& object) const noexcept;
 
-    void mark_rel_ids(const osmium::index::RelationsMapIndex& rel_in_rel, osmium::object_id_type parent_id);
+    // Do all filters only have expressions with plain keys?
+    bool has_only_plain_keys() const noexcept;
+
+    // Can an object with a tag with this key match any of the filters?
+    bool may_match_key(const char* key) const noexcept;
+
+}; // struct TagsFilterSet
+
+class CommandTagsFilter : public Command, public with_single_osm_input, public with_osm_output {
+
+    std::vector<std::unique_ptr<TagsFilterSet>> m_sets;
+
+    std::string m_config_file_name;
+    std::string m_config_directory;
+    std::string m_output_directory;
+
+    int m_count_passes = 0;
+    bool m_add_referenced_objects = true;
+    bool m_cache_members = false;
+    bool m_invert_match = false;
+    bool m_remove_tags = false;
+
+    // Number of PBF blocks not decoded because they can't contain any
+    // matching objects.
+    mutable std::atomic<std::size_t> m_skipped_blocks{0};
+
+    osmium::osm_entity_bits::type get_needed_types() const;
+
+    void find_referenced_objects();
+
     bool find_relations_in_relations();
     void find_nodes_and_ways_in_relations();
+    void add_cached_members();
     void find_nodes_in_ways();
 
-    void add_filter(osmium::osm_entity_bits::type entities, const osmium::TagMatcher& matcher);
-    void parse_and_add_expression(const std::string& expression);
-    void read_expressions_file(const std::string& file_name);
+    // Returns the objects from the buffer for each of the filter sets.
+    std::vector<osmium::memory::Buffer> filter_buffer(const osmium::memory::Buffer& buffer) const;
+
+    bool can_skip_blocks() const;
+
+    // Returns the objects from the PBF block for each of the filter sets.
+    // The block is only decoded if its string table contains a key some
+    // filter expression can match.
+    std::vector<osmium::memory::Buffer> filter_block(const pbf_block& block) const;
+
+    void read_expressions_file(const std::string& file_name, TagsFilterSet& set);
+    void parse_config_file();
 
 public:
 
@@ -89,7 +160,8 @@ public:
 
     const char* synopsis() const noexcept override final {
         return "osmium tags-filter [OPTIONS] OSM-FILE FILTER-EXPRESSION...\n"
-               "       osmium tags-filter [OPTIONS] --expressions=FILE OSM-FILE";
+               "       osmium tags-filter [OPTIONS] --expressions=FILE OSM-FILE\n"
+               "       osmium tags-filter [OPTIONS] --config=CONFIG-FILE OSM-FILE";
     }
 
 }; // class CommandTagsFilter
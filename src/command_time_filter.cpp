@@ -22,6 +22,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "command_time_filter.hpp"
 #include "exception.hpp"
+#include "pbf_blocks.hpp"
 #include "util.hpp"
 
 #include <osmium/diff_iterator.hpp>
@@ -29,23 +30,41 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <osmium/io/header.hpp>
 #include <osmium/io/input_iterator.hpp>
 #include <osmium/io/output_iterator.hpp>
+#include <osmium/io/reader.hpp>
 #include <osmium/io/reader_with_progress_bar.hpp>
 #include <osmium/io/writer.hpp>
+#include <osmium/memory/buffer.hpp>
 #include <osmium/osm/diff_object.hpp>
 #include <osmium/osm/entity_bits.hpp>
 #include <osmium/osm/object.hpp>
 #include <osmium/osm/timestamp.hpp>
+#include <osmium/thread/pool.hpp>
+#include <osmium/util/file.hpp>
+#include <osmium/util/progress_bar.hpp>
 #include <osmium/util/verbose_output.hpp>
 
 #include <boost/program_options.hpp>
 
 #include <algorithm>
+#include <cstddef>
 #include <ctime>
+#include <deque>
+#include <future>
+#include <iterator>
+#include <memory>
 #include <stdexcept>
 #include <string>
+#include <utility>
 #include <vector>
 
 bool CommandTimeFilter::setup(const std::vector<std::string>& arguments) {
+    po::options_description opts_cmd{"COMMAND OPTIONS"};
+    opts_cmd.add_options()
+    ("skip-blocks", "Use block statistics to skip PBF blocks with only newer objects")
+    ("snapshot,t", po::value<std::vector<std::string>>(), "Write snapshot at this time (can be given multiple times)")
+    ("directory,d", po::value<std::string>(), "Output directory for snapshots (default: current directory)")
+    ;
+
     po::options_description opts_common{add_common_options()};
     po::options_description opts_input{add_single_input_options()};
     po::options_description opts_output{add_output_options()};
@@ -58,7 +77,7 @@ bool CommandTimeFilter::setup(const std::vector<std::string>& arguments) {
     ;
 
     po::options_description desc;
-    desc.add(opts_common).add(opts_input).add(opts_output);
+    desc.add(opts_cmd).add(opts_common).add(opts_input).add(opts_output);
 
     po::options_description parsed_options;
     parsed_options.add(desc).add(hidden);
@@ -75,7 +94,51 @@ bool CommandTimeFilter::setup(const std::vector<std::string>& arguments) {
     setup_common(vm, desc);
     setup_progress(vm);
     setup_input_file(vm);
-    setup_output_file(vm);
+
+    if (vm.count("snapshot")) {
+        if (vm.count("time-from")) {
+            throw argument_error{"Can not use --snapshot/-t option together with time arguments."};
+        }
+        for (const auto& ts : vm["snapshot"].as<std::vector<std::string>>()) {
+            try {
+                m_snapshots.emplace_back(ts);
+            } catch (const std::invalid_argument&) {
+                throw argument_error{"Wrong format for snapshot timestamp (use YYYY-MM-DDThh:mm:ssZ)."};
+            }
+        }
+        std::sort(m_snapshots.begin(), m_snapshots.end());
+        m_snapshots.erase(std::unique(m_snapshots.begin(), m_snapshots.end()), m_snapshots.end());
+
+        if (vm.count("directory")) {
+            m_snapshot_directory = vm["directory"].as<std::string>();
+            if (!m_snapshot_directory.empty() && m_snapshot_directory.back() != '/') {
+                m_snapshot_directory += '/';
+            }
+        }
+
+        init_output_file(vm);
+        if (!m_output_filename.empty()) {
+            throw argument_error{"Can not use --output/-o option together with --snapshot/-t.\n"
+                                 "Set the output directory with --directory/-d instead."};
+        }
+
+        // All snapshot files have the same format, so checking one is
+        // enough.
+        osmium::io::File file{snapshot_filename(m_snapshots.front()), m_output_format};
+        file.check();
+        if (m_block_stats && file.format() != osmium::io::file_format::pbf) {
+            throw argument_error{"The --block-stats option only works with PBF output files."};
+        }
+        if (file.has_multiple_object_versions()) {
+            warning("You are writing to files marked as having multiple object versions,\n"
+                    "but there will be only a single version of each object.\n");
+        }
+    } else {
+        if (vm.count("directory")) {
+            throw argument_error{"The --directory/-d option can only be used with --snapshot/-t."};
+        }
+        setup_output_file(vm);
+    }
 
     m_from = osmium::Timestamp{std::time(nullptr)};
     m_to = m_from;
@@ -103,6 +166,20 @@ bool CommandTimeFilter::setup(const std::vector<std::string>& arguments) {
         throw argument_error{"Second timestamp is before first one."};
     }
 
+    if (vm.count("skip-blocks")) {
+        if (m_input_file.format() != osmium::io::file_format::pbf) {
+            throw argument_error{"The --skip-blocks option only works with PBF input files."};
+        }
+        if (is_stdin_or_pipe(m_input_file.filename())) {
+            throw argument_error{"The --skip-blocks option can not be used when reading from STDIN."};
+        }
+        m_skip_blocks = true;
+    }
+
+    if (!m_snapshots.empty()) {
+        return true;
+    }
+
     if (m_from == m_to) { // point in time
         if (m_output_file.has_multiple_object_versions()) {
             warning("You are writing to a file marked as having multiple object versions,\n"
@@ -120,17 +197,137 @@ bool CommandTimeFilter::setup(const std::vector<std::string>& arguments) {
 
 void CommandTimeFilter::show_arguments() {
     show_single_input_arguments(m_vout);
-    show_output_arguments(m_vout);
-    m_vout << "  other options:\n";
-    m_vout << "    Filtering from time " << m_from.to_iso() << " to " << m_to.to_iso() << "\n";
+    if (m_snapshots.empty()) {
+        show_output_arguments(m_vout);
+        m_vout << "  other options:\n";
+        m_vout << "    Filtering from time " << m_from.to_iso() << " to " << m_to.to_iso() << "\n";
+    } else {
+        m_vout << "  output options:\n";
+        m_vout << "    directory: " << m_snapshot_directory << "\n";
+        m_vout << "    file format: " << m_output_format << "\n";
+        m_vout << "    generator: " << m_generator << "\n";
+        m_vout << "    overwrite: " << yes_no(m_output_overwrite == osmium::io::overwrite::allow);
+        m_vout << "    fsync: " << yes_no(m_fsync == osmium::io::fsync::yes);
+        m_vout << "    block statistics: " << yes_no(m_block_stats);
+        m_vout << "  other options:\n";
+        m_vout << "    snapshots:\n";
+        for (const auto& ts : m_snapshots) {
+            m_vout << "      " << ts.to_iso() << " -> " << snapshot_filename(ts) << "\n";
+        }
+    }
+    m_vout << "    skip blocks: " << yes_no(m_skip_blocks);
+    m_vout << "    threads: " << m_threads << '\n';
 }
 
-bool CommandTimeFilter::run() {
-    m_vout << "Opening input file...\n";
-    osmium::io::ReaderWithProgressBar reader{display_progress(), m_input_file, osmium::osm_entity_bits::object};
+std::string CommandTimeFilter::snapshot_filename(const osmium::Timestamp& timestamp) const {
+    std::string filename{m_snapshot_directory};
+    filename += "snapshot-";
+    filename += timestamp.to_iso();
+    filename += '.';
+    filename += m_output_format.empty() ? "osm.pbf" : m_output_format;
+    return filename;
+}
 
+bool CommandTimeFilter::matches(const osmium::DiffObject& d) const noexcept {
+    if (m_from == m_to) {
+        return d.is_visible_at(m_from);
+    }
+    return d.is_between(m_from, m_to);
+}
+
+// A version is in all snapshots from its start time up to (but not
+// including) the start time of the next version. Because the snapshot
+// times are sorted, those are found with a binary search. Calls func
+// with the index of each snapshot the version is in.
+template <typename TFunc>
+void CommandTimeFilter::for_each_snapshot(const osmium::DiffObject& d, TFunc&& func) const {
+    if (!d.curr().visible()) {
+        return;
+    }
+    const auto end_time = d.end_time();
+    auto it = std::lower_bound(m_snapshots.cbegin(), m_snapshots.cend(), d.start_time());
+    for (; it != m_snapshots.cend() && *it < end_time; ++it) {
+        func(static_cast<std::size_t>(std::distance(m_snapshots.cbegin(), it)));
+    }
+}
+
+namespace {
+
+    bool same_object(const osmium::OSMObject& lhs, const osmium::OSMObject& rhs) noexcept {
+        return lhs.type() == rhs.type() && lhs.id() == rhs.id();
+    }
+
+    /**
+     * Call func with a DiffObject for each object in the buffer. The
+     * versions of an object can straddle the boundary between buffers,
+     * so the first object of the next buffer (if there is one) is used
+     * to find the end time of the last object in this buffer. The
+     * previous version of the first object isn't available, so the
+     * DiffObjects can't be asked whether they are the first version.
+     * This only reads the buffers, so it can run on any thread.
+     */
+    template <typename TFunc>
+    void for_each_diff_object(osmium::memory::Buffer& buffer, osmium::memory::Buffer* next_buffer, TFunc&& func) {
+        osmium::OSMObject* next_first = nullptr;
+        if (next_buffer) {
+            auto next_objects = next_buffer->select<osmium::OSMObject>();
+            if (next_objects.begin() != next_objects.end()) {
+                next_first = &*next_objects.begin();
+            }
+        }
+
+        auto objects = buffer.select<osmium::OSMObject>();
+        osmium::OSMObject* prev = nullptr;
+        for (auto it = objects.begin(); it != objects.end(); ++it) {
+            osmium::OSMObject& curr = *it;
+            osmium::OSMObject* next = nullptr;
+            const auto next_it = std::next(it);
+            if (next_it != objects.end()) {
+                next = &*next_it;
+            } else {
+                next = next_first;
+            }
+            if (!next || !same_object(curr, *next)) {
+                next = &curr;
+            }
+            if (!prev || !same_object(curr, *prev)) {
+                prev = &curr;
+            }
+            func(osmium::DiffObject{*prev, curr, *next});
+            prev = &curr;
+        }
+    }
+
+    /**
+     * Read all buffers from the reader and call submit with each of them
+     * and the buffer following it (or an empty pointer for the last one).
+     * Buffers without any objects are dropped so they don't hide the
+     * next version of an object.
+     */
+    template <typename TReader, typename TProgress, typename TSubmit>
+    void read_buffer_pairs(TReader& reader, TProgress&& progress, TSubmit&& submit) {
+        std::shared_ptr<osmium::memory::Buffer> current;
+        while (osmium::memory::Buffer buffer = reader.read()) {
+            progress();
+            if (buffer.committed() == 0) {
+                continue;
+            }
+            std::shared_ptr<osmium::memory::Buffer> next{new osmium::memory::Buffer{std::move(buffer)}};
+            if (current) {
+                submit(current, next);
+            }
+            current = std::move(next);
+        }
+        if (current) {
+            submit(current, std::shared_ptr<osmium::memory::Buffer>{});
+        }
+    }
+
+} // anonymous namespace
+
+template <typename TReader, typename TProgress>
+void CommandTimeFilter::filter(TReader& reader, osmium::io::Header header, TProgress&& progress) const {
     m_vout << "Opening output file...\n";
-    osmium::io::Header header{reader.header()};
     setup_header(header);
 
     osmium::io::Writer writer{m_output_file, header, m_output_overwrite, m_fsync};
@@ -141,33 +338,221 @@ bool CommandTimeFilter::run() {
     auto diff_end   = osmium::make_diff_iterator(input.end(), input.end());
     auto out = osmium::io::make_output_iterator(writer);
 
-    if (m_from == m_to) {
-        std::copy_if(
-            diff_begin,
-            diff_end,
-            out,
-            [this](const osmium::DiffObject& d){
-                return d.is_visible_at(m_from);
-        });
-    } else {
-        std::copy_if(
-            diff_begin,
-            diff_end,
-            out,
-            [this](const osmium::DiffObject& d){
-                return d.is_between(m_from, m_to);
-        });
+    std::copy_if(
+        diff_begin,
+        diff_end,
+        out,
+        [this, &progress](const osmium::DiffObject& d){
+            progress();
+            return matches(d);
+    });
+
+    m_vout << "Closing output file...\n";
+    writer.close();
+}
+
+template <typename TReader, typename TProgress>
+void CommandTimeFilter::filter_parallel(TReader& reader, osmium::io::Header header, TProgress&& progress) {
+    m_vout << "Opening output file...\n";
+    setup_header(header);
+
+    osmium::io::Writer writer{m_output_file, header, m_output_overwrite, m_fsync};
+
+    m_vout << "Filter data on " << m_threads << " threads while copying it from input to output...\n";
+    auto& pool = thread_pool();
+    std::deque<std::future<osmium::memory::Buffer>> pending;
+    const std::size_t max_pending = static_cast<std::size_t>(m_threads) * 4;
+
+    read_buffer_pairs(reader, progress, [&](const std::shared_ptr<osmium::memory::Buffer>& buffer, const std::shared_ptr<osmium::memory::Buffer>& next) {
+        pending.push_back(pool.submit([this, buffer, next]() {
+            osmium::memory::Buffer output{buffer->committed() + 1024, osmium::memory::Buffer::auto_grow::yes};
+            for_each_diff_object(*buffer, next.get(), [this, &output](const osmium::DiffObject& d) {
+                if (matches(d)) {
+                    output.add_item(d.curr());
+                    output.commit();
+                }
+            });
+            return output;
+        }));
+        while (pending.size() > max_pending) {
+            writer(pending.front().get());
+            pending.pop_front();
+        }
+    });
+
+    for (auto& future : pending) {
+        writer(future.get());
     }
 
     m_vout << "Closing output file...\n";
     writer.close();
+}
+
+template <typename TReader, typename TProgress>
+void CommandTimeFilter::write_snapshots(TReader& reader, osmium::io::Header header, TProgress&& progress) const {
+    m_vout << "Opening output files...\n";
+    setup_header(header);
+
+    std::vector<std::unique_ptr<osmium::io::Writer>> writers;
+    for (const auto& ts : m_snapshots) {
+        const osmium::io::File file{snapshot_filename(ts), m_output_format};
+        writers.emplace_back(new osmium::io::Writer{file, header, m_output_overwrite, m_fsync});
+    }
+
+    m_vout << "Writing snapshots while reading input...\n";
+    auto input = osmium::io::make_input_iterator_range<osmium::OSMObject>(reader);
+    auto diff_begin = osmium::make_diff_iterator(input.begin(), input.end());
+    auto diff_end   = osmium::make_diff_iterator(input.end(), input.end());
+
+    for (; diff_begin != diff_end; ++diff_begin) {
+        progress();
+        const osmium::DiffObject& d = *diff_begin;
+        for_each_snapshot(d, [&](std::size_t n) {
+            (*writers[n])(d.curr());
+        });
+    }
+
+    m_vout << "Closing output files...\n";
+    for (auto& writer : writers) {
+        writer->close();
+    }
+
+    if (m_block_stats) {
+        m_vout << "Adding block statistics...\n";
+        for (const auto& ts : m_snapshots) {
+            add_pbf_block_stats(snapshot_filename(ts), m_fsync);
+        }
+    }
+}
+
+template <typename TReader, typename TProgress>
+void CommandTimeFilter::write_snapshots_parallel(TReader& reader, osmium::io::Header header, TProgress&& progress) {
+    m_vout << "Opening output files...\n";
+    setup_header(header);
+
+    std::vector<std::unique_ptr<osmium::io::Writer>> writers;
+    for (const auto& ts : m_snapshots) {
+        const osmium::io::File file{snapshot_filename(ts), m_output_format};
+        writers.emplace_back(new osmium::io::Writer{file, header, m_output_overwrite, m_fsync});
+    }
 
-    m_vout << "Closing input file...\n";
-    reader.close();
+    m_vout << "Writing snapshots on " << m_threads << " threads while reading input...\n";
+    auto& pool = thread_pool();
+    std::deque<std::future<std::vector<osmium::memory::Buffer>>> pending;
+    const std::size_t max_pending = static_cast<std::size_t>(m_threads) * 4;
+
+    const auto write = [&writers](std::vector<osmium::memory::Buffer>&& outputs) {
+        for (std::size_t n = 0; n < outputs.size(); ++n) {
+            if (outputs[n].committed() > 0) {
+                (*writers[n])(std::move(outputs[n]));
+            }
+        }
+    };
+
+    read_buffer_pairs(reader, progress, [&](const std::shared_ptr<osmium::memory::Buffer>& buffer, const std::shared_ptr<osmium::memory::Buffer>& next) {
+        pending.push_back(pool.submit([this, buffer, next]() {
+            std::vector<osmium::memory::Buffer> outputs;
+            outputs.reserve(m_snapshots.size());
+            for (std::size_t n = 0; n < m_snapshots.size(); ++n) {
+                outputs.emplace_back(1024 * 1024, osmium::memory::Buffer::auto_grow::yes);
+            }
+            for_each_diff_object(*buffer, next.get(), [this, &outputs](const osmium::DiffObject& d) {
+                for_each_snapshot(d, [&outputs, &d](std::size_t n) {
+                    outputs[n].add_item(d.curr());
+                    outputs[n].commit();
+                });
+            });
+            return outputs;
+        }));
+        while (pending.size() > max_pending) {
+            write(pending.front().get());
+            pending.pop_front();
+        }
+    });
+
+    for (auto& future : pending) {
+        write(future.get());
+    }
+
+    m_vout << "Closing output files...\n";
+    for (auto& writer : writers) {
+        writer->close();
+    }
+
+    if (m_block_stats) {
+        m_vout << "Adding block statistics...\n";
+        for (const auto& ts : m_snapshots) {
+            add_pbf_block_stats(snapshot_filename(ts), m_fsync);
+        }
+    }
+}
+
+template <typename TReader, typename TProgress>
+void CommandTimeFilter::process(TReader& reader, const osmium::io::Header& header, TProgress&& progress) {
+    // With several threads the input buffers are filtered on the thread
+    // pool. The progress function is called once per buffer in that case
+    // and once per object otherwise.
+    if (m_threads > 1) {
+        if (m_snapshots.empty()) {
+            filter_parallel(reader, header, std::forward<TProgress>(progress));
+        } else {
+            write_snapshots_parallel(reader, header, std::forward<TProgress>(progress));
+        }
+    } else if (m_snapshots.empty()) {
+        filter(reader, header, std::forward<TProgress>(progress));
+    } else {
+        write_snapshots(reader, header, std::forward<TProgress>(progress));
+    }
+}
+
+bool CommandTimeFilter::run() {
+    if (m_skip_blocks) {
+        // Blocks in which all objects were created after the point in
+        // time (or at or after the end of the time range) can not
+        // contribute anything to the output. This assumes that the
+        // timestamps of the versions of an object are increasing, so a
+        // skipped version can never be the end of the life time of a
+        // version which is in the output.
+        osmium::Timestamp last = m_from == m_to ? m_to : osmium::Timestamp{m_to.seconds_since_epoch() - 1};
+        if (!m_snapshots.empty()) {
+            last = m_snapshots.back();
+        }
+
+        m_vout << "Reading block statistics...\n";
+        auto offsets = get_pbf_blocks_newer_than(m_input_file.filename(), last);
+        m_vout << "Skipping " << offsets.size() << " blocks.\n";
+
+        m_vout << "Opening input file...\n";
+        osmium::io::Header header;
+        {
+            osmium::io::Reader reader{m_input_file, osmium::osm_entity_bits::nothing};
+            header = reader.header();
+            reader.close();
+        }
+        PBFDataReader reader{m_input_file.filename(), std::move(offsets), PBFDataReader::offsets_mode::skip, osmium::osm_entity_bits::object};
+
+        osmium::ProgressBar progress_bar{osmium::file_size(m_input_file.filename()), display_progress()};
+        std::size_t n = 0;
+        const std::size_t progress_interval = m_threads > 1 ? 0 : 10000;
+        process(reader, header, [&]() {
+            if (n++ > progress_interval) {
+                n = 0;
+                progress_bar.update(reader.offset());
+            }
+        });
+        progress_bar.done();
+    } else {
+        m_vout << "Opening input file...\n";
+        osmium::io::ReaderWithProgressBar reader{display_progress(), m_input_file, osmium::osm_entity_bits::object};
+
+        process(reader, reader.header(), []() {});
+
+        m_vout << "Closing input file...\n";
+        reader.close();
+    }
 
     show_memory_used();
     m_vout << "Done.\n";
 
     return true;
 }
-
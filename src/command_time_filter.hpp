@@ -25,6 +25,8 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "cmd.hpp" // IWYU pragma: export
 
+#include <osmium/io/header.hpp>
+#include <osmium/osm/diff_object.hpp>
 #include <osmium/osm/timestamp.hpp>
 
 #include <string>
@@ -35,6 +37,35 @@ class CommandTimeFilter : public Command, public with_single_osm_input, public w
     osmium::Timestamp m_from;
     osmium::Timestamp m_to;
 
+    // Points in time for which snapshots are written into separate
+    // files, sorted and unique.
+    std::vector<osmium::Timestamp> m_snapshots;
+    std::string m_snapshot_directory;
+
+    bool m_skip_blocks = false;
+
+    std::string snapshot_filename(const osmium::Timestamp& timestamp) const;
+
+    bool matches(const osmium::DiffObject& d) const noexcept;
+
+    template <typename TFunc>
+    void for_each_snapshot(const osmium::DiffObject& d, TFunc&& func) const;
+
+    template <typename TReader, typename TProgress>
+    void filter(TReader& reader, osmium::io::Header header, TProgress&& progress) const;
+
+    template <typename TReader, typename TProgress>
+    void filter_parallel(TReader& reader, osmium::io::Header header, TProgress&& progress);
+
+    template <typename TReader, typename TProgress>
+    void write_snapshots(TReader& reader, osmium::io::Header header, TProgress&& progress) const;
+
+    template <typename TReader, typename TProgress>
+    void write_snapshots_parallel(TReader& reader, osmium::io::Header header, TProgress&& progress);
+
+    template <typename TReader, typename TProgress>
+    void process(TReader& reader, const osmium::io::Header& header, TProgress&& progress);
+
 public:
 
     explicit CommandTimeFilter(const CommandFactory& command_factory) :
@@ -53,7 +84,8 @@ public:
 
     const char* synopsis() const noexcept override final {
         return "osmium time-filter [OPTIONS] OSM-HISTORY-FILE [TIME]\n"
-               "       osmium time-filter [OPTIONS] OSM-HISTORY-FILE FROM-TIME TO-TIME";
+               "       osmium time-filter [OPTIONS] OSM-HISTORY-FILE FROM-TIME TO-TIME\n"
+               "       osmium time-filter [OPTIONS] -t TIME... [-d DIR] OSM-HISTORY-FILE";
     }
 
 }; // class CommandTimeFilter
@@ -3,6 +3,7 @@
 
 #include "command_add_locations_to_ways.hpp"
 #include "command_apply_changes.hpp"
+#include "command_bench.hpp"
 #include "command_cat.hpp"
 #include "command_changeset_filter.hpp"
 #include "command_check_refs.hpp"
@@ -16,9 +17,12 @@
 #include "command_help.hpp"
 #include "command_merge.hpp"
 #include "command_merge_changes.hpp"
+#include "command_pipeline.hpp"
 #include "command_renumber.hpp"
+#include "command_serve.hpp"
 #include "command_show.hpp"
 #include "command_sort.hpp"
+#include "command_tags_count.hpp"
 #include "command_tags_filter.hpp"
 #include "command_time_filter.hpp"
 
@@ -31,6 +35,10 @@ void register_commands(CommandFactory& cmd_factory) {
         return new CommandApplyChanges{cmd_factory};
     });
 
+    cmd_factory.register_command("bench", "Measure throughput of common operations", [&]() {
+        return new CommandBench{cmd_factory};
+    });
+
     cmd_factory.register_command("cat", "Concatenate OSM files and convert to different formats", [&]() {
         return new CommandCat{cmd_factory};
     });
@@ -82,10 +90,18 @@ void register_commands(CommandFactory& cmd_factory) {
         return new CommandMerge{cmd_factory};
     });
 
+    cmd_factory.register_command("pipeline", "Run several commands passing OSM data between them", [&]() {
+        return new CommandPipeline{cmd_factory};
+    });
+
     cmd_factory.register_command("renumber", "Renumber IDs in OSM file", [&]() {
         return new CommandRenumber{cmd_factory};
     });
 
+    cmd_factory.register_command("serve", "Answer ID queries on a PBF file over a socket", [&]() {
+        return new CommandServe{cmd_factory};
+    });
+
     cmd_factory.register_command("show", "Show OSM file contents", [&]() {
         return new CommandShow{cmd_factory};
     });
@@ -94,6 +110,10 @@ void register_commands(CommandFactory& cmd_factory) {
         return new CommandSort{cmd_factory};
     });
 
+    cmd_factory.register_command("tags-count", "Count keys and tags", [&]() {
+        return new CommandTagsCount{cmd_factory};
+    });
+
     cmd_factory.register_command("tags-filter", "Filter OSM data based on tags", [&]() {
         return new CommandTagsFilter{cmd_factory};
     });
@@ -0,0 +1,174 @@
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "compiled_tags_filter.hpp"
+#include "util.hpp"
+
+#include <osmium/util/string.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// A string given in a filter expression is plain if it matches only
+// itself (or one of its comma separated parts).
+static bool is_plain(const std::string& string) noexcept {
+    return string.empty() || (string.front() != '*' && string.back() != '*');
+}
+
+static std::vector<std::string> split_plain(const std::string& string) {
+    if (string.find(',') == std::string::npos) {
+        return {string};
+    }
+    auto strings = osmium::split_string(string, ',');
+    for (auto& s : strings) {
+        strip_whitespace(s);
+    }
+    return strings;
+}
+
+std::uint32_t CompiledTagsFilter::hash(const char* str) noexcept {
+    std::uint32_t h = 2166136261U;
+    for (; *str; ++str) {
+        h ^= static_cast<unsigned char>(*str);
+        h *= 16777619U;
+    }
+    return h;
+}
+
+const CompiledTagsFilter::key_entry* CompiledTagsFilter::find_entry(const char* key) const noexcept {
+    if (m_table.empty()) {
+        return nullptr;
+    }
+    const std::size_t mask = m_table.size() - 1;
+    for (std::size_t pos = hash(key) & mask; m_table[pos] != 0; pos = (pos + 1) & mask) {
+        const auto& entry = m_entries[m_table[pos] - 1];
+        if (!std::strcmp(entry.key.c_str(), key)) {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+void CompiledTagsFilter::rebuild_table() {
+    std::size_t size = 16;
+    while (size < m_entries.size() * 2) {
+        size <<= 1U;
+    }
+    m_table.assign(size, 0);
+    const std::size_t mask = size - 1;
+    for (std::size_t n = 0; n < m_entries.size(); ++n) {
+        auto pos = hash(m_entries[n].key.c_str()) & mask;
+        while (m_table[pos] != 0) {
+            pos = (pos + 1) & mask;
+        }
+        m_table[pos] = n + 1;
+    }
+}
+
+CompiledTagsFilter::key_entry& CompiledTagsFilter::get_entry(const std::string& key) {
+    const auto* entry = find_entry(key.c_str());
+    if (entry) {
+        return m_entries[static_cast<std::size_t>(entry - m_entries.data())];
+    }
+
+    m_entries.emplace_back();
+    m_entries.back().key = key;
+    if (m_entries.size() * 2 > m_table.size()) {
+        rebuild_table();
+    } else {
+        const std::size_t mask = m_table.size() - 1;
+        auto pos = hash(key.c_str()) & mask;
+        while (m_table[pos] != 0) {
+            pos = (pos + 1) & mask;
+        }
+        m_table[pos] = m_entries.size();
+    }
+    return m_entries.back();
+}
+
+void CompiledTagsFilter::add_expression(const std::string& expression) {
+    const auto op_pos = expression.find('=');
+
+    std::string key = expression.substr(0, op_pos);
+    const bool inverted = op_pos != std::string::npos && !key.empty() && key.back() == '!';
+    strip_whitespace(key);
+
+    std::string value;
+    bool any_value = op_pos == std::string::npos;
+    if (!any_value) {
+        value = expression.substr(op_pos + 1);
+        strip_whitespace(value);
+        any_value = value == "*";
+    }
+
+    if (inverted || !is_plain(key) || (!any_value && !is_plain(value))) {
+        m_other.add_rule(true, get_tag_matcher(expression));
+        ++m_other_count;
+        return;
+    }
+
+    const auto values = any_value ? std::vector<std::string>{} : split_plain(value);
+    for (const auto& k : split_plain(key)) {
+        auto& entry = get_entry(k);
+        if (any_value) {
+            entry.any_value = true;
+            entry.values.clear();
+        } else if (!entry.any_value) {
+            for (const auto& v : values) {
+                const auto it = std::lower_bound(entry.values.begin(), entry.values.end(), v);
+                if (it == entry.values.end() || *it != v) {
+                    entry.values.insert(it, v);
+                }
+            }
+        }
+    }
+}
+
+bool CompiledTagsFilter::operator()(const osmium::Tag& tag) const noexcept {
+    if (m_default_result) {
+        return true;
+    }
+
+    const auto* entry = find_entry(tag.key());
+    if (entry) {
+        if (entry->any_value) {
+            return true;
+        }
+        const char* value = tag.value();
+        const auto it = std::lower_bound(entry->values.begin(), entry->values.end(), value, [](const std::string& lhs, const char* rhs) {
+            return std::strcmp(lhs.c_str(), rhs) < 0;
+        });
+        if (it != entry->values.end() && !std::strcmp(it->c_str(), value)) {
+            return true;
+        }
+    }
+
+    return m_other_count > 0 && m_other(tag);
+}
+
+bool CompiledTagsFilter::match_any_of(const osmium::TagList& tags) const noexcept {
+    return std::any_of(tags.cbegin(), tags.cend(), [this](const osmium::Tag& tag) {
+        return (*this)(tag);
+    });
+}
@@ -0,0 +1,113 @@
+#ifndef COMPILED_TAGS_FILTER_HPP
+#define COMPILED_TAGS_FILTER_HPP
+
+
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <osmium/osm/tag.hpp>
+#include <osmium/tags/tags_filter.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Matches tags against many filter expressions (in the format parsed by
+ * get_tag_matcher()) at once. All expressions have the same result,
+ * so a tag matches if it matches any of the expressions.
+ *
+ * Expressions with plain keys and plain values (or any value) are
+ * stored in a hash table keyed by the tag key, each entry has the sorted
+ * list of values matching for this key. Matching a tag against all of
+ * these expressions needs only one hash lookup and one binary search.
+ * All other expressions (with prefix or substring patterns or inverted
+ * ones) are kept in an osmium::TagsFilter and checked one after the
+ * other as before.
+ */
+class CompiledTagsFilter {
+
+    struct key_entry {
+        std::string key;
+        std::vector<std::string> values;
+        bool any_value = false;
+    };
+
+    std::vector<key_entry> m_entries;
+
+    // Hash table with indexes into m_entries plus one, 0 marks empty slots.
+    std::vector<std::size_t> m_table;
+
+    osmium::TagsFilter m_other{false};
+    std::size_t m_other_count = 0;
+
+    bool m_default_result = false;
+
+    static std::uint32_t hash(const char* str) noexcept;
+
+    key_entry& get_entry(const std::string& key);
+    const key_entry* find_entry(const char* key) const noexcept;
+    void rebuild_table();
+
+public:
+
+    CompiledTagsFilter() = default;
+
+    explicit CompiledTagsFilter(bool default_result) noexcept :
+        m_default_result(default_result) {
+    }
+
+    // The result for tags not matching any expression. If this is true,
+    // all tags will match.
+    void set_default_result(bool default_result) noexcept {
+        m_default_result = default_result;
+    }
+
+    void add_expression(const std::string& expression);
+
+    bool empty() const noexcept {
+        return m_entries.empty() && m_other_count == 0;
+    }
+
+    // Are all expressions plain keys with plain or any values? Only then
+    // may_match_key() can be false.
+    bool has_only_plain_keys() const noexcept {
+        return !m_default_result && m_other_count == 0;
+    }
+
+    // Can a tag with this key match any of the expressions?
+    bool may_match_key(const char* key) const noexcept {
+        return !has_only_plain_keys() || find_entry(key) != nullptr;
+    }
+
+    bool operator()(const osmium::Tag& tag) const noexcept;
+
+    bool match_any_of(const osmium::TagList& tags) const noexcept;
+
+    bool match_none_of(const osmium::TagList& tags) const noexcept {
+        return !match_any_of(tags);
+    }
+
+}; // class CompiledTagsFilter
+
+#endif // COMPILED_TAGS_FILTER_HPP
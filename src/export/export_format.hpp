@@ -30,12 +30,43 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <osmium/osm/object.hpp>
 #include <osmium/util/verbose_output.hpp>
 
+#include <bitset>
 #include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
 
 class ExportFormat {
 
     const options_type& m_options;
 
+    // Names of the attributes which are written and the set of their
+    // first characters. Attribute names usually start with '@', so most
+    // tag keys can be ruled out after one lookup.
+    std::vector<const char*> m_attribute_names;
+    std::bitset<256> m_attribute_first_chars;
+
+    void add_attribute_name(const std::string& name) {
+        if (!name.empty()) {
+            m_attribute_names.push_back(name.c_str());
+            m_attribute_first_chars.set(static_cast<unsigned char>(name[0]));
+        }
+    }
+
+    bool is_attribute_name(const char* key) const noexcept {
+        if (!m_attribute_first_chars.test(static_cast<unsigned char>(key[0]))) {
+            return false;
+        }
+        for (const char* name : m_attribute_names) {
+            if (!std::strcmp(key, name)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
 protected:
 
     std::uint64_t m_count;
@@ -43,6 +74,14 @@ protected:
     explicit ExportFormat(const options_type& options) :
         m_options(options),
         m_count(0) {
+        add_attribute_name(options.type);
+        add_attribute_name(options.id);
+        add_attribute_name(options.version);
+        add_attribute_name(options.changeset);
+        add_attribute_name(options.uid);
+        add_attribute_name(options.user);
+        add_attribute_name(options.timestamp);
+        add_attribute_name(options.way_nodes);
     }
 
 public:
@@ -65,6 +104,26 @@ public:
 
     virtual void close() = 0;
 
+    /**
+     * Create a format object with the same settings as this one which
+     * doesn't write to a file but keeps its output in memory. Used to
+     * create the geometries of a batch of features on a worker thread.
+     * The output of the batch is then retrieved with take_chunk() and
+     * added to the real output with add_chunk().
+     */
+    virtual std::unique_ptr<ExportFormat> create_chunk_format() const = 0;
+
+    /// Can this format be used with create_chunk_format()?
+    virtual bool supports_chunks() const noexcept {
+        return true;
+    }
+
+    /// Get (and clear) the output of a format from create_chunk_format().
+    virtual std::string take_chunk() = 0;
+
+    /// Add the output of a chunk containing count features.
+    virtual void add_chunk(const std::string& chunk, std::uint64_t count) = 0;
+
     virtual void debug_output(osmium::VerboseOutput& /*out*/, const std::string& /*filename*/) {
     }
 
@@ -73,36 +132,10 @@ public:
         bool has_tags = false;
 
         for (const auto& tag : object.tags()) {
-            if (options().tags_filter(tag)) {
-
-                // If the tag key looks like any of the attribute keys, drop
-                // the tag on the floor. This should be okay for most cases
-                // when the attribute name chosen is sufficiently special.
-                if (!options().type.empty() && tag.key() == options().type) {
-                    continue;
-                }
-                if (!options().id.empty() && tag.key() == options().id) {
-                    continue;
-                }
-                if (!options().version.empty() && tag.key() == options().version) {
-                    continue;
-                }
-                if (!options().changeset.empty() && tag.key() == options().changeset) {
-                    continue;
-                }
-                if (!options().uid.empty() && tag.key() == options().uid) {
-                    continue;
-                }
-                if (!options().user.empty() && tag.key() == options().user) {
-                    continue;
-                }
-                if (!options().timestamp.empty() && tag.key() == options().timestamp) {
-                    continue;
-                }
-                if (!options().way_nodes.empty() && tag.key() == options().way_nodes) {
-                    continue;
-                }
-
+            // If the tag key looks like any of the attribute keys, drop
+            // the tag on the floor. This should be okay for most cases
+            // when the attribute name chosen is sufficiently special.
+            if (!is_attribute_name(tag.key()) && options().tags_filter(tag)) {
                 has_tags = true;
 
                 std::forward<TFunc>(func)(tag);
@@ -0,0 +1,438 @@
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "export_format_flatgeobuf.hpp"
+#include "format_util.hpp"
+
+#include <osmium/geom/factory.hpp>
+#include <osmium/io/detail/read_write.hpp>
+#include <osmium/osm.hpp>
+
+#ifndef RAPIDJSON_HAS_STDSTRING
+# define RAPIDJSON_HAS_STDSTRING 1
+#endif
+#include <rapidjson/writer.h>
+#include <rapidjson/stringbuffer.h>
+
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+static constexpr const std::size_t initial_buffer_size = 1024 * 1024;
+static constexpr const std::size_t flush_buffer_size   =  800 * 1024;
+
+static const char magic_bytes[] = {'f', 'g', 'b', 0x03, 'f', 'g', 'b', 0x00};
+
+// Geometry and column types and field ids from the FlatGeobuf schema
+// (header.fbs and feature.fbs).
+namespace fgb {
+
+    enum : std::uint8_t {
+        unknown      = 0,
+        point        = 1,
+        linestring   = 2,
+        polygon      = 3,
+        multipolygon = 6
+    };
+
+    enum : std::uint8_t {
+        type_int      = 5,
+        type_long     = 7,
+        type_string   = 11,
+        type_json     = 12,
+        type_datetime = 13
+    };
+
+    enum header_field : std::uint16_t {
+        header_name            = 0,
+        header_geometry_type   = 2,
+        header_columns         = 7,
+        header_index_node_size = 9,
+        header_crs             = 10
+    };
+
+    enum column_field : std::uint16_t {
+        column_name = 0,
+        column_type = 1
+    };
+
+    enum crs_field : std::uint16_t {
+        crs_org  = 0,
+        crs_code = 1
+    };
+
+    enum geometry_field : std::uint16_t {
+        geometry_ends  = 0,
+        geometry_xy    = 1,
+        geometry_type  = 6,
+        geometry_parts = 7
+    };
+
+    enum feature_field : std::uint16_t {
+        feature_geometry   = 0,
+        feature_properties = 1
+    };
+
+} // namespace fgb
+
+// The columns in the order they are written. Must be kept in sync with
+// ExportFormatFlatGeobuf::add_attributes().
+static std::vector<std::pair<std::string, std::uint8_t>> get_columns(const options_type& options) {
+    std::vector<std::pair<std::string, std::uint8_t>> columns;
+
+    if (options.unique_id == unique_id_type::counter) {
+        columns.emplace_back("id", fgb::type_long);
+    } else if (options.unique_id == unique_id_type::type_id) {
+        columns.emplace_back("id", fgb::type_string);
+    }
+
+    if (!options.type.empty()) {
+        columns.emplace_back(options.type, fgb::type_string);
+    }
+    if (!options.id.empty()) {
+        columns.emplace_back(options.id, fgb::type_long);
+    }
+    if (!options.version.empty()) {
+        columns.emplace_back(options.version, fgb::type_int);
+    }
+    if (!options.changeset.empty()) {
+        columns.emplace_back(options.changeset, fgb::type_long);
+    }
+    if (!options.uid.empty()) {
+        columns.emplace_back(options.uid, fgb::type_int);
+    }
+    if (!options.user.empty()) {
+        columns.emplace_back(options.user, fgb::type_string);
+    }
+    if (!options.timestamp.empty()) {
+        columns.emplace_back(options.timestamp, fgb::type_datetime);
+    }
+    if (!options.way_nodes.empty()) {
+        columns.emplace_back(options.way_nodes, fgb::type_json);
+    }
+
+    columns.emplace_back("tags", fgb::type_json);
+
+    return columns;
+}
+
+static void append_le(std::string& out, std::uint64_t value, std::size_t length) {
+    for (std::size_t i = 0; i < length; ++i) {
+        out += static_cast<char>((value >> (i * 8)) & 0xffU);
+    }
+}
+
+static void add_int_property(std::string& out, std::uint16_t column, std::int32_t value) {
+    append_le(out, column, sizeof(column));
+    append_le(out, static_cast<std::uint32_t>(value), sizeof(value));
+}
+
+static void add_long_property(std::string& out, std::uint16_t column, std::int64_t value) {
+    append_le(out, column, sizeof(column));
+    append_le(out, static_cast<std::uint64_t>(value), sizeof(value));
+}
+
+static void add_string_property(std::string& out, std::uint16_t column, const char* str, std::size_t length) {
+    append_le(out, column, sizeof(column));
+    append_le(out, length, sizeof(std::uint32_t));
+    out.append(str, length);
+}
+
+static void add_string_property(std::string& out, std::uint16_t column, const std::string& str) {
+    add_string_property(out, column, str.data(), str.size());
+}
+
+ExportFormatFlatGeobuf::ExportFormatFlatGeobuf(const std::string& /*output_format*/,
+                                               const std::string& output_filename,
+                                               osmium::io::overwrite overwrite,
+                                               osmium::io::fsync fsync,
+                                               const options_type& options) :
+    ExportFormat(options),
+    m_fd(osmium::io::detail::open_for_writing(output_filename, overwrite)),
+    m_fsync(fsync) {
+    m_buffer.reserve(initial_buffer_size);
+    write_header();
+}
+
+ExportFormatFlatGeobuf::ExportFormatFlatGeobuf(const options_type& options) :
+    ExportFormat(options),
+    m_fd(-1),
+    m_fsync(osmium::io::fsync::no) {
+    m_buffer.reserve(initial_buffer_size);
+}
+
+void ExportFormatFlatGeobuf::flush_to_output() {
+    osmium::io::detail::reliable_write(m_fd, m_buffer.data(), m_buffer.size());
+    m_buffer.clear();
+}
+
+void ExportFormatFlatGeobuf::write_header() {
+    m_buffer.append(magic_bytes, sizeof(magic_bytes));
+
+    std::vector<FlatBufferBuilder::offset_type> columns;
+    for (const auto& column : get_columns(options())) {
+        const auto name = m_builder.create_string(column.first);
+        m_builder.start_table();
+        m_builder.add_offset(fgb::column_name, name);
+        m_builder.add_ubyte(fgb::column_type, column.second);
+        columns.push_back(m_builder.end_table());
+    }
+    const auto columns_vector = m_builder.create_offset_vector(columns);
+
+    const auto org = m_builder.create_string("EPSG");
+    m_builder.start_table();
+    m_builder.add_offset(fgb::crs_org, org);
+    m_builder.add_int(fgb::crs_code, 4326);
+    const auto crs = m_builder.end_table();
+
+    const auto name = m_builder.create_string("osmium");
+
+    // The features are of different types, so the geometry type is
+    // unknown. An index node size of 0 means there is no spatial index.
+    m_builder.start_table();
+    m_builder.add_offset(fgb::header_name, name);
+    m_builder.add_ubyte(fgb::header_geometry_type, fgb::unknown);
+    m_builder.add_offset(fgb::header_columns, columns_vector);
+    m_builder.add_ushort(fgb::header_index_node_size, 0);
+    m_builder.add_offset(fgb::header_crs, crs);
+    const auto header = m_builder.end_table();
+
+    m_builder.finish_size_prefixed(header, m_buffer);
+}
+
+void ExportFormatFlatGeobuf::add_location(const osmium::Location& location) {
+    m_xy.push_back(location.lon());
+    m_xy.push_back(location.lat());
+}
+
+void ExportFormatFlatGeobuf::add_ring(const osmium::NodeRefList& ring) {
+    osmium::Location last_location;
+    for (const auto& node_ref : ring) {
+        if (last_location != node_ref.location()) {
+            last_location = node_ref.location();
+            add_location(last_location);
+        }
+    }
+    m_ends.push_back(static_cast<std::uint32_t>(m_xy.size() / 2));
+}
+
+FlatBufferBuilder::offset_type ExportFormatFlatGeobuf::create_geometry(std::uint8_t type) {
+    FlatBufferBuilder::offset_type ends = 0;
+    if (m_ends.size() > 1) {
+        ends = m_builder.create_vector(m_ends);
+    }
+    const auto xy = m_builder.create_vector(m_xy);
+
+    m_builder.start_table();
+    if (ends != 0) {
+        m_builder.add_offset(fgb::geometry_ends, ends);
+    }
+    m_builder.add_offset(fgb::geometry_xy, xy);
+    m_builder.add_ubyte(fgb::geometry_type, type);
+    return m_builder.end_table();
+}
+
+void ExportFormatFlatGeobuf::add_attributes(const osmium::OSMObject& object, std::uint16_t& column) {
+    if (!options().type.empty()) {
+        if (object.type() == osmium::item_type::area) {
+            add_string_property(m_properties, column, static_cast<const osmium::Area&>(object).from_way() ? "way" : "relation");
+        } else {
+            add_string_property(m_properties, column, osmium::item_type_to_name(object.type()));
+        }
+        ++column;
+    }
+
+    if (!options().id.empty()) {
+        add_long_property(m_properties, column++, object.type() == osmium::item_type::area ? osmium::area_id_to_object_id(object.id()) : object.id());
+    }
+
+    if (!options().version.empty()) {
+        add_int_property(m_properties, column++, static_cast<std::int32_t>(object.version()));
+    }
+
+    if (!options().changeset.empty()) {
+        add_long_property(m_properties, column++, object.changeset());
+    }
+
+    if (!options().uid.empty()) {
+        add_int_property(m_properties, column++, static_cast<std::int32_t>(object.uid()));
+    }
+
+    if (!options().user.empty()) {
+        add_string_property(m_properties, column++, object.user(), std::strlen(object.user()));
+    }
+
+    if (!options().timestamp.empty()) {
+        add_string_property(m_properties, column++, object.timestamp().to_iso());
+    }
+
+    if (!options().way_nodes.empty()) {
+        if (object.type() == osmium::item_type::way) {
+            std::string nodes{"["};
+            for (const auto& nr : static_cast<const osmium::Way&>(object).nodes()) {
+                append_int(nodes, nr.ref());
+                nodes += ',';
+            }
+            if (nodes.back() == ',') {
+                nodes.back() = ']';
+            } else {
+                nodes += ']';
+            }
+            add_string_property(m_properties, column, nodes);
+        }
+        ++column;
+    }
+}
+
+void ExportFormatFlatGeobuf::finish_feature(const osmium::OSMObject& object, const char type, const FlatBufferBuilder::offset_type geometry) {
+    m_properties.clear();
+    std::uint16_t column = 0;
+
+    if (options().unique_id == unique_id_type::counter) {
+        add_long_property(m_properties, column++, static_cast<std::int64_t>(m_count + 1));
+    } else if (options().unique_id == unique_id_type::type_id) {
+        add_string_property(m_properties, column++, type + std::to_string(object.id()));
+    }
+
+    add_attributes(object, column);
+
+    rapidjson::StringBuffer stream;
+    rapidjson::Writer<rapidjson::StringBuffer> writer{stream};
+
+    writer.StartObject();
+    const bool has_tags = add_tags(object, [&](const osmium::Tag& tag) {
+        writer.Key(tag.key());
+        writer.String(tag.value());
+    });
+    writer.EndObject();
+
+    if (!has_tags && !options().keep_untagged) {
+        m_builder.clear();
+        return;
+    }
+
+    add_string_property(m_properties, column, stream.GetString(), stream.GetSize());
+
+    const auto properties = m_builder.create_vector(reinterpret_cast<const unsigned char*>(m_properties.data()), m_properties.size());
+
+    m_builder.start_table();
+    m_builder.add_offset(fgb::feature_geometry, geometry);
+    m_builder.add_offset(fgb::feature_properties, properties);
+    const auto feature = m_builder.end_table();
+
+    m_builder.finish_size_prefixed(feature, m_buffer);
+
+    ++m_count;
+
+    if (m_fd >= 0 && m_buffer.size() > flush_buffer_size) {
+        flush_to_output();
+    }
+}
+
+void ExportFormatFlatGeobuf::node(const osmium::Node& node) {
+    m_builder.clear();
+    m_xy.clear();
+    m_ends.clear();
+
+    add_location(node.location());
+    finish_feature(node, 'n', create_geometry(fgb::point));
+}
+
+void ExportFormatFlatGeobuf::way(const osmium::Way& way) {
+    m_builder.clear();
+    m_xy.clear();
+    m_ends.clear();
+
+    osmium::Location last_location;
+    for (const auto& node_ref : way.nodes()) {
+        if (last_location != node_ref.location()) {
+            last_location = node_ref.location();
+            add_location(last_location);
+        }
+    }
+
+    if (m_xy.size() < 4) {
+        throw osmium::geometry_error{"need at least two points for linestring", "way", way.id()};
+    }
+
+    finish_feature(way, 'w', create_geometry(fgb::linestring));
+}
+
+void ExportFormatFlatGeobuf::area(const osmium::Area& area) {
+    m_builder.clear();
+    m_parts.clear();
+
+    for (const auto& outer : area.outer_rings()) {
+        m_xy.clear();
+        m_ends.clear();
+        add_ring(outer);
+        for (const auto& inner : area.inner_rings(outer)) {
+            add_ring(inner);
+        }
+        m_parts.push_back(create_geometry(fgb::polygon));
+    }
+
+    if (m_parts.empty()) {
+        throw osmium::geometry_error{"invalid area", "area", area.id()};
+    }
+
+    const auto parts = m_builder.create_offset_vector(m_parts);
+
+    m_builder.start_table();
+    m_builder.add_offset(fgb::geometry_parts, parts);
+    m_builder.add_ubyte(fgb::geometry_type, fgb::multipolygon);
+    const auto geometry = m_builder.end_table();
+
+    finish_feature(area, 'a', geometry);
+}
+
+std::unique_ptr<ExportFormat> ExportFormatFlatGeobuf::create_chunk_format() const {
+    return std::unique_ptr<ExportFormat>{new ExportFormatFlatGeobuf{options()}};
+}
+
+std::string ExportFormatFlatGeobuf::take_chunk() {
+    std::string chunk;
+    chunk.swap(m_buffer);
+    m_count = 0;
+    return chunk;
+}
+
+void ExportFormatFlatGeobuf::add_chunk(const std::string& chunk, std::uint64_t count) {
+    m_buffer.append(chunk);
+    m_count += count;
+
+    if (m_buffer.size() > flush_buffer_size) {
+        flush_to_output();
+    }
+}
+
+void ExportFormatFlatGeobuf::close() {
+    if (m_fd > 0) {
+        flush_to_output();
+        if (m_fsync == osmium::io::fsync::yes) {
+            osmium::io::detail::reliable_fsync(m_fd);
+        }
+        ::close(m_fd);
+        m_fd = -1;
+    }
+}
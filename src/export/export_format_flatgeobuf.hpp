@@ -0,0 +1,100 @@
+#ifndef EXPORT_EXPORT_FORMAT_FLATGEOBUF_HPP
+#define EXPORT_EXPORT_FORMAT_FLATGEOBUF_HPP
+
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "export_format.hpp"
+#include "flatbuffer_builder.hpp"
+
+#include <osmium/fwd.hpp>
+#include <osmium/io/writer_options.hpp>
+#include <osmium/osm/location.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * Writes FlatGeobuf files (https://flatgeobuf.org/). The attributes are
+ * written into separate columns, the tags into one JSON column. No spatial
+ * index is written and the number of features is not set in the header,
+ * because the file is written in one pass.
+ */
+class ExportFormatFlatGeobuf : public ExportFormat {
+
+    FlatBufferBuilder m_builder;
+    std::string m_buffer;
+    std::string m_properties;
+    std::vector<double> m_xy;
+    std::vector<std::uint32_t> m_ends;
+    std::vector<FlatBufferBuilder::offset_type> m_parts;
+    int m_fd;
+    osmium::io::fsync m_fsync;
+
+    void flush_to_output();
+
+    void write_header();
+
+    void add_location(const osmium::Location& location);
+    void add_ring(const osmium::NodeRefList& ring);
+    FlatBufferBuilder::offset_type create_geometry(std::uint8_t type);
+
+    void add_attributes(const osmium::OSMObject& object, std::uint16_t& column);
+    void finish_feature(const osmium::OSMObject& object, char type, FlatBufferBuilder::offset_type geometry);
+
+    // Used by create_chunk_format(), writes into memory only.
+    explicit ExportFormatFlatGeobuf(const options_type& options);
+
+public:
+
+    ExportFormatFlatGeobuf(const std::string& output_format,
+                           const std::string& output_filename,
+                           osmium::io::overwrite overwrite,
+                           osmium::io::fsync fsync,
+                           const options_type& options);
+
+    ~ExportFormatFlatGeobuf() override {
+        try {
+            close();
+        } catch (...) {
+        }
+    }
+
+    void node(const osmium::Node& node) override;
+
+    void way(const osmium::Way& way) override;
+
+    void area(const osmium::Area& area) override;
+
+    void close() override;
+
+    std::unique_ptr<ExportFormat> create_chunk_format() const override;
+
+    std::string take_chunk() override;
+
+    void add_chunk(const std::string& chunk, std::uint64_t count) override;
+
+}; // class ExportFormatFlatGeobuf
+
+#endif // EXPORT_EXPORT_FORMAT_FLATGEOBUF_HPP
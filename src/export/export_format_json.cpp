@@ -21,9 +21,12 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
 #include "export_format_json.hpp"
+#include "format_util.hpp"
 
 #include <osmium/io/detail/read_write.hpp>
 
+#include <cstring>
+
 static constexpr const std::size_t initial_buffer_size = 1024 * 1024;
 static constexpr const std::size_t flush_buffer_size   =  800 * 1024;
 
@@ -43,17 +46,33 @@ ExportFormatJSON::ExportFormatJSON(const std::string& output_format,
     m_fsync(fsync),
     m_text_sequence_format(output_format == "geojsonseq"),
     m_with_record_separator(m_text_sequence_format && options.print_record_separator),
-    m_writer(m_stream),
-    m_factory(m_writer) {
+    m_writer(m_stream) {
     m_stream.Reserve(initial_buffer_size);
+    if (options.gzip) {
+        m_gzip.reset(new ParallelGzipOutput{m_fd});
+    }
     if (!m_text_sequence_format) {
         add_to_stream(m_stream, "{\"type\":\"FeatureCollection\",\"features\":[\n");
     }
     m_committed_size = m_stream.GetSize();
 }
 
+ExportFormatJSON::ExportFormatJSON(bool text_sequence_format, const options_type& options) :
+    ExportFormat(options),
+    m_fd(-1),
+    m_fsync(osmium::io::fsync::no),
+    m_text_sequence_format(text_sequence_format),
+    m_with_record_separator(m_text_sequence_format && options.print_record_separator),
+    m_writer(m_stream) {
+    m_stream.Reserve(initial_buffer_size);
+}
+
 void ExportFormatJSON::flush_to_output() {
-    osmium::io::detail::reliable_write(m_fd, m_stream.GetString(), m_stream.GetSize());
+    if (m_gzip) {
+        m_gzip->write(m_stream.GetString(), m_stream.GetSize());
+    } else {
+        osmium::io::detail::reliable_write(m_fd, m_stream.GetString(), m_stream.GetSize());
+    }
     m_stream.Clear();
     m_committed_size = 0;
 }
@@ -139,6 +158,11 @@ void ExportFormatJSON::add_attributes(const osmium::OSMObject& object) {
     }
 }
 
+void ExportFormatJSON::add_geometry() {
+    m_writer.Key("geometry");
+    m_writer.RawValue(m_geometry.data(), m_geometry.size(), rapidjson::kObjectType);
+}
+
 void ExportFormatJSON::finish_feature(const osmium::OSMObject& object) {
     m_writer.Key("properties");
     m_writer.StartObject(); // start properties
@@ -157,7 +181,7 @@ void ExportFormatJSON::finish_feature(const osmium::OSMObject& object) {
         m_committed_size = m_stream.GetSize();
         ++m_count;
 
-        if (m_stream.GetSize() > flush_buffer_size) {
+        if (m_fd >= 0 && m_stream.GetSize() > flush_buffer_size) {
             flush_to_output();
         }
     }
@@ -165,19 +189,25 @@ void ExportFormatJSON::finish_feature(const osmium::OSMObject& object) {
 
 void ExportFormatJSON::node(const osmium::Node& node) {
     start_feature("n", node.id());
-    m_factory.create_point(node);
+    m_geometry.clear();
+    append_geojson_point(m_geometry, node);
+    add_geometry();
     finish_feature(node);
 }
 
 void ExportFormatJSON::way(const osmium::Way& way) {
     start_feature("w", way.id());
-    m_factory.create_linestring(way);
+    m_geometry.clear();
+    append_geojson_linestring(m_geometry, way);
+    add_geometry();
     finish_feature(way);
 }
 
 void ExportFormatJSON::area(const osmium::Area& area) {
     start_feature("a", area.id());
-    m_factory.create_multipolygon(area);
+    m_geometry.clear();
+    append_geojson_multipolygon(m_geometry, area);
+    add_geometry();
     finish_feature(area);
 }
 
@@ -188,6 +218,44 @@ void ExportFormatJSON::rollback_uncomitted() {
     }
 }
 
+std::unique_ptr<ExportFormat> ExportFormatJSON::create_chunk_format() const {
+    return std::unique_ptr<ExportFormat>{new ExportFormatJSON{m_text_sequence_format, options()}};
+}
+
+// The chunk starts with the first feature, the separator before it is
+// added in add_chunk() when needed.
+std::string ExportFormatJSON::take_chunk() {
+    rollback_uncomitted();
+    std::string chunk{m_stream.GetString(), m_stream.GetSize()};
+    m_stream.Clear();
+    m_committed_size = 0;
+    m_count = 0;
+    return chunk;
+}
+
+void ExportFormatJSON::add_chunk(const std::string& chunk, std::uint64_t count) {
+    if (count == 0) {
+        return;
+    }
+
+    rollback_uncomitted();
+
+    if (m_count > 0) {
+        if (!m_text_sequence_format) {
+            m_stream.Put(',');
+        }
+        m_stream.Put('\n');
+    }
+
+    std::memcpy(m_stream.Push(chunk.size()), chunk.data(), chunk.size());
+    m_committed_size = m_stream.GetSize();
+    m_count += count;
+
+    if (m_stream.GetSize() > flush_buffer_size) {
+        flush_to_output();
+    }
+}
+
 void ExportFormatJSON::close() {
     if (m_fd > 0) {
         rollback_uncomitted();
@@ -198,6 +266,9 @@ void ExportFormatJSON::close() {
         }
 
         flush_to_output();
+        if (m_gzip) {
+            m_gzip->flush();
+        }
         if (m_fsync == osmium::io::fsync::yes) {
             osmium::io::detail::reliable_fsync(m_fd);
         }
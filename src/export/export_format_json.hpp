@@ -24,9 +24,9 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
 #include "export_format.hpp"
+#include "gzip_output.hpp"
 
 #include <osmium/fwd.hpp>
-#include <osmium/geom/rapid_geojson.hpp>
 #include <osmium/io/writer_options.hpp>
 
 #ifndef RAPIDJSON_HAS_STDSTRING
@@ -35,6 +35,8 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <rapidjson/writer.h>
 #include <rapidjson/stringbuffer.h>
 
+#include <cstdint>
+#include <memory>
 #include <string>
 
 using writer_type = rapidjson::Writer<rapidjson::StringBuffer>;
@@ -43,21 +45,26 @@ class ExportFormatJSON : public ExportFormat {
 
     int m_fd;
     osmium::io::fsync m_fsync;
+    std::unique_ptr<ParallelGzipOutput> m_gzip;
     bool m_text_sequence_format;
     bool m_with_record_separator;
     rapidjson::StringBuffer m_stream;
     std::size_t m_committed_size = 0;
     writer_type m_writer;
-    osmium::geom::RapidGeoJSONFactory<writer_type> m_factory;
+    std::string m_geometry;
 
     void flush_to_output();
 
     void rollback_uncomitted();
 
     void start_feature(const std::string& prefix, osmium::object_id_type id);
+    void add_geometry();
     void add_attributes(const osmium::OSMObject& object);
     void finish_feature(const osmium::OSMObject& object);
 
+    // Used by create_chunk_format(), writes into memory only.
+    ExportFormatJSON(bool text_sequence_format, const options_type& options);
+
 public:
 
     ExportFormatJSON(const std::string& output_format,
@@ -78,6 +85,12 @@ public:
 
     void close() override;
 
+    std::unique_ptr<ExportFormat> create_chunk_format() const override;
+
+    std::string take_chunk() override;
+
+    void add_chunk(const std::string& chunk, std::uint64_t count) override;
+
 }; // class ExportFormatJSON
 
 #endif // EXPORT_EXPORT_FORMAT_JSON_HPP
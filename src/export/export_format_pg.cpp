@@ -21,6 +21,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
 #include "export_format_pg.hpp"
+#include "format_util.hpp"
 
 #include <osmium/io/detail/read_write.hpp>
 #include <osmium/io/detail/string_util.hpp>
@@ -31,7 +32,6 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <rapidjson/writer.h>
 #include <rapidjson/stringbuffer.h>
 
-#include <limits>
 #include <string>
 
 enum {
@@ -53,6 +53,13 @@ ExportFormatPg::ExportFormatPg(const std::string& /*output_format*/,
     m_buffer.reserve(initial_buffer_size);
 }
 
+ExportFormatPg::ExportFormatPg(const options_type& options) :
+    ExportFormat(options),
+    m_fd(-1),
+    m_fsync(osmium::io::fsync::no) {
+    m_buffer.reserve(initial_buffer_size);
+}
+
 void ExportFormatPg::flush_to_output() {
     osmium::io::detail::reliable_write(m_fd, m_buffer.data(), m_buffer.size());
     m_buffer.clear();
@@ -62,41 +69,15 @@ void ExportFormatPg::flush_to_output() {
 void ExportFormatPg::start_feature(const char type, const osmium::object_id_type id) {
     m_buffer.resize(m_commit_size);
     if (options().unique_id == unique_id_type::counter) {
-        m_buffer.append(std::to_string(m_count + 1));
+        append_int(m_buffer, m_count + 1);
         m_buffer += '\t';
     } else if (options().unique_id == unique_id_type::type_id) {
         m_buffer += type;
-        m_buffer.append(std::to_string(id));
+        append_int(m_buffer, id);
         m_buffer += '\t';
     }
 }
 
-void ExportFormatPg::append_pg_escaped(const char* str, std::size_t size = std::numeric_limits<std::size_t>::max()) {
-    while (size-- > 0 && *str != '\0') {
-        switch (*str) {
-            case '\\':
-                m_buffer += '\\';
-                m_buffer += '\\';
-                break;
-            case '\n':
-                m_buffer += '\\';
-                m_buffer += 'n';
-                break;
-            case '\r':
-                m_buffer += '\\';
-                m_buffer += 'r';
-                break;
-            case '\t':
-                m_buffer += '\\';
-                m_buffer += 't';
-                break;
-            default:
-                m_buffer += *str;
-        }
-        ++str;
-    }
-}
-
 void ExportFormatPg::add_attributes(const osmium::OSMObject& object) {
     if (!options().type.empty()) {
         if (object.type() == osmium::item_type::area) {
@@ -112,27 +93,27 @@ void ExportFormatPg::add_attributes(const osmium::OSMObject& object) {
     }
 
     if (!options().id.empty()) {
-        m_buffer.append(std::to_string(object.type() == osmium::item_type::area ? osmium::area_id_to_object_id(object.id()) : object.id()));
+        append_int(m_buffer, object.type() == osmium::item_type::area ? osmium::area_id_to_object_id(object.id()) : object.id());
         m_buffer += '\t';
     }
 
     if (!options().version.empty()) {
-        m_buffer.append(std::to_string(object.version()));
+        append_int(m_buffer, object.version());
         m_buffer += '\t';
     }
 
     if (!options().changeset.empty()) {
-        m_buffer.append(std::to_string(object.changeset()));
+        append_int(m_buffer, object.changeset());
         m_buffer += '\t';
     }
 
     if (!options().uid.empty()) {
-        m_buffer.append(std::to_string(object.uid()));
+        append_int(m_buffer, object.uid());
         m_buffer += '\t';
     }
 
     if (!options().user.empty()) {
-        append_pg_escaped(object.user());
+        append_pg_escaped(m_buffer, object.user());
         m_buffer += '\t';
     }
 
@@ -145,7 +126,7 @@ void ExportFormatPg::add_attributes(const osmium::OSMObject& object) {
         if (object.type() == osmium::item_type::way) {
             m_buffer += '{';
             for (const auto& nr : static_cast<const osmium::Way&>(object).nodes()) {
-                m_buffer.append(std::to_string(nr.ref()));
+                append_int(m_buffer, nr.ref());
                 m_buffer += ',';
             }
             if (m_buffer.back() == ',') {
@@ -177,7 +158,7 @@ bool ExportFormatPg::add_tags(const osmium::OSMObject& object) {
     }
     writer.EndObject();
 
-    append_pg_escaped(stream.GetString(), stream.GetSize());
+    append_pg_escaped(m_buffer, stream.GetString(), stream.GetSize());
 
     return has_tags;
 }
@@ -193,7 +174,7 @@ void ExportFormatPg::finish_feature(const osmium::OSMObject& object) {
 
         ++m_count;
 
-        if (m_buffer.size() > flush_buffer_size) {
+        if (m_fd >= 0 && m_buffer.size() > flush_buffer_size) {
             flush_to_output();
         }
     }
@@ -217,6 +198,30 @@ void ExportFormatPg::area(const osmium::Area& area) {
     finish_feature(area);
 }
 
+std::unique_ptr<ExportFormat> ExportFormatPg::create_chunk_format() const {
+    return std::unique_ptr<ExportFormat>{new ExportFormatPg{options()}};
+}
+
+std::string ExportFormatPg::take_chunk() {
+    m_buffer.resize(m_commit_size);
+    std::string chunk;
+    chunk.swap(m_buffer);
+    m_commit_size = 0;
+    m_count = 0;
+    return chunk;
+}
+
+void ExportFormatPg::add_chunk(const std::string& chunk, std::uint64_t count) {
+    m_buffer.resize(m_commit_size);
+    m_buffer.append(chunk);
+    m_commit_size = m_buffer.size();
+    m_count += count;
+
+    if (m_buffer.size() > flush_buffer_size) {
+        flush_to_output();
+    }
+}
+
 void ExportFormatPg::close() {
     if (m_fd > 0) {
         flush_to_output();
@@ -228,53 +233,58 @@ void ExportFormatPg::close() {
     }
 }
 
-void ExportFormatPg::debug_output(osmium::VerboseOutput& out, const std::string& filename) {
-    out << '\n';
+void print_pg_create_table(osmium::VerboseOutput& out, const options_type& options, bool binary) {
     out << "Create table with something like this:\n";
     out << "CREATE TABLE osmdata (\n";
 
-    if (options().unique_id == unique_id_type::counter) {
+    if (options.unique_id == unique_id_type::counter) {
         out << "    id        BIGINT PRIMARY KEY,\n";
-    } else if (options().unique_id == unique_id_type::type_id) {
+    } else if (options.unique_id == unique_id_type::type_id) {
         out << "    id        VARCHAR PRIMARY KEY,\n";
     }
 
     out << "    geom      GEOMETRY,\n";
 
-    if (!options().type.empty()) {
+    if (!options.type.empty()) {
         out << "    osm_type  VARCHAR,\n";
     }
 
-    if (!options().id.empty()) {
+    if (!options.id.empty()) {
         out << "    osm_id    BIGINT,\n";
     }
 
-    if (!options().version.empty()) {
+    if (!options.version.empty()) {
         out << "    version   INTEGER,\n";
     }
 
-    if (!options().changeset.empty()) {
+    if (!options.changeset.empty()) {
         out << "    changeset INTEGER,\n";
     }
 
-    if (!options().uid.empty()) {
+    if (!options.uid.empty()) {
         out << "    uid       INTEGER,\n";
     }
 
-    if (!options().user.empty()) {
+    if (!options.user.empty()) {
         out << "    user      VARCHAR,\n";
     }
 
-    if (!options().timestamp.empty()) {
+    if (!options.timestamp.empty()) {
         out << "    timestamp TIMESTAMP (0) WITH TIME ZONE,\n";
     }
 
-    if (!options().way_nodes.empty()) {
+    if (!options.way_nodes.empty()) {
         out << "    way_nodes BIGINT[],\n";
     }
 
-    out << "    tags      JSON -- or JSONB\n";
+    // The binary format of JSONB is different from JSON.
+    out << (binary ? "    tags      JSON\n" : "    tags      JSON -- or JSONB\n");
     out << ");\n";
+}
+
+void ExportFormatPg::debug_output(osmium::VerboseOutput& out, const std::string& filename) {
+    out << '\n';
+    print_pg_create_table(out, options(), false);
     out << "Then load data with something like this:\n";
     out << "\\copy osmdata FROM '" << filename << "'\n";
     out << '\n';
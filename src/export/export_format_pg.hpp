@@ -29,6 +29,8 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <osmium/geom/wkb.hpp>
 #include <osmium/io/writer_options.hpp>
 
+#include <cstdint>
+#include <memory>
 #include <string>
 
 class ExportFormatPg : public ExportFormat {
@@ -45,7 +47,9 @@ class ExportFormatPg : public ExportFormat {
     void add_attributes(const osmium::OSMObject& object);
     bool add_tags(const osmium::OSMObject& object);
     void finish_feature(const osmium::OSMObject& object);
-    void append_pg_escaped(const char* str, std::size_t size);
+
+    // Used by create_chunk_format(), writes into memory only.
+    explicit ExportFormatPg(const options_type& options);
 
 public:
 
@@ -70,8 +74,18 @@ public:
 
     void close() override;
 
+    std::unique_ptr<ExportFormat> create_chunk_format() const override;
+
+    std::string take_chunk() override;
+
+    void add_chunk(const std::string& chunk, std::uint64_t count) override;
+
     void debug_output(osmium::VerboseOutput& out, const std::string& filename) override;
 
 }; // class ExportFormatPg
 
+// Print the SQL command creating a table matching the output of the pg
+// (or pg-binary if binary is set) format.
+void print_pg_create_table(osmium::VerboseOutput& out, const options_type& options, bool binary);
+
 #endif // EXPORT_EXPORT_FORMAT_PG_HPP
@@ -0,0 +1,336 @@
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "export_format_pg_binary.hpp"
+#include "export_format_pg.hpp"
+#include "format_util.hpp"
+
+#include <osmium/io/detail/read_write.hpp>
+
+#ifndef RAPIDJSON_HAS_STDSTRING
+# define RAPIDJSON_HAS_STDSTRING 1
+#endif
+#include <rapidjson/writer.h>
+#include <rapidjson/stringbuffer.h>
+
+#include <string>
+
+enum {
+    initial_buffer_size = 1024u * 1024u
+};
+
+enum {
+    flush_buffer_size = 800u * 1024u
+};
+
+// Signature, flags field and header extension length.
+static const char copy_header[] = "PGCOPY\n\377\r\n\0\0\0\0\0\0\0\0\0";
+
+// Type OID of BIGINT used in the array header.
+static constexpr const std::int32_t oid_int8 = 20;
+
+// Difference between the Unix epoch and the PostgreSQL epoch (2000-01-01).
+static constexpr const std::int64_t pg_epoch_offset = 946684800;
+
+ExportFormatPgBinary::ExportFormatPgBinary(const std::string& /*output_format*/,
+                                           const std::string& output_filename,
+                                           osmium::io::overwrite overwrite,
+                                           osmium::io::fsync fsync,
+                                           const options_type& options) :
+    ExportFormat(options),
+    m_fd(osmium::io::detail::open_for_writing(output_filename, overwrite)),
+    m_fsync(fsync) {
+    m_buffer.reserve(initial_buffer_size);
+    m_buffer.append(copy_header, sizeof(copy_header) - 1);
+    m_commit_size = m_buffer.size();
+}
+
+ExportFormatPgBinary::ExportFormatPgBinary(const options_type& options) :
+    ExportFormat(options),
+    m_fd(-1),
+    m_fsync(osmium::io::fsync::no) {
+    m_buffer.reserve(initial_buffer_size);
+}
+
+void ExportFormatPgBinary::flush_to_output() {
+    osmium::io::detail::reliable_write(m_fd, m_buffer.data(), m_buffer.size());
+    m_buffer.clear();
+    m_commit_size = 0;
+}
+
+// All integers are in network byte order.
+void ExportFormatPgBinary::append_int16(std::int16_t value) {
+    const auto v = static_cast<std::uint16_t>(value);
+    m_buffer += static_cast<char>(v >> 8U);
+    m_buffer += static_cast<char>(v & 0xffU);
+}
+
+void ExportFormatPgBinary::append_int32(std::int32_t value) {
+    const auto v = static_cast<std::uint32_t>(value);
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        m_buffer += static_cast<char>((v >> static_cast<unsigned>(shift)) & 0xffU);
+    }
+}
+
+void ExportFormatPgBinary::append_int64(std::int64_t value) {
+    const auto v = static_cast<std::uint64_t>(value);
+    for (int shift = 56; shift >= 0; shift -= 8) {
+        m_buffer += static_cast<char>((v >> static_cast<unsigned>(shift)) & 0xffU);
+    }
+}
+
+// Reserve space for the length of a field. The length is filled in by
+// finish_field() after the field data was added.
+std::size_t ExportFormatPgBinary::start_field() {
+    const auto pos = m_buffer.size();
+    m_buffer.append(4, '\0');
+    return pos;
+}
+
+void ExportFormatPgBinary::finish_field(std::size_t pos) {
+    const auto length = static_cast<std::uint32_t>(m_buffer.size() - pos - 4);
+    for (std::size_t i = 0; i < 4; ++i) {
+        m_buffer[pos + i] = static_cast<char>((length >> ((3 - i) * 8)) & 0xffU);
+    }
+}
+
+void ExportFormatPgBinary::add_field(const char* data, std::size_t size) {
+    append_int32(static_cast<std::int32_t>(size));
+    m_buffer.append(data, size);
+}
+
+void ExportFormatPgBinary::add_int32_field(std::int32_t value) {
+    append_int32(sizeof(std::int32_t));
+    append_int32(value);
+}
+
+void ExportFormatPgBinary::add_int64_field(std::int64_t value) {
+    append_int32(sizeof(std::int64_t));
+    append_int64(value);
+}
+
+void ExportFormatPgBinary::add_null_field() {
+    append_int32(-1);
+}
+
+int ExportFormatPgBinary::num_fields() const noexcept {
+    int num = 2; // geometry and tags
+
+    if (options().unique_id != unique_id_type::none) {
+        ++num;
+    }
+
+    for (const auto* attr : {&options().type, &options().id, &options().version,
+                             &options().changeset, &options().uid, &options().user,
+                             &options().timestamp, &options().way_nodes}) {
+        if (!attr->empty()) {
+            ++num;
+        }
+    }
+
+    return num;
+}
+
+void ExportFormatPgBinary::start_feature(const char type, const osmium::object_id_type id) {
+    m_buffer.resize(m_commit_size);
+    append_int16(static_cast<std::int16_t>(num_fields()));
+
+    if (options().unique_id == unique_id_type::counter) {
+        add_int64_field(static_cast<std::int64_t>(m_count + 1));
+    } else if (options().unique_id == unique_id_type::type_id) {
+        const auto pos = start_field();
+        m_buffer += type;
+        append_int(m_buffer, id);
+        finish_field(pos);
+    }
+}
+
+void ExportFormatPgBinary::add_attributes(const osmium::OSMObject& object) {
+    if (!options().type.empty()) {
+        const auto pos = start_field();
+        if (object.type() == osmium::item_type::area) {
+            if (static_cast<const osmium::Area&>(object).from_way()) {
+                m_buffer.append("way");
+            } else {
+                m_buffer.append("relation");
+            }
+        } else {
+            m_buffer.append(osmium::item_type_to_name(object.type()));
+        }
+        finish_field(pos);
+    }
+
+    if (!options().id.empty()) {
+        add_int64_field(object.type() == osmium::item_type::area ? osmium::area_id_to_object_id(object.id()) : object.id());
+    }
+
+    if (!options().version.empty()) {
+        add_int32_field(static_cast<std::int32_t>(object.version()));
+    }
+
+    if (!options().changeset.empty()) {
+        add_int32_field(static_cast<std::int32_t>(object.changeset()));
+    }
+
+    if (!options().uid.empty()) {
+        add_int32_field(static_cast<std::int32_t>(object.uid()));
+    }
+
+    if (!options().user.empty()) {
+        const auto pos = start_field();
+        m_buffer.append(object.user());
+        finish_field(pos);
+    }
+
+    if (!options().timestamp.empty()) {
+        add_int64_field((object.timestamp().seconds_since_epoch() - pg_epoch_offset) * 1000000);
+    }
+
+    if (!options().way_nodes.empty()) {
+        if (object.type() == osmium::item_type::way) {
+            const auto& nodes = static_cast<const osmium::Way&>(object).nodes();
+            const auto pos = start_field();
+            if (nodes.empty()) {
+                append_int32(0); // number of dimensions
+                append_int32(0); // no nulls
+                append_int32(oid_int8);
+            } else {
+                append_int32(1); // number of dimensions
+                append_int32(0); // no nulls
+                append_int32(oid_int8);
+                append_int32(static_cast<std::int32_t>(nodes.size()));
+                append_int32(1); // lower bound
+                for (const auto& nr : nodes) {
+                    add_int64_field(nr.ref());
+                }
+            }
+            finish_field(pos);
+        } else {
+            add_null_field();
+        }
+    }
+}
+
+bool ExportFormatPgBinary::add_tags(const osmium::OSMObject& object) {
+    bool has_tags = false;
+
+    rapidjson::StringBuffer stream;
+    rapidjson::Writer<rapidjson::StringBuffer> writer{stream};
+
+    writer.StartObject();
+    for (const auto& tag : object.tags()) {
+        if (options().tags_filter(tag)) {
+            has_tags = true;
+            writer.Key(tag.key());
+            writer.String(tag.value());
+        }
+    }
+    writer.EndObject();
+
+    add_field(stream.GetString(), stream.GetSize());
+
+    return has_tags;
+}
+
+void ExportFormatPgBinary::finish_feature(const osmium::OSMObject& object) {
+    add_attributes(object);
+
+    if (add_tags(object) || options().keep_untagged) {
+        m_commit_size = m_buffer.size();
+
+        ++m_count;
+
+        if (m_fd >= 0 && m_buffer.size() > flush_buffer_size) {
+            flush_to_output();
+        }
+    }
+}
+
+// The geometry column comes right after the unique id, like in the pg
+// format.
+void ExportFormatPgBinary::node(const osmium::Node& node) {
+    const std::string geometry{m_factory.create_point(node)};
+    start_feature('n', node.id());
+    add_field(geometry.data(), geometry.size());
+    finish_feature(node);
+}
+
+void ExportFormatPgBinary::way(const osmium::Way& way) {
+    const std::string geometry{m_factory.create_linestring(way)};
+    start_feature('w', way.id());
+    add_field(geometry.data(), geometry.size());
+    finish_feature(way);
+}
+
+void ExportFormatPgBinary::area(const osmium::Area& area) {
+    const std::string geometry{m_factory.create_multipolygon(area)};
+    start_feature('a', area.id());
+    add_field(geometry.data(), geometry.size());
+    finish_feature(area);
+}
+
+std::unique_ptr<ExportFormat> ExportFormatPgBinary::create_chunk_format() const {
+    return std::unique_ptr<ExportFormat>{new ExportFormatPgBinary{options()}};
+}
+
+std::string ExportFormatPgBinary::take_chunk() {
+    m_buffer.resize(m_commit_size);
+    std::string chunk;
+    chunk.swap(m_buffer);
+    m_commit_size = 0;
+    m_count = 0;
+    return chunk;
+}
+
+void ExportFormatPgBinary::add_chunk(const std::string& chunk, std::uint64_t count) {
+    m_buffer.resize(m_commit_size);
+    m_buffer.append(chunk);
+    m_commit_size = m_buffer.size();
+    m_count += count;
+
+    if (m_buffer.size() > flush_buffer_size) {
+        flush_to_output();
+    }
+}
+
+void ExportFormatPgBinary::close() {
+    if (m_fd > 0) {
+        m_buffer.resize(m_commit_size);
+        append_int16(-1); // file trailer
+        flush_to_output();
+        if (m_fsync == osmium::io::fsync::yes) {
+            osmium::io::detail::reliable_fsync(m_fd);
+        }
+        ::close(m_fd);
+        m_fd = -1;
+    }
+}
+
+void ExportFormatPgBinary::debug_output(osmium::VerboseOutput& out, const std::string& filename) {
+    out << '\n';
+    print_pg_create_table(out, options(), true);
+    out << "Then load data with something like this:\n";
+    out << "\\copy osmdata FROM '" << filename << "' (FORMAT binary)\n";
+    out << "When writing to STDOUT, the output can be piped into psql with:\n";
+    out << "psql -c \"\\copy osmdata FROM STDIN (FORMAT binary)\"\n";
+    out << '\n';
+}
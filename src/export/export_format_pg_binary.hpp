@@ -0,0 +1,106 @@
+#ifndef EXPORT_EXPORT_FORMAT_PG_BINARY_HPP
+#define EXPORT_EXPORT_FORMAT_PG_BINARY_HPP
+
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "export_format.hpp"
+
+#include <osmium/fwd.hpp>
+#include <osmium/geom/wkb.hpp>
+#include <osmium/io/writer_options.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+/**
+ * Writes the PostgreSQL binary COPY format. The columns are the same as
+ * for the pg format, but no text escaping is needed and the geometry
+ * is written as binary EWKB.
+ */
+class ExportFormatPgBinary : public ExportFormat {
+
+    osmium::geom::WKBFactory<> m_factory{osmium::geom::wkb_type::ewkb, osmium::geom::out_type::binary};
+    std::string m_buffer;
+    std::size_t m_commit_size = 0;
+    int m_fd;
+    osmium::io::fsync m_fsync;
+
+    void flush_to_output();
+
+    void append_int16(std::int16_t value);
+    void append_int32(std::int32_t value);
+    void append_int64(std::int64_t value);
+
+    std::size_t start_field();
+    void finish_field(std::size_t pos);
+    void add_field(const char* data, std::size_t size);
+    void add_int32_field(std::int32_t value);
+    void add_int64_field(std::int64_t value);
+    void add_null_field();
+
+    int num_fields() const noexcept;
+
+    void start_feature(char type, osmium::object_id_type id);
+    void add_attributes(const osmium::OSMObject& object);
+    bool add_tags(const osmium::OSMObject& object);
+    void finish_feature(const osmium::OSMObject& object);
+
+    // Used by create_chunk_format(), writes into memory only.
+    explicit ExportFormatPgBinary(const options_type& options);
+
+public:
+
+    ExportFormatPgBinary(const std::string& output_format,
+                         const std::string& output_filename,
+                         osmium::io::overwrite overwrite,
+                         osmium::io::fsync fsync,
+                         const options_type& options);
+
+    ~ExportFormatPgBinary() override {
+        try {
+            close();
+        } catch(...) {
+        }
+    }
+
+    void node(const osmium::Node& node) override;
+
+    void way(const osmium::Way& way) override;
+
+    void area(const osmium::Area& area) override;
+
+    void close() override;
+
+    std::unique_ptr<ExportFormat> create_chunk_format() const override;
+
+    std::string take_chunk() override;
+
+    void add_chunk(const std::string& chunk, std::uint64_t count) override;
+
+    void debug_output(osmium::VerboseOutput& out, const std::string& filename) override;
+
+}; // class ExportFormatPgBinary
+
+#endif // EXPORT_EXPORT_FORMAT_PG_BINARY_HPP
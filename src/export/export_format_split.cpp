@@ -0,0 +1,114 @@
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "export_format_split.hpp"
+
+#include <osmium/geom/mercator_projection.hpp>
+#include <osmium/geom/tile.hpp>
+#include <osmium/osm.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+ExportFormatSplit::ExportFormatSplit(const options_type& options,
+                                     std::uint32_t zoom,
+                                     std::size_t max_files,
+                                     const std::string& directory,
+                                     const std::string& suffix,
+                                     factory_type factory) :
+    ExportFormat(options),
+    m_factory(std::move(factory)),
+    m_directory(directory),
+    m_suffix(suffix),
+    m_zoom(zoom),
+    m_max_files(max_files) {
+    if (!m_directory.empty() && m_directory.back() != '/') {
+        m_directory += '/';
+    }
+}
+
+ExportFormat& ExportFormatSplit::format_for(const osmium::Box& box) {
+    if (!box.valid()) {
+        throw osmium::invalid_location{"invalid location"};
+    }
+
+    const auto x = (static_cast<std::int64_t>(box.bottom_left().x()) + box.top_right().x()) / 2;
+    auto y = (static_cast<std::int64_t>(box.bottom_left().y()) + box.top_right().y()) / 2;
+
+    // Web mercator doesn't reach the poles.
+    const auto max_y = static_cast<std::int64_t>(osmium::geom::MERCATOR_MAX_LAT * osmium::detail::coordinate_precision);
+    y = std::max(-max_y, std::min(max_y, y));
+
+    const osmium::geom::Tile tile{m_zoom, osmium::Location{static_cast<std::int32_t>(x), static_cast<std::int32_t>(y)}};
+
+    const auto key = (static_cast<std::uint64_t>(tile.x) << 32U) | tile.y;
+    auto& format = m_formats[key];
+    if (!format) {
+        if (m_formats.size() > m_max_files) {
+            m_formats.erase(key);
+            throw std::runtime_error{"Too many output files for --split-zoom (more than " +
+                                     std::to_string(m_max_files) +
+                                     "). Use a smaller zoom level or raise the limit on open files (ulimit -n)."};
+        }
+        format = m_factory(m_directory + std::to_string(m_zoom) + '-' +
+                           std::to_string(tile.x) + '-' +
+                           std::to_string(tile.y) + '.' + m_suffix);
+    }
+
+    return *format;
+}
+
+void ExportFormatSplit::node(const osmium::Node& node) {
+    auto& format = format_for(osmium::Box{node.location(), node.location()});
+    const auto count = format.count();
+    format.node(node);
+    m_count += format.count() - count;
+}
+
+void ExportFormatSplit::way(const osmium::Way& way) {
+    auto& format = format_for(way.envelope());
+    const auto count = format.count();
+    format.way(way);
+    m_count += format.count() - count;
+}
+
+void ExportFormatSplit::area(const osmium::Area& area) {
+    auto& format = format_for(area.envelope());
+    const auto count = format.count();
+    format.area(area);
+    m_count += format.count() - count;
+}
+
+void ExportFormatSplit::close() {
+    for (auto& format : m_formats) {
+        format.second->close();
+    }
+}
+
+void ExportFormatSplit::debug_output(osmium::VerboseOutput& out, const std::string& /*filename*/) {
+    out << '\n';
+    out << "Writing one file per tile on zoom level " << m_zoom
+        << " named '" << m_directory << m_zoom << "-X-Y." << m_suffix << "'\n";
+    out << '\n';
+}
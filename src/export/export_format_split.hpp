@@ -0,0 +1,107 @@
+#ifndef EXPORT_EXPORT_FORMAT_SPLIT_HPP
+#define EXPORT_EXPORT_FORMAT_SPLIT_HPP
+
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "export_format.hpp"
+
+#include <osmium/fwd.hpp>
+#include <osmium/osm/box.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+/**
+ * Distributes the features over several output files, one for each
+ * (web mercator) tile on a given zoom level. Each feature goes into the
+ * file of the tile containing the center of its bounding box. The output
+ * files are created when the first feature for them is written using a
+ * format object from the factory function. All files stay open until
+ * the end, so there can be at most max_files of them.
+ */
+class ExportFormatSplit : public ExportFormat {
+
+public:
+
+    using factory_type = std::function<std::unique_ptr<ExportFormat>(const std::string&)>;
+
+private:
+
+    factory_type m_factory;
+    std::string m_directory;
+    std::string m_suffix;
+    std::uint32_t m_zoom;
+    std::size_t m_max_files;
+
+    // Key is the tile x coordinate in the upper and y in the lower half.
+    std::unordered_map<std::uint64_t, std::unique_ptr<ExportFormat>> m_formats;
+
+    ExportFormat& format_for(const osmium::Box& box);
+
+public:
+
+    ExportFormatSplit(const options_type& options,
+                      std::uint32_t zoom,
+                      std::size_t max_files,
+                      const std::string& directory,
+                      const std::string& suffix,
+                      factory_type factory);
+
+    void node(const osmium::Node& node) override;
+
+    void way(const osmium::Way& way) override;
+
+    void area(const osmium::Area& area) override;
+
+    void close() override;
+
+    // The features have to be routed to different files, so this format
+    // doesn't support chunked output.
+    bool supports_chunks() const noexcept override {
+        return false;
+    }
+
+    std::unique_ptr<ExportFormat> create_chunk_format() const override {
+        return std::unique_ptr<ExportFormat>{};
+    }
+
+    std::string take_chunk() override {
+        return std::string{};
+    }
+
+    void add_chunk(const std::string& /*chunk*/, std::uint64_t /*count*/) override {
+    }
+
+    void debug_output(osmium::VerboseOutput& out, const std::string& filename) override;
+
+    std::size_t num_files() const noexcept {
+        return m_formats.size();
+    }
+
+}; // class ExportFormatSplit
+
+#endif // EXPORT_EXPORT_FORMAT_SPLIT_HPP
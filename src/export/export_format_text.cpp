@@ -21,6 +21,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
 #include "export_format_text.hpp"
+#include "format_util.hpp"
 
 #include <osmium/io/detail/read_write.hpp>
 #include <osmium/io/detail/string_util.hpp>
@@ -37,10 +38,24 @@ ExportFormatText::ExportFormatText(const std::string& /*output_format*/,
     m_fd(osmium::io::detail::open_for_writing(output_filename, overwrite)),
     m_fsync(fsync) {
     m_buffer.reserve(initial_buffer_size);
+    if (options.gzip) {
+        m_gzip.reset(new ParallelGzipOutput{m_fd});
+    }
+}
+
+ExportFormatText::ExportFormatText(const options_type& options) :
+    ExportFormat(options),
+    m_fd(-1),
+    m_fsync(osmium::io::fsync::no) {
+    m_buffer.reserve(initial_buffer_size);
 }
 
 void ExportFormatText::flush_to_output() {
-    osmium::io::detail::reliable_write(m_fd, m_buffer.data(), m_buffer.size());
+    if (m_gzip) {
+        m_gzip->write(m_buffer.data(), m_buffer.size());
+    } else {
+        osmium::io::detail::reliable_write(m_fd, m_buffer.data(), m_buffer.size());
+    }
     m_buffer.clear();
     m_commit_size = 0;
 }
@@ -48,11 +63,11 @@ void ExportFormatText::flush_to_output() {
 void ExportFormatText::start_feature(char type, osmium::object_id_type id) {
     m_buffer.resize(m_commit_size);
     if (options().unique_id == unique_id_type::counter) {
-        m_buffer.append(std::to_string(m_count + 1));
+        append_int(m_buffer, m_count + 1);
         m_buffer.append(1, ' ');
     } else if (options().unique_id == unique_id_type::type_id) {
         m_buffer.append(1, type);
-        m_buffer.append(std::to_string(id));
+        append_int(m_buffer, id);
         m_buffer.append(1, ' ');
     }
 }
@@ -76,28 +91,28 @@ void ExportFormatText::add_attributes(const osmium::OSMObject& object) {
     if (!options().id.empty()) {
         m_buffer.append(options().id);
         m_buffer.append(1, '=');
-        m_buffer.append(std::to_string(object.type() == osmium::item_type::area ? osmium::area_id_to_object_id(object.id()) : object.id()));
+        append_int(m_buffer, object.type() == osmium::item_type::area ? osmium::area_id_to_object_id(object.id()) : object.id());
         m_buffer.append(1, ',');
     }
 
     if (!options().version.empty()) {
         m_buffer.append(options().version);
         m_buffer.append(1, '=');
-        m_buffer.append(std::to_string(object.version()));
+        append_int(m_buffer, object.version());
         m_buffer.append(1, ',');
     }
 
     if (!options().changeset.empty()) {
         m_buffer.append(options().changeset);
         m_buffer.append(1, '=');
-        m_buffer.append(std::to_string(object.changeset()));
+        append_int(m_buffer, object.changeset());
         m_buffer.append(1, ',');
     }
 
     if (!options().uid.empty()) {
         m_buffer.append(options().uid);
         m_buffer.append(1, '=');
-        m_buffer.append(std::to_string(object.uid()));
+        append_int(m_buffer, object.uid());
         m_buffer.append(1, ',');
     }
 
@@ -111,7 +126,7 @@ void ExportFormatText::add_attributes(const osmium::OSMObject& object) {
     if (!options().timestamp.empty()) {
         m_buffer.append(options().timestamp);
         m_buffer.append(1, '=');
-        m_buffer.append(std::to_string(object.timestamp().seconds_since_epoch()));
+        append_int(m_buffer, object.timestamp().seconds_since_epoch());
         m_buffer.append(1, ',');
     }
 
@@ -119,7 +134,7 @@ void ExportFormatText::add_attributes(const osmium::OSMObject& object) {
         m_buffer.append(options().way_nodes);
         m_buffer.append(1, '=');
         for (const auto& nr : static_cast<const osmium::Way&>(object).nodes()) {
-            m_buffer.append(std::to_string(nr.ref()));
+            append_int(m_buffer, nr.ref());
             m_buffer.append(1, '/');
         }
         if (m_buffer.back() == '/') {
@@ -151,7 +166,7 @@ void ExportFormatText::finish_feature(const osmium::OSMObject& object) {
 
         ++m_count;
 
-        if (m_buffer.size() > flush_buffer_size) {
+        if (m_fd >= 0 && m_buffer.size() > flush_buffer_size) {
             flush_to_output();
         }
     }
@@ -159,25 +174,52 @@ void ExportFormatText::finish_feature(const osmium::OSMObject& object) {
 
 void ExportFormatText::node(const osmium::Node& node) {
     start_feature('n', node.id());
-    m_buffer.append(m_factory.create_point(node));
+    append_wkt_point(m_buffer, node);
     finish_feature(node);
 }
 
 void ExportFormatText::way(const osmium::Way& way) {
     start_feature('w', way.id());
-    m_buffer.append(m_factory.create_linestring(way));
+    append_wkt_linestring(m_buffer, way);
     finish_feature(way);
 }
 
 void ExportFormatText::area(const osmium::Area& area) {
     start_feature('a', area.id());
-    m_buffer.append(m_factory.create_multipolygon(area));
+    append_wkt_multipolygon(m_buffer, area);
     finish_feature(area);
 }
 
+std::unique_ptr<ExportFormat> ExportFormatText::create_chunk_format() const {
+    return std::unique_ptr<ExportFormat>{new ExportFormatText{options()}};
+}
+
+std::string ExportFormatText::take_chunk() {
+    m_buffer.resize(m_commit_size);
+    std::string chunk;
+    chunk.swap(m_buffer);
+    m_commit_size = 0;
+    m_count = 0;
+    return chunk;
+}
+
+void ExportFormatText::add_chunk(const std::string& chunk, std::uint64_t count) {
+    m_buffer.resize(m_commit_size);
+    m_buffer.append(chunk);
+    m_commit_size = m_buffer.size();
+    m_count += count;
+
+    if (m_buffer.size() > flush_buffer_size) {
+        flush_to_output();
+    }
+}
+
 void ExportFormatText::close() {
     if (m_fd > 0) {
         flush_to_output();
+        if (m_gzip) {
+            m_gzip->flush();
+        }
         if (m_fsync == osmium::io::fsync::yes) {
             osmium::io::detail::reliable_fsync(m_fd);
         }
@@ -24,20 +24,22 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
 #include "export_format.hpp"
+#include "gzip_output.hpp"
 
 #include <osmium/fwd.hpp>
-#include <osmium/geom/wkt.hpp>
 #include <osmium/io/writer_options.hpp>
 
+#include <cstdint>
+#include <memory>
 #include <string>
 
 class ExportFormatText : public ExportFormat {
 
-    osmium::geom::WKTFactory<> m_factory;
     std::string m_buffer;
     std::size_t m_commit_size = 0;
     int m_fd;
     osmium::io::fsync m_fsync;
+    std::unique_ptr<ParallelGzipOutput> m_gzip;
 
     void flush_to_output();
 
@@ -45,6 +47,9 @@ class ExportFormatText : public ExportFormat {
     void add_attributes(const osmium::OSMObject& object);
     void finish_feature(const osmium::OSMObject& object);
 
+    // Used by create_chunk_format(), writes into memory only.
+    explicit ExportFormatText(const options_type& options);
+
 public:
 
     ExportFormatText(const std::string& output_format,
@@ -65,6 +70,12 @@ public:
 
     void close() override;
 
+    std::unique_ptr<ExportFormat> create_chunk_format() const override;
+
+    std::string take_chunk() override;
+
+    void add_chunk(const std::string& chunk, std::uint64_t count) override;
+
 }; // class ExportFormatText
 
 #endif // EXPORT_EXPORT_FORMAT_TEXT_HPP
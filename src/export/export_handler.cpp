@@ -22,20 +22,34 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "export_handler.hpp"
 #include "../exception.hpp"
+#include "../trace.hpp"
 #include "../util.hpp"
 
 #include <osmium/geom/factory.hpp>
 #include <osmium/osm.hpp>
 #include <osmium/osm/entity_bits.hpp>
-#include <osmium/tags/taglist.hpp>
 
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
 #include <cstring>
+#include <exception>
 #include <iostream>
 #include <memory>
 #include <string>
 #include <utility>
 #include <vector>
 
+// Batches of features are submitted to the pool when they are this large.
+static constexpr const std::size_t batch_size = 1024UL * 1024UL;
+
+// Tag lists larger than this (keys and values) are not cached, they are
+// unlikely to show up again.
+static constexpr const std::size_t max_cached_tags_size = 256;
+
+// The classification cache is cleared when it has this many entries.
+static constexpr const std::size_t max_cache_entries = 64UL * 1024UL;
+
 static bool check_conditions(const osmium::TagList& tags, const Ruleset& r1, const Ruleset& r2, bool is_no) noexcept {
     const char* area_tag = tags.get_value_by_key("area");
     if (area_tag) {
@@ -48,32 +62,84 @@ static bool check_conditions(const osmium::TagList& tags, const Ruleset& r1, con
     }
 
     if (r1.rule_type() == tags_filter_rule_type::other) {
-        return osmium::tags::match_none_of(tags, r2.filter());
+        return r2.filter().match_none_of(tags);
+    }
+
+    return r1.filter().match_any_of(tags);
+}
+
+ExportHandler::classification ExportHandler::classify(const osmium::TagList& tags) {
+    // Keys and values of all tags are stored one after the other as
+    // null-terminated strings, hash them all (FNV-1a) in one go.
+    const char* begin = tags.empty() ? "" : tags.begin()->key();
+    const char* end = begin;
+    for (const auto& tag : tags) {
+        end = tag.value() + std::strlen(tag.value()) + 1;
+    }
+    const auto size = static_cast<std::size_t>(end - begin);
+
+    if (size > max_cached_tags_size) {
+        return classification{check_conditions(tags, m_linear_ruleset, m_area_ruleset, true),
+                              check_conditions(tags, m_area_ruleset, m_linear_ruleset, false)};
     }
 
-    return osmium::tags::match_any_of(tags, r1.filter());
+    std::uint64_t hash = 14695981039346656037ULL;
+    for (const char* c = begin; c != end; ++c) {
+        hash ^= static_cast<unsigned char>(*c);
+        hash *= 1099511628211ULL;
+    }
+
+    const auto it = m_classification_cache.find(hash);
+    if (it != m_classification_cache.end() &&
+        it->second.tags.size() == size &&
+        std::memcmp(it->second.tags.data(), begin, size) == 0) {
+        return it->second.result;
+    }
+
+    if (m_classification_cache.size() >= max_cache_entries) {
+        m_classification_cache.clear();
+    }
+
+    auto& entry = m_classification_cache[hash];
+    entry.tags.assign(begin, size);
+    entry.result.linear = check_conditions(tags, m_linear_ruleset, m_area_ruleset, true);
+    entry.result.area = check_conditions(tags, m_area_ruleset, m_linear_ruleset, false);
+
+    return entry.result;
 }
 
-bool ExportHandler::is_linear(const osmium::TagList& tags) const noexcept {
-    return check_conditions(tags, m_linear_ruleset, m_area_ruleset, true);
+bool ExportHandler::is_linear(const osmium::TagList& tags) {
+    return classify(tags).linear;
 }
 
-bool ExportHandler::is_area(const osmium::TagList& tags) const noexcept {
-    return check_conditions(tags, m_area_ruleset, m_linear_ruleset, false);
+bool ExportHandler::is_area(const osmium::TagList& tags) {
+    return classify(tags).area;
 }
 
-ExportHandler::ExportHandler(std::unique_ptr<ExportFormat>&& handler,
+ExportHandler::ExportHandler(std::vector<std::unique_ptr<ExportFormat>>&& formats,
                              const Ruleset& linear_ruleset,
                              const Ruleset& area_ruleset,
                              geometry_types geometry_types,
                              bool show_errors,
-                             bool stop_on_error) :
-    m_handler(std::move(handler)),
+                             bool stop_on_error,
+                             osmium::thread::Pool* pool) :
+    m_formats(std::move(formats)),
     m_linear_ruleset(linear_ruleset),
     m_area_ruleset(area_ruleset),
     m_geometry_types(geometry_types),
     m_show_errors(show_errors),
     m_stop_on_error(stop_on_error) {
+    // The counter IDs depend on the order in which the features are
+    // written, so they can only be created on the main thread. Same
+    // for formats that can't write their output in chunks.
+    const bool chunks = std::all_of(m_formats.cbegin(), m_formats.cend(), [](const std::unique_ptr<ExportFormat>& format) {
+        return format->supports_chunks() && format->options().unique_id != unique_id_type::counter;
+    });
+    if (pool && pool->num_threads() > 1 && chunks) {
+        m_pool = pool;
+        m_max_pending = static_cast<std::size_t>(pool->num_threads()) * 4;
+        m_batch = osmium::memory::Buffer{batch_size, osmium::memory::Buffer::auto_grow::yes};
+    }
 }
 
 void ExportHandler::show_error(const std::runtime_error& error) {
@@ -86,17 +152,148 @@ void ExportHandler::show_error(const std::runtime_error& error) {
     }
 }
 
+void ExportHandler::show_errors(const std::vector<std::exception_ptr>& errors) {
+    for (const auto& error : errors) {
+        try {
+            std::rethrow_exception(error);
+        } catch (const osmium::geometry_error& e) {
+            show_error(e);
+        } catch (const osmium::invalid_location& e) {
+            show_error(e);
+        }
+    }
+}
+
+static void write_feature(ExportFormat& format, const osmium::OSMObject& object) {
+    switch (object.type()) {
+        case osmium::item_type::node:
+            format.node(static_cast<const osmium::Node&>(object));
+            break;
+        case osmium::item_type::way:
+            format.way(static_cast<const osmium::Way&>(object));
+            break;
+        case osmium::item_type::area:
+            format.area(static_cast<const osmium::Area&>(object));
+            break;
+        default:
+            break;
+    }
+}
+
+static export_chunk serialize_batch(ExportFormat& format, const osmium::memory::Buffer& buffer) {
+    const TraceSpan span{"format features (thread)"};
+    export_chunk chunk;
+
+    for (const auto& object : buffer.select<osmium::OSMObject>()) {
+        try {
+            write_feature(format, object);
+        } catch (const osmium::geometry_error&) {
+            chunk.errors.push_back(std::current_exception());
+        } catch (const osmium::invalid_location&) {
+            chunk.errors.push_back(std::current_exception());
+        }
+    }
+
+    chunk.count = format.count();
+    chunk.data = format.take_chunk();
+
+    return chunk;
+}
+
+// Geometry errors are reported only once for each feature, even if
+// several formats run into them.
+void ExportHandler::add_feature(const osmium::OSMObject& object) {
+    if (m_pool) {
+        add_to_batch(object);
+        return;
+    }
+
+    std::exception_ptr error;
+    for (auto& format : m_formats) {
+        try {
+            write_feature(*format, object);
+        } catch (const osmium::geometry_error&) {
+            error = std::current_exception();
+        } catch (const osmium::invalid_location&) {
+            error = std::current_exception();
+        }
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+void ExportHandler::add_to_batch(const osmium::OSMObject& object) {
+    m_batch.add_item(object);
+    m_batch.commit();
+
+    if (m_batch.committed() > batch_size) {
+        submit_batch();
+    }
+}
+
+void ExportHandler::submit_batch() {
+    if (m_batch.committed() == 0) {
+        return;
+    }
+
+    std::shared_ptr<osmium::memory::Buffer> buffer{new osmium::memory::Buffer{std::move(m_batch)}};
+    m_batch = osmium::memory::Buffer{batch_size, osmium::memory::Buffer::auto_grow::yes};
+
+    std::vector<std::future<export_chunk>> futures;
+    for (const auto& handler : m_formats) {
+        std::shared_ptr<ExportFormat> format{handler->create_chunk_format()};
+        futures.push_back(m_pool->submit([buffer, format]() {
+            return serialize_batch(*format, *buffer);
+        }));
+    }
+    m_pending.push_back(std::move(futures));
+
+    // Only collect results when there are too many of them, this keeps
+    // the features in the same order as in the single-threaded case.
+    while (m_pending.size() > m_max_pending) {
+        write_chunk();
+    }
+}
+
+void ExportHandler::write_chunk() {
+    auto futures = std::move(m_pending.front());
+    m_pending.pop_front();
+
+    for (std::size_t n = 0; n < m_formats.size(); ++n) {
+        const export_chunk chunk{futures[n].get()};
+        // All formats got the same features, so the errors of the
+        // first one are reported as the errors of the batch.
+        if (n == 0) {
+            show_errors(chunk.errors);
+        }
+        m_formats[n]->add_chunk(chunk.data, chunk.count);
+    }
+}
+
+void ExportHandler::close() {
+    if (m_pool) {
+        submit_batch();
+        while (!m_pending.empty()) {
+            write_chunk();
+        }
+    }
+    for (auto& format : m_formats) {
+        format->close();
+    }
+}
+
 void ExportHandler::node(const osmium::Node& node) {
     if (!m_geometry_types.point) {
         return;
     }
 
-    if (node.tags().empty() && !m_handler->options().keep_untagged) {
+    if (node.tags().empty() && !keep_untagged()) {
         return;
     }
 
     try {
-        m_handler->node(node);
+        add_feature(node);
     } catch (const osmium::geometry_error& e) {
         show_error(e);
     } catch (const osmium::invalid_location& e) {
@@ -120,10 +317,10 @@ void ExportHandler::way(const osmium::Way& way) {
         if (!way.nodes().front().location() || !way.nodes().back().location()) {
             throw osmium::invalid_location{"invalid location"};
         }
-        if ((way.tags().empty() && m_handler->options().keep_untagged)
+        if ((way.tags().empty() && keep_untagged())
             || !way.ends_have_same_location()
             || is_linear(way.tags())) {
-                m_handler->way(way);
+            add_feature(way);
         }
     } catch (const osmium::geometry_error& e) {
         show_error(e);
@@ -139,7 +336,7 @@ void ExportHandler::area(const osmium::Area& area) {
 
     if (!area.from_way() || is_area(area.tags())) {
         try {
-            m_handler->area(area);
+            add_feature(area);
         } catch (const osmium::geometry_error& e) {
             show_error(e);
         } catch (const osmium::invalid_location& e) {
@@ -29,17 +29,40 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <osmium/fwd.hpp>
 #include <osmium/handler.hpp>
 #include <osmium/io/writer_options.hpp>
+#include <osmium/memory/buffer.hpp>
 #include <osmium/osm/entity_bits.hpp>
 #include <osmium/tags/tags_filter.hpp>
+#include <osmium/thread/pool.hpp>
 
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <future>
 #include <memory>
 #include <stdexcept>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
+/**
+ * Output of a batch of features serialized on a worker thread and any
+ * geometry errors encountered while doing that.
+ */
+struct export_chunk {
+    std::string data;
+    std::uint64_t count = 0;
+    std::vector<std::exception_ptr> errors;
+};
+
+/**
+ * Decides which objects become features and hands them to one or more
+ * export formats. All formats get the same features, so the features
+ * are only selected once for all of them.
+ */
 class ExportHandler : public osmium::handler::Handler {
 
-    std::unique_ptr<ExportFormat> m_handler;
+    std::vector<std::unique_ptr<ExportFormat>> m_formats;
     const Ruleset& m_linear_ruleset;
     const Ruleset& m_area_ruleset;
     uint64_t m_error_count = 0;
@@ -49,20 +72,59 @@ class ExportHandler : public osmium::handler::Handler {
     bool m_show_errors;
     bool m_stop_on_error;
 
-    bool is_linear(const osmium::TagList& tags) const noexcept;
+    // Only used if geometries are created on several threads.
+    osmium::thread::Pool* m_pool = nullptr;
+    std::size_t m_max_pending = 0;
+    osmium::memory::Buffer m_batch;
+    // One future for each format for each batch.
+    std::deque<std::vector<std::future<export_chunk>>> m_pending;
 
-    bool is_area(const osmium::TagList& tags) const noexcept;
+    // Results of matching a tag list against the rulesets.
+    struct classification {
+        bool linear;
+        bool area;
+    };
+
+    struct cache_entry {
+        std::string tags;
+        classification result;
+    };
+
+    // The same tag combinations come up again and again, so the results
+    // are cached, keyed on a hash of all keys and values of the tag list.
+    std::unordered_map<std::uint64_t, cache_entry> m_classification_cache;
+
+    classification classify(const osmium::TagList& tags);
+
+    bool is_linear(const osmium::TagList& tags);
+
+    bool is_area(const osmium::TagList& tags);
 
     void show_error(const std::runtime_error& error);
 
+    void show_errors(const std::vector<std::exception_ptr>& errors);
+
+    bool keep_untagged() const noexcept {
+        return m_formats.front()->options().keep_untagged;
+    }
+
+    void add_feature(const osmium::OSMObject& object);
+
+    void add_to_batch(const osmium::OSMObject& object);
+
+    void submit_batch();
+
+    void write_chunk();
+
 public:
 
-    ExportHandler(std::unique_ptr<ExportFormat>&& handler,
+    ExportHandler(std::vector<std::unique_ptr<ExportFormat>>&& formats,
                   const Ruleset& linear_ruleset,
                   const Ruleset& area_ruleset,
                   geometry_types geometry_types,
                   bool show_errors,
-                  bool stop_on_error);
+                  bool stop_on_error,
+                  osmium::thread::Pool* pool = nullptr);
 
     void node(const osmium::Node& node);
 
@@ -70,12 +132,15 @@ public:
 
     void area(const osmium::Area& area);
 
-    void close() const {
-        m_handler->close();
+    void close();
+
+    std::size_t num_formats() const noexcept {
+        return m_formats.size();
     }
 
-    std::uint64_t count() const noexcept {
-        return m_handler->count();
+    /// The number of features written by format n.
+    std::uint64_t count(std::size_t n) const noexcept {
+        return m_formats[n]->count();
     }
 
     std::uint64_t error_count() const noexcept {
@@ -0,0 +1,162 @@
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "flatbuffer_builder.hpp"
+
+#include <cstring>
+
+void FlatBufferBuilder::push_bytes(std::uint64_t value, std::size_t length) {
+    // Bytes are stored in reverse order, so the most significant byte
+    // goes first to get little endian data in the end.
+    while (length > 0) {
+        --length;
+        m_data.push_back(static_cast<unsigned char>((value >> (length * 8)) & 0xffU));
+    }
+}
+
+void FlatBufferBuilder::pre_align(std::size_t length, std::size_t alignment) {
+    if (alignment > m_minalign) {
+        m_minalign = alignment;
+    }
+    while ((m_data.size() + length) % alignment != 0) {
+        m_data.push_back(0);
+    }
+}
+
+FlatBufferBuilder::offset_type FlatBufferBuilder::refer_to(offset_type offset) {
+    align(sizeof(offset_type));
+    return size() + sizeof(offset_type) - offset;
+}
+
+void FlatBufferBuilder::add_field(std::uint16_t field, std::uint64_t value, std::size_t length) {
+    align(length);
+    push_bytes(value, length);
+    m_fields.emplace_back(field, size());
+}
+
+void FlatBufferBuilder::clear() {
+    m_data.clear();
+    m_minalign = 1;
+    m_fields.clear();
+}
+
+FlatBufferBuilder::offset_type FlatBufferBuilder::create_string(const char* str, std::size_t length) {
+    pre_align(length + 1, sizeof(offset_type));
+    m_data.push_back(0);
+    for (std::size_t i = length; i > 0; --i) {
+        m_data.push_back(static_cast<unsigned char>(str[i - 1]));
+    }
+    push_bytes(length, sizeof(offset_type));
+    return size();
+}
+
+FlatBufferBuilder::offset_type FlatBufferBuilder::create_vector(const unsigned char* data, std::size_t count) {
+    pre_align(count, sizeof(offset_type));
+    for (std::size_t i = count; i > 0; --i) {
+        m_data.push_back(data[i - 1]);
+    }
+    push_bytes(count, sizeof(offset_type));
+    return size();
+}
+
+FlatBufferBuilder::offset_type FlatBufferBuilder::create_vector(const std::vector<std::uint32_t>& data) {
+    pre_align(data.size() * sizeof(std::uint32_t), sizeof(offset_type));
+    for (auto it = data.rbegin(); it != data.rend(); ++it) {
+        push_bytes(*it, sizeof(std::uint32_t));
+    }
+    push_bytes(data.size(), sizeof(offset_type));
+    return size();
+}
+
+FlatBufferBuilder::offset_type FlatBufferBuilder::create_vector(const std::vector<double>& data) {
+    pre_align(data.size() * sizeof(double), sizeof(offset_type));
+    pre_align(data.size() * sizeof(double), sizeof(double));
+    for (auto it = data.rbegin(); it != data.rend(); ++it) {
+        std::uint64_t bits;
+        static_assert(sizeof(bits) == sizeof(double), "double must be 64 bit");
+        std::memcpy(&bits, &*it, sizeof(double));
+        push_bytes(bits, sizeof(double));
+    }
+    push_bytes(data.size(), sizeof(offset_type));
+    return size();
+}
+
+FlatBufferBuilder::offset_type FlatBufferBuilder::create_offset_vector(const std::vector<offset_type>& offsets) {
+    pre_align(offsets.size() * sizeof(offset_type), sizeof(offset_type));
+    for (auto it = offsets.rbegin(); it != offsets.rend(); ++it) {
+        push_bytes(refer_to(*it), sizeof(offset_type));
+    }
+    push_bytes(offsets.size(), sizeof(offset_type));
+    return size();
+}
+
+void FlatBufferBuilder::start_table() {
+    m_fields.clear();
+    m_table_start = size();
+}
+
+void FlatBufferBuilder::add_offset(std::uint16_t field, offset_type offset) {
+    push_bytes(refer_to(offset), sizeof(offset_type));
+    m_fields.emplace_back(field, size());
+}
+
+FlatBufferBuilder::offset_type FlatBufferBuilder::end_table() {
+    // Placeholder for the offset to the vtable.
+    align(sizeof(std::int32_t));
+    push_bytes(0, sizeof(std::int32_t));
+    const offset_type table_end = size();
+
+    std::vector<std::uint16_t> vtable;
+    for (const auto& field : m_fields) {
+        if (field.first >= vtable.size()) {
+            vtable.resize(field.first + 1U, 0);
+        }
+        vtable[field.first] = static_cast<std::uint16_t>(table_end - field.second);
+    }
+
+    for (auto it = vtable.rbegin(); it != vtable.rend(); ++it) {
+        push_bytes(*it, sizeof(std::uint16_t));
+    }
+    push_bytes(table_end - m_table_start, sizeof(std::uint16_t));
+    push_bytes((vtable.size() + 2) * sizeof(std::uint16_t), sizeof(std::uint16_t));
+
+    // The vtable is in front of the table, the (signed) offset from
+    // the table to the vtable is positive.
+    const std::uint32_t vtable_offset = size() - table_end;
+    for (std::size_t i = 0; i < sizeof(std::int32_t); ++i) {
+        m_data[table_end - 1 - i] = static_cast<unsigned char>((vtable_offset >> (i * 8)) & 0xffU);
+    }
+
+    m_fields.clear();
+
+    return table_end;
+}
+
+void FlatBufferBuilder::finish_size_prefixed(offset_type root, std::string& out) {
+    pre_align(2 * sizeof(offset_type), m_minalign);
+    push_bytes(refer_to(root), sizeof(offset_type));
+    push_bytes(size(), sizeof(offset_type));
+
+    out.append(m_data.rbegin(), m_data.rend());
+
+    clear();
+}
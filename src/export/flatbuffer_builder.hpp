@@ -0,0 +1,118 @@
+#ifndef EXPORT_FLATBUFFER_BUILDER_HPP
+#define EXPORT_FLATBUFFER_BUILDER_HPP
+
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * Minimal builder for FlatBuffers (https://google.github.io/flatbuffers/)
+ * with just the functionality needed to write FlatGeobuf files.
+ *
+ * Like the builder in the flatbuffers library, the buffer is built from
+ * the back to the front, so child objects (strings, vectors and tables)
+ * have to be created before the table referring to them. Offsets returned
+ * are positions counted from the end of the buffer.
+ */
+class FlatBufferBuilder {
+
+public:
+
+    using offset_type = std::uint32_t;
+
+private:
+
+    // The bytes of the buffer in reverse order.
+    std::vector<unsigned char> m_data;
+
+    std::size_t m_minalign = 1;
+
+    std::size_t m_table_start = 0;
+
+    // Field ids and positions of the fields of the current table.
+    std::vector<std::pair<std::uint16_t, offset_type>> m_fields;
+
+    void push_bytes(std::uint64_t value, std::size_t length);
+
+    void pre_align(std::size_t length, std::size_t alignment);
+
+    void align(std::size_t alignment) {
+        pre_align(0, alignment);
+    }
+
+    offset_type refer_to(offset_type offset);
+
+    void add_field(std::uint16_t field, std::uint64_t value, std::size_t length);
+
+public:
+
+    offset_type size() const noexcept {
+        return static_cast<offset_type>(m_data.size());
+    }
+
+    void clear();
+
+    offset_type create_string(const char* str, std::size_t length);
+
+    offset_type create_string(const std::string& str) {
+        return create_string(str.data(), str.size());
+    }
+
+    offset_type create_vector(const unsigned char* data, std::size_t count);
+    offset_type create_vector(const std::vector<std::uint32_t>& data);
+    offset_type create_vector(const std::vector<double>& data);
+
+    /// Create vector of offsets to tables.
+    offset_type create_offset_vector(const std::vector<offset_type>& offsets);
+
+    void start_table();
+
+    void add_ubyte(std::uint16_t field, std::uint8_t value) {
+        add_field(field, value, sizeof(value));
+    }
+
+    void add_ushort(std::uint16_t field, std::uint16_t value) {
+        add_field(field, value, sizeof(value));
+    }
+
+    void add_int(std::uint16_t field, std::int32_t value) {
+        add_field(field, static_cast<std::uint32_t>(value), sizeof(value));
+    }
+
+    void add_offset(std::uint16_t field, offset_type offset);
+
+    offset_type end_table();
+
+    /**
+     * Finish the buffer with the given root table and append it, prefixed
+     * with its size, to the output. The builder is cleared afterwards.
+     */
+    void finish_size_prefixed(offset_type root, std::string& out);
+
+}; // class FlatBufferBuilder
+
+#endif // EXPORT_FLATBUFFER_BUILDER_HPP
@@ -0,0 +1,230 @@
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "format_util.hpp"
+
+#include <osmium/geom/factory.hpp>
+#include <osmium/osm.hpp>
+
+// Same as osmium::detail::coordinate_precision.
+static constexpr const std::int32_t coordinate_precision = 10000000;
+
+void append_int(std::string& out, std::int64_t value) {
+    char buffer[20];
+    char* ptr = buffer + sizeof(buffer);
+
+    auto v = value < 0 ? -static_cast<std::uint64_t>(value) : static_cast<std::uint64_t>(value);
+    do {
+        *--ptr = static_cast<char>('0' + v % 10);
+        v /= 10;
+    } while (v != 0);
+
+    if (value < 0) {
+        *--ptr = '-';
+    }
+
+    out.append(ptr, static_cast<std::size_t>(buffer + sizeof(buffer) - ptr));
+}
+
+void append_coordinate(std::string& out, std::int32_t value, bool json) {
+    std::int64_t v = value;
+    if (v < 0) {
+        out += '-';
+        v = -v;
+    }
+
+    append_int(out, v / coordinate_precision);
+
+    auto fraction = v % coordinate_precision;
+    if (fraction == 0) {
+        if (json) {
+            out.append(".0");
+        }
+        return;
+    }
+
+    char digits[7];
+    for (std::size_t i = sizeof(digits); i > 0; --i) {
+        digits[i - 1] = static_cast<char>('0' + fraction % 10);
+        fraction /= 10;
+    }
+
+    std::size_t length = sizeof(digits);
+    while (digits[length - 1] == '0') {
+        --length;
+    }
+
+    out += '.';
+    out.append(digits, length);
+}
+
+namespace {
+
+    enum class syntax {
+        wkt,
+        geojson
+    };
+
+    void append_location(std::string& out, const osmium::Location& location, syntax s) {
+        if (!location.valid()) {
+            throw osmium::invalid_location{"invalid location"};
+        }
+
+        const bool json = s == syntax::geojson;
+        if (json) {
+            out += '[';
+        }
+        append_coordinate(out, location.x(), json);
+        out += json ? ',' : ' ';
+        append_coordinate(out, location.y(), json);
+        if (json) {
+            out += ']';
+        }
+    }
+
+    // Append locations leaving out consecutive duplicates like the
+    // osmium geometry factories do. Returns number of locations added.
+    std::size_t append_locations(std::string& out, const osmium::NodeRefList& nodes, syntax s) {
+        const char open = s == syntax::wkt ? '(' : '[';
+        const char close = s == syntax::wkt ? ')' : ']';
+
+        out += open;
+        std::size_t count = 0;
+        osmium::Location last_location;
+        for (const auto& node_ref : nodes) {
+            if (last_location != node_ref.location()) {
+                last_location = node_ref.location();
+                if (count > 0) {
+                    out += ',';
+                }
+                append_location(out, last_location, s);
+                ++count;
+            }
+        }
+        out += close;
+
+        return count;
+    }
+
+    void append_linestring(std::string& out, const osmium::Way& way, syntax s) {
+        if (append_locations(out, way.nodes(), s) < 2) {
+            throw osmium::geometry_error{"need at least two points for linestring", "way", way.id()};
+        }
+    }
+
+    void append_multipolygon(std::string& out, const osmium::Area& area, syntax s) {
+        const char open = s == syntax::wkt ? '(' : '[';
+        const char close = s == syntax::wkt ? ')' : ']';
+
+        out += open;
+        std::size_t num_polygons = 0;
+        for (const auto& outer : area.outer_rings()) {
+            if (num_polygons > 0) {
+                out += ',';
+            }
+            out += open;
+            append_locations(out, outer, s);
+            for (const auto& inner : area.inner_rings(outer)) {
+                out += ',';
+                append_locations(out, inner, s);
+            }
+            out += close;
+            ++num_polygons;
+        }
+        out += close;
+
+        if (num_polygons == 0) {
+            throw osmium::geometry_error{"invalid area", "area", area.id()};
+        }
+    }
+
+} // anonymous namespace
+
+void append_wkt_point(std::string& out, const osmium::Node& node) {
+    out.append("POINT(");
+    append_location(out, node.location(), syntax::wkt);
+    out += ')';
+}
+
+void append_wkt_linestring(std::string& out, const osmium::Way& way) {
+    out.append("LINESTRING");
+    append_linestring(out, way, syntax::wkt);
+}
+
+void append_wkt_multipolygon(std::string& out, const osmium::Area& area) {
+    out.append("MULTIPOLYGON");
+    append_multipolygon(out, area, syntax::wkt);
+}
+
+void append_geojson_point(std::string& out, const osmium::Node& node) {
+    out.append("{\"type\":\"Point\",\"coordinates\":");
+    append_location(out, node.location(), syntax::geojson);
+    out += '}';
+}
+
+void append_geojson_linestring(std::string& out, const osmium::Way& way) {
+    out.append("{\"type\":\"LineString\",\"coordinates\":");
+    append_linestring(out, way, syntax::geojson);
+    out += '}';
+}
+
+void append_geojson_multipolygon(std::string& out, const osmium::Area& area) {
+    out.append("{\"type\":\"MultiPolygon\",\"coordinates\":");
+    append_multipolygon(out, area, syntax::geojson);
+    out += '}';
+}
+
+namespace {
+
+    // For each character the character to write after a backslash or 0
+    // if the character doesn't need escaping.
+    struct pg_escape_table {
+
+        char table[256];
+
+        pg_escape_table() noexcept : table() {
+            table[static_cast<unsigned char>('\\')] = '\\';
+            table[static_cast<unsigned char>('\n')] = 'n';
+            table[static_cast<unsigned char>('\r')] = 'r';
+            table[static_cast<unsigned char>('\t')] = 't';
+        }
+
+    }; // struct pg_escape_table
+
+    const pg_escape_table escape_table;
+
+} // anonymous namespace
+
+void append_pg_escaped(std::string& out, const char* str, std::size_t size) {
+    const char* run = str;
+    while (size-- > 0 && *str != '\0') {
+        const char escaped = escape_table.table[static_cast<unsigned char>(*str)];
+        if (escaped != 0) {
+            out.append(run, static_cast<std::size_t>(str - run));
+            out += '\\';
+            out += escaped;
+            run = str + 1;
+        }
+        ++str;
+    }
+    out.append(run, static_cast<std::size_t>(str - run));
+}
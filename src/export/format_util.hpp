@@ -0,0 +1,78 @@
+#ifndef EXPORT_FORMAT_UTIL_HPP
+#define EXPORT_FORMAT_UTIL_HPP
+
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <osmium/fwd.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+/**
+ * Append integer value in decimal to out.
+ */
+void append_int(std::string& out, std::int64_t value);
+
+/**
+ * Append a coordinate in the fixed-point format used by osmium::Location
+ * to out. This doesn't need any floating point arithmetic and gives the
+ * shortest decimal representation of the coordinate. If json is set,
+ * integral values are written with ".0" like rapidjson does with doubles.
+ */
+void append_coordinate(std::string& out, std::int32_t value, bool json = false);
+
+/**
+ * Append geometry as WKT (the same as osmium::geom::WKTFactory with the
+ * default precision creates).
+ *
+ * @throws osmium::invalid_location if a location is invalid
+ * @throws osmium::geometry_error if the geometry can not be created
+ */
+void append_wkt_point(std::string& out, const osmium::Node& node);
+void append_wkt_linestring(std::string& out, const osmium::Way& way);
+void append_wkt_multipolygon(std::string& out, const osmium::Area& area);
+
+/**
+ * Append geometry as GeoJSON geometry object (the same as
+ * osmium::geom::RapidGeoJSONFactory creates).
+ *
+ * @throws osmium::invalid_location if a location is invalid
+ * @throws osmium::geometry_error if the geometry can not be created
+ */
+void append_geojson_point(std::string& out, const osmium::Node& node);
+void append_geojson_linestring(std::string& out, const osmium::Way& way);
+void append_geojson_multipolygon(std::string& out, const osmium::Area& area);
+
+/**
+ * Append string to out escaping it for PostgreSQL COPY text format.
+ * Stops at the first null byte or after size bytes.
+ */
+void append_pg_escaped(std::string& out, const char* str, std::size_t size);
+
+inline void append_pg_escaped(std::string& out, const char* str) {
+    append_pg_escaped(out, str, std::strlen(str));
+}
+
+#endif // EXPORT_FORMAT_UTIL_HPP
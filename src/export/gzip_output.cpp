@@ -0,0 +1,90 @@
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "gzip_output.hpp"
+
+#include <osmium/io/detail/read_write.hpp>
+#include <osmium/io/error.hpp>
+#include <osmium/thread/pool.hpp>
+
+#include <zlib.h>
+
+#include <cstring>
+#include <string>
+
+static std::string gzip_compress(const std::string& input) {
+    z_stream stream;
+    std::memset(&stream, 0, sizeof(stream));
+
+    // Window bits 15 plus 16 for a gzip header and trailer.
+    if (::deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        throw osmium::io_error{"Failed to initialize gzip compression"};
+    }
+
+    std::string output(::deflateBound(&stream, static_cast<uLong>(input.size())), '\0');
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+    stream.avail_in = static_cast<uInt>(input.size());
+    stream.next_out = reinterpret_cast<Bytef*>(&output[0]);
+    stream.avail_out = static_cast<uInt>(output.size());
+
+    const auto result = ::deflate(&stream, Z_FINISH);
+    output.resize(stream.total_out);
+    ::deflateEnd(&stream);
+
+    if (result != Z_STREAM_END) {
+        throw osmium::io_error{"Failed to gzip compress output"};
+    }
+
+    return output;
+}
+
+ParallelGzipOutput::ParallelGzipOutput(int fd) :
+    m_fd(fd),
+    m_max_pending(static_cast<std::size_t>(osmium::thread::Pool::default_instance().num_threads()) * 2) {
+}
+
+void ParallelGzipOutput::write_front() {
+    const std::string data{m_pending.front().get()};
+    m_pending.pop_front();
+    osmium::io::detail::reliable_write(m_fd, data.data(), data.size());
+}
+
+void ParallelGzipOutput::write(const char* data, std::size_t size) {
+    if (size == 0) {
+        return;
+    }
+
+    std::string input{data, size};
+    m_pending.push_back(osmium::thread::Pool::default_instance().submit([input]() {
+        return gzip_compress(input);
+    }));
+
+    while (m_pending.size() > m_max_pending) {
+        write_front();
+    }
+}
+
+void ParallelGzipOutput::flush() {
+    while (!m_pending.empty()) {
+        write_front();
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef EXPORT_GZIP_OUTPUT_HPP
+#define EXPORT_GZIP_OUTPUT_HPP
+
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <cstddef>
+#include <deque>
+#include <future>
+#include <string>
+
+/**
+ * Writes data to a file descriptor as a series of gzip members. Each
+ * chunk given to write() is compressed into its own member on the
+ * default thread pool, the members are written out in order. Gzip
+ * readers decompress a file made of several members as one stream.
+ */
+class ParallelGzipOutput {
+
+    int m_fd;
+    std::deque<std::future<std::string>> m_pending;
+    std::size_t m_max_pending;
+
+    void write_front();
+
+public:
+
+    explicit ParallelGzipOutput(int fd);
+
+    void write(const char* data, std::size_t size);
+
+    // Wait for all pending chunks and write them out.
+    void flush();
+
+}; // class ParallelGzipOutput
+
+#endif // EXPORT_GZIP_OUTPUT_HPP
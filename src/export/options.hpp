@@ -48,6 +48,9 @@ struct options_type {
 
     bool keep_untagged = false;
     bool print_record_separator = true;
+
+    // Write gzip compressed output (only for the text based formats).
+    bool gzip = false;
 };
 
 struct geometry_types {
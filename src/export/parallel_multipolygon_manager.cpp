@@ -0,0 +1,182 @@
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "parallel_multipolygon_manager.hpp"
+#include "../trace.hpp"
+
+#include <osmium/osm/item_type.hpp>
+#include <osmium/osm/location.hpp>
+#include <osmium/tags/taglist.hpp>
+
+#include <cassert>
+#include <cstring>
+#include <memory>
+#include <utility>
+
+namespace {
+
+    osmium::memory::Buffer assemble_batch(const osmium::area::Assembler::config_type& config,
+                                          const osmium::memory::Buffer& buffer,
+                                          const std::vector<std::size_t>& member_counts) {
+        const TraceSpan span{"assemble areas (thread)"};
+        osmium::memory::Buffer output{buffer.committed() + 1024, osmium::memory::Buffer::auto_grow::yes};
+
+        auto count_it = member_counts.cbegin();
+        auto it = buffer.cbegin<osmium::OSMObject>();
+        const auto end = buffer.cend<osmium::OSMObject>();
+        while (it != end) {
+            if (it->type() == osmium::item_type::way) {
+                const auto& way = static_cast<const osmium::Way&>(*it);
+                ++it;
+                try {
+                    osmium::area::Assembler assembler{config};
+                    assembler(way, output);
+                } catch (const osmium::invalid_location&) {
+                    // ignore like osmium::area::MultipolygonManager does
+                }
+                continue;
+            }
+
+            const auto& relation = static_cast<const osmium::Relation&>(*it);
+            ++it;
+            std::vector<const osmium::Way*> ways;
+            for (std::size_t n = *count_it++; n > 0; --n, ++it) {
+                ways.push_back(&static_cast<const osmium::Way&>(*it));
+            }
+            try {
+                osmium::area::Assembler assembler{config};
+                assembler(relation, ways, output);
+            } catch (const osmium::invalid_location&) {
+                // ignore like osmium::area::MultipolygonManager does
+            }
+        }
+
+        return output;
+    }
+
+} // anonymous namespace
+
+ParallelMultipolygonManager::ParallelMultipolygonManager(const osmium::area::Assembler::config_type& assembler_config, osmium::thread::Pool& pool) :
+    m_assembler_config(assembler_config),
+    m_pool(pool),
+    m_max_pending(static_cast<std::size_t>(pool.num_threads()) * 4) {
+}
+
+bool ParallelMultipolygonManager::new_relation(const osmium::Relation& relation) const {
+    const char* type = relation.tags().get_value_by_key("type");
+
+    // ignore relations without "type" tag
+    if (!type) {
+        return false;
+    }
+
+    if ((!std::strcmp(type, "multipolygon")) || (!std::strcmp(type, "boundary"))) {
+        return osmium::tags::match_any_of(relation.tags(), m_filter);
+    }
+
+    return false;
+}
+
+void ParallelMultipolygonManager::complete_relation(const osmium::Relation& relation) {
+    m_batch.buffer.add_item(relation);
+    m_batch.buffer.commit();
+
+    std::size_t count = 0;
+    for (const auto& member : relation.members()) {
+        if (member.ref() != 0) {
+            const osmium::Way* way = this->get_member_way(member.ref());
+            assert(way != nullptr);
+            m_batch.buffer.add_item(*way);
+            m_batch.buffer.commit();
+            ++count;
+        }
+    }
+    m_batch.member_counts.push_back(count);
+
+    if (m_batch.buffer.committed() >= batch_size) {
+        submit_batch();
+    }
+}
+
+void ParallelMultipolygonManager::after_way(const osmium::Way& way) {
+    // you need at least 4 nodes to make up a polygon
+    if (way.nodes().size() <= 3) {
+        return;
+    }
+
+    if (!way.nodes().front().location() || !way.nodes().back().location()) {
+        return;
+    }
+
+    if (!way.ends_have_same_location() ||
+        way.tags().has_tag("area", "no") ||
+        osmium::tags::match_none_of(way.tags(), m_filter)) {
+        return;
+    }
+
+    m_batch.buffer.add_item(way);
+    m_batch.buffer.commit();
+
+    if (m_batch.buffer.committed() >= batch_size) {
+        submit_batch();
+    }
+}
+
+void ParallelMultipolygonManager::submit_batch() {
+    if (m_batch.buffer.committed() == 0) {
+        return;
+    }
+
+    auto batch_ptr = std::make_shared<batch>(std::move(m_batch));
+    m_batch = batch{};
+
+    const auto config = m_assembler_config;
+    m_pending.push_back(m_pool.submit([batch_ptr, config]() {
+        return assemble_batch(config, batch_ptr->buffer, batch_ptr->member_counts);
+    }));
+
+    // Results are only taken when there are too many of them, never
+    // when they happen to be ready. That way the output is always the
+    // same.
+    while (m_pending.size() > m_max_pending) {
+        write_result();
+    }
+}
+
+void ParallelMultipolygonManager::write_result() {
+    osmium::memory::Buffer areas{m_pending.front().get()};
+    m_pending.pop_front();
+
+    if (areas.committed() > 0) {
+        this->buffer().add_buffer(areas);
+        this->buffer().commit();
+        this->possibly_flush();
+    }
+}
+
+void ParallelMultipolygonManager::finish() {
+    submit_batch();
+    while (!m_pending.empty()) {
+        write_result();
+    }
+    this->flush_output();
+}
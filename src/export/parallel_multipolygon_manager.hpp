@@ -0,0 +1,86 @@
+#ifndef EXPORT_PARALLEL_MULTIPOLYGON_MANAGER_HPP
+#define EXPORT_PARALLEL_MULTIPOLYGON_MANAGER_HPP
+
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <osmium/area/assembler.hpp>
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm/relation.hpp>
+#include <osmium/osm/way.hpp>
+#include <osmium/relations/relations_manager.hpp>
+#include <osmium/tags/tags_filter.hpp>
+#include <osmium/thread/pool.hpp>
+
+#include <cstddef>
+#include <deque>
+#include <future>
+#include <vector>
+
+/**
+ * Works like the osmium::area::MultipolygonManager, but the areas are
+ * assembled on a thread pool. Closed ways and complete relations (with
+ * copies of their member ways) are collected into batches which are
+ * assembled by tasks on the pool. The resulting areas are added to the
+ * output in the order the batches were created, so the output doesn't
+ * depend on the timing of the threads.
+ */
+class ParallelMultipolygonManager : public osmium::relations::RelationsManager<ParallelMultipolygonManager, false, true, false> {
+
+    // Batches are submitted to the pool when they are this large.
+    static constexpr const std::size_t batch_size = 1024UL * 1024UL;
+
+    // Closed ways and relations to assemble. Each relation is followed
+    // by its member ways, their number is in member_counts.
+    struct batch {
+        osmium::memory::Buffer buffer{batch_size, osmium::memory::Buffer::auto_grow::yes};
+        std::vector<std::size_t> member_counts;
+    };
+
+    osmium::area::Assembler::config_type m_assembler_config;
+    osmium::TagsFilter m_filter{true};
+    osmium::thread::Pool& m_pool;
+    std::size_t m_max_pending;
+    batch m_batch;
+    std::deque<std::future<osmium::memory::Buffer>> m_pending;
+
+    void submit_batch();
+
+    void write_result();
+
+public:
+
+    ParallelMultipolygonManager(const osmium::area::Assembler::config_type& assembler_config, osmium::thread::Pool& pool);
+
+    bool new_relation(const osmium::Relation& relation) const;
+
+    void complete_relation(const osmium::Relation& relation);
+
+    void after_way(const osmium::Way& way);
+
+    // Wait for all outstanding areas and flush them to the callback. Must
+    // be called after the second pass.
+    void finish();
+
+}; // class ParallelMultipolygonManager
+
+#endif // EXPORT_PARALLEL_MULTIPOLYGON_MANAGER_HPP
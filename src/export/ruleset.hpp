@@ -1,9 +1,7 @@
 #ifndef EXPORT_RULESET_HPP
 #define EXPORT_RULESET_HPP
 
-#include "../util.hpp"
-
-#include <osmium/tags/tags_filter.hpp>
+#include "../compiled_tags_filter.hpp"
 
 #include <string>
 #include <vector>
@@ -19,7 +17,7 @@ class Ruleset {
 
     tags_filter_rule_type m_type = tags_filter_rule_type::any;
     std::vector<std::string> m_tags;
-    osmium::TagsFilter m_filter{false};
+    CompiledTagsFilter m_filter{false};
 
 public:
 
@@ -40,7 +38,7 @@ public:
         m_tags.emplace_back(std::forward<T>(rule));
     }
 
-    const osmium::TagsFilter& filter() const noexcept {
+    const CompiledTagsFilter& filter() const noexcept {
         return m_filter;
     }
 
@@ -52,7 +50,9 @@ public:
                 m_filter.set_default_result(true);
                 break;
             case tags_filter_rule_type::list:
-                initialize_tags_filter(m_filter, false, m_tags);
+                for (const auto& tag : m_tags) {
+                    m_filter.add_expression(tag);
+                }
                 break;
             case tags_filter_rule_type::other:
                 break;
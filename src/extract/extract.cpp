@@ -22,23 +22,81 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "extract.hpp"
 
+#include <osmium/io/header.hpp>
 #include <osmium/io/writer_options.hpp>
+#include <osmium/memory/buffer.hpp>
+#include <osmium/thread/pool.hpp>
 
+#include <algorithm>
+#include <cstddef>
 #include <sstream>
+#include <utility>
 #include <string>
 
+void Extract::output::write(osmium::memory::Buffer&& buffer) {
+    if (pooled_writer) {
+        (*pooled_writer)(std::move(buffer));
+    } else {
+        (*writer)(std::move(buffer));
+    }
+}
+
+void Extract::add_output(const osmium::io::File& output_file, const std::vector<std::pair<std::string, std::string>>& header_options) {
+    m_outputs.emplace_back(output_file);
+    m_outputs.back().header_options = header_options;
+}
+
 void Extract::open_file(const osmium::io::Header& header, osmium::io::overwrite output_overwrite, osmium::io::fsync sync) {
-    m_writer.reset(new osmium::io::Writer{m_output_file, header, output_overwrite, sync});
+    for (auto& out : m_outputs) {
+        osmium::io::Header file_header{header};
+        for (const auto& p : out.header_options) {
+            file_header.set(p.first, p.second);
+        }
+        if (PooledWriter::can_write(out.file)) {
+            out.pooled_writer.reset(new PooledWriter{out.file, file_header, output_overwrite, sync, osmium::thread::Pool::default_instance()});
+        } else {
+            out.writer.reset(new osmium::io::Writer{out.file, file_header, output_overwrite, sync});
+        }
+    }
+}
+
+void Extract::flush() {
+    if (m_buffer && m_buffer.committed() > 0) {
+        // All outputs except the last one get a copy of the buffer.
+        for (std::size_t n = 1; n < m_outputs.size(); ++n) {
+            osmium::memory::Buffer copy{m_buffer.committed(), osmium::memory::Buffer::auto_grow::no};
+            copy.add_buffer(m_buffer);
+            copy.commit();
+            m_outputs[n - 1].write(std::move(copy));
+        }
+        m_outputs.back().write(std::move(m_buffer));
+    }
+    m_buffer = osmium::memory::Buffer{};
 }
 
 void Extract::close_file() {
-    if (m_writer) {
-        m_writer->close();
+    if (!m_outputs.front().pooled_writer && !m_outputs.front().writer) {
+        return;
+    }
+    flush();
+    for (auto& out : m_outputs) {
+        if (out.pooled_writer) {
+            out.pooled_writer->close();
+        } else {
+            out.writer->close();
+        }
     }
 }
 
 void Extract::write(const osmium::memory::Item& item) {
-    (*m_writer)(item);
+    if (m_buffer && m_buffer.capacity() - m_buffer.committed() < item.padded_size()) {
+        flush();
+    }
+    if (!m_buffer) {
+        m_buffer = osmium::memory::Buffer{std::max(buffer_size, item.padded_size()), osmium::memory::Buffer::auto_grow::no};
+    }
+    m_buffer.add_item(item);
+    m_buffer.commit();
 }
 
 std::string Extract::envelope_as_text() const {
@@ -23,14 +23,19 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 */
 
+#include "../pooled_writer.hpp"
+
 #include <osmium/io/file.hpp>
 #include <osmium/io/header.hpp>
 #include <osmium/io/writer.hpp>
 #include <osmium/io/writer_options.hpp>
+#include <osmium/memory/buffer.hpp>
 #include <osmium/memory/item.hpp>
 #include <osmium/osm/box.hpp>
 #include <osmium/osm/location.hpp>
 
+#include <cstddef>
+#include <limits>
 #include <memory>
 #include <string>
 #include <utility>
@@ -38,29 +43,59 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 class Extract {
 
-    osmium::io::File m_output_file;
+    // Size of the buffers in which objects are collected before they are
+    // handed to the writer.
+    static constexpr const std::size_t buffer_size = 1024UL * 1024UL;
+
+    struct output {
+        osmium::io::File file;
+        std::vector<std::pair<std::string, std::string>> header_options;
+        // Uncompressed files are written with a PooledWriter, so that the
+        // number of threads doesn't grow with the number of extracts.
+        // Others need the osmium::io::Writer for the compression.
+        std::unique_ptr<PooledWriter> pooled_writer;
+        std::unique_ptr<osmium::io::Writer> writer;
+
+        explicit output(const osmium::io::File& output_file) :
+            file(output_file) {
+        }
+
+        void write(osmium::memory::Buffer&& buffer);
+    };
+
+    // The first output is the one of this extract, the others are from
+    // extracts in the config file with the same geometry which get the
+    // same data.
+    std::vector<output> m_outputs;
     std::string m_description;
-    std::vector<std::pair<std::string, std::string>> m_header_options;
     osmium::Box m_envelope;
-    std::unique_ptr<osmium::io::Writer> m_writer;
+    osmium::memory::Buffer m_buffer;
+    std::size_t m_parent = no_parent;
+
+    void flush();
 
 public:
 
+    static constexpr const std::size_t no_parent = std::numeric_limits<std::size_t>::max();
+
     Extract(const osmium::io::File& output_file, const std::string& description, const osmium::Box& envelope) :
-        m_output_file(output_file),
         m_description(description),
-        m_envelope(envelope),
-        m_writer(nullptr) {
+        m_envelope(envelope) {
+        m_outputs.emplace_back(output_file);
     }
 
     virtual ~Extract() = default;
 
-    const std::string& output() const noexcept {
-        return m_output_file.filename();
+    std::size_t num_outputs() const noexcept {
+        return m_outputs.size();
     }
 
-    const char* output_format() const noexcept {
-        return osmium::io::as_string(m_output_file.format());
+    const std::string& output(std::size_t n = 0) const noexcept {
+        return m_outputs[n].file.filename();
+    }
+
+    const char* output_format(std::size_t n = 0) const noexcept {
+        return osmium::io::as_string(m_outputs[n].file.format());
     }
 
     const std::string& description() const noexcept {
@@ -71,28 +106,57 @@ public:
         return m_envelope;
     }
 
-    void add_header_option(const std::string& name, const std::string& value) {
-        m_header_options.emplace_back(name, value);
+    /**
+     * Index of the parent extract or no_parent. An extract with a parent
+     * must be completely inside the parent. Nodes are only checked
+     * against an extract if they are inside its parent.
+     */
+    std::size_t parent() const noexcept {
+        return m_parent;
     }
 
-    const std::vector<std::pair<std::string, std::string>>& header_options() const noexcept {
-        return m_header_options;
+    void set_parent(std::size_t parent) noexcept {
+        m_parent = parent;
     }
 
-    osmium::io::Writer& writer() {
-        return *m_writer;
+    void add_header_option(const std::string& name, const std::string& value) {
+        m_outputs.front().header_options.emplace_back(name, value);
+    }
+
+    const std::vector<std::pair<std::string, std::string>>& header_options(std::size_t n = 0) const noexcept {
+        return m_outputs[n].header_options;
     }
 
+    /**
+     * Add another output file for this extract. Everything written to
+     * the extract is written to all its output files.
+     */
+    void add_output(const osmium::io::File& output_file, const std::vector<std::pair<std::string, std::string>>& header_options);
+
+    /**
+     * Open all output files. The header options of each output are set
+     * in a copy of the header.
+     */
     void open_file(const osmium::io::Header& header, osmium::io::overwrite output_overwrite, osmium::io::fsync sync);
 
     void close_file();
 
+    // Add the item to the buffer of this extract. Full buffers are moved
+    // to the writer.
     void write(const osmium::memory::Item& item);
 
     std::string envelope_as_text() const;
 
     virtual bool contains(const osmium::Location& location) const noexcept = 0;
 
+    /**
+     * Is the extract exactly its envelope? Then contains() is the same
+     * as checking the envelope and callers can do that themselves.
+     */
+    virtual bool is_box() const noexcept {
+        return false;
+    }
+
     virtual const char* geometry_type() const noexcept = 0;
 
     virtual std::string geometry_as_text() const = 0;
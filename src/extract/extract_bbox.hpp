@@ -35,6 +35,10 @@ public:
 
     bool contains(const osmium::Location& location) const noexcept override final;
 
+    bool is_box() const noexcept override final {
+        return true;
+    }
+
     const char* geometry_type() const noexcept override final;
 
     std::string geometry_as_text() const override final;
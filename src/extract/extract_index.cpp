@@ -0,0 +1,147 @@
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "extract_index.hpp"
+
+#include <osmium/osm/box.hpp>
+#include <osmium/osm/location.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+constexpr const std::size_t ExtractIndex::no_extract;
+
+int ExtractIndex::cell_x(int32_t x) noexcept {
+    const int64_t cell = (int64_t(x) + 180LL * osmium::detail::coordinate_precision) / osmium::detail::coordinate_precision;
+    if (cell < 0) {
+        return 0;
+    }
+    return cell >= num_cells_x ? num_cells_x - 1 : static_cast<int>(cell);
+}
+
+int ExtractIndex::cell_y(int32_t y) noexcept {
+    const int64_t cell = (int64_t(y) + 90LL * osmium::detail::coordinate_precision) / osmium::detail::coordinate_precision;
+    if (cell < 0) {
+        return 0;
+    }
+    return cell >= num_cells_y ? num_cells_y - 1 : static_cast<int>(cell);
+}
+
+ExtractIndex::ExtractIndex(const std::vector<osmium::Box>& envelopes) :
+    m_cells(num_cells_x * num_cells_y) {
+    for (std::size_t i = 0; i < envelopes.size(); ++i) {
+        const auto& box = envelopes[i];
+        if (!box.valid()) {
+            continue;
+        }
+        const int x_min = cell_x(box.bottom_left().x());
+        const int x_max = cell_x(box.top_right().x());
+        const int y_min = cell_y(box.bottom_left().y());
+        const int y_max = cell_y(box.top_right().y());
+        for (int y = y_min; y <= y_max; ++y) {
+            for (int x = x_min; x <= x_max; ++x) {
+                m_cells[y * num_cells_x + x].push_back(i);
+            }
+        }
+    }
+}
+
+const std::vector<std::size_t>& ExtractIndex::candidates(const osmium::Location& location) const noexcept {
+    if (m_cells.empty() || !location.valid()) {
+        return m_empty;
+    }
+    return m_cells[cell_y(location.y()) * num_cells_x + cell_x(location.x())];
+}
+
+ExtractIndex::ExtractIndex(const std::vector<tile_id>& tiles) {
+    if (tiles.empty()) {
+        return;
+    }
+
+    m_zoom = tiles.front().zoom;
+    uint32_t x_max = 0;
+    uint32_t y_max = 0;
+    m_tiles_x = tiles.front().x;
+    m_tiles_y = tiles.front().y;
+    for (const auto& tile : tiles) {
+        m_tiles_x = std::min(m_tiles_x, tile.x);
+        m_tiles_y = std::min(m_tiles_y, tile.y);
+        x_max = std::max(x_max, tile.x);
+        y_max = std::max(y_max, tile.y);
+    }
+    m_tiles_width = x_max - m_tiles_x + 1;
+    m_tiles_height = y_max - m_tiles_y + 1;
+
+    m_tiles.resize(static_cast<std::size_t>(m_tiles_width) * m_tiles_height, no_extract);
+    for (std::size_t i = 0; i < tiles.size(); ++i) {
+        const auto& tile = tiles[i];
+        m_tiles[static_cast<std::size_t>(tile.y - m_tiles_y) * m_tiles_width + (tile.x - m_tiles_x)] = i;
+    }
+}
+
+// A location exactly on the edge between tiles is in both of them, and
+// the edges of the tile envelopes are rounded to the coordinate
+// precision. So the tiles a small distance around the location are
+// candidates, there are at most four of them.
+std::size_t ExtractIndex::tile_candidates(const osmium::Location& location, std::size_t* result) const noexcept {
+    if (!location.valid()) {
+        return 0;
+    }
+
+    constexpr const double epsilon = 1e-5;
+    const double max = static_cast<double>((1UL << m_zoom) - 1);
+    const auto clamp = [max](double value) {
+        return std::min(std::max(std::floor(value), 0.0), max);
+    };
+
+    const double fx = tile_x(location.lon(), m_zoom);
+    const double fy = tile_y(location.lat(), m_zoom);
+    const double xs[2] = {clamp(fx - epsilon), clamp(fx + epsilon)};
+    const double ys[2] = {clamp(fy - epsilon), clamp(fy + epsilon)};
+
+    std::size_t count = 0;
+    for (std::size_t iy = 0; iy < 2; ++iy) {
+        if (iy == 1 && ys[1] == ys[0]) {
+            break;
+        }
+        for (std::size_t ix = 0; ix < 2; ++ix) {
+            if (ix == 1 && xs[1] == xs[0]) {
+                break;
+            }
+            const auto x = static_cast<uint32_t>(xs[ix]);
+            const auto y = static_cast<uint32_t>(ys[iy]);
+            if (x < m_tiles_x || y < m_tiles_y || x - m_tiles_x >= m_tiles_width || y - m_tiles_y >= m_tiles_height) {
+                continue;
+            }
+            const auto i = m_tiles[static_cast<std::size_t>(y - m_tiles_y) * m_tiles_width + (x - m_tiles_x)];
+            if (i != no_extract) {
+                result[count++] = i;
+            }
+        }
+    }
+
+    std::sort(result, result + count);
+    return count;
+}
@@ -0,0 +1,103 @@
+#ifndef EXTRACT_EXTRACT_INDEX_HPP
+#define EXTRACT_EXTRACT_INDEX_HPP
+
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "extract_tile.hpp"
+
+#include <osmium/osm/box.hpp>
+#include <osmium/osm/location.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+/**
+ * Uniform grid of one degree cells over the envelopes of all extracts.
+ * For a location it returns the (ascending) indexes of all extracts
+ * whose envelope overlaps the cell the location is in. Locations in
+ * other extracts can't be inside those extracts.
+ *
+ * If all extracts are tiles of the same zoom level, the tiles a location
+ * can be in are calculated directly from its coordinates instead.
+ */
+class ExtractIndex {
+
+    static constexpr const int num_cells_x = 360;
+    static constexpr const int num_cells_y = 180;
+
+    static constexpr const std::size_t no_extract = std::numeric_limits<std::size_t>::max();
+
+    std::vector<std::vector<std::size_t>> m_cells;
+    std::vector<std::size_t> m_empty;
+
+    // Tile mode: The extract for each tile in the smallest rectangle of
+    // tiles containing all extracts (or no_extract), row by row.
+    std::vector<std::size_t> m_tiles;
+    uint32_t m_zoom = 0;
+    uint32_t m_tiles_x = 0;
+    uint32_t m_tiles_y = 0;
+    uint32_t m_tiles_width = 0;
+    uint32_t m_tiles_height = 0;
+
+    static int cell_x(int32_t x) noexcept;
+    static int cell_y(int32_t y) noexcept;
+
+    // Maximum number of tiles a location can be in (at the corner of
+    // four tiles).
+    static constexpr const std::size_t max_tile_candidates = 4;
+
+    std::size_t tile_candidates(const osmium::Location& location, std::size_t* result) const noexcept;
+
+public:
+
+    ExtractIndex() = default;
+
+    explicit ExtractIndex(const std::vector<osmium::Box>& envelopes);
+
+    // The extract with index i is the tile tiles[i]. All tiles must have
+    // the same zoom level.
+    explicit ExtractIndex(const std::vector<tile_id>& tiles);
+
+    const std::vector<std::size_t>& candidates(const osmium::Location& location) const noexcept;
+
+    // Call func with the index of each extract the location might be in.
+    template <typename TFunc>
+    void for_each_candidate(const osmium::Location& location, TFunc&& func) const {
+        if (m_tiles.empty()) {
+            for (const auto i : candidates(location)) {
+                func(i);
+            }
+            return;
+        }
+        std::size_t result[max_tile_candidates];
+        const auto count = tile_candidates(location, result);
+        for (std::size_t n = 0; n < count; ++n) {
+            func(result[n]);
+        }
+    }
+
+}; // class ExtractIndex
+
+#endif // EXTRACT_EXTRACT_INDEX_HPP
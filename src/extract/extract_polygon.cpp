@@ -28,8 +28,10 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <osmium/osm/segment.hpp>
 
 #include <algorithm>
+#include <cmath>
 #include <cstddef>
 #include <cstdint>
+#include <iterator>
 #include <string>
 #include <utility>
 #include <vector>
@@ -49,6 +51,10 @@ static void add_ring(std::vector<osmium::Segment>& segments, const osmium::NodeR
     }
 }
 
+static int32_t max_x(const osmium::Segment& segment) noexcept {
+    return std::max(segment.first().x(), segment.second().x());
+}
+
 const osmium::Area& ExtractPolygon::area() const noexcept {
     return m_buffer.get<osmium::Area>(m_offset);
 }
@@ -68,28 +74,148 @@ ExtractPolygon::ExtractPolygon(const osmium::io::File& output_file, const std::s
         }
     }
 
-    // split y range into equal-sized bands
-    constexpr const int32_t segments_per_band = 10;
-    constexpr const int32_t max_bands = 10000;
-    int32_t num_bands = static_cast<int32_t>(segments.size()) / segments_per_band;
-    if (num_bands < 1) {
-        num_bands = 1;
-    } else if (num_bands > max_bands) {
-        num_bands = max_bands;
+    // Split the y range into bands with about the same number of
+    // segments starting in each band. Dense parts of the boundary (like
+    // a detailed coastline) get many narrow bands, so that no band has
+    // lots of segments.
+    constexpr const std::size_t segments_per_band = 10;
+    constexpr const std::size_t max_bands = 10000;
+
+    std::vector<int32_t> min_ys;
+    min_ys.reserve(segments.size());
+    for (const auto& segment : segments) {
+        min_ys.push_back(std::min(segment.first().y(), segment.second().y()));
     }
+    std::sort(min_ys.begin(), min_ys.end());
 
-    m_bands.resize(num_bands);
+    const std::size_t step = std::max(segments_per_band, min_ys.size() / max_bands + 1);
+    m_band_y.push_back(y_min());
+    for (std::size_t i = step; i < min_ys.size(); i += step) {
+        if (min_ys[i] > m_band_y.back()) {
+            m_band_y.push_back(min_ys[i]);
+        }
+    }
 
-    m_dy = (y_max() - y_min()) / num_bands;
+    std::vector<std::vector<osmium::Segment>> bands(m_band_y.size());
 
     // put segments into the bands they overlap
     for (const auto& segment : segments) {
         const std::pair<int32_t, int32_t> mm = std::minmax(segment.first().y(), segment.second().y());
-        const uint32_t band_min = (mm.first  - y_min()) / m_dy;
-        const uint32_t band_max = std::min(num_bands, ((mm.second - y_min()) / m_dy) + 1);
+        const std::size_t band_min = band(mm.first);
+        const std::size_t band_max = band(mm.second);
+
+        for (auto b = band_min; b <= band_max; ++b) {
+            bands[b].push_back(segment);
+        }
+    }
+
+    // Sort the segments in each band by their largest x coordinate. A
+    // location can only be inside if there are segments to the right
+    // of it, segments completely to its left can be skipped. Then store
+    // the coordinates in the flat arrays.
+    m_band_offsets.reserve(bands.size() + 1);
+    m_band_offsets.push_back(0);
+    for (auto& segments_in_band : bands) {
+        std::sort(segments_in_band.begin(), segments_in_band.end(), [](const osmium::Segment& lhs, const osmium::Segment& rhs) {
+            return max_x(lhs) < max_x(rhs);
+        });
+        for (const auto& segment : segments_in_band) {
+            m_x1.push_back(segment.first().x());
+            m_y1.push_back(segment.first().y());
+            m_x2.push_back(segment.second().x());
+            m_y2.push_back(segment.second().y());
+            m_max_x.push_back(max_x(segment));
+        }
+        m_band_offsets.push_back(m_x1.size());
+        segments_in_band.clear();
+        segments_in_band.shrink_to_fit();
+    }
+
+    build_grid(segments);
+}
+
+std::size_t ExtractPolygon::band(int32_t y) const noexcept {
+    const auto it = std::upper_bound(m_band_y.begin(), m_band_y.end(), y);
+    if (it == m_band_y.begin()) {
+        return 0;
+    }
+    return static_cast<std::size_t>(std::distance(m_band_y.begin(), it)) - 1;
+}
 
-        for (auto band = band_min; band < band_max; ++band) {
-            m_bands[band].push_back(segment);
+int64_t ExtractPolygon::cell_x(int64_t x) const noexcept {
+    const int64_t cell = (x - x_min()) / m_cell_dx;
+    return std::max(int64_t(0), std::min(m_grid_size - 1, cell));
+}
+
+int64_t ExtractPolygon::cell_y(int64_t y) const noexcept {
+    const int64_t cell = (y - y_min()) / m_cell_dy;
+    return std::max(int64_t(0), std::min(m_grid_size - 1, cell));
+}
+
+// Mark all cells the segment goes through as boundary cells. This is
+// conservative: In each row of cells the range of cells covered by the
+// segment is extended by one cell on each side, so that rounding errors
+// can never leave a cell touched by the segment unmarked.
+void ExtractPolygon::mark_boundary_cells(const osmium::Segment& segment) {
+    const double x1 = segment.first().x();
+    const double y1 = segment.first().y();
+    const double x2 = segment.second().x();
+    const double y2 = segment.second().y();
+
+    const int64_t row_min = cell_y(std::min(segment.first().y(), segment.second().y()));
+    const int64_t row_max = cell_y(std::max(segment.first().y(), segment.second().y()));
+
+    for (int64_t row = row_min; row <= row_max; ++row) {
+        double xa = std::min(x1, x2);
+        double xb = std::max(x1, x2);
+        if (y1 != y2) {
+            const double row_y_min = std::max(std::min(y1, y2), double(y_min() + row * m_cell_dy));
+            const double row_y_max = std::min(std::max(y1, y2), double(y_min() + (row + 1) * m_cell_dy));
+            const double xr1 = x1 + (x2 - x1) * (row_y_min - y1) / (y2 - y1);
+            const double xr2 = x1 + (x2 - x1) * (row_y_max - y1) / (y2 - y1);
+            xa = std::min(xr1, xr2);
+            xb = std::max(xr1, xr2);
+        }
+        const int64_t col_min = cell_x(static_cast<int64_t>(std::floor(xa)) - m_cell_dx);
+        const int64_t col_max = cell_x(static_cast<int64_t>(std::ceil(xb)) + m_cell_dx);
+        for (int64_t col = col_min; col <= col_max; ++col) {
+            m_grid[row * m_grid_size + col] = cell_state::boundary;
+        }
+    }
+}
+
+void ExtractPolygon::build_grid(const std::vector<osmium::Segment>& segments) {
+    constexpr const int64_t max_grid_size = 1024;
+
+    m_grid_size = std::max(int64_t(1), std::min(max_grid_size, static_cast<int64_t>(std::sqrt(static_cast<double>(segments.size())))));
+    m_cell_dx = (int64_t(envelope().top_right().x()) - x_min()) / m_grid_size + 1;
+    m_cell_dy = (int64_t(y_max()) - y_min()) / m_grid_size + 1;
+    m_grid.assign(static_cast<std::size_t>(m_grid_size * m_grid_size), cell_state::outside);
+
+    for (const auto& segment : segments) {
+        mark_boundary_cells(segment);
+    }
+
+    // No segment goes through a non-boundary cell or its neighbours, so
+    // all cells in a run of non-boundary cells in one row are either
+    // inside or outside the polygon. Check the center of the first cell
+    // in each run.
+    for (int64_t row = 0; row < m_grid_size; ++row) {
+        bool in_run = false;
+        cell_state state = cell_state::outside;
+        for (int64_t col = 0; col < m_grid_size; ++col) {
+            auto& cell = m_grid[row * m_grid_size + col];
+            if (cell == cell_state::boundary) {
+                in_run = false;
+                continue;
+            }
+            if (!in_run) {
+                const osmium::Location center{static_cast<int32_t>(x_min() + col * m_cell_dx + m_cell_dx / 2),
+                                              static_cast<int32_t>(y_min() + row * m_cell_dy + m_cell_dy / 2)};
+                state = segments_contain(center) ? cell_state::inside : cell_state::outside;
+                in_run = true;
+            }
+            cell = state;
         }
     }
 }
@@ -111,9 +237,15 @@ ExtractPolygon::ExtractPolygon(const osmium::io::File& output_file, const std::s
         return c;
     }
 
-  In our implementation we split the y-range into equal-sized subranges and
-  only have to test all segments in the subrange that contains the y coordinate
-  of the node.
+  In our implementation we split the y-range into subranges with about the
+  same number of segments each and only have to test the segments in the
+  subrange that contains the y coordinate of the node. Segments completely
+  to the left of the node can't cross the ray going to the right, so they
+  are skipped.
+
+  Before that a grid over the envelope is checked. Most locations are in
+  cells completely inside or outside the polygon and don't need the segment
+  test at all.
 
 */
 
@@ -122,33 +254,52 @@ bool ExtractPolygon::contains(const osmium::Location& location) const noexcept {
         return false;
     }
 
-    std::size_t band = (location.y() - y_min()) / m_dy;
-    if (band >= m_bands.size()) {
-        band = m_bands.size() - 1;
-    }
-
-    bool inside = false;
-
-    for (const auto& segment : m_bands[band]) {
-        if (segment.first() == location || segment.second() == location) {
+    switch (m_grid[cell_y(location.y()) * m_grid_size + cell_x(location.x())]) {
+        case cell_state::inside:
             return true;
-        }
-        if ((segment.second().y() > location.y()) != (segment.first().y() > location.y())) {
-            const int64_t ax = int64_t(segment.first().x()) - int64_t(segment.second().x());
-            const int64_t ay = int64_t(segment.first().y()) - int64_t(segment.second().y());
-            const int64_t tx = int64_t(location.x())        - int64_t(segment.second().x());
-            const int64_t ty = int64_t(location.y())        - int64_t(segment.second().y());
-
-            const bool comp = tx * ay < ax * ty;
+        case cell_state::outside:
+            return false;
+        default:
+            break;
+    }
 
-            if ((ay > 0) == comp) {
-                inside = !inside;
-            }
-        }
+    return segments_contain(location);
+}
 
+// The loop has no branches and works on the separate coordinate arrays,
+// so the compiler can vectorize it.
+bool ExtractPolygon::segments_contain(const osmium::Location& location) const noexcept {
+    const auto b = band(location.y());
+    const auto band_begin = m_max_x.begin() + static_cast<std::ptrdiff_t>(m_band_offsets[b]);
+    const auto band_end   = m_max_x.begin() + static_cast<std::ptrdiff_t>(m_band_offsets[b + 1]);
+
+    // Segments are sorted by largest x coordinate.
+    const auto first = static_cast<std::size_t>(std::distance(m_max_x.begin(), std::lower_bound(band_begin, band_end, location.x())));
+    const auto last = m_band_offsets[b + 1];
+
+    const int32_t* const x1 = m_x1.data();
+    const int32_t* const y1 = m_y1.data();
+    const int32_t* const x2 = m_x2.data();
+    const int32_t* const y2 = m_y2.data();
+    const int64_t lx = location.x();
+    const int64_t ly = location.y();
+
+    int on_vertex = 0;
+    int crossings = 0;
+    for (std::size_t i = first; i < last; ++i) {
+        on_vertex |= static_cast<int>((x1[i] == lx) & (y1[i] == ly)) | static_cast<int>((x2[i] == lx) & (y2[i] == ly));
+
+        const int64_t ax = int64_t(x1[i]) - int64_t(x2[i]);
+        const int64_t ay = int64_t(y1[i]) - int64_t(y2[i]);
+        const int64_t tx = lx - int64_t(x2[i]);
+        const int64_t ty = ly - int64_t(y2[i]);
+
+        const bool straddles = (y2[i] > ly) != (y1[i] > ly);
+        const bool comp = tx * ay < ax * ty;
+        crossings += static_cast<int>(straddles & ((ay > 0) == comp));
     }
 
-    return inside;
+    return on_vertex != 0 || (crossings & 1) != 0;
 }
 
 const char* ExtractPolygon::geometry_type() const noexcept {
@@ -28,18 +28,48 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <osmium/osm/area.hpp>
 #include <osmium/osm/segment.hpp>
 
+#include <cstddef>
+#include <cstdint>
 #include <vector>
 
 class ExtractPolygon : public Extract {
 
+    enum class cell_state : uint8_t {
+        outside  = 0,
+        inside   = 1,
+        boundary = 2
+    };
+
     const osmium::memory::Buffer& m_buffer;
     std::size_t m_offset;
 
-    std::vector<std::vector<osmium::Segment>> m_bands;
-    int32_t m_dy = 0;
+    // Lower y boundary of each band.
+    std::vector<int32_t> m_band_y;
+
+    // The segments overlapping each band, stored as separate arrays of
+    // coordinates, so the crossing test can work on many segments at
+    // once. The segments of band n are at m_band_offsets[n] up to
+    // m_band_offsets[n + 1], sorted by their largest x coordinate.
+    std::vector<std::size_t> m_band_offsets;
+    std::vector<int32_t> m_x1;
+    std::vector<int32_t> m_y1;
+    std::vector<int32_t> m_x2;
+    std::vector<int32_t> m_y2;
+    std::vector<int32_t> m_max_x;
+
+    // Grid over the envelope with the state of each cell. Only locations
+    // in boundary cells have to be checked against the segments.
+    std::vector<cell_state> m_grid;
+    int64_t m_grid_size = 0;
+    int64_t m_cell_dx = 1;
+    int64_t m_cell_dy = 1;
 
     const osmium::Area& area() const noexcept;
 
+    int32_t x_min() const noexcept {
+        return envelope().bottom_left().x();
+    }
+
     int32_t y_max() const noexcept {
         return envelope().top_right().y();
     }
@@ -48,6 +78,17 @@ class ExtractPolygon : public Extract {
         return envelope().bottom_left().y();
     }
 
+    std::size_t band(int32_t y) const noexcept;
+
+    int64_t cell_x(int64_t x) const noexcept;
+    int64_t cell_y(int64_t y) const noexcept;
+
+    void mark_boundary_cells(const osmium::Segment& segment);
+
+    void build_grid(const std::vector<osmium::Segment>& segments);
+
+    bool segments_contain(const osmium::Location& location) const noexcept;
+
 public:
 
     ExtractPolygon(const osmium::io::File& output_file, const std::string& description, const osmium::memory::Buffer& buffer, std::size_t offset);
@@ -0,0 +1,130 @@
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "extract_tile.hpp"
+
+#include <osmium/osm/box.hpp>
+#include <osmium/osm/location.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace {
+
+    // Latitude of the top and bottom edges of the Web Mercator tiles.
+    constexpr const double max_mercator_lat = 85.0511287798066;
+
+    constexpr const double pi = 3.14159265358979323846;
+
+    double tile_lon(double x, uint32_t zoom) noexcept {
+        return x / static_cast<double>(1UL << zoom) * 360.0 - 180.0;
+    }
+
+    double tile_lat(double y, uint32_t zoom) noexcept {
+        const double n = pi - 2.0 * pi * y / static_cast<double>(1UL << zoom);
+        return std::atan(std::sinh(n)) * 180.0 / pi;
+    }
+
+    uint32_t clamp_tile(double value, uint32_t zoom) noexcept {
+        const auto max = static_cast<double>((1UL << zoom) - 1);
+        return static_cast<uint32_t>(std::min(std::max(std::floor(value), 0.0), max));
+    }
+
+    struct tile_range {
+        uint32_t x_min = 0;
+        uint32_t x_max = 0;
+        uint32_t y_min = 0;
+        uint32_t y_max = 0;
+    };
+
+    tile_range get_tile_range(uint32_t zoom, const osmium::Box& box) noexcept {
+        tile_range range;
+        range.x_min = clamp_tile(tile_x(box.bottom_left().lon(), zoom), zoom);
+        range.x_max = clamp_tile(tile_x(box.top_right().lon(), zoom), zoom);
+        range.y_min = clamp_tile(tile_y(box.top_right().lat(), zoom), zoom);
+        range.y_max = clamp_tile(tile_y(box.bottom_left().lat(), zoom), zoom);
+        return range;
+    }
+
+} // anonymous namespace
+
+double tile_x(double lon, uint32_t zoom) noexcept {
+    return (lon + 180.0) / 360.0 * static_cast<double>(1UL << zoom);
+}
+
+double tile_y(double lat, uint32_t zoom) noexcept {
+    lat = std::min(std::max(lat, -max_mercator_lat), max_mercator_lat);
+    const double rad = lat * pi / 180.0;
+    return (1.0 - std::log(std::tan(rad) + 1.0 / std::cos(rad)) / pi) / 2.0 * static_cast<double>(1UL << zoom);
+}
+
+osmium::Box tile_envelope(const tile_id& tile) {
+    const uint32_t last = (1UL << tile.zoom) - 1;
+
+    const double left = tile_lon(tile.x, tile.zoom);
+    const double right = tile_lon(tile.x + 1, tile.zoom);
+    const double top = tile.y == 0 ? 90.0 : tile_lat(tile.y, tile.zoom);
+    const double bottom = tile.y == last ? -90.0 : tile_lat(tile.y + 1, tile.zoom);
+
+    return osmium::Box{left, bottom, right, top};
+}
+
+uint64_t num_tiles_in_box(uint32_t zoom, const osmium::Box& box) {
+    if (!box.valid()) {
+        return 0;
+    }
+
+    const auto range = get_tile_range(zoom, box);
+    return static_cast<uint64_t>(range.x_max - range.x_min + 1) * (range.y_max - range.y_min + 1);
+}
+
+std::vector<tile_id> tiles_in_box(uint32_t zoom, const osmium::Box& box) {
+    std::vector<tile_id> tiles;
+    if (!box.valid()) {
+        return tiles;
+    }
+
+    const auto range = get_tile_range(zoom, box);
+    tiles.reserve(num_tiles_in_box(zoom, box));
+    for (uint32_t x = range.x_min; x <= range.x_max; ++x) {
+        for (uint32_t y = range.y_min; y <= range.y_max; ++y) {
+            tiles.emplace_back(zoom, x, y);
+        }
+    }
+
+    return tiles;
+}
+
+bool ExtractTile::contains(const osmium::Location& location) const noexcept {
+    return location.valid() && envelope().contains(location);
+}
+
+const char* ExtractTile::geometry_type() const noexcept {
+    return "tile";
+}
+
+std::string ExtractTile::geometry_as_text() const {
+    return "TILE(" + std::to_string(m_tile.zoom) + '/' + std::to_string(m_tile.x) + '/' + std::to_string(m_tile.y) + ')';
+}
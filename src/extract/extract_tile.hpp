@@ -0,0 +1,109 @@
+#ifndef EXTRACT_EXTRACT_TILE_HPP
+#define EXTRACT_EXTRACT_TILE_HPP
+
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "extract.hpp"
+
+#include <osmium/osm/box.hpp>
+#include <osmium/osm/location.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * A tile in the usual Web Mercator tile scheme used for rendering. Tile
+ * 0/0 is in the top left corner.
+ */
+struct tile_id {
+
+    // Highest zoom level supported.
+    static constexpr const uint32_t max_zoom = 20;
+
+    uint32_t zoom = 0;
+    uint32_t x = 0;
+    uint32_t y = 0;
+
+    tile_id() noexcept = default;
+
+    tile_id(uint32_t zoom_, uint32_t x_, uint32_t y_) noexcept :
+        zoom(zoom_),
+        x(x_),
+        y(y_) {
+    }
+
+}; // struct tile_id
+
+/**
+ * The (fractional) tile coordinates of a location at the given zoom level.
+ * Latitudes outside the Web Mercator range are clamped to it.
+ */
+double tile_x(double lon, uint32_t zoom) noexcept;
+double tile_y(double lat, uint32_t zoom) noexcept;
+
+/**
+ * The bounding box of a tile. The tiles in the top and bottom rows extend
+ * to the poles, so every valid location is in at least one tile.
+ */
+osmium::Box tile_envelope(const tile_id& tile);
+
+/**
+ * Number of tiles at the given zoom level overlapping the box.
+ */
+uint64_t num_tiles_in_box(uint32_t zoom, const osmium::Box& box);
+
+/**
+ * All tiles at the given zoom level overlapping the box, ordered by x and
+ * then by y.
+ */
+std::vector<tile_id> tiles_in_box(uint32_t zoom, const osmium::Box& box);
+
+class ExtractTile : public Extract {
+
+    tile_id m_tile;
+
+public:
+
+    ExtractTile(const osmium::io::File& output_file, const std::string& description, const tile_id& tile) :
+        Extract(output_file, description, tile_envelope(tile)),
+        m_tile(tile) {
+    }
+
+    const tile_id& tile() const noexcept {
+        return m_tile;
+    }
+
+    bool contains(const osmium::Location& location) const noexcept override final;
+
+    bool is_box() const noexcept override final {
+        return true;
+    }
+
+    const char* geometry_type() const noexcept override final;
+
+    std::string geometry_as_text() const override final;
+
+}; // class ExtractTile
+
+#endif // EXTRACT_EXTRACT_TILE_HPP
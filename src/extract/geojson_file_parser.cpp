@@ -30,11 +30,15 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include <rapidjson/document.h>
 #include <rapidjson/error/en.h>
-#include <rapidjson/istreamwrapper.h>
+#include <rapidjson/memorystream.h>
+#include <rapidjson/reader.h>
 
 #include <cassert>
-#include <fstream>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 std::string get_value_as_string(const rapidjson::Value& object, const char* key) {
@@ -158,106 +162,466 @@ std::size_t parse_multipolygon_array(const rapidjson::Value& value, osmium::memo
     return buffer.commit();
 }
 
-OSMIUM_NORETURN void GeoJSONFileParser::error(const std::string& message) {
-    throw geojson_error{std::string{"In file '"} + m_file_name + "':\n" + message};
-}
+namespace {
+
+    /**
+     * SAX handler for GeoJSON files with a Feature or a FeatureCollection.
+     * It keeps track of where in the document it is and writes the
+     * coordinates of the geometry straight into the buffer as an area.
+     * Only the first geometry found is used, everything else is skipped.
+     */
+    class GeoJSONHandler : public rapidjson::BaseReaderHandler<rapidjson::UTF8<>, GeoJSONHandler> {
+
+        enum class context {
+            other,
+            root,
+            features,
+            feature,
+            geometry,
+            coordinates
+        };
+
+        struct frame {
+            context ctx;
+            bool is_array;
+            std::size_t index; // number of values seen so far in an array
+            std::string key;   // current key in an object
+        };
+
+        osmium::memory::Buffer& m_buffer;
+        const std::string& m_file_name;
+        std::vector<frame> m_stack;
+
+        std::string m_root_type;
+        std::string m_feature_type;
+        std::string m_geometry_type;
+        std::size_t m_num_features = 0;
+        bool m_has_features = false;
+        bool m_has_geometry = false;
+        bool m_geometry_in_root = false;
+        bool m_has_coordinates = false;
+
+        // State inside the coordinates array. Depth 1 is the coordinates
+        // array itself. The depth of the coordinate pairs is known when
+        // the first number is seen: 3 for a Polygon, 4 for a MultiPolygon.
+        std::size_t m_depth = 0;
+        std::size_t m_pair_depth = 0;
+        double m_pair[2] = {0.0, 0.0};
+        std::size_t m_pair_size = 0;
+        std::size_t m_ring_size = 0;
+        std::size_t m_rings_in_polygon = 0;
+        std::size_t m_rings = 0;
+
+        std::unique_ptr<osmium::builder::AreaBuilder> m_area_builder;
+        std::unique_ptr<osmium::builder::OuterRingBuilder> m_outer_ring_builder;
+        std::unique_ptr<osmium::builder::InnerRingBuilder> m_inner_ring_builder;
+
+        OSMIUM_NORETURN void error(const std::string& message) const {
+            throw geojson_error{std::string{"In file '"} + m_file_name + "':\n" + message};
+        }
 
-GeoJSONFileParser::GeoJSONFileParser(osmium::memory::Buffer& buffer, std::string file_name) :
-    m_buffer(buffer),
-    m_file_name(std::move(file_name)),
-    m_file(m_file_name) {
-    if (!m_file.is_open()) {
-        throw config_error{std::string{"Could not open file '"} + m_file_name + "'."};
-    }
-}
+        // The context of a value starting now.
+        context child_context() const {
+            if (m_stack.empty()) {
+                return context::root;
+            }
 
-std::size_t GeoJSONFileParser::parse_top(const rapidjson::Value& top) {
-    const auto json_geometry = top.FindMember("geometry");
-    if (json_geometry == top.MemberEnd()) {
-        error("Missing 'geometry' name.");
-    }
+            const auto& parent = m_stack.back();
+            switch (parent.ctx) {
+                case context::root:
+                    if (parent.key == "features") {
+                        return context::features;
+                    }
+                    if (parent.key == "geometry" && !m_has_geometry) {
+                        return context::geometry;
+                    }
+                    break;
+                case context::features:
+                    if (parent.index == 0) {
+                        return context::feature;
+                    }
+                    break;
+                case context::feature:
+                    if (parent.key == "geometry" && !m_has_geometry) {
+                        return context::geometry;
+                    }
+                    break;
+                case context::geometry:
+                    if (parent.key == "coordinates") {
+                        return context::coordinates;
+                    }
+                    break;
+                default:
+                    break;
+            }
 
-    if (!json_geometry->value.IsObject()) {
-        error("Expected 'geometry' value to be an object.");
-    }
+            return context::other;
+        }
 
-    std::string geometry_type{get_value_as_string(json_geometry->value, "type")};
-    if (geometry_type.empty()) {
-        error("Missing 'geometry.type'.");
-    }
-    if (geometry_type != "Polygon" && geometry_type != "MultiPolygon") {
-        error("Expected 'geometry.type' value to be 'Polygon' or 'MultiPolygon'.");
-    }
+        // Is the value starting now the value of a "type" we look at?
+        bool is_type_value() const noexcept {
+            if (m_stack.empty() || m_stack.back().is_array || m_stack.back().key != "type") {
+                return false;
+            }
+            const auto ctx = m_stack.back().ctx;
+            return ctx == context::root || ctx == context::feature || ctx == context::geometry;
+        }
 
-    const auto json_coordinates = json_geometry->value.FindMember("coordinates");
-    if (json_coordinates == json_geometry->value.MemberEnd()) {
-        error("Missing 'coordinates' name in 'geometry' object.");
-    }
+        // Check a value that is not an array or object.
+        void check_scalar(context ctx, bool is_string) const {
+            switch (ctx) {
+                case context::root:
+                    error("Top-level value must be an object.");
+                case context::features:
+                    error("Expected 'features' value to be an array.");
+                case context::feature:
+                    error("Expected values of 'features' array to be a objects.");
+                case context::geometry:
+                    error("Expected 'geometry' value to be an object.");
+                case context::coordinates:
+                    error("Expected 'geometry.coordinates' value to be an array.");
+                default:
+                    break;
+            }
+            if (!is_string && is_type_value()) {
+                throw config_error{"Value for name 'type' must be a string."};
+            }
+        }
 
-    if (!json_coordinates->value.IsArray()) {
-        error("Expected 'geometry.coordinates' value to be an array.");
-    }
+        void value_done() noexcept {
+            if (!m_stack.empty() && m_stack.back().is_array) {
+                ++m_stack.back().index;
+            }
+        }
 
-    if (geometry_type == "Polygon") {
-        return parse_polygon_array(json_coordinates->value, m_buffer);
-    }
+        bool scalar() {
+            if (m_depth > 0) {
+                throw config_error{"Coordinates array must contain numbers."};
+            }
+            check_scalar(child_context(), false);
+            value_done();
+            return true;
+        }
 
-    return parse_multipolygon_array(json_coordinates->value, m_buffer);
-}
+        bool number(double value) {
+            if (m_depth == 0) {
+                return scalar();
+            }
 
-std::size_t GeoJSONFileParser::operator()() {
-    rapidjson::IStreamWrapper stream_wrapper{m_file};
-
-    rapidjson::Document doc;
-    if (doc.ParseStream<rapidjson::kParseCommentsFlag | rapidjson::kParseTrailingCommasFlag>(stream_wrapper).HasParseError()) {
-        error(std::string{"JSON error at offset "} +
-              std::to_string(doc.GetErrorOffset()) +
-              " : " +
-              rapidjson::GetParseError_En(doc.GetParseError()));
-    }
+            if (m_pair_depth == 0) {
+                if (m_depth != 3 && m_depth != 4) {
+                    error("Expected 'geometry.coordinates' to contain rings (Polygon) or arrays of rings (MultiPolygon).");
+                }
+                m_pair_depth = m_depth;
+            } else if (m_depth != m_pair_depth) {
+                throw config_error{"Coordinates must be an array."};
+            }
 
-    if (!doc.IsObject()) {
-        error("Top-level value must be an object.");
-    }
+            if (m_pair_size == 2) {
+                throw config_error{"Coordinates array must have exactly two elements."};
+            }
+            m_pair[m_pair_size++] = value;
 
-    const std::string type{get_value_as_string(doc, "type")};
-    if (type.empty()) {
-        error("Expected 'type' name with the value 'Feature' or 'FeatureCollection'.");
-    }
+            return true;
+        }
 
-    if (type == "Feature") {
-        return parse_top(doc);
-    }
+        void add_location() {
+            if (m_pair_size != 2) {
+                throw config_error{"Coordinates array must have exactly two elements."};
+            }
 
-    if (type == "FeatureCollection") {
-        const auto json_features = doc.FindMember("features");
-        if (json_features == doc.MemberEnd()) {
-            error("Missing 'features' name.");
+            const osmium::Location location{m_pair[0], m_pair[1]};
+            if (!location.valid()) {
+                throw config_error{"Invalid location in boundary (multi)polygon: (" +
+                                   std::to_string(m_pair[0]) +
+                                   ", " +
+                                   std::to_string(m_pair[1]) + ")."};
+            }
+
+            if (m_ring_size == 0) {
+                if (m_rings_in_polygon == 0) {
+                    m_outer_ring_builder.reset(new osmium::builder::OuterRingBuilder{*m_area_builder});
+                } else {
+                    m_inner_ring_builder.reset(new osmium::builder::InnerRingBuilder{*m_area_builder});
+                }
+            }
+
+            if (m_outer_ring_builder) {
+                m_outer_ring_builder->add_node_ref(0, location);
+            } else {
+                m_inner_ring_builder->add_node_ref(0, location);
+            }
+            ++m_ring_size;
         }
 
-        if (!json_features->value.IsArray()) {
-            error("Expected 'features' value to be an array.");
+        void end_ring() {
+            if (m_ring_size < 3) {
+                throw config_error{"Ring must contain at least three coordinate pairs."};
+            }
+            m_outer_ring_builder.reset();
+            m_inner_ring_builder.reset();
+            m_ring_size = 0;
+            ++m_rings_in_polygon;
+            ++m_rings;
         }
 
-        const auto json_features_array = json_features->value.GetArray();
-        if (json_features_array.Empty()) {
-            throw config_error{"Features array must contain at least one polygon."};
+        void end_coordinates_array() {
+            if (m_depth == 1) {
+                if (m_rings == 0) {
+                    throw config_error{"Polygon must contain at least one ring."};
+                }
+                m_area_builder.reset();
+                m_depth = 0;
+                value_done();
+                return;
+            }
+
+            if (m_pair_depth == 0) {
+                // An array ended before the first coordinates were found.
+                throw config_error{"Polygon must contain at least one ring."};
+            }
+
+            if (m_depth == m_pair_depth) {
+                add_location();
+            } else if (m_depth == m_pair_depth - 1) {
+                end_ring();
+            } else if (m_depth == m_pair_depth - 2) {
+                if (m_rings_in_polygon == 0) {
+                    throw config_error{"Polygon must contain at least one ring."};
+                }
+                m_rings_in_polygon = 0;
+            }
+
+            --m_depth;
         }
 
-        const auto& json_first_feature = json_features_array[0];
-        if (!json_first_feature.IsObject()) {
-            error("Expected values of 'features' array to be a objects.");
+    public:
+
+        GeoJSONHandler(osmium::memory::Buffer& buffer, const std::string& file_name) :
+            m_buffer(buffer),
+            m_file_name(file_name) {
         }
 
-        const std::string feature_type{get_value_as_string(json_first_feature, "type")};
+        bool Null() {
+            return scalar();
+        }
 
-        if (feature_type != "Feature") {
-            error("Expected 'type' value to be 'Feature'.");
+        bool Bool(bool /*value*/) {
+            return scalar();
         }
 
-        return parse_top(json_first_feature);
-    }
+        bool Int(int value) {
+            return number(static_cast<double>(value));
+        }
+
+        bool Uint(unsigned value) {
+            return number(static_cast<double>(value));
+        }
+
+        bool Int64(int64_t value) {
+            return number(static_cast<double>(value));
+        }
+
+        bool Uint64(uint64_t value) {
+            return number(static_cast<double>(value));
+        }
+
+        bool Double(double value) {
+            return number(value);
+        }
+
+        bool String(const char* str, rapidjson::SizeType length, bool /*copy*/) {
+            if (m_depth > 0) {
+                throw config_error{"Coordinates array must contain numbers."};
+            }
+
+            check_scalar(child_context(), true);
+            if (is_type_value()) {
+                std::string value{str, length};
+                switch (m_stack.back().ctx) {
+                    case context::root:
+                        m_root_type = std::move(value);
+                        break;
+                    case context::feature:
+                        m_feature_type = std::move(value);
+                        break;
+                    default:
+                        m_geometry_type = std::move(value);
+                        break;
+                }
+            }
+
+            value_done();
+            return true;
+        }
+
+        bool StartObject() {
+            if (m_depth > 0) {
+                throw config_error{"Coordinates must be an array."};
+            }
+
+            const auto ctx = child_context();
+            if (ctx == context::features) {
+                error("Expected 'features' value to be an array.");
+            }
+            if (ctx == context::coordinates) {
+                error("Expected 'geometry.coordinates' value to be an array.");
+            }
+            if (is_type_value()) {
+                throw config_error{"Value for name 'type' must be a string."};
+            }
+
+            if (ctx == context::geometry) {
+                m_has_geometry = true;
+                m_geometry_in_root = m_stack.back().ctx == context::root;
+            }
+
+            m_stack.push_back(frame{ctx, false, 0, std::string{}});
+            return true;
+        }
+
+        bool Key(const char* str, rapidjson::SizeType length, bool /*copy*/) {
+            m_stack.back().key.assign(str, length);
+            return true;
+        }
+
+        bool EndObject(rapidjson::SizeType /*count*/) {
+            m_stack.pop_back();
+            value_done();
+            return true;
+        }
+
+        bool StartArray() {
+            if (m_depth > 0) {
+                ++m_depth;
+                if (m_pair_depth != 0 && m_depth > m_pair_depth) {
+                    throw config_error{"Coordinates array must contain numbers."};
+                }
+                m_pair_size = 0;
+                return true;
+            }
+
+            const auto ctx = child_context();
+            switch (ctx) {
+                case context::root:
+                    error("Top-level value must be an object.");
+                case context::feature:
+                    error("Expected values of 'features' array to be a objects.");
+                case context::geometry:
+                    error("Expected 'geometry' value to be an object.");
+                default:
+                    break;
+            }
+            if (is_type_value()) {
+                throw config_error{"Value for name 'type' must be a string."};
+            }
+
+            if (ctx == context::coordinates) {
+                m_has_coordinates = true;
+                m_depth = 1;
+                m_area_builder.reset(new osmium::builder::AreaBuilder{m_buffer});
+                return true;
+            }
+
+            if (ctx == context::features) {
+                m_has_features = true;
+            }
+
+            m_stack.push_back(frame{ctx, true, 0, std::string{}});
+            return true;
+        }
+
+        bool EndArray(rapidjson::SizeType /*count*/) {
+            if (m_depth > 0) {
+                end_coordinates_array();
+                return true;
+            }
+
+            if (m_stack.back().ctx == context::features) {
+                m_num_features = m_stack.back().index;
+            }
+            m_stack.pop_back();
+            value_done();
+            return true;
+        }
+
+        // Check the document structure after parsing and commit the area.
+        std::size_t finish() {
+            if (m_root_type.empty()) {
+                error("Expected 'type' name with the value 'Feature' or 'FeatureCollection'.");
+            }
+
+            if (m_root_type == "Feature") {
+                if (!m_has_geometry || !m_geometry_in_root) {
+                    error("Missing 'geometry' name.");
+                }
+            } else if (m_root_type == "FeatureCollection") {
+                if (!m_has_features) {
+                    error("Missing 'features' name.");
+                }
+                if (m_num_features == 0) {
+                    throw config_error{"Features array must contain at least one polygon."};
+                }
+                if (m_feature_type != "Feature") {
+                    error("Expected 'type' value to be 'Feature'.");
+                }
+                if (!m_has_geometry || m_geometry_in_root) {
+                    error("Missing 'geometry' name.");
+                }
+            } else {
+                error("Expected 'type' value to be 'Feature'.");
+            }
 
-    error("Expected 'type' value to be 'Feature'.");
+            if (m_geometry_type.empty()) {
+                error("Missing 'geometry.type'.");
+            }
+            if (m_geometry_type != "Polygon" && m_geometry_type != "MultiPolygon") {
+                error("Expected 'geometry.type' value to be 'Polygon' or 'MultiPolygon'.");
+            }
+
+            if (!m_has_coordinates) {
+                error("Missing 'coordinates' name in 'geometry' object.");
+            }
+
+            if (m_pair_depth != (m_geometry_type == "Polygon" ? 3 : 4)) {
+                error("Nesting of 'geometry.coordinates' arrays doesn't match 'geometry.type'.");
+            }
+
+            return m_buffer.commit();
+        }
+
+    }; // class GeoJSONHandler
+
+} // anonymous namespace
+
+OSMIUM_NORETURN void GeoJSONFileParser::error(const std::string& message) {
+    throw geojson_error{std::string{"In file '"} + m_file_name + "':\n" + message};
+}
+
+GeoJSONFileParser::GeoJSONFileParser(osmium::memory::Buffer& buffer, std::string file_name) :
+    m_buffer(buffer),
+    m_file_name(std::move(file_name)),
+    m_file(m_file_name) {
 }
 
+std::size_t GeoJSONFileParser::operator()() {
+    // Anything already written into the buffer is removed on error.
+    try {
+        GeoJSONHandler handler{m_buffer, m_file_name};
+        rapidjson::MemoryStream stream{m_file.data(), m_file.size()};
+        rapidjson::Reader reader;
+
+        const auto result = reader.Parse<rapidjson::kParseCommentsFlag | rapidjson::kParseTrailingCommasFlag>(stream, handler);
+        if (result.IsError()) {
+            error(std::string{"JSON error at offset "} +
+                  std::to_string(result.Offset()) +
+                  " : " +
+                  rapidjson::GetParseError_En(result.Code()));
+        }
+
+        return handler.finish();
+    } catch (...) {
+        m_buffer.rollback();
+        throw;
+    }
+}
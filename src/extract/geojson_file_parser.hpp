@@ -23,12 +23,14 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 */
 
+#include "mapped_file.hpp"
+
 #include <osmium/memory/buffer.hpp>
 #include <osmium/util/compatibility.hpp>
 
 #include <rapidjson/document.h>
 
-#include <fstream>
+#include <cstddef>
 #include <string>
 
 std::string get_value_as_string(const rapidjson::Value& object, const char* key);
@@ -36,18 +38,20 @@ std::size_t parse_polygon_array(const rapidjson::Value& value, osmium::memory::B
 std::size_t parse_multipolygon_array(const rapidjson::Value& value, osmium::memory::Buffer& buffer);
 
 /**
- * Gets areas from OSM files.
+ * Gets areas from GeoJSON files.
+ *
+ * The file is memory mapped and parsed with a SAX-style parser, the
+ * coordinates are written straight into the buffer without building a
+ * document tree first.
  */
 class GeoJSONFileParser {
 
     osmium::memory::Buffer& m_buffer;
     std::string m_file_name;
-    std::ifstream m_file;
+    MappedFile m_file;
 
     OSMIUM_NORETURN void error(const std::string& message);
 
-    std::size_t parse_top(const rapidjson::Value& top);
-
 public:
 
     GeoJSONFileParser(osmium::memory::Buffer& buffer, std::string file_name);
@@ -0,0 +1,40 @@
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "id_set.hpp"
+
+#include <osmium/osm/box.hpp>
+
+id_set_type id_set_type_for(const osmium::Box& envelope) noexcept {
+    // Envelopes smaller than this (in square degrees, roughly the size of
+    // a small country) use the compressed ID set.
+    constexpr const double max_compressed_area = 100.0;
+
+    if (!envelope.valid()) {
+        return id_set_type::compressed;
+    }
+
+    const double width  = envelope.top_right().lon() - envelope.bottom_left().lon();
+    const double height = envelope.top_right().lat() - envelope.bottom_left().lat();
+
+    return width * height < max_compressed_area ? id_set_type::compressed : id_set_type::dense;
+}
@@ -0,0 +1,280 @@
+#ifndef EXTRACT_ID_SET_HPP
+#define EXTRACT_ID_SET_HPP
+
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "../prefetch.hpp"
+
+#include <osmium/index/id_set.hpp>
+#include <osmium/osm/box.hpp>
+#include <osmium/osm/types.hpp>
+#include <osmium/osm/way.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+/**
+ * Compressed ID set similar to a roaring bitmap. The IDs are split into
+ * containers of 2^16 IDs. Each container stores its IDs in a sorted
+ * array of 16 bit values as long as there are only a few of them and
+ * switches to a bitmap when it gets fuller. So sparse sets need much
+ * less memory than an IdSetDense which always allocates large chunks.
+ */
+class CompressedIdSet {
+
+    static constexpr const std::size_t container_bits = 16;
+    static constexpr const std::size_t block_bits = 6;
+    static constexpr const std::size_t containers_per_block = 1UL << block_bits;
+    static constexpr const std::size_t max_array_size = 4096;
+
+    class Container {
+
+        std::vector<uint16_t> m_array;
+        std::vector<uint64_t> m_bitmap;
+
+        void convert_to_bitmap() {
+            m_bitmap.resize((1UL << container_bits) / 64);
+            for (const auto value : m_array) {
+                m_bitmap[value >> 6U] |= 1ULL << (value & 0x3fU);
+            }
+            std::vector<uint16_t>{}.swap(m_array);
+        }
+
+    public:
+
+        bool get(uint16_t value) const noexcept {
+            if (!m_bitmap.empty()) {
+                return (m_bitmap[value >> 6U] & (1ULL << (value & 0x3fU))) != 0;
+            }
+            return std::binary_search(m_array.cbegin(), m_array.cend(), value);
+        }
+
+        void prefetch_value(uint16_t value) const noexcept {
+            if (!m_bitmap.empty()) {
+                prefetch(&m_bitmap[value >> 6U]);
+            } else if (!m_array.empty()) {
+                prefetch(&m_array[m_array.size() / 2]);
+            }
+        }
+
+        template <typename TFunc>
+        void for_each(osmium::unsigned_object_id_type base, TFunc&& func) const {
+            if (m_bitmap.empty()) {
+                for (const auto value : m_array) {
+                    func(base + value);
+                }
+                return;
+            }
+            for (std::size_t i = 0; i < m_bitmap.size(); ++i) {
+                for (uint64_t bits = m_bitmap[i], n = 0; bits != 0; bits >>= 1U, ++n) {
+                    if (bits & 1U) {
+                        func(base + i * 64 + n);
+                    }
+                }
+            }
+        }
+
+        void set(uint16_t value) {
+            if (!m_bitmap.empty()) {
+                m_bitmap[value >> 6U] |= 1ULL << (value & 0x3fU);
+                return;
+            }
+
+            // IDs are usually added in order
+            if (m_array.empty() || m_array.back() < value) {
+                m_array.push_back(value);
+            } else {
+                const auto it = std::lower_bound(m_array.begin(), m_array.end(), value);
+                if (*it == value) {
+                    return;
+                }
+                m_array.insert(it, value);
+            }
+
+            if (m_array.size() > max_array_size) {
+                convert_to_bitmap();
+            }
+        }
+
+    }; // class Container
+
+    using block = std::array<std::unique_ptr<Container>, containers_per_block>;
+
+    std::vector<std::unique_ptr<block>> m_blocks;
+
+    const Container* find_container(osmium::unsigned_object_id_type id) const noexcept {
+        const auto b = id >> (container_bits + block_bits);
+        if (b >= m_blocks.size() || !m_blocks[b]) {
+            return nullptr;
+        }
+        return (*m_blocks[b])[(id >> container_bits) & (containers_per_block - 1)].get();
+    }
+
+public:
+
+    bool get(osmium::unsigned_object_id_type id) const noexcept {
+        const auto* container = find_container(id);
+        return container && container->get(static_cast<uint16_t>(id & 0xffffU));
+    }
+
+    /**
+     * Is any of the nodes in the list in the set? The data for a batch
+     * of nodes is prefetched before they are looked up, so the cache
+     * misses of the batch overlap.
+     */
+    bool any_of(const osmium::WayNodeList& nodes) const noexcept {
+        std::array<std::pair<const Container*, uint16_t>, prefetch_batch_size> batch;
+        auto it = nodes.cbegin();
+        while (it != nodes.cend()) {
+            std::size_t count = 0;
+            for (; it != nodes.cend() && count < batch.size(); ++it) {
+                const auto id = it->positive_ref();
+                const auto* container = find_container(id);
+                if (container) {
+                    const auto value = static_cast<uint16_t>(id & 0xffffU);
+                    container->prefetch_value(value);
+                    batch[count++] = std::make_pair(container, value);
+                }
+            }
+            for (std::size_t n = 0; n < count; ++n) {
+                if (batch[n].first->get(batch[n].second)) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    void set(osmium::unsigned_object_id_type id) {
+        const auto b = id >> (container_bits + block_bits);
+        if (b >= m_blocks.size()) {
+            m_blocks.resize(b + 1);
+        }
+        if (!m_blocks[b]) {
+            m_blocks[b].reset(new block{});
+        }
+        auto& container = (*m_blocks[b])[(id >> container_bits) & (containers_per_block - 1)];
+        if (!container) {
+            container.reset(new Container{});
+        }
+        container->set(static_cast<uint16_t>(id & 0xffffU));
+    }
+
+    /// Call func for each ID in the set in order.
+    template <typename TFunc>
+    void for_each(TFunc&& func) const {
+        for (std::size_t b = 0; b < m_blocks.size(); ++b) {
+            if (!m_blocks[b]) {
+                continue;
+            }
+            for (std::size_t c = 0; c < containers_per_block; ++c) {
+                const auto& container = (*m_blocks[b])[c];
+                if (container) {
+                    container->for_each(((b << block_bits) + c) << container_bits, func);
+                }
+            }
+        }
+    }
+
+}; // class CompressedIdSet
+
+enum class id_set_type {
+    dense      = 0,
+    compressed = 1
+};
+
+/**
+ * Choose the ID set type for an extract. Extracts with a small envelope
+ * usually only contain a small fraction of all IDs, they use the
+ * compressed ID set.
+ */
+id_set_type id_set_type_for(const osmium::Box& envelope) noexcept;
+
+/**
+ * ID set used in the extract strategies. Depending on the type set
+ * it uses an IdSetDense or a CompressedIdSet.
+ */
+class ExtractIdSet {
+
+    osmium::index::IdSetDense<osmium::unsigned_object_id_type> m_dense;
+    CompressedIdSet m_compressed;
+    id_set_type m_type = id_set_type::dense;
+
+public:
+
+    void set_type(id_set_type type) noexcept {
+        m_type = type;
+    }
+
+    id_set_type type() const noexcept {
+        return m_type;
+    }
+
+    bool get(osmium::unsigned_object_id_type id) const noexcept {
+        if (m_type == id_set_type::compressed) {
+            return m_compressed.get(id);
+        }
+        return m_dense.get(id);
+    }
+
+    /// Is any of the nodes in the list in the set?
+    bool any_of(const osmium::WayNodeList& nodes) const noexcept {
+        if (m_type == id_set_type::compressed) {
+            return m_compressed.any_of(nodes);
+        }
+        for (const auto& node_ref : nodes) {
+            if (m_dense.get(node_ref.positive_ref())) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void set(osmium::unsigned_object_id_type id) {
+        if (m_type == id_set_type::compressed) {
+            m_compressed.set(id);
+        } else {
+            m_dense.set(id);
+        }
+    }
+
+    /// Call func for each ID in the set in order.
+    template <typename TFunc>
+    void for_each(TFunc&& func) const {
+        if (m_type == id_set_type::compressed) {
+            m_compressed.for_each(func);
+        } else {
+            for (const auto id : m_dense) {
+                func(id);
+            }
+        }
+    }
+
+}; // class ExtractIdSet
+
+#endif // EXTRACT_ID_SET_HPP
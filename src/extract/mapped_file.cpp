@@ -0,0 +1,53 @@
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "../exception.hpp"
+#include "mapped_file.hpp"
+
+#include <osmium/io/detail/read_write.hpp>
+#include <osmium/util/file.hpp>
+#include <osmium/util/memory_mapping.hpp>
+
+#include <string>
+#include <system_error>
+
+MappedFile::MappedFile(const std::string& file_name) {
+    try {
+        m_fd = osmium::io::detail::open_for_reading(file_name);
+    } catch (const std::system_error&) {
+        throw config_error{std::string{"Could not open file '"} + file_name + "'."};
+    }
+
+    m_size = osmium::file_size(m_fd);
+
+    // An empty mapping is not possible, empty files are not mapped at all.
+    if (m_size > 0) {
+        m_mapping.reset(new osmium::MemoryMapping{m_size, osmium::MemoryMapping::mapping_mode::readonly, m_fd});
+    }
+}
+
+MappedFile::~MappedFile() noexcept {
+    m_mapping.reset();
+    if (m_fd >= 0) {
+        ::close(m_fd);
+    }
+}
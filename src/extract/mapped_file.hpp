@@ -0,0 +1,70 @@
+#ifndef EXTRACT_MAPPED_FILE_HPP
+#define EXTRACT_MAPPED_FILE_HPP
+
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <osmium/util/memory_mapping.hpp>
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+/**
+ * Read-only memory mapping of a whole file, so that parsers can work on
+ * the contents without reading them into memory first. The data is not
+ * null-terminated.
+ */
+class MappedFile {
+
+    int m_fd = -1;
+    std::size_t m_size = 0;
+    std::unique_ptr<osmium::MemoryMapping> m_mapping;
+
+public:
+
+    // Throws config_error if the file can not be opened.
+    explicit MappedFile(const std::string& file_name);
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    MappedFile(MappedFile&&) = delete;
+    MappedFile& operator=(MappedFile&&) = delete;
+
+    ~MappedFile() noexcept;
+
+    const char* data() const noexcept {
+        return m_mapping ? m_mapping->get_addr<const char>() : "";
+    }
+
+    std::size_t size() const noexcept {
+        return m_size;
+    }
+
+    const char* end() const noexcept {
+        return data() + m_size;
+    }
+
+}; // class MappedFile
+
+#endif // EXTRACT_MAPPED_FILE_HPP
@@ -0,0 +1,118 @@
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "node_extract_index.hpp"
+
+#include "../prefetch.hpp"
+
+#include <array>
+#include <cstddef>
+#include <limits>
+#include <stdexcept>
+
+NodeExtractIndex::NodeExtractIndex() :
+    m_lists(1) {
+}
+
+NodeExtractIndex::list_id NodeExtractIndex::add_to_list(list_id list, std::size_t extract) {
+    const uint64_t key = (static_cast<uint64_t>(extract) << 16U) | list;
+    const auto it = m_next_list.find(key);
+    if (it != m_next_list.end()) {
+        return it->second;
+    }
+
+    if (m_lists.size() > std::numeric_limits<list_id>::max()) {
+        throw std::overflow_error{"too many different lists of extracts"};
+    }
+
+    const auto new_list = static_cast<list_id>(m_lists.size());
+    m_lists.push_back(m_lists[list]);
+    m_lists.back().push_back(extract);
+    m_next_list.emplace(key, new_list);
+
+    if (m_last_way_for_extract.size() <= extract) {
+        m_last_way_for_extract.resize(extract + 1, 0);
+    }
+
+    return new_list;
+}
+
+void NodeExtractIndex::add(osmium::unsigned_object_id_type id, std::size_t extract) {
+    const auto c = id >> chunk_bits;
+    if (c >= m_chunks.size()) {
+        m_chunks.resize(c + 1);
+    }
+    if (!m_chunks[c]) {
+        m_chunks[c].reset(new list_id[chunk_size]());
+    }
+    auto& list = m_chunks[c][id & (chunk_size - 1)];
+    list = add_to_list(list, extract);
+}
+
+const std::vector<std::size_t>& NodeExtractIndex::way_extracts(const osmium::WayNodeList& nodes) {
+    ++m_way_count;
+    m_way_extracts.clear();
+
+    // The slots for a batch of nodes are prefetched before they are
+    // read, so the cache misses of the batch overlap.
+    std::array<const list_id*, prefetch_batch_size> batch;
+    list_id last_list = 0;
+    auto it = nodes.cbegin();
+    while (it != nodes.cend()) {
+        std::size_t count = 0;
+        for (; it != nodes.cend() && count < batch.size(); ++it) {
+            const auto id = it->positive_ref();
+            const auto c = id >> chunk_bits;
+            if (c < m_chunks.size() && m_chunks[c]) {
+                batch[count] = &m_chunks[c][id & (chunk_size - 1)];
+                prefetch(batch[count]);
+                ++count;
+            }
+        }
+        for (std::size_t n = 0; n < count; ++n) {
+            const auto list = *batch[n];
+            if (list == 0 || list == last_list) {
+                continue;
+            }
+            last_list = list;
+            for (const auto extract : m_lists[list]) {
+                if (m_last_way_for_extract[extract] != m_way_count) {
+                    m_last_way_for_extract[extract] = m_way_count;
+                    m_way_extracts.push_back(extract);
+                }
+            }
+        }
+    }
+
+    return m_way_extracts;
+}
+
+void NodeExtractIndex::clear() {
+    if (m_chunks.empty() && m_lists.size() == 1) {
+        return;
+    }
+    std::vector<std::vector<std::size_t>>(1).swap(m_lists);
+    std::unordered_map<uint64_t, list_id>{}.swap(m_next_list);
+    std::vector<std::unique_ptr<list_id[]>>{}.swap(m_chunks);
+    std::vector<std::size_t>{}.swap(m_way_extracts);
+    std::vector<std::size_t>{}.swap(m_last_way_for_extract);
+}
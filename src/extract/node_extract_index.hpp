@@ -0,0 +1,111 @@
+#ifndef EXTRACT_NODE_EXTRACT_INDEX_HPP
+#define EXTRACT_NODE_EXTRACT_INDEX_HPP
+
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <osmium/osm/types.hpp>
+#include <osmium/osm/way.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Index from node IDs to the list of extracts containing the node,
+ * shared by all extracts. The lists are interned (most nodes are in
+ * only one extract or in the same few overlapping extracts), so only
+ * a 16 bit list number is stored for each node ID. This allows finding
+ * all extracts a way is in with one lookup per way node instead of one
+ * lookup per way node and extract.
+ */
+class NodeExtractIndex {
+
+public:
+
+    using list_id = uint16_t;
+
+    /// With fewer extracts the index isn't worth the memory it needs.
+    static constexpr const std::size_t min_extracts = 8;
+
+private:
+
+    static constexpr const std::size_t chunk_bits = 12;
+    static constexpr const std::size_t chunk_size = 1UL << chunk_bits;
+
+    // List 0 is the empty list.
+    std::vector<std::vector<std::size_t>> m_lists;
+
+    // Maps (list, extract) to the list with the extract added.
+    std::unordered_map<uint64_t, list_id> m_next_list;
+
+    std::vector<std::unique_ptr<list_id[]>> m_chunks;
+
+    // Used by way_extracts() to find the extracts of a way without
+    // duplicates.
+    std::vector<std::size_t> m_way_extracts;
+    std::vector<std::size_t> m_last_way_for_extract;
+    std::size_t m_way_count = 0;
+
+    list_id add_to_list(list_id list, std::size_t extract);
+
+public:
+
+    NodeExtractIndex();
+
+    /**
+     * Add the extract to the list for this node. For each node the
+     * extracts must be added in order.
+     *
+     * @throws std::overflow_error If there are too many different
+     *         lists of extracts.
+     */
+    void add(osmium::unsigned_object_id_type id, std::size_t extract);
+
+    /// The number of the list of extracts containing the node.
+    list_id get(osmium::unsigned_object_id_type id) const noexcept {
+        const auto c = id >> chunk_bits;
+        if (c >= m_chunks.size() || !m_chunks[c]) {
+            return 0;
+        }
+        return m_chunks[c][id & (chunk_size - 1)];
+    }
+
+    /// The extracts in a list in order.
+    const std::vector<std::size_t>& extracts(list_id list) const noexcept {
+        return m_lists[list];
+    }
+
+    /**
+     * The extracts containing at least one of the nodes of the way
+     * (in no particular order). The result is valid until the next
+     * call.
+     */
+    const std::vector<std::size_t>& way_extracts(const osmium::WayNodeList& nodes);
+
+    void clear();
+
+}; // class NodeExtractIndex
+
+#endif // EXTRACT_NODE_EXTRACT_INDEX_HPP
@@ -23,114 +23,148 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include "../exception.hpp"
 #include "poly_file_parser.hpp"
 
-#include <osmium/geom/coordinates.hpp>
+#include <osmium/builder/osm_object_builder.hpp>
 #include <osmium/memory/buffer.hpp>
-#include <osmium/util/string.hpp>
+#include <osmium/osm/location.hpp>
 
-#include <fstream>
-#include <sstream>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
 #include <string>
-#include <vector>
 
 OSMIUM_NORETURN void PolyFileParser::error(const std::string& message) {
-    throw poly_error{std::string{"In file '"} + m_file_name + "' on line " + std::to_string(m_line + 1) + ":\n" + message};
+    throw poly_error{std::string{"In file '"} + m_file_name + "' on line " + std::to_string(m_line) + ":\n" + message};
 }
 
 PolyFileParser::PolyFileParser(osmium::memory::Buffer& buffer, const std::string& file_name) :
     m_buffer(buffer),
-    m_builder(nullptr),
-    m_file_name(file_name) {
-    std::ifstream file{file_name};
-    if (!file.is_open()) {
-        throw config_error{std::string{"Could not open file '"} + file_name + "'"};
-    }
-    std::stringstream sstr;
-    sstr << file.rdbuf();
-    m_data = osmium::split_string(sstr.str(), '\n', true);
-
-    // remove CR at end of lines
-    for (auto& line : m_data) {
-        if (line.back() == '\r') {
-            line.resize(line.size() - 1);
+    m_file_name(file_name),
+    m_file(file_name),
+    m_next(m_file.data()) {
+}
+
+bool PolyFileParser::next_line() noexcept {
+    const char* const end = m_file.end();
+    while (m_next != end) {
+        const char* const begin = m_next;
+        const auto* newline = static_cast<const char*>(std::memchr(begin, '\n', static_cast<std::size_t>(end - begin)));
+        const char* line_end = newline ? newline : end;
+        m_next = newline ? newline + 1 : end;
+        ++m_line;
+
+        // remove CR at end of line
+        if (line_end != begin && *(line_end - 1) == '\r') {
+            --line_end;
+        }
+
+        if (line_end != begin) {
+            m_line_begin = begin;
+            m_line_end = line_end;
+            return true;
         }
     }
+    return false;
 }
 
-void PolyFileParser::parse_ring() {
-    bool inner_ring = line()[0] == '!';
-    ++m_line;
+bool PolyFileParser::line_is(const char* str) const noexcept {
+    const auto len = std::strlen(str);
+    return static_cast<std::size_t>(m_line_end - m_line_begin) == len &&
+           std::memcmp(m_line_begin, str, len) == 0;
+}
 
-    std::vector<osmium::Location> coordinates;
-    while (m_line < m_data.size()) {
-        if (line() == "END") {
-            if (coordinates.size() < 3) {
-                error("Expected at least three lines with coordinates.");
-            }
+osmium::Location PolyFileParser::parse_location() {
+    m_line_copy.assign(m_line_begin, m_line_end);
+    const char* str = m_line_copy.c_str();
+    char* end = nullptr;
 
-            if (coordinates.front() != coordinates.back()) {
-                coordinates.push_back(coordinates.front());
+    const double lon = std::strtod(str, &end);
+    if (end == str) {
+        error("Expected coordinates or 'END' to end the ring.");
+    }
+    str = end;
+
+    const double lat = std::strtod(str, &end);
+    if (end == str || !std::isfinite(lon) || !std::isfinite(lat)) {
+        error("Expected coordinates or 'END' to end the ring.");
+    }
+
+    const osmium::Location location{lon, lat};
+    if (!location.valid()) {
+        throw config_error{"Invalid location in boundary (multi)polygon: (" + std::to_string(lon) + ", " + std::to_string(lat) + ")."};
+    }
+
+    return location;
+}
+
+template <typename TRingBuilder>
+void PolyFileParser::parse_ring_coordinates(TRingBuilder& ring_builder) {
+    std::size_t count = 0;
+    osmium::Location first;
+    osmium::Location last;
+
+    while (next_line()) {
+        if (line_is("END")) {
+            if (count < 3) {
+                error("Expected at least three lines with coordinates.");
             }
 
-            if (inner_ring) {
-                osmium::builder::InnerRingBuilder ring_builder{*m_builder};
-                for (const auto& location : coordinates) {
-                    ring_builder.add_node_ref(0, location);
-                }
-            } else {
-                osmium::builder::OuterRingBuilder ring_builder{*m_builder};
-                for (const auto& location : coordinates) {
-                    ring_builder.add_node_ref(0, location);
-                }
+            if (first != last) {
+                ring_builder.add_node_ref(0, first);
             }
 
-            ++m_line;
             return;
         }
 
-        std::istringstream sstr{line()};
-        double lon, lat;
-        if (!(sstr >> lon >> lat)) {
-            error("Expected coordinates or 'END' to end the ring.");
+        last = parse_location();
+        if (count == 0) {
+            first = last;
         }
-        coordinates.emplace_back(lon, lat);
+        ring_builder.add_node_ref(0, last);
+        ++count;
+    }
 
-        if (!coordinates.back().valid()) {
-            throw config_error{"Invalid location in boundary (multi)polygon: (" + std::to_string(lon) + ", " + std::to_string(lat) + ")."};
-        }
+    error("Expected 'END' to end the ring.");
+}
 
-        ++m_line;
+void PolyFileParser::parse_ring(osmium::builder::AreaBuilder& builder) {
+    if (*m_line_begin == '!') {
+        osmium::builder::InnerRingBuilder ring_builder{builder};
+        parse_ring_coordinates(ring_builder);
+    } else {
+        osmium::builder::OuterRingBuilder ring_builder{builder};
+        parse_ring_coordinates(ring_builder);
     }
 }
 
-void PolyFileParser::parse_multipolygon() {
-    ++m_line; // ignore first line
+void PolyFileParser::parse_multipolygon(osmium::builder::AreaBuilder& builder) {
+    // the first line (the name) is ignored
+    std::size_t rings = 0;
 
-    while (m_line < m_data.size()) {
-        if (line() == "END") {
-            ++m_line;
-            if (m_line == 2) {
+    while (next_line()) {
+        if (line_is("END")) {
+            if (rings == 0) {
                 error("Need at least one ring in (multi)polygon.");
             }
             return;
         }
-        parse_ring();
+        parse_ring(builder);
+        ++rings;
     }
 
-    --m_line;
     error("Expected 'END' for end of (multi)polygon.");
 }
 
 std::size_t PolyFileParser::operator()() {
-    if (m_data.empty()) {
+    if (!next_line()) {
         throw poly_error{std::string{"File '"} + m_file_name + "' is empty."};
     }
 
-    m_builder.reset(new osmium::builder::AreaBuilder{m_buffer});
-    while (m_line < m_data.size()) {
-        parse_multipolygon();
+    {
+        osmium::builder::AreaBuilder builder{m_buffer};
+        do {
+            parse_multipolygon(builder);
+        } while (next_line());
     }
-    m_builder.reset();
 
     return m_buffer.commit();
 }
-
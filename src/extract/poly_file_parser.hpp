@@ -23,13 +23,16 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 */
 
+#include "mapped_file.hpp"
+
 #include <osmium/builder/osm_object_builder.hpp>
 #include <osmium/memory/buffer.hpp>
+#include <osmium/osm/location.hpp>
 #include <osmium/util/compatibility.hpp>
 
-#include <memory>
+#include <cstddef>
+#include <stdexcept>
 #include <string>
-#include <vector>
 
 /**
  *  Thrown when there is a problem with parsing a poly file.
@@ -47,21 +50,40 @@ struct poly_error : public std::runtime_error {
  *
  * Format description:
  * https://wiki.openstreetmap.org/wiki/Osmosis/Polygon_Filter_File_Format
+ *
+ * The file is memory mapped and parsed line by line, the rings are
+ * written straight into the buffer.
  */
 class PolyFileParser {
 
     osmium::memory::Buffer& m_buffer;
-    std::unique_ptr<osmium::builder::AreaBuilder> m_builder;
     std::string m_file_name;
-    std::vector<std::string> m_data;
+    MappedFile m_file;
+
+    // Start of the next line not read yet.
+    const char* m_next;
+
+    // The current line (without line end) and its number.
+    const char* m_line_begin = nullptr;
+    const char* m_line_end = nullptr;
     std::size_t m_line = 0;
 
-    void parse_ring();
-    void parse_multipolygon();
+    // Used for parsing coordinates, which need a null-terminated string.
+    std::string m_line_copy;
 
-    const std::string& line() const noexcept {
-        return m_data[m_line];
-    }
+    // Go to the next non-empty line. Returns false at the end of the
+    // file.
+    bool next_line() noexcept;
+
+    bool line_is(const char* str) const noexcept;
+
+    osmium::Location parse_location();
+
+    template <typename TRingBuilder>
+    void parse_ring_coordinates(TRingBuilder& ring_builder);
+
+    void parse_ring(osmium::builder::AreaBuilder& builder);
+    void parse_multipolygon(osmium::builder::AreaBuilder& builder);
 
     OSMIUM_NORETURN void error(const std::string& message);
 
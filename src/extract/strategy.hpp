@@ -24,36 +24,79 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
 #include "extract.hpp"
+#include "extract_index.hpp"
+#include "extract_tile.hpp"
+#include "id_set.hpp"
+#include "node_extract_index.hpp"
+#include "../metrics.hpp"
+#include "../object_runs.hpp"
+#include "../trace.hpp"
 
 #include <osmium/io/file.hpp>
 #include <osmium/io/reader.hpp>
 #include <osmium/io/writer.hpp>
 #include <osmium/memory/buffer.hpp>
 #include <osmium/memory/item.hpp>
+#include <osmium/osm/box.hpp>
+#include <osmium/osm/location.hpp>
 #include <osmium/osm/node.hpp>
 #include <osmium/osm/object.hpp>
 #include <osmium/osm/relation.hpp>
 #include <osmium/osm/types.hpp>
 #include <osmium/osm/way.hpp>
+#include <osmium/thread/pool.hpp>
 #include <osmium/util/progress_bar.hpp>
 #include <osmium/util/verbose_output.hpp>
 
+#include <algorithm>
+#include <cstddef>
+#include <future>
 #include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
 
 template <typename T>
 class ExtractData : public T {
 
     Extract* m_extract_ptr;
 
+    // Copy of the envelope of the extract, checked inline before the
+    // (virtual) contains() of the extract is called. For bounding box
+    // extracts that check is all that is needed.
+    osmium::Box m_envelope;
+    bool m_is_box;
+
 public:
 
     explicit ExtractData(Extract& extract) :
         T(),
-        m_extract_ptr(&extract) {
+        m_extract_ptr(&extract),
+        m_envelope(extract.envelope()),
+        m_is_box(extract.is_box()) {
+        T::set_id_set_type(id_set_type_for(extract.envelope()));
+    }
+
+    const osmium::Box& envelope() const noexcept {
+        return m_extract_ptr->envelope();
+    }
+
+    std::size_t parent() const noexcept {
+        return m_extract_ptr->parent();
     }
 
     bool contains(const osmium::Location& location) const noexcept {
-        return m_extract_ptr->contains(location);
+        if (!location.valid() || !m_envelope.contains(location)) {
+            return false;
+        }
+        return m_is_box || m_extract_ptr->contains(location);
+    }
+
+    // The tile if this is a tile extract, nullptr otherwise.
+    const tile_id* tile() const noexcept {
+        const auto* tile_extract = dynamic_cast<const ExtractTile*>(m_extract_ptr);
+        return tile_extract ? &tile_extract->tile() : nullptr;
     }
 
     void write(const osmium::memory::Item& item) {
@@ -69,6 +112,11 @@ public:
 
 class ExtractStrategy {
 
+    int m_num_threads = 1;
+    Metrics* m_metrics = nullptr;
+    int m_pass_count = 0;
+    bool m_locations_on_ways = false;
+
 public:
 
     ExtractStrategy() = default;
@@ -77,6 +125,39 @@ public:
 
     virtual const char* name() const noexcept = 0;
 
+    int num_threads() const noexcept {
+        return m_num_threads;
+    }
+
+    void set_num_threads(int num_threads) noexcept {
+        m_num_threads = num_threads;
+    }
+
+    Metrics* metrics() const noexcept {
+        return m_metrics;
+    }
+
+    // Does the input file have the node locations on the ways? Strategies
+    // can then use those locations instead of looking up the node IDs.
+    bool locations_on_ways() const noexcept {
+        return m_locations_on_ways;
+    }
+
+    void set_locations_on_ways(bool locations_on_ways) noexcept {
+        m_locations_on_ways = locations_on_ways;
+    }
+
+    void set_metrics(Metrics* metrics) noexcept {
+        m_metrics = metrics;
+    }
+
+    // Start a new metrics phase for the next pass.
+    void start_pass_metrics() {
+        if (m_metrics) {
+            m_metrics->start_phase("pass " + std::to_string(++m_pass_count));
+        }
+    }
+
     virtual void show_arguments(osmium::VerboseOutput& /*vout*/) {
     }
 
@@ -85,39 +166,406 @@ public:
 }; // class ExtractStrategy
 
 
+/**
+ * Copies of OSM objects kept in memory, so that a later pass can use them
+ * without reading and decoding the input file again.
+ */
+class ObjectCache {
+
+    static constexpr const std::size_t buffer_size = 10UL * 1024UL * 1024UL;
+
+    std::vector<osmium::memory::Buffer> m_buffers;
+    std::size_t m_bytes = 0;
+
+public:
+
+    void add(const osmium::memory::Item& item) {
+        if (m_buffers.empty() || m_buffers.back().capacity() - m_buffers.back().committed() < item.padded_size()) {
+            m_buffers.emplace_back(std::max(buffer_size, item.padded_size()), osmium::memory::Buffer::auto_grow::no);
+        }
+        m_buffers.back().add_item(item);
+        m_buffers.back().commit();
+        m_bytes += item.padded_size();
+    }
+
+    const std::vector<osmium::memory::Buffer>& buffers() const noexcept {
+        return m_buffers;
+    }
+
+    std::size_t bytes() const noexcept {
+        return m_bytes;
+    }
+
+    void clear() {
+        m_buffers.clear();
+        m_bytes = 0;
+    }
+
+}; // class ObjectCache
+
+
 template <typename TStrategy, typename TChild>
 class Pass {
 
     TStrategy& m_strategy;
+    ExtractIndex m_index;
+    std::unique_ptr<osmium::thread::Pool> m_pool;
+    std::size_t m_num_threads = 1;
+
+    // Child extracts of each extract.
+    std::vector<std::vector<std::size_t>> m_children;
+
+    // Has nodes_done() been called?
+    bool m_nodes_done = false;
+
+    NodeExtractIndex m_node_index;
+    bool m_has_node_index = false;
+
+    // Which object runs in a buffer are handled.
+    enum class run_filter {
+        all,
+        nodes,
+        not_nodes
+    };
+
+    static bool handle_run(run_filter filter, osmium::item_type type) noexcept {
+        switch (filter) {
+            case run_filter::nodes:
+                return type == osmium::item_type::node;
+            case run_filter::not_nodes:
+                return type != osmium::item_type::node;
+            default:
+                break;
+        }
+        return true;
+    }
 
-    void run_impl(osmium::ProgressBar& progress_bar, osmium::io::Reader& reader) {
-        while (osmium::memory::Buffer buffer = reader.read()) {
-            progress_bar.update(reader.offset());
-            for (const auto& object : buffer) {
-                switch (object.type()) {
-                    case osmium::item_type::node:
-                        self().node(static_cast<const osmium::Node&>(object));
-                        for (auto& e : extracts()) {
-                            self().enode(e, static_cast<const osmium::Node&>(object));
+    // Does the child class define its own version of a handler? Those
+    // it doesn't define are empty, the loops calling them are then left
+    // out at compile time. These have to be functions, because TChild is
+    // still incomplete when this class is instantiated.
+    static constexpr bool has_node() noexcept {
+        return !std::is_same<decltype(&TChild::node), decltype(&Pass::node)>::value;
+    }
+
+    static constexpr bool has_way() noexcept {
+        return !std::is_same<decltype(&TChild::way), decltype(&Pass::way)>::value;
+    }
+
+    static constexpr bool has_relation() noexcept {
+        return !std::is_same<decltype(&TChild::relation), decltype(&Pass::relation)>::value;
+    }
+
+    static constexpr bool has_enode() noexcept {
+        return !std::is_same<decltype(&TChild::enode), decltype(&Pass::enode)>::value;
+    }
+
+    static constexpr bool has_eway() noexcept {
+        return !std::is_same<decltype(&TChild::eway), decltype(&Pass::eway)>::value;
+    }
+
+    static constexpr bool has_erelation() noexcept {
+        return !std::is_same<decltype(&TChild::erelation), decltype(&Pass::erelation)>::value;
+    }
+
+    static constexpr bool has_extract_handlers() noexcept {
+        return has_enode() || has_eway() || has_erelation();
+    }
+
+    static bool has_non_nodes(const osmium::memory::Buffer& buffer) {
+        return std::any_of(buffer.cbegin<osmium::OSMObject>(), buffer.cend<osmium::OSMObject>(), [](const osmium::OSMObject& object) {
+            return object.type() != osmium::item_type::node;
+        });
+    }
+
+    // Call enode() for the extract with index i and return whether the
+    // node is inside the extract. The enode() of passes with
+    // enode_in_envelope_only checks this anyway and returns the result.
+    bool enode_contains(std::size_t i, const osmium::Node& node, std::true_type /*enode_in_envelope_only*/) {
+        return self().enode(extracts()[i], node);
+    }
+
+    bool enode_contains(std::size_t i, const osmium::Node& node, std::false_type /*enode_in_envelope_only*/) {
+        auto& e = extracts()[i];
+        self().enode(e, node);
+        return e.contains(node.location());
+    }
+
+    // Call enode() for the extract with index i (if it is handled by
+    // this thread) and, if the node is inside the extract, recursively
+    // for its children. The polygon test is only done once per extract.
+    void enode_tree(const osmium::Node& node, std::size_t i, std::size_t first, std::size_t step) {
+        bool inside = false;
+        if (i % step == first) {
+            inside = enode_contains(i, node, std::integral_constant<bool, TChild::enode_in_envelope_only>{});
+        } else if (!m_children[i].empty()) {
+            inside = extracts()[i].contains(node.location());
+        }
+        if (inside) {
+            for (const auto child : m_children[i]) {
+                enode_tree(node, child, first, step);
+            }
+        }
+    }
+
+    // Call enode() for every extract with index first, first + step,
+    // first + 2 * step... If the child class allows it, only for those
+    // extracts whose envelope might contain the node and whose parent
+    // extract contains the node.
+    void enodes(const osmium::Node& node, std::size_t first, std::size_t step) {
+        auto& e_list = extracts();
+        if (TChild::enode_in_envelope_only) {
+            m_index.for_each_candidate(node.location(), [this, &e_list, &node, first, step](std::size_t i) {
+                if (e_list[i].parent() == Extract::no_parent) {
+                    enode_tree(node, i, first, step);
+                }
+            });
+        } else {
+            for (std::size_t i = first; i < e_list.size(); i += step) {
+                self().enode(e_list[i], node);
+            }
+        }
+    }
+
+    void handle_buffer(const osmium::memory::Buffer& buffer, run_filter filter) {
+        for_each_object_run(buffer, [this, filter](const ObjectRun& run) {
+            if (!handle_run(filter, run.type())) {
+                return;
+            }
+            switch (run.type()) {
+                case osmium::item_type::node:
+                    if (has_node() || has_enode()) {
+                        for (const auto& node : run.objects<osmium::Node>()) {
+                            if (has_node()) {
+                                self().node(node);
+                            }
+                            if (has_enode()) {
+                                enodes(node, 0, 1);
+                            }
+                        }
+                    }
+                    break;
+                case osmium::item_type::way:
+                    if (has_way() || has_eway()) {
+                        for (const auto& way : run.objects<osmium::Way>()) {
+                            if (has_way()) {
+                                self().way(way);
+                            }
+                            if (has_eway()) {
+                                for (auto& e : extracts()) {
+                                    self().eway(e, way);
+                                }
+                            }
+                        }
+                    }
+                    break;
+                case osmium::item_type::relation:
+                    if (has_relation() || has_erelation()) {
+                        for (const auto& relation : run.objects<osmium::Relation>()) {
+                            if (has_relation()) {
+                                self().relation(relation);
+                            }
+                            if (has_erelation()) {
+                                for (auto& e : extracts()) {
+                                    self().erelation(e, relation);
+                                }
+                            }
+                        }
+                    }
+                    break;
+                default:
+                    break;
+            }
+        });
+    }
+
+    // Call the per-extract handlers for all objects in the buffer for
+    // every extract with index first, first + step, first + 2 * step...
+    void run_extracts(const osmium::memory::Buffer& buffer, run_filter filter, std::size_t first, std::size_t step) {
+        auto& e_list = extracts();
+        for_each_object_run(buffer, [this, &e_list, filter, first, step](const ObjectRun& run) {
+            if (!handle_run(filter, run.type())) {
+                return;
+            }
+            switch (run.type()) {
+                case osmium::item_type::node:
+                    if (has_enode()) {
+                        for (const auto& node : run.objects<osmium::Node>()) {
+                            enodes(node, first, step);
+                        }
+                    }
+                    break;
+                case osmium::item_type::way:
+                    if (has_eway()) {
+                        for (const auto& way : run.objects<osmium::Way>()) {
+                            for (std::size_t i = first; i < e_list.size(); i += step) {
+                                self().eway(e_list[i], way);
+                            }
+                        }
+                    }
+                    break;
+                case osmium::item_type::relation:
+                    if (has_erelation()) {
+                        for (const auto& relation : run.objects<osmium::Relation>()) {
+                            for (std::size_t i = first; i < e_list.size(); i += step) {
+                                self().erelation(e_list[i], relation);
+                            }
                         }
-                        break;
-                    case osmium::item_type::way:
-                        self().way(static_cast<const osmium::Way&>(object));
-                        for (auto& e : extracts()) {
-                            self().eway(e, static_cast<const osmium::Way&>(object));
+                    }
+                    break;
+                default:
+                    break;
+            }
+        });
+    }
+
+    // Like handle_buffer() but the extracts are distributed over the
+    // threads of the pool. First the handlers for all objects in the
+    // buffer are called, then each thread handles all objects in the
+    // buffer for its share of the extracts. Each extract sees the objects
+    // in the same order as in handle_buffer(), so the results are the
+    // same.
+    void handle_buffer_parallel(const osmium::memory::Buffer& buffer, run_filter filter) {
+        for_each_object_run(buffer, [this, filter](const ObjectRun& run) {
+            if (!handle_run(filter, run.type())) {
+                return;
+            }
+            switch (run.type()) {
+                case osmium::item_type::node:
+                    if (has_node()) {
+                        for (const auto& node : run.objects<osmium::Node>()) {
+                            self().node(node);
                         }
-                        break;
-                    case osmium::item_type::relation:
-                        self().relation(static_cast<const osmium::Relation&>(object));
-                        for (auto& e : extracts()) {
-                            self().erelation(e, static_cast<const osmium::Relation&>(object));
+                    }
+                    break;
+                case osmium::item_type::way:
+                    if (has_way()) {
+                        for (const auto& way : run.objects<osmium::Way>()) {
+                            self().way(way);
                         }
-                        break;
-                    default:
-                        break;
+                    }
+                    break;
+                case osmium::item_type::relation:
+                    if (has_relation()) {
+                        for (const auto& relation : run.objects<osmium::Relation>()) {
+                            self().relation(relation);
+                        }
+                    }
+                    break;
+                default:
+                    break;
+            }
+        });
+
+        std::vector<std::future<void>> futures;
+        const auto num_threads = m_num_threads;
+        for (std::size_t n = 0; n < num_threads; ++n) {
+            futures.push_back(m_pool->submit([this, &buffer, filter, n, num_threads]() {
+                const TraceSpan span{"extract handlers (thread)"};
+                run_extracts(buffer, filter, n, num_threads);
+            }));
+        }
+
+        // Wait for all threads before get() can throw, they are
+        // still using the buffer.
+        for (auto& future : futures) {
+            future.wait();
+        }
+        for (auto& future : futures) {
+            future.get();
+        }
+    }
+
+    // Build the node index from the node IDs of all extracts (if the
+    // child class uses it and there are enough extracts). If there are
+    // too many different combinations of extracts, no index is used.
+    void build_node_index() {
+        if (!TChild::use_node_index || extracts().size() < NodeExtractIndex::min_extracts) {
+            return;
+        }
+        try {
+            for (std::size_t i = 0; i < extracts().size(); ++i) {
+                extracts()[i].node_ids.for_each([this, i](osmium::unsigned_object_id_type id) {
+                    m_node_index.add(id, i);
+                });
+            }
+        } catch (const std::overflow_error&) {
+            m_node_index.clear();
+            return;
+        }
+        m_has_node_index = true;
+    }
+
+    void prepare() {
+        m_nodes_done = false;
+        m_node_index.clear();
+        m_has_node_index = false;
+
+        if (TChild::enode_in_envelope_only && has_enode()) {
+            // If all extracts are tiles of the same zoom level, the
+            // index can find the tiles of a node directly.
+            std::vector<tile_id> tiles;
+            for (const auto& e : extracts()) {
+                const auto* tile = e.tile();
+                if (!tile || (!tiles.empty() && tile->zoom != tiles.front().zoom)) {
+                    tiles.clear();
+                    break;
+                }
+                tiles.push_back(*tile);
+            }
+
+            if (tiles.empty()) {
+                std::vector<osmium::Box> envelopes;
+                envelopes.reserve(extracts().size());
+                for (const auto& e : extracts()) {
+                    envelopes.push_back(e.envelope());
+                }
+                m_index = ExtractIndex{envelopes};
+            } else {
+                m_index = ExtractIndex{tiles};
+            }
+
+            m_children.clear();
+            m_children.resize(extracts().size());
+            for (std::size_t i = 0; i < extracts().size(); ++i) {
+                const auto parent = extracts()[i].parent();
+                if (parent != Extract::no_parent) {
+                    m_children[parent].push_back(i);
                 }
             }
         }
+
+        m_num_threads = std::min(static_cast<std::size_t>(m_strategy.num_threads()), extracts().size());
+        if (TChild::parallel_extracts && has_extract_handlers() && m_num_threads > 1 && !m_pool) {
+            // Use a separate pool, the default pool is used by the
+            // reader and by the writers of the extracts.
+            m_pool.reset(new osmium::thread::Pool{static_cast<int>(m_num_threads)});
+        }
+    }
+
+    void handle_runs(const osmium::memory::Buffer& buffer, run_filter filter) {
+        if (m_pool) {
+            handle_buffer_parallel(buffer, filter);
+        } else {
+            handle_buffer(buffer, filter);
+        }
+    }
+
+    // The input is sorted, so all nodes come before the first way or
+    // relation. If a buffer contains the last nodes and the first other
+    // objects, the nodes are handled completely (by all threads) before
+    // nodes_done() is called and the other objects are handled.
+    void handle(const osmium::memory::Buffer& buffer) {
+        if (!m_nodes_done && has_non_nodes(buffer)) {
+            handle_runs(buffer, run_filter::nodes);
+            m_nodes_done = true;
+            build_node_index();
+            self().nodes_done();
+            handle_runs(buffer, run_filter::not_nodes);
+        } else {
+            handle_runs(buffer, run_filter::all);
+        }
+        self().buffer_done();
     }
 
 protected:
@@ -139,9 +587,41 @@ protected:
     void node(const osmium::Node&) {
     }
 
+    // Called once after all nodes were handled by node() and enode()
+    // and before the first way or relation.
+    void nodes_done() {
+    }
+
     void way(const osmium::Way&) {
     }
 
+    // Called after all objects in a buffer were handled by all handlers.
+    void buffer_done() {
+    }
+
+    /**
+     * Is the node index available? If so, a child class should find
+     * the extracts of each way with way_extracts() in way() instead of
+     * checking the node IDs of each extract in eway(). This stays true
+     * after release_node_index().
+     */
+    bool has_node_index() const noexcept {
+        return m_has_node_index;
+    }
+
+    /**
+     * The extracts containing at least one of the nodes of the way.
+     * Only call this from way() if has_node_index() is true.
+     */
+    const std::vector<std::size_t>& way_extracts(const osmium::Way& way) {
+        return m_node_index.way_extracts(way.nodes());
+    }
+
+    /// Free the memory used by the node index once all ways are done.
+    void release_node_index() {
+        m_node_index.clear();
+    }
+
     void relation(const osmium::Relation&) {
     }
 
@@ -156,15 +636,76 @@ protected:
 
 public:
 
+    /**
+     * Set to false in a child class if the handlers for all extracts
+     * (node(), way(), relation()) depend on results of the handlers for
+     * single extracts (enode(), eway(), erelation()). Those passes will
+     * always run in a single thread.
+     */
+    static constexpr const bool parallel_extracts = true;
+
+    /**
+     * Set to true in a child class if enode() never does anything for
+     * nodes outside the envelope of the extract. The pass will then
+     * use a spatial index to only call enode() for the extracts near
+     * each node. The enode() of such a child class must return whether
+     * the node is inside the extract.
+     */
+    static constexpr const bool enode_in_envelope_only = false;
+
+    /**
+     * Set to true in a child class which uses the node index (see
+     * has_node_index()). After all nodes are handled, it is built from
+     * the node_ids sets of all extracts.
+     */
+    static constexpr const bool use_node_index = false;
+
     explicit Pass(TStrategy& strategy) :
         m_strategy(strategy) {
     }
 
     template <typename... Args>
     void run(osmium::ProgressBar& progress_bar, Args ...args) {
+        prepare();
+
+        m_strategy.start_pass_metrics();
+        Metrics* metrics = m_strategy.metrics();
+
         osmium::io::Reader reader{std::forward<Args>(args)...};
-        run_impl(progress_bar, reader);
+        while (osmium::memory::Buffer buffer = traced_read(reader)) {
+            progress_bar.update(reader.offset());
+            if (metrics) {
+                metrics->add_buffer(buffer);
+            }
+            const TraceSpan span{"extract handlers"};
+            handle(buffer);
+        }
+        if (metrics) {
+            metrics->add("bytes_read", reader.offset());
+        }
         reader.close();
+
+        if (metrics) {
+            metrics->end_phase();
+        }
+    }
+
+    /**
+     * Run this pass on buffers kept in memory from an earlier pass
+     * instead of reading the input file again.
+     */
+    void replay(const ObjectCache& cache) {
+        prepare();
+        m_strategy.start_pass_metrics();
+
+        for (const auto& buffer : cache.buffers()) {
+            const TraceSpan span{"extract handlers"};
+            handle(buffer);
+        }
+
+        if (m_strategy.metrics()) {
+            m_strategy.metrics()->end_phase();
+        }
     }
 
 }; // class Pass
@@ -28,7 +28,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 namespace strategy_complete_ways {
 
-    void Data::add_relation_parents(osmium::unsigned_object_id_type id, const osmium::index::RelationsMapIndex& map) {
+    void Data::add_relation_parents(osmium::unsigned_object_id_type id, const CompactRelationsMapIndex& map) {
         map.for_each_parent(id, [&](osmium::unsigned_object_id_type parent_id) {
             if (!relation_ids.get(parent_id)) {
                 relation_ids.set(parent_id);
@@ -55,10 +55,20 @@ namespace strategy_complete_ways {
     class Pass1 : public Pass<Strategy, Pass1> {
 
         osmium::handler::CheckOrder m_check_order;
-        osmium::index::RelationsMapStash m_relations_map_stash;
+        CompactRelationsMapStash m_relations_map_stash;
+
+        void add_way(extract_data& e, const osmium::Way& way) {
+            e.way_ids.set(way.positive_id());
+            for (const auto& nr : way.nodes()) {
+                e.extra_node_ids.set(nr.ref());
+            }
+        }
 
     public:
 
+        static constexpr const bool enode_in_envelope_only = true;
+        static constexpr const bool use_node_index = true;
+
         explicit Pass1(Strategy& strategy) :
             Pass(strategy) {
         }
@@ -67,30 +77,41 @@ namespace strategy_complete_ways {
             m_check_order.node(node);
         }
 
-        void enode(extract_data& e, const osmium::Node& node) {
+        bool enode(extract_data& e, const osmium::Node& node) {
             if (e.contains(node.location())) {
                 e.node_ids.set(node.positive_id());
+                return true;
             }
+            return false;
         }
 
+        // If the node index is used, the way is checked against all
+        // extracts here and eway() does nothing. This runs in a single
+        // thread, so it can write into the data of all extracts.
         void way(const osmium::Way& way) {
             m_check_order.way(way);
+            if (has_node_index()) {
+                for (const auto i : way_extracts(way)) {
+                    add_way(extracts()[i], way);
+                }
+            }
         }
 
         void eway(extract_data& e, const osmium::Way& way) {
-            for (const auto& nr : way.nodes()) {
-                if (e.node_ids.get(nr.positive_ref())) {
-                    e.way_ids.set(way.positive_id());
-                    for (const auto& nr : way.nodes()) {
-                        e.extra_node_ids.set(nr.ref());
-                    }
-                    return;
-                }
+            if (has_node_index()) {
+                return;
+            }
+            if (e.node_ids.any_of(way.nodes())) {
+                add_way(e, way);
             }
         }
 
         void relation(const osmium::Relation& relation) {
             m_check_order.relation(relation);
+            // The node index is not needed any more.
+            if (has_node_index()) {
+                release_node_index();
+            }
             m_relations_map_stash.add_members(relation);
         }
 
@@ -115,7 +136,7 @@ namespace strategy_complete_ways {
             }
         }
 
-        osmium::index::RelationsMapStash& relations_map_stash() noexcept {
+        CompactRelationsMapStash& relations_map_stash() noexcept {
             return m_relations_map_stash;
         }
 
@@ -151,7 +172,7 @@ namespace strategy_complete_ways {
     }; // class Pass2
 
     void Strategy::run(osmium::VerboseOutput& vout, bool display_progress, const osmium::io::File& input_file) {
-        if (input_file.filename().empty()) {
+        if (is_stdin_or_pipe(input_file.filename())) {
             throw osmium::io_error{"Can not read from STDIN when using 'complete_ways' strategy."};
         }
 
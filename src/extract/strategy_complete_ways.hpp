@@ -23,10 +23,11 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 */
 
+#include "id_set.hpp"
 #include "strategy.hpp"
+#include "../relations_map.hpp"
 
 #include <osmium/index/id_set.hpp>
-#include <osmium/index/relations_map.hpp>
 
 #include <memory>
 #include <vector>
@@ -34,12 +35,18 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 namespace strategy_complete_ways {
 
     struct Data {
-        osmium::index::IdSetDense<osmium::unsigned_object_id_type> node_ids;
-        osmium::index::IdSetDense<osmium::unsigned_object_id_type> extra_node_ids;
-        osmium::index::IdSetDense<osmium::unsigned_object_id_type> way_ids;
+        ExtractIdSet node_ids;
+        ExtractIdSet extra_node_ids;
+        ExtractIdSet way_ids;
         osmium::index::IdSetDense<osmium::unsigned_object_id_type> relation_ids;
 
-        void add_relation_parents(osmium::unsigned_object_id_type id, const osmium::index::RelationsMapIndex& map);
+        void set_id_set_type(id_set_type type) noexcept {
+            node_ids.set_type(type);
+            extra_node_ids.set_type(type);
+            way_ids.set_type(type);
+        }
+
+        void add_relation_parents(osmium::unsigned_object_id_type id, const CompactRelationsMapIndex& map);
     };
 
     class Strategy : public ExtractStrategy {
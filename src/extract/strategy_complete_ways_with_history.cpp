@@ -21,13 +21,14 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
 #include "strategy_complete_ways_with_history.hpp"
+#include "../util.hpp"
 
 #include <memory>
 #include <vector>
 
 namespace strategy_complete_ways_with_history {
 
-    void Data::add_relation_parents(osmium::unsigned_object_id_type id, const osmium::index::RelationsMapIndex& map) {
+    void Data::add_relation_parents(osmium::unsigned_object_id_type id, const CompactRelationsMapIndex& map) {
         map.for_each_parent(id, [&](osmium::unsigned_object_id_type parent_id) {
             if (!relation_ids.get(parent_id)) {
                 relation_ids.set(parent_id);
@@ -49,12 +50,16 @@ namespace strategy_complete_ways_with_history {
 
     class Pass1 : public Pass<Strategy, Pass1> {
 
-        osmium::index::RelationsMapStash m_relations_map_stash;
+        CompactRelationsMapStash m_relations_map_stash;
         std::vector<osmium::unsigned_object_id_type> m_current_way_nodes;
         osmium::unsigned_object_id_type m_current_way_id = 0;
 
     public:
 
+        // way() uses the way_ids set by eway() for the previous way
+        static constexpr const bool parallel_extracts = false;
+        static constexpr const bool enode_in_envelope_only = true;
+
         explicit Pass1(Strategy& strategy) :
             Pass(strategy) {
         }
@@ -70,10 +75,12 @@ namespace strategy_complete_ways_with_history {
             m_current_way_nodes.clear();
         }
 
-        void enode(extract_data& e, const osmium::Node& node) {
+        bool enode(extract_data& e, const osmium::Node& node) {
             if (e.contains(node.location())) {
                 e.node_ids.set(node.positive_id());
+                return true;
             }
+            return false;
         }
 
         void way(const osmium::Way& way) {
@@ -88,11 +95,8 @@ namespace strategy_complete_ways_with_history {
         }
 
         void eway(extract_data& e, const osmium::Way& way) {
-            for (const auto& nr : way.nodes()) {
-                if (e.node_ids.get(nr.positive_ref())) {
-                    e.way_ids.set(way.positive_id());
-                    return;
-                }
+            if (e.node_ids.any_of(way.nodes())) {
+                e.way_ids.set(way.positive_id());
             }
         }
 
@@ -121,7 +125,7 @@ namespace strategy_complete_ways_with_history {
             }
         }
 
-        osmium::index::RelationsMapStash& relations_map_stash() noexcept {
+        CompactRelationsMapStash& relations_map_stash() noexcept {
             return m_relations_map_stash;
         }
 
@@ -157,7 +161,7 @@ namespace strategy_complete_ways_with_history {
     }; // class Pass2
 
     void Strategy::run(osmium::VerboseOutput& vout, bool display_progress, const osmium::io::File& input_file) {
-        if (input_file.filename().empty()) {
+        if (is_stdin_or_pipe(input_file.filename())) {
             throw osmium::io_error{"Can not read from STDIN when using 'complete_ways' strategy."};
         }
 
@@ -24,9 +24,52 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include "../util.hpp"
 
 #include <osmium/handler/check_order.hpp>
+#include <osmium/io/reader.hpp>
+#include <osmium/osm/node.hpp>
+#include <osmium/osm/relation.hpp>
+#include <osmium/osm/way.hpp>
+#include <osmium/thread/pool.hpp>
+
+#include <cstddef>
+#include <deque>
+#include <future>
+#include <utility>
 
 namespace strategy_simple {
 
+    namespace {
+
+        bool way_in_extract(const ExtractData<Data>& e, const osmium::Way& way, bool locations_on_ways) noexcept {
+            // With the node locations on the ways, the locations are
+            // checked directly. This also finds ways whose nodes are not
+            // in the input file.
+            if (locations_on_ways) {
+                for (const auto& nr : way.nodes()) {
+                    if (nr.location().valid() && e.contains(nr.location())) {
+                        return true;
+                    }
+                }
+                return false;
+            }
+            return !way.nodes().empty() && e.node_ids.get(way.nodes().front().positive_ref());
+        }
+
+        bool relation_in_extract(const ExtractData<Data>& e, const osmium::Relation& relation) noexcept {
+            for (const auto& member : relation.members()) {
+                switch (member.type()) {
+                    case osmium::item_type::node:
+                        return e.node_ids.get(member.positive_ref());
+                    case osmium::item_type::way:
+                        return e.way_ids.get(member.positive_ref());
+                    default:
+                        break;
+                }
+            }
+            return false;
+        }
+
+    } // anonymous namespace
+
     Strategy::Strategy(const std::vector<std::unique_ptr<Extract>>& extracts, const osmium::Options& options) {
         m_extracts.reserve(extracts.size());
         for (const auto& extract : extracts) {
@@ -48,6 +91,8 @@ namespace strategy_simple {
 
     public:
 
+        static constexpr const bool enode_in_envelope_only = true;
+
         explicit Pass1(Strategy& strategy) :
             Pass(strategy) {
         }
@@ -56,11 +101,13 @@ namespace strategy_simple {
             m_check_order.node(node);
         }
 
-        void enode(extract_data& e, const osmium::Node& node) {
+        bool enode(extract_data& e, const osmium::Node& node) {
             if (e.contains(node.location())) {
                 e.write(node);
                 e.node_ids.set(node.positive_id());
+                return true;
             }
+            return false;
         }
 
         void way(const osmium::Way& way) {
@@ -68,12 +115,9 @@ namespace strategy_simple {
         }
 
         void eway(extract_data& e, const osmium::Way& way) {
-            for (const auto& nr : way.nodes()) {
-                if (e.node_ids.get(nr.positive_ref())) {
-                    e.write(way);
-                    e.way_ids.set(way.positive_id());
-                }
-                return;
+            if (way_in_extract(e, way, strategy().locations_on_ways())) {
+                e.write(way);
+                e.way_ids.set(way.positive_id());
             }
         }
 
@@ -82,33 +126,171 @@ namespace strategy_simple {
         }
 
         void erelation(extract_data& e, const osmium::Relation& relation) {
-            for (const auto& member : relation.members()) {
-                switch (member.type()) {
+            if (relation_in_extract(e, relation)) {
+                e.write(relation);
+            }
+        }
+
+    }; // class Pass1
+
+    Strategy::run_result Strategy::check_run(const std::shared_ptr<osmium::memory::Buffer>& buffer, const ObjectRun& run) const {
+        run_result result{buffer, run.type(), std::vector<std::vector<const osmium::OSMObject*>>(m_extracts.size())};
+
+        switch (run.type()) {
+            case osmium::item_type::node: {
+                    // Nodes are only checked against an extract if they
+                    // are inside its parent, which comes before it.
+                    std::vector<char> inside(m_extracts.size());
+                    for (const auto& node : run.objects<osmium::Node>()) {
+                        for (std::size_t i = 0; i < m_extracts.size(); ++i) {
+                            const auto& e = m_extracts[i];
+                            inside[i] = (e.parent() == Extract::no_parent || inside[e.parent()]) && e.contains(node.location());
+                            if (inside[i]) {
+                                result.objects[i].push_back(&node);
+                            }
+                        }
+                    }
+                }
+                break;
+            case osmium::item_type::way:
+                for (const auto& way : run.objects<osmium::Way>()) {
+                    for (std::size_t i = 0; i < m_extracts.size(); ++i) {
+                        if (way_in_extract(m_extracts[i], way, locations_on_ways())) {
+                            result.objects[i].push_back(&way);
+                        }
+                    }
+                }
+                break;
+            case osmium::item_type::relation:
+                for (const auto& relation : run.objects<osmium::Relation>()) {
+                    for (std::size_t i = 0; i < m_extracts.size(); ++i) {
+                        if (relation_in_extract(m_extracts[i], relation)) {
+                            result.objects[i].push_back(&relation);
+                        }
+                    }
+                }
+                break;
+            default:
+                break;
+        }
+
+        return result;
+    }
+
+    void Strategy::write_result(const run_result& result) {
+        for (std::size_t i = 0; i < m_extracts.size(); ++i) {
+            auto& e = m_extracts[i];
+            for (const auto* object : result.objects[i]) {
+                e.write(*object);
+                if (result.type == osmium::item_type::node) {
+                    e.node_ids.set(object->positive_id());
+                } else if (result.type == osmium::item_type::way) {
+                    e.way_ids.set(object->positive_id());
+                }
+            }
+        }
+    }
+
+    // The runs of objects in the buffers are checked against all extracts
+    // on the thread pool, the results are written in the order of the
+    // input. Ways need the IDs of all nodes and relations those of all
+    // nodes and ways, so all results are written before the first run of
+    // the next type is checked. This doesn't cost much in sorted input.
+    void Strategy::run_parallel(osmium::ProgressBar& progress_bar, const osmium::io::File& input_file) {
+        start_pass_metrics();
+
+        // Use a separate pool, the default pool is used by the reader and
+        // by the writers of the extracts.
+        osmium::thread::Pool pool{num_threads()};
+        const std::size_t max_pending = static_cast<std::size_t>(num_threads()) * 4;
+        std::deque<std::future<run_result>> pending;
+
+        const auto write_first = [this, &pending]() {
+            const TraceSpan span{"extract write"};
+            write_result(pending.front().get());
+            pending.pop_front();
+        };
+
+        osmium::handler::CheckOrder check_order;
+        osmium::item_type last_type = osmium::item_type::undefined;
+
+        osmium::io::Reader reader{input_file};
+        while (osmium::memory::Buffer buffer = traced_read(reader)) {
+            progress_bar.update(reader.offset());
+            if (metrics()) {
+                metrics()->add_buffer(buffer);
+            }
+
+            auto buffer_ptr = std::make_shared<osmium::memory::Buffer>(std::move(buffer));
+            for_each_object_run(*buffer_ptr, [&](const ObjectRun& run) {
+                switch (run.type()) {
                     case osmium::item_type::node:
-                        if (e.node_ids.get(member.positive_ref())) {
-                            e.write(relation);
+                        for (const auto& node : run.objects<osmium::Node>()) {
+                            check_order.node(node);
                         }
-                        return;
+                        break;
                     case osmium::item_type::way:
-                        if (e.way_ids.get(member.positive_ref())) {
-                            e.write(relation);
+                        for (const auto& way : run.objects<osmium::Way>()) {
+                            check_order.way(way);
                         }
-                        return;
+                        break;
+                    case osmium::item_type::relation:
+                        for (const auto& relation : run.objects<osmium::Relation>()) {
+                            check_order.relation(relation);
+                        }
+                        break;
                     default:
                         break;
                 }
-            }
+
+                if (run.type() != last_type) {
+                    while (!pending.empty()) {
+                        write_first();
+                    }
+                    last_type = run.type();
+                } else if (pending.size() >= max_pending) {
+                    write_first();
+                }
+
+                pending.push_back(pool.submit([this, buffer_ptr, run]() {
+                    const TraceSpan span{"extract handlers (thread)"};
+                    return check_run(buffer_ptr, run);
+                }));
+            });
         }
 
-    }; // class Pass1
+        while (!pending.empty()) {
+            write_first();
+        }
+
+        if (metrics()) {
+            metrics()->add("bytes_read", reader.offset());
+        }
+        reader.close();
+
+        if (metrics()) {
+            metrics()->end_phase();
+        }
+    }
 
     void Strategy::run(osmium::VerboseOutput& vout, bool display_progress, const osmium::io::File& input_file) {
         vout << "Running 'simple' strategy in one pass...\n";
+        if (locations_on_ways()) {
+            vout << "Using node locations on ways to find ways in extracts.\n";
+        }
         const std::size_t file_size = input_file.filename().empty() ? 0 : osmium::file_size(input_file.filename());
         osmium::ProgressBar progress_bar{file_size, display_progress};
 
-        Pass1 pass1{*this};
-        pass1.run(progress_bar, input_file);
+        // With fewer extracts than threads, distributing the extracts over
+        // the threads can't use all of them, so the objects are distributed
+        // instead.
+        if (num_threads() > 1 && m_extracts.size() < static_cast<std::size_t>(num_threads())) {
+            vout << "Checking objects against the extracts using " << num_threads() << " threads.\n";
+            run_parallel(progress_bar, input_file);
+        } else {
+            Pass1 pass1{*this};
+            pass1.run(progress_bar, input_file);
+        }
 
         progress_bar.done();
     }
@@ -23,9 +23,15 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 */
 
+#include "id_set.hpp"
 #include "strategy.hpp"
+#include "../object_runs.hpp"
 
-#include <osmium/index/id_set.hpp>
+#include <osmium/io/file.hpp>
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm/item_type.hpp>
+#include <osmium/osm/object.hpp>
+#include <osmium/util/progress_bar.hpp>
 
 #include <memory>
 #include <vector>
@@ -33,8 +39,13 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 namespace strategy_simple {
 
     struct Data {
-        osmium::index::IdSetDense<osmium::unsigned_object_id_type> node_ids;
-        osmium::index::IdSetDense<osmium::unsigned_object_id_type> way_ids;
+        ExtractIdSet node_ids;
+        ExtractIdSet way_ids;
+
+        void set_id_set_type(id_set_type type) noexcept {
+            node_ids.set_type(type);
+            way_ids.set_type(type);
+        }
     };
 
     class Strategy : public ExtractStrategy {
@@ -45,6 +56,25 @@ namespace strategy_simple {
         using extract_data = ExtractData<Data>;
         std::vector<extract_data> m_extracts;
 
+        // The objects of a run of objects of the same type which are in
+        // each of the extracts.
+        struct run_result {
+            // Keeps the buffer with the objects alive.
+            std::shared_ptr<osmium::memory::Buffer> buffer;
+            osmium::item_type type;
+            std::vector<std::vector<const osmium::OSMObject*>> objects;
+        };
+
+        // Check the objects of the run against all extracts. Only reads
+        // the ID sets, so it can be called from several threads at the
+        // same time as long as nothing is written to them.
+        run_result check_run(const std::shared_ptr<osmium::memory::Buffer>& buffer, const ObjectRun& run) const;
+
+        // Write the objects to the extracts and remember their IDs.
+        void write_result(const run_result& result);
+
+        void run_parallel(osmium::ProgressBar& progress_bar, const osmium::io::File& input_file);
+
     public:
 
         explicit Strategy(const std::vector<std::unique_ptr<Extract>>& extracts, const osmium::Options& /*options*/);
@@ -0,0 +1,168 @@
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "strategy_simple_with_history.hpp"
+#include "../util.hpp"
+
+#include <osmium/io/error.hpp>
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm/item_type.hpp>
+#include <osmium/osm/object.hpp>
+#include <osmium/util/file.hpp>
+
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace strategy_simple_with_history {
+
+    Strategy::Strategy(const std::vector<std::unique_ptr<Extract>>& extracts, const osmium::Options& options) {
+        m_extracts.reserve(extracts.size());
+        for (const auto& extract : extracts) {
+            m_extracts.emplace_back(*extract);
+        }
+
+        for (const auto& option : options) {
+            warning(std::string{"Ignoring unknown option '"} + option.first + "' for 'simple' strategy.\n");
+        }
+    }
+
+    const char* Strategy::name() const noexcept {
+        return "simple";
+    }
+
+    /**
+     * All versions of an object are next to each other in a history file.
+     * They are collected in a buffer while the handlers for the extracts
+     * decide whether any of the versions is in the extract. When the next
+     * object starts, all versions are written to the extracts it was in.
+     * So only the versions of one object are kept in memory.
+     */
+    class Pass1 : public Pass<Strategy, Pass1> {
+
+        osmium::memory::Buffer m_versions{1024 * 1024, osmium::memory::Buffer::auto_grow::yes};
+        osmium::item_type m_current_type = osmium::item_type::undefined;
+        bool m_current_positive = false;
+        osmium::unsigned_object_id_type m_current_id = 0;
+
+        void next_object(const osmium::OSMObject& object) {
+            // Same order as in sorted OSM files: by type, negative IDs
+            // before positive IDs, then by absolute value of the ID.
+            const auto current = std::make_tuple(m_current_type, m_current_positive, m_current_id);
+            const auto next = std::make_tuple(object.type(), object.id() > 0, object.positive_id());
+            if (next != current) {
+                if (next < current) {
+                    throw osmium::io_error{"Input file is not ordered by type and ID."};
+                }
+                flush();
+                m_current_type = object.type();
+                m_current_positive = object.id() > 0;
+                m_current_id = object.positive_id();
+            }
+            m_versions.add_item(object);
+            m_versions.commit();
+        }
+
+    public:
+
+        // next_object() must see each object before the extract handlers
+        static constexpr const bool parallel_extracts = false;
+        static constexpr const bool enode_in_envelope_only = true;
+
+        explicit Pass1(Strategy& strategy) :
+            Pass(strategy) {
+        }
+
+        // Write out the versions of the current object to all extracts
+        // any of them was in.
+        void flush() {
+            for (auto& e : extracts()) {
+                if (e.current_matches) {
+                    for (const auto& object : m_versions.select<osmium::OSMObject>()) {
+                        e.write(object);
+                    }
+                    e.current_matches = false;
+                }
+            }
+            m_versions.clear();
+        }
+
+        void node(const osmium::Node& node) {
+            next_object(node);
+        }
+
+        bool enode(extract_data& e, const osmium::Node& node) {
+            if (e.contains(node.location())) {
+                e.node_ids.set(node.positive_id());
+                e.current_matches = true;
+                return true;
+            }
+            return false;
+        }
+
+        void way(const osmium::Way& way) {
+            next_object(way);
+        }
+
+        void eway(extract_data& e, const osmium::Way& way) {
+            if (e.current_matches) {
+                return;
+            }
+            if (e.node_ids.any_of(way.nodes())) {
+                e.way_ids.set(way.positive_id());
+                e.current_matches = true;
+            }
+        }
+
+        void relation(const osmium::Relation& relation) {
+            next_object(relation);
+        }
+
+        void erelation(extract_data& e, const osmium::Relation& relation) {
+            if (e.current_matches) {
+                return;
+            }
+            for (const auto& member : relation.members()) {
+                if ((member.type() == osmium::item_type::node && e.node_ids.get(member.positive_ref())) ||
+                    (member.type() == osmium::item_type::way && e.way_ids.get(member.positive_ref()))) {
+                    e.current_matches = true;
+                    return;
+                }
+            }
+        }
+
+    }; // class Pass1
+
+    void Strategy::run(osmium::VerboseOutput& vout, bool display_progress, const osmium::io::File& input_file) {
+        vout << "Running 'simple' strategy for history files in one pass...\n";
+        const std::size_t file_size = input_file.filename().empty() ? 0 : osmium::file_size(input_file.filename());
+        osmium::ProgressBar progress_bar{file_size, display_progress};
+
+        Pass1 pass1{*this};
+        pass1.run(progress_bar, input_file);
+        pass1.flush();
+
+        progress_bar.done();
+    }
+
+} // namespace strategy_simple_with_history
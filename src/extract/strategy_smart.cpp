@@ -27,25 +27,15 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <osmium/util/misc.hpp>
 #include <osmium/util/string.hpp>
 
-namespace strategy_smart {
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
 
-    void Data::add_relation_members(const osmium::Relation& relation) {
-        for (const auto& member : relation.members()) {
-            const auto ref = member.positive_ref();
-            switch (member.type()) {
-                case osmium::item_type::node:
-                    extra_node_ids.set(ref);
-                    break;
-                case osmium::item_type::way:
-                    extra_way_ids.set(ref);
-                    break;
-                default:
-                    break;
-            }
-        }
-    }
+namespace strategy_smart {
 
-    void Data::add_relation_parents(osmium::unsigned_object_id_type id, const osmium::index::RelationsMapIndex& map) {
+    void Data::add_relation_parents(osmium::unsigned_object_id_type id, const CompactRelationsMapIndex& map) {
         map.for_each_parent(id, [&](osmium::unsigned_object_id_type parent_id) {
             if (!relation_ids.get(parent_id) &&
                 !extra_relation_ids.get(parent_id)) {
@@ -77,6 +67,8 @@ namespace strategy_smart {
                         m_complete_partial_relations_percentage = 100;
                     }
                 }
+            } else if (option.first == "cache-ways") {
+                m_cache_ways = option.second.empty() || option.second == "true" || option.second == "yes";
             } else {
                 warning(std::string{"Ignoring unknown option '"} + option.first + "' for 'smart' strategy.\n");
             }
@@ -123,87 +115,199 @@ namespace strategy_smart {
         } else {
             vout << "  - [complete-partial-relations] complete partial relations when " << m_complete_partial_relations_percentage << "% or more members are in extract\n";
         }
+        vout << "  - [cache-ways] keep ways in memory for second pass: " << yes_no(m_cache_ways);
         vout << '\n';
     }
 
+    /**
+     * The node and way members of the relations in the current buffer in
+     * columns indexed by the slot of the relation (its position among the
+     * relations in the buffer). The member lists of the relations are
+     * walked only once, not once for every extract, and the extracts only
+     * look at compact arrays of IDs.
+     */
+    class RelationMemberColumns {
+
+        // The members of slot n are at m_offsets[n] up to m_offsets[n + 1].
+        std::vector<std::size_t> m_offsets{0};
+        std::vector<osmium::unsigned_object_id_type> m_refs;
+        std::vector<uint8_t> m_is_way;
+
+        // Per slot: ID of the relation, number of all members (including
+        // relation members), and the result of check_type().
+        std::vector<osmium::unsigned_object_id_type> m_ids;
+        std::vector<std::size_t> m_sizes;
+        std::vector<uint8_t> m_complete_type;
+
+    public:
+
+        void add(const osmium::Relation& relation, bool complete_type) {
+            for (const auto& member : relation.members()) {
+                if (member.type() == osmium::item_type::node || member.type() == osmium::item_type::way) {
+                    m_refs.push_back(member.positive_ref());
+                    m_is_way.push_back(member.type() == osmium::item_type::way);
+                }
+            }
+            m_offsets.push_back(m_refs.size());
+            m_ids.push_back(relation.positive_id());
+            m_sizes.push_back(relation.members().size());
+            m_complete_type.push_back(complete_type);
+        }
+
+        void clear() {
+            m_offsets.resize(1);
+            m_refs.clear();
+            m_is_way.clear();
+            m_ids.clear();
+            m_sizes.clear();
+            m_complete_type.clear();
+        }
+
+        osmium::unsigned_object_id_type id(std::size_t slot) const noexcept {
+            return m_ids[slot];
+        }
+
+        std::size_t size(std::size_t slot) const noexcept {
+            return m_sizes[slot];
+        }
+
+        bool complete_type(std::size_t slot) const noexcept {
+            return m_complete_type[slot] != 0;
+        }
+
+        std::size_t begin(std::size_t slot) const noexcept {
+            return m_offsets[slot];
+        }
+
+        std::size_t end(std::size_t slot) const noexcept {
+            return m_offsets[slot + 1];
+        }
+
+        osmium::unsigned_object_id_type ref(std::size_t n) const noexcept {
+            return m_refs[n];
+        }
+
+        bool is_way(std::size_t n) const noexcept {
+            return m_is_way[n] != 0;
+        }
+
+    }; // class RelationMemberColumns
+
     class Pass1 : public Pass<Strategy, Pass1> {
 
         osmium::handler::CheckOrder m_check_order;
-        osmium::index::RelationsMapStash m_relations_map_stash;
+        CompactRelationsMapStash m_relations_map_stash;
+
+        RelationMemberColumns m_members;
+
+        // The slot of the next relation for each extract. Every extract is
+        // only handled by one thread at a time, so each thread only
+        // changes its own entries.
+        std::vector<std::size_t> m_next_slot;
+
+        std::size_t next_slot(const extract_data& e) noexcept {
+            return m_next_slot[static_cast<std::size_t>(&e - extracts().data())]++;
+        }
+
+        void add_members(extract_data& e, std::size_t slot) {
+            for (std::size_t n = m_members.begin(slot); n < m_members.end(slot); ++n) {
+                if (m_members.is_way(n)) {
+                    e.extra_way_ids.set(m_members.ref(n));
+                } else {
+                    e.extra_node_ids.set(m_members.ref(n));
+                }
+            }
+        }
 
     public:
 
+        static constexpr const bool enode_in_envelope_only = true;
+        static constexpr const bool use_node_index = true;
+
         explicit Pass1(Strategy& strategy) :
-            Pass(strategy) {
+            Pass(strategy),
+            m_next_slot(strategy.m_extracts.size(), 0) {
         }
 
         void node(const osmium::Node& node) {
             m_check_order.node(node);
         }
 
-        void enode(extract_data& e, const osmium::Node& node) {
+        bool enode(extract_data& e, const osmium::Node& node) {
             if (e.contains(node.location())) {
                 e.node_ids.set(node.positive_id());
+                return true;
             }
+            return false;
         }
 
         void way(const osmium::Way& way) {
             m_check_order.way(way);
+            if (strategy().m_cache_ways) {
+                strategy().m_way_cache.add(way);
+            }
+            if (has_node_index()) {
+                for (const auto i : way_extracts(way)) {
+                    extracts()[i].way_ids.set(way.positive_id());
+                }
+            }
         }
 
         void eway(extract_data& e, const osmium::Way& way) {
-            for (const auto& nr : way.nodes()) {
-                if (e.node_ids.get(nr.positive_ref())) {
-                    e.way_ids.set(way.positive_id());
-                    return;
-                }
+            if (has_node_index()) {
+                return;
+            }
+            if (e.node_ids.any_of(way.nodes())) {
+                e.way_ids.set(way.positive_id());
             }
         }
 
         void relation(const osmium::Relation& relation) {
             m_check_order.relation(relation);
+            if (has_node_index()) {
+                release_node_index();
+            }
             m_relations_map_stash.add_members(relation);
+            m_members.add(relation, strategy().check_type(relation));
         }
 
         void erelation(extract_data& e, const osmium::Relation& relation) {
+            const auto slot = next_slot(e);
+            assert(m_members.id(slot) == relation.positive_id());
+
+            const auto size = m_members.size(slot);
+            const auto end = m_members.end(slot);
             std::size_t wanted_members = 0;
-            for (const auto& member : relation.members()) {
-                switch (member.type()) {
-                    case osmium::item_type::node:
-                        if (e.node_ids.get(member.positive_ref())) {
-                            if (wanted_members == 0) {
-                                e.relation_ids.set(relation.positive_id());
-                                if (strategy().check_type(relation)) {
-                                    e.add_relation_members(relation);
-                                    return;
-                                }
-                            }
-                            ++wanted_members;
+            for (std::size_t n = m_members.begin(slot); n < end; ++n) {
+                const auto ref = m_members.ref(n);
+                if (m_members.is_way(n) ? e.way_ids.get(ref) : e.node_ids.get(ref)) {
+                    if (wanted_members == 0) {
+                        e.relation_ids.set(relation.positive_id());
+                        if (m_members.complete_type(slot)) {
+                            add_members(e, slot);
+                            return;
                         }
-                        break;
-                    case osmium::item_type::way:
-                        if (e.way_ids.get(member.positive_ref())) {
-                            if (wanted_members == 0) {
-                                e.relation_ids.set(relation.positive_id());
-                                if (strategy().check_type(relation)) {
-                                    e.add_relation_members(relation);
-                                    return;
-                                }
-                            }
-                            ++wanted_members;
-                        }
-                        break;
-                    default:
-                        break;
+                    }
+                    ++wanted_members;
+                } else if (wanted_members > 0 &&
+                           !strategy().check_members_count(size, wanted_members + (end - n - 1))) {
+                    // Even if all remaining members are in the extract,
+                    // there will not be enough of them.
+                    return;
                 }
             }
 
-            if (strategy().check_members_count(relation.members().size(), wanted_members)) {
-                e.add_relation_members(relation);
+            if (strategy().check_members_count(size, wanted_members)) {
+                add_members(e, slot);
             }
         }
 
-        osmium::index::RelationsMapStash& relations_map_stash() noexcept {
+        void buffer_done() {
+            m_members.clear();
+            std::fill(m_next_slot.begin(), m_next_slot.end(), 0);
+        }
+
+        CompactRelationsMapStash& relations_map_stash() noexcept {
             return m_relations_map_stash;
         }
 
@@ -260,7 +364,7 @@ namespace strategy_smart {
     }; // class Pass3
 
     void Strategy::run(osmium::VerboseOutput& vout, bool display_progress, const osmium::io::File& input_file) {
-        if (input_file.filename().empty()) {
+        if (is_stdin_or_pipe(input_file.filename())) {
             throw osmium::io_error{"Can not read from STDIN when using 'smart' strategy."};
         }
 
@@ -284,7 +388,13 @@ namespace strategy_smart {
         progress_bar.remove();
         vout << "Second pass (of three)...\n";
         Pass2 pass2{*this};
-        pass2.run(progress_bar, input_file, osmium::osm_entity_bits::way, osmium::io::read_meta::no);
+        if (m_cache_ways) {
+            vout << "Using " << (m_way_cache.bytes() / (1024 * 1024)) << " MBytes of ways cached in first pass.\n";
+            pass2.replay(m_way_cache);
+            m_way_cache.clear();
+        } else {
+            pass2.run(progress_bar, input_file, osmium::osm_entity_bits::way, osmium::io::read_meta::no);
+        }
         progress_bar.file_done(file_size);
 
         progress_bar.remove();
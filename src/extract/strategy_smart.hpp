@@ -23,10 +23,11 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 */
 
+#include "id_set.hpp"
 #include "strategy.hpp"
+#include "../relations_map.hpp"
 
 #include <osmium/index/id_set.hpp>
-#include <osmium/index/relations_map.hpp>
 
 #include <memory>
 #include <string>
@@ -35,15 +36,22 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 namespace strategy_smart {
 
     struct Data {
-        osmium::index::IdSetDense<osmium::unsigned_object_id_type> node_ids;
-        osmium::index::IdSetDense<osmium::unsigned_object_id_type> extra_node_ids;
-        osmium::index::IdSetDense<osmium::unsigned_object_id_type> way_ids;
-        osmium::index::IdSetDense<osmium::unsigned_object_id_type> extra_way_ids;
+        ExtractIdSet node_ids;
+        ExtractIdSet extra_node_ids;
+        ExtractIdSet way_ids;
+        ExtractIdSet extra_way_ids;
         osmium::index::IdSetDense<osmium::unsigned_object_id_type> relation_ids;
-        osmium::index::IdSetDense<osmium::unsigned_object_id_type> extra_relation_ids;
+        ExtractIdSet extra_relation_ids;
 
-        void add_relation_members(const osmium::Relation& relation);
-        void add_relation_parents(osmium::unsigned_object_id_type id, const osmium::index::RelationsMapIndex& map);
+        void set_id_set_type(id_set_type type) noexcept {
+            node_ids.set_type(type);
+            extra_node_ids.set_type(type);
+            way_ids.set_type(type);
+            extra_way_ids.set_type(type);
+            extra_relation_ids.set_type(type);
+        }
+
+        void add_relation_parents(osmium::unsigned_object_id_type id, const CompactRelationsMapIndex& map);
     };
 
     class Strategy : public ExtractStrategy {
@@ -58,6 +66,9 @@ namespace strategy_smart {
 
         std::size_t m_complete_partial_relations_percentage = 100;
 
+        bool m_cache_ways = false;
+        ObjectCache m_way_cache;
+
         bool check_members_count(const std::size_t size, const std::size_t wanted_members) const noexcept;
         bool check_type(const osmium::Relation& relation) const noexcept;
 
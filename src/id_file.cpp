@@ -8,6 +8,11 @@
 #include <osmium/osm/relation.hpp>
 #include <osmium/osm/way.hpp>
 
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
 void add_nodes(const osmium::Way& way, ids_type& ids) {
     for (const auto& nr : way.nodes()) {
         ids(osmium::item_type::node).set(nr.positive_ref());
@@ -43,8 +48,61 @@ void parse_and_add_id(const std::string& s, ids_type& ids, osmium::item_type def
     ids(p.first).set(static_cast<osmium::unsigned_object_id_type>(p.second));
 }
 
-void read_id_file(std::istream& stream, ids_type& ids, osmium::item_type default_item_type) {
-    for (std::string line; std::getline(stream, line);) {
+namespace {
+
+    // Parse a line with the usual format (optional spaces, optional
+    // type character, digits, then end of line, space, or comment) and
+    // add the ID. Returns false if there is anything unusual in the
+    // line, it has to be parsed with parse_and_add_id() then.
+    bool parse_id_line_fast(const char* begin, const char* end, ids_type& ids, osmium::item_type default_item_type) {
+        while (begin != end && *begin == ' ') {
+            ++begin;
+        }
+        if (begin == end || *begin == '#') {
+            return true; // empty line or comment
+        }
+
+        auto type = default_item_type;
+        switch (*begin) {
+            case 'n':
+                type = osmium::item_type::node;
+                ++begin;
+                break;
+            case 'w':
+                type = osmium::item_type::way;
+                ++begin;
+                break;
+            case 'r':
+                type = osmium::item_type::relation;
+                ++begin;
+                break;
+            default:
+                break;
+        }
+
+        // At most 18 digits, so the ID can not overflow.
+        const char* const digits = begin;
+        const char* const digits_end = (end - begin) > 18 ? begin + 18 : end;
+        osmium::unsigned_object_id_type id = 0;
+        while (begin != digits_end && static_cast<unsigned char>(*begin - '0') < 10) {
+            id = id * 10 + static_cast<osmium::unsigned_object_id_type>(*begin - '0');
+            ++begin;
+        }
+
+        if (begin == digits || (begin != end && *begin != ' ' && *begin != '#')) {
+            return false;
+        }
+
+        ids(type).set(id);
+        return true;
+    }
+
+    void parse_id_line(const char* begin, const char* end, ids_type& ids, osmium::item_type default_item_type) {
+        if (parse_id_line_fast(begin, end, ids, default_item_type)) {
+            return;
+        }
+
+        std::string line{begin, end};
         strip_whitespace(line);
         const auto pos = line.find_first_of(" #");
         if (pos != std::string::npos) {
@@ -54,6 +112,87 @@ void read_id_file(std::istream& stream, ids_type& ids, osmium::item_type default
             parse_and_add_id(line, ids, default_item_type);
         }
     }
+
+} // anonymous namespace
+
+void read_id_file(std::istream& stream, ids_type& ids, osmium::item_type default_item_type) {
+    // The file is read in large chunks and parsed in place. Only the
+    // last incomplete line of a chunk is kept for the next one.
+    std::vector<char> buffer(1024UL * 1024UL);
+    std::size_t kept = 0;
+
+    while (stream) {
+        if (kept == buffer.size()) { // line longer than the buffer
+            buffer.resize(buffer.size() * 2);
+        }
+        stream.read(buffer.data() + kept, static_cast<std::streamsize>(buffer.size() - kept));
+
+        const char* line = buffer.data();
+        const char* const end = line + kept + static_cast<std::size_t>(stream.gcount());
+        while (const char* nl = static_cast<const char*>(std::memchr(line, '\n', static_cast<std::size_t>(end - line)))) {
+            parse_id_line(line, nl, ids, default_item_type);
+            line = nl + 1;
+        }
+
+        kept = static_cast<std::size_t>(end - line);
+        std::memmove(buffer.data(), line, kept);
+    }
+
+    if (kept > 0) {
+        parse_id_line(buffer.data(), buffer.data() + kept, ids, default_item_type);
+    }
+}
+
+template <typename TIdSet>
+static void add_member_relations_impl(const CompactRelationsMapIndex& rel_in_rel,
+                                      TIdSet& relation_ids) {
+    std::vector<osmium::unsigned_object_id_type> frontier{relation_ids.begin(), relation_ids.end()};
+    std::vector<osmium::unsigned_object_id_type> next;
+
+    while (!frontier.empty()) {
+        // The index is sorted, looking up IDs in order keeps the accesses
+        // local.
+        std::sort(frontier.begin(), frontier.end());
+        for (const auto parent_id : frontier) {
+            rel_in_rel.for_each(parent_id, [&](osmium::unsigned_object_id_type member_id) {
+                if (relation_ids.check_and_set(member_id)) {
+                    next.push_back(member_id);
+                }
+            });
+        }
+        frontier.clear();
+        using std::swap;
+        swap(frontier, next);
+    }
+}
+
+void add_member_relations(const CompactRelationsMapIndex& rel_in_rel,
+                          osmium::index::IdSetDense<osmium::unsigned_object_id_type>& relation_ids) {
+    add_member_relations_impl(rel_in_rel, relation_ids);
+}
+
+void add_member_relations(const CompactRelationsMapIndex& rel_in_rel,
+                          AdaptiveIdSet& relation_ids) {
+    add_member_relations_impl(rel_in_rel, relation_ids);
+}
+
+std::vector<pbf_object_key> get_pbf_object_keys(const ids_type& ids) {
+    std::vector<pbf_object_key> keys;
+    for (const auto type : {osmium::item_type::node, osmium::item_type::way, osmium::item_type::relation}) {
+        for (const osmium::unsigned_object_id_type id : ids(type)) {
+            pbf_object_key key;
+            key.type = type;
+            key.id = id;
+            key.positive = id != 0;
+            keys.push_back(key);
+            if (id != 0) {
+                key.positive = false;
+                keys.push_back(key);
+            }
+        }
+    }
+    std::sort(keys.begin(), keys.end());
+    return keys;
 }
 
 bool no_ids(const ids_type& ids) noexcept {
@@ -1,6 +1,10 @@
 #ifndef ID_FILES_HPP
 #define ID_FILES_HPP
 
+#include "adaptive_id_set.hpp"
+#include "pbf_blocks.hpp"
+#include "relations_map.hpp"
+
 #include <osmium/index/id_set.hpp>
 #include <osmium/index/nwr_array.hpp>
 #include <osmium/osm/item_type.hpp>
@@ -8,8 +12,9 @@
 #include <osmium/osm/way.hpp>
 
 #include <string>
+#include <vector>
 
-using ids_type = osmium::nwr_array<osmium::index::IdSetDense<osmium::unsigned_object_id_type>>;
+using ids_type = osmium::nwr_array<AdaptiveIdSet>;
 
 void add_nodes(const osmium::Way& way, ids_type& ids);
 void read_id_osm_file(const std::string& file_name, ids_type& ids);
@@ -17,6 +22,25 @@ void read_id_osm_file(const std::string& file_name, ids_type& ids);
 void parse_and_add_id(const std::string& s, ids_type& ids, osmium::item_type default_item_type);
 void read_id_file(std::istream& stream, ids_type& ids, osmium::item_type default_item_type);
 
+/**
+ * Add all relations that are (directly or indirectly) members of the
+ * relations in relation_ids to relation_ids. This works breadth-first
+ * on one frontier of newly found relations at a time, so it doesn't
+ * recurse and handles arbitrarily deep nesting and loops.
+ */
+void add_member_relations(const CompactRelationsMapIndex& rel_in_rel,
+                          osmium::index::IdSetDense<osmium::unsigned_object_id_type>& relation_ids);
+
+void add_member_relations(const CompactRelationsMapIndex& rel_in_rel,
+                          AdaptiveIdSet& relation_ids);
+
+/**
+ * Get the sorted keys of all objects in the ID sets for looking them up in
+ * a PBF block index. The ID sets only contain the absolute value of the
+ * IDs, so there is a key for the positive and the negative ID.
+ */
+std::vector<pbf_object_key> get_pbf_object_keys(const ids_type& ids);
+
 bool no_ids(const ids_type& ids) noexcept;
 
 #endif // ID_FILES_HPP
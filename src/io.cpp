@@ -22,20 +22,46 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "cmd.hpp"
 #include "exception.hpp"
+#include "pbf_blocks.hpp"
+#include "remote_file.hpp"
 #include "util.hpp"
 
 #include <osmium/io/any_input.hpp> // IWYU pragma: keep
 #include <osmium/io/any_output.hpp> // IWYU pragma: keep
 #include <osmium/io/file.hpp>
+#include <osmium/io/file_format.hpp>
 #include <osmium/io/header.hpp>
 #include <osmium/io/writer_options.hpp>
 #include <osmium/util/verbose_output.hpp>
 
 #include <boost/program_options.hpp>
 
+#include <cstdlib>
 #include <string>
 #include <vector>
 
+namespace {
+
+    /**
+     * The libosmium Reader and Writer do the (de)compression and
+     * (de)coding of blocks on the default thread pool. It reads its size
+     * from the OSMIUM_POOL_THREADS environment variable when it is first
+     * used, so setting the variable here, before any file is opened,
+     * changes the number of worker threads. The Writer always writes the
+     * blocks in the order they were submitted, so the output doesn't
+     * depend on the number of threads.
+     */
+    void set_pool_threads(int num_threads) {
+        const std::string value{std::to_string(num_threads)};
+#ifdef _WIN32
+        _putenv_s("OSMIUM_POOL_THREADS", value.c_str());
+#else
+        ::setenv("OSMIUM_POOL_THREADS", value.c_str(), 1);
+#endif
+    }
+
+} // anonymous namespace
+
 void with_single_osm_input::setup_input_file(const boost::program_options::variables_map& vm) {
     if (vm.count("input-filename")) {
         m_input_filename = vm["input-filename"].as<std::string>();
@@ -57,7 +83,7 @@ void with_single_osm_input::setup_input_file(const boost::program_options::varia
         }
     }
 
-    m_input_file = osmium::io::File{m_input_filename, m_input_format};
+    m_input_file = osmium::io::File{remote_url(m_input_filename), m_input_format};
 }
 
 po::options_description with_single_osm_input::add_single_input_options() {
@@ -103,7 +129,7 @@ void with_multiple_osm_inputs::setup_input_files(const boost::program_options::v
     }
 
     for (const std::string& input_filename : m_input_filenames) {
-        osmium::io::File input_file{input_filename, m_input_format};
+        osmium::io::File input_file{remote_url(input_filename), m_input_format};
         m_input_files.push_back(input_file);
     }
 }
@@ -152,6 +178,33 @@ void with_osm_output::init_output_file(const po::variables_map& vm) {
     if (vm.count("fsync")) {
         m_fsync = osmium::io::fsync::yes;
     }
+
+    if (vm.count("output-threads")) {
+        m_output_threads = vm["output-threads"].as<int>();
+        if (m_output_threads < 1) {
+            throw argument_error{"The --output-threads option must be at least 1."};
+        }
+        set_pool_threads(m_output_threads);
+    }
+
+    if (vm.count("output-compression")) {
+        m_output_compression = vm["output-compression"].as<std::string>();
+    }
+
+    if (vm.count("output-compression-level")) {
+        m_output_compression_level = vm["output-compression-level"].as<int>();
+        if (m_output_compression_level < 0) {
+            throw argument_error{"The --output-compression-level option must be at least 0."};
+        }
+    }
+
+    if (vm.count("block-stats")) {
+        m_block_stats = true;
+    }
+
+    if (vm.count("cache-dir")) {
+        m_cache_directory = vm["cache-dir"].as<std::string>();
+    }
 }
 
 void with_osm_output::check_output_file() {
@@ -168,6 +221,16 @@ void with_osm_output::check_output_file() {
 
     m_output_file = osmium::io::File{m_output_filename, m_output_format};
     m_output_file.check();
+    set_pbf_compression(m_output_file, m_output_compression, m_output_compression_level);
+
+    if (m_block_stats) {
+        if (m_output_file.format() != osmium::io::file_format::pbf) {
+            throw argument_error{"The --block-stats option only works with PBF output files."};
+        }
+        if (m_output_filename.empty() || m_output_filename == "-") {
+            throw argument_error{"Can not use --block-stats when writing to STDOUT."};
+        }
+    }
 }
 
 void with_osm_output::setup_output_file(const po::variables_map& vm) {
@@ -185,6 +248,11 @@ po::options_description with_osm_output::add_output_options() {
     ("output,o", po::value<std::string>(), "Output file")
     ("overwrite,O", "Allow existing output file to be overwritten")
     ("output-header", po::value<std::vector<std::string>>(), "Add output header")
+    ("output-threads", po::value<int>(), "Number of threads for encoding output")
+    ("output-compression", po::value<std::string>(), "Compression of PBF blocks (none, zlib)")
+    ("output-compression-level", po::value<int>(), "Compression level for PBF blocks")
+    ("block-stats", "Store statistics for each block in PBF output file")
+    ("cache-dir", po::value<std::string>(), "Take output from or put it into result cache in this directory")
     ;
 
     return options;
@@ -197,6 +265,16 @@ void with_osm_output::show_output_arguments(osmium::VerboseOutput& vout) {
     vout << "    generator: " << m_generator << "\n";
     vout << "    overwrite: " << yes_no(m_output_overwrite == osmium::io::overwrite::allow);
     vout << "    fsync: " << yes_no(m_fsync == osmium::io::fsync::yes);
+    if (m_output_threads > 0) {
+        vout << "    output threads: " << m_output_threads << "\n";
+    }
+    if (!m_output_compression.empty()) {
+        vout << "    output compression: " << m_output_compression << "\n";
+    }
+    if (m_output_compression_level >= 0) {
+        vout << "    output compression level: " << m_output_compression_level << "\n";
+    }
+    vout << "    block statistics: " << yes_no(m_block_stats);
     if (!m_output_headers.empty()) {
         vout << "    output header:\n";
         for (const auto& h : m_output_headers) {
@@ -205,6 +283,12 @@ void with_osm_output::show_output_arguments(osmium::VerboseOutput& vout) {
     }
 }
 
+void with_osm_output::finish_output() const {
+    if (m_block_stats && !m_output_filename.empty()) {
+        add_pbf_block_stats(m_output_filename, m_fsync);
+    }
+}
+
 void with_osm_output::setup_header(osmium::io::Header& header) const {
     header.set("generator", m_generator);
     for (const auto& h : m_output_headers) {
@@ -0,0 +1,195 @@
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "location_index.hpp"
+#include "util.hpp"
+
+#include <osmium/index/map/all.hpp>
+#include <osmium/io/file_format.hpp>
+#include <osmium/osm/location.hpp>
+#include <osmium/osm/types.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <system_error>
+
+#include <sys/stat.h>
+
+#ifndef _WIN32
+# include <unistd.h>
+#endif
+
+uint64_t available_memory() {
+    std::ifstream meminfo{"/proc/meminfo"};
+    std::string line;
+    while (std::getline(meminfo, line)) {
+        if (line.compare(0, 13, "MemAvailable:") == 0) {
+            // The value is in kB.
+            return static_cast<uint64_t>(std::strtoull(line.c_str() + 13, nullptr, 10)) * 1024;
+        }
+    }
+
+#if defined(_SC_PHYS_PAGES) && defined(_SC_PAGE_SIZE)
+    const long pages = ::sysconf(_SC_PHYS_PAGES);
+    const long page_size = ::sysconf(_SC_PAGE_SIZE);
+    if (pages > 0 && page_size > 0) {
+        return static_cast<uint64_t>(pages) * static_cast<uint64_t>(page_size);
+    }
+#endif
+
+    return 0;
+}
+
+static std::string in_mbytes(uint64_t bytes) {
+    return std::to_string(bytes / (1024 * 1024)) + " MB";
+}
+
+location_index_choice select_location_index(const pbf_node_id_stats& stats,
+                                            uint64_t memory,
+                                            const std::function<bool(const std::string&)>& has_type) {
+    if (!stats.valid) {
+        return {"flex_mem", "nothing known about the nodes in the input"};
+    }
+
+    const uint64_t max_id = stats.max_id > 0 ? static_cast<uint64_t>(stats.max_id) : 0;
+    const uint64_t dense_size = (max_id + 1) * sizeof(osmium::Location);
+    const uint64_t sparse_size = stats.nodes * (sizeof(osmium::unsigned_object_id_type) + sizeof(osmium::Location));
+
+    std::string reason{stats.exact ? "" : "about "};
+    reason += std::to_string(stats.nodes) + " nodes with largest ID " + std::to_string(max_id) +
+              ", dense index needs " + in_mbytes(dense_size) +
+              ", sparse index needs " + in_mbytes(sparse_size);
+
+    if (memory == 0) {
+        return {"flex_mem", reason + ", available memory unknown"};
+    }
+    reason += ", " + in_mbytes(memory) + " of memory available";
+
+    const std::string dense_type{has_type("dense_mmap_array") ? "dense_mmap_array" : "dense_mem_array"};
+    const std::string sparse_type{has_type("sparse_mmap_array") ? "sparse_mmap_array" : "sparse_mem_array"};
+
+    // Leave some memory for everything else.
+    const uint64_t usable = memory / 10 * 8;
+
+    if (dense_size <= usable) {
+        return {dense_type, reason};
+    }
+
+    if (sparse_size <= usable) {
+        return {sparse_type, reason};
+    }
+
+    // Nothing fits, the smaller index at least has the best chance.
+    reason += ", neither index fits (consider using --index-file)";
+    if (dense_size <= sparse_size) {
+        return {dense_type, reason};
+    }
+    return {sparse_type, reason};
+}
+
+location_index_choice choose_location_index(const std::vector<osmium::io::File>& files) {
+    pbf_node_id_stats stats;
+    stats.valid = true;
+    stats.exact = true;
+
+    for (const auto& file : files) {
+        if (file.filename().empty() || file.format() != osmium::io::file_format::pbf) {
+            return {"flex_mem", "input is not a PBF file or is read from STDIN"};
+        }
+        const auto file_stats = get_pbf_node_id_stats(file.filename());
+        if (!file_stats.valid) {
+            return {"flex_mem", "input file '" + file.filename() + "' is not sorted and has no block statistics"};
+        }
+        stats.exact = stats.exact && file_stats.exact;
+        stats.nodes += file_stats.nodes;
+        stats.max_id = std::max(stats.max_id, file_stats.max_id);
+    }
+
+    const auto& map_factory = osmium::index::MapFactory<osmium::unsigned_object_id_type, osmium::Location>::instance();
+    return select_location_index(stats, available_memory(), [&map_factory](const std::string& type) {
+        return map_factory.has_map_type(type);
+    });
+}
+
+std::string index_file_identity(const std::string& index_type, const std::vector<osmium::io::File>& files) {
+    std::string identity{"osmium node location index\n" + index_type + '\n'};
+
+    for (const auto& file : files) {
+        if (is_stdin_or_pipe(file.filename())) {
+            return "";
+        }
+        struct stat file_stat{};
+        if (::stat(file.filename().c_str(), &file_stat) != 0) {
+            return "";
+        }
+        identity += std::to_string(file_stat.st_dev) + ' ' +
+                    std::to_string(file_stat.st_ino) + ' ' +
+                    std::to_string(file_stat.st_size) + ' ' +
+                    std::to_string(file_stat.st_mtime) + '\n';
+    }
+
+    return identity;
+}
+
+static std::string index_info_filename(const std::string& filename) {
+    return filename + ".info";
+}
+
+std::string partial_index_filename(const std::string& filename) {
+    return filename + ".part";
+}
+
+bool is_complete_index_file(const std::string& filename, const std::string& identity) {
+    if (identity.empty() || !std::ifstream{filename}.is_open()) {
+        return false;
+    }
+
+    std::ifstream info{index_info_filename(filename)};
+    const std::string contents{std::istreambuf_iterator<char>{info}, std::istreambuf_iterator<char>{}};
+    return contents == identity;
+}
+
+void clear_index_file(const std::string& filename) {
+    std::remove(index_info_filename(filename).c_str());
+    std::remove(partial_index_filename(filename).c_str());
+}
+
+void complete_index_file(const std::string& filename, const std::string& identity) {
+    const std::string partial_filename{partial_index_filename(filename)};
+    if (std::rename(partial_filename.c_str(), filename.c_str()) != 0) {
+        throw std::system_error{errno, std::system_category(), "Renaming '" + partial_filename + "' to '" + filename + "' failed"};
+    }
+
+    if (identity.empty()) {
+        return;
+    }
+
+    // The info file is written last, so an index is only used again if
+    // it was completed.
+    std::ofstream info{index_info_filename(filename)};
+    info << identity;
+}
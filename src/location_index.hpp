@@ -0,0 +1,102 @@
+#ifndef LOCATION_INDEX_HPP
+#define LOCATION_INDEX_HPP
+
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "pbf_blocks.hpp"
+
+#include <osmium/io/file.hpp>
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+ * Node location index type chosen for "--index-type=auto" and a
+ * human readable explanation why it was chosen.
+ */
+struct location_index_choice {
+
+    std::string type;
+    std::string reason;
+
+}; // struct location_index_choice
+
+/**
+ * Memory available for new allocations in bytes. Uses MemAvailable from
+ * /proc/meminfo if possible, the physical memory size otherwise. Returns
+ * 0 if unknown.
+ */
+uint64_t available_memory();
+
+/**
+ * Choose the densest index type which fits into the given amount of
+ * memory based on the node statistics. The has_type function tells
+ * whether an index type is available on this system.
+ */
+location_index_choice select_location_index(const pbf_node_id_stats& stats,
+                                            uint64_t memory,
+                                            const std::function<bool(const std::string&)>& has_type);
+
+/**
+ * Choose an index type for the given input files. Only PBF files can be
+ * inspected, for everything else the "flex_mem" index is used.
+ */
+location_index_choice choose_location_index(const std::vector<osmium::io::File>& files);
+
+/**
+ * Identity of the input files a node location index kept in a file
+ * (--index-file) is built from: the file based index type and the
+ * device, inode, size, and modification time of each input file. Empty
+ * if it can't be determined, for instance when reading from STDIN.
+ */
+std::string index_file_identity(const std::string& index_type, const std::vector<osmium::io::File>& files);
+
+/**
+ * Name of the file an index is built in before it is complete and gets
+ * its final name.
+ */
+std::string partial_index_filename(const std::string& filename);
+
+/**
+ * Is there a complete index in the given file built from the input files
+ * with the given identity? This is recorded in a ".info" file next to
+ * the index.
+ */
+bool is_complete_index_file(const std::string& filename, const std::string& identity);
+
+/**
+ * Remove the info file and any partial index left over from an earlier
+ * run before building the index again. The file based index types add
+ * to the data already in the file.
+ */
+void clear_index_file(const std::string& filename);
+
+/**
+ * Give the partial index its final name and mark it as complete. Must
+ * be called after the index has been sorted.
+ */
+void complete_index_file(const std::string& filename, const std::string& identity);
+
+#endif // LOCATION_INDEX_HPP
@@ -21,6 +21,8 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
 #include "cmd.hpp"
+#include "result_cache.hpp"
+#include "trace.hpp"
 
 #include <osmium/geom/factory.hpp>
 #include <osmium/handler/check_order.hpp>
@@ -106,10 +108,16 @@ int main(int argc, char *argv[]) {
         return return_code::fatal;
     }
 
+    const auto* output = dynamic_cast<const with_osm_output*>(cmd.get());
+    std::unique_ptr<ResultCache> cache;
+
     try {
         if (!cmd->setup(arguments)) {
             return return_code::okay;
         }
+        if (output && !output->cache_directory().empty()) {
+            cache.reset(new ResultCache{output->cache_directory(), command, arguments, output->output_filename()});
+        }
     } catch (const boost::program_options::error& e) {
         std::cerr << "Error parsing command line: " << e.what() << '\n';
         return return_code::fatal;
@@ -120,9 +128,23 @@ int main(int argc, char *argv[]) {
 
     cmd->print_arguments(command);
 
+    bool success = false;
+
     try {
-        if (cmd->run()) {
-            return return_code::okay;
+        if (cache && cache->fetch(output->output_filename(), output->output_overwrite())) {
+            cmd->vout() << "Output taken from result cache '" << cache->filename() << "'.\n";
+            success = true;
+        } else {
+            // Some commands (diff, getid) return false to signal a result
+            // but still write complete output.
+            success = cmd->run();
+            if (output) {
+                output->finish_output();
+            }
+            if (cache && success) {
+                cache->store(output->output_filename());
+                cmd->vout() << "Output stored in result cache '" << cache->filename() << "'.\n";
+            }
         }
     } catch (const std::bad_alloc&) {
         std::cerr << "Out of memory. Read the MEMORY USAGE section of the osmium(1) manpage.\n";
@@ -144,6 +166,14 @@ int main(int argc, char *argv[]) {
         std::cerr << e.what() << '\n';
     }
 
-    return return_code::error;
+    try {
+        cmd->write_metrics(command, success);
+        Tracer::instance().write();
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << '\n';
+        return return_code::error;
+    }
+
+    return success ? return_code::okay : return_code::error;
 }
 
@@ -0,0 +1,137 @@
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "memory_policy.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#ifdef __linux__
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# include <unistd.h>
+#endif
+
+#ifdef __linux__
+
+// From <linux/mempolicy.h> which isn't always installed.
+static constexpr const int mpol_interleave = 3;
+
+// Return the bitmask of NUMA nodes from a list like "0-1,4".
+static uint64_t parse_node_list(const std::string& list) {
+    uint64_t mask = 0;
+    std::istringstream in{list};
+    std::string range;
+    while (std::getline(in, range, ',')) {
+        const auto dash = range.find('-');
+        const auto first = std::stoul(range.substr(0, dash));
+        const auto last = dash == std::string::npos ? first : std::stoul(range.substr(dash + 1));
+        for (auto node = first; node <= last && node < 64; ++node) {
+            mask |= 1ULL << node;
+        }
+    }
+    return mask;
+}
+
+bool set_numa_interleave() {
+    std::ifstream file{"/sys/devices/system/node/online"};
+    std::string list;
+    if (!std::getline(file, list) || list.empty()) {
+        return false;
+    }
+
+    uint64_t mask = 0;
+    try {
+        mask = parse_node_list(list);
+    } catch (...) {
+        return false;
+    }
+
+    unsigned long nodemask = static_cast<unsigned long>(mask); // NOLINT(google-runtime-int)
+    return ::syscall(SYS_set_mempolicy, mpol_interleave, &nodemask, sizeof(nodemask) * 8 + 1) == 0;
+}
+
+std::size_t advise_huge_pages(std::size_t min_size) {
+    constexpr const uintptr_t huge_page_size = 2UL * 1024UL * 1024UL;
+
+    std::ifstream maps{"/proc/self/maps"};
+    std::size_t total = 0;
+    std::string line;
+    while (std::getline(maps, line)) {
+        // Format: "start-end perms offset dev inode [path]". Only private
+        // writable mappings without a file (or the heap) are of interest.
+        std::istringstream in{line};
+        std::string range;
+        std::string perms;
+        std::string offset;
+        std::string dev;
+        std::string inode;
+        std::string path;
+        if (!(in >> range >> perms >> offset >> dev >> inode) || perms.size() < 4 ||
+            perms[0] != 'r' || perms[1] != 'w' || perms[3] != 'p' ||
+            ((in >> path) && path != "[heap]")) {
+            continue;
+        }
+        const auto dash = range.find('-');
+        if (dash == std::string::npos) {
+            continue;
+        }
+        const uintptr_t start = std::stoull(range.substr(0, dash), nullptr, 16);
+        const uintptr_t end = std::stoull(range.substr(dash + 1), nullptr, 16);
+        if (end - start < min_size) {
+            continue;
+        }
+
+        // Only whole huge pages can be advised.
+        const uintptr_t first = (start + huge_page_size - 1) & ~(huge_page_size - 1);
+        const uintptr_t last = end & ~(huge_page_size - 1);
+        if (first >= last) {
+            continue;
+        }
+        void* addr = reinterpret_cast<void*>(first); // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast,performance-no-int-to-ptr)
+        const auto size = static_cast<std::size_t>(last - first);
+#ifdef MADV_HUGEPAGE
+        ::madvise(addr, size, MADV_HUGEPAGE);
+#endif
+#ifdef MADV_COLLAPSE
+        ::madvise(addr, size, MADV_COLLAPSE);
+#endif
+        total += size;
+    }
+
+    return total;
+}
+
+#else
+
+bool set_numa_interleave() {
+    return false;
+}
+
+std::size_t advise_huge_pages(std::size_t /*min_size*/) {
+    return 0;
+}
+
+#endif
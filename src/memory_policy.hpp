@@ -0,0 +1,48 @@
+#ifndef MEMORY_POLICY_HPP
+#define MEMORY_POLICY_HPP
+
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <cstddef>
+
+/**
+ * Set the NUMA memory policy of the process to interleave all memory
+ * allocated from now on over all NUMA nodes. This spreads large indexes
+ * over the memory of all sockets instead of putting them all on the
+ * node of the thread that touches them first. Returns false if this
+ * isn't supported on this system.
+ */
+bool set_numa_interleave();
+
+/**
+ * Ask the kernel to use transparent huge pages for all anonymous memory
+ * mappings of the process with at least min_size bytes. Large indexes
+ * are allocated in their own mappings, so this should be called after
+ * they have been built. On systems which support it the memory is
+ * collapsed into huge pages immediately, otherwise this is done in the
+ * background by the kernel. Returns the number of bytes in the mappings
+ * found (0 if this isn't supported on this system).
+ */
+std::size_t advise_huge_pages(std::size_t min_size);
+
+#endif // MEMORY_POLICY_HPP
@@ -0,0 +1,183 @@
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "metrics.hpp"
+#include "cmd.hpp"
+
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm/item_type.hpp>
+#include <osmium/util/memory.hpp>
+
+#include <rapidjson/prettywriter.h>
+#include <rapidjson/stringbuffer.h>
+
+#include <cerrno>
+#include <fstream>
+#include <string>
+#include <system_error>
+
+namespace {
+
+    double cpu_seconds(std::clock_t start) noexcept {
+        return static_cast<double>(std::clock() - start) / CLOCKS_PER_SEC;
+    }
+
+    template <typename TTimePoint>
+    double wall_seconds(const TTimePoint& start) noexcept {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+} // anonymous namespace
+
+Metrics::Metrics() :
+    m_start_wall(clock_type::now()),
+    m_start_cpu(std::clock()) {
+}
+
+void Metrics::start_phase(const std::string& name) {
+    if (!m_enabled) {
+        return;
+    }
+    end_phase();
+    m_phase_name = name;
+    m_phase_start_wall = clock_type::now();
+    m_phase_start_cpu = std::clock();
+}
+
+void Metrics::end_phase() {
+    if (!m_enabled || m_phase_name.empty()) {
+        return;
+    }
+    const osmium::MemoryUsage mem;
+    m_phases.push_back(phase{m_phase_name,
+                             wall_seconds(m_phase_start_wall),
+                             cpu_seconds(m_phase_start_cpu),
+                             mem.peak()});
+    m_phase_name.clear();
+}
+
+void Metrics::add_buffer(const osmium::memory::Buffer& buffer) {
+    if (!m_enabled) {
+        return;
+    }
+
+    std::uint64_t counts[4] = {0, 0, 0, 0};
+    for (const auto& item : buffer) {
+        switch (item.type()) {
+            case osmium::item_type::node:
+                ++counts[0];
+                break;
+            case osmium::item_type::way:
+                ++counts[1];
+                break;
+            case osmium::item_type::relation:
+                ++counts[2];
+                break;
+            case osmium::item_type::changeset:
+                ++counts[3];
+                break;
+            default:
+                break;
+        }
+    }
+
+    m_counters["buffers"] += 1;
+    m_counters["buffer_bytes"] += buffer.committed();
+    m_counters["nodes"] += counts[0];
+    m_counters["ways"] += counts[1];
+    m_counters["relations"] += counts[2];
+    m_counters["changesets"] += counts[3];
+}
+
+std::string Metrics::json(const std::string& command, const bool success) {
+    end_phase();
+
+    rapidjson::StringBuffer stream;
+    rapidjson::PrettyWriter<rapidjson::StringBuffer> writer{stream};
+
+    writer.StartObject();
+
+    writer.String("command");
+    writer.String(command.c_str());
+
+    writer.String("osmium_version");
+    writer.String(get_osmium_version());
+
+    writer.String("success");
+    writer.Bool(success);
+
+    writer.String("wall_time");
+    writer.Double(wall_seconds(m_start_wall));
+
+    writer.String("cpu_time");
+    writer.Double(cpu_seconds(m_start_cpu));
+
+    const osmium::MemoryUsage mem;
+    writer.String("peak_memory_mb");
+    writer.Int(mem.peak());
+
+    writer.String("phases");
+    writer.StartArray();
+    for (const auto& p : m_phases) {
+        writer.StartObject();
+        writer.String("name");
+        writer.String(p.name.c_str());
+        writer.String("wall_time");
+        writer.Double(p.wall_time);
+        writer.String("cpu_time");
+        writer.Double(p.cpu_time);
+        writer.String("peak_memory_mb");
+        writer.Int(p.peak_memory);
+        writer.EndObject();
+    }
+    writer.EndArray();
+
+    writer.String("counters");
+    writer.StartObject();
+    for (const auto& c : m_counters) {
+        writer.String(c.first.c_str());
+        writer.Uint64(c.second);
+    }
+    writer.EndObject();
+
+    writer.String("values");
+    writer.StartObject();
+    for (const auto& v : m_values) {
+        writer.String(v.first.c_str());
+        writer.Uint64(v.second);
+    }
+    writer.EndObject();
+
+    writer.EndObject();
+
+    return stream.GetString();
+}
+
+void Metrics::write(const std::string& filename, const std::string& command, const bool success) {
+    const auto data = json(command, success);
+
+    std::ofstream out{filename};
+    if (!out) {
+        throw std::system_error{errno, std::system_category(), std::string{"Could not open metrics file '"} + filename + "'"};
+    }
+    out << data << '\n';
+}
@@ -0,0 +1,119 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace osmium {
+    namespace memory {
+        class Buffer;
+    } // namespace memory
+} // namespace osmium
+
+/**
+ * Collects machine-readable numbers about a run of a command: wall and
+ * CPU time for the whole run and for each phase, counters (such as
+ * objects and buffers read) and memory use. They are written out as
+ * JSON if the --metrics option was used.
+ *
+ * All functions must be called from the main thread only.
+ */
+class Metrics {
+
+    using clock_type = std::chrono::steady_clock;
+
+    struct phase {
+        std::string name;
+        double wall_time;
+        double cpu_time;
+        int peak_memory;
+    };
+
+    std::vector<phase> m_phases;
+    std::map<std::string, std::uint64_t> m_counters;
+    std::map<std::string, std::uint64_t> m_values;
+
+    clock_type::time_point m_start_wall;
+    std::clock_t m_start_cpu;
+
+    std::string m_phase_name;
+    clock_type::time_point m_phase_start_wall;
+    std::clock_t m_phase_start_cpu = 0;
+
+    bool m_enabled = false;
+
+public:
+
+    Metrics();
+
+    bool enabled() const noexcept {
+        return m_enabled;
+    }
+
+    void enable() noexcept {
+        m_enabled = true;
+    }
+
+    // Start a new phase with the given name. A phase still running is
+    // ended first.
+    void start_phase(const std::string& name);
+
+    // End the current phase (if any).
+    void end_phase();
+
+    // Add value to the counter with the given name.
+    void add(const std::string& name, std::uint64_t value) {
+        if (m_enabled) {
+            m_counters[name] += value;
+        }
+    }
+
+    // Set the value (such as a memory size) with the given name. Only
+    // the largest value set is kept.
+    void set_max(const std::string& name, std::uint64_t value) {
+        if (m_enabled) {
+            auto& v = m_values[name];
+            if (value > v) {
+                v = value;
+            }
+        }
+    }
+
+    // Count the buffer and the objects of each type in it.
+    void add_buffer(const osmium::memory::Buffer& buffer);
+
+    // Return all metrics as JSON. This ends the current phase.
+    std::string json(const std::string& command, bool success);
+
+    // Write all metrics to the named file as JSON.
+    void write(const std::string& filename, const std::string& command, bool success);
+
+}; // class Metrics
+
+#endif // METRICS_HPP
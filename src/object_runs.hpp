@@ -0,0 +1,83 @@
+#ifndef OBJECT_RUNS_HPP
+#define OBJECT_RUNS_HPP
+
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <osmium/memory/buffer.hpp>
+#include <osmium/memory/item_iterator.hpp>
+#include <osmium/osm/item_type.hpp>
+#include <osmium/osm/object.hpp>
+
+/**
+ * A run of consecutive objects of the same type in a buffer.
+ */
+class ObjectRun {
+
+    const unsigned char* m_first;
+    const unsigned char* m_last;
+    osmium::item_type m_type;
+
+public:
+
+    ObjectRun(const unsigned char* first, const unsigned char* last, osmium::item_type type) noexcept :
+        m_first(first),
+        m_last(last),
+        m_type(type) {
+    }
+
+    osmium::item_type type() const noexcept {
+        return m_type;
+    }
+
+    /// The objects in this run. T must match type().
+    template <typename T>
+    osmium::memory::ItemIteratorRange<const T> objects() const noexcept {
+        return osmium::memory::ItemIteratorRange<const T>{m_first, m_last};
+    }
+
+}; // class ObjectRun
+
+/**
+ * Call func with an ObjectRun for each run of objects of the same type in
+ * the buffer. In sorted data most buffers contain only one or two runs, so
+ * the code handling the objects can branch on the type once per run and
+ * work through the objects of one type in a tight loop instead of looking
+ * at the type of each object. Items which are not OSM objects (such as
+ * changesets) are skipped.
+ */
+template <typename TFunc>
+void for_each_object_run(const osmium::memory::Buffer& buffer, TFunc&& func) {
+    auto it = buffer.cbegin<osmium::OSMObject>();
+    const auto end = buffer.cend<osmium::OSMObject>();
+
+    while (it != end) {
+        const auto type = it->type();
+        const unsigned char* first = it.data();
+        do {
+            ++it;
+        } while (it != end && it->type() == type);
+        func(ObjectRun{first, it.data(), type});
+    }
+}
+
+#endif // OBJECT_RUNS_HPP
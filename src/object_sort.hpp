@@ -0,0 +1,176 @@
+#ifndef OBJECT_SORT_HPP
+#define OBJECT_SORT_HPP
+
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "parallel_sort.hpp"
+
+#include <osmium/osm/object.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+/**
+ * Sort key packing everything needed for comparing two objects by type,
+ * ID, version, and timestamp into 16 bytes next to the object pointer,
+ * so the sort doesn't have to follow the pointers into the buffers.
+ */
+template <typename TPointer>
+struct object_sort_key {
+    std::uint64_t type_id;
+    std::uint32_t version;
+    std::uint32_t timestamp;
+    TPointer object;
+};
+
+template <typename TPointer>
+bool operator<(const object_sort_key<TPointer>& lhs, const object_sort_key<TPointer>& rhs) noexcept {
+    return std::tie(lhs.type_id, lhs.version, lhs.timestamp) <
+           std::tie(rhs.type_id, rhs.version, rhs.timestamp);
+}
+
+enum class version_order {
+    ascending, // like osmium::object_order_type_id_version
+    descending // like osmium::object_order_type_id_reverse_version
+};
+
+// The type is stored in the top 3 bits, then one bit for the sign of
+// the id, the absolute value of the id must fit into the rest.
+constexpr const std::uint64_t max_sort_key_id = 1ULL << 60U;
+
+// Number of bits of the type_id handled in each radix sort pass.
+constexpr const unsigned radix_bits = 8;
+constexpr const std::size_t radix_size = 1UL << radix_bits;
+
+/**
+ * Stable sort of the keys in [first, last). They are sorted by type and
+ * ID with an LSD radix sort, passes for digits which are the same in all
+ * keys (like most of the type bits and the high bits of the IDs) are
+ * skipped. Then the runs of keys with the same type and ID are sorted by
+ * version and timestamp. In history files and change files the runs are
+ * the (short) version chains of the objects, so whole keys are only
+ * compared within them.
+ */
+template <typename TPointer>
+void radix_sort_keys(typename std::vector<object_sort_key<TPointer>>::iterator first,
+                     typename std::vector<object_sort_key<TPointer>>::iterator last) {
+    using key_type = object_sort_key<TPointer>;
+
+    const auto size = static_cast<std::size_t>(last - first);
+    if (size < 2) {
+        return;
+    }
+
+    std::vector<key_type> temp(size);
+    key_type* in = &*first;
+    key_type* out = temp.data();
+
+    for (unsigned shift = 0; shift < 64; shift += radix_bits) {
+        std::array<std::size_t, radix_size> counts{};
+        for (const key_type* key = in; key != in + size; ++key) {
+            ++counts[(key->type_id >> shift) & (radix_size - 1)];
+        }
+        if (std::find(counts.cbegin(), counts.cend(), size) != counts.cend()) {
+            continue;
+        }
+
+        std::size_t sum = 0;
+        for (auto& count : counts) {
+            const auto n = count;
+            count = sum;
+            sum += n;
+        }
+        for (const key_type* key = in; key != in + size; ++key) {
+            out[counts[(key->type_id >> shift) & (radix_size - 1)]++] = *key;
+        }
+
+        using std::swap;
+        swap(in, out);
+    }
+
+    if (in != &*first) {
+        std::copy_n(in, size, first);
+    }
+
+    auto it = first;
+    while (it != last) {
+        auto end = it + 1;
+        while (end != last && end->type_id == it->type_id) {
+            ++end;
+        }
+        if (end - it > 1) {
+            std::stable_sort(it, end);
+        }
+        it = end;
+    }
+}
+
+/**
+ * Stable sort of the object pointers in [first, last) by type, ID,
+ * version, and timestamp using radix_sort_keys() on num_threads threads.
+ * Returns false without changing the range if an ID is too large for
+ * the packed keys, the caller has to use a comparison sort then.
+ *
+ * This needs two times 24 bytes per object while sorting.
+ */
+template <typename TIterator>
+bool radix_sort_objects(TIterator first, TIterator last, int num_threads, version_order order = version_order::ascending) {
+    using pointer_type = typename std::iterator_traits<TIterator>::value_type;
+    using key_type = object_sort_key<pointer_type>;
+
+    std::vector<key_type> keys;
+    keys.reserve(static_cast<std::size_t>(std::distance(first, last)));
+
+    // For descending versions the version and timestamp are inverted.
+    const std::uint32_t invert = order == version_order::descending ? 0xffffffffU : 0U;
+
+    for (auto it = first; it != last; ++it) {
+        const osmium::OSMObject* object = *it;
+        const auto id = object->positive_id();
+        if (id >= max_sort_key_id) {
+            return false;
+        }
+        keys.push_back(key_type{(static_cast<std::uint64_t>(object->type()) << 61U) |
+                                (object->id() > 0 ? max_sort_key_id : 0) | id,
+                                object->version() ^ invert,
+                                object->timestamp().seconds_since_epoch() ^ invert,
+                                *it});
+    }
+
+    parallel_sort_with(keys.begin(), keys.end(), radix_sort_keys<pointer_type>, std::less<key_type>{}, num_threads);
+
+    for (const auto& key : keys) {
+        *first++ = key.object;
+    }
+
+    return true;
+}
+
+#endif // OBJECT_SORT_HPP
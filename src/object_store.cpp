@@ -0,0 +1,326 @@
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "object_store.hpp"
+
+#include "pbf_blocks.hpp"
+
+#include <osmium/io/detail/read_write.hpp>
+#include <osmium/io/error.hpp>
+#include <osmium/io/header.hpp>
+#include <osmium/io/writer_options.hpp>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+# include <fcntl.h>
+# include <unistd.h>
+#endif
+
+static constexpr const char* object_store_magic = "osmium-object-store 1";
+
+static bool same_key(const pbf_object_key& lhs, const pbf_object_key& rhs) noexcept {
+    return !(lhs < rhs) && !(rhs < lhs);
+}
+
+static void rename_file(const std::string& from, const std::string& to) {
+    if (std::rename(from.c_str(), to.c_str()) != 0) {
+        throw osmium::io_error{std::string{"Could not rename file '"} + from + "' to '" + to + "': " + std::strerror(errno)};
+    }
+}
+
+// Make the rename of a file in the directory durable.
+static void fsync_directory(const std::string& directory) {
+#ifndef _WIN32
+    const int fd = ::open(directory.c_str(), O_RDONLY); // NOLINT(hicpp-signed-bitwise)
+    if (fd < 0) {
+        throw osmium::io_error{"Could not open directory '" + directory + "': " + std::strerror(errno)};
+    }
+    osmium::io::detail::reliable_fsync(fd);
+    osmium::io::detail::reliable_close(fd);
+#endif
+}
+
+ObjectStore::ObjectStore(const std::string& directory, const osmium::io::Header& header, osmium::io::fsync fsync) :
+    m_directory(directory),
+    m_header(header),
+    m_fsync(fsync),
+    m_temp_files(directory, "page", ".tmp"),
+    m_temp_filename(m_temp_files.create()) {
+}
+
+ObjectStore::ObjectStore(const std::string& directory, osmium::io::fsync fsync) :
+    m_directory(directory),
+    m_fsync(fsync),
+    m_temp_files(directory, "page", ".tmp"),
+    m_temp_filename(m_temp_files.create()) {
+    const std::string index_filename{filename("index")};
+    std::ifstream in{index_filename};
+    if (!in.is_open()) {
+        throw osmium::io_error{"Directory '" + directory + "' does not contain an object store"};
+    }
+
+    const osmium::io_error format_error{"Object store index '" + index_filename + "' has wrong format"};
+
+    std::string line;
+    if (!std::getline(in, line) || line != object_store_magic) {
+        throw format_error;
+    }
+
+    std::string name;
+    if (!std::getline(in, line)) {
+        throw format_error;
+    }
+    std::istringstream header_line{line};
+    if (!(header_line >> name >> m_next_number) || name != "next_page") {
+        throw format_error;
+    }
+
+    while (std::getline(in, line)) {
+        if (line.empty()) {
+            continue;
+        }
+        std::istringstream page_line{line};
+        page p;
+        std::string min;
+        if (!(page_line >> p.number >> min) || p.number >= m_next_number) {
+            throw format_error;
+        }
+        if (min != "-") {
+            if (m_pages.empty() || !pbf_object_key_from_string(min, p.min)) {
+                throw format_error;
+            }
+            p.has_min = true;
+        }
+        m_pages.push_back(p);
+    }
+
+    if (m_pages.empty() || m_pages.front().has_min) {
+        throw format_error;
+    }
+
+    PBFBlockReader reader{filename("header.osm.pbf")};
+    pbf_block block;
+    if (!reader.read(block) || block.type != "OSMHeader") {
+        throw osmium::io_error{"Missing header in object store '" + directory + "'"};
+    }
+    m_header = decode_pbf_header(block);
+}
+
+std::string ObjectStore::filename(const std::string& name) const {
+    return m_directory + "/" + name;
+}
+
+std::string ObjectStore::page_file(std::size_t number) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "page-%08zu.osm.pbf", number);
+    return filename(name);
+}
+
+std::string ObjectStore::page_filename(std::size_t n) const {
+    return page_file(m_pages[n].number);
+}
+
+std::string ObjectStore::temp_filename() const {
+    return m_temp_filename;
+}
+
+bool ObjectStore::after_page(std::size_t n, const pbf_object_key& key) const {
+    return n + 1 < m_pages.size() && !(key < m_pages[n + 1].min);
+}
+
+// Copy the data blocks of the PBF file into new pages with at most
+// max_blocks blocks each. A page is never split between blocks with
+// the same key, so all versions of an object in history files end up
+// on the same page.
+std::vector<ObjectStore::page> ObjectStore::copy_pages(const std::string& pbf_filename, std::size_t max_blocks) {
+    std::vector<page> pages;
+
+    PBFBlockReader reader{pbf_filename};
+    pbf_block block;
+    if (!reader.read(block) || block.type != "OSMHeader") {
+        throw osmium::io_error{"Missing header block in PBF file '" + pbf_filename + "'"};
+    }
+
+    std::unique_ptr<PBFBlockWriter> writer;
+    std::size_t blocks = 0;
+    pbf_object_key last;
+    while (reader.read(block)) {
+        pbf_object_key min;
+        pbf_object_key max;
+        if (block.type != "OSMData" || !get_pbf_block_range(block, min, max)) {
+            continue;
+        }
+        if (writer && min < last) {
+            throw osmium::io_error{"PBF file '" + pbf_filename + "' is not sorted by type and ID"};
+        }
+        if (!writer || (blocks >= max_blocks && !same_key(last, min))) {
+            if (writer) {
+                writer->close();
+            }
+            page p;
+            p.number = m_next_number++;
+            p.min = min;
+            p.has_min = true;
+            pages.push_back(p);
+            writer.reset(new PBFBlockWriter{page_file(p.number), m_header, osmium::io::overwrite::allow, m_fsync});
+            blocks = 0;
+        }
+        writer->write(block);
+        ++blocks;
+        last = max;
+    }
+
+    if (writer) {
+        writer->close();
+    }
+
+    return pages;
+}
+
+void ObjectStore::create(const std::string& directory, const std::string& pbf_filename, osmium::io::fsync fsync) {
+    std::ifstream index{directory + "/index"};
+    if (index.is_open()) {
+        throw osmium::io_error{"Directory '" + directory + "' already contains an object store"};
+    }
+
+    PBFBlockReader reader{pbf_filename};
+    pbf_block block;
+    if (!reader.read(block) || block.type != "OSMHeader") {
+        throw osmium::io_error{"Missing header block in PBF file '" + pbf_filename + "'"};
+    }
+
+    ObjectStore store{directory, decode_pbf_header(block), fsync};
+    PBFBlockWriter header_writer{store.filename("header.osm.pbf"), store.m_header, osmium::io::overwrite::allow, fsync};
+    header_writer.close();
+
+    store.m_pages = store.copy_pages(pbf_filename, blocks_per_page);
+    if (store.m_pages.empty()) {
+        page p;
+        p.number = store.m_next_number++;
+        PBFBlockWriter writer{store.page_file(p.number), store.m_header, osmium::io::overwrite::allow, fsync};
+        writer.close();
+        store.m_pages.push_back(p);
+    }
+    store.m_pages.front().has_min = false;
+    store.commit();
+}
+
+std::size_t ObjectStore::replace_page(std::size_t n) {
+    const std::string temp{temp_filename()};
+
+    // Pages are only split if they have grown a lot, so that pages
+    // don't get split again and again when only a few objects are
+    // added.
+    std::size_t blocks = 0;
+    {
+        PBFBlockReader reader{temp};
+        pbf_blob_header header;
+        while (reader.read_header(header)) {
+            if (header.type == "OSMData") {
+                ++blocks;
+            }
+        }
+    }
+    const auto max_blocks = blocks > 2 * blocks_per_page ? blocks_per_page : std::numeric_limits<std::size_t>::max();
+
+    auto pages = copy_pages(temp, max_blocks);
+    std::remove(temp.c_str());
+
+    m_obsolete_pages.push_back(m_pages[n].number);
+
+    if (pages.empty()) {
+        if (m_pages.size() > 1) {
+            m_pages.erase(m_pages.begin() + static_cast<std::ptrdiff_t>(n));
+            m_pages.front().has_min = false;
+            return 0;
+        }
+        page p;
+        p.number = m_next_number++;
+        PBFBlockWriter writer{page_file(p.number), m_header, osmium::io::overwrite::allow, m_fsync};
+        writer.close();
+        pages.push_back(p);
+    }
+
+    // The first of the new pages keeps the range of the old page.
+    pages.front().min = m_pages[n].min;
+    pages.front().has_min = m_pages[n].has_min;
+
+    m_pages.erase(m_pages.begin() + static_cast<std::ptrdiff_t>(n));
+    m_pages.insert(m_pages.begin() + static_cast<std::ptrdiff_t>(n), pages.begin(), pages.end());
+
+    return pages.size();
+}
+
+void ObjectStore::write_index() {
+    std::ostringstream out;
+    out << object_store_magic << '\n';
+    out << "next_page " << m_next_number << '\n';
+    for (const auto& p : m_pages) {
+        out << p.number << ' ' << (p.has_min ? pbf_object_key_to_string(p.min) : "-") << '\n';
+    }
+    const std::string data{out.str()};
+
+    const std::string temp{m_temp_files.create()};
+    const int fd = osmium::io::detail::open_for_writing(temp, osmium::io::overwrite::allow);
+    osmium::io::detail::reliable_write(fd, data.data(), data.size());
+    if (m_fsync == osmium::io::fsync::yes) {
+        osmium::io::detail::reliable_fsync(fd);
+    }
+    osmium::io::detail::reliable_close(fd);
+
+    rename_file(temp, filename("index"));
+    if (m_fsync == osmium::io::fsync::yes) {
+        fsync_directory(m_directory);
+    }
+}
+
+void ObjectStore::commit() {
+    write_index();
+    for (const auto number : m_obsolete_pages) {
+        std::remove(page_file(number).c_str());
+    }
+    m_obsolete_pages.clear();
+}
+
+void ObjectStore::write_snapshot(const std::string& output_filename, const osmium::io::Header& header, osmium::io::overwrite overwrite, osmium::io::fsync fsync) const {
+    PBFBlockWriter writer{output_filename, header, overwrite, fsync};
+    pbf_block block;
+    for (const auto& p : m_pages) {
+        PBFBlockReader reader{page_file(p.number)};
+        while (reader.read(block)) {
+            if (block.type == "OSMData") {
+                writer.write(block);
+            }
+        }
+    }
+    writer.close();
+}
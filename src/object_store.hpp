@@ -0,0 +1,137 @@
+#ifndef OBJECT_STORE_HPP
+#define OBJECT_STORE_HPP
+
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "pbf_blocks.hpp"
+#include "temp_files.hpp"
+
+#include <osmium/io/header.hpp>
+#include <osmium/io/writer_options.hpp>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/**
+ * An object store is a directory with the contents of a sorted OSM file
+ * split into pages. Each page is a small PBF file with the objects from
+ * a range of type and ID. Changes can be applied to the store by
+ * rewriting only the pages with changed objects, the full file can be
+ * recreated from the pages at any time.
+ *
+ * The directory contains the file "index" with the list of pages and
+ * the smallest key on each page, the file "header.osm.pbf" with the
+ * header of the original file and the pages in files named
+ * "page-NUMBER.osm.pbf". Pages are never changed, a changed page gets
+ * a new number. The index is replaced atomically in commit(), so a
+ * store is never left in an inconsistent state, even if an update is
+ * interrupted.
+ */
+class ObjectStore {
+
+    struct page {
+        std::size_t number = 0;
+
+        // Smallest key on this page. Not set on the first page which
+        // also gets all objects smaller than the first key.
+        pbf_object_key min;
+        bool has_min = false;
+    };
+
+    std::string m_directory;
+    osmium::io::Header m_header;
+    std::vector<page> m_pages;
+    std::vector<std::size_t> m_obsolete_pages;
+    std::size_t m_next_number = 0;
+    osmium::io::fsync m_fsync;
+    TempFiles m_temp_files;
+    std::string m_temp_filename;
+
+    ObjectStore(const std::string& directory, const osmium::io::Header& header, osmium::io::fsync fsync);
+
+    std::string filename(const std::string& name) const;
+
+    std::string page_file(std::size_t number) const;
+
+    std::vector<page> copy_pages(const std::string& filename, std::size_t max_blocks);
+
+    void write_index();
+
+public:
+
+    /// Target number of PBF blocks on each page.
+    static constexpr const std::size_t blocks_per_page = 32;
+
+    /**
+     * Create a new store in the existing directory from the sorted PBF
+     * file. The directory must not contain a store already.
+     */
+    static void create(const std::string& directory, const std::string& pbf_filename, osmium::io::fsync fsync);
+
+    /**
+     * Open the existing store in the directory.
+     *
+     * @throws osmium::io_error If the directory doesn't contain a store.
+     */
+    explicit ObjectStore(const std::string& directory, osmium::io::fsync fsync = osmium::io::fsync::no);
+
+    const osmium::io::Header& header() const noexcept {
+        return m_header;
+    }
+
+    /// The number of pages in the store.
+    std::size_t size() const noexcept {
+        return m_pages.size();
+    }
+
+    /// The name of the file with page n.
+    std::string page_filename(std::size_t n) const;
+
+    /**
+     * Does the key belong on a page after page n? Each page gets all
+     * objects from its smallest key up to the smallest key on the next
+     * page.
+     */
+    bool after_page(std::size_t n, const pbf_object_key& key) const;
+
+    /// Name of a temporary file in the store directory for a new page.
+    std::string temp_filename() const;
+
+    /**
+     * Replace page n with the contents of the PBF file written to
+     * temp_filename(). Large pages are split, empty pages are removed.
+     * Returns the number of pages the page was replaced with.
+     */
+    std::size_t replace_page(std::size_t n);
+
+    /// Write the new index and remove the pages not used any more.
+    void commit();
+
+    /// Write the contents of the whole store into a PBF file.
+    void write_snapshot(const std::string& filename, const osmium::io::Header& header, osmium::io::overwrite overwrite, osmium::io::fsync fsync) const;
+
+}; // class ObjectStore
+
+
+#endif // OBJECT_STORE_HPP
@@ -0,0 +1,176 @@
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "opl_writer.hpp"
+
+#include <osmium/io/detail/read_write.hpp>
+#include <osmium/io/file_compression.hpp>
+#include <osmium/io/file_format.hpp>
+#include <osmium/osm/metadata_options.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <memory>
+#include <system_error>
+#include <utility>
+
+#ifndef _WIN32
+# include <climits>
+# include <sys/uio.h>
+# include <unistd.h>
+#endif
+
+// Blocks are written out when there are this many bytes or blocks.
+static constexpr const std::size_t flush_size = 8UL * 1024UL * 1024UL;
+static constexpr const std::size_t max_blocks = 64;
+
+namespace {
+
+#ifndef _WIN32
+    // Write all blocks with as few writev() calls as possible.
+    void write_blocks(int fd, const std::vector<std::string>& blocks) {
+        std::vector<struct iovec> iov;
+        iov.reserve(blocks.size());
+        for (const auto& block : blocks) {
+            if (!block.empty()) {
+                struct iovec v;
+                v.iov_base = const_cast<char*>(block.data()); // NOLINT(cppcoreguidelines-pro-type-const-cast)
+                v.iov_len = block.size();
+                iov.push_back(v);
+            }
+        }
+
+#ifdef IOV_MAX
+        const std::size_t max_iov = IOV_MAX;
+#else
+        const std::size_t max_iov = 16;
+#endif
+
+        std::size_t first = 0;
+        while (first < iov.size()) {
+            const auto count = std::min(iov.size() - first, max_iov);
+            const auto written = ::writev(fd, &iov[first], static_cast<int>(count));
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::system_error{errno, std::system_category(), "Write failed"};
+            }
+
+            // Skip the blocks written completely and adjust the first
+            // one written partially.
+            auto remaining = static_cast<std::size_t>(written);
+            while (first < iov.size() && remaining >= iov[first].iov_len) {
+                remaining -= iov[first].iov_len;
+                ++first;
+            }
+            if (remaining > 0) {
+                iov[first].iov_base = static_cast<char*>(iov[first].iov_base) + remaining;
+                iov[first].iov_len -= remaining;
+            }
+        }
+    }
+#else
+    void write_blocks(int fd, const std::vector<std::string>& blocks) {
+        for (const auto& block : blocks) {
+            osmium::io::detail::reliable_write(fd, block.data(), block.size());
+        }
+    }
+#endif
+
+} // anonymous namespace
+
+bool OPLWriter::can_write(const osmium::io::File& file) {
+    return file.format() == osmium::io::file_format::opl &&
+           file.compression() == osmium::io::file_compression::none;
+}
+
+OPLWriter::OPLWriter(const osmium::io::File& file, osmium::io::overwrite overwrite, osmium::io::fsync fsync, osmium::thread::Pool& pool) :
+    m_pool(pool),
+    m_max_pending(static_cast<std::size_t>(pool.num_threads()) * 4),
+    m_fd(osmium::io::detail::open_for_writing(file.filename(), overwrite)),
+    m_fsync(fsync) {
+    m_options.add_metadata      = osmium::metadata_options{file.get("add_metadata")};
+    m_options.locations_on_ways = file.is_true("locations_on_ways");
+    m_options.format_as_diff    = file.is_true("diff");
+}
+
+OPLWriter::~OPLWriter() noexcept {
+    try {
+        close();
+    } catch (...) {
+        // Ignore any exceptions because destructor must not throw.
+    }
+}
+
+void OPLWriter::flush() {
+    write_blocks(m_fd, m_ready);
+    m_ready.clear();
+    m_ready_size = 0;
+}
+
+void OPLWriter::take_result() {
+    m_ready.push_back(m_pending.front().get());
+    m_pending.pop_front();
+    m_ready_size += m_ready.back().size();
+    if (m_ready_size >= flush_size || m_ready.size() >= max_blocks) {
+        flush();
+    }
+}
+
+void OPLWriter::operator()(osmium::memory::Buffer&& buffer) {
+    if (buffer.committed() == 0) {
+        return;
+    }
+
+    std::shared_ptr<osmium::memory::Buffer> buffer_ptr{new osmium::memory::Buffer{std::move(buffer)}};
+    const auto options = m_options;
+    m_pending.push_back(m_pool.submit([buffer_ptr, options]() {
+        osmium::io::detail::OPLOutputBlock block{std::move(*buffer_ptr), options};
+        return block();
+    }));
+
+    while (m_pending.size() > m_max_pending) {
+        take_result();
+    }
+}
+
+void OPLWriter::close() {
+    if (m_fd < 0) {
+        return;
+    }
+
+    while (!m_pending.empty()) {
+        take_result();
+    }
+    flush();
+
+    if (m_fsync == osmium::io::fsync::yes) {
+        osmium::io::detail::reliable_fsync(m_fd);
+    }
+
+    const int fd = m_fd;
+    m_fd = -1;
+    if (fd != 1) {
+        osmium::io::detail::reliable_close(fd);
+    }
+}
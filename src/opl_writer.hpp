@@ -0,0 +1,83 @@
+#ifndef OPL_WRITER_HPP
+#define OPL_WRITER_HPP
+
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <osmium/io/detail/opl_output_format.hpp>
+#include <osmium/io/file.hpp>
+#include <osmium/io/writer_options.hpp>
+#include <osmium/memory/buffer.hpp>
+#include <osmium/thread/pool.hpp>
+
+#include <cstddef>
+#include <deque>
+#include <future>
+#include <string>
+#include <vector>
+
+/**
+ * Fast path for writing uncompressed OPL files (or OPL to STDOUT). The
+ * buffers are formatted on the thread pool with the same code the
+ * osmium::io::Writer uses, so the output is the same. But the formatted
+ * blocks are not copied or queued for a separate writer thread, they are
+ * collected and written out with one writev() call for many of them.
+ */
+class OPLWriter {
+
+    osmium::thread::Pool& m_pool;
+    osmium::io::detail::opl_output_options m_options;
+    std::deque<std::future<std::string>> m_pending;
+    std::size_t m_max_pending;
+
+    // Formatted blocks ready to be written.
+    std::vector<std::string> m_ready;
+    std::size_t m_ready_size = 0;
+
+    int m_fd;
+    osmium::io::fsync m_fsync;
+
+    void take_result();
+    void flush();
+
+public:
+
+    // Can this class write the file?
+    static bool can_write(const osmium::io::File& file);
+
+    OPLWriter(const osmium::io::File& file, osmium::io::overwrite overwrite, osmium::io::fsync fsync, osmium::thread::Pool& pool);
+
+    OPLWriter(const OPLWriter&) = delete;
+    OPLWriter& operator=(const OPLWriter&) = delete;
+
+    OPLWriter(OPLWriter&&) = delete;
+    OPLWriter& operator=(OPLWriter&&) = delete;
+
+    ~OPLWriter() noexcept;
+
+    void operator()(osmium::memory::Buffer&& buffer);
+
+    void close();
+
+}; // class OPLWriter
+
+#endif // OPL_WRITER_HPP
@@ -0,0 +1,141 @@
+#ifndef PARALLEL_SORT_HPP
+#define PARALLEL_SORT_HPP
+
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <osmium/thread/pool.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <future>
+#include <iterator>
+#include <memory>
+#include <utility>
+#include <vector>
+
+/**
+ * Ranges smaller than this are always sorted in the current thread,
+ * the overhead of the thread pool isn't worth it.
+ */
+constexpr const std::size_t min_parallel_sort_size = 100000;
+
+/**
+ * Merge consecutive sorted partitions of a range into one sorted range.
+ * The bounds vector contains the iterators to the start of each
+ * partition followed by the end of the range. Partitions are merged
+ * pairwise using num_threads threads until one sorted range is left.
+ */
+template <typename TIterator, typename TCompare>
+void parallel_merge(std::vector<TIterator> bounds, TCompare compare, int num_threads) {
+    if (bounds.size() <= 2) {
+        return;
+    }
+
+    std::unique_ptr<osmium::thread::Pool> pool;
+    if (num_threads > 1) {
+        pool.reset(new osmium::thread::Pool{num_threads});
+    }
+    std::vector<std::future<void>> futures;
+
+    while (bounds.size() > 2) {
+        futures.clear();
+        std::vector<TIterator> new_bounds;
+
+        const std::size_t num_partitions = bounds.size() - 1;
+        for (std::size_t i = 0; i + 1 < num_partitions; i += 2) {
+            const auto begin = bounds[i];
+            const auto middle = bounds[i + 1];
+            const auto end = bounds[i + 2];
+            if (!pool) {
+                std::inplace_merge(begin, middle, end, compare);
+            } else {
+                futures.push_back(pool->submit([begin, middle, end, compare]() {
+                    std::inplace_merge(begin, middle, end, compare);
+                }));
+            }
+            new_bounds.push_back(begin);
+        }
+        if (num_partitions % 2 == 1) {
+            new_bounds.push_back(bounds[num_partitions - 1]);
+        }
+        new_bounds.push_back(bounds.back());
+
+        for (auto& future : futures) {
+            future.get();
+        }
+
+        using std::swap;
+        swap(bounds, new_bounds);
+    }
+}
+
+/**
+ * Sort the range [first, last) using num_threads threads. The range is
+ * split into one partition per thread, each partition is sorted by
+ * calling sort(begin, end) concurrently and then they are merged with
+ * parallel_merge() using compare (which must be the order sort() sorts
+ * in). With num_threads <= 1 this is a plain sort(first, last).
+ */
+template <typename TIterator, typename TSort, typename TCompare>
+void parallel_sort_with(TIterator first, TIterator last, TSort sort, TCompare compare, int num_threads) {
+    const auto size = static_cast<std::size_t>(std::distance(first, last));
+    if (num_threads <= 1 || size < min_parallel_sort_size) {
+        sort(first, last);
+        return;
+    }
+
+    std::vector<TIterator> bounds;
+    for (std::size_t i = 0; i <= static_cast<std::size_t>(num_threads); ++i) {
+        bounds.push_back(first + static_cast<typename std::iterator_traits<TIterator>::difference_type>(size * i / static_cast<std::size_t>(num_threads)));
+    }
+
+    {
+        osmium::thread::Pool pool{num_threads};
+        std::vector<std::future<void>> futures;
+        for (std::size_t i = 0; i + 1 < bounds.size(); ++i) {
+            const auto begin = bounds[i];
+            const auto end = bounds[i + 1];
+            futures.push_back(pool.submit([begin, end, sort]() {
+                sort(begin, end);
+            }));
+        }
+        for (auto& future : futures) {
+            future.get();
+        }
+    }
+
+    parallel_merge(std::move(bounds), compare, num_threads);
+}
+
+/**
+ * Sort the range [first, last) using num_threads threads with
+ * std::sort() on each partition (see parallel_sort_with()).
+ */
+template <typename TIterator, typename TCompare>
+void parallel_sort(TIterator first, TIterator last, TCompare compare, int num_threads) {
+    parallel_sort_with(first, last, [compare](TIterator begin, TIterator end) {
+        std::sort(begin, end, compare);
+    }, compare, num_threads);
+}
+
+#endif // PARALLEL_SORT_HPP
@@ -0,0 +1,1989 @@
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "pbf_blocks.hpp"
+#include "remote_file.hpp"
+
+#include <osmium/builder/osm_object_builder.hpp>
+#include <osmium/io/detail/pbf_decoder.hpp>
+#include <osmium/io/detail/read_write.hpp>
+#include <osmium/io/error.hpp>
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm/box.hpp>
+#include <osmium/osm/location.hpp>
+#include <osmium/osm/node.hpp>
+#include <osmium/osm/object.hpp>
+#include <osmium/osm/object_comparisons.hpp>
+#include <osmium/osm/timestamp.hpp>
+#include <osmium/thread/pool.hpp>
+#include <osmium/util/file.hpp>
+
+#include <protozero/exception.hpp>
+#include <protozero/pbf_reader.hpp>
+#include <protozero/pbf_writer.hpp>
+
+#include <fcntl.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <tuple>
+#include <utility>
+
+// How far ahead of the current offset the kernel is asked to read
+// when reading blocks sequentially.
+static constexpr const std::size_t readahead_window = 64UL * 1024UL * 1024UL;
+
+// Limits from the PBF format description.
+static constexpr const std::size_t max_blob_header_size = 64UL * 1024UL;
+static constexpr const std::size_t max_uncompressed_blob_size = 32UL * 1024UL * 1024UL;
+
+bool operator<(const pbf_object_key& lhs, const pbf_object_key& rhs) noexcept {
+    return std::tie(lhs.type, lhs.positive, lhs.id) <
+           std::tie(rhs.type, rhs.positive, rhs.id);
+}
+
+PBFBlockReader::PBFBlockReader(const std::string& filename) :
+    m_filename(filename) {
+    if (is_remote_url(filename)) {
+        m_remote.reset(new RemoteFile{filename});
+        return;
+    }
+    m_fd = osmium::io::detail::open_for_reading(filename);
+#ifdef POSIX_FADV_SEQUENTIAL
+    ::posix_fadvise(m_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+}
+
+PBFBlockReader::~PBFBlockReader() noexcept {
+    if (m_fd >= 0) {
+        ::close(m_fd);
+    }
+}
+
+bool PBFBlockReader::read_exactly(char* data, std::size_t size) {
+    if (m_remote) {
+        const auto n = m_remote->read(m_offset, data, size);
+        if (n < size) {
+            if (n == 0) {
+                return false;
+            }
+            throw osmium::io_error{"Truncated PBF file '" + m_filename + "'"};
+        }
+        m_offset += size;
+        return true;
+    }
+
+    std::size_t done = 0;
+    while (done < size) {
+        const auto n = ::read(m_fd, data + done, static_cast<unsigned int>(size - done));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::system_error{errno, std::system_category(), "Read failed on file '" + m_filename + "'"};
+        }
+        if (n == 0) {
+            if (done == 0) {
+                return false;
+            }
+            throw osmium::io_error{"Truncated PBF file '" + m_filename + "'"};
+        }
+        done += static_cast<std::size_t>(n);
+    }
+    m_offset += size;
+    return true;
+}
+
+// Ask the kernel to start reading the data after the current offset
+// in the background, so that reading the next blocks doesn't have to
+// wait for the disk. This is only a hint, if it fails (for instance on
+// a pipe) it isn't tried again.
+void PBFBlockReader::readahead() {
+#ifdef POSIX_FADV_WILLNEED
+    if (m_remote || !m_readahead || m_random_access || m_offset + readahead_window / 2 < m_readahead_end) {
+        return;
+    }
+    const auto start = std::max(m_offset, m_readahead_end);
+    const auto end = m_offset + readahead_window;
+    if (::posix_fadvise(m_fd, static_cast<off_t>(start), static_cast<off_t>(end - start), POSIX_FADV_WILLNEED) != 0) {
+        m_readahead = false;
+        return;
+    }
+    m_readahead_end = end;
+#endif
+}
+
+void PBFBlockReader::seek(std::size_t offset) {
+    // Short forward seeks only skip some blocks of a file which is
+    // otherwise read from start to end, reading ahead still helps there.
+    // Everything else is random access. Once the reader is back to short
+    // forward seeks, the file is read sequentially again.
+    const bool random_access = offset < m_offset || offset - m_offset >= readahead_window;
+
+    if (m_remote) {
+        if (random_access) {
+            m_remote->set_random_access();
+        }
+        m_offset = offset;
+        return;
+    }
+    if (random_access != m_random_access) {
+        m_random_access = random_access;
+        m_readahead_end = 0;
+#if defined(POSIX_FADV_RANDOM) && defined(POSIX_FADV_SEQUENTIAL)
+        ::posix_fadvise(m_fd, 0, 0, random_access ? POSIX_FADV_RANDOM : POSIX_FADV_SEQUENTIAL);
+#endif
+    }
+    if (::lseek(m_fd, static_cast<off_t>(offset), SEEK_SET) < 0) {
+        throw std::system_error{errno, std::system_category(), "Seek failed on file '" + m_filename + "'"};
+    }
+    m_offset = offset;
+}
+
+void PBFBlockReader::skip(std::size_t size) {
+    if (m_remote) {
+        // Don't prefetch data which is skipped.
+        if (size > 0) {
+            m_remote->set_random_access();
+        }
+        m_offset += size;
+        return;
+    }
+    if (::lseek(m_fd, static_cast<off_t>(size), SEEK_CUR) < 0) {
+        if (errno != ESPIPE) {
+            throw std::system_error{errno, std::system_category(), "Seek failed on file '" + m_filename + "'"};
+        }
+        // Not seekable (pipe), so read the data and throw it away.
+        std::string buffer(size, '\0');
+        if (size > 0 && !read_exactly(&buffer[0], size)) {
+            throw osmium::io_error{"Truncated PBF file '" + m_filename + "'"};
+        }
+        return;
+    }
+    m_offset += size;
+}
+
+// Read the length prefix and the BlobHeader into data. Returns false at
+// the end of the file.
+bool PBFBlockReader::read_blob_header(std::string& data, std::string& type, std::string* index_data, std::size_t& blob_size) {
+    type.clear();
+    data.resize(4);
+    if (!read_exactly(&data[0], 4)) {
+        return false;
+    }
+
+    const auto* size_bytes = reinterpret_cast<const unsigned char*>(data.data());
+    const std::size_t header_size = (static_cast<std::size_t>(size_bytes[0]) << 24U) |
+                                    (static_cast<std::size_t>(size_bytes[1]) << 16U) |
+                                    (static_cast<std::size_t>(size_bytes[2]) <<  8U) |
+                                     static_cast<std::size_t>(size_bytes[3]);
+    if (header_size > max_blob_header_size) {
+        throw osmium::io_error{"Invalid BlobHeader size in PBF file '" + m_filename + "'"};
+    }
+
+    data.resize(4 + header_size);
+    if (!read_exactly(&data[4], header_size)) {
+        throw osmium::io_error{"Truncated PBF file '" + m_filename + "'"};
+    }
+
+    blob_size = 0;
+    protozero::pbf_reader blob_header{data.data() + 4, header_size};
+    while (blob_header.next()) {
+        switch (blob_header.tag()) {
+            case 1: // type
+                type = blob_header.get_string();
+                break;
+            case 2: // indexdata
+                if (index_data) {
+                    *index_data = blob_header.get_string();
+                } else {
+                    blob_header.skip();
+                }
+                break;
+            case 3: // datasize
+                blob_size = static_cast<std::size_t>(blob_header.get_int32());
+                break;
+            default:
+                blob_header.skip();
+        }
+    }
+
+    if (blob_size > max_uncompressed_blob_size) {
+        throw osmium::io_error{"Invalid Blob size in PBF file '" + m_filename + "'"};
+    }
+
+    return true;
+}
+
+bool PBFBlockReader::read(pbf_block& block) {
+    readahead();
+
+    std::size_t blob_size = 0;
+    if (!read_blob_header(block.data, block.type, nullptr, blob_size)) {
+        return false;
+    }
+
+    block.blob_offset = block.data.size();
+    block.data.resize(block.blob_offset + blob_size);
+    if (blob_size > 0 && !read_exactly(&block.data[block.blob_offset], blob_size)) {
+        throw osmium::io_error{"Truncated PBF file '" + m_filename + "'"};
+    }
+
+    return true;
+}
+
+bool PBFBlockReader::read_header(pbf_blob_header& header) {
+    header.offset = m_offset;
+    header.index_data.clear();
+
+    std::string data;
+    std::size_t blob_size = 0;
+    if (!read_blob_header(data, header.type, &header.index_data, blob_size)) {
+        return false;
+    }
+
+    skip(blob_size);
+    header.size = data.size() + blob_size;
+
+    return true;
+}
+
+static void add_block(std::string& out, const char* type, const std::string& content) {
+    std::string blob;
+    {
+        protozero::pbf_writer pbf_blob{blob};
+        pbf_blob.add_bytes(1, content); // raw
+        pbf_blob.add_int32(2, static_cast<int32_t>(content.size())); // raw_size
+    }
+
+    std::string blob_header;
+    {
+        protozero::pbf_writer pbf_blob_header{blob_header};
+        pbf_blob_header.add_string(1, type); // type
+        pbf_blob_header.add_int32(3, static_cast<int32_t>(blob.size())); // datasize
+    }
+
+    const auto size = static_cast<uint32_t>(blob_header.size());
+    out += static_cast<char>((size >> 24U) & 0xffU);
+    out += static_cast<char>((size >> 16U) & 0xffU);
+    out += static_cast<char>((size >>  8U) & 0xffU);
+    out += static_cast<char>( size         & 0xffU);
+    out += blob_header;
+    out += blob;
+}
+
+static std::string encode_header(const osmium::io::Header& header) {
+    std::string data;
+    protozero::pbf_writer pbf_header_block{data};
+
+    const osmium::Box box = header.joined_boxes();
+    if (box) {
+        protozero::pbf_writer pbf_bbox{pbf_header_block, 1};
+        pbf_bbox.add_sint64(1, static_cast<int64_t>(box.bottom_left().x()) * 100);
+        pbf_bbox.add_sint64(2, static_cast<int64_t>(box.top_right().x()) * 100);
+        pbf_bbox.add_sint64(3, static_cast<int64_t>(box.top_right().y()) * 100);
+        pbf_bbox.add_sint64(4, static_cast<int64_t>(box.bottom_left().y()) * 100);
+    }
+
+    pbf_header_block.add_string(4, "OsmSchema-V0.6");
+    pbf_header_block.add_string(4, "DenseNodes");
+    if (header.has_multiple_object_versions()) {
+        pbf_header_block.add_string(4, "HistoricalInformation");
+    }
+    for (const auto& option : header) {
+        if (option.first.compare(0, 21, "pbf_required_feature_") == 0 &&
+            option.second != "OsmSchema-V0.6" &&
+            option.second != "DenseNodes" &&
+            option.second != "HistoricalInformation") {
+            pbf_header_block.add_string(4, option.second);
+        }
+    }
+    if (header.get("sorting") == "Type_then_ID") {
+        pbf_header_block.add_string(5, "Sort.Type_then_ID");
+    }
+    for (const auto& option : header) {
+        if (option.first.compare(0, 21, "pbf_optional_feature_") == 0 &&
+            option.second != "Sort.Type_then_ID") {
+            pbf_header_block.add_string(5, option.second);
+        }
+    }
+
+    pbf_header_block.add_string(16, header.get("generator"));
+
+    const std::string timestamp = header.get("osmosis_replication_timestamp");
+    if (!timestamp.empty()) {
+        const osmium::Timestamp ts{timestamp.c_str()};
+        pbf_header_block.add_int64(32, static_cast<int64_t>(ts.seconds_since_epoch()));
+    }
+
+    const std::string sequence_number = header.get("osmosis_replication_sequence_number");
+    if (!sequence_number.empty()) {
+        pbf_header_block.add_int64(33, std::atoll(sequence_number.c_str()));
+    }
+
+    const std::string base_url = header.get("osmosis_replication_base_url");
+    if (!base_url.empty()) {
+        pbf_header_block.add_string(34, base_url);
+    }
+
+    return data;
+}
+
+PBFBlockWriter::PBFBlockWriter(const std::string& filename,
+                               const osmium::io::Header& header,
+                               osmium::io::overwrite overwrite,
+                               osmium::io::fsync fsync) :
+    m_fd(osmium::io::detail::open_for_writing(filename, overwrite)),
+    m_fsync(fsync) {
+    std::string data;
+    add_block(data, "OSMHeader", encode_header(header));
+    osmium::io::detail::reliable_write(m_fd, data.data(), data.size());
+}
+
+PBFBlockWriter::~PBFBlockWriter() noexcept {
+    try {
+        close();
+    } catch (...) {
+    }
+}
+
+void PBFBlockWriter::write(const pbf_block& block) {
+    osmium::io::detail::reliable_write(m_fd, block.data.data(), block.data.size());
+}
+
+void PBFBlockWriter::close() {
+    if (m_fd >= 0) {
+        if (m_fsync == osmium::io::fsync::yes) {
+            osmium::io::detail::reliable_fsync(m_fd);
+        }
+        osmium::io::detail::reliable_close(m_fd);
+        m_fd = -1;
+    }
+}
+
+static protozero::data_view decode_blob(const pbf_block& block, std::string& output) {
+    protozero::pbf_reader pbf_blob{block.data.data() + block.blob_offset, block.data.size() - block.blob_offset};
+
+    protozero::data_view zlib_data;
+    std::size_t raw_size = 0;
+    while (pbf_blob.next()) {
+        switch (pbf_blob.tag()) {
+            case 1: // raw
+                return pbf_blob.get_view();
+            case 2: // raw_size
+                raw_size = static_cast<std::size_t>(pbf_blob.get_int32());
+                break;
+            case 3: // zlib_data
+                zlib_data = pbf_blob.get_view();
+                break;
+            default:
+                throw osmium::io_error{"Unsupported compression in PBF block"};
+        }
+    }
+
+    if (raw_size > max_uncompressed_blob_size) {
+        throw osmium::io_error{"Invalid raw_size in PBF block"};
+    }
+
+    output.resize(raw_size);
+    auto output_size = static_cast<uLongf>(raw_size);
+    const auto result = ::uncompress(reinterpret_cast<Bytef*>(&output[0]),
+                                     &output_size,
+                                     reinterpret_cast<const Bytef*>(zlib_data.data()),
+                                     static_cast<uLong>(zlib_data.size()));
+    if (result != Z_OK || output_size != raw_size) {
+        throw osmium::io_error{"Failed to decompress PBF block"};
+    }
+
+    return protozero::data_view{output.data(), output.size()};
+}
+
+// Buffer for the uncompressed data of a block. Blocks are decompressed
+// on the threads of the pool, each thread keeps its buffer for all the
+// blocks (and passes over the input) it handles, so the memory for the
+// uncompressed data isn't allocated, zeroed and freed again for every
+// block. The buffer is only used until the function decompressing into
+// it returns.
+static std::string& decompress_buffer() {
+    static thread_local std::string buffer;
+    return buffer;
+}
+
+osmium::io::Header decode_pbf_header(const pbf_block& block) {
+    osmium::io::Header header;
+    int required_features = 0;
+    int optional_features = 0;
+
+    std::string output;
+    protozero::pbf_reader pbf_header_block{decode_blob(block, output)};
+    while (pbf_header_block.next()) {
+        switch (pbf_header_block.tag()) {
+            case 1: { // bbox
+                    protozero::pbf_reader pbf_bbox = pbf_header_block.get_message();
+                    int64_t left = 0;
+                    int64_t right = 0;
+                    int64_t top = 0;
+                    int64_t bottom = 0;
+                    while (pbf_bbox.next()) {
+                        switch (pbf_bbox.tag()) {
+                            case 1:
+                                left = pbf_bbox.get_sint64();
+                                break;
+                            case 2:
+                                right = pbf_bbox.get_sint64();
+                                break;
+                            case 3:
+                                top = pbf_bbox.get_sint64();
+                                break;
+                            case 4:
+                                bottom = pbf_bbox.get_sint64();
+                                break;
+                            default:
+                                pbf_bbox.skip();
+                        }
+                    }
+                    header.add_box(osmium::Box{osmium::Location{static_cast<int32_t>(left / 100), static_cast<int32_t>(bottom / 100)},
+                                               osmium::Location{static_cast<int32_t>(right / 100), static_cast<int32_t>(top / 100)}});
+                }
+                break;
+            case 4: { // required_features
+                    const std::string feature{pbf_header_block.get_string()};
+                    if (feature == "HistoricalInformation") {
+                        header.set_has_multiple_object_versions(true);
+                    } else if (feature != "OsmSchema-V0.6" && feature != "DenseNodes") {
+                        header.set("pbf_required_feature_" + std::to_string(required_features++), feature);
+                    }
+                }
+                break;
+            case 5: { // optional_features
+                    const std::string feature{pbf_header_block.get_string()};
+                    if (feature == "Sort.Type_then_ID") {
+                        header.set("sorting", "Type_then_ID");
+                    }
+                    header.set("pbf_optional_feature_" + std::to_string(optional_features++), feature);
+                }
+                break;
+            case 16: // writingprogram
+                header.set("generator", pbf_header_block.get_string());
+                break;
+            case 32: // osmosis_replication_timestamp
+                header.set("osmosis_replication_timestamp", osmium::Timestamp{static_cast<uint32_t>(pbf_header_block.get_int64())}.to_iso());
+                break;
+            case 33: // osmosis_replication_sequence_number
+                header.set("osmosis_replication_sequence_number", std::to_string(pbf_header_block.get_int64()));
+                break;
+            case 34: // osmosis_replication_base_url
+                header.set("osmosis_replication_base_url", pbf_header_block.get_string());
+                break;
+            default:
+                pbf_header_block.skip();
+        }
+    }
+
+    return header;
+}
+
+std::vector<std::string> get_pbf_features(const osmium::io::Header& header) {
+    std::vector<std::string> features;
+
+    for (const auto& option : header) {
+        if (option.first.compare(0, 21, "pbf_required_feature_") == 0) {
+            features.push_back(option.second);
+        } else if (option.first.compare(0, 21, "pbf_optional_feature_") == 0 &&
+                   option.second != "Sort.Type_then_ID") {
+            features.push_back("optional " + option.second);
+        }
+    }
+    std::sort(features.begin(), features.end());
+
+    return features;
+}
+
+void copy_pbf_features(const osmium::io::Header& from, osmium::io::Header& to) {
+    for (const auto& option : from) {
+        if (option.first.compare(0, 21, "pbf_required_feature_") == 0 ||
+            option.first.compare(0, 21, "pbf_optional_feature_") == 0) {
+            to.set(option.first, option.second);
+        }
+    }
+}
+
+// Call func with type and ID of all objects in an OSMData block. This
+// decompresses the block but only decodes the IDs.
+template <typename TFunc>
+static void for_each_pbf_block_id(const pbf_block& block, TFunc&& func) {
+    const auto data = decode_blob(block, decompress_buffer());
+
+    protozero::pbf_reader pbf_primitive_block{data};
+    while (pbf_primitive_block.next(2)) { // primitivegroup
+        protozero::pbf_reader pbf_primitive_group = pbf_primitive_block.get_message();
+        while (pbf_primitive_group.next()) {
+            switch (pbf_primitive_group.tag()) {
+                case 1: { // nodes
+                        protozero::pbf_reader pbf_node = pbf_primitive_group.get_message();
+                        if (pbf_node.next(1)) {
+                            func(osmium::item_type::node, pbf_node.get_sint64());
+                        }
+                    }
+                    break;
+                case 2: { // dense
+                        protozero::pbf_reader pbf_dense_nodes = pbf_primitive_group.get_message();
+                        if (pbf_dense_nodes.next(1)) {
+                            int64_t id = 0;
+                            for (const auto delta : pbf_dense_nodes.get_packed_sint64()) {
+                                id += delta;
+                                func(osmium::item_type::node, id);
+                            }
+                        }
+                    }
+                    break;
+                case 3: { // ways
+                        protozero::pbf_reader pbf_way = pbf_primitive_group.get_message();
+                        if (pbf_way.next(1)) {
+                            func(osmium::item_type::way, pbf_way.get_int64());
+                        }
+                    }
+                    break;
+                case 4: { // relations
+                        protozero::pbf_reader pbf_relation = pbf_primitive_group.get_message();
+                        if (pbf_relation.next(1)) {
+                            func(osmium::item_type::relation, pbf_relation.get_int64());
+                        }
+                    }
+                    break;
+                default:
+                    pbf_primitive_group.skip();
+            }
+        }
+    }
+}
+
+bool get_pbf_block_range(const pbf_block& block, pbf_object_key& min, pbf_object_key& max) {
+    bool found = false;
+    for_each_pbf_block_id(block, [&](osmium::item_type type, int64_t id) {
+        pbf_object_key key;
+        key.type = type;
+        key.positive = id > 0;
+        key.id = static_cast<osmium::unsigned_object_id_type>(id < 0 ? -id : id);
+        if (!found || key < min) {
+            min = key;
+        }
+        if (!found || max < key) {
+            max = key;
+        }
+        found = true;
+    });
+
+    return found;
+}
+
+std::size_t count_pbf_block_objects(const pbf_block& block, osmium::osm_entity_bits::type entities) {
+    std::size_t count = 0;
+    for_each_pbf_block_id(block, [&count, entities](osmium::item_type type, int64_t /*id*/) {
+        if (entities & osmium::osm_entity_bits::from_item_type(type)) {
+            ++count;
+        }
+    });
+    return count;
+}
+
+bool pbf_block_has_string(const pbf_block& block, const std::function<bool(const std::string&)>& predicate) {
+    const auto data = decode_blob(block, decompress_buffer());
+
+    std::string str;
+    protozero::pbf_reader pbf_primitive_block{data};
+    while (pbf_primitive_block.next(1)) { // stringtable
+        protozero::pbf_reader pbf_string_table = pbf_primitive_block.get_message();
+        while (pbf_string_table.next(1)) { // s
+            const auto view = pbf_string_table.get_view();
+            str.assign(view.data(), view.size());
+            if (predicate(str)) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+osmium::memory::Buffer decode_pbf_block(const pbf_block& block, osmium::osm_entity_bits::type entities) {
+    const auto data = decode_blob(block, decompress_buffer());
+
+    osmium::io::detail::PBFPrimitiveBlockDecoder decoder{data, entities, osmium::io::read_meta::yes};
+    return decoder();
+}
+
+// Granularity and offsets of the coordinates in a PrimitiveBlock.
+struct pbf_coordinates {
+    int64_t granularity = 100;
+    int64_t lat_offset = 0;
+    int64_t lon_offset = 0;
+
+    // The PBF format uses nanodegrees, osmium uses 1e-7 degrees.
+    int32_t convert(int64_t offset, int64_t value) const noexcept {
+        return static_cast<int32_t>((offset + granularity * value) / 100);
+    }
+};
+
+// Decode a DenseNodes group. Nodes with tags are added to the buffer,
+// the locations of all nodes to node_locations.
+static void decode_dense_nodes(const protozero::data_view& data,
+                               const std::vector<protozero::data_view>& strings,
+                               const pbf_coordinates& coordinates,
+                               osmium::memory::Buffer& buffer,
+                               std::vector<pbf_node_location>& node_locations) {
+    protozero::iterator_range<protozero::pbf_reader::const_sint64_iterator> ids;
+    protozero::iterator_range<protozero::pbf_reader::const_sint64_iterator> lats;
+    protozero::iterator_range<protozero::pbf_reader::const_sint64_iterator> lons;
+    protozero::iterator_range<protozero::pbf_reader::const_int32_iterator> tags;
+
+    protozero::pbf_reader pbf_dense_nodes{data};
+    while (pbf_dense_nodes.next()) {
+        switch (pbf_dense_nodes.tag()) {
+            case 1: // id
+                ids = pbf_dense_nodes.get_packed_sint64();
+                break;
+            case 8: // lat
+                lats = pbf_dense_nodes.get_packed_sint64();
+                break;
+            case 9: // lon
+                lons = pbf_dense_nodes.get_packed_sint64();
+                break;
+            case 10: // keys_vals
+                tags = pbf_dense_nodes.get_packed_int32();
+                break;
+            default:
+                pbf_dense_nodes.skip();
+        }
+    }
+
+    const auto get_string = [&strings](int32_t index) -> const protozero::data_view& {
+        if (index < 0 || static_cast<std::size_t>(index) >= strings.size()) {
+            throw osmium::io_error{"Invalid string index in PBF block"};
+        }
+        return strings[static_cast<std::size_t>(index)];
+    };
+
+    int64_t id = 0;
+    int64_t lat = 0;
+    int64_t lon = 0;
+    auto lat_it = lats.begin();
+    auto lon_it = lons.begin();
+    auto tag_it = tags.begin();
+    for (auto id_it = ids.begin(); id_it != ids.end(); ++id_it, ++lat_it, ++lon_it) {
+        if (lat_it == lats.end() || lon_it == lons.end()) {
+            throw osmium::io_error{"Missing coordinates in dense nodes in PBF block"};
+        }
+        id += *id_it;
+        lat += *lat_it;
+        lon += *lon_it;
+        const osmium::Location location{coordinates.convert(coordinates.lon_offset, lon),
+                                        coordinates.convert(coordinates.lat_offset, lat)};
+        node_locations.push_back(pbf_node_location{id, location});
+
+        // The tags of all nodes are in one list, the tags of each node
+        // are followed by a 0. The list is empty if no node has tags.
+        if (tag_it == tags.end() || *tag_it == 0) {
+            if (tag_it != tags.end()) {
+                ++tag_it;
+            }
+            continue;
+        }
+
+        {
+            osmium::builder::NodeBuilder builder{buffer};
+            builder.set_id(id);
+            builder.set_location(location);
+            osmium::builder::TagListBuilder tl_builder{builder};
+            while (tag_it != tags.end() && *tag_it != 0) {
+                const auto& key = get_string(*tag_it);
+                if (++tag_it == tags.end()) {
+                    throw osmium::io_error{"Missing tag value in dense nodes in PBF block"};
+                }
+                const auto& value = get_string(*tag_it);
+                ++tag_it;
+                tl_builder.add_tag(key.data(), key.size(), value.data(), value.size());
+            }
+            if (tag_it != tags.end()) {
+                ++tag_it;
+            }
+        }
+        buffer.commit();
+    }
+}
+
+osmium::memory::Buffer decode_pbf_block_tagged(const pbf_block& block, osmium::osm_entity_bits::type entities, std::vector<pbf_node_location>& node_locations) {
+    const auto data = decode_blob(block, decompress_buffer());
+
+    std::vector<protozero::data_view> strings;
+    std::vector<protozero::data_view> dense_groups;
+    pbf_coordinates coordinates;
+    bool only_dense_nodes = (entities & osmium::osm_entity_bits::node) != 0;
+
+    protozero::pbf_reader pbf_primitive_block{data};
+    while (only_dense_nodes && pbf_primitive_block.next()) {
+        switch (pbf_primitive_block.tag()) {
+            case 1: { // stringtable
+                    protozero::pbf_reader pbf_string_table = pbf_primitive_block.get_message();
+                    while (pbf_string_table.next(1)) { // s
+                        strings.push_back(pbf_string_table.get_view());
+                    }
+                }
+                break;
+            case 2: { // primitivegroup
+                    protozero::pbf_reader pbf_primitive_group = pbf_primitive_block.get_message();
+                    while (pbf_primitive_group.next()) {
+                        if (pbf_primitive_group.tag() != 2) { // dense
+                            only_dense_nodes = false;
+                            break;
+                        }
+                        dense_groups.push_back(pbf_primitive_group.get_view());
+                    }
+                }
+                break;
+            case 17: // granularity
+                coordinates.granularity = pbf_primitive_block.get_int32();
+                break;
+            case 19: // lat_offset
+                coordinates.lat_offset = pbf_primitive_block.get_int64();
+                break;
+            case 20: // lon_offset
+                coordinates.lon_offset = pbf_primitive_block.get_int64();
+                break;
+            default:
+                pbf_primitive_block.skip();
+        }
+    }
+
+    if (!only_dense_nodes) {
+        osmium::io::detail::PBFPrimitiveBlockDecoder decoder{data, entities, osmium::io::read_meta::no};
+        osmium::memory::Buffer buffer{decoder()};
+        for (const auto& node : buffer.select<osmium::Node>()) {
+            node_locations.push_back(pbf_node_location{node.id(), node.location()});
+        }
+        return buffer;
+    }
+
+    osmium::memory::Buffer buffer{64UL * 1024UL, osmium::memory::Buffer::auto_grow::yes};
+    for (const auto& group : dense_groups) {
+        decode_dense_nodes(group, strings, coordinates, buffer, node_locations);
+    }
+
+    return buffer;
+}
+
+static constexpr const char* block_stats_magic = "osmium-block-stats 1";
+
+static uint32_t metadata_to_bits(const osmium::metadata_options& options) noexcept {
+    return (options.version()   ? 0x01U : 0U) |
+           (options.timestamp() ? 0x02U : 0U) |
+           (options.changeset() ? 0x04U : 0U) |
+           (options.uid()       ? 0x08U : 0U) |
+           (options.user()      ? 0x10U : 0U);
+}
+
+static osmium::metadata_options bits_to_metadata(uint32_t bits) {
+    static const char* const names[] = {"version", "timestamp", "changeset", "uid", "user"};
+    std::string attributes;
+    for (uint32_t i = 0; i < 5; ++i) {
+        if (bits & (1U << i)) {
+            if (!attributes.empty()) {
+                attributes += '+';
+            }
+            attributes += names[i];
+        }
+    }
+    return osmium::metadata_options{attributes.empty() ? "none" : attributes};
+}
+
+std::string encode_pbf_block_stats(const pbf_block_stats& stats) {
+    std::string data;
+    protozero::pbf_writer pbf_stats{data};
+
+    pbf_stats.add_string(1, block_stats_magic);
+
+    pbf_stats.add_uint64(2, stats.nodes);
+    pbf_stats.add_uint64(3, stats.ways);
+    pbf_stats.add_uint64(4, stats.relations);
+
+    if (stats.nodes > 0) {
+        pbf_stats.add_sint64(5, stats.min_node_id);
+        pbf_stats.add_sint64(6, stats.max_node_id);
+    }
+    if (stats.ways > 0) {
+        pbf_stats.add_sint64(7, stats.min_way_id);
+        pbf_stats.add_sint64(8, stats.max_way_id);
+    }
+    if (stats.relations > 0) {
+        pbf_stats.add_sint64(9, stats.min_relation_id);
+        pbf_stats.add_sint64(10, stats.max_relation_id);
+    }
+
+    if (stats.bounds.valid()) {
+        pbf_stats.add_sint32(11, stats.bounds.bottom_left().x());
+        pbf_stats.add_sint32(12, stats.bounds.bottom_left().y());
+        pbf_stats.add_sint32(13, stats.bounds.top_right().x());
+        pbf_stats.add_sint32(14, stats.bounds.top_right().y());
+    }
+
+    if (stats.first_type != osmium::item_type::undefined) {
+        pbf_stats.add_uint32(15, stats.first_timestamp.seconds_since_epoch());
+        pbf_stats.add_uint32(16, stats.last_timestamp.seconds_since_epoch());
+
+        pbf_stats.add_uint32(17, metadata_to_bits(stats.metadata_all_objects));
+        pbf_stats.add_uint32(18, metadata_to_bits(stats.metadata_some_objects));
+
+        pbf_stats.add_bool(19, stats.ordered);
+        pbf_stats.add_bool(20, stats.multiple_versions);
+
+        pbf_stats.add_uint32(21, static_cast<uint32_t>(stats.first_type));
+        pbf_stats.add_sint64(22, stats.first_id);
+        pbf_stats.add_uint32(23, static_cast<uint32_t>(stats.last_type));
+        pbf_stats.add_sint64(24, stats.last_id);
+    }
+
+    return data;
+}
+
+bool decode_pbf_block_stats(const std::string& data, pbf_block_stats& stats) {
+    stats = pbf_block_stats{};
+
+    // The indexdata field can contain anything, so anything that doesn't
+    // start with our magic string is ignored.
+    protozero::pbf_reader pbf_stats{data};
+    try {
+        if (!pbf_stats.next(1) || pbf_stats.get_string() != block_stats_magic) {
+            return false;
+        }
+    } catch (const protozero::exception&) {
+        return false;
+    }
+
+    int32_t coordinates[4] = {0, 0, 0, 0};
+    bool has_bounds = false;
+
+    while (pbf_stats.next()) {
+        switch (pbf_stats.tag()) {
+            case 2:
+                stats.nodes = pbf_stats.get_uint64();
+                break;
+            case 3:
+                stats.ways = pbf_stats.get_uint64();
+                break;
+            case 4:
+                stats.relations = pbf_stats.get_uint64();
+                break;
+            case 5:
+                stats.min_node_id = pbf_stats.get_sint64();
+                break;
+            case 6:
+                stats.max_node_id = pbf_stats.get_sint64();
+                break;
+            case 7:
+                stats.min_way_id = pbf_stats.get_sint64();
+                break;
+            case 8:
+                stats.max_way_id = pbf_stats.get_sint64();
+                break;
+            case 9:
+                stats.min_relation_id = pbf_stats.get_sint64();
+                break;
+            case 10:
+                stats.max_relation_id = pbf_stats.get_sint64();
+                break;
+            case 11:
+            case 12:
+            case 13:
+            case 14:
+                coordinates[pbf_stats.tag() - 11] = pbf_stats.get_sint32();
+                has_bounds = true;
+                break;
+            case 15:
+                stats.first_timestamp = osmium::Timestamp{pbf_stats.get_uint32()};
+                break;
+            case 16:
+                stats.last_timestamp = osmium::Timestamp{pbf_stats.get_uint32()};
+                break;
+            case 17:
+                stats.metadata_all_objects = bits_to_metadata(pbf_stats.get_uint32());
+                break;
+            case 18:
+                stats.metadata_some_objects = bits_to_metadata(pbf_stats.get_uint32());
+                break;
+            case 19:
+                stats.ordered = pbf_stats.get_bool();
+                break;
+            case 20:
+                stats.multiple_versions = pbf_stats.get_bool();
+                break;
+            case 21:
+                stats.first_type = static_cast<osmium::item_type>(pbf_stats.get_uint32());
+                break;
+            case 22:
+                stats.first_id = pbf_stats.get_sint64();
+                break;
+            case 23:
+                stats.last_type = static_cast<osmium::item_type>(pbf_stats.get_uint32());
+                break;
+            case 24:
+                stats.last_id = pbf_stats.get_sint64();
+                break;
+            default:
+                pbf_stats.skip();
+        }
+    }
+
+    if (has_bounds) {
+        stats.bounds.extend(osmium::Location{coordinates[0], coordinates[1]});
+        stats.bounds.extend(osmium::Location{coordinates[2], coordinates[3]});
+    }
+
+    return true;
+}
+
+pbf_block_stats get_pbf_block_stats(const pbf_block& block) {
+    const osmium::memory::Buffer buffer{decode_pbf_block(block, osmium::osm_entity_bits::nwr)};
+
+    pbf_block_stats stats;
+    for (const auto& object : buffer.select<osmium::OSMObject>()) {
+        const auto type = object.type();
+        const auto id = object.id();
+        switch (type) {
+            case osmium::item_type::node:
+                if (stats.nodes == 0 || id < stats.min_node_id) {
+                    stats.min_node_id = id;
+                }
+                if (stats.nodes == 0 || id > stats.max_node_id) {
+                    stats.max_node_id = id;
+                }
+                ++stats.nodes;
+                stats.bounds.extend(static_cast<const osmium::Node&>(object).location());
+                break;
+            case osmium::item_type::way:
+                if (stats.ways == 0 || id < stats.min_way_id) {
+                    stats.min_way_id = id;
+                }
+                if (stats.ways == 0 || id > stats.max_way_id) {
+                    stats.max_way_id = id;
+                }
+                ++stats.ways;
+                break;
+            default: // relation
+                if (stats.relations == 0 || id < stats.min_relation_id) {
+                    stats.min_relation_id = id;
+                }
+                if (stats.relations == 0 || id > stats.max_relation_id) {
+                    stats.max_relation_id = id;
+                }
+                ++stats.relations;
+                break;
+        }
+
+        const auto metadata = osmium::detect_available_metadata(object);
+        if (stats.first_type == osmium::item_type::undefined) {
+            stats.first_type = type;
+            stats.first_id = id;
+            stats.first_timestamp = object.timestamp();
+            stats.last_timestamp = object.timestamp();
+        } else {
+            if (object.timestamp() < stats.first_timestamp) {
+                stats.first_timestamp = object.timestamp();
+            }
+            if (stats.last_timestamp < object.timestamp()) {
+                stats.last_timestamp = object.timestamp();
+            }
+            if (stats.last_type == type) {
+                if (stats.last_id == id) {
+                    stats.multiple_versions = true;
+                }
+                if (osmium::id_order{}(id, stats.last_id)) {
+                    stats.ordered = false;
+                }
+            } else if (stats.last_type > type) {
+                stats.ordered = false;
+            }
+        }
+        stats.metadata_all_objects &= metadata;
+        stats.metadata_some_objects |= metadata;
+        stats.last_type = type;
+        stats.last_id = id;
+    }
+
+    return stats;
+}
+
+void set_pbf_block_index_data(pbf_block& block, const std::string& index_data) {
+    const std::size_t blob_size = block.data.size() - block.blob_offset;
+
+    std::string blob_header;
+    {
+        protozero::pbf_writer pbf_blob_header{blob_header};
+        pbf_blob_header.add_string(1, block.type); // type
+        pbf_blob_header.add_bytes(2, index_data); // indexdata
+        pbf_blob_header.add_int32(3, static_cast<int32_t>(blob_size)); // datasize
+    }
+
+    std::string data;
+    data.reserve(4 + blob_header.size() + blob_size);
+
+    const auto size = static_cast<uint32_t>(blob_header.size());
+    data += static_cast<char>((size >> 24U) & 0xffU);
+    data += static_cast<char>((size >> 16U) & 0xffU);
+    data += static_cast<char>((size >>  8U) & 0xffU);
+    data += static_cast<char>( size         & 0xffU);
+    data += blob_header;
+    data.append(block.data, block.blob_offset, std::string::npos);
+
+    block.blob_offset = 4 + blob_header.size();
+    block.data.swap(data);
+}
+
+void add_pbf_block_stats(const std::string& filename, osmium::io::fsync fsync) {
+    const std::string tmp_filename{filename + ".stats"};
+
+    {
+        PBFBlockReader reader{filename};
+        const int fd = osmium::io::detail::open_for_writing(tmp_filename, osmium::io::overwrite::allow);
+
+        pbf_block block;
+        while (reader.read(block)) {
+            if (block.type == "OSMData") {
+                set_pbf_block_index_data(block, encode_pbf_block_stats(get_pbf_block_stats(block)));
+            }
+            osmium::io::detail::reliable_write(fd, block.data.data(), block.data.size());
+        }
+
+        if (fsync == osmium::io::fsync::yes) {
+            osmium::io::detail::reliable_fsync(fd);
+        }
+        osmium::io::detail::reliable_close(fd);
+    }
+
+    if (std::rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+        throw std::system_error{errno, std::system_category(), "Renaming '" + tmp_filename + "' to '" + filename + "' failed"};
+    }
+}
+
+namespace {
+
+    // Digest of the raw (compressed) data of a block. Blocks are only
+    // considered identical if all of these match.
+    struct blob_digest {
+
+        std::size_t size = 0;
+        uint32_t crc = 0;
+        uint64_t fnv = 0;
+
+    }; // struct blob_digest
+
+    bool operator<(const blob_digest& lhs, const blob_digest& rhs) noexcept {
+        return std::tie(lhs.size, lhs.crc, lhs.fnv) <
+               std::tie(rhs.size, rhs.crc, rhs.fnv);
+    }
+
+    blob_digest digest_blob(const pbf_block& block) noexcept {
+        const auto* begin = reinterpret_cast<const unsigned char*>(block.data.data()) + block.blob_offset;
+        const std::size_t size = block.data.size() - block.blob_offset;
+
+        blob_digest digest;
+        digest.size = size;
+        digest.crc = static_cast<uint32_t>(::crc32(0, begin, static_cast<uInt>(size)));
+
+        uint64_t fnv = 14695981039346656037ULL;
+        for (std::size_t i = 0; i < size; ++i) {
+            fnv ^= begin[i];
+            fnv *= 1099511628211ULL;
+        }
+        digest.fnv = fnv;
+
+        return digest;
+    }
+
+} // anonymous namespace
+
+identical_pbf_blocks find_identical_pbf_blocks(const std::string& filename1, const std::string& filename2) {
+    std::map<blob_digest, std::deque<std::size_t>> blocks2;
+    {
+        PBFBlockReader reader{filename2};
+        pbf_block block;
+        for (;;) {
+            const auto offset = reader.offset();
+            if (!reader.read(block)) {
+                break;
+            }
+            if (block.type == "OSMData") {
+                blocks2[digest_blob(block)].push_back(offset);
+            }
+        }
+    }
+
+    identical_pbf_blocks result;
+
+    PBFBlockReader reader{filename1};
+    pbf_block block;
+    for (;;) {
+        const auto offset = reader.offset();
+        if (!reader.read(block)) {
+            break;
+        }
+        if (block.type != "OSMData") {
+            continue;
+        }
+        const auto it = blocks2.find(digest_blob(block));
+        if (it != blocks2.end() && !it->second.empty()) {
+            result.offsets1.push_back(offset);
+            result.offsets2.push_back(it->second.front());
+            it->second.pop_front();
+        }
+    }
+
+    std::sort(result.offsets2.begin(), result.offsets2.end());
+
+    return result;
+}
+
+PBFDataReader::PBFDataReader(const std::string& filename, std::vector<std::size_t> offsets, offsets_mode mode, osmium::osm_entity_bits::type entities, bool count_skipped) :
+    m_reader(filename),
+    m_offsets(std::move(offsets)),
+    m_mode(mode),
+    m_entities(entities),
+    m_count_skipped(count_skipped) {
+}
+
+// Read next OSMData block which should be decoded.
+bool PBFDataReader::read_block(pbf_block& block) {
+    if (m_mode == offsets_mode::read) {
+        if (m_next_offset == m_offsets.size()) {
+            return false;
+        }
+        m_reader.seek(m_offsets[m_next_offset++]);
+        return m_reader.read(block);
+    }
+
+    for (;;) {
+        const auto offset = m_reader.offset();
+        if (!m_reader.read(block)) {
+            return false;
+        }
+        if (block.type != "OSMData") {
+            continue;
+        }
+        while (m_next_offset < m_offsets.size() && m_offsets[m_next_offset] < offset) {
+            ++m_next_offset;
+        }
+        if (m_next_offset < m_offsets.size() && m_offsets[m_next_offset] == offset) {
+            ++m_next_offset;
+            if (m_count_skipped) {
+                m_skipped_objects += count_pbf_block_objects(block, m_entities);
+            }
+            continue;
+        }
+        return true;
+    }
+}
+
+void PBFDataReader::fill() {
+    while (!m_eof && m_pending.size() < max_pending) {
+        std::shared_ptr<pbf_block> block{new pbf_block{}};
+        if (!read_block(*block)) {
+            m_eof = true;
+            return;
+        }
+        const auto entities = m_entities;
+        m_pending.push_back(osmium::thread::Pool::default_instance().submit([block, entities]() {
+            return decode_pbf_block(*block, entities);
+        }));
+    }
+}
+
+osmium::memory::Buffer PBFDataReader::read() {
+    for (;;) {
+        fill();
+        if (m_pending.empty()) {
+            return osmium::memory::Buffer{};
+        }
+        osmium::memory::Buffer buffer{m_pending.front().get()};
+        m_pending.pop_front();
+        if (buffer.committed() > 0) {
+            return buffer;
+        }
+    }
+}
+
+PBFTaggedReader::PBFTaggedReader(const std::string& filename, osmium::osm_entity_bits::type entities) :
+    m_reader(filename),
+    m_entities(entities) {
+}
+
+void PBFTaggedReader::fill() {
+    while (!m_eof && m_pending.size() < max_pending) {
+        std::shared_ptr<pbf_block> block{new pbf_block{}};
+        if (!m_reader.read(*block)) {
+            m_eof = true;
+            return;
+        }
+        if (block->type != "OSMData") {
+            continue;
+        }
+        const auto entities = m_entities;
+        m_pending.push_back(osmium::thread::Pool::default_instance().submit([block, entities]() {
+            decoded_block result;
+            result.buffer = decode_pbf_block_tagged(*block, entities, result.node_locations);
+            return result;
+        }));
+    }
+}
+
+bool PBFTaggedReader::read(osmium::memory::Buffer& buffer, std::vector<pbf_node_location>& node_locations) {
+    fill();
+    if (m_pending.empty()) {
+        return false;
+    }
+    auto result = m_pending.front().get();
+    m_pending.pop_front();
+    buffer = std::move(result.buffer);
+    node_locations = std::move(result.node_locations);
+    return true;
+}
+
+// Is the "Sort.Type_then_ID" optional feature set in the header block?
+static bool pbf_header_is_sorted(const pbf_block& block) {
+    std::string output;
+    protozero::pbf_reader pbf_header_block{decode_blob(block, output)};
+    while (pbf_header_block.next(5)) { // optional_features
+        if (pbf_header_block.get_string() == "Sort.Type_then_ID") {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Bits for the types of objects in an OSMData block.
+enum pbf_type_bits : uint8_t {
+    pbf_type_none     = 0x00U,
+    pbf_type_node     = 0x01U,
+    pbf_type_way      = 0x02U,
+    pbf_type_relation = 0x04U,
+    pbf_type_unknown  = 0x80U
+};
+
+static uint8_t pbf_block_type_bits(const pbf_block& block) {
+    uint8_t bits = pbf_type_none;
+    for_each_pbf_block_id(block, [&bits](osmium::item_type type, int64_t /*id*/) {
+        switch (type) {
+            case osmium::item_type::node:
+                bits |= pbf_type_node;
+                break;
+            case osmium::item_type::way:
+                bits |= pbf_type_way;
+                break;
+            default:
+                bits |= pbf_type_relation;
+        }
+    });
+    return bits;
+}
+
+pbf_type_blocks get_pbf_type_blocks(const std::string& filename) {
+    PBFBlockReader reader{filename};
+    pbf_blob_header header;
+    pbf_block block;
+    pbf_block_stats stats;
+    bool sorted = false;
+    if (reader.read(block) && block.type == "OSMHeader") {
+        sorted = pbf_header_is_sorted(block);
+    } else {
+        reader.seek(0);
+    }
+
+    // The type bits of all OSMData blocks, from the block statistics if
+    // available, otherwise they are unknown for now.
+    std::vector<std::size_t> offsets;
+    std::vector<uint8_t> types;
+    std::size_t unknown = 0;
+    while (reader.read_header(header)) {
+        if (header.type != "OSMData") {
+            continue;
+        }
+
+        offsets.push_back(header.offset);
+        if (decode_pbf_block_stats(header.index_data, stats)) {
+            types.push_back(static_cast<uint8_t>((stats.nodes > 0 ? pbf_type_node : pbf_type_none) |
+                                                 (stats.ways > 0 ? pbf_type_way : pbf_type_none) |
+                                                 (stats.relations > 0 ? pbf_type_relation : pbf_type_none)));
+        } else {
+            types.push_back(pbf_type_unknown);
+            ++unknown;
+        }
+    }
+
+    const auto probe = [&](std::size_t n) -> uint8_t {
+        if (types[n] == pbf_type_unknown) {
+            reader.seek(offsets[n]);
+            reader.read(block);
+            types[n] = pbf_block_type_bits(block);
+        }
+        return types[n];
+    };
+
+    // In a sorted file the smallest and the largest type in the blocks
+    // never decrease. So the blocks with objects of some type are one
+    // range which can be found with a binary search decoding only a few
+    // blocks. This doesn't work if there are empty blocks.
+    bool searched = false;
+    if (sorted && unknown > 0) {
+        const auto find_first = [&](const std::function<bool(uint8_t)>& predicate) -> std::size_t {
+            std::size_t lo = 0;
+            std::size_t hi = offsets.size();
+            while (lo < hi) {
+                const std::size_t mid = lo + (hi - lo) / 2;
+                if (predicate(probe(mid))) {
+                    hi = mid;
+                } else {
+                    lo = mid + 1;
+                }
+            }
+            return lo;
+        };
+
+        std::vector<uint8_t> range_types(offsets.size(), pbf_type_none);
+        bool has_empty = false;
+        for (const uint8_t type : {pbf_type_node, pbf_type_way, pbf_type_relation}) {
+            // First block with objects of this type or a larger type and
+            // first block with only objects of larger types.
+            const std::size_t first = find_first([&](uint8_t bits) -> bool {
+                has_empty = has_empty || bits == pbf_type_none;
+                return bits >= type;
+            });
+            const std::size_t last = find_first([&](uint8_t bits) -> bool {
+                has_empty = has_empty || bits == pbf_type_none;
+                return (bits & ((type << 1U) - 1U)) == 0;
+            });
+            for (std::size_t n = first; n < last; ++n) {
+                range_types[n] |= type;
+            }
+        }
+
+        if (!has_empty) {
+            types.swap(range_types);
+            searched = true;
+        }
+    }
+
+    pbf_type_blocks result;
+    for (std::size_t n = 0; n < offsets.size(); ++n) {
+        const uint8_t bits = searched ? types[n] : probe(n);
+        if ((bits & pbf_type_node) != 0) {
+            result.nodes.push_back(offsets[n]);
+        }
+        if ((bits & pbf_type_way) != 0) {
+            result.ways.push_back(offsets[n]);
+        }
+        if ((bits & pbf_type_relation) != 0) {
+            result.relations.push_back(offsets[n]);
+        }
+    }
+
+    return result;
+}
+
+pbf_node_id_stats get_pbf_node_id_stats(const std::string& filename) {
+    pbf_node_id_stats result;
+
+    PBFBlockReader reader{filename};
+    pbf_block block;
+    if (!reader.read(block) || block.type != "OSMHeader") {
+        return result;
+    }
+    const bool sorted = pbf_header_is_sorted(block);
+
+    std::vector<std::size_t> offsets;
+    bool all_stats = true;
+    pbf_blob_header header;
+    pbf_block_stats stats;
+    while (reader.read_header(header)) {
+        if (header.type != "OSMData") {
+            continue;
+        }
+        offsets.push_back(header.offset);
+        if (!all_stats) {
+            continue;
+        }
+        if (decode_pbf_block_stats(header.index_data, stats)) {
+            if (stats.nodes > 0) {
+                result.nodes += stats.nodes;
+                result.max_id = std::max(result.max_id, stats.max_node_id);
+            }
+        } else {
+            all_stats = false;
+        }
+    }
+
+    if (all_stats) {
+        result.valid = true;
+        result.exact = true;
+        return result;
+    }
+
+    result = pbf_node_id_stats{};
+    if (!sorted) {
+        return result;
+    }
+
+    result.valid = true;
+    if (offsets.empty()) {
+        result.exact = true;
+        return result;
+    }
+
+    // Decode the IDs of one block and count its nodes.
+    const auto probe = [&](std::size_t n, osmium::object_id_type& max_id) -> uint64_t {
+        reader.seek(offsets[n]);
+        reader.read(block);
+        uint64_t count = 0;
+        for_each_pbf_block_id(block, [&](osmium::item_type type, int64_t id) {
+            if (type == osmium::item_type::node) {
+                ++count;
+                max_id = std::max(max_id, id);
+            }
+        });
+        return count;
+    };
+
+    osmium::object_id_type max_id = 0;
+    const uint64_t first_count = probe(0, max_id);
+    if (first_count == 0) {
+        return result;
+    }
+
+    // In a sorted file all blocks with nodes come before the others.
+    // The block at lo always contains nodes, the block at hi never.
+    std::size_t lo = 0;
+    std::size_t hi = offsets.size();
+    uint64_t last_count = first_count;
+    while (hi - lo > 1) {
+        const std::size_t mid = lo + (hi - lo) / 2;
+        osmium::object_id_type mid_max_id = 0;
+        const uint64_t count = probe(mid, mid_max_id);
+        if (count > 0) {
+            lo = mid;
+            last_count = count;
+            max_id = mid_max_id;
+        } else {
+            hi = mid;
+        }
+    }
+
+    result.nodes = lo * first_count + last_count;
+    result.max_id = max_id;
+
+    return result;
+}
+
+std::vector<std::size_t> get_pbf_blocks_newer_than(const std::string& filename, osmium::Timestamp timestamp) {
+    std::vector<std::size_t> offsets;
+
+    PBFBlockReader reader{filename};
+    pbf_blob_header header;
+    pbf_block_stats stats;
+    while (reader.read_header(header)) {
+        if (header.type != "OSMData") {
+            continue;
+        }
+        if (decode_pbf_block_stats(header.index_data, stats) &&
+            stats.nodes + stats.ways + stats.relations > 0 &&
+            stats.first_timestamp > timestamp) {
+            offsets.push_back(header.offset);
+        }
+    }
+
+    return offsets;
+}
+
+std::vector<std::size_t> find_pbf_blocks_with_ids(const std::string& filename,
+                                                  osmium::item_type type,
+                                                  osmium::object_id_type from,
+                                                  osmium::object_id_type to) {
+    assert(from > 0 && from <= to);
+
+    PBFBlockReader reader{filename};
+    pbf_blob_header header;
+    pbf_block block;
+    pbf_block_stats stats;
+    bool sorted = false;
+    if (reader.read(block) && block.type == "OSMHeader") {
+        sorted = pbf_header_is_sorted(block);
+    } else {
+        reader.seek(0);
+    }
+
+    const auto make_key = [](osmium::item_type key_type, osmium::object_id_type id) {
+        pbf_object_key key;
+        key.type = key_type;
+        key.positive = id > 0;
+        key.id = static_cast<osmium::unsigned_object_id_type>(id < 0 ? -id : id);
+        return key;
+    };
+
+    const pbf_object_key min = make_key(type, from);
+    const pbf_object_key max = make_key(type, to);
+
+    // Whether each OSMData block contains objects in the range, from the
+    // block statistics if available, otherwise it is unknown for now.
+    // For blocks with ordered objects the first and last key are also
+    // known from the statistics.
+    enum class contains : uint8_t {
+        no = 0,
+        yes = 1,
+        unknown = 2
+    };
+
+    std::vector<std::size_t> offsets;
+    std::vector<contains> states;
+    std::vector<pbf_block_range> ranges;
+    std::vector<bool> has_range;
+    std::size_t unknown = 0;
+    while (reader.read_header(header)) {
+        if (header.type != "OSMData") {
+            continue;
+        }
+
+        offsets.push_back(header.offset);
+        ranges.emplace_back();
+        has_range.push_back(false);
+        if (!decode_pbf_block_stats(header.index_data, stats)) {
+            states.push_back(contains::unknown);
+            ++unknown;
+            continue;
+        }
+
+        bool in_range = false;
+        switch (type) {
+            case osmium::item_type::node:
+                in_range = stats.nodes > 0 && stats.min_node_id <= to && stats.max_node_id >= from;
+                break;
+            case osmium::item_type::way:
+                in_range = stats.ways > 0 && stats.min_way_id <= to && stats.max_way_id >= from;
+                break;
+            case osmium::item_type::relation:
+                in_range = stats.relations > 0 && stats.min_relation_id <= to && stats.max_relation_id >= from;
+                break;
+            default:
+                break;
+        }
+        states.push_back(in_range ? contains::yes : contains::no);
+
+        if (stats.ordered && stats.nodes + stats.ways + stats.relations > 0) {
+            ranges.back().min = make_key(stats.first_type, stats.first_id);
+            ranges.back().max = make_key(stats.last_type, stats.last_id);
+            has_range.back() = true;
+        }
+    }
+
+    // Decode the IDs of a block to find out whether it contains objects
+    // in the range and what its smallest and largest keys are.
+    const auto probe = [&](std::size_t n) {
+        if (states[n] != contains::unknown && has_range[n]) {
+            return;
+        }
+        reader.seek(offsets[n]);
+        reader.read(block);
+        bool in_range = false;
+        bool found = false;
+        for_each_pbf_block_id(block, [&](osmium::item_type block_type, int64_t id) {
+            const auto key = make_key(block_type, id);
+            in_range = in_range || (block_type == type && id >= from && id <= to);
+            if (!found || key < ranges[n].min) {
+                ranges[n].min = key;
+            }
+            if (!found || ranges[n].max < key) {
+                ranges[n].max = key;
+            }
+            found = true;
+        });
+        states[n] = in_range ? contains::yes : contains::no;
+        has_range[n] = found;
+    };
+
+    // In a sorted file the blocks which can contain objects in the range
+    // are one range of blocks which can be found with a binary search
+    // decoding only a few blocks. The blocks in between contain objects
+    // in the range unless there are gaps in the IDs, so they are
+    // returned without decoding them. This doesn't work if there are
+    // empty blocks.
+    if (sorted && unknown > 0) {
+        bool has_empty = false;
+        const auto find_first = [&](const std::function<bool(const pbf_block_range&)>& predicate) -> std::size_t {
+            std::size_t lo = 0;
+            std::size_t hi = offsets.size();
+            while (lo < hi) {
+                const std::size_t mid = lo + (hi - lo) / 2;
+                probe(mid);
+                has_empty = has_empty || !has_range[mid];
+                if (predicate(ranges[mid])) {
+                    hi = mid;
+                } else {
+                    lo = mid + 1;
+                }
+            }
+            return lo;
+        };
+
+        const std::size_t first = find_first([&](const pbf_block_range& range) {
+            return !(range.max < min);
+        });
+        const std::size_t last = find_first([&](const pbf_block_range& range) {
+            return max < range.min;
+        });
+
+        if (!has_empty) {
+            std::vector<std::size_t> result;
+            for (std::size_t n = first; n < last; ++n) {
+                if (states[n] != contains::no) {
+                    result.push_back(offsets[n]);
+                }
+            }
+            return result;
+        }
+    }
+
+    std::vector<std::size_t> result;
+    for (std::size_t n = 0; n < offsets.size(); ++n) {
+        if (states[n] == contains::unknown) {
+            probe(n);
+        }
+        if (states[n] == contains::yes) {
+            result.push_back(offsets[n]);
+        }
+    }
+
+    return result;
+}
+
+pbf_block_index build_pbf_block_index(const std::string& filename) {
+    pbf_block_index index;
+    index.file_size = osmium::file_size(filename);
+
+    PBFBlockReader reader{filename};
+    pbf_block block;
+    if (!reader.read(block) || block.type != "OSMHeader") {
+        throw osmium::io_error{"Missing header block in PBF file '" + filename + "'"};
+    }
+
+    for (;;) {
+        pbf_block_range range;
+        range.offset = reader.offset();
+        if (!reader.read(block)) {
+            break;
+        }
+        if (block.type == "OSMData" && get_pbf_block_range(block, range.min, range.max)) {
+            index.blocks.push_back(range);
+        }
+    }
+
+    return index;
+}
+
+static constexpr const char* block_index_magic = "osmium-pbf-block-index 1";
+
+// Keys are written as type character followed by the signed ID.
+std::string pbf_object_key_to_string(const pbf_object_key& key) {
+    std::string out(1, osmium::item_type_to_char(key.type));
+    if (!key.positive && key.id != 0) {
+        out += '-';
+    }
+    out += std::to_string(key.id);
+    return out;
+}
+
+bool pbf_object_key_from_string(const std::string& str, pbf_object_key& key) {
+    if (str.size() < 2) {
+        return false;
+    }
+    key.type = osmium::char_to_item_type(str[0]);
+    if (key.type != osmium::item_type::node &&
+        key.type != osmium::item_type::way &&
+        key.type != osmium::item_type::relation) {
+        return false;
+    }
+    const bool negative = str[1] == '-';
+    const char* digits = str.c_str() + (negative ? 2 : 1);
+    if (*digits < '0' || *digits > '9') {
+        return false;
+    }
+    char* end = nullptr;
+    key.id = std::strtoull(digits, &end, 10);
+    if (*end != '\0') {
+        return false;
+    }
+    key.positive = !negative && key.id != 0;
+    return true;
+}
+
+void write_pbf_block_index(const std::string& filename, const pbf_block_index& index) {
+    std::ofstream out{filename};
+    if (!out.is_open()) {
+        throw osmium::io_error{"Could not open block index file '" + filename + "' for writing"};
+    }
+
+    out << block_index_magic << '\n';
+    out << "file_size " << index.file_size << '\n';
+    for (const auto& range : index.blocks) {
+        out << range.offset << ' ' << pbf_object_key_to_string(range.min) << ' ' << pbf_object_key_to_string(range.max) << '\n';
+    }
+
+    out.close();
+    if (out.fail()) {
+        throw osmium::io_error{"Error writing block index file '" + filename + "'"};
+    }
+}
+
+pbf_block_index read_pbf_block_index(const std::string& filename) {
+    std::ifstream in{filename};
+    if (!in.is_open()) {
+        throw osmium::io_error{"Could not open block index file '" + filename + "'"};
+    }
+
+    const osmium::io_error format_error{"Block index file '" + filename + "' has wrong format"};
+
+    std::string line;
+    if (!std::getline(in, line) || line != block_index_magic) {
+        throw format_error;
+    }
+
+    pbf_block_index index;
+    std::string name;
+    if (!std::getline(in, line)) {
+        throw format_error;
+    }
+    std::istringstream header_line{line};
+    if (!(header_line >> name >> index.file_size) || name != "file_size") {
+        throw format_error;
+    }
+
+    while (std::getline(in, line)) {
+        if (line.empty()) {
+            continue;
+        }
+        std::istringstream block_line{line};
+        pbf_block_range range;
+        std::string min;
+        std::string max;
+        if (!(block_line >> range.offset >> min >> max) ||
+            !pbf_object_key_from_string(min, range.min) ||
+            !pbf_object_key_from_string(max, range.max)) {
+            throw format_error;
+        }
+        index.blocks.push_back(range);
+    }
+
+    return index;
+}
+
+std::vector<std::size_t> find_pbf_blocks(const pbf_block_index& index, const std::vector<pbf_object_key>& keys) {
+    std::vector<std::size_t> offsets;
+    for (const auto& range : index.blocks) {
+        const auto it = std::lower_bound(keys.begin(), keys.end(), range.min);
+        if (it != keys.end() && !(range.max < *it)) {
+            offsets.push_back(range.offset);
+        }
+    }
+    std::sort(offsets.begin(), offsets.end());
+    return offsets;
+}
+
+// The object index file starts with a magic number, the size of the PBF
+// file and the number of entries. Each entry has the encoded key and the
+// block offset and number of the object in the block packed into one
+// integer.
+static constexpr const uint64_t object_index_magic = 0x3158444e494a424fULL; // "OBJINDX1"
+static constexpr const std::size_t object_index_header_size = 3 * sizeof(uint64_t);
+static constexpr const std::size_t object_index_entry_size = 2 * sizeof(uint64_t);
+static constexpr const unsigned int object_index_bits = 24U;
+
+// Encode the key so that the order of the integers is the order of the
+// keys.
+static uint64_t encode_object_key(const pbf_object_key& key) noexcept {
+    return (static_cast<uint64_t>(key.type) << 62U) |
+           (static_cast<uint64_t>(key.positive) << 61U) |
+           (key.id & ((1ULL << 61U) - 1));
+}
+
+PBFObjectIndex::PBFObjectIndex(const std::string& filename) :
+    m_filename(filename),
+    m_file(filename, std::ios::binary) {
+    if (!m_file.is_open()) {
+        throw osmium::io_error{"Could not open object index file '" + filename + "'"};
+    }
+
+    uint64_t header[3];
+    if (!m_file.read(reinterpret_cast<char*>(header), sizeof(header)) || header[0] != object_index_magic) { // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
+        throw osmium::io_error{"Object index file '" + filename + "' has wrong format"};
+    }
+    m_file_size = header[1];
+    m_size = header[2];
+}
+
+uint64_t PBFObjectIndex::read_entry(std::size_t n, uint64_t& position) {
+    uint64_t entry[2];
+    m_file.seekg(static_cast<std::streamoff>(object_index_header_size + n * object_index_entry_size));
+    if (!m_file.read(reinterpret_cast<char*>(entry), sizeof(entry))) { // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
+        throw osmium::io_error{"Truncated object index file '" + m_filename + "'"};
+    }
+    position = entry[1];
+    return entry[0];
+}
+
+std::vector<pbf_object_position> PBFObjectIndex::find(const std::vector<pbf_object_key>& keys) {
+    std::vector<pbf_object_position> positions;
+
+    // The keys are sorted, so the search for each key can start where
+    // the last one ended.
+    std::size_t start = 0;
+    uint64_t position = 0;
+    for (const auto& k : keys) {
+        const auto key = encode_object_key(k);
+        std::size_t lo = start;
+        std::size_t hi = m_size;
+        while (lo < hi) {
+            const std::size_t mid = lo + (hi - lo) / 2;
+            if (read_entry(mid, position) < key) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        start = lo;
+        for (; start < m_size && read_entry(start, position) == key; ++start) {
+            pbf_object_position pos;
+            pos.offset = static_cast<std::size_t>(position >> object_index_bits);
+            pos.index = static_cast<std::size_t>(position & ((1ULL << object_index_bits) - 1));
+            positions.push_back(pos);
+        }
+    }
+
+    std::sort(positions.begin(), positions.end(), [](const pbf_object_position& lhs, const pbf_object_position& rhs) {
+        return std::tie(lhs.offset, lhs.index) < std::tie(rhs.offset, rhs.index);
+    });
+
+    return positions;
+}
+
+void write_pbf_object_index(const std::string& filename, const std::string& index_filename) {
+    std::ofstream out{index_filename, std::ios::binary};
+    if (!out.is_open()) {
+        throw osmium::io_error{"Could not open object index file '" + index_filename + "' for writing"};
+    }
+
+    uint64_t header[3] = {object_index_magic, osmium::file_size(filename), 0};
+    out.write(reinterpret_cast<const char*>(header), sizeof(header)); // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
+
+    PBFBlockReader reader{filename};
+    pbf_block block;
+    if (!reader.read(block) || block.type != "OSMHeader") {
+        throw osmium::io_error{"Missing header block in PBF file '" + filename + "'"};
+    }
+
+    uint64_t last_key = 0;
+    for (;;) {
+        const std::size_t offset = reader.offset();
+        if (!reader.read(block)) {
+            break;
+        }
+        if (block.type != "OSMData") {
+            continue;
+        }
+        if (static_cast<uint64_t>(offset) >= (1ULL << (64U - object_index_bits))) {
+            throw osmium::io_error{"PBF file '" + filename + "' is too large. Can not create object index."};
+        }
+        std::size_t n = 0;
+        for_each_pbf_block_id(block, [&](osmium::item_type type, int64_t id) {
+            pbf_object_key k;
+            k.type = type;
+            k.positive = id > 0;
+            k.id = static_cast<osmium::unsigned_object_id_type>(id < 0 ? -id : id);
+            if (n >= (1ULL << object_index_bits)) {
+                throw osmium::io_error{"Too many objects in block of PBF file '" + filename + "'. Can not create object index."};
+            }
+            const uint64_t entry[2] = {encode_object_key(k), (static_cast<uint64_t>(offset) << object_index_bits) | n};
+            if (entry[0] < last_key) {
+                throw osmium::io_error{"PBF file '" + filename + "' is not sorted by type and ID. Can not create object index."};
+            }
+            last_key = entry[0];
+            out.write(reinterpret_cast<const char*>(entry), sizeof(entry)); // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
+            ++n;
+            ++header[2];
+        });
+    }
+
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(header), sizeof(header)); // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
+    out.close();
+    if (out.fail()) {
+        throw osmium::io_error{"Error writing object index file '" + index_filename + "'"};
+    }
+}
+
+osmium::memory::Buffer read_pbf_objects(PBFBlockReader& reader, const std::vector<pbf_object_position>& positions) {
+    osmium::memory::Buffer result{1024 * 1024, osmium::memory::Buffer::auto_grow::yes};
+
+    pbf_block block;
+    auto it = positions.begin();
+    while (it != positions.end()) {
+        const auto offset = it->offset;
+        reader.seek(offset);
+        if (!reader.read(block) || block.type != "OSMData") {
+            throw osmium::io_error{"Object index does not match PBF file"};
+        }
+        const auto buffer = decode_pbf_block(block, osmium::osm_entity_bits::object);
+        std::size_t n = 0;
+        for (const auto& object : buffer.select<osmium::OSMObject>()) {
+            if (it == positions.end() || it->offset != offset) {
+                break;
+            }
+            if (it->index == n) {
+                result.add_item(object);
+                result.commit();
+                ++it;
+            }
+            ++n;
+        }
+        if (it != positions.end() && it->offset == offset) {
+            throw osmium::io_error{"Object index does not match PBF file"};
+        }
+    }
+
+    return result;
+}
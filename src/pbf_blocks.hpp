@@ -0,0 +1,627 @@
+#ifndef PBF_BLOCKS_HPP
+#define PBF_BLOCKS_HPP
+
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <osmium/io/header.hpp>
+#include <osmium/io/writer_options.hpp>
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm/box.hpp>
+#include <osmium/osm/entity_bits.hpp>
+#include <osmium/osm/item_type.hpp>
+#include <osmium/osm/location.hpp>
+#include <osmium/osm/metadata_options.hpp>
+#include <osmium/osm/timestamp.hpp>
+#include <osmium/osm/types.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * Type and ID of an object in the order used in sorted OSM files.
+ */
+struct pbf_object_key {
+
+    osmium::item_type type = osmium::item_type::undefined;
+    bool positive = false;
+    osmium::unsigned_object_id_type id = 0;
+
+}; // struct pbf_object_key
+
+bool operator<(const pbf_object_key& lhs, const pbf_object_key& rhs) noexcept;
+
+/**
+ * Convert key to and from a string with the type character followed by
+ * the signed ID (for instance "n-17"). Used in text based index files.
+ */
+std::string pbf_object_key_to_string(const pbf_object_key& key);
+bool pbf_object_key_from_string(const std::string& str, pbf_object_key& key);
+
+/**
+ * A block from a PBF file as read from disk: The length prefix, the
+ * BlobHeader and the (compressed) Blob. It can be written out again as
+ * is without any decoding.
+ */
+struct pbf_block {
+
+    std::string type;
+    std::string data;
+    std::size_t blob_offset = 0;
+
+}; // struct pbf_block
+
+/**
+ * The information from the BlobHeader of a PBF block. Used when walking
+ * through a file without reading the blobs.
+ */
+struct pbf_blob_header {
+
+    std::string type;
+
+    // Contents of the optional indexdata field.
+    std::string index_data;
+
+    // Offset of the block in the file and size of the whole block on
+    // disk including the length prefix and the BlobHeader.
+    std::size_t offset = 0;
+    std::size_t size = 0;
+
+}; // struct pbf_blob_header
+
+class RemoteFile;
+
+/**
+ * Reads raw blocks from a PBF file. The file can also be a remote file
+ * given as http(s):// or s3:// URL, it is then read with range requests.
+ */
+class PBFBlockReader {
+
+    std::string m_filename;
+    std::unique_ptr<RemoteFile> m_remote;
+    int m_fd = -1;
+    std::size_t m_offset = 0;
+
+    // Data up to this offset was announced to the kernel with
+    // posix_fadvise(). Only used while the file is read sequentially.
+    std::size_t m_readahead_end = 0;
+    bool m_readahead = true;
+
+    // Set while the file is accessed randomly, that is after a seek
+    // backwards or far forwards.
+    bool m_random_access = false;
+
+    bool read_exactly(char* data, std::size_t size);
+
+    void readahead();
+
+    void skip(std::size_t size);
+
+    bool read_blob_header(std::string& data, std::string& type, std::string* index_data, std::size_t& blob_size);
+
+public:
+
+    explicit PBFBlockReader(const std::string& filename);
+
+    PBFBlockReader(const PBFBlockReader&) = delete;
+    PBFBlockReader& operator=(const PBFBlockReader&) = delete;
+
+    PBFBlockReader(PBFBlockReader&&) = delete;
+    PBFBlockReader& operator=(PBFBlockReader&&) = delete;
+
+    ~PBFBlockReader() noexcept;
+
+    // Offset of the next block in the file.
+    std::size_t offset() const noexcept {
+        return m_offset;
+    }
+
+    // Position the file at the given offset. Only works on real files
+    // and remote files. After a seek backwards or far forwards the reader
+    // doesn't ask the kernel to read ahead until it only seeks a short
+    // distance forwards again. Remote files stop prefetching data for
+    // good.
+    void seek(std::size_t offset);
+
+    // Read the next block. Returns false at the end of the file.
+    bool read(pbf_block& block);
+
+    // Read only the BlobHeader of the next block and skip the Blob.
+    // Returns false at the end of the file.
+    bool read_header(pbf_blob_header& header);
+
+}; // class PBFBlockReader
+
+/**
+ * Writes a PBF file with a newly encoded header block and data blocks
+ * copied as they are.
+ */
+class PBFBlockWriter {
+
+    int m_fd;
+    osmium::io::fsync m_fsync;
+
+public:
+
+    PBFBlockWriter(const std::string& filename,
+                   const osmium::io::Header& header,
+                   osmium::io::overwrite overwrite,
+                   osmium::io::fsync fsync);
+
+    PBFBlockWriter(const PBFBlockWriter&) = delete;
+    PBFBlockWriter& operator=(const PBFBlockWriter&) = delete;
+
+    PBFBlockWriter(PBFBlockWriter&&) = delete;
+    PBFBlockWriter& operator=(PBFBlockWriter&&) = delete;
+
+    ~PBFBlockWriter() noexcept;
+
+    void write(const pbf_block& block);
+
+    void close();
+
+}; // class PBFBlockWriter
+
+/**
+ * Decode the parts of an OSMHeader block osmium knows about (bounding
+ * box, generator, history flag, sorting, and replication settings).
+ * All other required and optional features are kept in the header
+ * options "pbf_required_feature_N" and "pbf_optional_feature_N" like
+ * the libosmium PBF reader does, the PBFBlockWriter writes them into
+ * its header again.
+ */
+osmium::io::Header decode_pbf_header(const pbf_block& block);
+
+/**
+ * Get the features from the "pbf_required_feature_N" and
+ * "pbf_optional_feature_N" header options (except the sorting which is
+ * handled separately). They describe how the data blocks are encoded
+ * (for instance "LocationsOnWays"), so blocks copied without decoding
+ * them need an output file header declaring the same features. The
+ * result is sorted and optional features are prefixed with "optional ".
+ */
+std::vector<std::string> get_pbf_features(const osmium::io::Header& header);
+
+/**
+ * Copy the features (see get_pbf_features()) from one header to another.
+ */
+void copy_pbf_features(const osmium::io::Header& from, osmium::io::Header& to);
+
+/**
+ * Get the smallest and largest key of the objects in an OSMData block.
+ * This decompresses the block but only decodes the IDs. Returns false
+ * if the block doesn't contain any objects.
+ */
+bool get_pbf_block_range(const pbf_block& block, pbf_object_key& min, pbf_object_key& max);
+
+/**
+ * Count the objects of the given types in an OSMData block. This
+ * decompresses the block but only decodes the IDs.
+ */
+std::size_t count_pbf_block_objects(const pbf_block& block, osmium::osm_entity_bits::type entities = osmium::osm_entity_bits::nwr);
+
+/**
+ * Check the strings in the string table of an OSMData block (keys,
+ * values, roles, and user names) with the predicate. Returns true as
+ * soon as the predicate returns true for one of them. This decompresses
+ * the block but doesn't decode any objects.
+ */
+bool pbf_block_has_string(const pbf_block& block, const std::function<bool(const std::string&)>& predicate);
+
+/**
+ * Decode the objects of the given types from an OSMData block.
+ */
+osmium::memory::Buffer decode_pbf_block(const pbf_block& block, osmium::osm_entity_bits::type entities);
+
+/**
+ * ID and location of a node.
+ */
+struct pbf_node_location {
+
+    osmium::object_id_type id;
+    osmium::Location location;
+
+}; // struct pbf_node_location
+
+/**
+ * Decode the objects of the given types from an OSMData block without
+ * metadata. The IDs and locations of all nodes are added to
+ * node_locations in the order of the block. If the block only contains
+ * dense nodes, the untagged nodes are not decoded into objects. Other
+ * blocks are decoded completely.
+ */
+osmium::memory::Buffer decode_pbf_block_tagged(const pbf_block& block, osmium::osm_entity_bits::type entities, std::vector<pbf_node_location>& node_locations);
+
+/**
+ * Offsets of the OSMData blocks with the same raw (compressed) data in
+ * two PBF files. Both vectors are sorted.
+ */
+struct identical_pbf_blocks {
+
+    std::vector<std::size_t> offsets1;
+    std::vector<std::size_t> offsets2;
+
+}; // struct identical_pbf_blocks
+
+/**
+ * Find the OSMData blocks which are in both PBF files with exactly the
+ * same content. Only the raw data is compared, nothing is decompressed.
+ */
+identical_pbf_blocks find_identical_pbf_blocks(const std::string& filename1, const std::string& filename2);
+
+/**
+ * Reads the objects from the OSMData blocks of a PBF file. Either all
+ * blocks except those at the given offsets are read or only those at the
+ * given offsets. Blocks are decoded ahead on the default thread pool. Can
+ * be used with osmium::io::make_input_iterator_range() like an
+ * osmium::io::Reader.
+ */
+class PBFDataReader {
+
+    static constexpr const std::size_t max_pending = 10;
+
+public:
+
+    enum class offsets_mode {
+        skip = 0,
+        read = 1
+    };
+
+private:
+
+    PBFBlockReader m_reader;
+    std::vector<std::size_t> m_offsets;
+    std::size_t m_next_offset = 0;
+    offsets_mode m_mode;
+    osmium::osm_entity_bits::type m_entities;
+    std::deque<std::future<osmium::memory::Buffer>> m_pending;
+    uint64_t m_skipped_objects = 0;
+    bool m_count_skipped;
+    bool m_eof = false;
+
+    bool read_block(pbf_block& block);
+
+    void fill();
+
+public:
+
+    // The offsets must be sorted.
+    PBFDataReader(const std::string& filename, std::vector<std::size_t> offsets, offsets_mode mode, osmium::osm_entity_bits::type entities, bool count_skipped = false);
+
+    // Returns an invalid buffer at the end of the file.
+    osmium::memory::Buffer read();
+
+    // Offset in the file up to which blocks have been read.
+    std::size_t offset() const noexcept {
+        return m_reader.offset();
+    }
+
+    // Number of objects in skipped blocks, only counted if count_skipped
+    // was set in the constructor.
+    uint64_t skipped_objects() const noexcept {
+        return m_skipped_objects;
+    }
+
+}; // class PBFDataReader
+
+/**
+ * Reads the objects from the OSMData blocks of a PBF file like
+ * PBFDataReader, but without metadata and without most untagged nodes.
+ * The locations of all nodes are returned separately (see
+ * decode_pbf_block_tagged()). For users which only need untagged nodes
+ * for their locations.
+ */
+class PBFTaggedReader {
+
+    static constexpr const std::size_t max_pending = 10;
+
+    struct decoded_block {
+        osmium::memory::Buffer buffer;
+        std::vector<pbf_node_location> node_locations;
+    };
+
+    PBFBlockReader m_reader;
+    osmium::osm_entity_bits::type m_entities;
+    std::deque<std::future<decoded_block>> m_pending;
+    bool m_eof = false;
+
+    void fill();
+
+public:
+
+    PBFTaggedReader(const std::string& filename, osmium::osm_entity_bits::type entities);
+
+    // Get the objects and the node locations of the next block. Returns
+    // false at the end of the file.
+    bool read(osmium::memory::Buffer& buffer, std::vector<pbf_node_location>& node_locations);
+
+    // Offset in the file up to which blocks have been read.
+    std::size_t offset() const noexcept {
+        return m_reader.offset();
+    }
+
+}; // class PBFTaggedReader
+
+/**
+ * Offsets of the OSMData blocks in a PBF file containing objects of each
+ * type. A block containing objects of several types is in several lists.
+ */
+struct pbf_type_blocks {
+
+    std::vector<std::size_t> nodes;
+    std::vector<std::size_t> ways;
+    std::vector<std::size_t> relations;
+
+}; // struct pbf_type_blocks
+
+/**
+ * Find out which blocks of a PBF file contain objects of which types.
+ * Uses the block statistics in the BlobHeaders if available, otherwise
+ * the IDs in the block are decoded. In files sorted by type and ID only
+ * the blocks needed for a binary search for the type boundaries are
+ * decoded.
+ */
+pbf_type_blocks get_pbf_type_blocks(const std::string& filename);
+
+/**
+ * Number of nodes and largest node ID in a PBF file.
+ */
+struct pbf_node_id_stats {
+
+    // Set if anything is known about the nodes in the file.
+    bool valid = false;
+
+    // Set if the numbers come from block statistics for all blocks. If
+    // not, the number of nodes is an estimate.
+    bool exact = false;
+
+    uint64_t nodes = 0;
+    osmium::object_id_type max_id = 0;
+
+}; // struct pbf_node_id_stats
+
+/**
+ * Find out how many nodes there are in a PBF file and what the largest
+ * node ID is. Uses the block statistics if all blocks have them. If the
+ * file is sorted, only the blocks visited by a binary search for the
+ * last block with nodes are decoded. Returns invalid stats otherwise.
+ */
+pbf_node_id_stats get_pbf_node_id_stats(const std::string& filename);
+
+/**
+ * Find the OSMData blocks of a PBF file which only contain objects with
+ * a timestamp after the given one. Only the block statistics in the
+ * BlobHeaders are used, blocks without statistics are never returned.
+ * The offsets are sorted.
+ */
+std::vector<std::size_t> get_pbf_blocks_newer_than(const std::string& filename, osmium::Timestamp timestamp);
+
+/**
+ * Find the OSMData blocks of a PBF file which can contain objects of the
+ * given type with IDs from "from" to "to" (inclusive, both positive).
+ * Uses the block statistics in the BlobHeaders if available, otherwise
+ * the IDs in the block are decoded. In files sorted by type and ID only
+ * the blocks needed for a binary search for the start and end of the
+ * range are decoded. The offsets are sorted.
+ */
+std::vector<std::size_t> find_pbf_blocks_with_ids(const std::string& filename,
+                                                  osmium::item_type type,
+                                                  osmium::object_id_type from,
+                                                  osmium::object_id_type to);
+
+/**
+ * Statistics about the contents of an OSMData block. They can be stored
+ * in the indexdata field of the BlobHeader, so that they are available
+ * without decoding the block.
+ */
+struct pbf_block_stats {
+
+    uint64_t nodes     = 0;
+    uint64_t ways      = 0;
+    uint64_t relations = 0;
+
+    // Only valid if there is at least one object of the type.
+    osmium::object_id_type min_node_id     = 0;
+    osmium::object_id_type max_node_id     = 0;
+    osmium::object_id_type min_way_id      = 0;
+    osmium::object_id_type max_way_id      = 0;
+    osmium::object_id_type min_relation_id = 0;
+    osmium::object_id_type max_relation_id = 0;
+
+    osmium::Box bounds;
+
+    // Only valid if there is at least one object.
+    osmium::Timestamp first_timestamp;
+    osmium::Timestamp last_timestamp;
+
+    osmium::metadata_options metadata_all_objects{"all"};
+    osmium::metadata_options metadata_some_objects{"none"};
+
+    // Are the objects in the block ordered by type and ID and are there
+    // several versions of the same object?
+    bool ordered = true;
+    bool multiple_versions = false;
+
+    // First and last object in the block. Used to find out whether the
+    // blocks are in order.
+    osmium::item_type first_type = osmium::item_type::undefined;
+    osmium::object_id_type first_id = 0;
+    osmium::item_type last_type = osmium::item_type::undefined;
+    osmium::object_id_type last_id = 0;
+
+}; // struct pbf_block_stats
+
+/**
+ * Encode block statistics for use in the indexdata field of a BlobHeader.
+ */
+std::string encode_pbf_block_stats(const pbf_block_stats& stats);
+
+/**
+ * Decode block statistics from the indexdata field of a BlobHeader.
+ * Returns false if the data doesn't contain statistics written by
+ * osmium.
+ */
+bool decode_pbf_block_stats(const std::string& data, pbf_block_stats& stats);
+
+/**
+ * Decode an OSMData block and calculate its statistics.
+ */
+pbf_block_stats get_pbf_block_stats(const pbf_block& block);
+
+/**
+ * Replace the indexdata field in the BlobHeader of a block. The blob
+ * itself is not changed.
+ */
+void set_pbf_block_index_data(pbf_block& block, const std::string& index_data);
+
+/**
+ * Add block statistics to all OSMData blocks of a PBF file. The file is
+ * rewritten and replaced in one go.
+ */
+void add_pbf_block_stats(const std::string& filename, osmium::io::fsync fsync);
+
+/**
+ * Offset and smallest and largest key of an OSMData block in a PBF file.
+ */
+struct pbf_block_range {
+
+    std::size_t offset = 0;
+    pbf_object_key min;
+    pbf_object_key max;
+
+}; // struct pbf_block_range
+
+/**
+ * Index of all OSMData blocks in a PBF file. It is stored in a text file
+ * next to the PBF file and allows reading only the blocks which can
+ * contain some given objects.
+ */
+struct pbf_block_index {
+
+    // Size of the PBF file the index was created from. Used to detect
+    // an index not matching the file.
+    std::size_t file_size = 0;
+
+    std::vector<pbf_block_range> blocks;
+
+}; // struct pbf_block_index
+
+/**
+ * Read all blocks of a PBF file and create the block index.
+ */
+pbf_block_index build_pbf_block_index(const std::string& filename);
+
+/**
+ * Write block index to file.
+ */
+void write_pbf_block_index(const std::string& filename, const pbf_block_index& index);
+
+/**
+ * Read block index from file. Throws osmium::io_error if the file can
+ * not be read or has the wrong format.
+ */
+pbf_block_index read_pbf_block_index(const std::string& filename);
+
+/**
+ * Find the blocks in the index which can contain any of the objects with
+ * the given keys. The keys must be sorted. Returns the sorted offsets of
+ * those blocks.
+ */
+std::vector<std::size_t> find_pbf_blocks(const pbf_block_index& index, const std::vector<pbf_object_key>& keys);
+
+/**
+ * Position of an object in a PBF file: The offset of its block and the
+ * number of the object in the block.
+ */
+struct pbf_object_position {
+
+    std::size_t offset = 0;
+    std::size_t index = 0;
+
+}; // struct pbf_object_position
+
+/**
+ * Index of all objects in a PBF file sorted by type and ID. It is stored
+ * in a binary file (in native byte order) with a fixed-size entry for
+ * each object, so that objects can be looked up with a binary search in
+ * the file without reading all of it into memory.
+ */
+class PBFObjectIndex {
+
+    std::string m_filename;
+    std::ifstream m_file;
+    std::size_t m_file_size = 0;
+    std::size_t m_size = 0;
+
+    uint64_t read_entry(std::size_t n, uint64_t& position);
+
+public:
+
+    /**
+     * Open the index file. Throws osmium::io_error if the file can not
+     * be read or has the wrong format.
+     */
+    explicit PBFObjectIndex(const std::string& filename);
+
+    // Size of the PBF file the index was created from.
+    std::size_t file_size() const noexcept {
+        return m_file_size;
+    }
+
+    // Number of objects in the index.
+    std::size_t size() const noexcept {
+        return m_size;
+    }
+
+    /**
+     * Find the positions of all objects with the given keys. The keys
+     * must be sorted. Keys not in the index are ignored. Returns the
+     * positions sorted by offset and index.
+     */
+    std::vector<pbf_object_position> find(const std::vector<pbf_object_key>& keys);
+
+}; // class PBFObjectIndex
+
+/**
+ * Read all blocks of a sorted PBF file and write the object index to
+ * index_filename. Only the IDs in the blocks are decoded. Throws
+ * osmium::io_error if the PBF file isn't sorted by type and ID or if
+ * it is larger than 1 TiB (block offsets are stored in 40 bits).
+ */
+void write_pbf_object_index(const std::string& filename, const std::string& index_filename);
+
+/**
+ * Read the objects at the given positions (sorted by offset and index)
+ * from the PBF file and return them in the order of the file. Only the
+ * blocks containing the objects are decoded. Throws osmium::io_error if
+ * the positions don't match the file.
+ */
+osmium::memory::Buffer read_pbf_objects(PBFBlockReader& reader, const std::vector<pbf_object_position>& positions);
+
+#endif // PBF_BLOCKS_HPP
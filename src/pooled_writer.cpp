@@ -0,0 +1,93 @@
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "pooled_writer.hpp"
+
+#include <osmium/io/any_output.hpp> // IWYU pragma: keep
+#include <osmium/io/detail/read_write.hpp>
+#include <osmium/io/file_compression.hpp>
+
+#include <chrono>
+#include <utility>
+
+bool PooledWriter::can_write(const osmium::io::File& file) {
+    return file.compression() == osmium::io::file_compression::none;
+}
+
+PooledWriter::PooledWriter(const osmium::io::File& file, const osmium::io::Header& header, osmium::io::overwrite overwrite, osmium::io::fsync fsync, osmium::thread::Pool& pool) :
+    m_queue(0, "pooled_writer"),
+    m_output(osmium::io::detail::OutputFormatFactory::instance().create_output(pool, file, m_queue)),
+    m_compressor(osmium::io::CompressionFactory::instance().create_compressor(
+                     file.compression(),
+                     osmium::io::detail::open_for_writing(file.filename(), overwrite),
+                     fsync)),
+    m_max_pending(static_cast<std::size_t>(pool.num_threads()) * 4) {
+    m_output->write_header(header);
+}
+
+PooledWriter::~PooledWriter() noexcept {
+    try {
+        close();
+    } catch (...) {
+        // Ignore any exceptions because destructor must not throw.
+    }
+}
+
+// Write all blocks which are ready and wait for the oldest ones until
+// there are at most max_pending left.
+void PooledWriter::write_ready(std::size_t max_pending) {
+    std::future<std::string> future;
+    while (m_queue.try_pop(future)) {
+        m_pending.push_back(std::move(future));
+    }
+
+    while (!m_pending.empty() &&
+           (m_pending.size() > max_pending ||
+            m_pending.front().wait_for(std::chrono::seconds(0)) == std::future_status::ready)) {
+        const std::string data{m_pending.front().get()};
+        m_pending.pop_front();
+        if (!data.empty()) {
+            m_compressor->write(data);
+        }
+    }
+}
+
+void PooledWriter::operator()(osmium::memory::Buffer&& buffer) {
+    if (!m_compressor || buffer.committed() == 0) {
+        return;
+    }
+
+    m_output->write_buffer(std::move(buffer));
+    write_ready(m_max_pending);
+}
+
+void PooledWriter::close() {
+    if (!m_compressor) {
+        return;
+    }
+
+    m_output->write_end();
+    write_ready(0);
+
+    auto compressor = std::move(m_compressor);
+    compressor->close();
+}
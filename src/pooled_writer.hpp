@@ -0,0 +1,83 @@
+#ifndef POOLED_WRITER_HPP
+#define POOLED_WRITER_HPP
+
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <osmium/io/compression.hpp>
+#include <osmium/io/detail/output_format.hpp>
+#include <osmium/io/detail/queue_util.hpp>
+#include <osmium/io/file.hpp>
+#include <osmium/io/header.hpp>
+#include <osmium/io/writer_options.hpp>
+#include <osmium/memory/buffer.hpp>
+#include <osmium/thread/pool.hpp>
+
+#include <cstddef>
+#include <deque>
+#include <future>
+#include <memory>
+#include <string>
+
+/**
+ * Writes an uncompressed OSM file without a thread of its own. The
+ * buffers are encoded on the thread pool with the output formats the
+ * osmium::io::Writer uses, so the output is the same. But the encoded
+ * blocks are not handed to a separate writer thread, they are written
+ * in order by the thread calling this writer whenever they are ready.
+ * This allows having many output files open at the same time (for
+ * instance for extracts) with the number of threads only depending on
+ * the size of the pool.
+ */
+class PooledWriter {
+
+    osmium::io::detail::future_string_queue_type m_queue;
+    std::unique_ptr<osmium::io::detail::OutputFormat> m_output;
+    std::unique_ptr<osmium::io::Compressor> m_compressor;
+    std::deque<std::future<std::string>> m_pending;
+    std::size_t m_max_pending;
+
+    void write_ready(std::size_t max_pending);
+
+public:
+
+    // Can this class write the file?
+    static bool can_write(const osmium::io::File& file);
+
+    // The pool must not be used for anything that waits for this writer.
+    PooledWriter(const osmium::io::File& file, const osmium::io::Header& header, osmium::io::overwrite overwrite, osmium::io::fsync fsync, osmium::thread::Pool& pool);
+
+    PooledWriter(const PooledWriter&) = delete;
+    PooledWriter& operator=(const PooledWriter&) = delete;
+
+    PooledWriter(PooledWriter&&) = delete;
+    PooledWriter& operator=(PooledWriter&&) = delete;
+
+    ~PooledWriter() noexcept;
+
+    void operator()(osmium::memory::Buffer&& buffer);
+
+    void close();
+
+}; // class PooledWriter
+
+#endif // POOLED_WRITER_HPP
@@ -0,0 +1,48 @@
+#ifndef PREFETCH_HPP
+#define PREFETCH_HPP
+
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <cstddef>
+
+/**
+ * Number of lookups into a large index that are prefetched together
+ * before they are resolved. Enough to keep the memory system busy, but
+ * small enough that the prefetched data is still in the cache when it
+ * is used.
+ */
+constexpr const std::size_t prefetch_batch_size = 16;
+
+/**
+ * Hint to the CPU that the memory at this address will be read soon.
+ * Does nothing on compilers that don't support it.
+ */
+inline void prefetch(const void* address) noexcept {
+#ifdef __GNUC__
+    __builtin_prefetch(address, 0, 3);
+#else
+    (void)address;
+#endif
+}
+
+#endif // PREFETCH_HPP
@@ -0,0 +1,225 @@
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "query_index.hpp"
+#include "exception.hpp"
+#include "remote_file.hpp"
+
+#include <osmium/io/detail/opl_output_format.hpp>
+#include <osmium/io/error.hpp>
+#include <osmium/io/reader.hpp>
+#include <osmium/osm/entity_bits.hpp>
+#include <osmium/osm/metadata_options.hpp>
+#include <osmium/osm/object.hpp>
+#include <osmium/osm/relation.hpp>
+#include <osmium/osm/way.hpp>
+#include <osmium/util/string.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+    bool member_less(const QueryIndex::member_parent& lhs, const QueryIndex::member_parent& rhs) noexcept {
+        return lhs.member < rhs.member || (lhs.member == rhs.member && lhs.parent < rhs.parent);
+    }
+
+    bool member_equal(const QueryIndex::member_parent& lhs, const QueryIndex::member_parent& rhs) noexcept {
+        return lhs.member == rhs.member && lhs.parent == rhs.parent;
+    }
+
+    void sort_unique(std::vector<QueryIndex::member_parent>& data) {
+        std::sort(data.begin(), data.end(), member_less);
+        data.erase(std::unique(data.begin(), data.end(), member_equal), data.end());
+        data.shrink_to_fit();
+    }
+
+    void add_parents(const std::vector<QueryIndex::member_parent>& index,
+                     const AdaptiveIdSet& members,
+                     AdaptiveIdSet& parents) {
+        for (const osmium::unsigned_object_id_type id : members) {
+            QueryIndex::member_parent key{id, 0};
+            for (auto it = std::lower_bound(index.begin(), index.end(), key, member_less); it != index.end() && it->member == id; ++it) {
+                parents.set(it->parent);
+            }
+        }
+    }
+
+    osmium::osm_entity_bits::type needed_types(const ids_type& ids) noexcept {
+        osmium::osm_entity_bits::type types = osmium::osm_entity_bits::nothing;
+        if (!ids(osmium::item_type::node).empty()) {
+            types |= osmium::osm_entity_bits::node;
+        }
+        if (!ids(osmium::item_type::way).empty()) {
+            types |= osmium::osm_entity_bits::way;
+        }
+        if (!ids(osmium::item_type::relation).empty()) {
+            types |= osmium::osm_entity_bits::relation;
+        }
+        return types;
+    }
+
+} // anonymous namespace
+
+QueryIndex::QueryIndex(const std::string& filename, pbf_block_index block_index) :
+    m_filename(filename),
+    m_block_index(std::move(block_index)),
+    m_reader(filename) {
+    if (m_block_index.file_size != input_file_size(filename)) {
+        throw std::runtime_error{"Block index does not match input file '" + filename + "'."};
+    }
+}
+
+void QueryIndex::open_object_index(const std::string& filename) {
+    m_object_index.reset(new PBFObjectIndex{filename});
+    if (m_object_index->file_size() != m_block_index.file_size) {
+        throw std::runtime_error{"Object index does not match input file '" + m_filename + "'."};
+    }
+}
+
+void QueryIndex::build_parent_index() {
+    osmium::io::Reader reader{m_filename, osmium::osm_entity_bits::way | osmium::osm_entity_bits::relation};
+    while (osmium::memory::Buffer buffer = reader.read()) {
+        for (const auto& way : buffer.select<osmium::Way>()) {
+            for (const auto& nr : way.nodes()) {
+                m_node_ways.push_back(member_parent{nr.positive_ref(), way.positive_id()});
+            }
+        }
+        for (const auto& relation : buffer.select<osmium::Relation>()) {
+            for (const auto& member : relation.members()) {
+                const member_parent mp{member.positive_ref(), relation.positive_id()};
+                switch (member.type()) {
+                    case osmium::item_type::node:
+                        m_node_relations.push_back(mp);
+                        break;
+                    case osmium::item_type::way:
+                        m_way_relations.push_back(mp);
+                        break;
+                    case osmium::item_type::relation:
+                        m_relation_relations.push_back(mp);
+                        break;
+                    default:
+                        break;
+                }
+            }
+        }
+    }
+    reader.close();
+
+    sort_unique(m_node_ways);
+    sort_unique(m_node_relations);
+    sort_unique(m_way_relations);
+    sort_unique(m_relation_relations);
+
+    m_has_parent_index = true;
+}
+
+osmium::memory::Buffer QueryIndex::get_objects(const ids_type& ids) {
+    if (m_object_index) {
+        return read_pbf_objects(m_reader, m_object_index->find(get_pbf_object_keys(ids)));
+    }
+
+    osmium::memory::Buffer result{1024 * 1024, osmium::memory::Buffer::auto_grow::yes};
+
+    const auto entities = needed_types(ids);
+    pbf_block block;
+    for (const auto offset : find_pbf_blocks(m_block_index, get_pbf_object_keys(ids))) {
+        m_reader.seek(offset);
+        if (!m_reader.read(block) || block.type != "OSMData") {
+            throw osmium::io_error{"Block index does not match input file '" + m_filename + "'."};
+        }
+        const auto buffer = decode_pbf_block(block, entities);
+        for (const auto& object : buffer.select<osmium::OSMObject>()) {
+            if (ids(object.type()).get(object.positive_id())) {
+                result.add_item(object);
+                result.commit();
+            }
+        }
+    }
+
+    return result;
+}
+
+void QueryIndex::add_parent_ids(const ids_type& ids, ids_type& parents) const {
+    add_parents(m_node_ways, ids(osmium::item_type::node), parents(osmium::item_type::way));
+    add_parents(m_node_relations, ids(osmium::item_type::node), parents(osmium::item_type::relation));
+    add_parents(m_way_relations, ids(osmium::item_type::way), parents(osmium::item_type::relation));
+    add_parents(m_relation_relations, ids(osmium::item_type::relation), parents(osmium::item_type::relation));
+}
+
+std::string QueryIndex::query(const std::string& request, osmium::item_type default_item_type) {
+    auto words = osmium::split_string(request, "\t ;,/|", true);
+    if (words.empty()) {
+        throw argument_error{"Empty request"};
+    }
+
+    const std::string command = words.front();
+    words.erase(words.begin());
+
+    if (command == "fileinfo") {
+        std::string result{"file " + m_filename + "\n"};
+        result += "size " + std::to_string(m_block_index.file_size) + "\n";
+        result += "blocks " + std::to_string(m_block_index.blocks.size()) + "\n";
+        result += "object_index " + std::string{m_object_index ? "yes" : "no"} + "\n";
+        if (m_object_index) {
+            result += "object_index_entries " + std::to_string(m_object_index->size()) + "\n";
+        }
+        result += "parent_index " + std::string{m_has_parent_index ? "yes" : "no"} + "\n";
+        if (m_has_parent_index) {
+            result += "parent_index_entries " + std::to_string(parent_index_size()) + "\n";
+        }
+        return result;
+    }
+
+    if (command != "getid" && command != "getparents") {
+        throw argument_error{"Unknown request '" + command + "'"};
+    }
+
+    ids_type ids;
+    for (const auto& word : words) {
+        parse_and_add_id(word, ids, default_item_type);
+    }
+
+    osmium::memory::Buffer buffer;
+    if (command == "getid") {
+        buffer = get_objects(ids);
+    } else {
+        if (!m_has_parent_index) {
+            throw argument_error{"No parent index (use --parents option)"};
+        }
+        ids_type parents;
+        add_parent_ids(ids, parents);
+        buffer = get_objects(parents);
+    }
+
+    if (buffer.committed() == 0) {
+        return std::string{};
+    }
+
+    osmium::io::detail::opl_output_options options;
+    options.add_metadata = osmium::metadata_options{"all"};
+    osmium::io::detail::OPLOutputBlock output_block{std::move(buffer), options};
+    return output_block();
+}
@@ -0,0 +1,122 @@
+#ifndef QUERY_INDEX_HPP
+#define QUERY_INDEX_HPP
+
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "id_file.hpp"
+#include "pbf_blocks.hpp"
+
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm/item_type.hpp>
+#include <osmium/osm/types.hpp>
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * Answers queries for objects by ID from a PBF file using its block
+ * index, so only the blocks which can contain the objects are read and
+ * decoded. Optionally an index from members to their parent ways and
+ * relations can be built, it allows looking up parents without reading
+ * the whole file.
+ *
+ * This is used by the "serve" command which keeps these indexes in
+ * memory for many queries.
+ */
+class QueryIndex {
+
+public:
+
+    struct member_parent {
+        osmium::unsigned_object_id_type member;
+        osmium::unsigned_object_id_type parent;
+    };
+
+private:
+
+    std::string m_filename;
+    pbf_block_index m_block_index;
+    PBFBlockReader m_reader;
+    std::unique_ptr<PBFObjectIndex> m_object_index;
+
+    bool m_has_parent_index = false;
+
+    // Sorted by member ID
+    std::vector<member_parent> m_node_ways;
+    std::vector<member_parent> m_node_relations;
+    std::vector<member_parent> m_way_relations;
+    std::vector<member_parent> m_relation_relations;
+
+public:
+
+    /**
+     * Throws std::runtime_error if the block index doesn't match the file.
+     */
+    QueryIndex(const std::string& filename, pbf_block_index block_index);
+
+    /**
+     * Use the object index in this file to find objects instead of the
+     * block index. Throws std::runtime_error if it doesn't match the
+     * file.
+     */
+    void open_object_index(const std::string& filename);
+
+    /**
+     * Read all ways and relations from the file and build the index
+     * from members to their parents.
+     */
+    void build_parent_index();
+
+    bool has_parent_index() const noexcept {
+        return m_has_parent_index;
+    }
+
+    std::size_t parent_index_size() const noexcept {
+        return m_node_ways.size() + m_node_relations.size() +
+               m_way_relations.size() + m_relation_relations.size();
+    }
+
+    /**
+     * Get all objects (all versions in a history file) with the given IDs
+     * from the file. They are returned in the order of the file.
+     */
+    osmium::memory::Buffer get_objects(const ids_type& ids);
+
+    /**
+     * Add the IDs of all ways and relations directly referencing any of
+     * the objects in ids to parents. Needs the parent index.
+     */
+    void add_parent_ids(const ids_type& ids, ids_type& parents) const;
+
+    /**
+     * Answer a query. Queries are "getid IDS...", "getparents IDS..." or
+     * "fileinfo". The objects found are returned in OPL format, one per
+     * line. Throws argument_error for invalid queries.
+     */
+    std::string query(const std::string& request, osmium::item_type default_item_type);
+
+}; // class QueryIndex
+
+#endif // QUERY_INDEX_HPP
@@ -0,0 +1,94 @@
+#ifndef READ_AHEAD_HPP
+#define READ_AHEAD_HPP
+
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <osmium/io/file.hpp>
+#include <osmium/io/reader.hpp>
+#include <osmium/osm/entity_bits.hpp>
+
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <vector>
+
+/**
+ * Gives out readers for a list of input files one after the other. Up to
+ * read_ahead files after the current one are already open. A Reader
+ * starts reading and decoding in its own threads when it is created, so
+ * the data from the next files is ready when it is needed and there is
+ * no stall at file boundaries. The memory use is bounded by the input
+ * queues of the open readers.
+ */
+class ReadAhead {
+
+    const std::vector<osmium::io::File>& m_files;
+    osmium::osm_entity_bits::type m_entities;
+    std::size_t m_read_ahead;
+    osmium::io::read_meta m_read_meta;
+    std::size_t m_next_file = 0;
+    std::deque<std::unique_ptr<osmium::io::Reader>> m_readers;
+
+    std::unique_ptr<osmium::io::Reader> open_next_file() {
+        std::unique_ptr<osmium::io::Reader> reader{new osmium::io::Reader{m_files[m_next_file], m_entities, m_read_meta}};
+        ++m_next_file;
+        return reader;
+    }
+
+    void open_readers() {
+        while (m_next_file < m_files.size() && m_readers.size() < m_read_ahead) {
+            m_readers.push_back(open_next_file());
+        }
+    }
+
+public:
+
+    ReadAhead(const std::vector<osmium::io::File>& files, osmium::osm_entity_bits::type entities, std::size_t read_ahead, osmium::io::read_meta read_meta = osmium::io::read_meta::yes) :
+        m_files(files),
+        m_entities(entities),
+        m_read_ahead(read_ahead),
+        m_read_meta(read_meta) {
+    }
+
+    // Return the reader for the next file or nullptr if there are no
+    // more files.
+    std::unique_ptr<osmium::io::Reader> next() {
+        std::unique_ptr<osmium::io::Reader> reader;
+        if (!m_readers.empty()) {
+            reader = std::move(m_readers.front());
+            m_readers.pop_front();
+        } else if (m_next_file < m_files.size()) {
+            reader = open_next_file();
+        }
+        open_readers();
+        return reader;
+    }
+
+    // The number of files opened ahead of the current one.
+    std::size_t num_open() const noexcept {
+        return m_readers.size();
+    }
+
+}; // class ReadAhead
+
+#endif // READ_AHEAD_HPP
@@ -0,0 +1,137 @@
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "relations_map.hpp"
+
+#include <osmium/osm/item_type.hpp>
+#include <osmium/osm/relation.hpp>
+#include <osmium/osm/types.hpp>
+
+#include <protozero/varint.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+constexpr const std::size_t CompactRelationsMapIndex::block_size;
+
+namespace {
+
+    template <typename T>
+    void encode_pairs(std::vector<std::pair<T, T>>& pairs, bool reverse,
+                      std::vector<osmium::unsigned_object_id_type>& block_keys,
+                      std::vector<std::size_t>& block_offsets,
+                      std::string& data,
+                      std::size_t block_size) {
+        if (reverse) {
+            for (auto& p : pairs) {
+                using std::swap;
+                swap(p.first, p.second);
+            }
+        }
+        std::sort(pairs.begin(), pairs.end());
+        pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+
+        std::size_t num_keys = 0;
+        osmium::unsigned_object_id_type last_key = 0;
+        for (auto it = pairs.cbegin(); it != pairs.cend();) {
+            const osmium::unsigned_object_id_type key = it->first;
+            auto values_end = it;
+            while (values_end != pairs.cend() && values_end->first == it->first) {
+                ++values_end;
+            }
+
+            if (num_keys % block_size == 0) {
+                block_keys.push_back(key);
+                block_offsets.push_back(data.size());
+                last_key = key;
+            }
+            ++num_keys;
+
+            protozero::add_varint_to_buffer(&data, key - last_key);
+            last_key = key;
+            protozero::add_varint_to_buffer(&data, static_cast<uint64_t>(std::distance(it, values_end)));
+
+            osmium::unsigned_object_id_type last_value = 0;
+            for (; it != values_end; ++it) {
+                protozero::add_varint_to_buffer(&data, it->second - last_value);
+                last_value = it->second;
+            }
+        }
+    }
+
+} // anonymous namespace
+
+void CompactRelationsMapStash::add(osmium::unsigned_object_id_type member_id, osmium::unsigned_object_id_type relation_id) {
+    constexpr const auto max32 = std::numeric_limits<uint32_t>::max();
+    if (member_id <= max32 && relation_id <= max32) {
+        m_map32.emplace_back(static_cast<uint32_t>(member_id), static_cast<uint32_t>(relation_id));
+    } else {
+        m_map64.emplace_back(member_id, relation_id);
+    }
+}
+
+void CompactRelationsMapStash::add_members(const osmium::Relation& relation) {
+    for (const auto& member : relation.members()) {
+        if (member.type() == osmium::item_type::relation) {
+            add(member.ref(), relation.id());
+        }
+    }
+}
+
+CompactRelationsMapIndex CompactRelationsMapStash::build_index(bool reverse) {
+    CompactRelationsMapIndex index;
+
+    if (m_map64.empty()) {
+        encode_pairs(m_map32, reverse, index.m_block_keys, index.m_block_offsets, index.m_data, CompactRelationsMapIndex::block_size);
+        index.m_size = m_map32.size();
+    } else {
+        m_map64.reserve(m_map64.size() + m_map32.size());
+        for (const auto& p : m_map32) {
+            m_map64.emplace_back(p.first, p.second);
+        }
+        std::vector<std::pair<uint32_t, uint32_t>>{}.swap(m_map32);
+        encode_pairs(m_map64, reverse, index.m_block_keys, index.m_block_offsets, index.m_data, CompactRelationsMapIndex::block_size);
+        index.m_size = m_map64.size();
+    }
+
+    std::vector<std::pair<uint32_t, uint32_t>>{}.swap(m_map32);
+    std::vector<std::pair<uint64_t, uint64_t>>{}.swap(m_map64);
+
+    index.m_data.shrink_to_fit();
+    index.m_block_keys.shrink_to_fit();
+    index.m_block_offsets.shrink_to_fit();
+
+    return index;
+}
+
+CompactRelationsMapIndex CompactRelationsMapStash::build_member_to_parent_index() {
+    return build_index(false);
+}
+
+CompactRelationsMapIndex CompactRelationsMapStash::build_parent_to_member_index() {
+    return build_index(true);
+}
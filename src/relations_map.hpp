@@ -0,0 +1,164 @@
+#ifndef RELATIONS_MAP_HPP
+#define RELATIONS_MAP_HPP
+
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <osmium/osm/relation.hpp>
+#include <osmium/osm/types.hpp>
+
+#include <protozero/varint.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * Compressed index from member relation IDs to parent relation IDs or
+ * the other way around. This is used instead of the RelationsMapIndex
+ * from libosmium, which stores all pairs of IDs uncompressed.
+ *
+ * The keys are sorted and stored in blocks of block_size keys. Inside a
+ * block each key is stored as varint-encoded difference to the previous
+ * key followed by the number of values and the sorted values, also as
+ * varint-encoded differences. Only the first key and the offset of each
+ * block are stored uncompressed, so a lookup is a binary search over the
+ * blocks and then a linear scan over at most block_size keys.
+ *
+ * Create it with CompactRelationsMapStash.
+ */
+class CompactRelationsMapIndex {
+
+    friend class CompactRelationsMapStash;
+
+    static constexpr const std::size_t block_size = 64;
+
+    std::vector<osmium::unsigned_object_id_type> m_block_keys;
+    std::vector<std::size_t> m_block_offsets;
+    std::string m_data;
+    std::size_t m_size = 0;
+
+public:
+
+    CompactRelationsMapIndex() = default;
+
+    /**
+     * Call func with each value stored for the key in ascending order.
+     */
+    template <typename TFunc>
+    void for_each(osmium::unsigned_object_id_type key, TFunc&& func) const {
+        const auto it = std::upper_bound(m_block_keys.cbegin(), m_block_keys.cend(), key);
+        if (it == m_block_keys.cbegin()) {
+            return;
+        }
+        const auto block = static_cast<std::size_t>(std::distance(m_block_keys.cbegin(), it)) - 1;
+
+        const char* data = m_data.data() + m_block_offsets[block];
+        const char* end = block + 1 < m_block_offsets.size() ? m_data.data() + m_block_offsets[block + 1]
+                                                             : m_data.data() + m_data.size();
+
+        osmium::unsigned_object_id_type current = m_block_keys[block];
+        while (data != end) {
+            current += protozero::decode_varint(&data, end);
+            auto count = protozero::decode_varint(&data, end);
+            if (current > key) {
+                return;
+            }
+            if (current == key) {
+                osmium::unsigned_object_id_type value = 0;
+                while (count-- > 0) {
+                    value += protozero::decode_varint(&data, end);
+                    func(value);
+                }
+                return;
+            }
+            while (count-- > 0) {
+                protozero::skip_varint(&data, end);
+            }
+        }
+    }
+
+    // Same as for_each(), named like the function of the libosmium index
+    // from members to parents.
+    template <typename TFunc>
+    void for_each_parent(osmium::unsigned_object_id_type member_id, TFunc&& func) const {
+        for_each(member_id, std::forward<TFunc>(func));
+    }
+
+    bool empty() const noexcept {
+        return m_size == 0;
+    }
+
+    // Number of (key, value) pairs in the index.
+    std::size_t size() const noexcept {
+        return m_size;
+    }
+
+    std::size_t used_memory() const noexcept {
+        return m_data.capacity() +
+               m_block_keys.capacity() * sizeof(osmium::unsigned_object_id_type) +
+               m_block_offsets.capacity() * sizeof(std::size_t);
+    }
+
+}; // class CompactRelationsMapIndex
+
+/**
+ * Collects pairs of member and parent relation IDs and builds a
+ * CompactRelationsMapIndex from them in either direction. Pairs are
+ * stored with 32 bit IDs as long as they fit. Building an index uses up
+ * the stash.
+ */
+class CompactRelationsMapStash {
+
+    std::vector<std::pair<uint32_t, uint32_t>> m_map32;
+    std::vector<std::pair<uint64_t, uint64_t>> m_map64;
+
+    CompactRelationsMapIndex build_index(bool reverse);
+
+public:
+
+    CompactRelationsMapStash() = default;
+
+    void add(osmium::unsigned_object_id_type member_id, osmium::unsigned_object_id_type relation_id);
+
+    // Add all relation members of the relation.
+    void add_members(const osmium::Relation& relation);
+
+    bool empty() const noexcept {
+        return m_map32.empty() && m_map64.empty();
+    }
+
+    std::size_t size() const noexcept {
+        return m_map32.size() + m_map64.size();
+    }
+
+    CompactRelationsMapIndex build_member_to_parent_index();
+
+    CompactRelationsMapIndex build_parent_to_member_index();
+
+}; // class CompactRelationsMapStash
+
+#endif // RELATIONS_MAP_HPP
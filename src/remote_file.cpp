@@ -0,0 +1,448 @@
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "remote_file.hpp"
+#include "exception.hpp"
+
+#include <osmium/io/error.hpp>
+#include <osmium/util/file.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <future>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#ifndef _WIN32
+# include <fcntl.h>
+# include <signal.h>
+# include <sys/types.h>
+# include <sys/wait.h>
+# include <unistd.h>
+#endif
+
+// Size of the chunks requested while reading sequentially and the
+// maximum number of those requests running at the same time.
+static constexpr const std::size_t chunk_size = 4UL * 1024UL * 1024UL;
+static constexpr const std::size_t max_requests_in_flight = 8;
+
+// Smallest request while reading randomly. Reading a block needs a few
+// small reads (length prefix and BlobHeader) before the Blob itself,
+// they should usually be served by the same request.
+static constexpr const std::size_t min_request_size = 256UL * 1024UL;
+
+// Largest response to a HEAD request read.
+static constexpr const std::size_t max_headers_size = 1024UL * 1024UL;
+
+static bool starts_with(const std::string& str, const char* prefix) {
+    return str.compare(0, std::char_traits<char>::length(prefix), prefix) == 0;
+}
+
+static std::string get_env(const char* name) {
+    const char* value = std::getenv(name);
+    return value ? value : "";
+}
+
+static std::string aws_region() {
+    auto region = get_env("AWS_REGION");
+    if (region.empty()) {
+        region = get_env("AWS_DEFAULT_REGION");
+    }
+    return region.empty() ? "us-east-1" : region;
+}
+
+static std::string s3_endpoint() {
+    auto endpoint = get_env("OSMIUM_S3_ENDPOINT");
+    while (!endpoint.empty() && endpoint.back() == '/') {
+        endpoint.pop_back();
+    }
+    return endpoint;
+}
+
+bool is_remote_url(const std::string& filename) {
+    return starts_with(filename, "http://") ||
+           starts_with(filename, "https://") ||
+           starts_with(filename, "s3://");
+}
+
+std::string remote_url(const std::string& filename) {
+    if (!starts_with(filename, "s3://")) {
+        return filename;
+    }
+
+    const auto path = filename.substr(5);
+    const auto slash = path.find('/');
+    if (slash == 0 || slash == std::string::npos || slash + 1 == path.size()) {
+        throw argument_error{"Invalid S3 URL '" + filename + "'. Use s3://BUCKET/KEY."};
+    }
+
+    const auto bucket = path.substr(0, slash);
+    const auto key = path.substr(slash + 1);
+
+    const auto endpoint = s3_endpoint();
+    if (!endpoint.empty()) {
+        return endpoint + "/" + bucket + "/" + key;
+    }
+
+    return "https://" + bucket + ".s3." + aws_region() + ".amazonaws.com/" + key;
+}
+
+std::size_t input_file_size(const std::string& filename) {
+    if (is_remote_url(filename)) {
+        return RemoteFile{filename}.size();
+    }
+    return osmium::file_size(filename);
+}
+
+namespace {
+
+    // Is this the https URL of an object on S3 (or on the configured
+    // S3 compatible endpoint)?
+    bool is_s3_url(const std::string& url) {
+        const auto endpoint = s3_endpoint();
+        if (!endpoint.empty() && starts_with(url, (endpoint + "/").c_str())) {
+            return true;
+        }
+
+        if (!starts_with(url, "https://")) {
+            return false;
+        }
+        const auto host = url.substr(8, url.find('/', 8) - 8);
+        return host.size() > 14 && host.compare(host.size() - 14, 14, ".amazonaws.com") == 0;
+    }
+
+    // Quote a value for a curl config file.
+    std::string config_quote(const std::string& value) {
+        std::string result{"\""};
+        for (const char c : value) {
+            if (c == '"' || c == '\\') {
+                result += '\\';
+            }
+            result += c;
+        }
+        result += '"';
+        return result;
+    }
+
+    // Curl configuration for signing the requests with the AWS
+    // credentials from the environment. Empty if there are none.
+    std::string aws_config() {
+        const auto key_id = get_env("AWS_ACCESS_KEY_ID");
+        const auto secret = get_env("AWS_SECRET_ACCESS_KEY");
+        if (key_id.empty() || secret.empty()) {
+            return "";
+        }
+
+        std::string config;
+        config += "user = " + config_quote(key_id + ":" + secret) + "\n";
+        config += "aws-sigv4 = " + config_quote("aws:amz:" + aws_region() + ":s3") + "\n";
+
+        const auto token = get_env("AWS_SESSION_TOKEN");
+        if (!token.empty()) {
+            config += "header = " + config_quote("x-amz-security-token: " + token) + "\n";
+        }
+
+        return config;
+    }
+
+#ifndef _WIN32
+    // Serializes creating the pipes and forking, so that no child
+    // process inherits the pipes of a curl process started by another
+    // thread (which would keep them open). Where pipe2() is available
+    // the close-on-exec flag is set atomically anyway.
+    std::mutex spawn_mutex;
+
+    int make_pipe(int fds[2]) {
+#ifdef __linux__
+        return ::pipe2(fds, O_CLOEXEC);
+#else
+        if (::pipe(fds) < 0) {
+            return -1;
+        }
+        ::fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+        ::fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+        return 0;
+#endif
+    }
+
+    void write_all(int fd, const std::string& data) {
+        std::size_t done = 0;
+        while (done < data.size()) {
+            const auto n = ::write(fd, data.data() + done, data.size() - done);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::system_error{errno, std::system_category(), "Could not run curl: write() call failed"};
+            }
+            done += static_cast<std::size_t>(n);
+        }
+    }
+#endif
+
+    // Run curl with the arguments followed by the URL and return what it
+    // writes to STDOUT. The config (if any) is written to its STDIN. If
+    // curl writes more than max_size bytes, it is stopped and only the
+    // first max_size + 1 bytes are returned.
+    std::string run_curl(std::vector<std::string> arguments, const std::string& config, const std::string& url, std::size_t max_size) {
+#ifdef _WIN32
+        throw osmium::io_error{"Reading remote file '" + url + "' is not supported on Windows"};
+#else
+        arguments.insert(arguments.begin(), {"curl", "-g", "-L", "-f", "-s", "-S"});
+        if (!config.empty()) {
+            arguments.emplace_back("-K");
+            arguments.emplace_back("-");
+        }
+        arguments.push_back(url);
+
+        // Build the argument list before forking, the child must not
+        // allocate memory.
+        std::vector<char*> argv;
+        argv.reserve(arguments.size() + 1);
+        for (auto& argument : arguments) {
+            argv.push_back(&argument[0]);
+        }
+        argv.push_back(nullptr);
+
+        int in[2];
+        int out[2];
+        pid_t pid = 0;
+        {
+            const std::lock_guard<std::mutex> lock{spawn_mutex};
+            if (make_pipe(in) < 0) {
+                throw std::system_error{errno, std::system_category(), "Could not run curl: pipe() call failed"};
+            }
+            if (make_pipe(out) < 0) {
+                ::close(in[0]);
+                ::close(in[1]);
+                throw std::system_error{errno, std::system_category(), "Could not run curl: pipe() call failed"};
+            }
+
+            pid = ::fork();
+            if (pid < 0) {
+                ::close(in[0]);
+                ::close(in[1]);
+                ::close(out[0]);
+                ::close(out[1]);
+                throw std::system_error{errno, std::system_category(), "Could not run curl: fork() call failed"};
+            }
+
+            if (pid == 0) {
+                // child, the duplicated descriptors don't have the
+                // close-on-exec flag set
+                if (::dup2(in[0], 0) < 0 || ::dup2(out[1], 1) < 0) {
+                    ::_exit(1);
+                }
+                ::execvp("curl", argv.data());
+
+                // Exec will either succeed and never return here, or it
+                // fails and we'll exit.
+                ::_exit(1);
+            }
+        }
+
+        // parent
+        ::close(in[0]);
+        ::close(out[1]);
+
+        try {
+            write_all(in[1], config);
+        } catch (...) {
+            ::close(in[1]);
+            ::close(out[0]);
+            ::waitpid(pid, nullptr, 0);
+            throw;
+        }
+        ::close(in[1]);
+
+        std::string result;
+        bool too_large = false;
+        char buffer[64 * 1024];
+        while (!too_large) {
+            const auto n = ::read(out[0], buffer, sizeof(buffer));
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                const auto error = errno;
+                ::close(out[0]);
+                ::waitpid(pid, nullptr, 0);
+                throw std::system_error{error, std::system_category(), "Could not read from curl"};
+            }
+            if (n == 0) {
+                break;
+            }
+            result.append(buffer, static_cast<std::size_t>(n));
+            if (result.size() > max_size) {
+                result.resize(max_size + 1);
+                too_large = true;
+                ::kill(pid, SIGTERM);
+            }
+        }
+        ::close(out[0]);
+
+        int status = 0;
+        while (::waitpid(pid, &status, 0) < 0) {
+            if (errno != EINTR) {
+                throw std::system_error{errno, std::system_category(), "Could not run curl: waitpid() call failed"};
+            }
+        }
+
+        if (!too_large && (!WIFEXITED(status) || WEXITSTATUS(status) != 0)) {
+            throw osmium::io_error{"Download of '" + url + "' failed (curl exit status " + std::to_string(WEXITSTATUS(status)) + ")"};
+        }
+
+        return result;
+#endif
+    }
+
+    // Get the value of the last header with the name (in lower case,
+    // including the colon) from the output of a HEAD request. When curl
+    // follows redirects there are several responses, the last one is the
+    // one for the file. Returns an empty string if there is no such
+    // header.
+    std::string last_header(const std::string& headers, const std::string& name) {
+        std::string result;
+        std::string::size_type pos = 0;
+        while (pos < headers.size()) {
+            auto end = headers.find('\n', pos);
+            if (end == std::string::npos) {
+                end = headers.size();
+            }
+            const auto line = headers.substr(pos, end - pos);
+            pos = end + 1;
+
+            if (line.size() <= name.size() ||
+                !std::equal(name.begin(), name.end(), line.begin(), [](char a, char b) {
+                    return a == std::tolower(static_cast<unsigned char>(b));
+                })) {
+                continue;
+            }
+
+            const auto value = line.substr(name.size());
+            const auto first = value.find_first_not_of(" \t");
+            const auto last = value.find_last_not_of(" \t\r");
+            result = first == std::string::npos ? "" : value.substr(first, last - first + 1);
+        }
+
+        return result;
+    }
+
+} // anonymous namespace
+
+RemoteFile::RemoteFile(const std::string& url) :
+    m_url(remote_url(url)) {
+    if (starts_with(url, "s3://") || is_s3_url(m_url)) {
+        m_config = aws_config();
+    }
+
+    const auto headers = run_curl({"-I"}, m_config, m_url, max_headers_size);
+    const auto length = last_header(headers, "content-length:");
+    if (length.empty() || !std::isdigit(static_cast<unsigned char>(length[0]))) {
+        throw osmium::io_error{"Could not get size of remote file '" + m_url + "' (no Content-Length in response)"};
+    }
+    m_size = std::stoul(length);
+
+    if (last_header(headers, "accept-ranges:") == "none") {
+        throw osmium::io_error{"Server doesn't support range requests for remote file '" + m_url + "'"};
+    }
+}
+
+std::string RemoteFile::fetch(std::size_t offset, std::size_t size) const {
+    const auto range = std::to_string(offset) + "-" + std::to_string(offset + size - 1);
+    // A server ignoring the range sends the whole file, only one byte
+    // more than requested is read to detect this.
+    auto data = run_curl({"-r", range}, m_config, m_url, size);
+
+    if (data.size() > size) {
+        throw osmium::io_error{"Server doesn't support range requests for remote file '" + m_url + "'"};
+    }
+    if (data.size() < size) {
+        throw osmium::io_error{"Short read on remote file '" + m_url + "'"};
+    }
+
+    return data;
+}
+
+const std::string& RemoteFile::sequential_chunk(std::size_t chunk_offset) {
+    // Chunks before the current one are not needed any more.
+    m_chunks.erase(m_chunks.begin(), m_chunks.lower_bound(chunk_offset));
+
+    const auto window_end = std::min(m_size, chunk_offset + max_requests_in_flight * chunk_size);
+    for (auto offset = chunk_offset; offset < window_end; offset += chunk_size) {
+        if (m_chunks.count(offset) == 0) {
+            const auto size = std::min(chunk_size, m_size - offset);
+            m_chunks.emplace(offset, std::async(std::launch::async, [this, offset, size]() {
+                return fetch(offset, size);
+            }).share());
+            ++m_requests;
+            m_bytes_transferred += size;
+        }
+    }
+
+    return m_chunks[chunk_offset].get();
+}
+
+void RemoteFile::set_random_access() {
+    m_sequential = false;
+    m_chunks.clear();
+}
+
+std::size_t RemoteFile::read(std::size_t offset, char* data, std::size_t size) {
+    if (offset >= m_size) {
+        return 0;
+    }
+    size = std::min(size, m_size - offset);
+
+    std::size_t done = 0;
+    while (done < size) {
+        const auto pos = offset + done;
+
+        const std::string* buffer = nullptr;
+        std::size_t buffer_offset = 0;
+        if (m_sequential) {
+            buffer_offset = pos - pos % chunk_size;
+            buffer = &sequential_chunk(buffer_offset);
+        } else {
+            if (pos < m_data_offset || pos >= m_data_offset + m_data.size()) {
+                const auto fetch_size = std::min(std::max(size - done, min_request_size), m_size - pos);
+                m_data = fetch(pos, fetch_size);
+                m_data_offset = pos;
+                ++m_requests;
+                m_bytes_transferred += fetch_size;
+            }
+            buffer = &m_data;
+            buffer_offset = m_data_offset;
+        }
+
+        const auto n = std::min(size - done, buffer->size() - (pos - buffer_offset));
+        std::copy_n(buffer->data() + (pos - buffer_offset), n, data + done);
+        done += n;
+    }
+
+    return size;
+}
@@ -0,0 +1,129 @@
+#ifndef REMOTE_FILE_HPP
+#define REMOTE_FILE_HPP
+
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <cstddef>
+#include <future>
+#include <map>
+#include <string>
+
+/**
+ * Is this the name of a remote file (an http://, https://, or s3:// URL)?
+ */
+bool is_remote_url(const std::string& filename);
+
+/**
+ * Convert an s3://BUCKET/KEY URL into the https URL of the object. If
+ * the OSMIUM_S3_ENDPOINT environment variable is set, a path-style URL
+ * on that endpoint is used, otherwise the virtual-host style URL on
+ * Amazon S3 in the region from AWS_REGION or AWS_DEFAULT_REGION. Other
+ * file names are returned unchanged.
+ */
+std::string remote_url(const std::string& filename);
+
+/**
+ * The size of a local file or of a remote file given as URL.
+ */
+std::size_t input_file_size(const std::string& filename);
+
+/**
+ * Random access to a remote file over HTTP using range requests. The
+ * requests are done by the curl program (like libosmium does for its
+ * remote input), so this only works on POSIX systems.
+ *
+ * While the file is read sequentially, the next chunks are requested in
+ * parallel ahead of the current offset, with at most a fixed number of
+ * requests in flight. After the first read at a different offset (for
+ * instance after seeking to a block from an index), only the ranges
+ * actually read are requested.
+ *
+ * If the AWS_ACCESS_KEY_ID and AWS_SECRET_ACCESS_KEY environment
+ * variables are set, requests to S3 are signed.
+ */
+class RemoteFile {
+
+    std::string m_url;
+
+    // Curl configuration with the credentials. It is handed to curl on
+    // STDIN so that the secrets don't show up in the process list.
+    std::string m_config;
+
+    std::size_t m_size = 0;
+
+    // Pending and finished requests for chunks by chunk offset. Only
+    // used while reading sequentially.
+    std::map<std::size_t, std::shared_future<std::string>> m_chunks;
+
+    // Data from the last request while reading randomly.
+    std::string m_data;
+    std::size_t m_data_offset = 0;
+
+    std::size_t m_requests = 0;
+    std::size_t m_bytes_transferred = 0;
+
+    bool m_sequential = true;
+
+    std::string fetch(std::size_t offset, std::size_t size) const;
+
+    const std::string& sequential_chunk(std::size_t chunk_offset);
+
+public:
+
+    explicit RemoteFile(const std::string& url);
+
+    RemoteFile(const RemoteFile&) = delete;
+    RemoteFile& operator=(const RemoteFile&) = delete;
+
+    RemoteFile(RemoteFile&&) = delete;
+    RemoteFile& operator=(RemoteFile&&) = delete;
+
+    ~RemoteFile() noexcept = default;
+
+    const std::string& url() const noexcept {
+        return m_url;
+    }
+
+    std::size_t size() const noexcept {
+        return m_size;
+    }
+
+    std::size_t requests() const noexcept {
+        return m_requests;
+    }
+
+    std::size_t bytes_transferred() const noexcept {
+        return m_bytes_transferred;
+    }
+
+    // Stop prefetching, from now on only request the data read.
+    void set_random_access();
+
+    // Read up to size bytes at the offset into data. Returns the number
+    // of bytes read which is only smaller than size at the end of the
+    // file.
+    std::size_t read(std::size_t offset, char* data, std::size_t size);
+
+}; // class RemoteFile
+
+#endif // REMOTE_FILE_HPP
@@ -0,0 +1,353 @@
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "result_cache.hpp"
+#include "cmd.hpp"
+#include "exception.hpp"
+#include "remote_file.hpp"
+#include "sha256.hpp"
+#include "temp_files.hpp"
+#include "util.hpp"
+
+#include <osmium/io/writer_options.hpp>
+
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+namespace {
+
+    /**
+     * SHA-256 digest of a sequence of strings.
+     */
+    class Digest {
+
+        SHA256 m_hash;
+
+    public:
+
+        void update(const char* data, std::size_t size) noexcept {
+            m_hash.update(data, size);
+        }
+
+        // The terminating zero byte is added, too, so that the boundaries
+        // between strings are part of the digest.
+        void update(const std::string& str) noexcept {
+            update(str.c_str(), str.size() + 1);
+        }
+
+        std::string hex() {
+            return m_hash.hex_digest();
+        }
+
+    }; // class Digest
+
+    constexpr const std::size_t read_buffer_size = 1024UL * 1024UL;
+
+    // Files changed less than this many seconds ago don't get their
+    // digest remembered, another change in the same second could not be
+    // detected from the modification time.
+    constexpr const std::time_t min_file_age = 2;
+
+    std::string read_file_digest(const std::string& filename) {
+        std::ifstream file{filename, std::ios::binary};
+        if (!file) {
+            throw argument_error{"Could not open file '" + filename + "' for result cache."};
+        }
+
+        Digest digest;
+        std::vector<char> buffer(read_buffer_size);
+        while (file) {
+            file.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+            digest.update(buffer.data(), static_cast<std::size_t>(file.gcount()));
+        }
+
+        return digest.hex();
+    }
+
+    /**
+     * Digest of the contents of a file. Reading large input files takes
+     * a while, so the digests are remembered in the cache directory under
+     * a name made from the file name, device, inode, size, and
+     * modification and change times of the file. The contents are only
+     * read the first time a file is seen.
+     */
+    std::string file_digest(const std::string& directory, const std::string& filename) {
+        struct stat file_stat{};
+        if (::stat(filename.c_str(), &file_stat) != 0) {
+            throw argument_error{"Could not open file '" + filename + "' for result cache."};
+        }
+
+        Digest file_id;
+        file_id.update(filename);
+        file_id.update(std::to_string(file_stat.st_dev));
+        file_id.update(std::to_string(file_stat.st_ino));
+        file_id.update(std::to_string(file_stat.st_size));
+        file_id.update(std::to_string(file_stat.st_mtime));
+        file_id.update(std::to_string(file_stat.st_ctime));
+        const std::string digest_filename{directory + "/digest-" + file_id.hex()};
+
+        {
+            std::ifstream in{digest_filename};
+            std::string digest;
+            if (in >> digest && digest.size() == 64) {
+                return digest;
+            }
+        }
+
+        const std::string digest{read_file_digest(filename)};
+
+        const auto now = std::time(nullptr);
+        if (now - file_stat.st_mtime >= min_file_age && now - file_stat.st_ctime >= min_file_age) {
+            TempFiles temp_files{directory, "digest", ".tmp"};
+            const std::string temp_filename{temp_files.create()};
+            std::ofstream out{temp_filename};
+            out << digest << '\n';
+            out.close();
+            // The digest is only an optimization, errors are ignored.
+            if (out) {
+                std::rename(temp_filename.c_str(), digest_filename.c_str());
+            }
+        }
+
+        return digest;
+    }
+
+    bool is_file_type(const std::string& filename, unsigned int type) noexcept {
+        struct stat file_stat{};
+        return ::stat(filename.c_str(), &file_stat) == 0 && (file_stat.st_mode & S_IFMT) == type;
+    }
+
+    bool is_regular_file(const std::string& filename) noexcept {
+        return is_file_type(filename, S_IFREG);
+    }
+
+    void copy_file(const std::string& from, const std::string& to) {
+        std::ifstream in{from, std::ios::binary};
+        if (!in) {
+            throw std::system_error{errno, std::system_category(), "Could not open '" + from + "'"};
+        }
+        std::ofstream out{to, std::ios::binary | std::ios::trunc};
+        if (!out) {
+            throw std::system_error{errno, std::system_category(), "Could not open '" + to + "'"};
+        }
+        std::vector<char> buffer(read_buffer_size);
+        while (in) {
+            in.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+            out.write(buffer.data(), in.gcount());
+        }
+        out.close();
+        if (!out) {
+            throw std::system_error{errno, std::system_category(), "Error writing '" + to + "'"};
+        }
+    }
+
+    // Options which don't change the output of a command.
+    struct ignored_option {
+        const char* name;
+        const char* short_name;
+        bool has_value;
+    };
+
+    const std::array<ignored_option, 14> ignored_options{{
+        {"--output",         "-o",    true},
+        {"--overwrite",      "-O",    false},
+        {"--fsync",          nullptr, false},
+        {"--verbose",        "-v",    false},
+        {"--progress",       nullptr, false},
+        {"--no-progress",    nullptr, false},
+        {"--threads",        nullptr, true},
+        {"--output-threads", nullptr, true},
+        {"--metrics",        nullptr, true},
+        {"--trace",          nullptr, true},
+        {"--memory-budget",  nullptr, true},
+        {"--memory-policy",  nullptr, true},
+        {"--temp-dir",       nullptr, true},
+        {"--cache-dir",      nullptr, true}
+    }};
+
+    // Options of some commands naming files or directories with state
+    // kept between runs (such as indexes), so the output depends on more
+    // than the arguments and the input files.
+    struct stateful_option {
+        const char* command;
+        const char* name;
+        const char* short_name;
+    };
+
+    const std::array<stateful_option, 4> stateful_options{{
+        {"add-locations-to-ways", "--index-file",      nullptr},
+        {"apply-changes",         "--store",           nullptr},
+        {"apply-changes",         "--create-store",    nullptr},
+        {"renumber",              "--index-directory", "-i"}
+    }};
+
+    bool starts_with(const std::string& str, const std::string& prefix) noexcept {
+        return str.compare(0, prefix.size(), prefix) == 0;
+    }
+
+    bool is_option(const std::string& argument, const char* name, const char* short_name) {
+        if (argument == name || starts_with(argument, std::string{name} + "=")) {
+            return true;
+        }
+        return short_name && !starts_with(argument, "--") && starts_with(argument, short_name);
+    }
+
+    // The previous argument is needed for options with the value in the
+    // next argument.
+    void check_stateful_option(const std::string& command, const std::string& previous, const std::string& argument) {
+        for (const auto& option : stateful_options) {
+            if (command == option.command && is_option(argument, option.name, option.short_name)) {
+                throw argument_error{std::string{"Can not use --cache-dir with the "} + option.name + " option."};
+            }
+        }
+
+        // File based index types like "dense_file_array,FILE" use an
+        // existing index file.
+        const bool index_type = is_option(argument, "--index-type", "-i") || previous == "--index-type" || previous == "-i";
+        if (command == "add-locations-to-ways" && index_type && argument.find(',') != std::string::npos) {
+            throw argument_error{"Can not use --cache-dir with a file based index."};
+        }
+    }
+
+    // Returns the number of arguments (1 or 2) taken up by an ignored
+    // option starting with this argument or 0 for any other argument.
+    std::size_t ignored_arguments(const std::string& argument) {
+        for (const auto& option : ignored_options) {
+            if (argument == option.name || (option.short_name && argument == option.short_name)) {
+                return option.has_value ? 2 : 1;
+            }
+            if (option.has_value) {
+                if (starts_with(argument, std::string{option.name} + "=")) {
+                    return 1;
+                }
+                if (option.short_name && !starts_with(argument, "--") && starts_with(argument, option.short_name)) {
+                    return 1;
+                }
+            }
+        }
+        return 0;
+    }
+
+} // anonymous namespace
+
+ResultCache::ResultCache(const std::string& directory, const std::string& command, const std::vector<std::string>& arguments, const std::string& output_filename) :
+    m_directory(directory) {
+    if (output_filename.empty() || output_filename == "-") {
+        throw argument_error{"The --cache-dir option needs an output file set with --output/-o."};
+    }
+    if (!is_file_type(directory, S_IFDIR)) {
+        throw argument_error{"Cache directory '" + directory + "' does not exist."};
+    }
+
+    Digest digest;
+    digest.update(get_osmium_long_version());
+    digest.update(get_libosmium_version());
+    digest.update(command);
+    digest.update(get_filename_suffix(output_filename));
+
+    for (std::size_t i = 0; i < arguments.size();) {
+        const auto& argument = arguments[i];
+        const auto ignored = ignored_arguments(argument);
+        if (ignored > 0) {
+            i += ignored;
+            continue;
+        }
+        ++i;
+
+        if (argument == "-") {
+            throw argument_error{"Can not use --cache-dir when reading from STDIN."};
+        }
+        check_stateful_option(command, i > 1 ? arguments[i - 2] : std::string{}, argument);
+
+        // Arguments naming files (such as the input files, polygon files
+        // or files with IDs) are replaced by the digest of their contents.
+        std::size_t value_pos = 0;
+        if (starts_with(argument, "--")) {
+            const auto pos = argument.find('=');
+            if (pos != std::string::npos) {
+                value_pos = pos + 1;
+            }
+        }
+        const std::string value{argument.substr(value_pos)};
+        if (is_remote_url(value)) {
+            throw argument_error{"Can not use --cache-dir with remote files."};
+        }
+        if (is_regular_file(value)) {
+            digest.update(argument.substr(0, value_pos) + "file:" + file_digest(directory, value));
+        } else {
+            digest.update(argument);
+        }
+    }
+
+    m_key = digest.hex();
+}
+
+std::string ResultCache::filename() const {
+    return m_directory + "/" + m_key;
+}
+
+bool ResultCache::fetch(const std::string& output_filename, osmium::io::overwrite overwrite) const {
+    const std::string cached{filename()};
+    if (!is_regular_file(cached)) {
+        return false;
+    }
+
+    if (is_regular_file(output_filename)) {
+        if (overwrite == osmium::io::overwrite::no) {
+            throw std::system_error{EEXIST, std::system_category(), "Open failed for '" + output_filename + "'"};
+        }
+        std::remove(output_filename.c_str());
+    }
+
+    // The result is copied, not hard linked, so the output file can be
+    // overwritten later without touching the (read-only) cached file.
+    copy_file(cached, output_filename);
+    return true;
+}
+
+void ResultCache::store(const std::string& output_filename) const {
+    TempFiles temp_files{m_directory, m_key, ".tmp"};
+    const std::string temp_filename{temp_files.create()};
+
+    copy_file(output_filename, temp_filename);
+
+#ifndef _WIN32
+    // Making cached files read-only protects them from accidental
+    // changes.
+    ::chmod(temp_filename.c_str(), S_IRUSR | S_IRGRP | S_IROTH);
+#endif
+
+    if (std::rename(temp_filename.c_str(), filename().c_str()) != 0) {
+        throw std::system_error{errno, std::system_category(), "Renaming '" + temp_filename + "' to '" + filename() + "' failed"};
+    }
+}
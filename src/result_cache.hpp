@@ -0,0 +1,82 @@
+#ifndef RESULT_CACHE_HPP
+#define RESULT_CACHE_HPP
+
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <osmium/io/writer_options.hpp>
+
+#include <string>
+#include <vector>
+
+/**
+ * Cache for the output files of commands in a directory (set with the
+ * --cache-dir option). The cached files are named after a SHA-256 digest of the
+ * osmium version, the command name, the normalized command line
+ * arguments, and the contents of all files named in the arguments (such
+ * as the input files). Running the same command on the same data again
+ * then only needs a copy of the cached file. The digests of the input
+ * files are kept in the cache directory, too, so unchanged files are not
+ * read again.
+ */
+class ResultCache {
+
+    std::string m_directory;
+    std::string m_key;
+
+public:
+
+    /**
+     * Create the cache key for the command with the arguments. Options
+     * which don't change the output (such as --verbose or --threads) and
+     * the output file name are not part of the key, only the suffix of
+     * the output file name is.
+     *
+     * @throws argument_error If the result can't be cached, for instance
+     *                        when reading from STDIN.
+     */
+    ResultCache(const std::string& directory, const std::string& command, const std::vector<std::string>& arguments, const std::string& output_filename);
+
+    const std::string& key() const noexcept {
+        return m_key;
+    }
+
+    // Name of the file in the cache directory for this result.
+    std::string filename() const;
+
+    /**
+     * Copy the cached result to the output file. Returns false if there
+     * is no cached result.
+     */
+    bool fetch(const std::string& output_filename, osmium::io::overwrite overwrite) const;
+
+    /**
+     * Copy the output file into the cache. The file is copied to a
+     * temporary file first and renamed, so other processes never see a
+     * partial result.
+     */
+    void store(const std::string& output_filename) const;
+
+}; // class ResultCache
+
+
+#endif // RESULT_CACHE_HPP
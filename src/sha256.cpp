@@ -0,0 +1,150 @@
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "sha256.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace {
+
+    constexpr const std::array<uint32_t, 64> round_constants{{
+        0x428a2f98U, 0x71374491U, 0xb5c0fbcfU, 0xe9b5dba5U, 0x3956c25bU, 0x59f111f1U, 0x923f82a4U, 0xab1c5ed5U,
+        0xd807aa98U, 0x12835b01U, 0x243185beU, 0x550c7dc3U, 0x72be5d74U, 0x80deb1feU, 0x9bdc06a7U, 0xc19bf174U,
+        0xe49b69c1U, 0xefbe4786U, 0x0fc19dc6U, 0x240ca1ccU, 0x2de92c6fU, 0x4a7484aaU, 0x5cb0a9dcU, 0x76f988daU,
+        0x983e5152U, 0xa831c66dU, 0xb00327c8U, 0xbf597fc7U, 0xc6e00bf3U, 0xd5a79147U, 0x06ca6351U, 0x14292967U,
+        0x27b70a85U, 0x2e1b2138U, 0x4d2c6dfcU, 0x53380d13U, 0x650a7354U, 0x766a0abbU, 0x81c2c92eU, 0x92722c85U,
+        0xa2bfe8a1U, 0xa81a664bU, 0xc24b8b70U, 0xc76c51a3U, 0xd192e819U, 0xd6990624U, 0xf40e3585U, 0x106aa070U,
+        0x19a4c116U, 0x1e376c08U, 0x2748774cU, 0x34b0bcb5U, 0x391c0cb3U, 0x4ed8aa4aU, 0x5b9cca4fU, 0x682e6ff3U,
+        0x748f82eeU, 0x78a5636fU, 0x84c87814U, 0x8cc70208U, 0x90befffaU, 0xa4506cebU, 0xbef9a3f7U, 0xc67178f2U
+    }};
+
+    inline uint32_t rotate_right(uint32_t value, unsigned int bits) noexcept {
+        return (value >> bits) | (value << (32U - bits));
+    }
+
+} // anonymous namespace
+
+SHA256::SHA256() noexcept :
+    m_state{{0x6a09e667U, 0xbb67ae85U, 0x3c6ef372U, 0xa54ff53aU, 0x510e527fU, 0x9b05688cU, 0x1f83d9abU, 0x5be0cd19U}} {
+}
+
+void SHA256::process_block(const unsigned char* block) noexcept {
+    std::array<uint32_t, 64> w; // NOLINT(cppcoreguidelines-pro-type-member-init)
+    for (std::size_t i = 0; i < 16; ++i) {
+        w[i] = (static_cast<uint32_t>(block[i * 4]) << 24U) |
+               (static_cast<uint32_t>(block[i * 4 + 1]) << 16U) |
+               (static_cast<uint32_t>(block[i * 4 + 2]) << 8U) |
+               static_cast<uint32_t>(block[i * 4 + 3]);
+    }
+    for (std::size_t i = 16; i < 64; ++i) {
+        const uint32_t s0 = rotate_right(w[i - 15], 7) ^ rotate_right(w[i - 15], 18) ^ (w[i - 15] >> 3U);
+        const uint32_t s1 = rotate_right(w[i - 2], 17) ^ rotate_right(w[i - 2], 19) ^ (w[i - 2] >> 10U);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = m_state[0];
+    uint32_t b = m_state[1];
+    uint32_t c = m_state[2];
+    uint32_t d = m_state[3];
+    uint32_t e = m_state[4];
+    uint32_t f = m_state[5];
+    uint32_t g = m_state[6];
+    uint32_t h = m_state[7];
+
+    for (std::size_t i = 0; i < 64; ++i) {
+        const uint32_t s1 = rotate_right(e, 6) ^ rotate_right(e, 11) ^ rotate_right(e, 25);
+        const uint32_t ch = (e & f) ^ (~e & g);
+        const uint32_t temp1 = h + s1 + ch + round_constants[i] + w[i];
+        const uint32_t s0 = rotate_right(a, 2) ^ rotate_right(a, 13) ^ rotate_right(a, 22);
+        const uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+        const uint32_t temp2 = s0 + maj;
+
+        h = g;
+        g = f;
+        f = e;
+        e = d + temp1;
+        d = c;
+        c = b;
+        b = a;
+        a = temp1 + temp2;
+    }
+
+    m_state[0] += a;
+    m_state[1] += b;
+    m_state[2] += c;
+    m_state[3] += d;
+    m_state[4] += e;
+    m_state[5] += f;
+    m_state[6] += g;
+    m_state[7] += h;
+}
+
+void SHA256::update(const char* data, std::size_t size) noexcept {
+    m_length += size;
+    while (size > 0) {
+        const std::size_t n = std::min(size, m_block.size() - m_block_size);
+        std::memcpy(m_block.data() + m_block_size, data, n);
+        m_block_size += n;
+        data += n;
+        size -= n;
+        if (m_block_size == m_block.size()) {
+            process_block(m_block.data());
+            m_block_size = 0;
+        }
+    }
+}
+
+std::string SHA256::hex_digest() {
+    const uint64_t bits = m_length * 8;
+
+    // Padding: a one bit, zeros, and the length in bits (big endian) at
+    // the end of the last block.
+    const char one = static_cast<char>(0x80);
+    update(&one, 1);
+    const char zero = 0;
+    while (m_block_size != 56) {
+        update(&zero, 1);
+    }
+    std::array<char, 8> length{};
+    for (std::size_t i = 0; i < 8; ++i) {
+        length[i] = static_cast<char>((bits >> (56U - 8U * i)) & 0xffU);
+    }
+    update(length.data(), length.size());
+
+    static constexpr const char* hex_digits = "0123456789abcdef";
+    std::string result;
+    result.reserve(64);
+    for (const auto value : m_state) {
+        for (unsigned int shift = 28;; shift -= 4) {
+            result += hex_digits[(value >> shift) & 0xfU];
+            if (shift == 0) {
+                break;
+            }
+        }
+    }
+    return result;
+}
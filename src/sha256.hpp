@@ -0,0 +1,56 @@
+#ifndef SHA256_HPP
+#define SHA256_HPP
+
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * SHA-256 hash (FIPS 180-4) of a sequence of bytes. Used for the keys of
+ * the result cache, so that different inputs never end up with the same
+ * key.
+ */
+class SHA256 {
+
+    std::array<uint32_t, 8> m_state;
+    std::array<unsigned char, 64> m_block{};
+    std::size_t m_block_size = 0;
+    uint64_t m_length = 0;
+
+    void process_block(const unsigned char* block) noexcept;
+
+public:
+
+    SHA256() noexcept;
+
+    void update(const char* data, std::size_t size) noexcept;
+
+    // Finish the hash and return it as 64 hex digits. Must be called
+    // only once.
+    std::string hex_digest();
+
+}; // class SHA256
+
+#endif // SHA256_HPP
@@ -0,0 +1,65 @@
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "temp_files.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#ifdef _MSC_VER
+# include <process.h>
+#else
+# include <unistd.h>
+#endif
+
+static int process_id() noexcept {
+#ifdef _MSC_VER
+    return _getpid();
+#else
+    return ::getpid();
+#endif
+}
+
+std::string default_temp_directory() {
+    const char* directory = std::getenv("TMPDIR");
+    if (directory && directory[0] != '\0') {
+        return directory;
+    }
+    return "/tmp";
+}
+
+TempFiles::TempFiles(const std::string& directory, const std::string& prefix, const std::string& suffix) :
+    m_prefix(directory + "/" + prefix + "-" + std::to_string(process_id()) + "-"),
+    m_suffix(suffix) {
+}
+
+TempFiles::~TempFiles() noexcept {
+    for (const auto& filename : m_filenames) {
+        std::remove(filename.c_str());
+    }
+}
+
+std::string TempFiles::create() {
+    m_filenames.push_back(m_prefix + std::to_string(m_count++) + m_suffix);
+    return m_filenames.back();
+}
@@ -0,0 +1,65 @@
+#ifndef TEMP_FILES_HPP
+#define TEMP_FILES_HPP
+
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <string>
+#include <vector>
+
+/**
+ * Directory for temporary files if not set on the command line: The
+ * directory in the TMPDIR environment variable or "/tmp".
+ */
+std::string default_temp_directory();
+
+/**
+ * Keeps track of temporary files. The names of the files are created
+ * from the directory, a prefix, the process ID, and a counter. All files
+ * not yet removed will be removed when this object goes out of scope,
+ * even if there was an exception.
+ */
+class TempFiles {
+
+    std::string m_prefix;
+    std::string m_suffix;
+    std::vector<std::string> m_filenames;
+    int m_count = 0;
+
+public:
+
+    TempFiles(const std::string& directory, const std::string& prefix, const std::string& suffix);
+
+    TempFiles(const TempFiles&) = delete;
+    TempFiles& operator=(const TempFiles&) = delete;
+
+    TempFiles(TempFiles&&) = delete;
+    TempFiles& operator=(TempFiles&&) = delete;
+
+    ~TempFiles() noexcept;
+
+    // Return the name for a new temporary file. The file is not created.
+    std::string create();
+
+}; // class TempFiles
+
+#endif // TEMP_FILES_HPP
@@ -0,0 +1,128 @@
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "trace.hpp"
+
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
+
+#include <cerrno>
+#include <fstream>
+#include <system_error>
+
+int Tracer::thread_id() {
+    static thread_local int id = -1;
+    if (id < 0) {
+        id = m_thread_count++;
+    }
+    return id;
+}
+
+void Tracer::enable(const std::string& filename) {
+    m_filename = filename;
+    m_start = clock_type::now();
+    thread_id(); // the main thread gets id 0
+    m_enabled = true;
+}
+
+void Tracer::record(const char* name, const std::int64_t start, const std::int64_t end) {
+    const int thread = thread_id();
+    const std::lock_guard<std::mutex> lock{m_mutex};
+    if (m_events.size() < max_events) {
+        m_events.push_back(event{name, start, end - start, thread});
+    } else {
+        ++m_dropped;
+    }
+}
+
+void Tracer::write() {
+    if (!enabled()) {
+        return;
+    }
+    m_enabled = false;
+
+    const std::lock_guard<std::mutex> lock{m_mutex};
+
+    rapidjson::StringBuffer stream;
+    rapidjson::Writer<rapidjson::StringBuffer> writer{stream};
+
+    writer.StartObject();
+    writer.String("traceEvents");
+    writer.StartArray();
+
+    for (int thread = 0; thread < m_thread_count; ++thread) {
+        const std::string name = thread == 0 ? "main" : "thread " + std::to_string(thread);
+        writer.StartObject();
+        writer.String("name");
+        writer.String("thread_name");
+        writer.String("ph");
+        writer.String("M");
+        writer.String("pid");
+        writer.Int(1);
+        writer.String("tid");
+        writer.Int(thread);
+        writer.String("args");
+        writer.StartObject();
+        writer.String("name");
+        writer.String(name.c_str());
+        writer.EndObject();
+        writer.EndObject();
+    }
+
+    for (const auto& e : m_events) {
+        writer.StartObject();
+        writer.String("name");
+        writer.String(e.name);
+        writer.String("cat");
+        writer.String("osmium");
+        writer.String("ph");
+        writer.String("X");
+        writer.String("ts");
+        writer.Int64(e.start);
+        writer.String("dur");
+        writer.Int64(e.duration);
+        writer.String("pid");
+        writer.Int(1);
+        writer.String("tid");
+        writer.Int(e.thread);
+        writer.EndObject();
+    }
+
+    writer.EndArray();
+
+    writer.String("displayTimeUnit");
+    writer.String("ms");
+
+    writer.String("otherData");
+    writer.StartObject();
+    writer.String("dropped_events");
+    writer.Uint64(m_dropped);
+    writer.EndObject();
+
+    writer.EndObject();
+
+    std::ofstream out{m_filename};
+    if (!out) {
+        throw std::system_error{errno, std::system_category(), std::string{"Could not open trace file '"} + m_filename + "'"};
+    }
+    out << stream.GetString() << '\n';
+}
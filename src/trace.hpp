@@ -0,0 +1,151 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+/*
+
+Osmium -- OpenStreetMap data manipulation command line tool
+https://osmcode.org/osmium-tool/
+
+Copyright (C) 2013-2018  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * Records spans of time spent in some part of the program and writes
+ * them out in the Chrome trace event format (which can also be read by
+ * Perfetto). Tracing is enabled with the --trace option, otherwise
+ * recording a span only costs a check of an atomic flag.
+ *
+ * There is only one tracer for the whole program, because spans are
+ * recorded deep down in the code and from the worker threads.
+ */
+class Tracer {
+
+    using clock_type = std::chrono::steady_clock;
+
+    // Stop recording after this many events to limit memory use.
+    static constexpr const std::size_t max_events = 10UL * 1000UL * 1000UL;
+
+    struct event {
+        const char* name;
+        std::int64_t start;
+        std::int64_t duration;
+        int thread;
+    };
+
+    std::atomic<bool> m_enabled{false};
+    std::atomic<int> m_thread_count{0};
+    clock_type::time_point m_start;
+    std::string m_filename;
+
+    std::mutex m_mutex;
+    std::vector<event> m_events;
+    std::size_t m_dropped = 0;
+
+    Tracer() = default;
+
+    int thread_id();
+
+public:
+
+    static Tracer& instance() {
+        static Tracer tracer;
+        return tracer;
+    }
+
+    bool enabled() const noexcept {
+        return m_enabled.load(std::memory_order_relaxed);
+    }
+
+    // Start recording events that will be written to the named file.
+    // Must be called from the main thread.
+    void enable(const std::string& filename);
+
+    std::int64_t now() const noexcept {
+        return std::chrono::duration_cast<std::chrono::microseconds>(clock_type::now() - m_start).count();
+    }
+
+    // Record a span. The name must be a string literal (or live until
+    // the trace is written).
+    void record(const char* name, std::int64_t start, std::int64_t end);
+
+    // Write all recorded events to the file (if tracing is enabled).
+    void write();
+
+}; // class Tracer
+
+/**
+ * Records a span from its construction to its destruction if tracing
+ * is enabled.
+ */
+class TraceSpan {
+
+    const char* m_name;
+    std::int64_t m_start = -1;
+
+public:
+
+    explicit TraceSpan(const char* name) :
+        m_name(name) {
+        if (Tracer::instance().enabled()) {
+            m_start = Tracer::instance().now();
+        }
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+    TraceSpan(TraceSpan&&) = delete;
+    TraceSpan& operator=(TraceSpan&&) = delete;
+
+    ~TraceSpan() {
+        if (m_start >= 0) {
+            Tracer::instance().record(m_name, m_start, Tracer::instance().now());
+        }
+    }
+
+}; // class TraceSpan
+
+/**
+ * Read the next buffer from the reader recording a "read" span. This is
+ * the time the caller waits for the input to be read and decoded.
+ */
+template <typename TReader>
+auto traced_read(TReader& reader) -> decltype(reader.read()) {
+    const TraceSpan span{"read"};
+    return reader.read();
+}
+
+/**
+ * Write data to the writer recording a "write" span. This is the time
+ * the caller waits for the writer to take the data.
+ */
+template <typename TWriter, typename T>
+void traced_write(TWriter& writer, T&& data) {
+    const TraceSpan span{"write"};
+    writer(std::forward<T>(data));
+}
+
+#endif // TRACE_HPP
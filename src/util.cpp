@@ -21,19 +21,34 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
 #include "exception.hpp"
+#include "remote_file.hpp"
 #include "util.hpp"
 
 #include <osmium/io/file.hpp>
+#include <osmium/io/file_compression.hpp>
+#include <osmium/io/file_format.hpp>
+#include <osmium/io/header.hpp>
+#include <osmium/io/reader.hpp>
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm/entity.hpp>
+#include <osmium/osm/entity_bits.hpp>
+#include <osmium/osm/metadata_options.hpp>
 #include <osmium/tags/tags_filter.hpp>
-#include <osmium/util/file.hpp>
 #include <osmium/util/string.hpp>
 
 #include <cassert>
+#include <cstdint>
 #include <cstdlib>
 #include <iostream>
 #include <string>
+#include <utility>
 #include <vector>
 
+#ifndef _WIN32
+# include <sys/resource.h>
+# include <sys/stat.h>
+#endif
+
 /**
  * Get the suffix of the given file name. The suffix is everything after
  * the *first* dot (.). So multiple suffixes will all be returned.
@@ -70,7 +85,36 @@ std::size_t file_size_sum(const std::vector<osmium::io::File>& files) {
     std::size_t sum = 0;
 
     for (const auto& file : files) {
-        sum += osmium::file_size(file.filename());
+        sum += input_file_size(file.filename());
+    }
+
+    return sum;
+}
+
+/**
+ * Rough estimate of the memory needed to keep all objects from the files
+ * in memory. Returns 0 if the size of any of the files is not known, for
+ * instance when reading from STDIN.
+ */
+uint64_t estimate_buffer_memory(const std::vector<osmium::io::File>& files) {
+    uint64_t sum = 0;
+
+    for (const auto& file : files) {
+        if (file.filename().empty()) {
+            return 0;
+        }
+        // Ratio between the size of the objects in osmium buffers and
+        // the size of the file (times 10). These are rough averages
+        // for typical OSM data.
+        uint64_t factor = 4;
+        if (file.format() == osmium::io::file_format::pbf) {
+            factor = 100;
+        } else if (file.format() == osmium::io::file_format::o5m) {
+            factor = 50;
+        } else if (file.compression() != osmium::io::file_compression::none) {
+            factor = 30;
+        }
+        sum += input_file_size(file.filename()) * factor / 10;
     }
 
     return sum;
@@ -212,6 +256,83 @@ osmium::Box parse_bbox(const std::string& str, const std::string& option_name) {
     return box;
 }
 
+/**
+ * Set the compression (none or zlib) and compression level used for
+ * the blocks of a PBF output file. An empty compression or a negative
+ * level leaves the respective setting alone.
+ *
+ * @throws argument_error If the compression is unknown or the file is
+ *         not a PBF file.
+ */
+void set_pbf_compression(osmium::io::File& file, const std::string& compression, int level) {
+    if (compression.empty() && level < 0) {
+        return;
+    }
+
+    if (file.format() != osmium::io::file_format::pbf) {
+        throw argument_error{"The output compression can only be set for PBF files."};
+    }
+
+    if (!compression.empty()) {
+        if (compression != "none" && compression != "zlib") {
+            throw argument_error{"Unknown output compression '" + compression + "' (use 'none' or 'zlib')."};
+        }
+        file.set("pbf_compression", compression);
+    }
+
+    if (level >= 0) {
+        file.set("pbf_compression_level", std::to_string(level));
+    }
+}
+
+/**
+ * Is the input file STDIN (empty file name or "-") or a pipe or socket?
+ * Those can only be read once from start to end. (The pipeline command
+ * connects its commands through pipes named /dev/fd/N.)
+ */
+bool is_stdin_or_pipe(const std::string& filename) {
+    if (filename.empty() || filename == "-") {
+        return true;
+    }
+
+#ifndef _WIN32
+    struct stat st{};
+    if (::stat(filename.c_str(), &st) == 0) {
+        return S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode);
+    }
+#endif
+
+    return false;
+}
+
+/**
+ * Does the OSM file have node locations on ways? This is the case if it
+ * is set in the file options or if a PBF file announces it in its header.
+ * Files read from STDIN or a pipe are never checked, because that would
+ * use up the header.
+ */
+bool has_locations_on_ways(const osmium::io::File& file) {
+    if (file.is_true("locations_on_ways")) {
+        return true;
+    }
+
+    if (file.format() != osmium::io::file_format::pbf || is_stdin_or_pipe(file.filename())) {
+        return false;
+    }
+
+    osmium::io::Reader reader{file, osmium::osm_entity_bits::nothing};
+    const osmium::io::Header header = reader.header();
+    reader.close();
+
+    for (const auto& option : header) {
+        if (option.first.compare(0, 21, "pbf_optional_feature_") == 0 && option.second == "LocationsOnWays") {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 osmium::item_type parse_item_type(const std::string& t) {
     if (t == "n" || t == "node") {
         return osmium::item_type::node;
@@ -228,3 +349,56 @@ osmium::item_type parse_item_type(const std::string& t) {
     throw argument_error{std::string{"Unknown default type '"} + t + "' (Allowed are 'node', 'way', and 'relation')."};
 }
 
+/**
+ * Does the output file store any metadata (version, timestamp, etc.)?
+ * This is only not the case if it was opened with add_metadata=false
+ * (or none). If it doesn't, there is no need to decode the metadata
+ * from the input.
+ */
+bool has_metadata_output(const osmium::io::File& file) {
+    return osmium::metadata_options{file.get("add_metadata")}.any();
+}
+
+/**
+ * Remove all objects after the first max_objects objects from the buffer.
+ * Returns the number of objects left in the buffer.
+ */
+std::size_t truncate_buffer(osmium::memory::Buffer& buffer, std::size_t max_objects) {
+    std::size_t count = 0;
+    auto it = buffer.begin<osmium::OSMEntity>();
+    for (; it != buffer.end<osmium::OSMEntity>() && count < max_objects; ++it) {
+        ++count;
+    }
+
+    if (it == buffer.end<osmium::OSMEntity>()) {
+        return count;
+    }
+
+    osmium::memory::Buffer truncated{buffer.committed(), osmium::memory::Buffer::auto_grow::yes};
+    for (auto copy_it = buffer.begin<osmium::OSMEntity>(); copy_it != it; ++copy_it) {
+        truncated.add_item(*copy_it);
+        truncated.commit();
+    }
+    buffer = std::move(truncated);
+
+    return count;
+}
+
+/**
+ * How many more files can this process open at the same time? This is
+ * the soft limit on file descriptors (RLIMIT_NOFILE) minus the given
+ * number of descriptors reserved for input files, indexes, etc. Always
+ * returns at least 1.
+ */
+std::size_t max_open_files(std::size_t reserve) {
+    std::size_t limit = 512;
+
+#ifndef _WIN32
+    struct rlimit rl{};
+    if (::getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY) {
+        limit = static_cast<std::size_t>(rl.rlim_cur);
+    }
+#endif
+
+    return limit > reserve ? limit - reserve : 1;
+}
@@ -24,12 +24,15 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
 #include <osmium/io/file.hpp>
+#include <osmium/memory/buffer.hpp>
 #include <osmium/osm/box.hpp>
 #include <osmium/osm/entity_bits.hpp>
 #include <osmium/tags/matcher.hpp>
 #include <osmium/tags/tags_filter.hpp>
 #include <osmium/util/string_matcher.hpp>
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
 #include <utility>
 #include <vector>
@@ -39,6 +42,7 @@ const char* yes_no(bool choice) noexcept;
 void warning(const char* text);
 void warning(const std::string& text);
 std::size_t file_size_sum(const std::vector<osmium::io::File>& files);
+uint64_t estimate_buffer_memory(const std::vector<osmium::io::File>& files);
 osmium::osm_entity_bits::type get_types(const std::string& str);
 std::pair<osmium::osm_entity_bits::type, std::string> get_filter_expression(const std::string& str);
 void strip_whitespace(std::string& string);
@@ -47,5 +51,11 @@ osmium::TagMatcher get_tag_matcher(const std::string& expression);
 void initialize_tags_filter(osmium::TagsFilter& tags_filter, bool default_result, const std::vector<std::string>& strings);
 osmium::Box parse_bbox(const std::string& str, const std::string& option_name);
 osmium::item_type parse_item_type(const std::string& t);
+void set_pbf_compression(osmium::io::File& file, const std::string& compression, int level);
+bool is_stdin_or_pipe(const std::string& filename);
+bool has_locations_on_ways(const osmium::io::File& file);
+bool has_metadata_output(const osmium::io::File& file);
+std::size_t truncate_buffer(osmium::memory::Buffer& buffer, std::size_t max_objects);
+std::size_t max_open_files(std::size_t reserve);
 
 #endif // UTIL_HPP
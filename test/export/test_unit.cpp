@@ -0,0 +1,104 @@
+#include "test.hpp" // IWYU pragma: keep
+
+#include "export/flatbuffer_builder.hpp"
+#include "export/format_util.hpp"
+
+#include <cstdint>
+#include <limits>
+#include <string>
+
+TEST_CASE("FlatBuffer table with scalar field") {
+    FlatBufferBuilder builder;
+
+    builder.start_table();
+    builder.add_ubyte(0, 7);
+    const auto table = builder.end_table();
+
+    std::string out;
+    builder.finish_size_prefixed(table, out);
+
+    const std::string expected{
+        "\x14\x00\x00\x00" // size prefix
+        "\x0c\x00\x00\x00" // offset to root table
+        "\x00\x00"         // padding
+        "\x06\x00\x08\x00\x07\x00" // vtable
+        "\x06\x00\x00\x00" // offset to vtable
+        "\x00\x00\x00\x07", // padding and field
+        24
+    };
+
+    REQUIRE(out == expected);
+    REQUIRE(builder.size() == 0);
+}
+
+TEST_CASE("FlatBuffer table with string field") {
+    FlatBufferBuilder builder;
+
+    const auto str = builder.create_string("ab");
+    builder.start_table();
+    builder.add_offset(0, str);
+    const auto table = builder.end_table();
+
+    std::string out{"x"};
+    builder.finish_size_prefixed(table, out);
+
+    const std::string expected{
+        "x"
+        "\x1c\x00\x00\x00" // size prefix
+        "\x0c\x00\x00\x00" // offset to root table
+        "\x00\x00"         // padding
+        "\x06\x00\x08\x00\x04\x00" // vtable
+        "\x06\x00\x00\x00" // offset to vtable
+        "\x04\x00\x00\x00" // offset to string
+        "\x02\x00\x00\x00" "ab\x00\x00", // string with padding
+        33
+    };
+
+    REQUIRE(out == expected);
+}
+
+TEST_CASE("Append integers") {
+    std::string out;
+    append_int(out, 0);
+    out += ' ';
+    append_int(out, 1234);
+    out += ' ';
+    append_int(out, -56);
+    out += ' ';
+    append_int(out, std::numeric_limits<std::int64_t>::min());
+    REQUIRE(out == "0 1234 -56 -9223372036854775808");
+}
+
+TEST_CASE("Append coordinates") {
+    std::string out;
+    append_coordinate(out, 0);
+    out += ' ';
+    append_coordinate(out, 15000000);
+    out += ' ';
+    append_coordinate(out, -1234567);
+    out += ' ';
+    append_coordinate(out, 1800000000);
+    out += ' ';
+    append_coordinate(out, 1);
+    REQUIRE(out == "0 1.5 -0.1234567 180 0.0000001");
+}
+
+TEST_CASE("Append coordinates for JSON") {
+    std::string out;
+    append_coordinate(out, 10000000, true);
+    out += ' ';
+    append_coordinate(out, -15000000, true);
+    REQUIRE(out == "1.0 -1.5");
+}
+
+TEST_CASE("Append string escaped for PostgreSQL") {
+    std::string out;
+    append_pg_escaped(out, "a\\b\tc\nd\re");
+    REQUIRE(out == "a\\\\b\\tc\\nd\\re");
+}
+
+TEST_CASE("Append string escaped for PostgreSQL with size") {
+    std::string out;
+    append_pg_escaped(out, "abc\tdef", 4);
+    REQUIRE(out == "abc\\t");
+}
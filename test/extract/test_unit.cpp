@@ -2,11 +2,24 @@
 #include "test.hpp" // IWYU pragma: keep
 
 #include "exception.hpp"
+#include "extract_index.hpp"
+#include "extract_polygon.hpp"
+#include "extract_tile.hpp"
 #include "geojson_file_parser.hpp"
+#include "id_set.hpp"
+#include "node_extract_index.hpp"
 #include "osm_file_parser.hpp"
 #include "poly_file_parser.hpp"
 
+#include <osmium/builder/attr.hpp>
+#include <osmium/io/file.hpp>
 #include <osmium/memory/buffer.hpp>
+#include <osmium/osm/location.hpp>
+#include <osmium/osm/way.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
 
 TEST_CASE("Parse poly files") {
     osmium::memory::Buffer buffer{1024};
@@ -240,5 +253,222 @@ TEST_CASE("Parse GeoJSON files") {
         REQUIRE_THROWS_AS(parser(), const geojson_error&);
     }
 
+    SECTION("Invalid GeoJSON file: Coordinates don't match geometry type") {
+        GeoJSONFileParser parser{buffer, "test/extract/wrong-nesting.geojson"};
+        REQUIRE_THROWS_AS(parser(), const geojson_error&);
+        REQUIRE(buffer.committed() == 0);
+    }
+
+    SECTION("Feature with polygon with outer and inner ring") {
+        GeoJSONFileParser parser{buffer, "test/extract/polygon-outer-inner.geojson"};
+        REQUIRE(parser() == 0);
+        const osmium::Area& area = buffer.get<osmium::Area>(0);
+        const auto nr = area.num_rings();
+        REQUIRE(nr.first == 1);
+        REQUIRE(nr.second == 1);
+
+        const auto& outer_ring = *area.outer_rings().begin();
+        REQUIRE(outer_ring.size() == 5);
+        REQUIRE(outer_ring.front().location() == osmium::Location(10.0, 10.0));
+        const auto& inner_ring = *area.inner_rings(outer_ring).begin();
+        REQUIRE(inner_ring.front().location() == osmium::Location(11.0, 11.0));
+    }
+
+    SECTION("Feature collection with multipolygon, names in any order") {
+        GeoJSONFileParser parser{buffer, "test/extract/multipolygon-collection.geojson"};
+        REQUIRE(parser() == 0);
+        const osmium::Area& area = buffer.get<osmium::Area>(0);
+        const auto nr = area.num_rings();
+        REQUIRE(nr.first == 2);
+        REQUIRE(nr.second == 0);
+
+        auto it = area.outer_rings().begin();
+        REQUIRE(it->front().location() == osmium::Location(10.0, 10.0));
+        ++it;
+        REQUIRE(it->front().location() == osmium::Location(20.0, 20.0));
+    }
+
+}
+
+TEST_CASE("Extract index") {
+    const std::vector<osmium::Box> envelopes = {
+        osmium::Box{0.0, 0.0, 1.5, 10.0},
+        osmium::Box{},
+        osmium::Box{-10.5, -20.5, -9.5, -19.5},
+        osmium::Box{1.2, 9.5, 3.0, 11.0}
+    };
+
+    const ExtractIndex index{envelopes};
+
+    REQUIRE(index.candidates(osmium::Location{}).empty());
+    REQUIRE(index.candidates(osmium::Location{100.0, 50.0}).empty());
+    REQUIRE(index.candidates(osmium::Location{0.5, 0.5}) == std::vector<std::size_t>{0});
+    REQUIRE(index.candidates(osmium::Location{-10.0, -20.0}) == std::vector<std::size_t>{2});
+    REQUIRE(index.candidates(osmium::Location{1.3, 9.7}) == (std::vector<std::size_t>{0, 3}));
+    REQUIRE(index.candidates(osmium::Location{180.0, 90.0}).empty());
+}
+
+TEST_CASE("Tile envelopes") {
+    const auto box = tile_envelope(tile_id{1, 0, 0});
+    REQUIRE(box.bottom_left() == osmium::Location(-180.0, 0.0));
+    REQUIRE(box.top_right() == osmium::Location(0.0, 90.0));
+
+    const auto box2 = tile_envelope(tile_id{2, 3, 3});
+    REQUIRE(box2.bottom_left() == osmium::Location(90.0, -90.0));
+    REQUIRE(box2.top_right().lon() == Approx(180.0));
+    REQUIRE(box2.top_right().lat() == Approx(-66.5132604));
+}
+
+TEST_CASE("Tiles in box") {
+    REQUIRE(num_tiles_in_box(10, osmium::Box{-180.0, -90.0, 180.0, 90.0}) == 1024 * 1024);
+
+    const auto tiles = tiles_in_box(1, osmium::Box{-10.0, -10.0, 10.0, 10.0});
+    REQUIRE(tiles.size() == 4);
+    REQUIRE(tiles[0].x == 0);
+    REQUIRE(tiles[0].y == 0);
+    REQUIRE(tiles[3].x == 1);
+    REQUIRE(tiles[3].y == 1);
+
+    REQUIRE(tiles_in_box(8, osmium::Box{1.0, 1.0, 1.1, 1.1}).size() == 1);
+}
+
+TEST_CASE("Extract index for tiles") {
+    const std::vector<tile_id> tiles = {
+        tile_id{1, 0, 0},
+        tile_id{1, 1, 0},
+        tile_id{1, 1, 1}
+    };
+
+    const ExtractIndex index{tiles};
+
+    const auto candidates = [&index](const osmium::Location& location) -> std::vector<std::size_t> {
+        std::vector<std::size_t> result;
+        index.for_each_candidate(location, [&result](std::size_t i) {
+            result.push_back(i);
+        });
+        return result;
+    };
+
+    REQUIRE(candidates(osmium::Location{}).empty());
+    REQUIRE(candidates(osmium::Location{-90.0, 45.0}) == std::vector<std::size_t>{0});
+    REQUIRE(candidates(osmium::Location{90.0, -45.0}) == std::vector<std::size_t>{2});
+    REQUIRE(candidates(osmium::Location{-90.0, -45.0}).empty());
+    REQUIRE(candidates(osmium::Location{90.0, 89.9}) == std::vector<std::size_t>{1});
+    REQUIRE(candidates(osmium::Location{0.0, 0.0}) == (std::vector<std::size_t>{0, 1, 2}));
+}
+
+TEST_CASE("Polygon extract contains locations") {
+    osmium::memory::Buffer buffer{1024};
+    PolyFileParser parser{buffer, "test/extract/polygon-outer-inner.poly"};
+    const ExtractPolygon extract{osmium::io::File{"test.osm"}, "", buffer, parser()};
+
+    REQUIRE_FALSE(extract.contains(osmium::Location{}));
+    REQUIRE(extract.contains(osmium::Location{10.0, 10.0}));
+
+    for (int i = 0; i < 40; ++i) {
+        for (int j = 0; j < 40; ++j) {
+            const double x = 9.15 + i * 0.3;
+            const double y = 9.15 + j * 0.3;
+            const bool in_outer = x > 10.0 && x < 19.0 && y > 10.0 && y < 19.0;
+            const bool in_inner = x > 11.0 && x < 18.0 && y > 11.0 && y < 18.0;
+            REQUIRE(extract.contains(osmium::Location{x, y}) == (in_outer && !in_inner));
+        }
+    }
+}
+
+TEST_CASE("Compressed ID set") {
+    CompressedIdSet set;
+
+    REQUIRE_FALSE(set.get(0));
+    REQUIRE_FALSE(set.get(17));
+
+    set.set(17);
+    set.set(3);
+    set.set(17);
+    set.set(10000000000ULL);
+
+    REQUIRE(set.get(3));
+    REQUIRE(set.get(17));
+    REQUIRE(set.get(10000000000ULL));
+    REQUIRE_FALSE(set.get(4));
+    REQUIRE_FALSE(set.get(10000000001ULL));
+
+    SECTION("Container switching to bitmap") {
+        for (osmium::unsigned_object_id_type id = 100000; id < 120000; id += 2) {
+            set.set(id);
+        }
+        for (osmium::unsigned_object_id_type id = 100000; id < 120000; ++id) {
+            REQUIRE(set.get(id) == (id % 2 == 0));
+        }
+        REQUIRE(set.get(17));
+
+        std::size_t count = 0;
+        set.for_each([&](osmium::unsigned_object_id_type id) {
+            REQUIRE(set.get(id));
+            ++count;
+        });
+        REQUIRE(count == 10000 + 3);
+    }
+
+    SECTION("Any of the nodes of a way") {
+        using namespace osmium::builder::attr; // NOLINT(google-build-using-namespace)
+        osmium::memory::Buffer buffer{1024};
+        const auto& way1 = buffer.get<osmium::Way>(osmium::builder::add_way(buffer, _id(1), _nodes({1, 2, 4, 5, 6, 7, 8, 9, 11, 12, 13, 14, 15, 16, 18, 19, 20, 17})));
+        const auto& way2 = buffer.get<osmium::Way>(osmium::builder::add_way(buffer, _id(2), _nodes({1, 2, 4, 5, 6, 7, 8, 9, 11, 12, 13, 14, 15, 16, 18, 19, 20, 21})));
+        REQUIRE(set.any_of(way1.nodes()));
+        REQUIRE_FALSE(set.any_of(way2.nodes()));
+    }
+
+    SECTION("Iterate in order") {
+        std::vector<osmium::unsigned_object_id_type> ids;
+        set.for_each([&](osmium::unsigned_object_id_type id) {
+            ids.push_back(id);
+        });
+        const std::vector<osmium::unsigned_object_id_type> expected = {3, 17, 10000000000ULL};
+        REQUIRE(ids == expected);
+    }
 }
 
+TEST_CASE("Node extract index") {
+    NodeExtractIndex index;
+
+    index.add(10, 0);
+    index.add(10, 2);
+    index.add(11, 2);
+    index.add(12, 0);
+    index.add(12, 2);
+    index.add(100000, 1);
+
+    REQUIRE(index.get(1) == 0);
+    REQUIRE(index.get(13) == 0);
+    REQUIRE(index.get(10) == index.get(12));
+    REQUIRE(index.extracts(index.get(10)) == std::vector<std::size_t>({0, 2}));
+    REQUIRE(index.extracts(index.get(11)) == std::vector<std::size_t>({2}));
+    REQUIRE(index.extracts(index.get(100000)) == std::vector<std::size_t>({1}));
+
+    osmium::memory::Buffer buffer{1024};
+
+    SECTION("Way with nodes in some extracts") {
+        using namespace osmium::builder::attr; // NOLINT(google-build-using-namespace)
+        const auto& way = buffer.get<osmium::Way>(osmium::builder::add_way(buffer, _id(1), _nodes({1, 11, 10, 12})));
+        auto extracts = index.way_extracts(way.nodes());
+        std::sort(extracts.begin(), extracts.end());
+        REQUIRE(extracts == std::vector<std::size_t>({0, 2}));
+    }
+
+    SECTION("Way with no nodes in any extract") {
+        using namespace osmium::builder::attr; // NOLINT(google-build-using-namespace)
+        const auto& way = buffer.get<osmium::Way>(osmium::builder::add_way(buffer, _id(1), _nodes({1, 2, 3})));
+        REQUIRE(index.way_extracts(way.nodes()).empty());
+    }
+
+    SECTION("Clear") {
+        index.clear();
+        REQUIRE(index.get(10) == 0);
+    }
+}
+
+TEST_CASE("ID set type for extract") {
+    REQUIRE(id_set_type_for(osmium::Box{0.0, 0.0, 1.5, 10.0}) == id_set_type::compressed);
+    REQUIRE(id_set_type_for(osmium::Box{-180.0, -90.0, 180.0, 90.0}) == id_set_type::dense);
+}
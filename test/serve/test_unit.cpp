@@ -0,0 +1,49 @@
+#include "test.hpp" // IWYU pragma: keep
+
+#include "exception.hpp"
+#include "pbf_blocks.hpp"
+#include "query_index.hpp"
+
+#include <string>
+
+TEST_CASE("Query index") {
+    const std::string filename{"test/cat/input1.osm.pbf"};
+    QueryIndex index{filename, build_pbf_block_index(filename)};
+
+    SECTION("getid") {
+        REQUIRE(index.query("getid n2", osmium::item_type::node) == "n2 v1 dV c1 t2015-01-01T01:00:00Z i1 utest T x1 y2\n");
+        REQUIRE(index.query("getid 2", osmium::item_type::node) == "n2 v1 dV c1 t2015-01-01T01:00:00Z i1 utest T x1 y2\n");
+        REQUIRE(index.query("getid n1,n3", osmium::item_type::node) ==
+                "n1 v1 dV c1 t2015-01-01T01:00:00Z i1 utest T x1 y1\n"
+                "n3 v1 dV c1 t2015-01-01T01:00:00Z i1 utest T x1 y3\n");
+    }
+
+    SECTION("getid missing objects") {
+        REQUIRE(index.query("getid n99 w1", osmium::item_type::node).empty());
+    }
+
+    SECTION("getparents needs parent index") {
+        REQUIRE_THROWS_AS(index.query("getparents n2", osmium::item_type::node), const argument_error&);
+        index.build_parent_index();
+        REQUIRE(index.has_parent_index());
+        REQUIRE(index.query("getparents n2", osmium::item_type::node).empty());
+    }
+
+    SECTION("fileinfo") {
+        const auto result = index.query("fileinfo", osmium::item_type::node);
+        REQUIRE(result.find("file test/cat/input1.osm.pbf\n") == 0);
+        REQUIRE(result.find("parent_index no\n") != std::string::npos);
+    }
+
+    SECTION("unknown request") {
+        REQUIRE_THROWS_AS(index.query("foo", osmium::item_type::node), const argument_error&);
+        REQUIRE_THROWS_AS(index.query("", osmium::item_type::node), const argument_error&);
+    }
+}
+
+TEST_CASE("Query index with wrong block index") {
+    const std::string filename{"test/cat/input1.osm.pbf"};
+    pbf_block_index block_index;
+    block_index.file_size = 1;
+    REQUIRE_THROWS(QueryIndex(filename, block_index));
+}
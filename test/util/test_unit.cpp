@@ -1,8 +1,56 @@
 
 #include "test.hpp" // IWYU pragma: keep
 
+#include "adaptive_id_set.hpp"
+#include "changeset_prefilter.hpp"
+#include "compiled_tags_filter.hpp"
+#include "id_file.hpp"
+#include "location_index.hpp"
+#include "metrics.hpp"
+#include "object_runs.hpp"
+#include "parallel_sort.hpp"
+#include "pbf_blocks.hpp"
+#include "read_ahead.hpp"
+#include "relations_map.hpp"
+#include "remote_file.hpp"
+#include "result_cache.hpp"
+#include "sha256.hpp"
+#include "temp_files.hpp"
 #include "util.hpp"
 
+#include <osmium/builder/attr.hpp>
+#include <osmium/io/error.hpp>
+#include <osmium/io/file.hpp>
+#include <osmium/io/header.hpp>
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm/location.hpp>
+#include <osmium/osm/node.hpp>
+#include <osmium/osm/relation.hpp>
+#include <osmium/osm/tag.hpp>
+#include <osmium/osm/timestamp.hpp>
+#include <osmium/osm/way.hpp>
+
+#include <rapidjson/document.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 TEST_CASE("Get suffix from filename") {
     REQUIRE(get_filename_suffix("foo.bar") == "bar");
 }
@@ -119,3 +167,801 @@ TEST_CASE("get_tag_matcher") {
     REQUIRE_FALSE(test_tag_matcher("addr:*", "addr", "Berlin"));
 }
 
+static bool test_compiled_filter(const CompiledTagsFilter& filter, const char* key, const char* value) {
+    osmium::memory::Buffer buffer{1024, osmium::memory::Buffer::auto_grow::yes};
+    const auto pos = osmium::builder::add_tag_list(buffer, osmium::builder::attr::_tag(key, value));
+    return filter.match_any_of(buffer.get<osmium::TagList>(pos));
+}
+
+TEST_CASE("CompiledTagsFilter") {
+    CompiledTagsFilter filter;
+    REQUIRE(filter.empty());
+    REQUIRE_FALSE(test_compiled_filter(filter, "foo", "bar"));
+
+    filter.add_expression("highway=primary,secondary");
+    filter.add_expression("landuse, natural");
+    filter.add_expression("amenity=restaurant");
+    filter.add_expression("amenity=cafe");
+    filter.add_expression("addr:*");
+    filter.add_expression("name!=foo");
+    REQUIRE_FALSE(filter.empty());
+
+    REQUIRE(test_compiled_filter(filter, "highway", "primary"));
+    REQUIRE(test_compiled_filter(filter, "highway", "secondary"));
+    REQUIRE_FALSE(test_compiled_filter(filter, "highway", "residential"));
+
+    REQUIRE(test_compiled_filter(filter, "landuse", "forest"));
+    REQUIRE(test_compiled_filter(filter, "natural", "wood"));
+
+    REQUIRE(test_compiled_filter(filter, "amenity", "restaurant"));
+    REQUIRE(test_compiled_filter(filter, "amenity", "cafe"));
+    REQUIRE_FALSE(test_compiled_filter(filter, "amenity", "bar"));
+
+    REQUIRE(test_compiled_filter(filter, "addr:city", "Berlin"));
+    REQUIRE_FALSE(test_compiled_filter(filter, "addr", "Berlin"));
+
+    REQUIRE(test_compiled_filter(filter, "name", "bar"));
+    REQUIRE_FALSE(test_compiled_filter(filter, "name", "foo"));
+
+    SECTION("default result true matches everything") {
+        filter.set_default_result(true);
+        REQUIRE(test_compiled_filter(filter, "foo", "bar"));
+    }
+
+    SECTION("many keys") {
+        for (int i = 0; i < 1000; ++i) {
+            filter.add_expression("key" + std::to_string(i) + "=value" + std::to_string(i));
+        }
+        REQUIRE(test_compiled_filter(filter, "key0", "value0"));
+        REQUIRE(test_compiled_filter(filter, "key999", "value999"));
+        REQUIRE_FALSE(test_compiled_filter(filter, "key999", "value998"));
+        REQUIRE(test_compiled_filter(filter, "highway", "primary"));
+    }
+}
+
+TEST_CASE("Parallel sort") {
+    std::vector<int> data;
+    for (int i = 0; i < 1000003; ++i) {
+        data.push_back((i * 7919) % 1000003);
+    }
+    std::vector<int> expected{data};
+    std::sort(expected.begin(), expected.end(), std::greater<int>{});
+
+    SECTION("single thread") {
+        parallel_sort(data.begin(), data.end(), std::greater<int>{}, 1);
+        REQUIRE(data == expected);
+    }
+
+    SECTION("multiple threads") {
+        parallel_sort(data.begin(), data.end(), std::greater<int>{}, 5);
+        REQUIRE(data == expected);
+    }
+}
+
+TEST_CASE("Runs of objects of the same type in a buffer") {
+    osmium::memory::Buffer buffer{1024, osmium::memory::Buffer::auto_grow::yes};
+    osmium::builder::add_node(buffer, osmium::builder::attr::_id(1));
+    osmium::builder::add_node(buffer, osmium::builder::attr::_id(2));
+    osmium::builder::add_way(buffer, osmium::builder::attr::_id(3));
+    osmium::builder::add_relation(buffer, osmium::builder::attr::_id(4));
+    osmium::builder::add_relation(buffer, osmium::builder::attr::_id(5));
+
+    std::vector<osmium::item_type> types;
+    std::vector<osmium::object_id_type> ids;
+    for_each_object_run(buffer, [&](const ObjectRun& run) {
+        types.push_back(run.type());
+        if (run.type() == osmium::item_type::node) {
+            for (const auto& node : run.objects<osmium::Node>()) {
+                ids.push_back(node.id());
+            }
+        } else if (run.type() == osmium::item_type::way) {
+            for (const auto& way : run.objects<osmium::Way>()) {
+                ids.push_back(way.id());
+            }
+        } else if (run.type() == osmium::item_type::relation) {
+            for (const auto& relation : run.objects<osmium::Relation>()) {
+                ids.push_back(relation.id());
+            }
+        }
+    });
+
+    REQUIRE(types.size() == 3);
+    REQUIRE(types[0] == osmium::item_type::node);
+    REQUIRE(types[1] == osmium::item_type::way);
+    REQUIRE(types[2] == osmium::item_type::relation);
+
+    const std::vector<osmium::object_id_type> expected_ids{1, 2, 3, 4, 5};
+    REQUIRE(ids == expected_ids);
+}
+
+TEST_CASE("Runs of objects in an empty buffer") {
+    osmium::memory::Buffer buffer{1024, osmium::memory::Buffer::auto_grow::yes};
+
+    int count = 0;
+    for_each_object_run(buffer, [&](const ObjectRun& /*run*/) {
+        ++count;
+    });
+
+    REQUIRE(count == 0);
+}
+
+TEST_CASE("Read ID file") {
+    std::istringstream stream{"n12\n  w3 # comment\n\n# comment only\nr7#x\n5\n 42  foo\r\nn99"};
+    ids_type ids;
+    read_id_file(stream, ids, osmium::item_type::way);
+
+    REQUIRE(ids(osmium::item_type::node).size() == 2);
+    REQUIRE(ids(osmium::item_type::node).get(12));
+    REQUIRE(ids(osmium::item_type::node).get(99));
+    REQUIRE(ids(osmium::item_type::way).size() == 3);
+    REQUIRE(ids(osmium::item_type::way).get(3));
+    REQUIRE(ids(osmium::item_type::way).get(5));
+    REQUIRE(ids(osmium::item_type::way).get(42));
+    REQUIRE(ids(osmium::item_type::relation).size() == 1);
+    REQUIRE(ids(osmium::item_type::relation).get(7));
+}
+
+TEST_CASE("Read ID file with lines crossing chunk boundaries") {
+    std::string data;
+    for (int i = 1; i <= 300000; ++i) {
+        data += 'n';
+        data += std::to_string(i);
+        data += '\n';
+    }
+    std::istringstream stream{data};
+    ids_type ids;
+    read_id_file(stream, ids, osmium::item_type::node);
+
+    REQUIRE(ids(osmium::item_type::node).size() == 300000);
+    REQUIRE(ids(osmium::item_type::node).get(1));
+    REQUIRE(ids(osmium::item_type::node).get(300000));
+}
+
+TEST_CASE("Read ID file with negative ID") {
+    std::istringstream stream{"n1\nn-5\n"};
+    ids_type ids;
+    REQUIRE_THROWS(read_id_file(stream, ids, osmium::item_type::node));
+}
+
+TEST_CASE("Add member relations") {
+    CompactRelationsMapStash stash;
+    // chain 1 -> 2 -> ... -> 100000, a loop 10 -> 20 -> 10 and an unrelated 200001 -> 200002
+    for (osmium::object_id_type id = 1; id < 100000; ++id) {
+        stash.add(id + 1, id);
+    }
+    stash.add(20, 10);
+    stash.add(10, 20);
+    stash.add(200002, 200001);
+    const auto rel_in_rel = stash.build_parent_to_member_index();
+
+    ids_type ids;
+    ids(osmium::item_type::relation).set(1);
+    add_member_relations(rel_in_rel, ids(osmium::item_type::relation));
+
+    REQUIRE(ids(osmium::item_type::relation).size() == 100000);
+    REQUIRE(ids(osmium::item_type::relation).get(100000));
+    REQUIRE_FALSE(ids(osmium::item_type::relation).get(200002));
+}
+
+TEST_CASE("Compact relations map index") {
+    CompactRelationsMapStash stash;
+    // Enough parents for several blocks, one member with two parents and
+    // one pair that needs 64 bit IDs.
+    for (osmium::unsigned_object_id_type id = 1; id <= 1000; ++id) {
+        stash.add(id * 3, id);
+    }
+    stash.add(30, 2000);
+    stash.add(30, 2000);
+    stash.add(5000000000ULL, 7);
+    REQUIRE(stash.size() == 1003);
+
+    const auto member_to_parent = stash.build_member_to_parent_index();
+    REQUIRE(stash.empty());
+    REQUIRE(member_to_parent.size() == 1002);
+
+    const auto parents = [&member_to_parent](osmium::unsigned_object_id_type id) -> std::vector<osmium::unsigned_object_id_type> {
+        std::vector<osmium::unsigned_object_id_type> result;
+        member_to_parent.for_each_parent(id, [&result](osmium::unsigned_object_id_type parent) {
+            result.push_back(parent);
+        });
+        return result;
+    };
+
+    REQUIRE(parents(3) == std::vector<osmium::unsigned_object_id_type>{1});
+    REQUIRE(parents(30) == (std::vector<osmium::unsigned_object_id_type>{10, 2000}));
+    REQUIRE(parents(2997) == std::vector<osmium::unsigned_object_id_type>{999});
+    REQUIRE(parents(3000) == std::vector<osmium::unsigned_object_id_type>{1000});
+    REQUIRE(parents(5000000000ULL) == std::vector<osmium::unsigned_object_id_type>{7});
+    REQUIRE(parents(0).empty());
+    REQUIRE(parents(4).empty());
+    REQUIRE(parents(3001).empty());
+}
+
+TEST_CASE("Compact relations map index from parents to members") {
+    CompactRelationsMapStash stash;
+    stash.add(2, 1);
+    stash.add(3, 1);
+    stash.add(3, 2);
+
+    const auto parent_to_member = stash.build_parent_to_member_index();
+    std::vector<osmium::unsigned_object_id_type> members;
+    parent_to_member.for_each(1, [&members](osmium::unsigned_object_id_type member) {
+        members.push_back(member);
+    });
+    REQUIRE(members == (std::vector<osmium::unsigned_object_id_type>{2, 3}));
+}
+
+static bool all_index_types(const std::string& /*type*/) {
+    return true;
+}
+
+TEST_CASE("Choose location index without node statistics") {
+    const pbf_node_id_stats stats;
+    REQUIRE(select_location_index(stats, 1024 * 1024 * 1024, all_index_types).type == "flex_mem");
+}
+
+TEST_CASE("Choose location index with unknown memory") {
+    pbf_node_id_stats stats;
+    stats.valid = true;
+    stats.nodes = 1000;
+    stats.max_id = 1000;
+    REQUIRE(select_location_index(stats, 0, all_index_types).type == "flex_mem");
+}
+
+TEST_CASE("Choose dense location index if it fits") {
+    pbf_node_id_stats stats;
+    stats.valid = true;
+    stats.nodes = 1000;
+    stats.max_id = 1000000;
+    REQUIRE(select_location_index(stats, 1024 * 1024 * 1024, all_index_types).type == "dense_mmap_array");
+    REQUIRE(select_location_index(stats, 1024 * 1024 * 1024, [](const std::string& type) {
+        return type.find("mmap") == std::string::npos;
+    }).type == "dense_mem_array");
+}
+
+TEST_CASE("Choose sparse location index if dense index doesn't fit") {
+    pbf_node_id_stats stats;
+    stats.valid = true;
+    stats.nodes = 1000;
+    stats.max_id = 1000000000;
+    const auto choice = select_location_index(stats, 1024 * 1024 * 1024, all_index_types);
+    REQUIRE(choice.type == "sparse_mmap_array");
+    REQUIRE_FALSE(choice.reason.empty());
+}
+
+TEST_CASE("Choose smaller location index if nothing fits") {
+    pbf_node_id_stats stats;
+    stats.valid = true;
+    stats.nodes = 900000000;
+    stats.max_id = 1000000000;
+    REQUIRE(select_location_index(stats, 1024 * 1024 * 1024, all_index_types).type == "dense_mmap_array");
+}
+
+TEST_CASE("Index file is only used again if complete and built from the same input") {
+    const std::vector<osmium::io::File> input{osmium::io::File{"test/cat/input1.osm"}};
+    const std::string identity{index_file_identity("dense_file_array", input)};
+    REQUIRE_FALSE(identity.empty());
+    REQUIRE(identity == index_file_identity("dense_file_array", input));
+    REQUIRE(identity != index_file_identity("sparse_file_array", input));
+    REQUIRE(identity != index_file_identity("dense_file_array", {osmium::io::File{"test/cat/input2.osm"}}));
+    REQUIRE(index_file_identity("dense_file_array", {osmium::io::File{"-", "osm"}}).empty());
+
+    const std::string filename{default_temp_directory() + "/osmium-test-locations.idx"};
+    clear_index_file(filename);
+    {
+        std::ofstream out{partial_index_filename(filename)};
+        out << "index";
+    }
+    REQUIRE_FALSE(is_complete_index_file(filename, identity));
+
+    complete_index_file(filename, identity);
+    REQUIRE(is_complete_index_file(filename, identity));
+    REQUIRE_FALSE(is_complete_index_file(filename, index_file_identity("sparse_file_array", input)));
+
+    clear_index_file(filename);
+    REQUIRE_FALSE(is_complete_index_file(filename, identity));
+    REQUIRE(std::remove(filename.c_str()) == 0);
+}
+
+TEST_CASE("PBF header keeps the features of the input") {
+    osmium::io::Header header;
+    header.set("generator", "test");
+    header.set("sorting", "Type_then_ID");
+    header.set("pbf_optional_feature_0", "Sort.Type_then_ID");
+    header.set("pbf_optional_feature_1", "LocationsOnWays");
+    header.set("pbf_required_feature_0", "Foo");
+
+    const std::string filename{default_temp_directory() + "/osmium-test-features.osm.pbf"};
+    {
+        PBFBlockWriter writer{filename, header, osmium::io::overwrite::allow, osmium::io::fsync::no};
+        writer.close();
+    }
+
+    PBFBlockReader reader{filename};
+    pbf_block block;
+    REQUIRE(reader.read(block));
+    const auto decoded = decode_pbf_header(block);
+    REQUIRE(decoded.get("sorting") == "Type_then_ID");
+    REQUIRE(get_pbf_features(decoded) == get_pbf_features(header));
+    REQUIRE(get_pbf_features(decoded) == std::vector<std::string>{"Foo", "optional LocationsOnWays"});
+
+    osmium::io::Header copy;
+    copy_pbf_features(decoded, copy);
+    REQUIRE(get_pbf_features(copy) == get_pbf_features(header));
+
+    std::remove(filename.c_str());
+}
+
+TEST_CASE("Small adaptive ID set") {
+    AdaptiveIdSet set;
+    REQUIRE(set.empty());
+
+    set.set(17);
+    set.set(3);
+    set.set(42);
+    set.set(3);
+    REQUIRE_FALSE(set.is_dense());
+    REQUIRE(set.size() == 3);
+    REQUIRE(set.get(3));
+    REQUIRE(set.get(17));
+    REQUIRE_FALSE(set.get(18));
+    REQUIRE_FALSE(set.check_and_set(42));
+    REQUIRE(set.check_and_set(1));
+
+    set.unset(17);
+    const std::vector<osmium::unsigned_object_id_type> ids(set.begin(), set.end());
+    const std::vector<osmium::unsigned_object_id_type> expected = {1, 3, 42};
+    REQUIRE(ids == expected);
+}
+
+TEST_CASE("Adaptive ID set switches to dense set") {
+    AdaptiveIdSet set;
+    for (osmium::unsigned_object_id_type id = 100000; id > 0; id -= 10) {
+        set.set(id);
+    }
+    REQUIRE(set.is_dense());
+    REQUIRE(set.size() == 10000);
+    REQUIRE(set.get(10));
+    REQUIRE(set.get(100000));
+    REQUIRE_FALSE(set.get(11));
+
+    osmium::unsigned_object_id_type expected = 10;
+    for (const auto id : set) {
+        REQUIRE(id == expected);
+        expected += 10;
+    }
+
+    set.clear();
+    REQUIRE(set.empty());
+    REQUIRE_FALSE(set.is_dense());
+}
+
+TEST_CASE("Parse changeset attributes") {
+    const std::string attrs{R"( id="1" created_at="2013-03-22T02:08:55Z" num_changes="10" closed_at="2013-03-22T02:08:58Z" open="false" min_lon="120.5" min_lat="-10.5" max_lon="121" max_lat="-10" user='Elbert' uid="1237205" comments_count="2")"};
+    changeset_summary summary;
+    REQUIRE(parse_changeset_attributes(attrs.data(), attrs.data() + attrs.size(), summary));
+    REQUIRE(summary.created_at() == osmium::Timestamp{"2013-03-22T02:08:55Z"});
+    REQUIRE(summary.closed_at() == osmium::Timestamp{"2013-03-22T02:08:58Z"});
+    REQUIRE(summary.closed());
+    REQUIRE(summary.num_changes() == 10);
+    REQUIRE(summary.num_comments() == 2);
+    REQUIRE(std::string{summary.user()} == "Elbert");
+    REQUIRE(summary.uid() == 1237205);
+    REQUIRE(summary.bounds().valid());
+    REQUIRE(summary.bounds().bottom_left() == osmium::Location(120.5, -10.5));
+}
+
+TEST_CASE("Parse changeset attributes which can't be interpreted") {
+    changeset_summary summary;
+    const std::string entity{R"( user="A &amp; B")"};
+    REQUIRE_FALSE(parse_changeset_attributes(entity.data(), entity.data() + entity.size(), summary));
+    const std::string partial_bbox{R"( min_lon="1" min_lat="2")"};
+    REQUIRE_FALSE(parse_changeset_attributes(partial_bbox.data(), partial_bbox.data() + partial_bbox.size(), summary));
+    const std::string bad_uid{R"( uid="x")"};
+    REQUIRE_FALSE(parse_changeset_attributes(bad_uid.data(), bad_uid.data() + bad_uid.size(), summary));
+}
+
+TEST_CASE("Prefilter changesets in XML data") {
+    std::string data{"<osm version=\"0.6\">"
+                     "<changeset id=\"1\" uid=\"10\" user=\"a>b\"><discussion><comment><text>x</text></comment></discussion></changeset>"
+                     "<changeset id=\"2\" uid=\"20\"/>"
+                     "<changeset id=\"3\" uid=\"10\"><tag k=\"a\" v=\"b\"/></changeset>"
+                     "</osm>"};
+    const auto removed = prefilter_xml_changesets(data, [](const changeset_summary& summary) {
+        return summary.uid() == 20;
+    });
+    REQUIRE(removed == 2);
+    REQUIRE(data == "<osm version=\"0.6\"><changeset id=\"2\" uid=\"20\"/></osm>");
+}
+
+TEST_CASE("SHA-256 digest") {
+    SHA256 empty;
+    REQUIRE(empty.hex_digest() == "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+
+    SHA256 abc;
+    abc.update("a", 1);
+    abc.update("bc", 2);
+    REQUIRE(abc.hex_digest() == "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+
+    const std::string data(1000000, 'a');
+    SHA256 million;
+    million.update(data.data(), data.size());
+    REQUIRE(million.hex_digest() == "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+}
+
+namespace {
+
+    // Cache directory for the result cache tests, removed with everything
+    // in it (results and memoized file digests) at the end of the test.
+    class TestCacheDirectory {
+
+        std::string m_path;
+
+    public:
+
+        TestCacheDirectory() :
+            m_path(default_temp_directory() + "/osmium-test-cache-" + std::to_string(::getpid())) {
+            REQUIRE(::mkdir(m_path.c_str(), 0700) == 0);
+        }
+
+        ~TestCacheDirectory() {
+            DIR* dir = ::opendir(m_path.c_str());
+            if (dir) {
+                while (const struct dirent* entry = ::readdir(dir)) {
+                    const std::string name{entry->d_name};
+                    if (name != "." && name != "..") {
+                        ::unlink((m_path + "/" + name).c_str());
+                    }
+                }
+                ::closedir(dir);
+            }
+            ::rmdir(m_path.c_str());
+        }
+
+        TestCacheDirectory(const TestCacheDirectory&) = delete;
+        TestCacheDirectory& operator=(const TestCacheDirectory&) = delete;
+
+        const std::string& path() const noexcept {
+            return m_path;
+        }
+
+    }; // class TestCacheDirectory
+
+} // anonymous namespace
+
+TEST_CASE("Result cache key ignores options which don't change the output") {
+    const TestCacheDirectory cache_dir;
+    const ResultCache cache1{cache_dir.path(), "cat", {"-o", "out1.osm", "test/cat/input1.osm"}, "out1.osm"};
+    const ResultCache cache2{cache_dir.path(), "cat", {"-v", "--threads=4", "test/cat/input1.osm", "--output=out2.osm", "-O"}, "out2.osm"};
+    REQUIRE(cache1.key().size() == 64);
+    REQUIRE(cache1.key() == cache2.key());
+    REQUIRE(cache1.filename() == cache_dir.path() + "/" + cache1.key());
+}
+
+TEST_CASE("Result cache key depends on command, arguments, input, and output format") {
+    const TestCacheDirectory cache_dir;
+    const ResultCache cache{cache_dir.path(), "cat", {"-o", "out.osm", "test/cat/input1.osm"}, "out.osm"};
+    REQUIRE(cache.key() != ResultCache(cache_dir.path(), "sort", {"-o", "out.osm", "test/cat/input1.osm"}, "out.osm").key());
+    REQUIRE(cache.key() != ResultCache(cache_dir.path(), "cat", {"-o", "out.osm", "-t", "node", "test/cat/input1.osm"}, "out.osm").key());
+    REQUIRE(cache.key() != ResultCache(cache_dir.path(), "cat", {"-o", "out.osm", "test/cat/input2.osm"}, "out.osm").key());
+    REQUIRE(cache.key() != ResultCache(cache_dir.path(), "cat", {"-o", "out.osm.pbf", "test/cat/input1.osm"}, "out.osm.pbf").key());
+}
+
+TEST_CASE("Result cache can not be used with STDIN or STDOUT") {
+    const TestCacheDirectory cache_dir;
+    REQUIRE_THROWS_AS(ResultCache(cache_dir.path(), "cat", {"-F", "osm", "-o", "out.osm", "-"}, "out.osm"), const argument_error&);
+    REQUIRE_THROWS_AS(ResultCache(cache_dir.path(), "cat", {"-f", "osm", "test/cat/input1.osm"}, ""), const argument_error&);
+    REQUIRE_THROWS_AS(ResultCache("test/no-such-dir", "cat", {"-o", "out.osm", "test/cat/input1.osm"}, "out.osm"), const argument_error&);
+}
+
+TEST_CASE("Result cache can not be used with remote files or state kept in other files") {
+    const TestCacheDirectory cache_dir;
+    REQUIRE_THROWS_AS(ResultCache(cache_dir.path(), "cat", {"-o", "out.osm", "https://example.com/input.osm"}, "out.osm"), const argument_error&);
+    REQUIRE_THROWS_AS(ResultCache(cache_dir.path(), "renumber", {"-o", "out.osm", "-i", "test", "test/cat/input1.osm"}, "out.osm"), const argument_error&);
+    REQUIRE_THROWS_AS(ResultCache(cache_dir.path(), "renumber", {"-o", "out.osm", "--index-directory=test", "test/cat/input1.osm"}, "out.osm"), const argument_error&);
+    REQUIRE_THROWS_AS(ResultCache(cache_dir.path(), "add-locations-to-ways", {"-o", "out.osm", "--index-file=idx", "test/cat/input1.osm"}, "out.osm"), const argument_error&);
+    REQUIRE_THROWS_AS(ResultCache(cache_dir.path(), "add-locations-to-ways", {"-o", "out.osm", "-i", "dense_file_array,idx", "test/cat/input1.osm"}, "out.osm"), const argument_error&);
+    REQUIRE_THROWS_AS(ResultCache(cache_dir.path(), "apply-changes", {"-o", "out.osm", "--store=store", "test/cat/input1.osm"}, "out.osm"), const argument_error&);
+    REQUIRE_NOTHROW(ResultCache(cache_dir.path(), "add-locations-to-ways", {"-o", "out.osm", "-i", "flex_mem", "test/cat/input1.osm"}, "out.osm"));
+}
+
+TEST_CASE("Output files fetched from the result cache can be overwritten") {
+    const TestCacheDirectory cache_dir;
+    const std::string output{cache_dir.path() + "/osmium-test-result-cache.opl"};
+    const ResultCache cache{cache_dir.path(), "cat", {"-o", output, "test/cat/input1.osm"}, output};
+    {
+        std::ofstream out{output};
+        out << "n1\n";
+    }
+    cache.store(output);
+    REQUIRE(std::remove(output.c_str()) == 0);
+
+    REQUIRE(cache.fetch(output, osmium::io::overwrite::no));
+    {
+        std::ofstream out{output, std::ios::trunc};
+        REQUIRE(out.is_open());
+    }
+}
+
+TEST_CASE("Detect remote file URLs") {
+    REQUIRE(is_remote_url("https://example.com/planet.osm.pbf"));
+    REQUIRE(is_remote_url("http://example.com/planet.osm.pbf"));
+    REQUIRE(is_remote_url("s3://bucket/planet.osm.pbf"));
+    REQUIRE_FALSE(is_remote_url("planet.osm.pbf"));
+    REQUIRE_FALSE(is_remote_url("/data/https/planet.osm.pbf"));
+    REQUIRE_FALSE(is_remote_url("-"));
+}
+
+TEST_CASE("Convert S3 URLs into https URLs") {
+    ::unsetenv("OSMIUM_S3_ENDPOINT");
+    ::setenv("AWS_REGION", "eu-central-1", 1);
+    REQUIRE(remote_url("s3://bucket/dir/planet.osm.pbf") == "https://bucket.s3.eu-central-1.amazonaws.com/dir/planet.osm.pbf");
+    REQUIRE(remote_url("https://example.com/planet.osm.pbf") == "https://example.com/planet.osm.pbf");
+    REQUIRE(remote_url("planet.osm.pbf") == "planet.osm.pbf");
+
+    ::setenv("OSMIUM_S3_ENDPOINT", "http://localhost:9000/", 1);
+    REQUIRE(remote_url("s3://bucket/planet.osm.pbf") == "http://localhost:9000/bucket/planet.osm.pbf");
+    ::unsetenv("OSMIUM_S3_ENDPOINT");
+    ::unsetenv("AWS_REGION");
+
+    REQUIRE_THROWS_AS(remote_url("s3://bucket"), const argument_error&);
+    REQUIRE_THROWS_AS(remote_url("s3://bucket/"), const argument_error&);
+    REQUIRE_THROWS_AS(remote_url("s3:///planet.osm.pbf"), const argument_error&);
+}
+
+namespace {
+
+    // Minimal HTTP server on a local port answering requests for a file
+    // with the data in a thread of its own. Each connection gets one
+    // response.
+    class TestHttpServer {
+
+    public:
+
+        enum class ranges {
+            supported, // range requests get 206 responses
+            ignored,   // the whole file is sent for range requests
+            none       // "Accept-Ranges: none" in response to HEAD
+        };
+
+    private:
+
+        std::string m_data;
+        ranges m_ranges;
+        int m_fd = -1;
+        int m_port = 0;
+        std::atomic<bool> m_done{false};
+        std::thread m_thread;
+
+        std::string response(const std::string& request) const {
+            const auto size = std::to_string(m_data.size());
+            if (request.compare(0, 5, "HEAD ") == 0) {
+                return "HTTP/1.1 200 OK\r\nContent-Length: " + size + "\r\n" +
+                       (m_ranges == ranges::none ? "Accept-Ranges: none\r\n" : "Accept-Ranges: bytes\r\n") +
+                       "Connection: close\r\n\r\n";
+            }
+
+            const auto pos = request.find("Range: bytes=");
+            if (pos == std::string::npos || m_ranges != ranges::supported) {
+                return "HTTP/1.1 200 OK\r\nContent-Length: " + size + "\r\nConnection: close\r\n\r\n" + m_data;
+            }
+            const auto first = std::stoul(request.substr(pos + 13));
+            auto last = std::stoul(request.substr(request.find('-', pos + 13) + 1));
+            last = std::min(last, m_data.size() - 1);
+            return "HTTP/1.1 206 Partial Content\r\nContent-Length: " + std::to_string(last - first + 1) +
+                   "\r\nContent-Range: bytes " + std::to_string(first) + "-" + std::to_string(last) + "/" + size +
+                   "\r\nConnection: close\r\n\r\n" + m_data.substr(first, last - first + 1);
+        }
+
+        void serve() {
+            while (true) {
+                const int fd = ::accept(m_fd, nullptr, nullptr);
+                if (m_done) {
+                    if (fd >= 0) {
+                        ::close(fd);
+                    }
+                    return;
+                }
+                if (fd < 0) {
+                    continue;
+                }
+                std::string request;
+                char buffer[4096];
+                while (request.find("\r\n\r\n") == std::string::npos) {
+                    const auto n = ::read(fd, buffer, sizeof(buffer));
+                    if (n <= 0) {
+                        break;
+                    }
+                    request.append(buffer, static_cast<std::size_t>(n));
+                }
+                const auto data = response(request);
+                std::size_t done = 0;
+                while (done < data.size()) {
+                    const auto n = ::send(fd, data.data() + done, data.size() - done, MSG_NOSIGNAL);
+                    if (n <= 0) {
+                        break;
+                    }
+                    done += static_cast<std::size_t>(n);
+                }
+                ::close(fd);
+            }
+        }
+
+    public:
+
+        TestHttpServer(const std::string& data, ranges r) :
+            m_data(data),
+            m_ranges(r) {
+            m_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+            REQUIRE(m_fd >= 0);
+            sockaddr_in address{};
+            address.sin_family = AF_INET;
+            address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            socklen_t length = sizeof(address);
+            REQUIRE(::bind(m_fd, reinterpret_cast<sockaddr*>(&address), length) == 0); // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
+            REQUIRE(::listen(m_fd, 16) == 0);
+            REQUIRE(::getsockname(m_fd, reinterpret_cast<sockaddr*>(&address), &length) == 0); // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
+            m_port = ntohs(address.sin_port);
+            m_thread = std::thread{&TestHttpServer::serve, this};
+        }
+
+        TestHttpServer(const TestHttpServer&) = delete;
+        TestHttpServer& operator=(const TestHttpServer&) = delete;
+
+        TestHttpServer(TestHttpServer&&) = delete;
+        TestHttpServer& operator=(TestHttpServer&&) = delete;
+
+        ~TestHttpServer() noexcept {
+            // Wake up the server thread with a last connection.
+            m_done = true;
+            const int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+            sockaddr_in address{};
+            address.sin_family = AF_INET;
+            address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            address.sin_port = htons(static_cast<uint16_t>(m_port));
+            ::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)); // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
+            m_thread.join();
+            ::close(fd);
+            ::close(m_fd);
+        }
+
+        std::string url() const {
+            return "http://127.0.0.1:" + std::to_string(m_port) + "/data.osm.pbf";
+        }
+
+    }; // class TestHttpServer
+
+    bool has_curl() {
+        return std::system("curl --version >/dev/null 2>&1") == 0;
+    }
+
+    std::string test_data() {
+        std::string data;
+        for (int i = 0; i < 1000; ++i) {
+            data += static_cast<char>('a' + i % 26);
+        }
+        return data;
+    }
+
+} // anonymous namespace
+
+TEST_CASE("Read remote file with range requests") {
+    if (!has_curl()) {
+        return;
+    }
+    const auto data = test_data();
+    const TestHttpServer server{data, TestHttpServer::ranges::supported};
+
+    RemoteFile file{server.url()};
+    REQUIRE(file.size() == data.size());
+
+    std::string buffer(100, ' ');
+    REQUIRE(file.read(0, &buffer[0], buffer.size()) == 100);
+    REQUIRE(buffer == data.substr(0, 100));
+
+    file.set_random_access();
+    REQUIRE(file.read(950, &buffer[0], buffer.size()) == 50);
+    REQUIRE(buffer.substr(0, 50) == data.substr(950));
+}
+
+TEST_CASE("Remote file on server ignoring range requests") {
+    if (!has_curl()) {
+        return;
+    }
+    const TestHttpServer server{test_data(), TestHttpServer::ranges::ignored};
+
+    RemoteFile file{server.url()};
+    file.set_random_access();
+    std::string buffer(10, ' ');
+    REQUIRE_THROWS_AS(file.read(500, &buffer[0], buffer.size()), const osmium::io_error&);
+}
+
+TEST_CASE("Remote file on server without range requests") {
+    if (!has_curl()) {
+        return;
+    }
+    const TestHttpServer server{test_data(), TestHttpServer::ranges::none};
+
+    REQUIRE_THROWS_AS(RemoteFile{server.url()}, const osmium::io_error&);
+}
+
+TEST_CASE("Metrics are written as JSON") {
+    osmium::memory::Buffer buffer{1024, osmium::memory::Buffer::auto_grow::yes};
+    osmium::builder::add_node(buffer, osmium::builder::attr::_id(1));
+    osmium::builder::add_node(buffer, osmium::builder::attr::_id(2));
+    osmium::builder::add_way(buffer, osmium::builder::attr::_id(3));
+
+    Metrics metrics;
+    metrics.enable();
+    metrics.start_phase("read");
+    metrics.add_buffer(buffer);
+    metrics.start_phase("write");
+    metrics.add("bytes_written", 100);
+    metrics.add("bytes_written", 23);
+    metrics.set_max("index_memory", 7);
+    metrics.set_max("index_memory", 5);
+
+    rapidjson::Document doc;
+    REQUIRE_FALSE(doc.Parse(metrics.json("sort", true).c_str()).HasParseError());
+    REQUIRE(doc.IsObject());
+
+    REQUIRE(std::string{doc["command"].GetString()} == "sort");
+    REQUIRE(doc["success"].GetBool());
+    REQUIRE(doc["wall_time"].GetDouble() >= 0.0);
+    REQUIRE(doc["cpu_time"].GetDouble() >= 0.0);
+
+    const auto& phases = doc["phases"];
+    REQUIRE(phases.IsArray());
+    REQUIRE(phases.Size() == 2);
+    REQUIRE(std::string{phases[0]["name"].GetString()} == "read");
+    REQUIRE(std::string{phases[1]["name"].GetString()} == "write");
+    REQUIRE(phases[1].HasMember("wall_time"));
+    REQUIRE(phases[1].HasMember("cpu_time"));
+
+    const auto& counters = doc["counters"];
+    REQUIRE(counters["buffers"].GetUint64() == 1);
+    REQUIRE(counters["nodes"].GetUint64() == 2);
+    REQUIRE(counters["ways"].GetUint64() == 1);
+    REQUIRE(counters["relations"].GetUint64() == 0);
+    REQUIRE(counters["bytes_written"].GetUint64() == 123);
+
+    REQUIRE(doc["values"]["index_memory"].GetUint64() == 7);
+}
+
+TEST_CASE("Metrics are not recorded unless enabled") {
+    Metrics metrics;
+    metrics.start_phase("read");
+    metrics.add("bytes_written", 100);
+
+    rapidjson::Document doc;
+    REQUIRE_FALSE(doc.Parse(metrics.json("cat", false).c_str()).HasParseError());
+    REQUIRE_FALSE(doc["success"].GetBool());
+    REQUIRE(doc["phases"].Size() == 0);
+    REQUIRE(doc["counters"].ObjectEmpty());
+}
+
+TEST_CASE("Read ahead opens the configured number of files after the current one") {
+    const std::vector<osmium::io::File> files{osmium::io::File{"test/cat/input1.osm"},
+                                              osmium::io::File{"test/cat/input2.osm"},
+                                              osmium::io::File{"test/cat/input1.osm"}};
+
+    SECTION("no read ahead") {
+        ReadAhead inputs{files, osmium::osm_entity_bits::nothing, 0};
+        for (std::size_t i = 0; i < files.size(); ++i) {
+            REQUIRE(inputs.next());
+            REQUIRE(inputs.num_open() == 0);
+        }
+        REQUIRE_FALSE(inputs.next());
+    }
+
+    SECTION("read ahead one file") {
+        ReadAhead inputs{files, osmium::osm_entity_bits::nothing, 1};
+        REQUIRE(inputs.next());
+        REQUIRE(inputs.num_open() == 1);
+        REQUIRE(inputs.next());
+        REQUIRE(inputs.num_open() == 1);
+        REQUIRE(inputs.next());
+        REQUIRE(inputs.num_open() == 0);
+        REQUIRE_FALSE(inputs.next());
+    }
+}